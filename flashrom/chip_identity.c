@@ -0,0 +1,160 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * The chip header shared by the manifest and the journal files, and the line
+ * parsing both of them use.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip_identity.h"
+#include "flash.h"
+
+static const char *str_or_empty(const char *s)
+{
+	return s ? s : "";
+}
+
+/* Describes the chip, dropping what the identity held before. */
+int chip_identity_set(struct chip_identity *id, const struct flashchip *chip)
+{
+	chip_identity_clear(id);
+	id->vendor = strdup(str_or_empty(chip->vendor));
+	id->name = strdup(str_or_empty(chip->name));
+	if (!id->vendor || !id->name) {
+		msg_gerr("Out of memory!\n");
+		chip_identity_clear(id);
+		return 1;
+	}
+	id->manufacture_id = chip->manufacture_id;
+	id->model_id = chip->model_id;
+	id->chip_size = chip->total_size * 1024;
+	id->block_size = chip_min_block_size(chip);
+	return 0;
+}
+
+void chip_identity_clear(struct chip_identity *id)
+{
+	free(id->vendor);
+	free(id->name);
+	memset(id, 0, sizeof(*id));
+}
+
+bool chip_identity_matches(const struct chip_identity *id, const struct flashchip *chip)
+{
+	return id->chip_size == chip->total_size * 1024 &&
+		id->block_size == chip_min_block_size(chip) &&
+		id->manufacture_id == chip->manufacture_id &&
+		id->model_id == chip->model_id &&
+		!strcmp(str_or_empty(id->vendor), str_or_empty(chip->vendor)) &&
+		!strcmp(str_or_empty(id->name), str_or_empty(chip->name));
+}
+
+/* Room chip_identity_to_text() needs, including a header of up to 64 characters. */
+size_t chip_identity_text_size(const struct chip_identity *id)
+{
+	return 256 + strlen(str_or_empty(id->vendor)) + strlen(str_or_empty(id->name));
+}
+
+/* Writes the header lines to out, returns their length. */
+size_t chip_identity_to_text(const struct chip_identity *id, const char *header, char *out, size_t capacity)
+{
+	return snprintf(out, capacity, "%s\nvendor %s\nname %s\nid 0x%"PRIx32" 0x%"PRIx32"\n"
+			"size %zu\nblock_size %zu\n", header,
+			str_or_empty(id->vendor), str_or_empty(id->name),
+			id->manufacture_id, id->model_id, id->chip_size, id->block_size);
+}
+
+/* Returns the value of line if it starts with key and a space, NULL otherwise. */
+const char *text_line_value(const char *line, const char *key)
+{
+	const size_t len = strlen(key);
+
+	if (strncmp(line, key, len) || line[len] != ' ')
+		return NULL;
+	return line + len + 1;
+}
+
+/*
+ * Parses header line lineno, one of the first CHIP_IDENTITY_LINES. A size of
+ * 0 is an identity that was never set, it has no blocks either.
+ * Returns 0 on success, 1 if out of memory and 2 if the line is invalid.
+ */
+int chip_identity_parse_line(struct chip_identity *id, const char *header, unsigned int lineno, const char *line)
+{
+	const char *value;
+	unsigned long long a, b;
+	char extra;
+
+	switch (lineno) {
+	case 0:
+		return strcmp(line, header) ? 2 : 0;
+	case 1:
+		if (!(value = text_line_value(line, "vendor")))
+			return 2;
+		return (id->vendor = strdup(value)) ? 0 : 1;
+	case 2:
+		if (!(value = text_line_value(line, "name")))
+			return 2;
+		return (id->name = strdup(value)) ? 0 : 1;
+	case 3:
+		if (!(value = text_line_value(line, "id")) || sscanf(value, "%llx %llx%c", &a, &b, &extra) != 2 ||
+		    a > UINT32_MAX || b > UINT32_MAX)
+			return 2;
+		id->manufacture_id = a;
+		id->model_id = b;
+		return 0;
+	case 4:
+		if (!(value = text_line_value(line, "size")) || sscanf(value, "%llu%c", &a, &extra) != 1)
+			return 2;
+		id->chip_size = a;
+		return 0;
+	case 5:
+		if (!(value = text_line_value(line, "block_size")) || sscanf(value, "%llu%c", &a, &extra) != 1)
+			return 2;
+		if (!id->chip_size)
+			return a ? 2 : 0;
+		if (!a || id->chip_size % a)
+			return 2;
+		id->block_size = a;
+		return 0;
+	default:
+		return 2;
+	}
+}
+
+/*
+ * Calls parse_line for every line of buffer, until it fails. The last line
+ * doesn't need a newline. lineno is set to the number of lines parsed.
+ * Returns 0 on success, 1 if out of memory, or what parse_line failed with.
+ */
+int text_parse_lines(const char *buffer, size_t len, unsigned int *lineno,
+		     int (*parse_line)(void *data, unsigned int lineno, const char *line), void *data)
+{
+	char *text = malloc(len + 1);
+	if (!text) {
+		msg_gerr("Out of memory!\n");
+		return 1;
+	}
+	memcpy(text, buffer, len);
+	text[len] = '\0';
+
+	int ret = 0;
+	*lineno = 0;
+	for (char *line = text; *line; (*lineno)++) {
+		char *eol = strchr(line, '\n');
+		if (eol)
+			*eol = '\0';
+		ret = parse_line(data, *lineno, line);
+		if (ret)
+			break;
+		line = eol ? eol + 1 : line + strlen(line);
+	}
+	free(text);
+	return ret;
+}
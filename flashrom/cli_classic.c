@@ -16,14 +16,18 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <cli_getopt.h>
 #include <cli_output.h>
 #include <time.h>
+#include <unistd.h>
 #include "flash.h"
 #include "flashchips.h"
 #include "fmap.h"
+#include "image_index.h"
 #include "programmer.h"
 #include "libflashrom.h"
+#include "serve.h"
 
 #if CONFIG_RPMC_ENABLED == 1
 #include "rpmc.h"
@@ -45,6 +49,16 @@ enum {
 	OPTION_WP_LIST,
 	OPTION_PROGRESS,
 	OPTION_SACRIFICE_RATIO,
+	OPTION_DRY_RUN,
+	OPTION_ERASE_PLANNER,
+	OPTION_MANIFEST,
+	OPTION_TRUST_MANIFEST,
+	OPTION_JOURNAL,
+	OPTION_RESUME,
+	OPTION_SERVE,
+	OPTION_SCAN_IMAGE,
+	OPTION_STATS,
+	OPTION_TRACE,
 #if CONFIG_RPMC_ENABLED == 1
 	OPTION_RPMC_READ_DATA,
 	OPTION_RPMC_WRITE_ROOT_KEY,
@@ -84,6 +98,16 @@ struct cli_options {
 	char *referencefile;
 	const char *chip_to_probe;
 	int sacrifice_ratio;
+	bool dry_run;
+	bool cost_erase_planner;
+	char *manifest_file;
+	bool trust_manifest;
+	char *journal_file;
+	bool resume;
+	char *serve_socket;
+	char *scan_image_file;
+	bool show_stats, stats_json;
+	char *trace_file;
 
 #if CONFIG_RPMC_ENABLED == 1
 	bool rpmc_read_data;
@@ -99,7 +123,7 @@ struct cli_options {
 
 static void cli_classic_usage(const char *name)
 {
-	printf("Usage: %s [-h|-R|-L|"
+	printf("Usage: %s [-h|-R|-L|--scan-image <file>|"
 	       "\n\t-p <programmername>[:<parameters>] [-c <chipname>]\n"
 	       "\t\t(--flash-name|--flash-size|\n"
 	       "\t\t [-E|-x|(-r|-w|-v) [<file>]]\n"
@@ -150,6 +174,26 @@ static void cli_classic_usage(const char *name)
 	       "                                    operation VS the longevity of the chip. Default is\n"
 	       "                                    longevity.\n"
 	       "                                    DANGEROUS! It wears your chip faster!\n"
+	       "      --dry-run                     with -w, print the erase/write plan as JSON\n"
+	       "                                    instead of modifying the flash\n"
+	       "      --erase-planner <greedy|cost> select erase blocks by sacrifice ratio (default)\n"
+	       "                                    or by estimated erase and program time\n"
+	       "      --manifest <file>             keep per-block digests of the flash contents\n"
+	       "                                    in <file>, updated after every operation\n"
+	       "      --trust-manifest              with -w and --manifest, only read blocks that\n"
+	       "                                    differ from the manifest plus a sample\n"
+	       "      --journal <file>              with -w, record the progress of the write in\n"
+	       "                                    <file>, removed once the write succeeded\n"
+	       "      --resume <file>               with -w, continue the interrupted write that\n"
+	       "                                    <file> recorded and keep recording in it\n"
+	       "      --serve <socket>              keep the programmer initialised and serve\n"
+	       "                                    flashrom_client requests on <socket>\n"
+	       "      --scan-image <file>           list the FMAP, IFD, ME, UEFI and CBFS regions\n"
+	       "                                    found in <file>\n"
+	       "      --stats[=<text|json>]         print bus transactions, delays and opcode\n"
+	       "                                    latencies per stage at the end\n"
+	       "      --trace <file>                record all bus traffic to <file>, for\n"
+	       "                                    the replay programmer and flashrom_trace\n"
 #if CONFIG_RPMC_ENABLED == 1
 	       "RPMC COMMANDS\n"
 	       "      --get-rpmc-status             read the extended status\n"
@@ -586,7 +630,8 @@ static int read_buf_from_include_args(const struct flashrom_layout *const layout
  * Writes content from supplied buffer to files. If a filename is specified for
  * individual regions using the partial read syntax ('-i <region>[:<filename>]')
  * then this will write files using data from the corresponding region in the
- * supplied buffer.
+ * supplied buffer. Regions are written straight from the buffer, which may be
+ * the mapping of the main output file.
  *
  * @param layout   The layout to be used.
  * @param buf      Chip-sized buffer to read data from
@@ -625,30 +670,283 @@ static char *get_optional_filename(char *argv[])
 	return filename;
 }
 
+/* Reads the rest of file into a new buffer and closes it. */
+static int read_whole_file(FILE *file, char **buf, size_t *len)
+{
+	size_t capacity = 0;
+
+	*buf = NULL;
+	*len = 0;
+	while (!feof(file) && !ferror(file)) {
+		if (*len == capacity) {
+			capacity = capacity ? capacity * 2 : 64 * KiB;
+			char *grown = realloc(*buf, capacity);
+			if (!grown) {
+				msg_gerr("Out of memory!\n");
+				free(*buf);
+				fclose(file);
+				return 1;
+			}
+			*buf = grown;
+		}
+		*len += fread(*buf + *len, 1, capacity - *len, file);
+	}
+	const bool failed = ferror(file);
+	fclose(file);
+	if (failed) {
+		free(*buf);
+		return 2;
+	}
+	return 0;
+}
+
+static int load_manifest(const char *const filename, struct flashrom_manifest **manifest)
+{
+	FILE *file = fopen(filename, "rb");
+	if (!file) {
+		if (errno != ENOENT) {
+			msg_gerr("Error: opening manifest \"%s\" failed: %s\n", filename, strerror(errno));
+			return 1;
+		}
+		msg_ginfo("Manifest \"%s\" doesn't exist yet, it will be created.\n", filename);
+		return flashrom_manifest_new(manifest);
+	}
+
+	char *buf;
+	size_t len;
+	int ret = read_whole_file(file, &buf, &len);
+	if (ret) {
+		if (ret == 2)
+			msg_gerr("Error: reading manifest \"%s\" failed.\n", filename);
+		return 1;
+	}
+
+	ret = flashrom_manifest_read_from_buffer(manifest, buf, len);
+	free(buf);
+	if (ret == 2) {
+		msg_gwarn("Manifest \"%s\" is invalid, starting a new one.\n", filename);
+		ret = flashrom_manifest_new(manifest);
+	}
+	return ret;
+}
+
+/* Replaces the file as a whole, so an interrupted run can't leave a truncated manifest. */
+static int save_manifest(const char *const filename, const struct flashrom_manifest *manifest)
+{
+	char *text = NULL;
+
+	if (flashrom_manifest_write_to_buffer(manifest, &text))
+		return 1;
+	const int ret = replace_file(filename, text, strlen(text));
+	flashrom_data_free(text);
+	return ret;
+}
+
+struct journal_file {
+	const char *filename;
+	FILE *file;	/* Open for appending records. */
+};
+
+/*
+ * Stores the whole journal with replace_file(), records are appended and
+ * synced. A block must not be trusted once its erase started, so a record
+ * must not get lost.
+ */
+static int store_journal(const char *text, bool append, void *user_data)
+{
+	struct journal_file *const journal = user_data;
+	const size_t text_len = strlen(text);
+
+	if (append) {
+		if (!journal->file || fwrite(text, 1, text_len, journal->file) != text_len ||
+		    fflush(journal->file))
+			return 1;
+#if defined(_POSIX_FSYNC) && (_POSIX_FSYNC != -1)
+		if (fsync(fileno(journal->file)))
+			return 1;
+#endif
+		return 0;
+	}
+
+	if (journal->file) {
+		fclose(journal->file);
+		journal->file = NULL;
+	}
+
+	if (replace_file(journal->filename, text, text_len))
+		return 1;
+	journal->file = fopen(journal->filename, "ab");
+	return !journal->file;
+}
+
+static int load_journal(const char *const filename, bool resume, struct flashrom_journal **journal)
+{
+	if (!resume)
+		return flashrom_journal_new(journal);
+
+	FILE *file = fopen(filename, "rb");
+	if (!file) {
+		msg_gerr("Error: opening journal \"%s\" failed: %s\n", filename, strerror(errno));
+		return 1;
+	}
+
+	char *buf;
+	size_t len;
+	int ret = read_whole_file(file, &buf, &len);
+	if (ret) {
+		if (ret == 2)
+			msg_gerr("Error: reading journal \"%s\" failed.\n", filename);
+		return 1;
+	}
+
+	ret = flashrom_journal_read_from_buffer(journal, buf, len);
+	free(buf);
+	if (ret == 2) {
+		msg_gwarn("Journal \"%s\" is invalid, the whole chip will be read.\n", filename);
+		ret = flashrom_journal_new(journal);
+	} else if (!ret && flashrom_journal_complete(*journal)) {
+		msg_ginfo("Journal \"%s\" recorded a completed write.\n", filename);
+	}
+	return ret;
+}
+
+static void print_stats_text(const struct flashrom_stats *stats)
+{
+	msg_ginfo("%-7s %10s %12s %12s %12s %10s %9s %8s %10s\n", "stage", "time[ms]", "transactions",
+		  "bytes out", "bytes in", "bus[ms]", "wip polls", "delays", "delay[ms]");
+	for (int i = 0; i < FLASHROM_STATS_NR; i++) {
+		const struct flashrom_stage_stats *const stage = &stats->stage[i];
+		if (!stage->transactions && !stage->delays)
+			continue;
+		msg_ginfo("%-7s %10.3f %12"PRIu64" %12"PRIu64" %12"PRIu64" %10.3f %9"PRIu64" %8"PRIu64" %10.3f\n",
+			  flashrom_stats_stage_name(i), stage->time_ns / 1e6, stage->transactions,
+			  stage->bytes_out, stage->bytes_in, stage->bus_ns / 1e6, stage->wip_polls,
+			  stage->delays, stage->delay_ns / 1e6);
+	}
+
+	msg_ginfo("\n%-6s %10s %10s %10s %8s %10s %10s  %s\n", "opcode", "count", "avg[us]", "max[us]",
+		  "busy", "avg[us]", "max[us]", "latency histogram");
+	for (int i = 0; i < 256; i++) {
+		const struct flashrom_opcode_stats *const op = &stats->opcode[i];
+		if (!op->count)
+			continue;
+		msg_ginfo("0x%02x   %10"PRIu64" %10.1f %10.1f %8"PRIu64" %10.1f %10.1f ", i, op->count,
+			  op->total_ns / 1e3 / op->count, op->max_ns / 1e3, op->busy_count,
+			  op->busy_count ? op->busy_total_ns / 1e3 / op->busy_count : 0.0, op->busy_max_ns / 1e3);
+		for (int j = 0; j < FLASHROM_STATS_LATENCY_BUCKETS; j++) {
+			if (!op->latency[j])
+				continue;
+			if (j < FLASHROM_STATS_LATENCY_BUCKETS - 1)
+				msg_ginfo(" <%luus:%"PRIu64, 1UL << j, op->latency[j]);
+			else
+				msg_ginfo(" >=%luus:%"PRIu64, 1UL << (j - 1), op->latency[j]);
+		}
+		msg_ginfo("\n");
+	}
+}
+
+static void print_stats_json(const struct flashrom_stats *stats)
+{
+	printf("{\"stages\":{");
+	for (int i = 0; i < FLASHROM_STATS_NR; i++) {
+		const struct flashrom_stage_stats *const stage = &stats->stage[i];
+		printf("%s\"%s\":{\"time_ns\":%"PRIu64",\"transactions\":%"PRIu64",\"bytes_out\":%"PRIu64","
+		       "\"bytes_in\":%"PRIu64",\"bus_ns\":%"PRIu64",\"wip_polls\":%"PRIu64","
+		       "\"delays\":%"PRIu64",\"delay_ns\":%"PRIu64"}",
+		       i ? "," : "", flashrom_stats_stage_name(i), stage->time_ns, stage->transactions,
+		       stage->bytes_out, stage->bytes_in, stage->bus_ns, stage->wip_polls,
+		       stage->delays, stage->delay_ns);
+	}
+	printf("},\"opcodes\":[");
+	bool first = true;
+	for (int i = 0; i < 256; i++) {
+		const struct flashrom_opcode_stats *const op = &stats->opcode[i];
+		if (!op->count)
+			continue;
+		printf("%s{\"opcode\":%d,\"count\":%"PRIu64",\"total_ns\":%"PRIu64",\"max_ns\":%"PRIu64
+		       ",\"busy_count\":%"PRIu64",\"busy_total_ns\":%"PRIu64",\"busy_max_ns\":%"PRIu64
+		       ",\"latency\":[", first ? "" : ",", i, op->count, op->total_ns, op->max_ns,
+		       op->busy_count, op->busy_total_ns, op->busy_max_ns);
+		for (int j = 0; j < FLASHROM_STATS_LATENCY_BUCKETS; j++)
+			printf("%s%"PRIu64, j ? "," : "", op->latency[j]);
+		printf("]}");
+		first = false;
+	}
+	printf("]}\n");
+}
+
+static void print_stats(const struct flashctx *flash, bool json)
+{
+	struct flashrom_stats *const stats = malloc(sizeof(*stats));
+	if (!stats) {
+		msg_gerr("Out of memory!\n");
+		return;
+	}
+	if (!flashrom_stats_get(flash, stats)) {
+		if (json)
+			print_stats_json(stats);
+		else
+			print_stats_text(stats);
+	}
+	free(stats);
+}
+
+static int scan_image(const char *const filename)
+{
+	struct image_file image;
+	struct image_index index;
+	struct stat s;
+	int ret = 1;
+
+	if (stat(filename, &s) != 0) {
+		msg_gerr("Failed to stat image \"%s\"\n", filename);
+		return 1;
+	}
+
+	if (image_file_map(&image, filename, s.st_size, false))
+		return 1;
+	if (image_index_scan(image.buf, image.size, IMAGE_REGION_ALL, &index))
+		goto _free_ret;
+
+	if (!index.count) {
+		msg_ginfo("No known firmware structures found in \"%s\".\n", filename);
+	} else {
+		msg_ginfo("%-5s %-10s %-10s %-10s %s\n", "type", "start", "end", "header", "name");
+		for (size_t i = 0; i < index.count; i++) {
+			const struct image_region *const region = &index.regions[i];
+			msg_ginfo("%-5s 0x%08zx 0x%08zx 0x%08zx %s\n", image_region_type_name(region->type),
+				  region->start, region->end, region->structure, region->name);
+		}
+	}
+	image_index_free(&index);
+	ret = 0;
+
+_free_ret:
+	image_file_release(&image);
+	return ret;
+}
+
 static int do_read(struct flashctx *const flash, const char *const filename)
 {
+	struct image_file image;
 	int ret;
 
-	unsigned long size = flashrom_flash_getsize(flash);
-	unsigned char *buf = calloc(size, sizeof(unsigned char));
-	if (!buf) {
-		msg_gerr("Memory allocation failed!\n");
+	/* With a file the chip is read straight into its mapping. */
+	if (image_file_create(&image, filename, flashrom_flash_getsize(flash)))
 		return 1;
-	}
 
-	ret = flashrom_image_read(flash, buf, size);
+	ret = flashrom_image_read(flash, image.buf, image.size);
 	if (ret > 0)
 		goto free_out;
 
-	if (write_buf_to_include_args(get_layout(flash), buf)) {
+	if (write_buf_to_include_args(get_layout(flash), image.buf)) {
 		ret = 1;
 		goto free_out;
 	}
-	if (filename)
-		ret = write_buf_to_file(buf, size, filename);
+	ret = image_file_commit(&image);
 
 free_out:
-	free(buf);
+	image_file_release(&image);
 	return ret;
 }
 
@@ -658,71 +956,88 @@ static int do_extract(struct flashctx *const flash)
 	return do_read(flash, NULL);
 }
 
-static int do_write(struct flashctx *const flash, const char *const filename, const char *const referencefile)
+static int do_write(struct flashctx *const flash, const char *const filename, const char *const referencefile,
+		    const bool dry_run)
 {
 	const size_t flash_size = flashrom_flash_getsize(flash);
+	struct image_file newcontents = { 0 }, refcontents = { 0 };
 	int ret = 1;
 
-	uint8_t *const newcontents = malloc(flash_size);
-	uint8_t *const refcontents = referencefile ? malloc(flash_size) : NULL;
-
-	if (!newcontents || (referencefile && !refcontents)) {
-		msg_gerr("Out of memory!\n");
-		goto _free_ret;
-	}
-
-	/* Read '-w' argument first... */
+	/*
+	 * Read '-w' argument first... The image is changed in memory, by the
+	 * '-i' files and by keeping the flash contents outside the included
+	 * regions, so it is mapped copy-on-write.
+	 */
 	if (filename) {
-		if (read_buf_from_file(newcontents, flash_size, filename))
+		if (image_file_map(&newcontents, filename, flash_size, true))
 			goto _free_ret;
+	} else if (image_file_create(&newcontents, NULL, flash_size)) {
+		goto _free_ret;
 	}
 	/*
 	 * ... then update newcontents with contents from files provided to '-i'
 	 * args if needed.
 	 */
-	if (read_buf_from_include_args(get_layout(flash), newcontents))
+	if (read_buf_from_include_args(get_layout(flash), newcontents.buf))
 		goto _free_ret;
 
 	if (referencefile) {
-		if (read_buf_from_file(refcontents, flash_size, referencefile))
+		if (image_file_map(&refcontents, referencefile, flash_size, false))
 			goto _free_ret;
 	}
 
-	ret = flashrom_image_write(flash, newcontents, flash_size, refcontents);
+	if (dry_run) {
+		char *plan_json = NULL;
+		ret = flashrom_image_write_plan(flash, newcontents.buf, flash_size, refcontents.buf, &plan_json);
+		if (!ret)
+			printf("%s", plan_json);
+		flashrom_data_free(plan_json);
+	} else {
+		ret = flashrom_image_write(flash, newcontents.buf, flash_size, refcontents.buf);
+	}
 
 _free_ret:
-	free(refcontents);
-	free(newcontents);
+	image_file_release(&refcontents);
+	image_file_release(&newcontents);
 	return ret;
 }
 
+static bool include_args_have_files(const struct flashrom_layout *const layout)
+{
+	const struct romentry *entry = NULL;
+
+	while ((entry = layout_next_included(layout, entry))) {
+		if (entry->file)
+			return true;
+	}
+	return false;
+}
+
 static int do_verify(struct flashctx *const flash, const char *const filename)
 {
 	const size_t flash_size = flashrom_flash_getsize(flash);
+	struct image_file newcontents = { 0 };
 	int ret = 1;
 
-	uint8_t *const newcontents = malloc(flash_size);
-	if (!newcontents) {
-		msg_gerr("Out of memory!\n");
-		goto _free_ret;
-	}
-
 	/* Read '-v' argument first... */
 	if (filename) {
-		if (read_buf_from_file(newcontents, flash_size, filename))
+		const bool patched = include_args_have_files(get_layout(flash));
+		if (image_file_map(&newcontents, filename, flash_size, patched))
 			goto _free_ret;
+	} else if (image_file_create(&newcontents, NULL, flash_size)) {
+		goto _free_ret;
 	}
 	/*
 	 * ... then update newcontents with contents from files provided to '-i'
 	 * args if needed.
 	 */
-	if (read_buf_from_include_args(get_layout(flash), newcontents))
+	if (read_buf_from_include_args(get_layout(flash), newcontents.buf))
 		goto _free_ret;
 
-	ret = flashrom_image_verify(flash, newcontents, flash_size);
+	ret = flashrom_image_verify(flash, newcontents.buf, flash_size);
 
 _free_ret:
-	free(newcontents);
+	image_file_release(&newcontents);
 	return ret;
 }
 
@@ -925,6 +1240,10 @@ static void parse_options(int argc, char **argv, const char *optstring,
 			cli_classic_validate_singleop(&operation_specified);
 			options->list_supported = true;
 			break;
+		case OPTION_SCAN_IMAGE:
+			cli_classic_validate_singleop(&operation_specified);
+			options->scan_image_file = strdup(optarg);
+			break;
 		case 'p':
 			if (options->prog != NULL) {
 				cli_classic_abort_usage("Error: --programmer specified "
@@ -970,12 +1289,14 @@ static void parse_options(int argc, char **argv, const char *optstring,
 			}
 			break;
 		case 'R':
-			/* print_version() is always called during startup. */
 			cli_classic_validate_singleop(&operation_specified);
+			print_version();
 			exit(0);
 			break;
 		case 'h':
 			cli_classic_validate_singleop(&operation_specified);
+			print_version();
+			print_banner();
 			cli_classic_usage(argv[0]);
 			exit(0);
 			break;
@@ -997,6 +1318,46 @@ static void parse_options(int argc, char **argv, const char *optstring,
 			/* It is okay to convert invalid input to 0. */
 			options->sacrifice_ratio = atoi(optarg);
 			break;
+		case OPTION_DRY_RUN:
+			options->dry_run = true;
+			break;
+		case OPTION_MANIFEST:
+			if (options->manifest_file)
+				cli_classic_abort_usage("Error: --manifest specified more than once. Aborting.\n");
+			options->manifest_file = strdup(optarg);
+			break;
+		case OPTION_TRUST_MANIFEST:
+			options->trust_manifest = true;
+			break;
+		case OPTION_JOURNAL:
+		case OPTION_RESUME:
+			if (options->journal_file)
+				cli_classic_abort_usage("Error: --journal or --resume specified more than once. "
+							"Aborting.\n");
+			options->journal_file = strdup(optarg);
+			options->resume = opt == OPTION_RESUME;
+			break;
+		case OPTION_SERVE:
+			cli_classic_validate_singleop(&operation_specified);
+			options->serve_socket = strdup(optarg);
+			break;
+		case OPTION_STATS:
+			options->show_stats = true;
+			if (optarg && !strcmp(optarg, "json"))
+				options->stats_json = true;
+			else if (optarg && strcmp(optarg, "text"))
+				cli_classic_abort_usage("Error: Unknown statistics format. Aborting.\n");
+			break;
+		case OPTION_TRACE:
+			free(options->trace_file);
+			options->trace_file = strdup(optarg);
+			break;
+		case OPTION_ERASE_PLANNER:
+			if (!strcmp(optarg, "cost"))
+				options->cost_erase_planner = true;
+			else if (strcmp(optarg, "greedy"))
+				cli_classic_abort_usage("Error: Unknown erase planner. Aborting.\n");
+			break;
 #if CONFIG_RPMC_ENABLED == 1
 		case OPTION_RPMC_READ_DATA:
 			options->rpmc_read_data = true;
@@ -1032,6 +1393,15 @@ static void parse_options(int argc, char **argv, const char *optstring,
 
 	if (optind < argc)
 		cli_classic_abort_usage("Error: Extra parameter found.\n");
+
+	if (options->dry_run && !options->write_it)
+		cli_classic_abort_usage("Error: --dry-run can only be used with --write. Aborting.\n");
+
+	if (options->trust_manifest && (!options->write_it || !options->manifest_file))
+		cli_classic_abort_usage("Error: --trust-manifest requires --write and --manifest. Aborting.\n");
+
+	if (options->journal_file && (!options->write_it || options->dry_run))
+		cli_classic_abort_usage("Error: --journal and --resume can only be used with --write. Aborting.\n");
 }
 
 static void free_options(struct cli_options *options)
@@ -1040,6 +1410,11 @@ static void free_options(struct cli_options *options)
 	free(options->filename);
 	free(options->fmapfile);
 	free(options->referencefile);
+	free(options->manifest_file);
+	free(options->journal_file);
+	free(options->serve_socket);
+	free(options->scan_image_file);
+	free(options->trace_file);
 	free(options->layoutfile);
 	free(options->pparam);
 	free(options->wp_region);
@@ -1055,6 +1430,9 @@ int main(int argc, char *argv[])
 	int ret = 0;
 	int all_matched_count = 0;
 	const char **all_matched_names = NULL;
+	struct flashrom_manifest *manifest = NULL;
+	struct flashrom_journal *journal = NULL;
+	struct journal_file journal_file = { 0 };
 	time_t time_start, time_end;
 
 	struct flashctx *context = NULL; /* holds the active detected chip and other info */
@@ -1101,6 +1479,16 @@ int main(int argc, char *argv[])
 		{"output",		1, NULL, 'o'},
 		{"progress",		0, NULL, OPTION_PROGRESS},
 		{"sacrifice-ratio",	1, NULL, OPTION_SACRIFICE_RATIO},
+		{"dry-run",		0, NULL, OPTION_DRY_RUN},
+		{"erase-planner",	1, NULL, OPTION_ERASE_PLANNER},
+		{"manifest",		1, NULL, OPTION_MANIFEST},
+		{"trust-manifest",	0, NULL, OPTION_TRUST_MANIFEST},
+		{"journal",		1, NULL, OPTION_JOURNAL},
+		{"resume",		1, NULL, OPTION_RESUME},
+		{"serve",		1, NULL, OPTION_SERVE},
+		{"scan-image",		1, NULL, OPTION_SCAN_IMAGE},
+		{"stats",		2, NULL, OPTION_STATS},
+		{"trace",		1, NULL, OPTION_TRACE},
 #if CONFIG_RPMC_ENABLED == 1
 		{"get-rpmc-status",	0, NULL, OPTION_RPMC_READ_DATA},
 		{"write-root-key",	0, NULL, OPTION_RPMC_WRITE_ROOT_KEY},
@@ -1127,23 +1515,29 @@ int main(int argc, char *argv[])
 		flashrom_set_log_callback(&flashrom_print_cb);
 	}
 
-	print_version();
-	print_banner();
-
 	setbuf(stdout, NULL);
 
 	parse_options(argc, argv, optstring, long_options, &options);
 
+	/* JSON is printed on stdout, everything else goes to stderr. */
+	info_to_stderr = options.dry_run || options.stats_json;
+	print_version();
+	print_banner();
+
 	if (options.filename && check_filename(options.filename, "image"))
 		cli_classic_abort_usage(NULL);
 	if (options.layoutfile && check_filename(options.layoutfile, "layout"))
 		cli_classic_abort_usage(NULL);
 	if (options.fmapfile && check_filename(options.fmapfile, "fmap"))
 		cli_classic_abort_usage(NULL);
+	if (options.scan_image_file && check_filename(options.scan_image_file, "image"))
+		cli_classic_abort_usage(NULL);
 	if (options.referencefile && check_filename(options.referencefile, "reference"))
 		cli_classic_abort_usage(NULL);
 	if (options.logfile && check_filename(options.logfile, "log"))
 		cli_classic_abort_usage(NULL);
+	if (options.trace_file && check_filename(options.trace_file, "trace"))
+		cli_classic_abort_usage(NULL);
 	if (options.logfile && open_logfile(options.logfile))
 		cli_classic_abort_usage(NULL);
 
@@ -1153,6 +1547,11 @@ int main(int argc, char *argv[])
 		goto out;
 	}
 
+	if (options.scan_image_file) {
+		ret = scan_image(options.scan_image_file);
+		goto out;
+	}
+
 	start_logging();
 
 	print_buildinfo();
@@ -1218,6 +1617,14 @@ int main(int argc, char *argv[])
 		ret = 1;
 		goto out_shutdown;
 	}
+	if (options.show_stats && flashrom_stats_enable(context, true)) {
+		ret = 1;
+		goto out_shutdown;
+	}
+	if (options.trace_file && flashrom_trace_start(context, options.trace_file)) {
+		ret = 1;
+		goto out_shutdown;
+	}
 	tempstr = flashbuses_to_text(get_buses_supported());
 	msg_pdbg("The following protocols are supported: %s.\n", tempstr ? tempstr : "?");
 	free(tempstr);
@@ -1333,7 +1740,7 @@ int main(int argc, char *argv[])
 
 	const bool any_op = options.read_it || options.write_it || options.verify_it ||
 		options.erase_it || options.flash_name || options.flash_size ||
-		options.extract_it || any_wp_op || any_rpmc_op;
+		options.extract_it || options.serve_socket || any_wp_op || any_rpmc_op;
 
 	if (!any_op) {
 		msg_ginfo("No operations were specified.\n");
@@ -1438,26 +1845,19 @@ int main(int argc, char *argv[])
 			goto out_shutdown;
 		}
 
-		size_t fmapfile_size = s.st_size;
-		uint8_t *fmapfile_buffer = malloc(fmapfile_size);
-		if (!fmapfile_buffer) {
+		struct image_file fmapfile;
+		if (image_file_map(&fmapfile, options.fmapfile, s.st_size, false)) {
 			ret = 1;
 			goto out_shutdown;
 		}
 
-		if (read_buf_from_file(fmapfile_buffer, fmapfile_size, options.fmapfile)) {
-			ret = 1;
-			free(fmapfile_buffer);
-			goto out_shutdown;
-		}
-
-		if (flashrom_layout_read_fmap_from_buffer(&options.layout, context, fmapfile_buffer, fmapfile_size) ||
+		if (flashrom_layout_read_fmap_from_buffer(&options.layout, context, fmapfile.buf, fmapfile.size) ||
 		    process_include_args(options.layout, options.include_args)) {
 			ret = 1;
-			free(fmapfile_buffer);
+			image_file_release(&fmapfile);
 			goto out_shutdown;
 		}
-		free(fmapfile_buffer);
+		image_file_release(&fmapfile);
 	} else if (options.fmap) {
 		/* Read layout from ROM fmap */
 		if (flashrom_layout_read_fmap_from_rom(&options.layout, context, 0,
@@ -1475,27 +1875,20 @@ int main(int argc, char *argv[])
 				goto out_release;
 			}
 
-			size_t fmapfile_size = s.st_size;
-			uint8_t *file_buffer = malloc(fmapfile_size);
-			if (!file_buffer) {
+			struct image_file file;
+			if (image_file_map(&file, options.filename, s.st_size, false)) {
 				ret = 1;
 				goto out_release;
 			}
-
-			if (read_buf_from_file(file_buffer, fmapfile_size, options.filename)) {
-				ret = 1;
-				free(file_buffer);
-				goto out_release;
-			}
 			/* Read layout from file fmap */
-			if (flashrom_layout_read_fmap_from_buffer(&file_layout, context, file_buffer,
+			if (flashrom_layout_read_fmap_from_buffer(&file_layout, context, file.buf,
 					flashrom_flash_getsize(context)) ||
 					process_include_args(file_layout, options.include_args)) {
 				ret = 1;
-				free(file_buffer);
+				image_file_release(&file);
 				goto out_release;
 			}
-			free(file_buffer);
+			image_file_release(&file);
 			/* compare the two layouts */
 			if (flashrom_layout_compare(options.layout, file_layout)) {
 				msg_cerr("FMAP layouts do not match! Aborting.\n");
@@ -1544,6 +1937,27 @@ int main(int argc, char *argv[])
 #endif
 	flashrom_flag_set(context, FLASHROM_FLAG_VERIFY_AFTER_WRITE, !options.dont_verify_it);
 	flashrom_flag_set(context, FLASHROM_FLAG_VERIFY_WHOLE_CHIP, !options.dont_verify_all);
+	flashrom_flag_set(context, FLASHROM_FLAG_COST_ERASE_PLANNER, options.cost_erase_planner);
+	flashrom_flag_set(context, FLASHROM_FLAG_TRUST_MANIFEST, options.trust_manifest);
+
+	if (options.manifest_file) {
+		if (load_manifest(options.manifest_file, &manifest)) {
+			ret = 1;
+			goto out_release;
+		}
+		flashrom_manifest_set(context, manifest);
+	}
+
+	flashrom_flag_set(context, FLASHROM_FLAG_RESUME_JOURNAL, options.resume);
+	if (options.journal_file) {
+		if (load_journal(options.journal_file, options.resume, &journal)) {
+			ret = 1;
+			goto out_release;
+		}
+		journal_file.filename = options.journal_file;
+		flashrom_journal_set_callback(journal, store_journal, &journal_file);
+		flashrom_journal_set(context, journal);
+	}
 
 	/* FIXME: We should issue an unconditional chip reset here. This can be
 	 * done once we have a .reset function in struct flashchip.
@@ -1558,9 +1972,22 @@ int main(int argc, char *argv[])
 		ret = flashrom_flash_erase(context);
 	}
 	else if (options.write_it)
-		ret = do_write(context, options.filename, options.referencefile);
+		ret = do_write(context, options.filename, options.referencefile, options.dry_run);
 	else if (options.verify_it)
 		ret = do_verify(context, options.filename);
+	else if (options.serve_socket)
+		ret = serve(context, options.serve_socket, options.layout);
+
+	/* Also store it after failures, the touched blocks were dropped from it. */
+	if (manifest && !options.dry_run)
+		if (save_manifest(options.manifest_file, manifest))
+			ret = 1;
+
+	if (journal_file.file)
+		fclose(journal_file.file);
+	/* Keep it after failures, so the write can be resumed. */
+	if (journal && !ret && flashrom_journal_complete(journal))
+		remove(options.journal_file);
 
 #if CONFIG_RPMC_ENABLED == 1
 	if (any_rpmc_op && ret == 0) {
@@ -1580,8 +2007,14 @@ int main(int argc, char *argv[])
 out_release:
 	flashrom_layout_release(options.layout);
 out_shutdown:
+	if (options.show_stats)
+		print_stats(context, options.stats_json);
+	if (flashrom_trace_stop(context))
+		ret = 1;
 	flashrom_programmer_shutdown(NULL);
 out:
+	flashrom_manifest_release(manifest);
+	flashrom_journal_release(journal);
 	flashrom_data_free(all_matched_names);
 	flashrom_flash_release(context);
 
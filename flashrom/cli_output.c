@@ -15,6 +15,7 @@
 
 enum flashrom_log_level verbose_screen = FLASHROM_MSG_INFO;
 enum flashrom_log_level verbose_logfile = FLASHROM_MSG_DEBUG2;
+bool info_to_stderr = false;
 
 /* Enum to indicate what was the latest printed char prior to a progress indicator. */
 enum line_state {
@@ -154,7 +155,7 @@ int flashrom_print_cb(enum flashrom_log_level level, const char *fmt, va_list ap
 	va_list logfile_args;
 	va_copy(logfile_args, ap);
 
-	if (level < FLASHROM_MSG_INFO)
+	if (level < FLASHROM_MSG_INFO || info_to_stderr)
 		output_type = stderr;
 
 	if (level <= verbose_screen) {
@@ -0,0 +1,433 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * `flashrom --serve <socket>`: keeps the programmer initialised and the chip
+ * probed, and serves requests of flashrom_client until it is told to stop.
+ * Connections are served one after the other, each with its own layout.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flash.h"
+#include "layout.h"
+#include "libflashrom.h"
+#include "serve.h"
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t g_stop;
+
+static void stop_serving(int sig)
+{
+	(void)sig;
+	g_stop = 1;
+}
+
+struct serve_session {
+	struct flashrom_flashctx *flashctx;
+	struct flashrom_layout *default_layout;
+	struct flashrom_layout *layout;		/* Set by SERVE_OP_LAYOUT, NULL for the default. */
+	bool shutdown;
+};
+
+static struct flashrom_layout *session_layout(const struct serve_session *session)
+{
+	return session->layout ? session->layout : session->default_layout;
+}
+
+static const char *op_name(uint32_t op)
+{
+	static const char *const names[] = {
+		[SERVE_OP_INFO]		= "info",
+		[SERVE_OP_LAYOUT]	= "layout",
+		[SERVE_OP_READ]		= "read",
+		[SERVE_OP_WRITE]	= "write",
+		[SERVE_OP_VERIFY]	= "verify",
+		[SERVE_OP_WP_READ]	= "wp-read",
+		[SERVE_OP_WP_WRITE]	= "wp-write",
+		[SERVE_OP_SHUTDOWN]	= "shutdown",
+	};
+
+	return op < ARRAY_SIZE(names) && names[op] ? names[op] : "unknown";
+}
+
+static int set_layout(struct serve_session *session, const struct serve_request *req, int fd)
+{
+	struct flashrom_flashctx *const flashctx = session->flashctx;
+	struct flashrom_layout *layout = NULL;
+	int ret;
+
+	switch (req->layout_source) {
+	case SERVE_LAYOUT_DEFAULT:
+		flashrom_layout_release(session->layout);
+		session->layout = NULL;
+		return 0;
+	case SERVE_LAYOUT_FILE: {
+		if (fd < 0) {
+			msg_gerr("Layout request without a layout file.\n");
+			return 1;
+		}
+		char path[32];
+		snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+		ret = layout_from_file(&layout, path);
+		break;
+	}
+	case SERVE_LAYOUT_IFD:
+		ret = flashrom_layout_read_from_ifd(&layout, flashctx, NULL, 0);
+		break;
+	case SERVE_LAYOUT_FMAP:
+		ret = flashrom_layout_read_fmap_from_rom(&layout, flashctx, 0, flashrom_flash_getsize(flashctx));
+		break;
+	default:
+		msg_gerr("Unknown layout source %"PRIu32".\n", req->layout_source);
+		return 1;
+	}
+
+	if (ret) {
+		flashrom_layout_release(layout);
+		return 1;
+	}
+	flashrom_layout_release(session->layout);
+	session->layout = layout;
+	return 0;
+}
+
+/* Builds a layout of the requested regions, *layout stays NULL for the whole chip. */
+static int request_layout(const struct serve_session *session, const struct serve_request *req,
+			  struct flashrom_layout **layout)
+{
+	struct flashrom_layout *const base = session_layout(session);
+	char regions[SERVE_REGIONS_LEN];
+
+	*layout = NULL;
+	if (!req->regions[0])
+		return 0;
+	if (!base) {
+		msg_gerr("Error: A flash layout must be specified to include regions.\n");
+		return 1;
+	}
+	if (flashrom_layout_new(layout))
+		return 1;
+
+	memcpy(regions, req->regions, sizeof(regions));
+	regions[sizeof(regions) - 1] = '\0';
+	char *saveptr = NULL;
+	for (char *name = strtok_r(regions, ",", &saveptr); name; name = strtok_r(NULL, ",", &saveptr)) {
+		unsigned int start, len;
+		if (flashrom_layout_get_region_range(base, name, &start, &len)) {
+			msg_gerr("Error: Region %s not found in flash layout.\n", name);
+			goto _err;
+		}
+		if (flashrom_layout_add_region(*layout, start, start + len - 1, name) ||
+		    flashrom_layout_include_region(*layout, name))
+			goto _err;
+	}
+	if (included_regions_overlap(*layout)) {
+		msg_gerr("Error: Included regions overlap.\n");
+		goto _err;
+	}
+	return 0;
+
+_err:
+	flashrom_layout_release(*layout);
+	*layout = NULL;
+	return 1;
+}
+
+static int serve_read(struct flashrom_flashctx *flashctx, struct serve_reply *reply, int *reply_fd)
+{
+	const size_t size = flashrom_flash_getsize(flashctx);
+
+	const int fd = serve_memfd("flashrom-read", size);
+	if (fd < 0) {
+		msg_gerr("Creating the image failed: %s\n", strerror(errno));
+		return 1;
+	}
+	void *const buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (buf == MAP_FAILED) {
+		msg_gerr("Mapping the image failed: %s\n", strerror(errno));
+		close(fd);
+		return 1;
+	}
+
+	const int ret = flashrom_image_read(flashctx, buf, size);
+	munmap(buf, size);
+	if (ret) {
+		close(fd);
+		return ret;
+	}
+	reply->image_size = size;
+	*reply_fd = fd;
+	return 0;
+}
+
+static int serve_write_or_verify(struct flashrom_flashctx *flashctx, const struct serve_request *req, int fd)
+{
+	const size_t size = flashrom_flash_getsize(flashctx);
+	struct stat st;
+
+	if (fd < 0 || req->image_size != size) {
+		msg_gerr("Error: Image size (%"PRIu64" B) doesn't match the flash chip's size (%zu B)!\n",
+			 fd < 0 ? 0 : req->image_size, size);
+		return 1;
+	}
+	/* Don't trust image_size, mapping past the end of the file would fault. */
+	if (fstat(fd, &st)) {
+		msg_gerr("Checking the image failed: %s\n", strerror(errno));
+		return 1;
+	}
+	if (st.st_size < 0 || (uint64_t)st.st_size < size) {
+		msg_gerr("Error: Image file (%jd B) is smaller than the flash chip (%zu B)!\n",
+			 (intmax_t)st.st_size, size);
+		return 1;
+	}
+	/* Private, writing changes the image in memory. */
+	void *const buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (buf == MAP_FAILED) {
+		msg_gerr("Mapping the image failed: %s\n", strerror(errno));
+		return 1;
+	}
+
+	int ret;
+	if (req->op == SERVE_OP_WRITE) {
+		flashrom_flag_set(flashctx, FLASHROM_FLAG_VERIFY_AFTER_WRITE, !(req->flags & SERVE_NOVERIFY));
+		flashrom_flag_set(flashctx, FLASHROM_FLAG_VERIFY_WHOLE_CHIP, !(req->flags & SERVE_NOVERIFY_ALL));
+		ret = flashrom_image_write(flashctx, buf, size, NULL);
+	} else {
+		ret = flashrom_image_verify(flashctx, buf, size);
+	}
+	munmap(buf, size);
+	return ret;
+}
+
+static int serve_wp(struct serve_session *session, const struct serve_request *req, struct serve_reply *reply)
+{
+	struct flashrom_wp_cfg *cfg = NULL;
+	enum flashrom_wp_result ret = flashrom_wp_cfg_new(&cfg);
+
+	if (ret == FLASHROM_WP_OK)
+		ret = flashrom_wp_read_cfg(cfg, session->flashctx);
+
+	if (ret == FLASHROM_WP_OK && req->op == SERVE_OP_WP_WRITE) {
+		if (req->flags & SERVE_WP_SET_REGION) {
+			struct flashrom_layout *const base = session_layout(session);
+			unsigned int start, len;
+			if (!base || flashrom_layout_get_region_range(base, req->regions, &start, &len)) {
+				msg_gerr("Error: Region %s not found in flash layout.\n", req->regions);
+				flashrom_wp_cfg_release(cfg);
+				return 1;
+			}
+			flashrom_wp_set_range(cfg, start, len);
+		} else if (req->flags & SERVE_WP_SET_RANGE) {
+			flashrom_wp_set_range(cfg, req->wp_start, req->wp_len);
+		}
+		if (req->flags & SERVE_WP_SET_MODE)
+			flashrom_wp_set_mode(cfg, req->wp_mode);
+		ret = flashrom_wp_write_cfg(session->flashctx, cfg);
+		if (ret == FLASHROM_WP_OK)
+			ret = flashrom_wp_read_cfg(cfg, session->flashctx);
+	}
+
+	if (ret == FLASHROM_WP_OK) {
+		size_t start, len;
+		flashrom_wp_get_range(&start, &len, cfg);
+		reply->wp_mode = flashrom_wp_get_mode(cfg);
+		reply->wp_start = start;
+		reply->wp_len = len;
+	} else {
+		msg_gerr("Write protection request failed (error %d).\n", ret);
+	}
+	flashrom_wp_cfg_release(cfg);
+	return ret != FLASHROM_WP_OK;
+}
+
+static int handle_request(struct serve_session *session, const struct serve_request *req, int fd,
+			  struct serve_reply *reply, int *reply_fd)
+{
+	struct flashrom_flashctx *const flashctx = session->flashctx;
+	struct flashrom_layout *layout = NULL;
+	int ret;
+
+	msg_ginfo("Serving %s request.\n", op_name(req->op));
+	switch (req->op) {
+	case SERVE_OP_INFO:
+		return 0;
+	case SERVE_OP_LAYOUT:
+		return set_layout(session, req, fd);
+	case SERVE_OP_READ:
+	case SERVE_OP_WRITE:
+	case SERVE_OP_VERIFY:
+		if (request_layout(session, req, &layout))
+			return 1;
+		flashrom_layout_set(flashctx, layout);
+		if (req->op == SERVE_OP_READ)
+			ret = serve_read(flashctx, reply, reply_fd);
+		else
+			ret = serve_write_or_verify(flashctx, req, fd);
+		flashrom_layout_set(flashctx, NULL);
+		flashrom_layout_release(layout);
+		return ret;
+	case SERVE_OP_WP_READ:
+	case SERVE_OP_WP_WRITE:
+		return serve_wp(session, req, reply);
+	case SERVE_OP_SHUTDOWN:
+		session->shutdown = true;
+		return 0;
+	default:
+		msg_gerr("Unknown request %"PRIu32".\n", req->op);
+		return 1;
+	}
+}
+
+static void serve_requests(struct serve_session *session, int conn)
+{
+	struct serve_request req;
+	int fd;
+
+	while (!session->shutdown && !g_stop) {
+		const int ret = serve_recv(conn, &req, sizeof(req), &fd);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret) {
+			if (ret < 0)
+				msg_gerr("Receiving request failed: %s\n", strerror(errno));
+			break;
+		}
+		if (req.magic != SERVE_MAGIC || req.version != SERVE_VERSION) {
+			msg_gerr("Invalid request, closing the connection.\n");
+			if (fd >= 0)
+				close(fd);
+			break;
+		}
+		req.regions[sizeof(req.regions) - 1] = '\0';
+
+		struct serve_reply reply = {
+			.magic		= SERVE_MAGIC,
+			.version	= SERVE_VERSION,
+			.chip_size	= flashrom_flash_getsize(session->flashctx),
+		};
+		snprintf(reply.chip_vendor, sizeof(reply.chip_vendor), "%s", session->flashctx->chip->vendor);
+		snprintf(reply.chip_name, sizeof(reply.chip_name), "%s", session->flashctx->chip->name);
+
+		int reply_fd = -1;
+		reply.ret = handle_request(session, &req, fd, &reply, &reply_fd);
+		if (fd >= 0)
+			close(fd);
+
+		const int sent = serve_send(conn, &reply, sizeof(reply), reply_fd);
+		if (reply_fd >= 0)
+			close(reply_fd);
+		if (sent) {
+			msg_gerr("Sending reply failed: %s\n", strerror(errno));
+			break;
+		}
+	}
+}
+
+int serve_connection(struct flashrom_flashctx *flashctx, int conn, struct flashrom_layout *layout)
+{
+	struct serve_session session = {
+		.flashctx	= flashctx,
+		.default_layout	= layout,
+	};
+
+	serve_requests(&session, conn);
+	flashrom_layout_release(session.layout);
+	return session.shutdown;
+}
+
+static int listen_on(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct stat st;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		msg_gerr("Error: Socket path \"%s\" is too long.\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	/* Only replace stale sockets, never other files. */
+	if (lstat(path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			msg_gerr("Error: \"%s\" exists and isn't a socket.\n", path);
+			return -1;
+		}
+		unlink(path);
+	}
+
+	const int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		msg_gerr("Error: Creating socket failed: %s\n", strerror(errno));
+		return -1;
+	}
+	/* Only the owner may connect. */
+	const mode_t old_umask = umask(0177);
+	const int bound = bind(sock, (const struct sockaddr *)&addr, sizeof(addr));
+	umask(old_umask);
+	if (bound || listen(sock, 4)) {
+		msg_gerr("Error: Listening on \"%s\" failed: %s\n", path, strerror(errno));
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+int serve(struct flashrom_flashctx *flashctx, const char *path, struct flashrom_layout *layout)
+{
+	struct sigaction sa = { .sa_handler = stop_serving }, old_int, old_term;
+	bool shutdown = false;
+
+	const int sock = listen_on(path);
+	if (sock < 0)
+		return 1;
+
+	/* No SA_RESTART, a signal has to interrupt accept(). */
+	sigemptyset(&sa.sa_mask);
+	g_stop = 0;
+	sigaction(SIGINT, &sa, &old_int);
+	sigaction(SIGTERM, &sa, &old_term);
+
+	msg_ginfo("Serving requests on \"%s\".\n", path);
+	while (!shutdown && !g_stop) {
+		const int conn = accept(sock, NULL, NULL);
+		if (conn < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			msg_gerr("Error: Accepting connection failed: %s\n", strerror(errno));
+			break;
+		}
+		shutdown = serve_connection(flashctx, conn, layout);
+		close(conn);
+	}
+	msg_ginfo("Stopped serving requests.\n");
+
+	sigaction(SIGINT, &old_int, NULL);
+	sigaction(SIGTERM, &old_term, NULL);
+	close(sock);
+	unlink(path);
+	return 0;
+}
+
+#else
+
+int serve(struct flashrom_flashctx *flashctx, const char *path, struct flashrom_layout *layout)
+{
+	msg_gerr("Error: --serve is only supported on Linux.\n");
+	return 1;
+}
+
+#endif /* __linux__ */
@@ -18,17 +18,18 @@
 #include <strings.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/types.h>
 
 #include "flash.h"
 #include "hwaccess_physmap.h"
+#include "platform.h"
 #include "programmer.h"
 
-/* Enable SMBIOS decoding. Currently legacy DMI decoding is enough. */
-#define SM_SUPPORT 0
-
 /* Strings longer than 4096 in DMI are just insane. */
 #define DMI_MAX_ANSWER_LEN 4096
 
@@ -85,7 +86,7 @@ static const struct {
 	{0x19, 0, "Multi-system"}, /* used by Supermicro (X7DWT) */
 };
 
-#if CONFIG_INTERNAL_DMI == 1
+#if CONFIG_INTERNAL_DMI == 1 || defined(__linux__)
 static bool dmi_checksum(const uint8_t * const buf, size_t len)
 {
 	uint8_t sum = 0;
@@ -120,7 +121,7 @@ static char *dmi_string(const char *buf, uint8_t string_id, const char *limit)
 		buf += strnlen(buf, limit - buf) + 1;
 	}
 
-	if (!*buf) /* as long as the current byte we're on isn't null */
+	if (buf >= limit || !*buf) /* as long as the current byte we're on isn't null */
 		return strdup("<BAD INDEX>");
 
 	len = strnlen(buf, limit - buf);
@@ -157,18 +158,71 @@ static int dmi_chassis_type(uint8_t code)
 	return is_laptop;
 }
 
-static void dmi_table(uint32_t base, uint16_t len, uint16_t num, int *is_laptop)
+/* Location of the structure table as described by an entry point. */
+struct dmi_table_info {
+	uint64_t base;
+	uint32_t len;
+	unsigned int num;	/* Number of structures, UINT_MAX if only the end-of-table structure tells. */
+};
+
+/** Decode an SMBIOS 3 ("_SM3_"), SMBIOS 2 ("_SM_") or legacy ("_DMI_") entry point.
+ *
+ * See SMBIOS spec. section 5.2 "Table convention".
+ *
+ * \param buf	the entry point
+ * \param len	number of bytes available at \em buf
+ * \param info	receives the location of the structure table
+ * \return 0 on success, 1 if \em buf doesn't hold a valid entry point
+ */
+static int dmi_decode_entry_point(const uint8_t *buf, size_t len, struct dmi_table_info *info)
 {
-	unsigned int i = 0, j = 0;
+	if (len >= 0x18 && memcmp(buf, "_SM3_", 5) == 0) {
+		if (buf[0x06] < 0x18 || buf[0x06] > len || !dmi_checksum(buf, buf[0x06]))
+			return 1;
+		msg_pdbg("SMBIOS %u.%u.%u present.\n", buf[0x07], buf[0x08], buf[0x09]);
+		info->base = read_le64(buf, 0x10);
+		info->len = read_le32(buf, 0x0C);
+		info->num = UINT_MAX;
+		return 0;
+	}
 
-	uint8_t *dmi_table_mem = physmap_ro("DMI Table", base, len);
-	if (dmi_table_mem == ERROR_PTR) {
-		msg_perr("Unable to access DMI Table\n");
-		return;
+	if (len >= 0x1F && memcmp(buf, "_SM_", 4) == 0) {
+		/* TODO: other checks mentioned in the conformance guidelines? */
+		if (buf[0x05] < 0x1F || buf[0x05] > len || !dmi_checksum(buf, buf[0x05]))
+			return 1;
+		msg_pdbg("SMBIOS %u.%u present.\n", buf[0x06], buf[0x07]);
+		/* The intermediate anchor is a complete legacy entry point. */
+		buf += 0x10;
+		len -= 0x10;
+	}
+
+	if (len >= 0x0F && memcmp(buf, "_DMI_", 5) == 0) {
+		if (!dmi_checksum(buf, 0x0F))
+			return 1;
+		info->base = read_le32(buf, 0x08);
+		info->len = read_le16(buf, 0x06);
+		info->num = read_le16(buf, 0x0C);
+		return 0;
 	}
 
-	uint8_t *data = dmi_table_mem;
-	uint8_t *limit = dmi_table_mem + len;
+	return 1;
+}
+
+/** Decode a structure table, filling dmi_strings and \em is_laptop in a single pass.
+ *
+ * If a string is present in several structures (e.g. multiple baseboards), the first one is used.
+ *
+ * \param table		the structure table
+ * \param len		length of \em table
+ * \param num		maximum number of structures to decode
+ * \param is_laptop	set according to the chassis type, if there is one
+ */
+static void dmi_table_decode(const uint8_t *table, size_t len, unsigned int num, int *is_laptop)
+{
+	unsigned int i = 0, j = 0;
+
+	const uint8_t *data = table;
+	const uint8_t *limit = table + len;
 
 	/* SMBIOS structure header is always 4 B long and contains:
 	 *  - uint8_t type;	// see dmi_chassis_types's type
@@ -188,8 +242,12 @@ static void dmi_table(uint32_t base, uint16_t len, uint16_t num, int *is_laptop)
 			break;
 		}
 
+		/* End-of-table structure, the only way to find the end of SMBIOS 3 tables. */
+		if (data[0] == 127)
+			break;
+
 		if(data[0] == 3) {
-			if (data + 5 < limit)
+			if (data[1] > 5)
 				*is_laptop = dmi_chassis_type(data[5]);
 			else /* the table is broken, but laptop detection is optional, hence continue. */
 				msg_pwarn("DMI table is broken (chassis_type out of bounds)!\n");
@@ -198,12 +256,12 @@ static void dmi_table(uint32_t base, uint16_t len, uint16_t num, int *is_laptop)
 				uint8_t offset = dmi_strings[j].offset;
 				uint8_t type = dmi_strings[j].type;
 
-				if (data[0] != type)
+				if (data[0] != type || dmi_strings[j].value != NULL)
 					continue;
 
-				if (data[1] <= offset || data + offset >= limit) {
+				if (data[1] <= offset) {
 					msg_perr("DMI table is broken (offset out of bounds)!\n");
-					goto out;
+					return;
 				}
 
 				dmi_strings[j].value = dmi_string((const char *)(data + data[1]), data[offset],
@@ -211,7 +269,7 @@ static void dmi_table(uint32_t base, uint16_t len, uint16_t num, int *is_laptop)
 			}
 		/* Find next structure by skipping data and string sections */
 		data += data[1];
-		while (data + 1 <= limit) {
+		while (data + 1 < limit) {
 			if (data[0] == 0 && data[1] == 0)
 				break;
 			data++;
@@ -219,39 +277,88 @@ static void dmi_table(uint32_t base, uint16_t len, uint16_t num, int *is_laptop)
 		data += 2;
 		i++;
 	}
-out:
-	physunmap(dmi_table_mem, len);
 }
+#endif /* CONFIG_INTERNAL_DMI == 1 || defined(__linux__) */
 
-#if SM_SUPPORT
-static int smbios_decode(uint8_t *buf, int *is_laptop)
-{
-	/* TODO: other checks mentioned in the conformance guidelines? */
-	if (!dmi_checksum(buf, buf[0x05]) ||
-	    (memcmp(buf + 0x10, "_DMI_", 5) != 0) ||
-	    !dmi_checksum(buf + 0x10, 0x0F))
-			return 0;
+#ifdef __linux__
+#define DMI_SYSFS_ENTRY_POINT	"/sys/firmware/dmi/tables/smbios_entry_point"
+#define DMI_SYSFS_TABLE		"/sys/firmware/dmi/tables/DMI"
 
-	dmi_table(mmio_readl(buf + 0x18), mmio_readw(buf + 0x16), mmio_readw(buf + 0x1C), is_laptop);
+/* Read up to len bytes of a sysfs file. Returns the number of bytes read, -1 if the file can't be opened. */
+static ssize_t dmi_read_sysfs(const char *path, uint8_t *buf, size_t len)
+{
+	FILE *fp = fopen(path, "rb");
+	if (!fp) {
+		msg_pdbg("Cannot open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
 
-	return 1;
+	size_t total = 0;
+	while (total < len) {
+		const size_t n = fread(buf + total, 1, len - total, fp);
+		if (n == 0)
+			break;
+		total += n;
+	}
+	fclose(fp);
+	return total;
 }
-#endif
 
-static int legacy_decode(uint8_t *buf, int *is_laptop)
+/* Linux exports the entry point and the structure table the kernel found (since 4.2), which works
+ * without /dev/mem access and without spawning dmidecode. */
+static int dmi_fill_sysfs(int *is_laptop)
 {
-	if (!dmi_checksum(buf, 0x0F))
+	uint8_t entry_point[0x20];
+	struct dmi_table_info info;
+
+	const ssize_t ep_len = dmi_read_sysfs(DMI_SYSFS_ENTRY_POINT, entry_point, sizeof(entry_point));
+	if (ep_len < 0)
+		return 1;
+	if (dmi_decode_entry_point(entry_point, ep_len, &info) || info.len == 0) {
+		msg_pdbg("No valid SMBIOS entry point in %s.\n", DMI_SYSFS_ENTRY_POINT);
 		return 1;
+	}
 
-	dmi_table(mmio_readl(buf + 0x08), mmio_readw(buf + 0x06), mmio_readw(buf + 0x0C), is_laptop);
+	uint8_t *const table = malloc(info.len);
+	if (!table) {
+		msg_perr("Out of memory!\n");
+		return 1;
+	}
 
-	return 0;
+	const ssize_t table_len = dmi_read_sysfs(DMI_SYSFS_TABLE, table, info.len);
+	if (table_len > 0) {
+		msg_pdbg("Using DMI table from sysfs.\n");
+		dmi_table_decode(table, table_len, info.num, is_laptop);
+	}
+	free(table);
+	return table_len > 0 ? 0 : 1;
 }
+#endif /* __linux__ */
 
-static int dmi_fill(int *is_laptop)
+#if CONFIG_INTERNAL_DMI == 1
+static void dmi_table(const struct dmi_table_info *info, int *is_laptop)
+{
+	if ((uintptr_t)info->base != info->base) {
+		msg_perr("DMI Table is out of reach\n");
+		return;
+	}
+
+	uint8_t *dmi_table_mem = physmap_ro("DMI Table", info->base, info->len);
+	if (dmi_table_mem == ERROR_PTR) {
+		msg_perr("Unable to access DMI Table\n");
+		return;
+	}
+
+	dmi_table_decode(dmi_table_mem, info->len, info->num, is_laptop);
+
+	physunmap(dmi_table_mem, info->len);
+}
+
+static int dmi_fill_fallback(int *is_laptop)
 {
 	size_t fp;
 	uint8_t *dmi_mem;
+	struct dmi_table_info info;
 	int ret = 1;
 
 	msg_pdbg("Using Internal DMI decoder.\n");
@@ -264,17 +371,11 @@ static int dmi_fill(int *is_laptop)
 		return ret;
 
 	for (fp = 0; fp <= 0xFFF0; fp += 16) {
-#if SM_SUPPORT
-		if (memcmp(dmi_mem + fp, "_SM_", 4) == 0 && fp <= 0xFFE0) {
-			if (smbios_decode(dmi_mem + fp), is_laptop) // FIXME: length check
-				goto out;
-		} else
-#endif
-		if (memcmp(dmi_mem + fp, "_DMI_", 5) == 0)
-			if (legacy_decode(dmi_mem + fp, is_laptop) == 0) {
-				ret = 0;
-				goto out;
-			}
+		if (dmi_decode_entry_point(dmi_mem + fp, 0x10000 - fp, &info) == 0) {
+			dmi_table(&info, is_laptop);
+			ret = 0;
+			goto out;
+		}
 	}
 	msg_pinfo("No DMI table found.\n");
 out:
@@ -342,7 +443,7 @@ static char *get_dmi_string(const char *string_name)
 	return result;
 }
 
-static int dmi_fill(int *is_laptop)
+static int dmi_fill_fallback(int *is_laptop)
 {
 	unsigned int i;
 	char *chassis_type;
@@ -372,6 +473,15 @@ static int dmi_fill(int *is_laptop)
 
 #endif /* CONFIG_INTERNAL_DMI */
 
+static int dmi_fill(int *is_laptop)
+{
+#ifdef __linux__
+	if (dmi_fill_sysfs(is_laptop) == 0)
+		return 0;
+#endif
+	return dmi_fill_fallback(is_laptop);
+}
+
 static int dmi_shutdown(void *data)
 {
 	unsigned int i;
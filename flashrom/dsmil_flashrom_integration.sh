@@ -41,6 +41,13 @@ echo "✓ flashrom found: $(which flashrom)"
 echo "  Version: $(flashrom --version 2>&1 | head -1)"
 echo ""
 
+# With a running `flashrom --serve`, send the requests to it instead of
+# initialising the programmer again for every step.
+if [ -n "${FLASHROM_SOCKET:-}" ] && command -v flashrom_client >/dev/null 2>&1; then
+    echo "✓ Using flashrom --serve on ${FLASHROM_SOCKET}"
+    flashrom() { flashrom_client "$@"; }
+fi
+
 # Create output directory
 mkdir -p "$OUTPUT_DIR"
 
@@ -6,7 +6,9 @@
  */
 
 #include <limits.h>
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <limits.h>
 #include <string.h>
@@ -14,6 +16,22 @@
 #include "flash.h"
 #include "layout.h"
 #include "erasure_layout.h"
+#include "journal.h"
+#include "memdiff.h"
+#include "stats.h"
+
+/*
+ * Cost model of the cost based erase planner. Chips without typical times
+ * from SFDP or flashchips.c are estimated like common SPI NOR parts, e.g.
+ * ~47 ms for a 4 KiB erase, ~150 ms for 64 KiB and 0.7 ms per 256 B page.
+ */
+#define DEFAULT_ERASE_BASE_US		40000
+#define DEFAULT_ERASE_US_PER_KIB	1700
+#define DEFAULT_PAGE_PROGRAM_US		700
+#define DEFAULT_PAGE_SIZE		256
+/* Time to move one byte over the bus, assuming ~10 MHz SPI. */
+#define TRANSFER_NS_PER_BYTE		800
+#define COST_INFINITE			(UINT64_MAX / 4)
 
 static size_t calculate_block_count(const struct flashchip *chip, size_t eraser_idx)
 {
@@ -134,6 +152,355 @@ int create_erase_layout(struct flashctx *const flashctx, struct erase_layout **e
 	return layout_idx;
 }
 
+/* Returns the index of the block of the smallest eraser that contains addr. */
+static size_t find_smallest_block(const struct erase_layout *layout, chipoff_t addr)
+{
+	size_t lo = 0, hi = layout[0].block_count - 1;
+
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo + 1) / 2;
+		if (layout[0].layout_list[mid].start_addr <= addr)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
+}
+
+static int add_write_extent(struct write_plan *plan, size_t *capacity, chipoff_t start, chipsize_t len)
+{
+	if (plan->extent_count) {
+		struct write_extent *last = &plan->extents[plan->extent_count - 1];
+		if (last->start + last->len == start) {
+			last->len += len;
+			return 0;
+		}
+	}
+
+	if (plan->extent_count == *capacity) {
+		const size_t new_capacity = *capacity ? *capacity * 2 : 64;
+		struct write_extent *extents = realloc(plan->extents, new_capacity * sizeof(*extents));
+		if (!extents)
+			return -1;
+		plan->extents = extents;
+		*capacity = new_capacity;
+	}
+
+	plan->extents[plan->extent_count++] = (struct write_extent){ .start = start, .len = len };
+	return 0;
+}
+
+/* Appends to an array that grows in powers of two, so its capacity follows from the count. */
+static int append_op(struct write_extent **ops, size_t *count, chipoff_t start, chipsize_t len)
+{
+	const size_t n = *count;
+
+	if (n < 16 ? !n : !(n & (n - 1))) {
+		struct write_extent *grown = realloc(*ops, (n < 16 ? 16 : n * 2) * sizeof(**ops));
+		if (!grown) {
+			msg_gerr("Out of memory!\n");
+			return -1;
+		}
+		*ops = grown;
+	}
+	(*ops)[(*count)++] = (struct write_extent){ .start = start, .len = len };
+	return 0;
+}
+
+static int compare_write_extents(const void *a, const void *b)
+{
+	const struct write_extent *ea = a, *eb = b;
+
+	if (ea->start != eb->start)
+		return ea->start < eb->start ? -1 : 1;
+	return 0;
+}
+
+/* Sorts the extents and merges overlapping or adjacent ones, as included regions may overlap. */
+static void coalesce_write_extents(struct write_plan *plan)
+{
+	size_t out = 0;
+
+	if (!plan->extent_count)
+		return;
+
+	qsort(plan->extents, plan->extent_count, sizeof(*plan->extents), compare_write_extents);
+	for (size_t i = 1; i < plan->extent_count; i++) {
+		struct write_extent *last = &plan->extents[out];
+		const struct write_extent *cur = &plan->extents[i];
+		if (cur->start <= last->start + last->len) {
+			const chipoff_t end = cur->start + cur->len;
+			if (end > last->start + last->len)
+				last->len = end - last->start;
+		} else {
+			plan->extents[++out] = *cur;
+		}
+	}
+	plan->extent_count = out + 1;
+}
+
+/*
+ * @brief	Function to free the buffers of a write plan
+ *
+ * @param	plan	write plan filled by create_write_plan()
+ */
+void free_write_plan(struct write_plan *plan)
+{
+	if (!plan)
+		return;
+	free(plan->block_flags);
+	free(plan->extents);
+	free(plan->erase_ops);
+	free(plan->write_ops);
+	memset(plan, 0, sizeof(*plan));
+}
+
+/*
+ * @brief	Function to compute the write plan for the included regions
+ *
+ * @param	flashctx	flash context
+ * @param	erase_layout	erase layout
+ * @param	curcontents	buffer containg the current contents of the flash
+ * @param	newcontents	buffer containg the new contents of the flash
+ * @param	plan		plan to fill, must be released with free_write_plan()
+ * @return	0 on success,
+ *		-1 if out of memory
+ *
+ * This compares the included regions of both buffers exactly once. Every block
+ * of the smallest eraser gets flagged as dirty and/or needing an erase, and
+ * the differing bytes are collected into sorted, coalesced write extents.
+ * Blocks only partially covered by included regions are flagged as such, as
+ * erase_write() extends regions to sector boundaries and has to re-evaluate
+ * them with the contents it reads back.
+ */
+int create_write_plan(struct flashctx *const flashctx, const struct erase_layout *erase_layout,
+		const uint8_t *curcontents, const uint8_t *newcontents, struct write_plan *plan)
+{
+	const struct flashrom_layout *const flash_layout = get_layout(flashctx);
+	const enum write_granularity gran = flashctx->chip->gran;
+	const uint8_t erased_value = ERASED_VALUE(flashctx);
+	size_t extent_capacity = 0;
+
+	memset(plan, 0, sizeof(*plan));
+	plan->block_count = erase_layout[0].block_count;
+	plan->block_flags = calloc(plan->block_count, sizeof(*plan->block_flags));
+	if (!plan->block_flags)
+		goto _oom;
+
+	const struct romentry *entry = NULL;
+	while ((entry = layout_next_included(flash_layout, entry))) {
+		const chipoff_t region_start = entry->region.start;
+		const chipoff_t region_end = entry->region.end;
+
+		for (size_t i = find_smallest_block(erase_layout, region_start); i < plan->block_count; i++) {
+			const struct eraseblock_data *ll = &erase_layout[0].layout_list[i];
+			if (ll->start_addr > region_end)
+				break;
+
+			const chipoff_t start = ll->start_addr > region_start ? ll->start_addr : region_start;
+			const chipoff_t end = ll->end_addr < region_end ? ll->end_addr : region_end;
+			const unsigned int len = end - start + 1;
+			unsigned int write_start = 0, write_len;
+			bool dirty = false;
+
+			if (start != ll->start_addr || end != ll->end_addr)
+				plan->block_flags[i] |= WRITE_PLAN_PARTIAL;
+
+			while ((write_len = get_next_write(curcontents + start + write_start,
+							   newcontents + start + write_start,
+							   len - write_start, &write_start, gran))) {
+				if (add_write_extent(plan, &extent_capacity, start + write_start, write_len))
+					goto _oom;
+				write_start += write_len;
+				dirty = true;
+			}
+			if (!dirty)
+				continue;
+
+			plan->block_flags[i] |= WRITE_PLAN_DIRTY;
+			if (need_erase(curcontents + start, newcontents + start, len, gran, erased_value)) {
+				plan->block_flags[i] |= WRITE_PLAN_NEEDS_ERASE;
+				plan->erase_len += len;
+			}
+		}
+	}
+
+	coalesce_write_extents(plan);
+	for (size_t i = 0; i < plan->extent_count; i++)
+		plan->write_len += plan->extents[i].len;
+
+	return 0;
+
+_oom:
+	msg_gerr("Out of memory!\n");
+	free_write_plan(plan);
+	return -1;
+}
+
+/* Whether the plan's view of a block still matches what erase_write() would compute for it. */
+static bool plan_block_valid(const struct write_plan *plan, const struct erase_layout *layout, size_t block_num)
+{
+	if (!plan || !plan->block_flags)
+		return false;
+
+	const struct eraseblock_data *ll = &layout[0].layout_list[block_num];
+	return !(plan->block_flags[block_num] & (WRITE_PLAN_PARTIAL | WRITE_PLAN_STALE)) &&
+		ll->start_addr >= plan->active_start && ll->end_addr <= plan->active_end;
+}
+
+static void mark_plan_stale(struct write_plan *plan, const struct erase_layout *layout,
+			    chipoff_t start, chipoff_t end)
+{
+	if (!plan || !plan->block_flags)
+		return;
+
+	for (size_t i = find_smallest_block(layout, start);
+	     i < plan->block_count && layout[0].layout_list[i].start_addr <= end; i++)
+		plan->block_flags[i] |= WRITE_PLAN_STALE;
+}
+
+struct json_buf {
+	char *data;
+	size_t len;
+	size_t capacity;
+	bool failed;
+};
+
+static void json_append(struct json_buf *buf, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (buf->failed)
+		return;
+
+	va_start(ap, fmt);
+	int needed = vsnprintf(buf->data ? buf->data + buf->len : NULL,
+			       buf->data ? buf->capacity - buf->len : 0, fmt, ap);
+	va_end(ap);
+	if (needed < 0) {
+		buf->failed = true;
+		return;
+	}
+	if (buf->data && buf->len + needed < buf->capacity) {
+		buf->len += needed;
+		return;
+	}
+
+	size_t capacity = buf->capacity ? buf->capacity : 1024;
+	while (capacity <= buf->len + needed)
+		capacity *= 2;
+	char *data = realloc(buf->data, capacity);
+	if (!data) {
+		buf->failed = true;
+		return;
+	}
+	buf->data = data;
+	buf->capacity = capacity;
+
+	va_start(ap, fmt);
+	vsnprintf(buf->data + buf->len, buf->capacity - buf->len, fmt, ap);
+	va_end(ap);
+	buf->len += needed;
+}
+
+/* Append `str` as a JSON string, with quotes, backslashes and control characters escaped. */
+static void json_append_string(struct json_buf *buf, const char *str)
+{
+	if (!str) {
+		json_append(buf, "null");
+		return;
+	}
+
+	json_append(buf, "\"");
+	for (; *str; str++) {
+		const unsigned char c = *str;
+		if (c == '"' || c == '\\')
+			json_append(buf, "\\%c", c);
+		else if (c < 0x20)
+			json_append(buf, "\\u%04x", c);
+		else
+			json_append(buf, "%c", c);
+	}
+	json_append(buf, "\"");
+}
+
+static void json_append_ops(struct json_buf *buf, const char *name, const struct write_extent *ops,
+			    size_t count, const char *trailer)
+{
+	json_append(buf, "  \"%s\": [", name);
+	for (size_t i = 0; i < count; i++)
+		json_append(buf, "%s\n    {\"start\": %u, \"len\": %u}", i ? "," : "", ops[i].start, ops[i].len);
+	json_append(buf, "%s]%s\n", count ? "\n  " : "", trailer);
+}
+
+/*
+ * @brief	Function to describe a write plan as JSON
+ *
+ * @param	flashctx	flash context
+ * @param	erase_layout	erase layout the plan was created with
+ * @param	plan		write plan
+ * @return	NUL-terminated JSON document allocated with malloc(),
+ *		NULL if out of memory
+ *
+ * Consecutive dirty blocks with the same erase requirement are reported as
+ * one range. The erase and write operations and the predicted time are only
+ * filled in if the plan was run through erase_write() in simulation mode.
+ */
+char *write_plan_to_json(const struct flashctx *flashctx, const struct erase_layout *erase_layout,
+		const struct write_plan *plan)
+{
+	struct json_buf buf = { 0 };
+	const char *sep = "";
+
+	json_append(&buf, "{\n  \"chip\": {\"vendor\": ");
+	json_append_string(&buf, flashctx->chip->vendor);
+	json_append(&buf, ", \"name\": ");
+	json_append_string(&buf, flashctx->chip->name);
+	json_append(&buf, ", \"size\": %u},\n", flashctx->chip->total_size * 1024);
+	json_append(&buf, "  \"erase_bytes\": %zu,\n  \"write_bytes\": %zu,\n",
+		    plan->erase_len, plan->write_len);
+	json_append(&buf, "  \"erase_planner\": \"%s\",\n  \"predicted_us\": %"PRIu64",\n",
+		    flashctx->flags.cost_erase_planner ? "cost" : "greedy", plan->predicted_us);
+
+	json_append(&buf, "  \"dirty_blocks\": [");
+	for (size_t i = 0; i < plan->block_count; i++) {
+		const uint8_t flags = plan->block_flags[i] & (WRITE_PLAN_DIRTY | WRITE_PLAN_NEEDS_ERASE);
+		if (!(flags & WRITE_PLAN_DIRTY))
+			continue;
+
+		size_t last = i;
+		while (last + 1 < plan->block_count &&
+		       (plan->block_flags[last + 1] & (WRITE_PLAN_DIRTY | WRITE_PLAN_NEEDS_ERASE)) == flags)
+			last++;
+
+		json_append(&buf, "%s\n    {\"start\": %u, \"end\": %u, \"needs_erase\": %s}", sep,
+			    erase_layout[0].layout_list[i].start_addr, erase_layout[0].layout_list[last].end_addr,
+			    flags & WRITE_PLAN_NEEDS_ERASE ? "true" : "false");
+		sep = ",";
+		i = last;
+	}
+	json_append(&buf, "%s],\n", *sep ? "\n  " : "");
+
+	sep = "";
+	json_append(&buf, "  \"writes\": [");
+	for (size_t i = 0; i < plan->extent_count; i++) {
+		json_append(&buf, "%s\n    {\"start\": %u, \"len\": %u}", sep,
+			    plan->extents[i].start, plan->extents[i].len);
+		sep = ",";
+	}
+	json_append(&buf, "%s],\n", *sep ? "\n  " : "");
+
+	json_append_ops(&buf, "erase_ops", plan->erase_ops, plan->erase_op_count, ",");
+	json_append_ops(&buf, "write_ops", plan->write_ops, plan->write_op_count, "");
+	json_append(&buf, "}\n");
+
+	if (buf.failed) {
+		free(buf.data);
+		return NULL;
+	}
+	return buf.data;
+}
+
 /*
  * @brief	Function to align start and address of the region boundaries
  *
@@ -210,16 +577,21 @@ static void deselect_erase_functions(const struct erase_layout *layout, size_t i
  * @param	block_num	index of the block to erase according to the erase function index
  * @param	curcontents	buffer containg the current contents of the flash
  * @param	newcontents	buffer containg the new contents of the flash
+ * @param	plan		write plan to take the results for untouched blocks from, may be NULL
  * @param	rstart		start address of the region
  * @rend	rend		end address of the region
  */
 static void select_erase_functions(struct flashctx *flashctx, const struct erase_layout *layout,
 				size_t findex, size_t block_num, uint8_t *curcontents, uint8_t *newcontents,
-				chipoff_t rstart, chipoff_t rend)
+				const struct write_plan *plan, chipoff_t rstart, chipoff_t rend)
 {
 	struct eraseblock_data *ll = &layout[findex].layout_list[block_num];
 	if (!findex) {
 		if (ll->start_addr >= rstart && ll->end_addr <= rend) {
+			if (plan_block_valid(plan, layout, block_num)) {
+				ll->selected = plan->block_flags[block_num] & WRITE_PLAN_NEEDS_ERASE;
+				return;
+			}
 			chipoff_t start_addr = ll->start_addr;
 			chipoff_t end_addr = ll->end_addr;
 			const chipsize_t erase_len = end_addr - start_addr + 1;
@@ -234,7 +606,7 @@ static void select_erase_functions(struct flashctx *flashctx, const struct erase
 
 		for (int j = sub_block_start; j <= sub_block_end; j++) {
 			select_erase_functions(flashctx, layout, findex - 1, j, curcontents, newcontents,
-						rstart, rend);
+						plan, rstart, rend);
 			if (layout[findex - 1].layout_list[j].selected)
 				count++;
 		}
@@ -260,20 +632,332 @@ static void select_erase_functions(struct flashctx *flashctx, const struct erase
 	}
 }
 
+struct write_queue {
+	struct flashctx *flashctx;
+	uint8_t *curcontents;
+	const uint8_t *newcontents;
+	const struct erase_layout *layout;
+	struct write_plan *plan;
+	bool *all_skipped;
+	struct write_extent pending;
+	/* Everything before this is written, blocks from here on are not yet journaled as such. */
+	chipoff_t journal_from;
+};
+
+static int flush_write(struct write_queue *queue)
+{
+	const chipoff_t start = queue->pending.start;
+	const chipsize_t len = queue->pending.len;
+
+	if (!len)
+		return 0;
+	queue->pending.len = 0;
+
+	if (queue->plan && queue->plan->simulate) {
+		if (append_op(&queue->plan->write_ops, &queue->plan->write_op_count, start, len))
+			return -1;
+	} else {
+		// execute write
+		int ret = write_flash(queue->flashctx, queue->newcontents + start, start, len);
+		if (ret) {
+			msg_cerr("Write failed at %#x, Abort.\n", start);
+			return -1;
+		}
+		queue->journal_from = journal_written(queue->flashctx->journal, queue->journal_from,
+						      start + len - 1);
+	}
+
+	// adjust curcontents
+	memcpy(queue->curcontents + start, queue->newcontents + start, len);
+	mark_plan_stale(queue->plan, queue->layout, start, start + len - 1);
+	msg_cdbg("W(%"PRIx32":%"PRIx32")", start, start + len - 1);
+
+	*queue->all_skipped = false;
+	return 0;
+}
+
+/* Queues a write, merging it with the pending one if they are contiguous. */
+static int queue_extent(struct write_queue *queue, chipoff_t start, chipsize_t len, bool mergeable)
+{
+	if (mergeable && queue->pending.len && queue->pending.start + queue->pending.len == start) {
+		queue->pending.len += len;
+		return 0;
+	}
+	if (flush_write(queue))
+		return -1;
+	queue->pending = (struct write_extent){ .start = start, .len = len };
+	return 0;
+}
+
+/*
+ * While a journal records the write, writes are split at journal blocks so
+ * that each finished block gets recorded before the next one is started.
+ */
+static int queue_write(struct write_queue *queue, chipoff_t start, chipsize_t len)
+{
+	const struct flashrom_journal *journal = queue->flashctx->journal;
+
+	if (!journal_active(journal))
+		return queue_extent(queue, start, len, true);
+
+	const size_t bs = journal_block_size(journal);
+	while (len) {
+		const chipsize_t chunk = len < bs - start % bs ? len : bs - start % bs;
+		if (queue_extent(queue, start, chunk, start % bs != 0))
+			return -1;
+		start += chunk;
+		len -= chunk;
+	}
+	return 0;
+}
+
+/* Returns the index of the first extent that ends after start. */
+static size_t first_extent_after(const struct write_plan *plan, chipoff_t start)
+{
+	size_t lo = 0, hi = plan->extent_count;
+
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		if (plan->extents[mid].start + plan->extents[mid].len <= start)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Queues the planned extents that intersect [start, end]. */
+static int queue_planned_writes(struct write_queue *queue, chipoff_t start, chipoff_t end)
+{
+	const struct write_plan *plan = queue->plan;
+
+	for (size_t i = first_extent_after(plan, start); i < plan->extent_count && plan->extents[i].start <= end; i++) {
+		const chipoff_t ext_end = plan->extents[i].start + plan->extents[i].len - 1;
+		const chipoff_t write_start = plan->extents[i].start > start ? plan->extents[i].start : start;
+		const chipoff_t write_end = ext_end < end ? ext_end : end;
+		if (queue_write(queue, write_start, write_end - write_start + 1))
+			return -1;
+	}
+	return 0;
+}
+
+/* Queues the differing chunks in [start, end] by comparing the buffers. */
+static int queue_diffed_writes(struct write_queue *queue, chipoff_t start, chipoff_t end)
+{
+	const unsigned int len = end - start + 1;
+	unsigned int start_here = 0, len_here;
+
+	while ((len_here = get_next_write(queue->curcontents + start + start_here,
+					  queue->newcontents + start + start_here,
+					  len - start_here, &start_here,
+					  queue->flashctx->chip->gran))) {
+		if (queue_write(queue, start + start_here, len_here))
+			return -1;
+		start_here += len_here;
+	}
+	return 0;
+}
+
+static bool plan_block_usable(const struct write_plan *plan, const struct erase_layout *layout,
+			      size_t block_num, chipoff_t rstart, chipoff_t rend)
+{
+	const struct eraseblock_data *ll = &layout[0].layout_list[block_num];
+
+	return ll->start_addr >= rstart && ll->end_addr <= rend &&
+		plan_block_valid(plan, layout, block_num);
+}
+
+struct erase_planner {
+	struct flashctx *flashctx;
+	const struct erase_layout *layout;
+	const uint8_t *curcontents;
+	const uint8_t *newcontents;
+	const struct write_plan *plan;
+	chipoff_t rstart;
+	chipoff_t rend;
+};
+
+/* Estimated cost of one block of the smallest eraser. */
+struct block_cost {
+	uint64_t keep_us;	/* Programming it without erasing it first. */
+	uint64_t erased_us;	/* Programming it after it was erased. */
+	bool needs_erase;
+};
+
+static uint64_t add_cost(uint64_t a, uint64_t b)
+{
+	return a + b > COST_INFINITE ? COST_INFINITE : a + b;
+}
+
+static uint64_t erase_cost_us(const struct erase_layout *layout, size_t findex, chipsize_t len)
+{
+	if (layout[findex].eraser->typ_erase_us)
+		return layout[findex].eraser->typ_erase_us;
+	return DEFAULT_ERASE_BASE_US + (uint64_t)len / 1024 * DEFAULT_ERASE_US_PER_KIB;
+}
+
+static uint64_t program_cost_us(const struct flashctx *flashctx, size_t bytes)
+{
+	const struct flashchip *chip = flashctx->chip;
+	const unsigned int page_size = chip->page_size ? chip->page_size : DEFAULT_PAGE_SIZE;
+	const unsigned int page_us = chip->typ_page_program_us ? chip->typ_page_program_us
+							       : DEFAULT_PAGE_PROGRAM_US;
+
+	return (uint64_t)(bytes + page_size - 1) / page_size * page_us +
+		(uint64_t)bytes * TRANSFER_NS_PER_BYTE / 1000;
+}
+
+static void get_block_cost(const struct erase_planner *planner, size_t block_num, struct block_cost *cost)
+{
+	const struct eraseblock_data *ll = &planner->layout[0].layout_list[block_num];
+	const chipoff_t start = ll->start_addr > planner->rstart ? ll->start_addr : planner->rstart;
+	const chipoff_t end = ll->end_addr < planner->rend ? ll->end_addr : planner->rend;
+	const struct write_plan *plan = planner->plan;
+	size_t write_len = 0, first;
+
+	memset(cost, 0, sizeof(*cost));
+	if (start > end)
+		return;
+
+	if (plan_block_usable(plan, planner->layout, block_num, planner->rstart, planner->rend)) {
+		for (size_t i = first_extent_after(plan, start);
+		     i < plan->extent_count && plan->extents[i].start <= end; i++) {
+			const chipoff_t ext_end = plan->extents[i].start + plan->extents[i].len - 1;
+			write_len += (ext_end < end ? ext_end : end) -
+				     (plan->extents[i].start > start ? plan->extents[i].start : start) + 1;
+		}
+		cost->needs_erase = plan->block_flags[block_num] & WRITE_PLAN_NEEDS_ERASE;
+	} else {
+		const unsigned int len = end - start + 1;
+		unsigned int write_start = 0, len_here;
+
+		while ((len_here = get_next_write(planner->curcontents + start + write_start,
+						  planner->newcontents + start + write_start,
+						  len - write_start, &write_start, planner->flashctx->chip->gran))) {
+			write_len += len_here;
+			write_start += len_here;
+		}
+		/* Blocks only partially inside the region can't be erased anyway. */
+		if (start == ll->start_addr && end == ll->end_addr)
+			cost->needs_erase = need_erase(planner->curcontents + start, planner->newcontents + start,
+						       len, planner->flashctx->chip->gran,
+						       ERASED_VALUE(planner->flashctx));
+	}
+
+	cost->keep_us = program_cost_us(planner->flashctx, write_len);
+	cost->erased_us = program_cost_us(planner->flashctx,
+			memdiff_count_unerased(planner->newcontents + start, end - start + 1,
+					       ERASED_VALUE(planner->flashctx), &first));
+}
+
+/*
+ * @brief	Function to select the sectors to erase by estimated cost
+ *
+ * @param	planner		planner state of the region
+ * @param	findex		index of the erase function
+ * @param	block_num	index of the block according to the erase function index
+ * @param	erased_us	pointer to store the cost of programming the block after erasing it
+ * @return	estimated time in microseconds to bring the block to the new contents
+ *
+ * Dynamic programming over the erase layout tree: a block is either erased as
+ * a whole and its preserved and new data programmed back, or left to the
+ * cheapest choice for each of its sub-blocks. Blocks that can't be written
+ * without an erase have infinite cost unless an erase covers them.
+ */
+static uint64_t select_erase_functions_by_cost(const struct erase_planner *planner, size_t findex,
+					       size_t block_num, uint64_t *erased_us)
+{
+	const struct erase_layout *layout = planner->layout;
+	struct eraseblock_data *ll = &layout[findex].layout_list[block_num];
+	uint64_t keep_us = 0;
+
+	ll->selected = false;
+	if (!findex) {
+		struct block_cost cost;
+		get_block_cost(planner, block_num, &cost);
+		*erased_us = cost.erased_us;
+		keep_us = cost.needs_erase ? COST_INFINITE : cost.keep_us;
+	} else {
+		*erased_us = 0;
+		for (size_t j = ll->first_sub_block_index; j <= ll->last_sub_block_index; j++) {
+			uint64_t sub_erased_us;
+			keep_us = add_cost(keep_us, select_erase_functions_by_cost(planner, findex - 1, j,
+										   &sub_erased_us));
+			*erased_us = add_cost(*erased_us, sub_erased_us);
+		}
+	}
+
+	if (ll->start_addr < planner->rstart || ll->end_addr > planner->rend)
+		return keep_us;
+
+	const uint64_t erase_us = add_cost(erase_cost_us(layout, findex, ll->end_addr - ll->start_addr + 1),
+					   *erased_us);
+	if (erase_us >= keep_us)
+		return keep_us;
+
+	if (findex)
+		deselect_erase_functions(layout, findex - 1, ll->first_sub_block_index, ll->last_sub_block_index);
+	ll->selected = true;
+	return erase_us;
+}
+
+/* Returns the estimated cost of the current selection for a block and its sub-blocks. */
+static uint64_t selection_cost(const struct erase_planner *planner, size_t findex, size_t block_num, bool erased)
+{
+	const struct eraseblock_data *ll = &planner->layout[findex].layout_list[block_num];
+	uint64_t cost = 0;
+
+	if (ll->selected) {
+		cost = erase_cost_us(planner->layout, findex, ll->end_addr - ll->start_addr + 1);
+		erased = true;
+	}
+
+	if (!findex) {
+		struct block_cost bcost;
+		get_block_cost(planner, block_num, &bcost);
+		return cost + (erased ? bcost.erased_us : bcost.keep_us);
+	}
+
+	for (size_t j = ll->first_sub_block_index; j <= ll->last_sub_block_index; j++)
+		cost += selection_cost(planner, findex - 1, j, erased);
+	return cost;
+}
+
 static int erase_write_helper(struct flashctx *const flashctx, chipoff_t region_start, chipoff_t region_end,
 		uint8_t *curcontents, uint8_t *newcontents,
-		struct erase_layout *erase_layout, bool *all_skipped)
+		struct erase_layout *erase_layout, struct write_plan *plan, bool *all_skipped)
 {
 	const size_t erasefn_count = count_usable_erasers(flashctx);
+	const struct erase_planner planner = {
+		.flashctx	= flashctx,
+		.layout		= erase_layout,
+		.curcontents	= curcontents,
+		.newcontents	= newcontents,
+		.plan		= plan,
+		.rstart		= region_start,
+		.rend		= region_end,
+	};
 
 	// select erase functions
 	for (size_t i = 0; i < erase_layout[erasefn_count - 1].block_count; i++) {
-		if (erase_layout[erasefn_count - 1].layout_list[i].start_addr <= region_end &&
-			region_start <= erase_layout[erasefn_count - 1].layout_list[i].end_addr)
+		if (erase_layout[erasefn_count - 1].layout_list[i].start_addr > region_end ||
+		    region_start > erase_layout[erasefn_count - 1].layout_list[i].end_addr)
+			continue;
+
+		if (flashctx->flags.cost_erase_planner) {
+			uint64_t erased_us;
+			const uint64_t cost = select_erase_functions_by_cost(&planner, erasefn_count - 1, i,
+									     &erased_us);
+			if (plan)
+				plan->predicted_us += cost;
+		} else {
 			select_erase_functions(flashctx, erase_layout,
 						erasefn_count - 1, i,
-						curcontents, newcontents,
+						curcontents, newcontents, plan,
 						region_start, region_end);
+			if (plan)
+				plan->predicted_us += selection_cost(&planner, erasefn_count - 1, i, false);
+		}
 	}
 
 	// erase
@@ -285,23 +969,33 @@ static int erase_write_helper(struct flashctx *const flashctx, chipoff_t region_
 			chipoff_t start_addr = erase_layout[i].layout_list[j].start_addr;
 			unsigned int block_len = erase_layout[i].layout_list[j].end_addr - start_addr + 1;
 			const uint8_t erased_value = ERASED_VALUE(flashctx);
-			// execute erase
-			erasefunc_t *erasefn = lookup_erase_func_ptr(erase_layout[i].eraser);
 
+			if (plan && plan->simulate) {
+				if (append_op(&plan->erase_ops, &plan->erase_op_count, start_addr, block_len))
+					return -1;
+			} else {
+				// execute erase
+				erasefunc_t *erasefn = lookup_erase_func_ptr(erase_layout[i].eraser);
 
-			if (erasefn(flashctx, start_addr, block_len)) {
-				return -1;
-			}
-			if (flashctx->flags.verify_after_write
-				&& check_erased_range(flashctx, start_addr, block_len)) {
-				msg_cerr("ERASE FAILED!\n");
-				return -1;
-			}
+				journal_erasing(flashctx->journal, start_addr, start_addr + block_len - 1);
+				const enum flashrom_stats_stage stage = stats_set_stage(flashctx, FLASHROM_STATS_ERASE);
+				const int erase_ret = erasefn(flashctx, start_addr, block_len);
+				stats_set_stage(flashctx, stage);
+				if (erase_ret) {
+					return -1;
+				}
+				if (flashctx->flags.verify_after_write
+					&& check_erased_range(flashctx, start_addr, block_len)) {
+					msg_cerr("ERASE FAILED!\n");
+					return -1;
+				}
 
-			update_progress(flashctx, FLASHROM_PROGRESS_ERASE, block_len);
+				update_progress(flashctx, FLASHROM_PROGRESS_ERASE, block_len);
+			}
 
 			// adjust curcontents
 			memset(curcontents+start_addr, erased_value, block_len);
+			mark_plan_stale(plan, erase_layout, start_addr, start_addr + block_len - 1);
 			// after erase make it unselected again
 			erase_layout[i].layout_list[j].selected = false;
 			msg_cdbg("E(%"PRIx32":%"PRIx32")", start_addr, start_addr + block_len - 1);
@@ -311,32 +1005,46 @@ static int erase_write_helper(struct flashctx *const flashctx, chipoff_t region_
 	}
 
 	// write
-	unsigned int start_here = 0, len_here = 0, erase_len = region_end - region_start + 1;
-	while ((len_here = get_next_write(curcontents + region_start + start_here,
-					newcontents + region_start + start_here,
-					erase_len - start_here, &start_here,
-					flashctx->chip->gran))) {
-		// execute write
-		int ret = write_flash(flashctx,
-				newcontents + region_start + start_here,
-				region_start + start_here, len_here);
-		if (ret) {
-			msg_cerr("Write failed at %#x, Abort.\n", region_start + start_here);
-			return -1;
-		}
+	struct write_queue queue = {
+		.flashctx	= flashctx,
+		.curcontents	= curcontents,
+		.newcontents	= newcontents,
+		.layout		= erase_layout,
+		.plan		= plan,
+		.all_skipped	= all_skipped,
+		.journal_from	= region_start,
+	};
+	chipoff_t addr = region_start;
+	while (addr <= region_end) {
+		/*
+		 * Split the range into runs of blocks the plan is still accurate for,
+		 * which take their extents from it, and runs that need to be compared
+		 * again (erased, written, or only partially inside the region).
+		 */
+		size_t block = find_smallest_block(erase_layout, addr);
+		const bool usable = plan_block_usable(plan, erase_layout, block, region_start, region_end);
+		chipoff_t run_end = erase_layout[0].layout_list[block].end_addr;
 
-		// adjust curcontents
-		memcpy(curcontents + region_start + start_here,
-			newcontents + region_start + start_here, len_here);
-		msg_cdbg("W(%"PRIx32":%"PRIx32")", region_start + start_here, region_start + start_here + len_here - 1);
+		while (run_end < region_end &&
+		       plan_block_usable(plan, erase_layout, block + 1, region_start, region_end) == usable)
+			run_end = erase_layout[0].layout_list[++block].end_addr;
+		if (run_end > region_end)
+			run_end = region_end;
 
-		*all_skipped = false;
+		int ret = usable ? queue_planned_writes(&queue, addr, run_end)
+				 : queue_diffed_writes(&queue, addr, run_end);
+		if (ret)
+			return -1;
+		addr = run_end + 1;
 	}
 
+	if (flush_write(&queue))
+		return -1;
+	if (!plan || !plan->simulate)
+		journal_written(flashctx->journal, queue.journal_from, region_end);
 	return 0;
 }
 
-
 /*
  * @brief	wrapper to use the erase algorithm
  *
@@ -346,16 +1054,25 @@ static int erase_write_helper(struct flashctx *const flashctx, chipoff_t region_
  * @param       curcontents     buffer containg the current contents of the flash
  * @param       newcontents     buffer containg the new contents of the flash
  * @param	erase_layout	erase layout
+ * @param	plan		write plan created for the included regions, may be NULL
  * @param	all_skipped	pointer to the flag to chec if any block was erased
+ *
+ * If the plan is in simulation mode the erase and write operations are only
+ * recorded in it and applied to curcontents, the chip is left untouched.
  */
 int erase_write(struct flashctx *const flashctx, chipoff_t region_start, chipoff_t region_end,
 		uint8_t *curcontents, uint8_t *newcontents,
-		struct erase_layout *erase_layout, bool *all_skipped)
+		struct erase_layout *erase_layout, struct write_plan *plan, bool *all_skipped)
 {
 	int ret = 0;
 	chipoff_t old_start = region_start, old_end = region_end;
 	align_region(erase_layout, flashctx, &region_start, &region_end);
 
+	if (plan) {
+		plan->active_start = old_start;
+		plan->active_end = old_end;
+	}
+
 	if (!flashctx->flags.skip_unwritable_regions) {
 		if (check_for_unwritable_regions(flashctx, region_start, region_end - region_start + 1))
 			return -1;
@@ -373,6 +1090,7 @@ int erase_write(struct flashctx *const flashctx, chipoff_t region_start, chipoff
 			goto _end;
 		}
 		read_flash(flashctx, curcontents + region_start, region_start, start_buf_len);
+		mark_plan_stale(plan, erase_layout, region_start, old_start - 1);
 		memcpy(old_start_buf, newcontents + region_start, start_buf_len);
 		memcpy(newcontents + region_start, curcontents + region_start, start_buf_len);
 	}
@@ -385,6 +1103,7 @@ int erase_write(struct flashctx *const flashctx, chipoff_t region_start, chipoff
 			goto _end;
 		}
 		read_flash(flashctx, curcontents + end_offset, end_offset, end_buf_len);
+		mark_plan_stale(plan, erase_layout, end_offset, region_end);
 		memcpy(old_end_buf, newcontents + end_offset, end_buf_len);
 		memcpy(newcontents + end_offset, curcontents + end_offset, end_buf_len);
 	}
@@ -413,7 +1132,8 @@ int erase_write(struct flashctx *const flashctx, chipoff_t region_start, chipoff
 		free(region.name);
 
 
-		ret = erase_write_helper(flashctx, addr, addr + len - 1, curcontents, newcontents, erase_layout, all_skipped);
+		ret = erase_write_helper(flashctx, addr, addr + len - 1, curcontents, newcontents,
+					 erase_layout, plan, all_skipped);
 		if (ret)
 			goto _end;
 	}
@@ -428,6 +1148,7 @@ _end:
 		free(old_end_buf);
 	}
 
-	msg_cinfo("Erase/write done from %"PRIx32" to %"PRIx32"\n", region_start, region_end);
+	if (!plan || !plan->simulate)
+		msg_cinfo("Erase/write done from %"PRIx32" to %"PRIx32"\n", region_start, region_end);
 	return ret;
 }
@@ -108,7 +108,9 @@
 		/* supports SFDP */
 		/* OTP: 1024B total, 256B reserved; read 0x48; write 0x42, erase 0x44, read ID 0x4B */
 		.feature_bits	= FEATURE_WRSR_WREN | FEATURE_OTP |
-				  FEATURE_WRSR_EXT2 | FEATURE_WRSR2 | FEATURE_WRSR3,
+				  FEATURE_WRSR_EXT2 | FEATURE_WRSR2 | FEATURE_WRSR3 |
+				  FEATURE_FAST_READ_DOUT | FEATURE_FAST_READ_DIO |
+				  FEATURE_FAST_READ_QOUT | FEATURE_FAST_READ_QIO,
 		.tested		= TEST_OK_PREWB,
 		.probe		= PROBE_SPI_RDID,
 		.probe_timing	= TIMING_ZERO,
@@ -145,6 +147,7 @@
 			.sec	= {STATUS1, 6, RW},
 			.cmp	= {STATUS2, 6, RW},
 			.wps	= {STATUS3, 2, RW},
+			.qe	= {STATUS2, 1, RW},
 		},
 		.decode_range	= DECODE_RANGE_SPI25,
 	},
@@ -357,7 +360,9 @@
 		.page_size	= 256,
 		/* supports SFDP */
 		/* OTP: 1024B total, 256B reserved; read 0x48; write 0x42, erase 0x44, read ID 0x4B */
-		.feature_bits	= FEATURE_WRSR_WREN | FEATURE_OTP | FEATURE_WRSR2,
+		.feature_bits	= FEATURE_WRSR_WREN | FEATURE_OTP | FEATURE_WRSR2 |
+				  FEATURE_FAST_READ_DOUT | FEATURE_FAST_READ_DIO |
+				  FEATURE_FAST_READ_QOUT | FEATURE_FAST_READ_QIO,
 		.tested		= TEST_OK_PREWB,
 		.probe		= PROBE_SPI_RDID,
 		.probe_timing	= TIMING_ZERO,
@@ -393,6 +398,7 @@
 			.tb     = {STATUS1, 5, RW},
 			.sec    = {STATUS1, 6, RW},
 			.cmp    = {STATUS2, 6, RW},
+			.qe     = {STATUS2, 1, RW},
 		},
 		.decode_range	= DECODE_RANGE_SPI25,
 	},
@@ -913,7 +919,9 @@
 		.page_size	= 256,
 		/* supports SFDP */
 		/* OTP: 1024B total, 256B reserved; read 0x48; write 0x42, erase 0x44, read ID 0x4B */
-		.feature_bits	= FEATURE_WRSR_WREN | FEATURE_OTP | FEATURE_WRSR_EXT2,
+		.feature_bits	= FEATURE_WRSR_WREN | FEATURE_OTP | FEATURE_WRSR_EXT2 |
+				  FEATURE_FAST_READ_DOUT | FEATURE_FAST_READ_DIO |
+				  FEATURE_FAST_READ_QOUT | FEATURE_FAST_READ_QIO,
 		.tested		= TEST_OK_PREW,
 		.probe		= PROBE_SPI_RDID,
 		.probe_timing	= TIMING_ZERO,
@@ -949,6 +957,7 @@
 			.tb     = {STATUS1, 5, RW},
 			.sec    = {STATUS1, 6, RW},
 			.cmp    = {STATUS2, 6, RW},
+			.qe     = {STATUS2, 1, RW},
 		},
 		.decode_range	= DECODE_RANGE_SPI25,
 	},
@@ -964,7 +973,9 @@
 		/* supports SFDP */
 		/* OTP: 1024B total, 256B reserved; read 0x48; write 0x42, erase 0x44, read ID 0x4B */
 		.feature_bits	= FEATURE_WRSR_WREN | FEATURE_OTP | FEATURE_QPI |
-				  FEATURE_WRSR_EXT2 | FEATURE_WRSR2 | FEATURE_WRSR3,
+				  FEATURE_WRSR_EXT2 | FEATURE_WRSR2 | FEATURE_WRSR3 |
+				  FEATURE_FAST_READ_DOUT | FEATURE_FAST_READ_DIO |
+				  FEATURE_FAST_READ_QOUT | FEATURE_FAST_READ_QIO,
 		.tested		= TEST_OK_PREW,
 		.probe		= PROBE_SPI_RDID,
 		.probe_timing	= TIMING_ZERO,
@@ -1001,6 +1012,7 @@
 			.sec    = {STATUS1, 6, RW},
 			.cmp    = {STATUS2, 6, RW},
 			.wps    = {STATUS3, 2, RW},
+			.qe     = {STATUS2, 1, RW},
 		},
 		.decode_range	= DECODE_RANGE_SPI25,
 	},
@@ -1068,7 +1080,9 @@
 		/* supports SFDP */
 		/* OTP: 1024B total, 256B reserved; read 0x48; write 0x42, erase 0x44, read ID 0x4B */
 		.feature_bits	= FEATURE_WRSR_WREN | FEATURE_OTP |
-				  FEATURE_WRSR_EXT2 | FEATURE_WRSR2 | FEATURE_WRSR3,
+				  FEATURE_WRSR_EXT2 | FEATURE_WRSR2 | FEATURE_WRSR3 |
+				  FEATURE_FAST_READ_DOUT | FEATURE_FAST_READ_DIO |
+				  FEATURE_FAST_READ_QOUT | FEATURE_FAST_READ_QIO,
 		.tested		= TEST_OK_PREW,
 		.probe		= PROBE_SPI_RDID,
 		.probe_timing	= TIMING_ZERO,
@@ -1105,6 +1119,7 @@
 			.sec    = {STATUS1, 6, RW},
 			.cmp    = {STATUS2, 6, RW},
 			.wps    = {STATUS3, 2, RW},
+			.qe     = {STATUS2, 1, RW},
 		},
 		.decode_range	= DECODE_RANGE_SPI25,
 	},
@@ -1541,7 +1556,9 @@
 		.page_size	= 256,
 		/* supports SFDP */
 		/* OTP: 1024B total, 256B reserved; read 0x48; write 0x42, erase 0x44, read ID 0x4B */
-		.feature_bits	= FEATURE_WRSR_WREN | FEATURE_OTP | FEATURE_WRSR2,
+		.feature_bits	= FEATURE_WRSR_WREN | FEATURE_OTP | FEATURE_WRSR2 |
+				  FEATURE_FAST_READ_DOUT | FEATURE_FAST_READ_DIO |
+				  FEATURE_FAST_READ_QOUT | FEATURE_FAST_READ_QIO,
 		.tested		= TEST_OK_PREWB,
 		.probe		= PROBE_SPI_RDID,
 		.probe_timing	= TIMING_ZERO,
@@ -1577,6 +1594,7 @@
 			.tb	= {STATUS1, 5, RW},
 			.sec	= {STATUS1, 6, RW},
 			.cmp	= {STATUS2, 6, RW},
+			.qe	= {STATUS2, 1, RW},
 		},
 		.decode_range	= DECODE_RANGE_SPI25,
 	},
@@ -1592,7 +1610,9 @@
 		/* supports SFDP */
 		/* OTP: 1024B total, 256B reserved; read 0x48; write 0x42, erase 0x44, read ID 0x4B */
 		.feature_bits	= FEATURE_WRSR_WREN | FEATURE_OTP |
-				  FEATURE_WRSR_EXT2 | FEATURE_WRSR2 | FEATURE_WRSR3,
+				  FEATURE_WRSR_EXT2 | FEATURE_WRSR2 | FEATURE_WRSR3 |
+				  FEATURE_FAST_READ_DOUT | FEATURE_FAST_READ_DIO |
+				  FEATURE_FAST_READ_QOUT | FEATURE_FAST_READ_QIO,
 		.tested		= TEST_OK_PREWB,
 		.probe		= PROBE_SPI_RDID,
 		.probe_timing	= TIMING_ZERO,
@@ -1629,6 +1649,7 @@
 			.sec	= {STATUS1, 6, RW},
 			.cmp	= {STATUS2, 6, RW},
 			.wps	= {STATUS3, 2, RW},
+			.qe	= {STATUS2, 1, RW},
 		},
 		.decode_range	= DECODE_RANGE_SPI25,
 	},
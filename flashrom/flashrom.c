@@ -16,6 +16,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <time.h>
 #include <errno.h>
 #include <ctype.h>
 
@@ -25,37 +26,18 @@
 #include "programmer.h"
 #include "hwaccess_physmap.h"
 #include "chipdrivers.h"
+#include "spi.h"
 #include "erasure_layout.h"
+#include "journal.h"
+#include "manifest.h"
+#include "memdiff.h"
+#include "probe_index.h"
+#include "stats.h"
+#include "trace.h"
 #include "platform/udelay.h"
 
 const char flashrom_version[] = FLASHROM_VERSION;
 
-static const struct programmer_entry *programmer = NULL;
-
-/*
- * Programmers supporting multiple buses can have differing size limits on
- * each bus. Store the limits for each bus in a common struct.
- */
-struct decode_sizes max_rom_decode;
-
-/* If nonzero, used as the start address of bottom-aligned flash. */
-uintptr_t flashbase;
-
-/* Is writing allowed with this programmer? */
-bool programmer_may_write;
-
-#define SHUTDOWN_MAXFN 32
-static int shutdown_fn_count = 0;
-/** @private */
-static struct shutdown_func_data {
-	int (*func) (void *data);
-	void *data;
-} shutdown_fn[SHUTDOWN_MAXFN];
-/* Initialize to 0 to make sure nobody registers a shutdown function before
- * programmer init.
- */
-static bool may_register_shutdown = false;
-
 static struct bus_type_info {
 	enum chipbustype type;
 	const char *name;
@@ -77,19 +59,21 @@ static struct bus_type_info {
  */
 int register_shutdown(int (*function) (void *data), void *data)
 {
-	if (shutdown_fn_count >= SHUTDOWN_MAXFN) {
+	struct flashrom_programmer *const prog = programmer_current();
+
+	if (prog->shutdown_fn_count >= SHUTDOWN_MAXFN) {
 		msg_perr("Tried to register more than %i shutdown functions.\n",
 			 SHUTDOWN_MAXFN);
 		return 1;
 	}
-	if (!may_register_shutdown) {
+	if (!prog->may_register_shutdown) {
 		msg_perr("Tried to register a shutdown function before "
 			 "programmer init.\n");
 		return 1;
 	}
-	shutdown_fn[shutdown_fn_count].func = function;
-	shutdown_fn[shutdown_fn_count].data = data;
-	shutdown_fn_count++;
+	prog->shutdown_fn[prog->shutdown_fn_count].func = function;
+	prog->shutdown_fn[prog->shutdown_fn_count].data = data;
+	prog->shutdown_fn_count++;
 
 	return 0;
 }
@@ -130,21 +114,22 @@ int programmer_init(const struct programmer_entry *prog, const char *param)
 		msg_perr("Invalid programmer specified!\n");
 		return -1;
 	}
-	programmer = prog;
+	struct flashrom_programmer *const ctx = programmer_current();
+	ctx->entry = prog;
 	/* Initialize all programmer specific data. */
 	/* Default to unlimited decode sizes. */
-	max_rom_decode = (const struct decode_sizes) {
+	ctx->rom_decode = (const struct decode_sizes) {
 		.parallel	= 0xffffffff,
 		.lpc		= 0xffffffff,
 		.fwh		= 0xffffffff,
 		.spi		= 0xffffffff,
 	};
 	/* Default to top aligned flash at 4 GB. */
-	flashbase = 0;
+	ctx->flash_base = 0;
 	/* Registering shutdown functions is now allowed. */
-	may_register_shutdown = true;
+	ctx->may_register_shutdown = true;
 	/* Default to allowing writes. Broken programmers set this to 0. */
-	programmer_may_write = true;
+	ctx->may_write = true;
 
 	struct programmer_cfg cfg;
 
@@ -187,15 +172,19 @@ int programmer_init(const struct programmer_entry *prog, const char *param)
  * @return The OR-ed result values of all shutdown functions (i.e. 0 on success). */
 int programmer_shutdown(void)
 {
+	struct flashrom_programmer *const prog = programmer_current();
 	int ret = 0;
 
 	/* Registering shutdown functions is no longer allowed. */
-	may_register_shutdown = false;
-	while (shutdown_fn_count > 0) {
-		int i = --shutdown_fn_count;
-		ret |= shutdown_fn[i].func(shutdown_fn[i].data);
+	prog->may_register_shutdown = false;
+	while (prog->shutdown_fn_count > 0) {
+		int i = --prog->shutdown_fn_count;
+		ret |= prog->shutdown_fn[i].func(prog->shutdown_fn[i].data);
 	}
-	registered_master_count = 0;
+	prog->master_count = 0;
+	prog->entry = NULL;
+	clear_spi_id_cache(prog);
+	probe_index_release(prog);
 
 	return ret;
 }
@@ -252,6 +241,22 @@ static bool master_uses_physmap(const struct registered_master *mst)
 	return false;
 }
 
+static void master_delay(const struct flashctx *flash, unsigned int usecs)
+{
+	if (flash->mst->buses_supported & BUS_SPI) {
+		if (flash->mst->spi.delay)
+			return flash->mst->spi.delay(flash, usecs);
+	} else if (flash->mst->buses_supported & BUS_PARALLEL) {
+		if (flash->mst->par.delay)
+			return flash->mst->par.delay(flash, usecs);
+	} else if (flash->mst->buses_supported & BUS_PROG) {
+		if (flash->mst->opaque.delay)
+			return flash->mst->opaque.delay(flash, usecs);
+	}
+
+	return default_delay(usecs);
+}
+
 void programmer_delay(const struct flashctx *flash, unsigned int usecs)
 {
 	if (usecs == 0)
@@ -272,18 +277,11 @@ void programmer_delay(const struct flashctx *flash, unsigned int usecs)
 		return default_delay(usecs);
 	}
 
-	if (flash->mst->buses_supported & BUS_SPI) {
-		if (flash->mst->spi.delay)
-			return flash->mst->spi.delay(flash, usecs);
-	} else if (flash->mst->buses_supported & BUS_PARALLEL) {
-		if (flash->mst->par.delay)
-			return flash->mst->par.delay(flash, usecs);
-	} else if (flash->mst->buses_supported & BUS_PROG) {
-		if (flash->mst->opaque.delay)
-			return flash->mst->opaque.delay(flash, usecs);
-	}
-
-	return default_delay(usecs);
+	const uint64_t start = stats_start(flash);
+	const uint64_t trace_start = trace_begin(flash);
+	master_delay(flash, usecs);
+	stats_count_delay(flash, start);
+	trace_delay(flash, usecs, trace_start);
 }
 
 int read_memmapped(struct flashctx *flash, uint8_t *buf, unsigned int start,
@@ -518,42 +516,71 @@ unsigned int count_usable_erasers(const struct flashctx *flash)
 	return usable_erasefunctions;
 }
 
-static int compare_range(const uint8_t *wantbuf, const uint8_t *havebuf, unsigned int start, unsigned int len)
+/*
+ * Size of the smallest erase block, the granularity of the manifest and the
+ * write journal.
+ */
+size_t chip_min_block_size(const struct flashchip *chip)
 {
-	int ret = 0, failcount = 0;
-	unsigned int i;
-	for (i = 0; i < len; i++) {
-		if (wantbuf[i] != havebuf[i]) {
-			/* Only print the first failure. */
-			if (!failcount++)
-				msg_cerr("FAILED at 0x%08x! Expected=0x%02x, Found=0x%02x,",
-					 start + i, wantbuf[i], havebuf[i]);
+	const size_t chip_size = chip->total_size * 1024;
+	size_t block_size = chip_size;
+
+	for (size_t i = 0; i < NUM_ERASEFUNCTIONS; i++) {
+		const struct block_eraser *eraser = &chip->block_erasers[i];
+		if (eraser->block_erase == NO_BLOCK_ERASE_FUNC)
+			continue;
+		for (size_t j = 0; j < NUM_ERASEREGIONS; j++) {
+			if (eraser->eraseblocks[j].count && eraser->eraseblocks[j].size < block_size)
+				block_size = eraser->eraseblocks[j].size;
 		}
 	}
-	if (failcount) {
-		msg_cerr(" failed byte count from 0x%08x-0x%08x: 0x%x\n",
-			 start, start + len - 1, failcount);
-		ret = -1;
-	}
-	return ret;
+
+	/* Non-uniform erasers may not tile the chip, fall back to 1 KiB blocks then. */
+	if (!block_size || chip_size % block_size)
+		block_size = 1024;
+	return block_size;
 }
 
-/* start is an offset to the base address of the flash chip */
-int check_erased_range(struct flashctx *flash, unsigned int start, unsigned int len)
+static int compare_range(const uint8_t *wantbuf, const uint8_t *havebuf, unsigned int start, unsigned int len)
 {
-	int ret;
-	const uint8_t erased_value = ERASED_VALUE(flash);
+	size_t first;
+	const size_t failcount = memdiff_count(havebuf, wantbuf, len, &first);
 
-	uint8_t *cmpbuf = malloc(len);
-	if (!cmpbuf) {
-		msg_gerr("Out of memory!\n");
-		return -1;
-	}
-	memset(cmpbuf, erased_value, len);
-	ret = verify_range(flash, cmpbuf, start, len);
+	if (!failcount)
+		return 0;
 
-	free(cmpbuf);
-	return ret;
+	/* Only print the first failure. */
+	msg_cerr("FAILED at 0x%08zx! Expected=0x%02x, Found=0x%02x,",
+		 start + first, wantbuf[first], havebuf[first]);
+	msg_cerr(" failed byte count from 0x%08x-0x%08x: 0x%zx\n",
+		 start, start + len - 1, failcount);
+	return -1;
+}
+
+/* Same as compare_range(), but against a buffer filled with erased_value. */
+static int compare_erased_range(uint8_t erased_value, const uint8_t *havebuf, unsigned int start, unsigned int len)
+{
+	size_t first;
+	const size_t failcount = memdiff_count_unerased(havebuf, len, erased_value, &first);
+
+	if (!failcount)
+		return 0;
+
+	msg_cerr("FAILED at 0x%08zx! Expected=0x%02x, Found=0x%02x,",
+		 start + first, erased_value, havebuf[first]);
+	msg_cerr(" failed byte count from 0x%08x-0x%08x: 0x%zx\n",
+		 start, start + len - 1, failcount);
+	return -1;
+}
+
+static int verify_range_common(struct flashctx *flash, const uint8_t *cmpbuf,
+			       unsigned int start, unsigned int len);
+
+/* start is an offset to the base address of the flash chip */
+int check_erased_range(struct flashctx *flash, unsigned int start, unsigned int len)
+{
+	/* No compare buffer, the read contents are checked against the erased value directly. */
+	return verify_range_common(flash, NULL, start, len);
 }
 
 #ifdef FLASHROM_TEST
@@ -641,12 +668,14 @@ int read_flash(struct flashctx *flash, uint8_t *buf, unsigned int start, unsigne
 
 /*
  * @cmpbuf	buffer to compare against, cmpbuf[0] is expected to match the
- *		flash content at location start
+ *		flash content at location start. If NULL, the flash content is
+ *		expected to be erased.
  * @start	offset to the base address of the flash chip
  * @len		length of the verified area
  * @return	0 for success, -1 for failure
  */
-int verify_range(struct flashctx *flash, const uint8_t *cmpbuf, unsigned int start, unsigned int len)
+static int verify_range_common(struct flashctx *flash, const uint8_t *cmpbuf,
+			       unsigned int start, unsigned int len)
 {
 	if (!len)
 		return -1;
@@ -701,7 +730,10 @@ int verify_range(struct flashctx *flash, const uint8_t *cmpbuf, unsigned int sta
 			goto out_free;
 		}
 
-		ret = compare_range(cmpbuf + (addr - start), readbuf, addr, read_len);
+		if (cmpbuf)
+			ret = compare_range(cmpbuf + (addr - start), readbuf, addr, read_len);
+		else
+			ret = compare_erased_range(ERASED_VALUE(flash), readbuf, addr, read_len);
 		if (ret)
 			goto out_free;
 
@@ -712,20 +744,22 @@ out_free:
 	return ret;
 }
 
+int verify_range(struct flashctx *flash, const uint8_t *cmpbuf, unsigned int start, unsigned int len)
+{
+	return verify_range_common(flash, cmpbuf, start, len);
+}
+
 /* Helper function for need_erase() that focuses on granularities of gran bytes. */
 static int need_erase_gran_bytes(const uint8_t *have, const uint8_t *want, unsigned int len,
                                  unsigned int gran, const uint8_t erased_value)
 {
-	unsigned int i, j, limit;
+	unsigned int j;
 	for (j = 0; j < len / gran; j++) {
-		limit = min (gran, len - j * gran);
-		/* Are 'have' and 'want' identical? */
-		if (!memcmp(have + j * gran, want + j * gran, limit))
-			continue;
-		/* have needs to be in erased state. */
-		for (i = 0; i < limit; i++)
-			if (have[j * gran + i] != erased_value)
-				return 1;
+		bool all_erased;
+		/* If 'have' and 'want' differ, have needs to be in erased state. */
+		if (memdiff_summary(have + j * gran, want + j * gran, gran, erased_value, &all_erased) &&
+		    !all_erased)
+			return 1;
 	}
 	return 0;
 }
@@ -748,22 +782,13 @@ int need_erase(const uint8_t *have, const uint8_t *want, unsigned int len,
                enum write_granularity gran, const uint8_t erased_value)
 {
 	int result = 0;
-	unsigned int i;
 
 	switch (gran) {
 	case WRITE_GRAN_1BIT:
-		for (i = 0; i < len; i++)
-			if ((have[i] & want[i]) != want[i]) {
-				result = 1;
-				break;
-			}
+		result = memdiff_sets_bits(have, want, len);
 		break;
 	case WRITE_GRAN_1BYTE:
-		for (i = 0; i < len; i++)
-			if ((have[i] != want[i]) && (have[i] != erased_value)) {
-				result = 1;
-				break;
-			}
+		result = memdiff_unerased_diff(have, want, len, erased_value);
 		break;
 	case WRITE_GRAN_128BYTES:
 		result = need_erase_gran_bytes(have, want, len, 128, erased_value);
@@ -824,9 +849,7 @@ unsigned int get_next_write(const uint8_t *have, const uint8_t *want, unsigned i
 			  unsigned int *first_start,
 			  enum write_granularity gran)
 {
-	bool need_write = false;
-	unsigned int rel_start = 0, first_len = 0;
-	unsigned int i, limit, stride;
+	unsigned int rel_start, end, stride;
 
 	switch (gran) {
 	case WRITE_GRAN_1BIT:
@@ -863,28 +886,25 @@ unsigned int get_next_write(const uint8_t *have, const uint8_t *want, unsigned i
 		 */
 		return 0;
 	}
-	for (i = 0; i < len / stride; i++) {
-		limit = min(stride, len - i * stride);
-		/* Are 'have' and 'want' identical? */
-		if (memcmp(have + i * stride, want + i * stride, limit)) {
-			if (!need_write) {
-				/* First location where have and want differ. */
-				need_write = true;
-				rel_start = i * stride;
-			}
-		} else {
-			if (need_write) {
-				/* First location where have and want
-				 * do not differ anymore.
-				 */
-				break;
-			}
-		}
+	/* A partial chunk at the end is never written. */
+	const unsigned int span = len / stride * stride;
+	const unsigned int first_diff = memdiff_find(have, want, span, false);
+	if (first_diff == span)
+		return 0;
+
+	rel_start = first_diff / stride * stride;
+	if (stride == 1) {
+		/* First location where have and want do not differ anymore. */
+		end = first_diff + memdiff_find(have + first_diff, want + first_diff, span - first_diff, true);
+	} else {
+		/* First chunk where have and want are identical. */
+		end = rel_start + stride;
+		while (end < span && memdiff_find(have + end, want + end, stride, false) < stride)
+			end += stride;
 	}
-	if (need_write)
-		first_len = min(i * stride - rel_start, len);
+
 	*first_start += rel_start;
-	return first_len;
+	return end - rel_start;
 }
 
 void unmap_flash(struct flashctx *flash)
@@ -915,7 +935,8 @@ int map_flash(struct flashctx *flash)
 		return 0;
 
 	const chipsize_t size = flash->chip->total_size * 1024;
-	uintptr_t base = flashbase ? flashbase : (0xffffffff - size + 1);
+	const struct flashrom_programmer *const prog = programmer_of(flash);
+	uintptr_t base = prog->flash_base ? prog->flash_base : (0xffffffff - size + 1);
 	void *addr = master_map_flash_region(flash->mst, flash->chip->name, base, size);
 	if (addr == ERROR_PTR) {
 		msg_perr("Could not map flash chip %s at 0x%0*" PRIxPTR ".\n",
@@ -1213,8 +1234,10 @@ static probe_func_t *lookup_probe_func_ptr(const struct flashchip *chip)
 }
 
 /*
- * Probes the entries in flashchips array one by one, starting from `startchip` index.
+ * Probes the entries in flashchips array in order, starting from `startchip` index.
  * Probing keeps going until first match found or end of array reached.
+ * Unless a chip name is given, entries with an ID based probe function are only
+ * probed if the IDs read from the bus can match them, see probe_index.c.
  *
  * Returns:
  * the position of the matched chip, i.e. index of the entry in flashchips array
@@ -1223,11 +1246,29 @@ static probe_func_t *lookup_probe_func_ptr(const struct flashchip *chip)
 */
 int probe_flash(struct registered_master *mst, int startchip, struct flashctx *flash, int force, const char *const chip_to_probe)
 {
-	const struct flashchip *chip;
+	const struct flashchip *chip = NULL;
 	enum chipbustype buses_common;
+	size_t *candidates = NULL, candidate_count = 0;
 	char *tmp;
 
-	for (chip = flashchips + startchip; chip && chip->name; chip++) {
+	/* ID answers are only valid for the bus they were read from. */
+	if (startchip == 0)
+		clear_spi_id_cache(programmer_of_master(mst));
+
+	/* Without a chip name, only probe the chips the bus IDs can match. */
+	const bool indexed = !chip_to_probe && probe_index_enabled() &&
+			     !probe_index_collect(flash, mst, startchip, &candidates, &candidate_count);
+
+	for (size_t i = 0; ; i++) {
+		if (indexed) {
+			if (i >= candidate_count)
+				break;
+			chip = flashchips + candidates[i];
+		} else {
+			chip = flashchips + startchip + i;
+			if (!chip->name)
+				break;
+		}
 		if (chip_to_probe && strcmp(chip->name, chip_to_probe) != 0)
 			continue;
 		buses_common = mst->buses_supported & chip->bustype;
@@ -1247,6 +1288,7 @@ int probe_flash(struct registered_master *mst, int startchip, struct flashctx *f
 		flash->chip = calloc(1, sizeof(*flash->chip));
 		if (!flash->chip) {
 			msg_gerr("Out of memory!\n");
+			free(candidates);
 			return ERROR_FLASHROM_PROBE_INTERNAL_ERROR;
 		}
 		*flash->chip = *chip;
@@ -1265,7 +1307,10 @@ int probe_flash(struct registered_master *mst, int startchip, struct flashctx *f
 			if (!w29ee011_can_override(flash->chip->name, chip_to_probe))
 				goto notfound;
 
-		if (probe_func(flash) != 1)
+		const enum flashrom_stats_stage stage = stats_set_stage(flash, FLASHROM_STATS_PROBE);
+		const int found = probe_func(flash);
+		stats_set_stage(flash, stage);
+		if (found != 1)
 			goto notfound;
 
 		/* If this is the first chip found, accept it.
@@ -1281,8 +1326,10 @@ int probe_flash(struct registered_master *mst, int startchip, struct flashctx *f
 				msg_cinfo("The standard operations read and "
 					  "verify should work, but support for "
 					  "erase and write needs to be added manually.\n");
-			else if (selfcheck_chip(flash->chip))
+			else if (selfcheck_chip(flash->chip)) {
+				free(candidates);
 				return ERROR_FLASHROM_PROBE_INTERNAL_ERROR;
+			}
 			else
 				msg_cinfo("All standard operations (read, "
 					  "verify, erase and write) should work.\n");
@@ -1305,6 +1352,7 @@ notfound:
 		free(flash->chip);
 		flash->chip = NULL;
 	}
+	free(candidates);
 
 	if (!flash->chip)
 		return ERROR_FLASHROM_PROBE_NO_CHIPS_FOUND;
@@ -1320,7 +1368,7 @@ notfound:
 		msg_cinfo("mapped at physical address 0x%0*" PRIxPTR ".\n",
 			  PRIxPTR_WIDTH, flash->physical_memory);
 	else
-		msg_cinfo("on %s.\n", programmer->name);
+		msg_cinfo("on %s.\n", programmer_of(flash)->entry ? programmer_of(flash)->entry->name : "programmer");
 
 	/* Flash registers may more likely not be mapped if the chip was forced.
 	 * Lock info may be stored in registers, so avoid lock info printing. */
@@ -1338,13 +1386,12 @@ notfound:
 }
 
 static void setup_progress_from_layout(struct flashctx *flashctx,
+				       const struct flashrom_layout *flash_layout,
 				       enum flashrom_progress_stage stage)
 {
 	if (!flashctx->progress_callback && !flashctx->deprecated_progress_callback)
 		return;
 
-	const struct flashrom_layout *const flash_layout = get_layout(flashctx);
-
 	size_t total = 0;
 	const struct romentry *entry = NULL;
 	while ((entry = layout_next_included(flash_layout, entry))) {
@@ -1356,49 +1403,27 @@ static void setup_progress_from_layout(struct flashctx *flashctx,
 }
 
 
-static void setup_progress_from_layout_and_diff(struct flashctx *flashctx,
-						const void *have,
-						const void *want,
-						enum flashrom_progress_stage stage)
+static void setup_progress_from_write_plan(struct flashctx *flashctx,
+					   const struct write_plan *plan,
+					   enum flashrom_progress_stage stage)
 {
 	if (!flashctx->progress_callback && !flashctx->deprecated_progress_callback)
 		return;
 
-	const struct flashrom_layout *flash_layout = get_layout(flashctx);
-	const size_t page_size = flashctx->chip->page_size;
-
 	size_t total = 0;
 
-	const struct romentry *entry = NULL;
-	while ((entry = layout_next_included(flash_layout, entry))) {
-		const struct flash_region *region = &entry->region;
-
-		if (stage == FLASHROM_PROGRESS_ERASE) {
-			size_t offset;
-			for (offset = region->start; offset <= region->end; offset += page_size) {
-				const size_t len = min(page_size, region->end + 1 - offset);
+	if (stage == FLASHROM_PROGRESS_ERASE)
+		total = plan->erase_len;
 
-				if (need_erase(have, want, len, flashctx->chip->gran, ERASED_VALUE(flashctx)))
-					total += len;
-			}
-		}
+	if (stage == FLASHROM_PROGRESS_WRITE) {
+		total = plan->write_len;
 
-		if (stage == FLASHROM_PROGRESS_WRITE) {
-			unsigned int start = region->start;
-			unsigned int len;
-			while ((len = get_next_write(have + start, want + start,
-						     region->end + 1 - start, &start, flashctx->chip->gran))) {
-				start += len;
-				total += len;
-			}
-
-			if (flashctx->chip->feature_bits & FEATURE_NO_ERASE)
-				/* For chips with FEATURE_NO_ERASE erase op is running as write under the hood.
-				 * So typical write, which usually consists of erasing and then writing,
-				 * would be writing and then writing again. The planned total length for the
-				 * progress indicator for write is double. */
-				total *= 2;
-		}
+		if (flashctx->chip->feature_bits & FEATURE_NO_ERASE)
+			/* For chips with FEATURE_NO_ERASE erase op is running as write under the hood.
+			 * So typical write, which usually consists of erasing and then writing,
+			 * would be writing and then writing again. The planned total length for the
+			 * progress indicator for write is double. */
+			total *= 2;
 	}
 
 	init_progress(flashctx, stage, total);
@@ -1408,20 +1433,18 @@ static void setup_progress_from_layout_and_diff(struct flashctx *flashctx,
 /**
  * @brief Reads the included layout regions into a buffer.
  *
- * If there is no layout set in the given flash context, the whole chip will
- * be read.
- *
  * @param flashctx Flash context to be used.
+ * @param layout   Layout whose included regions are read, usually get_layout(flashctx).
  * @param buffer   Buffer of full chip size to read into.
  * @return 0 on success,
  *	   1 if any read fails.
  */
-static int read_by_layout(struct flashctx *const flashctx, uint8_t *const buffer)
+static int read_by_layout(struct flashctx *const flashctx, const struct flashrom_layout *const layout,
+			  uint8_t *const buffer)
 {
-	const struct flashrom_layout *const layout = get_layout(flashctx);
 	const struct romentry *entry = NULL;
 
-	setup_progress_from_layout(flashctx, FLASHROM_PROGRESS_READ);
+	setup_progress_from_layout(flashctx, layout, FLASHROM_PROGRESS_READ);
 
 	while ((entry = layout_next_included(layout, entry))) {
 		const struct flash_region *region = &entry->region;
@@ -1434,6 +1457,203 @@ static int read_by_layout(struct flashctx *const flashctx, uint8_t *const buffer
 	return 0;
 }
 
+enum manifest_block_state {
+	MANIFEST_BLOCK_UNUSED = 0,	/* Outside of the layout. */
+	MANIFEST_BLOCK_READ,		/* Unknown or different in the new image, has to be read. */
+	MANIFEST_BLOCK_TRUSTED,		/* Taken from the new image. */
+	MANIFEST_BLOCK_SAMPLED,		/* Trusted, but read back to check the manifest. */
+};
+
+/* Picks about one in MANIFEST_SAMPLE_RATIO trusted blocks, starting at a random offset. */
+static size_t sample_trusted_blocks(uint8_t *state, size_t block_count, size_t trusted)
+{
+	size_t samples = trusted / MANIFEST_SAMPLE_RATIO;
+
+	if (samples < MANIFEST_MIN_SAMPLES)
+		samples = MANIFEST_MIN_SAMPLES;
+	if (samples > trusted)
+		samples = trusted;
+	if (!samples)
+		return 0;
+
+	const size_t stride = trusted / samples;
+	size_t next = (size_t)time(NULL) % stride, seen = 0, taken = 0;
+	for (size_t i = 0; i < block_count && taken < samples; i++) {
+		if (state[i] != MANIFEST_BLOCK_TRUSTED)
+			continue;
+		if (seen++ == next) {
+			state[i] = MANIFEST_BLOCK_SAMPLED;
+			next += stride;
+			taken++;
+		}
+	}
+	return taken;
+}
+
+/**
+ * @brief Fills the current contents of a layout from the manifest where possible.
+ *
+ * Blocks whose manifest digest matches the new image are taken from the new
+ * image, all others are read. A sample of the trusted blocks is read as well
+ * and compared; on any mismatch the manifest is dropped for the layout.
+ *
+ * @param flashctx    Flash context with a manifest set.
+ * @param layout      Layout whose included regions are needed.
+ * @param newcontents New image of full chip size.
+ * @param curcontents Buffer of full chip size to fill.
+ * @return 0 on success,
+ *	   1 if the manifest can't be used and the layout has to be read in full,
+ *	   2 if reading failed.
+ */
+static int read_using_manifest(struct flashctx *const flashctx, const struct flashrom_layout *const layout,
+			       const uint8_t *const newcontents, uint8_t *const curcontents)
+{
+	struct flashrom_manifest *const manifest = flashctx->manifest;
+	struct flashrom_layout *read_layout = NULL;
+	size_t trusted = 0, read = 0;
+	int ret = 1;
+
+	if (!manifest_matches_chip(manifest, flashctx->chip)) {
+		msg_cinfo("Manifest doesn't describe this flash chip, ignoring it.\n");
+		return 1;
+	}
+
+	const size_t bs = manifest_block_size(manifest);
+	const size_t block_count = flashctx->chip->total_size * 1024 / bs;
+	uint8_t *const state = calloc(block_count, sizeof(*state));
+	if (!state || flashrom_layout_new(&read_layout)) {
+		msg_gerr("Out of memory!\n");
+		goto _free_ret;
+	}
+
+	const struct romentry *entry = NULL;
+	while ((entry = layout_next_included(layout, entry))) {
+		for (size_t i = entry->region.start / bs; i <= entry->region.end / bs; i++) {
+			if (state[i] != MANIFEST_BLOCK_UNUSED)
+				continue;
+			if (manifest_block_matches(manifest, i, newcontents)) {
+				state[i] = MANIFEST_BLOCK_TRUSTED;
+				trusted++;
+			} else {
+				state[i] = MANIFEST_BLOCK_READ;
+				read++;
+			}
+		}
+	}
+	const size_t sampled = sample_trusted_blocks(state, block_count, trusted);
+
+	/* Read runs of blocks in one go. */
+	for (size_t i = 0; i < block_count; i++) {
+		if (state[i] != MANIFEST_BLOCK_READ && state[i] != MANIFEST_BLOCK_SAMPLED)
+			continue;
+		size_t last = i;
+		while (last + 1 < block_count &&
+		       (state[last + 1] == MANIFEST_BLOCK_READ || state[last + 1] == MANIFEST_BLOCK_SAMPLED))
+			last++;
+
+		char name[32];
+		snprintf(name, sizeof(name), "manifest_%zu", i);
+		if (flashrom_layout_add_region(read_layout, i * bs, (last + 1) * bs - 1, name) ||
+		    flashrom_layout_include_region(read_layout, name))
+			goto _free_ret;
+		i = last;
+	}
+
+	msg_cinfo("Reading %zu of %zu blocks, %zu of them to check the manifest... ",
+		  read + sampled, read + trusted, sampled);
+	if (read_by_layout(flashctx, read_layout, curcontents)) {
+		ret = 2;
+		goto _free_ret;
+	}
+
+	for (size_t i = 0; i < block_count; i++) {
+		if (state[i] == MANIFEST_BLOCK_SAMPLED && memcmp(curcontents + i * bs, newcontents + i * bs, bs)) {
+			msg_cwarn("manifest is out of date at 0x%08zx.\n", i * bs);
+			manifest_invalidate(manifest, flashctx->chip, NULL);
+			goto _free_ret;
+		}
+		if (state[i] == MANIFEST_BLOCK_TRUSTED)
+			memcpy(curcontents + i * bs, newcontents + i * bs, bs);
+	}
+	ret = 0;
+
+_free_ret:
+	flashrom_layout_release(read_layout);
+	free(state);
+	return ret;
+}
+
+/**
+ * @brief Fills the current contents of a layout from the journal of an interrupted write.
+ *
+ * Blocks the journal recorded as holding the new image are taken from it,
+ * all others, including the ones that were in flight, are read.
+ *
+ * @param flashctx    Flash context with a journal set.
+ * @param layout      Layout whose included regions are needed.
+ * @param newcontents New image of full chip size.
+ * @param curcontents Buffer of full chip size to fill.
+ * @return 0 on success,
+ *	   1 if the journal can't be used and the layout has to be read in full,
+ *	   2 if reading failed.
+ */
+static int read_using_journal(struct flashctx *const flashctx, const struct flashrom_layout *const layout,
+			      const uint8_t *const newcontents, uint8_t *const curcontents)
+{
+	const struct flashrom_journal *const journal = flashctx->journal;
+	struct flashrom_layout *read_layout = NULL;
+	size_t trusted = 0, read = 0;
+	int ret = 1;
+
+	if (!journal_matches(journal, flashctx->chip, newcontents)) {
+		msg_cinfo("Journal doesn't describe writing this image to this flash chip, ignoring it.\n");
+		return 1;
+	}
+
+	const size_t bs = journal_block_size(journal);
+	const size_t block_count = flashctx->chip->total_size * 1024 / bs;
+	bool *const needed = calloc(block_count, sizeof(*needed));
+	if (!needed || flashrom_layout_new(&read_layout)) {
+		msg_gerr("Out of memory!\n");
+		goto _free_ret;
+	}
+
+	const struct romentry *entry = NULL;
+	while ((entry = layout_next_included(layout, entry))) {
+		for (size_t i = entry->region.start / bs; i <= entry->region.end / bs; i++)
+			needed[i] = true;
+	}
+
+	for (size_t i = 0; i < block_count; i++) {
+		if (!needed[i])
+			continue;
+		if (journal_block_trusted(journal, i)) {
+			memcpy(curcontents + i * bs, newcontents + i * bs, bs);
+			trusted++;
+			continue;
+		}
+		size_t last = i;
+		while (last + 1 < block_count && needed[last + 1] && !journal_block_trusted(journal, last + 1))
+			last++;
+
+		char name[32];
+		snprintf(name, sizeof(name), "journal_%zu", i);
+		if (flashrom_layout_add_region(read_layout, i * bs, (last + 1) * bs - 1, name) ||
+		    flashrom_layout_include_region(read_layout, name))
+			goto _free_ret;
+		read += last - i + 1;
+		i = last;
+	}
+
+	msg_cinfo("Resuming, reading %zu of %zu blocks... ", read, read + trusted);
+	ret = read_by_layout(flashctx, read_layout, curcontents) ? 2 : 0;
+
+_free_ret:
+	flashrom_layout_release(read_layout);
+	free(needed);
+	return ret;
+}
+
 static int erase_by_layout(struct flashctx *const flashctx)
 {
 	bool all_skipped = true;
@@ -1441,6 +1661,7 @@ static int erase_by_layout(struct flashctx *const flashctx)
 	uint8_t* curcontents = malloc(flash_size);
 	uint8_t* newcontents = malloc(flash_size);
 	struct erase_layout *erase_layout;
+	struct write_plan plan = { 0 };
 	create_erase_layout(flashctx, &erase_layout);
 	int ret = 0;
 
@@ -1459,13 +1680,19 @@ static int erase_by_layout(struct flashctx *const flashctx)
 	memset(curcontents, ~ERASED_VALUE(flashctx), flash_size);
 	memset(newcontents, ERASED_VALUE(flashctx), flash_size);
 
-	setup_progress_from_layout(flashctx, FLASHROM_PROGRESS_READ);
-	setup_progress_from_layout_and_diff(flashctx, curcontents, newcontents, FLASHROM_PROGRESS_ERASE);
+	if (create_write_plan(flashctx, erase_layout, curcontents, newcontents, &plan)) {
+		ret = 1;
+		goto _ret;
+	}
+
+	setup_progress_from_layout(flashctx, get_layout(flashctx), FLASHROM_PROGRESS_READ);
+	setup_progress_from_write_plan(flashctx, &plan, FLASHROM_PROGRESS_ERASE);
 
 	const struct flashrom_layout *const flash_layout = get_layout(flashctx);
 	const struct romentry *entry = NULL;
 	while ((entry = layout_next_included(flash_layout, entry))) {
-		ret = erase_write(flashctx, entry->region.start, entry->region.end, curcontents, newcontents, erase_layout, &all_skipped);
+		ret = erase_write(flashctx, entry->region.start, entry->region.end, curcontents, newcontents,
+				  erase_layout, &plan, &all_skipped);
 		if (ret) {
 			ret = 1;
 			msg_cerr("Erase Failed");
@@ -1476,6 +1703,7 @@ static int erase_by_layout(struct flashctx *const flashctx)
 _ret:
 	free(curcontents);
 	free(newcontents);
+	free_write_plan(&plan);
 	free_erase_layout(erase_layout, count_usable_erasers(flashctx));
 	return ret;
 }
@@ -1489,6 +1717,7 @@ static int write_by_layout(struct flashctx *const flashctx,
 
 	const struct flashrom_layout *const flash_layout = get_layout(flashctx);
 	struct erase_layout *erase_layout;
+	struct write_plan plan = { 0 };
 	create_erase_layout(flashctx, &erase_layout);
 
 	if (!flash_layout) {
@@ -1498,9 +1727,13 @@ static int write_by_layout(struct flashctx *const flashctx,
 		goto _ret;
 	}
 
-	setup_progress_from_layout(flashctx, FLASHROM_PROGRESS_READ);
-	setup_progress_from_layout_and_diff(flashctx, curcontents, newcontents, FLASHROM_PROGRESS_WRITE);
-	setup_progress_from_layout_and_diff(flashctx, curcontents, newcontents, FLASHROM_PROGRESS_ERASE);
+	/* Diff the images once, progress, erase selection and writing all work from the plan. */
+	if (create_write_plan(flashctx, erase_layout, curcontents, newcontents, &plan))
+		goto _ret;
+
+	setup_progress_from_layout(flashctx, get_layout(flashctx), FLASHROM_PROGRESS_READ);
+	setup_progress_from_write_plan(flashctx, &plan, FLASHROM_PROGRESS_WRITE);
+	setup_progress_from_write_plan(flashctx, &plan, FLASHROM_PROGRESS_ERASE);
 
 	const struct romentry *entry = NULL;
 	while ((entry = layout_next_included(flash_layout, entry))) {
@@ -1508,13 +1741,16 @@ static int write_by_layout(struct flashctx *const flashctx,
 						entry->region.end,
 						curcontents,
 						(uint8_t *)newcontents,
-						erase_layout, all_skipped);
+						erase_layout, &plan, all_skipped);
 		if (ret) {
 			msg_cerr("Write Failed!");
 			goto _ret;
 		}
 	}
+	msg_cdbg("Estimated erase/write time with the %s erase planner: %"PRIu64" ms\n",
+		 flashctx->flags.cost_erase_planner ? "cost" : "greedy", plan.predicted_us / 1000);
 _ret:
+	free_write_plan(&plan);
 	free_erase_layout(erase_layout, erasefn_count);
 	return ret;
 }
@@ -1540,7 +1776,7 @@ static int verify_by_layout(
 {
 	const struct romentry *entry = NULL;
 
-	setup_progress_from_layout(flashctx, FLASHROM_PROGRESS_READ);
+	setup_progress_from_layout(flashctx, get_layout(flashctx), FLASHROM_PROGRESS_READ);
 
 	while ((entry = layout_next_included(layout, entry))) {
 		const struct flash_region *region = &entry->region;
@@ -1556,19 +1792,19 @@ static int verify_by_layout(
 	return 0;
 }
 
-static bool is_internal_programmer()
+static bool is_internal_programmer(const struct flashctx *flash)
 {
 #if CONFIG_INTERNAL == 1
-	return programmer == &programmer_internal;
+	return programmer_of(flash)->entry == &programmer_internal;
 #else
 	return false;
 #endif
 }
 
-static void nonfatal_help_message(void)
+static void nonfatal_help_message(const struct flashctx *flash)
 {
 	msg_gerr("Good, writing to the flash chip apparently didn't do anything.\n");
-	if (is_internal_programmer())
+	if (is_internal_programmer(flash))
 		msg_gerr("This means we have to add special support for your board, programmer or flash\n"
 			 "chip. Please report this to the mailing list at flashrom@flashrom.org or on\n"
 			 "chat channels (see https://flashrom.org/contact.html for details), thanks!\n"
@@ -1581,10 +1817,10 @@ static void nonfatal_help_message(void)
 			 "https://flashrom.org/contact.html for details), thanks!\n");
 }
 
-void emergency_help_message(void)
+void emergency_help_message(const struct flashctx *flash)
 {
 	msg_gerr("Your flash chip is in an unknown state.\n");
-	if (is_internal_programmer())
+	if (is_internal_programmer(flash))
 		msg_gerr("Get help on chat (see https://flashrom.org/contact.html) or mail\n"
 			"flashrom@flashrom.org with the subject \"FAILED: <your board name>\"!"
 			"-------------------------------------------------------------------------------\n"
@@ -1712,7 +1948,7 @@ static int chip_safety_check(const struct flashctx *flash, int force,
 {
 	const struct flashchip *chip = flash->chip;
 
-	if (!programmer_may_write && (write_it || erase_it)) {
+	if (!programmer_of(flash)->may_write && (write_it || erase_it)) {
 		msg_perr("Write/erase is not working yet on your programmer in "
 			 "its current configuration.\n");
 		/* --force is the wrong approach, but it's the best we can do
@@ -1977,6 +2213,15 @@ void finalize_flash_access(struct flashctx *const flash)
 	unmap_flash(flash);
 }
 
+/*
+ * Skipped regions are left unread or unwritten, so the manifest can't vouch
+ * for blocks in them.
+ */
+static bool manifest_trackable(const struct flashctx *const flashctx)
+{
+	return !flashctx->flags.skip_unreadable_regions && !flashctx->flags.skip_unwritable_regions;
+}
+
 int flashrom_flash_erase(struct flashctx *const flashctx)
 {
 	if (prepare_flash_access(flashctx, false, false, true, flashctx->flags.verify_after_write)) {
@@ -1987,7 +2232,25 @@ int flashrom_flash_erase(struct flashctx *const flashctx)
 		return ERROR_FLASHROM_PREPARE_FLASH_ACCESS;
 	}
 
+	const enum flashrom_stats_stage stage = stats_set_stage(flashctx, FLASHROM_STATS_ERASE);
 	const int ret = erase_by_layout(flashctx);
+	stats_set_stage(flashctx, stage);
+
+	/*
+	 * The erased blocks are recorded as such. If the erase failed partway,
+	 * it is unknown which blocks it reached, so all of them are dropped.
+	 */
+	if (flashctx->manifest) {
+		const size_t flash_size = flashctx->chip->total_size * 1024;
+		uint8_t *const erased = ret || !manifest_trackable(flashctx) ? NULL : malloc(flash_size);
+		if (erased) {
+			memset(erased, ERASED_VALUE(flashctx), flash_size);
+			manifest_update(flashctx->manifest, flashctx->chip, get_layout(flashctx), erased);
+			free(erased);
+		} else {
+			manifest_invalidate(flashctx->manifest, flashctx->chip, get_layout(flashctx));
+		}
+	}
 
 	finalize_flash_access(flashctx);
 
@@ -1999,7 +2262,7 @@ int flashrom_flash_erase(struct flashctx *const flashctx)
 	 * knows very well that booting won't work.
 	 */
 	if (ret)
-		emergency_help_message();
+		emergency_help_message(flashctx);
 
 	return ret;
 }
@@ -2017,7 +2280,10 @@ int flashrom_image_read(struct flashctx *const flashctx, void *const buffer, con
 	msg_cinfo("Reading flash... ");
 
 	int ret = 1;
-	if (read_by_layout(flashctx, buffer)) {
+	const enum flashrom_stats_stage stage = stats_set_stage(flashctx, FLASHROM_STATS_READ);
+	const int read_ret = read_by_layout(flashctx, get_layout(flashctx), buffer);
+	stats_set_stage(flashctx, stage);
+	if (read_ret) {
 		msg_cerr("Read operation failed!\n");
 		msg_cinfo("FAILED.\n");
 		goto _finalize_ret;
@@ -2025,6 +2291,9 @@ int flashrom_image_read(struct flashctx *const flashctx, void *const buffer, con
 	msg_cinfo("done.\n");
 	ret = 0;
 
+	if (flashctx->manifest && manifest_trackable(flashctx))
+		manifest_update(flashctx->manifest, flashctx->chip, get_layout(flashctx), buffer);
+
 _finalize_ret:
 	finalize_flash_access(flashctx);
 	return ret;
@@ -2067,6 +2336,7 @@ int flashrom_image_write(struct flashctx *const flashctx, void *const buffer, co
 		return 4;
 
 	int ret = 1;
+	bool write_started = false, all_skipped = true;
 
 	uint8_t *const newcontents = buffer;
 	const uint8_t *const refcontents = refbuffer;
@@ -2080,7 +2350,7 @@ int flashrom_image_write(struct flashctx *const flashctx, void *const buffer, co
 	}
 
 #if CONFIG_INTERNAL == 1
-	if (is_internal_programmer() && cb_check_image(newcontents, flash_size) < 0) {
+	if (is_internal_programmer(flashctx) && cb_check_image(newcontents, flash_size) < 0) {
 		if (flashctx->flags.force_boardmismatch) {
 			msg_pinfo("Proceeding anyway because user forced us to.\n");
 		} else {
@@ -2095,15 +2365,37 @@ int flashrom_image_write(struct flashctx *const flashctx, void *const buffer, co
 		msg_gerr("Error: some of the required checks to prepare flash access failed. "
 			 "Earlier messages should give more details.\n"
 			 "Write operation has not started.\n");
-		goto _finalize_ret;
+		finalize_flash_access(flashctx);
+		goto _free_ret;
 	}
 
+	const enum flashrom_stats_stage stage = stats_set_stage(flashctx, FLASHROM_STATS_READ);
 	/* If given, assume flash chip contains same data as `refcontents`. */
 	if (refcontents) {
 		msg_cinfo("Assuming old flash chip contents as ref-file...\n");
 		memcpy(curcontents, refcontents, flash_size);
 		if (oldcontents)
 			memcpy(oldcontents, refcontents, flash_size);
+	} else if (flashctx->manifest && flashctx->flags.trust_manifest &&
+		   (ret = read_using_manifest(flashctx, verify_layout, newcontents, curcontents)) != 1) {
+		if (ret) {
+			msg_cinfo("FAILED.\n");
+			ret = 1;
+			goto _finalize_ret;
+		}
+		msg_cinfo("done.\n");
+		if (oldcontents)
+			memcpy(oldcontents, curcontents, flash_size);
+	} else if (flashctx->journal && flashctx->flags.resume_journal &&
+		   (ret = read_using_journal(flashctx, verify_layout, newcontents, curcontents)) != 1) {
+		if (ret) {
+			msg_cinfo("FAILED.\n");
+			ret = 1;
+			goto _finalize_ret;
+		}
+		msg_cinfo("done.\n");
+		if (oldcontents)
+			memcpy(oldcontents, curcontents, flash_size);
 	} else {
 		/*
 		 * Read the whole chip to be able to check whether regions need to be
@@ -2121,7 +2413,7 @@ int flashrom_image_write(struct flashctx *const flashctx, void *const buffer, co
 			}
 			memcpy(curcontents, oldcontents, flash_size);
 		} else {
-			if (read_by_layout(flashctx, curcontents)) {
+			if (read_by_layout(flashctx, get_layout(flashctx), curcontents)) {
 				msg_cinfo("FAILED.\n");
 				goto _finalize_ret;
 			}
@@ -2129,31 +2421,39 @@ int flashrom_image_write(struct flashctx *const flashctx, void *const buffer, co
 		msg_cinfo("done.\n");
 	}
 
-	bool all_skipped = true;
+	ret = 1;
+	if (flashctx->journal &&
+	    journal_begin(flashctx->journal, flashctx->chip, get_layout(flashctx), curcontents, newcontents)) {
+		msg_cerr("Write operation has not started.\n");
+		goto _finalize_ret;
+	}
 
 	msg_cinfo("Updating flash chip contents... ");
+	write_started = true;
+	stats_set_stage(flashctx, FLASHROM_STATS_WRITE);
 	if (write_by_layout(flashctx, curcontents, newcontents, &all_skipped)) {
 		msg_cerr("Uh oh. Erase/write failed. ");
 		ret = 2;
 		if (verify_all) {
 			msg_cerr("Checking if anything has changed.\n");
 			msg_cinfo("Reading current flash chip contents... ");
+			stats_set_stage(flashctx, FLASHROM_STATS_READ);
 			init_progress(flashctx, FLASHROM_PROGRESS_READ, flash_size);
 			if (!read_flash(flashctx, curcontents, 0, flash_size)) {
 				msg_cinfo("done.\n");
 				if (!memcmp(oldcontents, curcontents, flash_size)) {
-					nonfatal_help_message();
+					nonfatal_help_message(flashctx);
 					goto _finalize_ret;
 				}
 				msg_cerr("Apparently at least some data has changed.\n");
 			} else
 				msg_cerr("Can't even read anymore!\n");
-			emergency_help_message();
+			emergency_help_message(flashctx);
 			goto _finalize_ret;
 		} else {
 			msg_cerr("\n");
 		}
-		emergency_help_message();
+		emergency_help_message(flashctx);
 		goto _finalize_ret;
 	}
 
@@ -2189,11 +2489,12 @@ int flashrom_image_write(struct flashctx *const flashctx, void *const buffer, co
 
 		if (verify_all)
 			combine_image_by_layout(flashctx, newcontents, oldcontents);
+		stats_set_stage(flashctx, FLASHROM_STATS_VERIFY);
 		ret = verify_by_layout(flashctx, verify_layout, curcontents, newcontents);
 		/* If we tried to write, and verification now fails, we
 		   might have an emergency situation. */
 		if (ret)
-			emergency_help_message();
+			emergency_help_message(flashctx);
 		else
 			msg_cinfo("VERIFIED.\n");
 	} else {
@@ -2202,6 +2503,23 @@ int flashrom_image_write(struct flashctx *const flashctx, void *const buffer, co
 	}
 
 _finalize_ret:
+	if (flashctx->journal && write_started)
+		journal_end(flashctx->journal, !ret);
+	if (flashctx->manifest && write_started) {
+		if (ret || !manifest_trackable(flashctx)) {
+			manifest_invalidate(flashctx->manifest, flashctx->chip, get_layout(flashctx));
+		} else if (oldcontents && (!refcontents || (verify && !all_skipped))) {
+			/* The rest of the chip is known from reading it (or from verifying it). */
+			const struct romentry *entry = NULL;
+			while ((entry = layout_next_included(get_layout(flashctx), entry)))
+				memcpy(oldcontents + entry->region.start, newcontents + entry->region.start,
+				       entry->region.end - entry->region.start + 1);
+			manifest_update(flashctx->manifest, flashctx->chip, verify_layout, oldcontents);
+		} else {
+			manifest_update(flashctx->manifest, flashctx->chip, get_layout(flashctx), newcontents);
+		}
+	}
+	stats_set_stage(flashctx, stage);
 	finalize_flash_access(flashctx);
 _free_ret:
 	free(oldcontents);
@@ -2209,6 +2527,83 @@ _free_ret:
 	return ret;
 }
 
+int flashrom_image_write_plan(struct flashctx *const flashctx, const void *const buffer, const size_t buffer_len,
+			      const void *const refbuffer, char **const plan_json)
+{
+	const size_t flash_size = flashctx->chip->total_size * 1024;
+
+	if (buffer_len != flash_size)
+		return 4;
+
+	/* erase_write() temporarily modifies the new contents, so work on a copy. */
+	uint8_t *const newcontents = malloc(flash_size);
+	uint8_t *const curcontents = malloc(flash_size);
+	if (!curcontents || !newcontents) {
+		msg_gerr("Out of memory!\n");
+		free(newcontents);
+		free(curcontents);
+		return 3;
+	}
+	memcpy(newcontents, buffer, flash_size);
+
+	int ret = 1;
+	bool all_skipped = true;
+	struct erase_layout *erase_layout = NULL;
+	struct write_plan plan = { 0 };
+
+	if (prepare_flash_access(flashctx, !refbuffer, false, false, false))
+		goto _free_ret;
+
+	if (refbuffer) {
+		msg_cinfo("Assuming old flash chip contents as ref-file...\n");
+		memcpy(curcontents, refbuffer, flash_size);
+	} else {
+		msg_cinfo("Reading old flash chip contents... ");
+		const enum flashrom_stats_stage stage = stats_set_stage(flashctx, FLASHROM_STATS_READ);
+		const int read_ret = read_by_layout(flashctx, get_layout(flashctx), curcontents);
+		stats_set_stage(flashctx, stage);
+		if (read_ret) {
+			msg_cinfo("FAILED.\n");
+			ret = 2;
+			goto _finalize_ret;
+		}
+		msg_cinfo("done.\n");
+	}
+
+	if (create_erase_layout(flashctx, &erase_layout) <= 0)
+		goto _finalize_ret;
+	if (create_write_plan(flashctx, erase_layout, curcontents, newcontents, &plan)) {
+		ret = 3;
+		goto _finalize_ret;
+	}
+
+	/* Run the erase/write algorithm without touching the chip to get the operations it would issue. */
+	plan.simulate = true;
+	const struct romentry *entry = NULL;
+	while ((entry = layout_next_included(get_layout(flashctx), entry))) {
+		if (erase_write(flashctx, entry->region.start, entry->region.end, curcontents, newcontents,
+				erase_layout, &plan, &all_skipped))
+			goto _finalize_ret;
+	}
+
+	*plan_json = write_plan_to_json(flashctx, erase_layout, &plan);
+	if (!*plan_json) {
+		msg_gerr("Out of memory!\n");
+		ret = 3;
+		goto _finalize_ret;
+	}
+	ret = 0;
+
+_finalize_ret:
+	finalize_flash_access(flashctx);
+	free_write_plan(&plan);
+	free_erase_layout(erase_layout, count_usable_erasers(flashctx));
+_free_ret:
+	free(curcontents);
+	free(newcontents);
+	return ret;
+}
+
 int flashrom_image_verify(struct flashctx *const flashctx, const void *const buffer, const size_t buffer_len)
 {
 	const struct flashrom_layout *const layout = get_layout(flashctx);
@@ -2230,9 +2625,14 @@ int flashrom_image_verify(struct flashctx *const flashctx, const void *const buf
 		goto _free_ret;
 
 	msg_cinfo("Verifying flash... ");
+	const enum flashrom_stats_stage stage = stats_set_stage(flashctx, FLASHROM_STATS_VERIFY);
 	ret = verify_by_layout(flashctx, layout, curcontents, newcontents);
-	if (!ret)
+	stats_set_stage(flashctx, stage);
+	if (!ret) {
 		msg_cinfo("VERIFIED.\n");
+		if (flashctx->manifest && manifest_trackable(flashctx))
+			manifest_update(flashctx->manifest, flashctx->chip, layout, newcontents);
+	}
 
 	finalize_flash_access(flashctx);
 _free_ret:
@@ -11,6 +11,7 @@
 #include <sys/types.h>
 #include "flash.h"
 #include "fmap.h"
+#include "image_index.h"
 
 static size_t fmap_size(const struct fmap *fmap)
 {
@@ -18,7 +19,7 @@ static size_t fmap_size(const struct fmap *fmap)
 }
 
 /* Make a best-effort assessment if the given fmap is real */
-static int is_valid_fmap(const struct fmap *fmap)
+int fmap_is_valid(const struct fmap *fmap)
 {
 	if (memcmp(fmap, FMAP_SIGNATURE, strlen(FMAP_SIGNATURE)) != 0)
 		return 0;
@@ -63,23 +64,11 @@ static int is_valid_fmap(const struct fmap *fmap)
  */
 static ssize_t fmap_lsearch(const uint8_t *buf, size_t len)
 {
-	ssize_t offset;
-	bool fmap_found = false;
-
-	if (len < sizeof(struct fmap))
-		return -1;
-
-	for (offset = 0; offset <= (ssize_t)(len - sizeof(struct fmap)); offset++) {
-		if (is_valid_fmap((struct fmap *)&buf[offset])) {
-			fmap_found = true;
-			break;
-		}
-	}
-
-	if (!fmap_found)
+	const ssize_t offset = image_index_find_first(buf, len, IMAGE_REGION_FMAP);
+	if (offset < 0)
 		return -1;
 
-	if (offset + fmap_size((struct fmap *)&buf[offset]) > len) {
+	if (offset + fmap_size((const struct fmap *)&buf[offset]) > len) {
 		msg_gerr("fmap size exceeds buffer boundary.\n");
 		return -2;
 	}
@@ -229,7 +218,7 @@ static int fmap_bsearch_rom(struct fmap **fmap_out, struct flashctx *const flash
 				continue;
 			}
 
-			if (is_valid_fmap(fmap)) {
+			if (fmap_is_valid(fmap)) {
 				msg_gdbg("fmap found at offset 0x%06zx\n", offset);
 				fmap_found = true;
 				break;
@@ -17,6 +17,13 @@
 #include <sys/stat.h>
 #endif
 
+#if !defined(__LIBPAYLOAD__) && !defined(__DJGPP__) && !IS_WINDOWS
+#include <sys/mman.h>
+#define HAVE_IMAGE_MMAP 1
+#else
+#define HAVE_IMAGE_MMAP 0
+#endif
+
 #include "flash.h"
 
 int read_buf_from_file(unsigned char *buf, unsigned long size,
@@ -122,3 +129,288 @@ out:
 	return ret;
 #endif
 }
+
+/**
+ * @brief Replaces the contents of a file
+ *
+ * The data goes to a temporary file next to filename first, which is synced
+ * and renamed over it, so an interrupted run leaves either the old or the new
+ * contents. mkstemp() picks the temporary name, so concurrent runs don't
+ * clobber each other's file. Anything but a regular file with a single link is
+ * written in place, like images are.
+ *
+ * @param filename File to replace
+ * @param buf      New contents
+ * @param size     Size of buf
+ * @return 0 on success
+ */
+int replace_file(const char *filename, const void *buf, size_t size)
+{
+#if HAVE_IMAGE_MMAP
+	struct stat st;
+	mode_t mode;
+
+	if (lstat(filename, &st) == 0) {
+		if (!S_ISREG(st.st_mode) || st.st_nlink != 1)
+			return write_buf_to_file(buf, size, filename);
+		mode = st.st_mode & 07777;
+	} else if (errno == ENOENT) {
+		const mode_t mask = umask(0);
+		umask(mask);
+		mode = 0666 & ~mask;
+	} else {
+		msg_gerr("Error: getting metadata of file \"%s\" failed: %s\n", filename, strerror(errno));
+		return 1;
+	}
+
+	char *const tmpname = malloc(strlen(filename) + strlen(".XXXXXX") + 1);
+	if (!tmpname) {
+		msg_gerr("Out of memory!\n");
+		return 1;
+	}
+	sprintf(tmpname, "%s.XXXXXX", filename);
+
+	const int fd = mkstemp(tmpname);
+	if (fd < 0) {
+		msg_gerr("Error: creating \"%s\" failed: %s\n", tmpname, strerror(errno));
+		free(tmpname);
+		return 1;
+	}
+
+	int ret = fchmod(fd, mode);
+	for (size_t done = 0; !ret && done < size;) {
+		const ssize_t written = write(fd, (const uint8_t *)buf + done, size - done);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			ret = 1;
+		else
+			done += written;
+	}
+#if defined(_POSIX_FSYNC) && (_POSIX_FSYNC != -1)
+	ret = ret || fsync(fd);
+#endif
+	ret = close(fd) || ret;
+	if (ret || rename(tmpname, filename)) {
+		msg_gerr("Error: writing \"%s\" failed: %s\n", filename, strerror(errno));
+		(void)unlink(tmpname);
+		ret = 1;
+	}
+	free(tmpname);
+	return ret;
+#else
+	return write_buf_to_file(buf, size, filename);
+#endif
+}
+
+#if HAVE_IMAGE_MMAP
+/* Maps filename if it is a regular file of the expected size. Returns 1 if it should be read instead. */
+static int map_input(struct image_file *file, const char *filename, size_t size, bool writable)
+{
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return 1;
+
+	struct stat image_stat;
+	if (fstat(fd, &image_stat) != 0 || !S_ISREG(image_stat.st_mode) || image_stat.st_size != (intmax_t)size) {
+		(void)close(fd);
+		return 1;
+	}
+
+	/* Private mappings are copy-on-write, only pages that are changed get copied. */
+	void *const buf = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+	(void)close(fd);
+	if (buf == MAP_FAILED) {
+		msg_gdbg("Mapping \"%s\" failed (%s), reading it instead.\n", filename, strerror(errno));
+		return 1;
+	}
+	file->buf = buf;
+	file->mapped = true;
+	return 0;
+}
+
+/* Allocates the blocks up front, running out of space later would fault on access to the mapping. */
+static int preallocate(int fd, size_t size)
+{
+#ifndef __APPLE__
+	const int err = posix_fallocate(fd, 0, size);
+	if (err != EINVAL && err != EOPNOTSUPP)
+		return err;
+#endif
+	/* Not supported by the file system, the file stays sparse. */
+	return ftruncate(fd, size);
+}
+
+/*
+ * Maps a preallocated temporary file next to filename, which replaces it on
+ * commit. Returns 1 if a buffer should be used and filename written in place.
+ */
+static int map_output(struct image_file *file, const char *filename, size_t size)
+{
+	struct stat image_stat;
+	bool exists = true;
+
+	/*
+	 * Anything but a regular file with a single link, e.g. a device, a symlink
+	 * or a hard link, is written in place so that it stays what it was.
+	 */
+	if (lstat(filename, &image_stat) != 0) {
+		if (errno != ENOENT)
+			return 1;
+		exists = false;
+	} else if (!S_ISREG(image_stat.st_mode) || image_stat.st_nlink != 1) {
+		return 1;
+	}
+
+	char *const tmpname = malloc(strlen(filename) + strlen(".XXXXXX") + 1);
+	if (!tmpname)
+		return 1;
+	sprintf(tmpname, "%s.XXXXXX", filename);
+
+	/* mkstemp() picks an unused name and creates it exclusively. */
+	const int fd = mkstemp(tmpname);
+	if (fd < 0) {
+		free(tmpname);
+		return 1;
+	}
+
+	/*
+	 * The replacement takes over owner and mode of the file. If the owner
+	 * can't be kept, the file is written in place instead. New files get the
+	 * mode open() would have given them.
+	 */
+	int ret;
+	if (exists) {
+		ret = fchown(fd, image_stat.st_uid, image_stat.st_gid) ||
+		      fchmod(fd, image_stat.st_mode & 07777);
+	} else {
+		const mode_t mask = umask(0);
+		umask(mask);
+		ret = fchmod(fd, 0666 & ~mask);
+	}
+
+	void *buf = MAP_FAILED;
+	if (!ret && !preallocate(fd, size))
+		buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	(void)close(fd);
+	if (buf == MAP_FAILED) {
+		msg_gdbg("Preparing \"%s\" failed, writing \"%s\" at the end instead.\n", tmpname, filename);
+		(void)unlink(tmpname);
+		free(tmpname);
+		return 1;
+	}
+	file->buf = buf;
+	file->mapped = true;
+	file->tmpname = tmpname;
+	return 0;
+}
+#endif
+
+/**
+ * @brief Provides the contents of an image file
+ *
+ * @param file     Image to set up, release with image_file_release()
+ * @param filename File to read, "-" for the standard input
+ * @param size     Expected size of the file
+ * @param writable Whether file->buf may be modified, this doesn't change the file
+ * @return 0 on success
+ */
+int image_file_map(struct image_file *file, const char *filename, size_t size, bool writable)
+{
+	memset(file, 0, sizeof(*file));
+	file->size = size;
+
+#if HAVE_IMAGE_MMAP
+	if (size && strcmp(filename, "-") && !map_input(file, filename, size, writable))
+		return 0;
+#endif
+
+	file->buf = malloc(size);
+	if (!file->buf) {
+		msg_gerr("Out of memory!\n");
+		return 1;
+	}
+	if (read_buf_from_file(file->buf, size, filename)) {
+		image_file_release(file);
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Provides a zeroed buffer to be written to an image file
+ *
+ * The file is only written by image_file_commit(), until then it is left
+ * untouched. A regular file is replaced by a temporary file next to it that
+ * has the same owner and mode. Other files, hard links and files whose owner
+ * can't be kept are written in place.
+ *
+ * @param file     Image to set up, release with image_file_release()
+ * @param filename File to write, NULL for a buffer that isn't written anywhere
+ * @param size     Size of the file
+ * @return 0 on success
+ */
+int image_file_create(struct image_file *file, const char *filename, size_t size)
+{
+	memset(file, 0, sizeof(*file));
+	file->size = size;
+	file->filename = filename;
+
+#if HAVE_IMAGE_MMAP
+	if (filename && size && !map_output(file, filename, size))
+		return 0;
+#endif
+
+	file->buf = calloc(size, 1);
+	if (!file->buf) {
+		msg_gerr("Out of memory!\n");
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Writes an image created by image_file_create() to its file
+ *
+ * @param file Image to write
+ * @return 0 on success
+ */
+int image_file_commit(struct image_file *file)
+{
+	if (!file->filename)
+		return 0;
+	if (!file->mapped)
+		return write_buf_to_file(file->buf, file->size, file->filename);
+
+#if HAVE_IMAGE_MMAP
+	if (msync(file->buf, file->size, MS_SYNC)) {
+		msg_gerr("Error: syncing file \"%s\" failed: %s\n", file->tmpname, strerror(errno));
+		return 1;
+	}
+	if (rename(file->tmpname, file->filename)) {
+		msg_gerr("Error: renaming \"%s\" to \"%s\" failed: %s\n",
+			 file->tmpname, file->filename, strerror(errno));
+		return 1;
+	}
+	free(file->tmpname);
+	file->tmpname = NULL;
+#endif
+	return 0;
+}
+
+/* Releases the memory of the image, outputs that weren't committed are discarded. */
+void image_file_release(struct image_file *file)
+{
+#if HAVE_IMAGE_MMAP
+	if (file->mapped) {
+		(void)munmap(file->buf, file->size);
+		if (file->tmpname)
+			(void)unlink(file->tmpname);
+		free(file->tmpname);
+		memset(file, 0, sizeof(*file));
+		return;
+	}
+#endif
+	free(file->buf);
+	memset(file, 0, sizeof(*file));
+}
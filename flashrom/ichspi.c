@@ -1276,8 +1276,28 @@ struct hwseq_data {
 	uint32_t hsfc_fcycle;
 
 	struct fd_region fd_regions[MAX_FD_REGIONS];
+
+	/* Read-only mapping of the end of the BIOS region, see ich_hwseq_map_bios(). */
+	const uint8_t *bios_map;
+	uint32_t map_start;
+	uint32_t map_len;
+	unsigned int map_chunks;	/* Chunks read through the mapping so far. */
 };
 
+/*
+ * The chipset decodes the end of the BIOS region right below 4 GiB, so that
+ * the CPU can read it like memory. Up to 16 MiB of it are mapped for reading.
+ */
+#define ICH_BIOS_DECODE_MAX	(16 * MiB)
+/*
+ * Reads through the mapping are done in chunks of this size. The first chunk
+ * of every read and every ICH_MMAP_CHECK_INTERVAL-th chunk after that are
+ * compared with what the hardware sequencer reads at their start.
+ */
+#define ICH_MMAP_CHUNK		(4 * KiB)
+#define ICH_MMAP_CHECK_INTERVAL	16
+#define ICH_MMAP_SAMPLE		64
+
 #define MAX_PR_REGISTERS 6
 struct flash_region ranges_data[MAX_PR_REGISTERS];
 struct protected_ranges ranges = {
@@ -1665,11 +1685,64 @@ static int ich_hwseq_probe(struct flashctx *flash)
 	return 1;
 }
 
+static void ich_hwseq_unmap_bios(struct hwseq_data *hwseq_data)
+{
+	if (!hwseq_data->bios_map)
+		return;
+	physunmap((void *)hwseq_data->bios_map, hwseq_data->map_len);
+	hwseq_data->bios_map = NULL;
+	hwseq_data->map_len = 0;
+}
+
+/* Maps the end of the BIOS region where it is decoded below 4 GiB. */
+static void ich_hwseq_map_bios(struct hwseq_data *hwseq_data)
+{
+	const struct fd_region *const bios = &hwseq_data->fd_regions[1];
+
+	if (!bios->name) {
+		msg_pwarn("The descriptor has no BIOS region, reading with hardware sequencing only.\n");
+		return;
+	}
+	if (bios->level == READ_PROT || bios->level == LOCKED) {
+		msg_pwarn("The BIOS region is read protected, reading with hardware sequencing only.\n");
+		return;
+	}
+
+	const uint32_t len = min(bios->limit - bios->base + 1, ICH_BIOS_DECODE_MAX);
+	void *const map = physmap_ro("ICH BIOS region", (uintptr_t)(0xffffffff - len + 1), len);
+	if (map == ERROR_PTR) {
+		msg_pwarn("Could not map the BIOS region, reading with hardware sequencing only.\n");
+		return;
+	}
+
+	hwseq_data->bios_map = map;
+	hwseq_data->map_start = bios->limit + 1 - len;
+	hwseq_data->map_len = len;
+	msg_pdbg("Reading 0x%06"PRIx32"-0x%06"PRIx32" of the BIOS region through its mapping.\n",
+		 hwseq_data->map_start, bios->limit);
+}
+
+static bool ich_hwseq_map_overlaps(const struct hwseq_data *hwseq_data, unsigned int addr, unsigned int len)
+{
+	return hwseq_data->bios_map && len &&
+	       addr < hwseq_data->map_start + hwseq_data->map_len &&
+	       addr + len > hwseq_data->map_start;
+}
+
+/* The mapping is cached, it may hold stale data after the flash was changed. */
+static void ich_hwseq_invalidate_map(struct hwseq_data *hwseq_data, unsigned int addr, unsigned int len)
+{
+	if (!ich_hwseq_map_overlaps(hwseq_data, addr, len))
+		return;
+	msg_pdbg("Not reading the BIOS region through its mapping after changing it.\n");
+	ich_hwseq_unmap_bios(hwseq_data);
+}
+
 static int ich_hwseq_block_erase(struct flashctx *flash, unsigned int addr,
 				 unsigned int len)
 {
 	uint32_t erase_block;
-	const struct hwseq_data *hwseq_data = get_hwseq_data_from_context(flash);
+	struct hwseq_data *hwseq_data = get_hwseq_data_from_context(flash);
 
 	erase_block = ich_hwseq_get_erase_block_size(addr, hwseq_data->addr_mask, hwseq_data->only_4k);
 	if (len != erase_block) {
@@ -1695,6 +1768,7 @@ static int ich_hwseq_block_erase(struct flashctx *flash, unsigned int addr,
 	}
 
 	msg_pdbg("Erasing %d bytes starting at 0x%06x.\n", len, addr);
+	ich_hwseq_invalidate_map(hwseq_data, addr, len);
 
 	if (ich_exec_sync_hwseq_xfer(flash, HSFC_CYCLE_BLOCK_ERASE, addr, 1, ich_generation,
 		hwseq_data->addr_mask))
@@ -1702,22 +1776,13 @@ static int ich_hwseq_block_erase(struct flashctx *flash, unsigned int addr,
 	return 0;
 }
 
-static int ich_hwseq_read(struct flashctx *flash, uint8_t *buf,
-			  unsigned int addr, unsigned int len)
+/* Reads with the hardware sequencer, one FDATA block at a time. */
+static int ich_hwseq_read_blocks(struct flashctx *flash, uint8_t *buf,
+				 unsigned int addr, unsigned int len)
 {
 	uint8_t block_len;
 	const struct hwseq_data *hwseq_data = get_hwseq_data_from_context(flash);
 
-	if (addr + len > flash->chip->total_size * 1024) {
-		msg_perr("Request to read from an inaccessible memory address "
-			 "(addr=0x%x, len=%d).\n", addr, len);
-		return -1;
-	}
-
-	msg_pdbg("Reading %d bytes starting at 0x%06x.\n", len, addr);
-	/* clear FDONE, FCERR, AEL by writing 1 to them (if they are set) */
-	REGWRITE16(ICH9_REG_HSFS, REGREAD16(ICH9_REG_HSFS));
-
 	while (len > 0) {
 		/* Obey programmer limit... */
 		block_len = min(len, flash->mst->opaque.max_data_read);
@@ -1735,10 +1800,71 @@ static int ich_hwseq_read(struct flashctx *flash, uint8_t *buf,
 	return 0;
 }
 
+/*
+ * Copies a range inside the BIOS mapping and compares samples of it with
+ * the flash. If they differ, the mapping is dropped and the whole range is
+ * read with the hardware sequencer instead.
+ */
+static int ich_hwseq_read_mapped(struct flashctx *flash, uint8_t *buf,
+				 unsigned int addr, unsigned int len)
+{
+	struct hwseq_data *hwseq_data = get_hwseq_data_from_context(flash);
+	uint8_t sample[ICH_MMAP_SAMPLE];
+	unsigned int done = 0;
+
+	while (done < len) {
+		const unsigned int chunk = min(len - done, ICH_MMAP_CHUNK - (addr + done) % ICH_MMAP_CHUNK);
+		const bool check = done == 0 || hwseq_data->map_chunks % ICH_MMAP_CHECK_INTERVAL == 0;
+
+		mmio_readn(hwseq_data->bios_map + (addr + done - hwseq_data->map_start), buf + done, chunk);
+		hwseq_data->map_chunks++;
+		if (check) {
+			const unsigned int sample_len = min(chunk, ICH_MMAP_SAMPLE);
+			if (ich_hwseq_read_blocks(flash, sample, addr + done, sample_len))
+				return 1;
+			if (memcmp(sample, buf + done, sample_len)) {
+				msg_pwarn("The mapped BIOS region differs from the flash at 0x%06x, "
+					  "reading it with hardware sequencing.\n", addr + done);
+				ich_hwseq_unmap_bios(hwseq_data);
+				return ich_hwseq_read_blocks(flash, buf, addr, len);
+			}
+		}
+		done += chunk;
+	}
+	return 0;
+}
+
+static int ich_hwseq_read(struct flashctx *flash, uint8_t *buf,
+			  unsigned int addr, unsigned int len)
+{
+	const struct hwseq_data *hwseq_data = get_hwseq_data_from_context(flash);
+
+	if (addr + len > flash->chip->total_size * 1024) {
+		msg_perr("Request to read from an inaccessible memory address "
+			 "(addr=0x%x, len=%d).\n", addr, len);
+		return -1;
+	}
+
+	msg_pdbg("Reading %d bytes starting at 0x%06x.\n", len, addr);
+	/* clear FDONE, FCERR, AEL by writing 1 to them (if they are set) */
+	REGWRITE16(ICH9_REG_HSFS, REGREAD16(ICH9_REG_HSFS));
+
+	if (ich_hwseq_map_overlaps(hwseq_data, addr, len)) {
+		const unsigned int start = max(addr, hwseq_data->map_start);
+		const unsigned int end = min(addr + len, hwseq_data->map_start + hwseq_data->map_len);
+
+		if (ich_hwseq_read_blocks(flash, buf, addr, start - addr) ||
+		    ich_hwseq_read_mapped(flash, buf + (start - addr), start, end - start))
+			return 1;
+		return ich_hwseq_read_blocks(flash, buf + (end - addr), end, addr + len - end);
+	}
+	return ich_hwseq_read_blocks(flash, buf, addr, len);
+}
+
 static int ich_hwseq_write(struct flashctx *flash, const uint8_t *buf, unsigned int addr, unsigned int len)
 {
 	uint8_t block_len;
-	const struct hwseq_data *hwseq_data = get_hwseq_data_from_context(flash);
+	struct hwseq_data *hwseq_data = get_hwseq_data_from_context(flash);
 
 	if (addr + len > flash->chip->total_size * 1024) {
 		msg_perr("Request to write to an inaccessible memory address "
@@ -1747,6 +1873,7 @@ static int ich_hwseq_write(struct flashctx *flash, const uint8_t *buf, unsigned
 	}
 
 	msg_pdbg("Writing %d bytes starting at 0x%06x.\n", len, addr);
+	ich_hwseq_invalidate_map(hwseq_data, addr, len);
 	/* clear FDONE, FCERR, AEL by writing 1 to them (if they are set) */
 	REGWRITE16(ICH9_REG_HSFS, REGREAD16(ICH9_REG_HSFS));
 
@@ -1769,6 +1896,7 @@ static int ich_hwseq_write(struct flashctx *flash, const uint8_t *buf, unsigned
 
 static int ich_hwseq_shutdown(void *data)
 {
+	ich_hwseq_unmap_bios(data);
 	free(data);
 	return 0;
 }
@@ -2110,6 +2238,26 @@ static int get_ich_spi_mode_param(const struct programmer_cfg *cfg, enum ich_spi
 	return 0;
 }
 
+static int get_ich_mmap_read_param(const struct programmer_cfg *cfg, bool *mmap_read)
+{
+	char *const arg = extract_programmer_param_str(cfg, "ich_mmap_read");
+	if (!arg)
+		return 0;
+
+	if (!strcmp(arg, "yes")) {
+		*mmap_read = true;
+	} else if (!strcmp(arg, "no")) {
+		*mmap_read = false;
+	} else {
+		msg_perr("Unknown argument for ich_mmap_read: %s\n", arg);
+		free(arg);
+		return ERROR_FLASHROM_FATAL;
+	}
+	free(arg);
+
+	return 0;
+}
+
 static void init_chipset_properties(struct swseq_data *swseq, struct hwseq_data *hwseq,
 					size_t *num_freg, size_t *num_pr, size_t *reg_pr0,
 					enum ich_chipset ich_gen)
@@ -2193,9 +2341,13 @@ static int init_ich_default(const struct programmer_cfg *cfg, void *spibar, enum
 	enum ich_spi_mode ich_spi_mode = ich_auto;
 	size_t num_freg, num_pr, reg_pr0;
 	struct hwseq_data hwseq_data = { 0 };
+	bool mmap_read = false;
 	init_chipset_properties(&swseq_data, &hwseq_data, &num_freg, &num_pr, &reg_pr0, ich_gen);
 
 	int ret = get_ich_spi_mode_param(cfg, &ich_spi_mode);
+	if (ret)
+		return ret;
+	ret = get_ich_mmap_read_param(cfg, &mmap_read);
 	if (ret)
 		return ret;
 
@@ -2447,8 +2599,12 @@ static int init_ich_default(const struct programmer_cfg *cfg, void *spibar, enum
 		if (!opaque_hwseq_data)
 			return ERROR_FLASHROM_FATAL;
 		memcpy(opaque_hwseq_data, &hwseq_data, sizeof(*opaque_hwseq_data));
+		if (mmap_read)
+			ich_hwseq_map_bios(opaque_hwseq_data);
 		register_opaque_master(&opaque_master_ich_hwseq, opaque_hwseq_data);
 	} else {
+		if (mmap_read)
+			msg_pwarn("ich_mmap_read only applies to hardware sequencing, ignoring it.\n");
 		register_spi_master(&spi_master_ich, NULL);
 	}
 
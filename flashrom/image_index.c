@@ -0,0 +1,408 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Single-pass index of the firmware structures in an image. All signatures
+ * are searched for at once: the image is read a 64-bit word at a time and a
+ * word is only looked at byte by byte if it contains the first byte of one of
+ * the signatures. Each hit is validated before the regions it describes are
+ * recorded, so strings that merely contain a signature are ignored.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "flash.h"
+#include "fmap.h"
+#include "ich_descriptors.h"
+#include "image_index.h"
+#include "layout.h"
+#include "platform.h"
+
+struct signature {
+	const char *magic;
+	size_t len;
+};
+
+static const struct signature signatures[IMAGE_REGION_NR] = {
+	[IMAGE_REGION_FMAP]	= { FMAP_SIGNATURE, 8 },
+	[IMAGE_REGION_IFD]	= { "\x5a\xa5\xf0\x0f", 4 },	/* DESCRIPTOR_MODE_SIGNATURE, little endian */
+	[IMAGE_REGION_FPT]	= { "$FPT", 4 },
+	[IMAGE_REGION_FV]	= { "_FVH", 4 },
+	[IMAGE_REGION_CBFS]	= { "LARCHIVE", 8 },
+};
+
+/* Intel flash descriptors start on a 4 KiB boundary. */
+#define IFD_ALIGNMENT		0x1000
+/* The ME region starts with a 16 byte ROM bypass vector in front of $FPT. */
+#define FPT_ROM_BYPASS_LEN	0x10
+#define FPT_HEADER_MIN_LEN	0x20
+#define FPT_ENTRY_LEN		0x20
+#define FPT_MAX_ENTRIES		128
+/* EFI_FIRMWARE_VOLUME_HEADER */
+#define FV_SIGNATURE_OFFSET	40
+#define FV_HEADER_MIN_LEN	56
+#define FV_ALIGNMENT		8
+/* struct cbfs_file */
+#define CBFS_HEADER_LEN		24
+#define CBFS_ALIGNMENT		64
+#define CBFS_MAX_DATA_OFFSET	4096
+#define CBFS_TYPE_DELETED	0x00000000
+#define CBFS_TYPE_NULL		0xffffffff
+
+#define WORD_ONES		0x0101010101010101ULL
+#define WORD_HIGHS		0x8080808080808080ULL
+
+const char *image_region_type_name(enum image_region_type type)
+{
+	switch (type) {
+	case IMAGE_REGION_FMAP:	return "fmap";
+	case IMAGE_REGION_IFD:	return "ifd";
+	case IMAGE_REGION_FPT:	return "fpt";
+	case IMAGE_REGION_FV:	return "fv";
+	case IMAGE_REGION_CBFS:	return "cbfs";
+	case IMAGE_REGION_NR:	break;
+	}
+	return "unknown";
+}
+
+void image_index_free(struct image_index *index)
+{
+	free(index->regions);
+	index->regions = NULL;
+	index->count = 0;
+	index->capacity = 0;
+}
+
+static int add_region(struct image_index *index, enum image_region_type type, size_t start, size_t end,
+		      size_t structure, const char *name)
+{
+	if (index->count == index->capacity) {
+		const size_t capacity = index->capacity ? 2 * index->capacity : 16;
+		struct image_region *regions = realloc(index->regions, capacity * sizeof(*regions));
+		if (!regions) {
+			msg_gerr("Out of memory!\n");
+			return 1;
+		}
+		index->regions = regions;
+		index->capacity = capacity;
+	}
+
+	struct image_region *const region = &index->regions[index->count++];
+	region->type = type;
+	region->start = start;
+	region->end = end;
+	region->structure = structure;
+	snprintf(region->name, sizeof(region->name), "%s", name);
+	return 0;
+}
+
+/*
+ * The validators return 1 for a valid structure, 0 if the hit is to be
+ * ignored and -1 on errors. The regions are only recorded if index is set.
+ */
+
+static int validate_fmap(const uint8_t *buf, size_t len, size_t hit, struct image_index *index)
+{
+	if (len - hit < sizeof(struct fmap) || !fmap_is_valid((const struct fmap *)(buf + hit)))
+		return 0;
+	if (!index)
+		return 1;
+
+	const struct fmap *const fmap = (const struct fmap *)(buf + hit);
+	if (hit + sizeof(*fmap) + fmap->nareas * sizeof(struct fmap_area) > len)
+		return 0;
+
+	for (size_t i = 0; i < fmap->nareas; i++) {
+		const struct fmap_area *const area = &fmap->areas[i];
+		char name[FMAP_STRLEN + 1];
+
+		/* Zero-size areas can't be represented by inclusive bounds. */
+		if (!area->size || (size_t)area->offset + area->size > len)
+			continue;
+		snprintf(name, sizeof(name), "%s", area->name);
+		if (add_region(index, IMAGE_REGION_FMAP, area->offset, area->offset + area->size - 1, hit, name))
+			return -1;
+	}
+	return 1;
+}
+
+static int validate_ifd(const uint8_t *buf, size_t len, size_t hit, struct image_index *index)
+{
+#ifndef __FLASHROM_LITTLE_ENDIAN__
+	return 0;
+#else
+	struct flashrom_layout *layout = NULL;
+	size_t base;
+
+	/* The signature is the first dword on ICH8 and the fifth one since. */
+	if (hit % IFD_ALIGNMENT == 0)
+		base = hit;
+	else if (hit % IFD_ALIGNMENT == 4 * sizeof(uint32_t))
+		base = hit - 4 * sizeof(uint32_t);
+	else
+		return 0;
+	if (len - base < IFD_ALIGNMENT)
+		return 0;
+
+	const int parsed = layout_from_ich_descriptors(&layout, buf + base, len - base);
+	if (parsed)
+		return parsed == 2 ? -1 : 0;
+
+	int ret = 1;
+	const struct romentry *entry = NULL;
+	while (index && (entry = layout_next(layout, entry))) {
+		if (base + entry->region.end >= len)
+			continue;
+		if (add_region(index, IMAGE_REGION_IFD, base + entry->region.start, base + entry->region.end,
+			       hit, entry->region.name)) {
+			ret = -1;
+			break;
+		}
+	}
+	flashrom_layout_release(layout);
+	return ret;
+#endif
+}
+
+static int validate_fpt(const uint8_t *buf, size_t len, size_t hit, struct image_index *index)
+{
+	if (hit % sizeof(uint32_t) || len - hit < FPT_HEADER_MIN_LEN)
+		return 0;
+
+	const uint32_t entries = read_le32(buf, hit + 4);
+	const uint8_t header_version = buf[hit + 8];
+	const uint8_t entry_version = buf[hit + 9];
+	const uint8_t header_len = buf[hit + 10];
+	if (!entries || entries > FPT_MAX_ENTRIES || entry_version != 0x10 ||
+	    (header_version != 0x10 && header_version != 0x20 && header_version != 0x21) ||
+	    header_len < FPT_HEADER_MIN_LEN || header_len % sizeof(uint32_t) ||
+	    hit + header_len + entries * FPT_ENTRY_LEN > len)
+		return 0;
+	if (!index)
+		return 1;
+
+	/* Partition offsets are relative to the start of the ME region. */
+	const size_t base = (hit >= FPT_ROM_BYPASS_LEN && (hit - FPT_ROM_BYPASS_LEN) % IFD_ALIGNMENT == 0) ?
+			    hit - FPT_ROM_BYPASS_LEN : hit;
+
+	for (size_t i = 0; i < entries; i++) {
+		const uint8_t *const entry = buf + hit + header_len + i * FPT_ENTRY_LEN;
+		const uint32_t offset = read_le32(entry, 8);
+		const uint32_t size = read_le32(entry, 12);
+		char name[5 + 4 + 1] = "fpt_";
+
+		if (!size || offset == 0xffffffff || size == 0xffffffff || base + offset + size > len)
+			continue;
+		for (size_t j = 0; j < 4 && isgraph(entry[j]); j++)
+			name[4 + j] = entry[j];
+		if (add_region(index, IMAGE_REGION_FPT, base + offset, base + offset + size - 1, hit, name))
+			return -1;
+	}
+	return 1;
+}
+
+static int validate_fv(const uint8_t *buf, size_t len, size_t hit, struct image_index *index)
+{
+	if (hit < FV_SIGNATURE_OFFSET)
+		return 0;
+	const size_t base = hit - FV_SIGNATURE_OFFSET;
+	if (base % FV_ALIGNMENT || len - base < FV_HEADER_MIN_LEN)
+		return 0;
+
+	const uint64_t fv_len = read_le64(buf, base + 32);
+	const uint16_t header_len = read_le16(buf, base + 48);
+	const uint8_t revision = buf[base + 55];
+	if (revision < 1 || revision > 2 || header_len < FV_HEADER_MIN_LEN || header_len % 2 ||
+	    header_len > len - base || fv_len < header_len || fv_len > len - base)
+		return 0;
+
+	/* The 16 bit words of the header add up to zero. */
+	uint16_t sum = 0;
+	for (size_t i = 0; i < header_len; i += 2)
+		sum += read_le16(buf, base + i);
+	if (sum)
+		return 0;
+	if (!index)
+		return 1;
+
+	char name[IMAGE_REGION_NAME_LEN];
+	snprintf(name, sizeof(name), "fv_%08zx", base);
+	return add_region(index, IMAGE_REGION_FV, base, base + fv_len - 1, base, name) ? -1 : 1;
+}
+
+static int validate_cbfs(const uint8_t *buf, size_t len, size_t hit, struct image_index *index)
+{
+	if (hit % CBFS_ALIGNMENT || len - hit < CBFS_HEADER_LEN + 1)
+		return 0;
+
+	const uint32_t data_len = read_be32(buf, hit + 8);
+	const uint32_t type = read_be32(buf, hit + 12);
+	const uint32_t attributes = read_be32(buf, hit + 16);
+	const uint32_t data_offset = read_be32(buf, hit + 20);
+	if (data_offset <= CBFS_HEADER_LEN || data_offset > CBFS_MAX_DATA_OFFSET ||
+	    (attributes && (attributes < CBFS_HEADER_LEN || attributes > data_offset)) ||
+	    data_offset > len - hit || data_len > len - hit - data_offset)
+		return 0;
+
+	/* The file name is a printable, NUL terminated string in front of the attributes and data. */
+	const char *const filename = (const char *)buf + hit + CBFS_HEADER_LEN;
+	const size_t name_max = (attributes ? attributes : data_offset) - CBFS_HEADER_LEN;
+	const size_t name_len = strnlen(filename, name_max);
+	if (name_len == name_max)
+		return 0;
+	for (size_t i = 0; i < name_len; i++) {
+		if (!isprint((unsigned char)filename[i]))
+			return 0;
+	}
+	if (!index)
+		return 1;
+
+	/* Empty and deleted files only fill the free space. */
+	if (type == CBFS_TYPE_NULL || type == CBFS_TYPE_DELETED || !data_len)
+		return 1;
+
+	char name[IMAGE_REGION_NAME_LEN];
+	snprintf(name, sizeof(name), "cbfs_%s", filename);
+	return add_region(index, IMAGE_REGION_CBFS, hit, hit + data_offset + data_len - 1, hit, name) ? -1 : 1;
+}
+
+typedef int (validate_fn)(const uint8_t *buf, size_t len, size_t hit, struct image_index *index);
+
+static validate_fn *const validators[IMAGE_REGION_NR] = {
+	[IMAGE_REGION_FMAP]	= validate_fmap,
+	[IMAGE_REGION_IFD]	= validate_ifd,
+	[IMAGE_REGION_FPT]	= validate_fpt,
+	[IMAGE_REGION_FV]	= validate_fv,
+	[IMAGE_REGION_CBFS]	= validate_cbfs,
+};
+
+/* Returns a word with the high bit set in every byte of word that equals the byte of pattern. */
+static uint64_t bytes_equal(uint64_t word, uint64_t pattern)
+{
+	const uint64_t x = word ^ pattern;
+	return (x - WORD_ONES) & ~x & WORD_HIGHS;
+}
+
+/*
+ * Calls the validators of the requested types for every signature in the
+ * image, in order of the offset of the signature. Stops at the first valid
+ * structure if first is set. Returns the offset of the last valid signature,
+ * -1 if there was none and -2 on errors.
+ */
+static ssize_t scan(const uint8_t *buf, size_t len, unsigned int types, struct image_index *index, bool first)
+{
+	uint64_t patterns[IMAGE_REGION_NR];
+	uint8_t first_bytes[256] = { 0 };	/* Bitmask of types per first byte. */
+	size_t pattern_count = 0;
+	ssize_t found = -1;
+
+	for (size_t t = 0; t < IMAGE_REGION_NR; t++) {
+		if (!(types & IMAGE_REGION_MASK(t)))
+			continue;
+		const uint8_t byte = signatures[t].magic[0];
+		if (!first_bytes[byte])
+			patterns[pattern_count++] = byte * WORD_ONES;
+		first_bytes[byte] |= IMAGE_REGION_MASK(t);
+	}
+	if (!pattern_count)
+		return -1;
+
+	for (size_t pos = 0; pos < len; pos += sizeof(uint64_t)) {
+		const size_t chunk = len - pos < sizeof(uint64_t) ? len - pos : sizeof(uint64_t);
+		if (chunk == sizeof(uint64_t)) {
+			uint64_t word, hits = 0;
+			memcpy(&word, buf + pos, sizeof(word));
+			for (size_t p = 0; p < pattern_count; p++)
+				hits |= bytes_equal(word, patterns[p]);
+			if (!hits)
+				continue;
+		}
+
+		for (size_t hit = pos; hit < pos + chunk; hit++) {
+			const unsigned int candidates = first_bytes[buf[hit]];
+			if (!candidates)
+				continue;
+			for (size_t t = 0; t < IMAGE_REGION_NR; t++) {
+				if (!(candidates & IMAGE_REGION_MASK(t)) || len - hit < signatures[t].len ||
+				    memcmp(buf + hit, signatures[t].magic, signatures[t].len))
+					continue;
+				const int ret = validators[t](buf, len, hit, index);
+				if (ret < 0)
+					return -2;
+				if (!ret)
+					continue;
+				msg_gdbg("Found %s structure at 0x%08zx.\n", image_region_type_name(t), hit);
+				found = hit;
+				if (first)
+					return found;
+			}
+		}
+	}
+	return found;
+}
+
+static int compare_regions(const void *a, const void *b)
+{
+	const struct image_region *ra = a, *rb = b;
+
+	if (ra->start != rb->start)
+		return ra->start < rb->start ? -1 : 1;
+	if (ra->type != rb->type)
+		return ra->type < rb->type ? -1 : 1;
+	return ra->end < rb->end ? -1 : ra->end > rb->end;
+}
+
+int image_index_scan(const uint8_t *buf, size_t len, unsigned int types, struct image_index *index)
+{
+	memset(index, 0, sizeof(*index));
+	if (scan(buf, len, types, index, false) == -2) {
+		image_index_free(index);
+		return 1;
+	}
+	if (index->count)
+		qsort(index->regions, index->count, sizeof(*index->regions), compare_regions);
+	return 0;
+}
+
+ssize_t image_index_find_first(const uint8_t *buf, size_t len, enum image_region_type type)
+{
+	const ssize_t ret = scan(buf, len, IMAGE_REGION_MASK(type), NULL, true);
+	return ret < 0 ? -1 : ret;
+}
+
+int image_index_to_layout(const struct image_index *index, unsigned int types, struct flashrom_layout **layout)
+{
+	if (flashrom_layout_new(layout))
+		return 1;
+
+	for (size_t i = 0; i < index->count; i++) {
+		const struct image_region *const region = &index->regions[i];
+		char name[IMAGE_REGION_NAME_LEN + 16];
+
+		if (!(types & IMAGE_REGION_MASK(region->type)))
+			continue;
+
+		/* Names must be unique, e.g. CBFS files show up in every CBFS. */
+		bool duplicate = false;
+		for (size_t j = 0; j < i && !duplicate; j++) {
+			duplicate = (types & IMAGE_REGION_MASK(index->regions[j].type)) &&
+				    !strcmp(index->regions[j].name, region->name);
+		}
+		if (duplicate)
+			snprintf(name, sizeof(name), "%s@%zx", region->name, region->start);
+		else
+			snprintf(name, sizeof(name), "%s", region->name);
+
+		if (flashrom_layout_add_region(*layout, region->start, region->end, name)) {
+			flashrom_layout_release(*layout);
+			*layout = NULL;
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,48 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef __CHIP_IDENTITY_H__
+#define __CHIP_IDENTITY_H__ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "flash.h"
+
+/*
+ * The chip a manifest or journal belongs to, and the size of its blocks. In
+ * text it is the header of the file, one item per line:
+ *	<header>
+ *	vendor <chip vendor>
+ *	name <chip name>
+ *	id <manufacture id> <model id>
+ *	size <chip size in bytes>
+ *	block_size <block size in bytes>
+ */
+struct chip_identity {
+	char *vendor;
+	char *name;
+	uint32_t manufacture_id;
+	uint32_t model_id;
+	size_t chip_size;
+	size_t block_size;
+};
+
+#define CHIP_IDENTITY_LINES	6
+
+int chip_identity_set(struct chip_identity *id, const struct flashchip *chip);
+void chip_identity_clear(struct chip_identity *id);
+bool chip_identity_matches(const struct chip_identity *id, const struct flashchip *chip);
+size_t chip_identity_text_size(const struct chip_identity *id);
+size_t chip_identity_to_text(const struct chip_identity *id, const char *header, char *out, size_t capacity);
+int chip_identity_parse_line(struct chip_identity *id, const char *header, unsigned int lineno, const char *line);
+
+const char *text_line_value(const char *line, const char *key);
+int text_parse_lines(const char *buffer, size_t len, unsigned int *lineno,
+		     int (*parse_line)(void *data, unsigned int lineno, const char *line), void *data);
+
+#endif /* !__CHIP_IDENTITY_H__ */
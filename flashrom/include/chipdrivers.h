@@ -22,6 +22,7 @@ int probe_spi_res1(struct flashctx *flash);
 int probe_spi_res2(struct flashctx *flash);
 int probe_spi_res3(struct flashctx *flash);
 int probe_spi_at25f(struct flashctx *flash);
+int spi_read_probe_ids(struct flashctx *flash, enum probe_func probe, uint32_t *id1, uint32_t *id2);
 int spi_write_enable(struct flashctx *flash);
 int spi_write_disable(struct flashctx *flash);
 int spi_block_erase_20(struct flashctx *flash, unsigned int addr, unsigned int blocklen);
@@ -41,6 +42,7 @@ int spi_block_erase_db(struct flashctx *flash, unsigned int addr, unsigned int b
 int spi_block_erase_dc(struct flashctx *flash, unsigned int addr, unsigned int blocklen);
 enum block_erase_func spi25_get_erasefn_from_opcode(uint8_t opcode);
 const uint8_t *spi_get_opcode_from_erasefn(enum block_erase_func func);
+const uint8_t *spi_find_opcode_from_erasefn(enum block_erase_func func);
 int spi_chip_write_1(struct flashctx *flash, const uint8_t *buf, unsigned int start, unsigned int len);
 int spi_nbyte_read(struct flashctx *flash, unsigned int addr, uint8_t *bytes, unsigned int len);
 int spi_read_chunked(struct flashctx *flash, uint8_t *buf, unsigned int start, unsigned int len, unsigned int chunksize);
@@ -48,6 +50,8 @@ int spi_write_chunked(struct flashctx *flash, const uint8_t *buf, unsigned int s
 int spi_enter_4ba(struct flashctx *flash);
 int spi_exit_4ba(struct flashctx *flash);
 int spi_set_extended_address(struct flashctx *, uint8_t addr_high);
+unsigned int spi_chip_typ_busy_us(const struct flashctx *flash, uint8_t op, size_t len);
+int spi_poll_wip(struct flashctx *flash, uint8_t op, size_t len, unsigned int poll_us, unsigned int max_us);
 
 
 /* spi25_statusreg.c */
@@ -9,10 +9,13 @@
 #define __CLI_OUTPUT_H__
 
 #include <stdarg.h>
+#include <stdbool.h>
 #include "flash.h"
 
 extern enum flashrom_log_level verbose_screen;
 extern enum flashrom_log_level verbose_logfile;
+/* Keeps stdout for machine-readable output, e.g. JSON. */
+extern bool info_to_stderr;
 int open_logfile(const char * const filename);
 int close_logfile(void);
 void start_logging(void);
@@ -23,10 +23,51 @@ struct erase_layout {
 	const struct block_eraser *eraser;
 };
 
+/* Per-block state of a write plan, one entry per block of the smallest eraser. */
+#define WRITE_PLAN_DIRTY	(1 << 0) /* Block differs from the new image. */
+#define WRITE_PLAN_NEEDS_ERASE	(1 << 1) /* Block can't be written without erasing it first. */
+#define WRITE_PLAN_PARTIAL	(1 << 2) /* Block is only partially covered by included regions. */
+#define WRITE_PLAN_STALE	(1 << 3) /* Block contents changed after the plan was built. */
+
+struct write_extent {
+	chipoff_t start;
+	chipsize_t len;
+};
+
+/*
+ * Diff between the current and the new contents of the included regions,
+ * computed once and shared by progress reporting, erase function selection
+ * and the write loop.
+ */
+struct write_plan {
+	uint8_t *block_flags;
+	size_t block_count;
+	struct write_extent *extents;	/* Sorted, coalesced ranges that differ. */
+	size_t extent_count;
+	size_t erase_len;		/* Bytes in included regions that need an erase. */
+	size_t write_len;		/* Bytes in included regions that differ. */
+	/* Bounds of the layout region erase_write() is currently working on. */
+	chipoff_t active_start;
+	chipoff_t active_end;
+	/* Only record the operations in erase_ops/write_ops, don't execute them. */
+	bool simulate;
+	struct write_extent *erase_ops;
+	size_t erase_op_count;
+	struct write_extent *write_ops;
+	size_t write_op_count;
+	/* Estimated time of the selected erase and write operations. */
+	uint64_t predicted_us;
+};
+
 void free_erase_layout(struct erase_layout *layout, unsigned int erasefn_count);
 int create_erase_layout(struct flashctx *const flashctx, struct erase_layout **erase_layout);
 int erase_write(struct flashctx *const flashctx, chipoff_t region_start, chipoff_t region_end,
 		uint8_t* curcontents, uint8_t* newcontents,
-		struct erase_layout *erase_layout, bool *all_skipped);
+		struct erase_layout *erase_layout, struct write_plan *plan, bool *all_skipped);
+int create_write_plan(struct flashctx *const flashctx, const struct erase_layout *erase_layout,
+		const uint8_t *curcontents, const uint8_t *newcontents, struct write_plan *plan);
+void free_write_plan(struct write_plan *plan);
+char *write_plan_to_json(const struct flashctx *flashctx, const struct erase_layout *erase_layout,
+		const struct write_plan *plan);
 
 #endif		/* !__ERASURE_LAYOUT_H__ */
@@ -168,6 +168,31 @@ enum write_granularity {
  */
 #define FEATURE_FLASH_HARDENING (1 << 26)
 
+#define FEATURE_FAST_READ_DOUT	(1 << 27) /**< Dual output fast read (0x3b, 1-1-2) is supported. */
+#define FEATURE_FAST_READ_QOUT	(1 << 28) /**< Quad output fast read (0x6b, 1-1-4) is supported. */
+#define FEATURE_FAST_READ_DIO	(1 << 29) /**< Dual I/O fast read (0xbb, 1-2-2) is supported. */
+#define FEATURE_FAST_READ_QIO	(1 << 30) /**< Quad I/O fast read (0xeb, 1-4-4) is supported. */
+
+/*
+ * Data lines used for the instruction, the address and the data of an SPI
+ * command, in this order. Ordered by read throughput.
+ */
+enum spi_io_mode {
+	SPI_IO_1_1_1 = 0,
+	SPI_IO_1_1_2,
+	SPI_IO_1_2_2,
+	SPI_IO_1_1_4,
+	SPI_IO_1_4_4,
+	SPI_IO_MODES
+};
+
+/* A fast read instruction, in the terms of the SFDP basic parameter table. */
+struct spi_read_insn {
+	uint8_t opcode;
+	uint8_t mode_clocks;	/* mode bits after the address, in clocks */
+	uint8_t wait_states;	/* dummy clocks after the mode bits */
+};
+
 #define ERASED_VALUE(flash)	(((flash)->chip->feature_bits & FEATURE_ERASED_ZERO) ? 0x00 : 0xff)
 #define UNERASED_VALUE(flash)	(((flash)->chip->feature_bits & FEATURE_ERASED_ZERO) ? 0xff : 0x00)
 
@@ -194,6 +219,8 @@ enum test_state {
 #define TEST_BAD_PREWB	(struct tested){ .probe = BAD, .read = BAD, .erase = BAD, .write = BAD, .wp = BAD }
 
 struct flashrom_flashctx;
+struct stats_collector;
+struct trace_capture;
 #define flashctx flashrom_flashctx /* TODO: Agree on a name and convert all occurrences. */
 typedef int (erasefunc_t)(struct flashctx *flash, unsigned int addr, unsigned int blocklen);
 
@@ -446,8 +473,24 @@ struct flashchip {
 	unsigned int total_size;
 	/* Chip page size in bytes */
 	unsigned int page_size;
+	/* Typical time to program one page in microseconds, 0 if unknown. */
+	unsigned int typ_page_program_us;
+	/* Typical time to program a single byte in microseconds, 0 if unknown. */
+	unsigned int typ_byte_program_us;
+	/* Typical time to erase the whole chip in microseconds, 0 if unknown. */
+	unsigned int typ_chip_erase_us;
+	/* Program operations take at most this many times their typical time, 0 if unknown. */
+	unsigned int max_time_factor;
+	/* Erase operations take at most this many times their typical time, 0 if unknown. */
+	unsigned int max_erase_time_factor;
 	int feature_bits;
 
+	/*
+	 * Fast read instructions by I/O mode, for the modes set in feature_bits.
+	 * An unset opcode means the standard instruction, see spi_read_chunked().
+	 */
+	struct spi_read_insn fast_read[SPI_IO_MODES];
+
 	/* Indicate how well flashrom supports different operations of this flash chip. */
 	struct tested {
 		enum test_state probe;
@@ -489,6 +532,8 @@ struct flashchip {
 		/* a block_erase function should try to erase one block of size
 		 * 'blocklen' at address 'blockaddr' and return 0 on success. */
 		enum block_erase_func block_erase;
+		/* Typical time to erase one block in microseconds, 0 if unknown. */
+		unsigned int typ_erase_us;
 	} block_erasers[NUM_ERASEFUNCTIONS];
 
 	enum printlock_func printlock;
@@ -534,6 +579,9 @@ struct flashchip {
 
 		/* Write Protect Selection (per sector protection when set) */
 		struct reg_bit_info wps;
+
+		/* Quad enable (QE), IO2 and IO3 are only data lines when set */
+		struct reg_bit_info qe;
 	} reg_bits;
 
 	/*
@@ -599,6 +647,9 @@ struct flashrom_flashctx {
 		bool verify_whole_chip;
 		bool skip_unreadable_regions;
 		bool skip_unwritable_regions;
+		bool cost_erase_planner;
+		bool trust_manifest;
+		bool resume_journal;
 	} flags;
 	/* We cache the state of the extended address register (highest byte
 	 * of a 4BA for 3BA instructions) and the state of the 4BA mode here.
@@ -623,6 +674,17 @@ struct flashrom_flashctx {
 
 	/* Maximum allowed % of redundant erase */
 	int sacrifice_ratio;
+
+	/* Block digests of the known chip contents, may be NULL. */
+	struct flashrom_manifest *manifest;
+	/* Records the progress of writes, may be NULL. */
+	struct flashrom_journal *journal;
+	/* Bus traffic statistics, NULL unless enabled. */
+	struct stats_collector *stats;
+	/* Bus trace being recorded, NULL unless started. */
+	struct trace_capture *trace;
+	/* Observed busy time per opcode in us, used for chips without timing data. */
+	unsigned int learned_busy_us[256];
 };
 
 /* Timing used in probe routines. ZERO is -2 to differentiate between an unset
@@ -671,7 +733,7 @@ int read_memmapped(struct flashctx *flash, uint8_t *buf, unsigned int start, uns
 int erase_flash(struct flashctx *flash);
 int probe_flash(struct registered_master *mst, int startchip, struct flashctx *flash, int force, const char *const chip_to_probe);
 int verify_range(struct flashctx *flash, const uint8_t *cmpbuf, unsigned int start, unsigned int len);
-void emergency_help_message(void);
+void emergency_help_message(const struct flashctx *flash);
 void print_version(void);
 void print_buildinfo(void);
 void print_banner(void);
@@ -679,11 +741,30 @@ void list_programmers_linebreak(int startcol, int cols, int paren);
 int selfcheck(void);
 int read_buf_from_file(unsigned char *buf, unsigned long size, const char *filename);
 int write_buf_to_file(const unsigned char *buf, unsigned long size, const char *filename);
+int replace_file(const char *filename, const void *buf, size_t size);
+
+/*
+ * An image file held in memory. Where possible the file is mapped instead of
+ * copied: inputs privately (so changes stay in memory), outputs shared (so the
+ * data lands in the page cache directly). Otherwise buf is a heap copy.
+ */
+struct image_file {
+	uint8_t *buf;
+	size_t size;
+	bool mapped;
+	const char *filename;	/* Output to commit buf to, NULL for inputs. */
+	char *tmpname;		/* Mapped output until it is committed. */
+};
+int image_file_map(struct image_file *file, const char *filename, size_t size, bool writable);
+int image_file_create(struct image_file *file, const char *filename, size_t size);
+int image_file_commit(struct image_file *file);
+void image_file_release(struct image_file *file);
 int prepare_flash_access(struct flashctx *, bool read_it, bool write_it, bool erase_it, bool verify_it);
 void finalize_flash_access(struct flashctx *);
 int register_chip_restore(chip_restore_fn_cb_t func, struct flashctx *flash, void *data);
 int check_block_eraser(const struct flashctx *flash, int k, int log);
 unsigned int count_usable_erasers(const struct flashctx *flash);
+size_t chip_min_block_size(const struct flashchip *chip);
 int need_erase(const uint8_t *have, const uint8_t *want, unsigned int len, enum write_granularity gran, const uint8_t erased_value);
 erasefunc_t *lookup_erase_func_ptr(const struct block_eraser *const eraser);
 int check_erased_range(struct flashctx *flash, unsigned int start, unsigned int len);
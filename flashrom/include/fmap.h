@@ -34,6 +34,7 @@ struct fmap {
 	struct fmap_area areas[];
 }  __attribute__((packed));
 
+int fmap_is_valid(const struct fmap *fmap);
 int fmap_read_from_buffer(struct fmap **fmap_out, const uint8_t *buf, size_t len);
 int fmap_read_from_rom(struct fmap **fmap_out, struct flashctx *const flashctx, size_t rom_offset, size_t len);
 
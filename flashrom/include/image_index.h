@@ -0,0 +1,61 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef __IMAGE_INDEX_H__
+#define __IMAGE_INDEX_H__ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "layout.h"
+
+enum image_region_type {
+	IMAGE_REGION_FMAP,	/* Area of a flashmap ("__FMAP__"). */
+	IMAGE_REGION_IFD,	/* Region of an Intel flash descriptor (0x0FF0A55A). */
+	IMAGE_REGION_FPT,	/* Partition of an ME flash partition table ("$FPT"). */
+	IMAGE_REGION_FV,	/* UEFI firmware volume ("_FVH"). */
+	IMAGE_REGION_CBFS,	/* coreboot CBFS file ("LARCHIVE"). */
+	IMAGE_REGION_NR,
+};
+
+#define IMAGE_REGION_MASK(type)	(1u << (type))
+#define IMAGE_REGION_ALL	(IMAGE_REGION_MASK(IMAGE_REGION_NR) - 1)
+
+#define IMAGE_REGION_NAME_LEN	64
+
+struct image_region {
+	enum image_region_type type;
+	size_t start;
+	size_t end;		/* Inclusive, like struct flash_region. */
+	size_t structure;	/* Offset of the signature that described the region. */
+	char name[IMAGE_REGION_NAME_LEN];
+};
+
+/* Regions are sorted by start offset, then by type. */
+struct image_index {
+	struct image_region *regions;
+	size_t count;
+	size_t capacity;
+};
+
+/*
+ * Scans the image once for all signatures in types (a mask of
+ * IMAGE_REGION_MASK() values), validates each hit and records the regions the
+ * structure describes. Returns 0 on success, 1 if out of memory.
+ */
+int image_index_scan(const uint8_t *buf, size_t len, unsigned int types, struct image_index *index);
+void image_index_free(struct image_index *index);
+const char *image_region_type_name(enum image_region_type type);
+
+/* Offset of the first valid signature of the given type, -1 if there is none. */
+ssize_t image_index_find_first(const uint8_t *buf, size_t len, enum image_region_type type);
+
+/* Creates a layout with one (not included) entry per region of the given types. */
+int image_index_to_layout(const struct image_index *index, unsigned int types, struct flashrom_layout **layout);
+
+#endif /* !__IMAGE_INDEX_H__ */
@@ -0,0 +1,28 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "flash.h"
+#include "layout.h"
+
+bool journal_active(const struct flashrom_journal *journal);
+bool journal_matches(const struct flashrom_journal *journal, const struct flashchip *chip,
+		     const uint8_t *newcontents);
+size_t journal_block_size(const struct flashrom_journal *journal);
+bool journal_block_trusted(const struct flashrom_journal *journal, size_t block);
+int journal_begin(struct flashrom_journal *journal, const struct flashchip *chip,
+		  const struct flashrom_layout *layout, const uint8_t *curcontents, const uint8_t *newcontents);
+void journal_erasing(struct flashrom_journal *journal, chipoff_t start, chipoff_t end);
+chipoff_t journal_written(struct flashrom_journal *journal, chipoff_t start, chipoff_t end);
+void journal_end(struct flashrom_journal *journal, bool complete);
+
+#endif /* !__JOURNAL_H__ */
@@ -238,7 +238,10 @@ struct flashrom_programmer;
 /**
  * @brief Initialize the specified programmer.
  *
- * Currently, only one programmer may be initialized at a time.
+ * Each initialized programmer keeps its own state. Only the dummy programmer
+ * keeps all of its state there, so it is the only one that may be
+ * initialized several times at once. Each instance, and the flash contexts
+ * probed on it, must only be used by one thread at a time.
  *
  * @param[out] flashprog Points to a pointer of type struct flashrom_programmer
  *                       that will be set if programmer initialization succeeds.
@@ -252,7 +255,8 @@ int flashrom_programmer_init(struct flashrom_programmer **flashprog, const char
 /**
  * @brief Shut down the initialized programmer.
  *
- * @param flashprog The programmer to shut down.
+ * @param flashprog The programmer to shut down, it is freed afterwards. NULL
+ *                  shuts down the one last initialized by the calling thread.
  * @return 0 on success
  */
 int flashrom_programmer_shutdown(struct flashrom_programmer *flashprog);
@@ -313,8 +317,8 @@ __attribute__((deprecated("Use flashrom_flash_probe_v2 instead")));
  *				 If no chips are found, the returned array contains
  *				 a single NULL element. Callers must free the array once unused
  *				 by calling `flashrom_data_free`.
- * @param[in] flashprog The flash programmer used to access the chip,
- *			currently unused.
+ * @param[in] flashprog The flash programmer used to access the chip, or NULL
+ *			for the one last initialized by the calling thread.
  * @param[in] chip_name Name of a chip to probe for, or NULL to probe for
  *                      all known chips.
  * @return the number of matched chips (which can be 0) on success,
@@ -356,6 +360,21 @@ enum flashrom_flag {
 	FLASHROM_FLAG_VERIFY_WHOLE_CHIP,
 	FLASHROM_FLAG_SKIP_UNREADABLE_REGIONS,
 	FLASHROM_FLAG_SKIP_UNWRITABLE_REGIONS,
+	/*
+	 * Select erase blocks by minimising the estimated erase and program
+	 * time instead of by the sacrifice ratio.
+	 */
+	FLASHROM_FLAG_COST_ERASE_PLANNER,
+	/*
+	 * Take the contents of blocks whose manifest digest matches the new
+	 * image from the manifest instead of reading them before a write.
+	 */
+	FLASHROM_FLAG_TRUST_MANIFEST,
+	/*
+	 * Continue an interrupted write recorded in the journal of the flash
+	 * context instead of reading the whole layout first.
+	 */
+	FLASHROM_FLAG_RESUME_JOURNAL,
 };
 
 /**
@@ -413,6 +432,31 @@ int flashrom_image_read(struct flashrom_flashctx *flashctx, void *buffer, size_t
  *         or 1 on any other failure.
  */
 int flashrom_image_write(struct flashrom_flashctx *flashctx, void *buffer, size_t buffer_len, const void *refbuffer);
+/**
+ * @brief Describe what writing the specified image would do, without touching the chip.
+ *
+ * Computes the same write plan @ref flashrom_image_write works from: which
+ * blocks of the smallest eraser differ and need an erase, and the coalesced
+ * byte ranges that would be written. The erase algorithm is then run without
+ * executing anything to list the erase and write operations the selected
+ * erase planner (see FLASHROM_FLAG_COST_ERASE_PLANNER) would issue, along
+ * with their estimated time. If a layout is set in the specified flash
+ * context, only included regions are considered.
+ *
+ * @param flashctx The context of the flash chip.
+ * @param buffer Source buffer with the new image.
+ * @param buffer_len Size of source buffer in bytes.
+ * @param refbuffer If given, assume flash chip contains same data as `refbuffer`.
+ * @param[out] plan_json Points to a NUL-terminated JSON description of the plan
+ *			 on success. Has to be freed by the caller with @ref flashrom_data_free.
+ * @return 0 on success,
+ *         4 if buffer_len doesn't match the size of the flash chip,
+ *         3 if memory allocation failed,
+ *         2 if reading the current contents failed,
+ *         or 1 on any other failure.
+ */
+int flashrom_image_write_plan(struct flashrom_flashctx *flashctx, const void *buffer, size_t buffer_len,
+			      const void *refbuffer, char **plan_json);
 /**
  * @brief Verify the ROM chip's contents with the specified image.
  *
@@ -580,6 +624,279 @@ void flashrom_layout_set(struct flashrom_flashctx *flashctx, const struct flashr
 
 /** @} */ /* end flashrom-layout */
 
+/**
+ * @defgroup flashrom-manifest Block digest manifest
+ * @{
+ *
+ * A manifest records a SHA-256 digest for every smallest erase block of a
+ * flash chip whose contents flashrom knows, together with the identity and
+ * size of the chip. When set for a flash context it is refreshed after every
+ * successful read, write and verify, and blocks touched by an erase or a
+ * failed write are dropped from it.
+ *
+ * With FLASHROM_FLAG_TRUST_MANIFEST set, @ref flashrom_image_write takes the
+ * current contents of every block whose digest matches the new image from
+ * the manifest instead of reading it. A sample of those blocks is still read
+ * back; any mismatch invalidates the manifest and the whole layout is read.
+ */
+
+struct flashrom_manifest;
+/**
+ * @brief Create a new, empty manifest.
+ *
+ * @param[out] manifest Points to a struct flashrom_manifest
+ *                      that has to be freed with @ref flashrom_manifest_release.
+ * @return 0 on success,
+ *         1 if out of memory.
+ */
+int flashrom_manifest_new(struct flashrom_manifest **manifest);
+/**
+ * @brief Parse a manifest previously produced by @ref flashrom_manifest_write_to_buffer.
+ *
+ * @param[out] manifest Points to a struct flashrom_manifest
+ *                      that has to be freed with @ref flashrom_manifest_release.
+ * @param buffer Buffer with the text representation of the manifest.
+ * @param len Length of the buffer.
+ * @return 0 on success,
+ *         2 if the buffer is not a valid manifest,
+ *         1 if out of memory.
+ */
+int flashrom_manifest_read_from_buffer(struct flashrom_manifest **manifest, const char *buffer, size_t len);
+/**
+ * @brief Serialise a manifest into its text representation.
+ *
+ * @param manifest Manifest to serialise.
+ * @param[out] buffer Points to a NUL-terminated string on success.
+ *                    Has to be freed by the caller with @ref flashrom_data_free.
+ * @return 0 on success,
+ *         1 if out of memory.
+ */
+int flashrom_manifest_write_to_buffer(const struct flashrom_manifest *manifest, char **buffer);
+/**
+ * @brief Free a manifest.
+ *
+ * @param manifest Manifest to free.
+ */
+void flashrom_manifest_release(struct flashrom_manifest *manifest);
+/**
+ * @brief Set the manifest a flash context keeps up to date.
+ *
+ * Note: The caller must not release the manifest as long as it is used
+ *       through the given flash context.
+ *
+ * @param flashctx Flash context whose manifest will be set.
+ * @param manifest Manifest to be set, NULL to stop tracking.
+ */
+void flashrom_manifest_set(struct flashrom_flashctx *flashctx, struct flashrom_manifest *manifest);
+
+/** @} */ /* end flashrom-manifest */
+
+/**
+ * @defgroup flashrom-journal Write journal
+ * @{
+ *
+ * A journal records the progress of @ref flashrom_image_write, so that an
+ * interrupted write can be continued instead of started over. Before the chip
+ * is touched, it stores the identity of the chip, a SHA-256 digest of the new
+ * image and which smallest erase blocks of the layout differ from it. Then
+ * every block is recorded as it gets erased and once it is completely written.
+ *
+ * With FLASHROM_FLAG_RESUME_JOURNAL set and a journal of the same chip and
+ * image, @ref flashrom_image_write takes the blocks that were written, or
+ * never had to be, from the new image and only reads the blocks that were in
+ * flight. A journal for anything else is ignored and the layout read in full.
+ *
+ * The journal is kept in memory, the caller stores it through a callback.
+ * Records are only ever appended, a lost record merely makes a block look
+ * in flight, so the callback doesn't need to sync appended records.
+ */
+
+struct flashrom_journal;
+/**
+ * @brief Callback to store the text representation of a journal.
+ *
+ * @param text      NUL-terminated text, one or more complete lines.
+ * @param append    If false, text replaces everything stored before and should
+ *                  be stored atomically. If true, text is appended to it.
+ * @param user_data Pointer passed to @ref flashrom_journal_set_callback.
+ * @return 0 on success. A write doesn't start if storing the initial journal
+ *         fails, failures to append are only reported.
+ */
+typedef int(flashrom_journal_callback)(const char *text, bool append, void *user_data);
+/**
+ * @brief Create a new, empty journal.
+ *
+ * @param[out] journal Points to a struct flashrom_journal
+ *                     that has to be freed with @ref flashrom_journal_release.
+ * @return 0 on success,
+ *         1 if out of memory.
+ */
+int flashrom_journal_new(struct flashrom_journal **journal);
+/**
+ * @brief Parse a journal stored through its callback.
+ *
+ * An incomplete last line, as left by an interrupted append, is ignored.
+ *
+ * @param[out] journal Points to a struct flashrom_journal
+ *                     that has to be freed with @ref flashrom_journal_release.
+ * @param buffer Buffer with the text representation of the journal.
+ * @param len Length of the buffer.
+ * @return 0 on success,
+ *         2 if the buffer is not a valid journal,
+ *         1 if out of memory.
+ */
+int flashrom_journal_read_from_buffer(struct flashrom_journal **journal, const char *buffer, size_t len);
+/**
+ * @brief Set the callback that stores a journal.
+ *
+ * @param journal   Journal to store.
+ * @param callback  Callback to store it with, NULL to keep it in memory only.
+ * @param user_data Pointer passed to the callback.
+ */
+void flashrom_journal_set_callback(struct flashrom_journal *journal, flashrom_journal_callback *callback,
+				   void *user_data);
+/**
+ * @brief Check whether the write recorded in a journal finished.
+ *
+ * @param journal Journal to check.
+ * @return true if the write completed and was verified (if enabled),
+ *         false if it was interrupted or the journal is empty.
+ */
+bool flashrom_journal_complete(const struct flashrom_journal *journal);
+/**
+ * @brief Free a journal.
+ *
+ * @param journal Journal to free.
+ */
+void flashrom_journal_release(struct flashrom_journal *journal);
+/**
+ * @brief Set the journal that records the writes of a flash context.
+ *
+ * Note: The caller must not release the journal as long as it is used
+ *       through the given flash context.
+ *
+ * @param flashctx Flash context whose journal will be set.
+ * @param journal  Journal to be set, NULL to stop journaling.
+ */
+void flashrom_journal_set(struct flashrom_flashctx *flashctx, struct flashrom_journal *journal);
+
+/** @} */ /* end flashrom-journal */
+
+/**
+ * @defgroup flashrom-stats Bus traffic statistics
+ * @{
+ *
+ * When enabled for a flash context, flashrom counts the SPI transactions, the
+ * bytes moved, the WIP polls and the delays of every operation on it, split by
+ * the stage of the operation, and keeps a latency histogram per SPI opcode.
+ * Transactions a master sends as one multicommand are timed together and the
+ * latency is accounted to the opcode of the last command in the batch.
+ */
+
+enum flashrom_stats_stage {
+	FLASHROM_STATS_OTHER,	/**< Anything outside of the stages below. */
+	FLASHROM_STATS_PROBE,
+	FLASHROM_STATS_READ,
+	FLASHROM_STATS_ERASE,
+	FLASHROM_STATS_WRITE,
+	FLASHROM_STATS_VERIFY,
+	FLASHROM_STATS_NR,
+};
+
+/** Bucket 0 counts latencies below 1us, bucket n those from 2^(n-1)us up to 2^n us. The last one is open. */
+#define FLASHROM_STATS_LATENCY_BUCKETS 24
+
+struct flashrom_stage_stats {
+	uint64_t time_ns;	/**< Wall time spent in the stage. */
+	uint64_t transactions;	/**< SPI commands sent, including those of multicommands. */
+	uint64_t bytes_out;	/**< Bytes written to the bus, opcodes and addresses included. */
+	uint64_t bytes_in;	/**< Bytes read from the bus. */
+	uint64_t bus_ns;	/**< Time spent in the master's command functions. */
+	uint64_t wip_polls;	/**< Status register reads waiting for WIP to clear. */
+	uint64_t delays;	/**< Calls to the programmer's delay function. */
+	uint64_t delay_ns;	/**< Time spent in them. */
+};
+
+struct flashrom_opcode_stats {
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t max_ns;
+	uint64_t latency[FLASHROM_STATS_LATENCY_BUCKETS];
+	uint64_t busy_count;	/**< Times WIP was polled until the chip finished this opcode. */
+	uint64_t busy_total_ns;	/**< Time the chip stayed busy after it, sleeps included. */
+	uint64_t busy_max_ns;
+};
+
+struct flashrom_stats {
+	struct flashrom_stage_stats stage[FLASHROM_STATS_NR];
+	struct flashrom_opcode_stats opcode[256];
+};
+
+/**
+ * @brief Start or stop collecting statistics for a flash context.
+ *
+ * Enabling clears the statistics collected so far.
+ *
+ * @param flashctx Flash context to collect statistics for.
+ * @param enable   Whether to collect them.
+ * @return 0 on success,
+ *         1 if out of memory.
+ */
+int flashrom_stats_enable(struct flashrom_flashctx *flashctx, bool enable);
+/**
+ * @brief Get the statistics collected for a flash context.
+ *
+ * @param flashctx Flash context to query.
+ * @param[out] stats Filled with the statistics collected since they were enabled.
+ * @return 0 on success,
+ *         1 if statistics are not enabled for the flash context.
+ */
+int flashrom_stats_get(const struct flashrom_flashctx *flashctx, struct flashrom_stats *stats);
+/**
+ * @brief Get a short lower case name for a stage, e.g. "write".
+ *
+ * @param stage Stage to name.
+ * @return Static string, "unknown" for invalid stages.
+ */
+const char *flashrom_stats_stage_name(enum flashrom_stats_stage stage);
+
+/** @} */ /* end flashrom-stats */
+
+/**
+ * @defgroup flashrom-trace Bus traces
+ * @{
+ *
+ * A trace records every SPI command of a flash context with its data, return
+ * value and timing, the bulk transfers of masters that don't use commands
+ * for them, the operations of opaque masters and the delays in between. The
+ * `replay` programmer answers the commands of a trace to rerun a session
+ * without hardware, `flashrom_trace` summarizes and compares traces.
+ */
+
+/**
+ * @brief Start recording a bus trace of a flash context.
+ *
+ * A trace already being recorded is finished first.
+ *
+ * @param flashctx Flash context to trace.
+ * @param path     File to write the trace to, an existing one is replaced.
+ * @return 0 on success,
+ *         1 if the file couldn't be created or finishing the previous trace failed.
+ */
+int flashrom_trace_start(struct flashrom_flashctx *flashctx, const char *path);
+/**
+ * @brief Finish the bus trace of a flash context.
+ *
+ * Also done by flashrom_flash_release().
+ *
+ * @param flashctx Flash context whose trace to finish.
+ * @return 0 on success or if no trace was recorded,
+ *         1 if writing the trace failed.
+ */
+int flashrom_trace_stop(struct flashrom_flashctx *flashctx);
+
+/** @} */ /* end flashrom-trace */
+
 /**
  * @defgroup flashrom-wp Write Protect
  * @{
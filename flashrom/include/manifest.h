@@ -0,0 +1,29 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef __MANIFEST_H__
+#define __MANIFEST_H__ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "flash.h"
+#include "layout.h"
+
+/* Read back at least this many trusted blocks, and one in every MANIFEST_SAMPLE_RATIO. */
+#define MANIFEST_MIN_SAMPLES	4
+#define MANIFEST_SAMPLE_RATIO	32
+
+bool manifest_matches_chip(const struct flashrom_manifest *manifest, const struct flashchip *chip);
+size_t manifest_block_size(const struct flashrom_manifest *manifest);
+bool manifest_block_matches(const struct flashrom_manifest *manifest, size_t block, const uint8_t *contents);
+void manifest_update(struct flashrom_manifest *manifest, const struct flashchip *chip,
+		     const struct flashrom_layout *layout, const uint8_t *contents);
+void manifest_invalidate(struct flashrom_manifest *manifest, const struct flashchip *chip,
+			 const struct flashrom_layout *layout);
+
+#endif /* !__MANIFEST_H__ */
@@ -0,0 +1,48 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef __MEMDIFF_H__
+#define __MEMDIFF_H__ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Buffers are compared in lanes of 64 bytes. For every lane two masks are
+ * produced in one pass, bit i of each mask describing byte i of the lane:
+ * "differs" is set where have and want differ, "erased" is set where have
+ * holds the erased value. Bits past the end of a partial last lane are clear.
+ */
+#define MEMDIFF_LANE_SIZE	64
+
+enum memdiff_impl {
+	MEMDIFF_IMPL_SCALAR,
+	MEMDIFF_IMPL_SSE2,
+	MEMDIFF_IMPL_AVX2,
+	MEMDIFF_IMPL_AVX512,
+	MEMDIFF_IMPL_NR,
+};
+
+/* Kernel selection, the best supported one is picked on first use. */
+bool memdiff_impl_supported(enum memdiff_impl impl);
+int memdiff_set_impl(enum memdiff_impl impl);
+enum memdiff_impl memdiff_get_impl(void);
+const char *memdiff_impl_name(enum memdiff_impl impl);
+
+void memdiff_masks(const uint8_t *have, const uint8_t *want, size_t len, uint8_t erased_value,
+		   uint64_t *differs, uint64_t *erased);
+
+/* Helpers built on top of the masks. */
+size_t memdiff_find(const uint8_t *have, const uint8_t *want, size_t len, bool equal);
+size_t memdiff_count(const uint8_t *have, const uint8_t *want, size_t len, size_t *first);
+size_t memdiff_count_unerased(const uint8_t *have, size_t len, uint8_t erased_value, size_t *first);
+bool memdiff_summary(const uint8_t *have, const uint8_t *want, size_t len, uint8_t erased_value,
+		     bool *all_erased);
+bool memdiff_unerased_diff(const uint8_t *have, const uint8_t *want, size_t len, uint8_t erased_value);
+bool memdiff_sets_bits(const uint8_t *have, const uint8_t *want, size_t len);
+
+#endif /* !__MEMDIFF_H__ */
@@ -25,6 +25,12 @@ struct pci_dev *pcidev_getdevfn(struct pci_dev *dev, const int func);
 struct pci_dev *pcidev_find_vendorclass(uint16_t vendor, uint16_t devclass);
 struct pci_dev *pcidev_card_find(uint16_t vendor, uint16_t device, uint16_t card_vendor, uint16_t card_device);
 struct pci_dev *pcidev_find(uint16_t vendor, uint16_t device);
+/*
+ * The lookups above use an index of the devices of `acc` while it is `pacc`.
+ * pci_init_common() builds it and the PCI shutdown releases it.
+ */
+void pcidev_index_build(struct pci_access *acc);
+void pcidev_index_release(void);
 
 /* rpci_write_* are reversible writes. The original PCI config space register
  * contents will be restored on shutdown.
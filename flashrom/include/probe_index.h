@@ -0,0 +1,30 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef __PROBE_INDEX_H__
+#define __PROBE_INDEX_H__ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "flash.h"
+
+/*
+ * Chips identified by a plain ID command (RDID, RDID4, REMS, RES2) are looked
+ * up by the IDs the bus returns, so each of these commands is sent at most
+ * once per bus and only the matching entries of flashchips[] are probed.
+ * All other chips are still probed one by one.
+ */
+int probe_index_collect(struct flashctx *flash, struct registered_master *mst,
+			int startchip, size_t **chips, size_t *count);
+/* The index is built on first use and kept until the programmer is shut down. */
+void probe_index_release(struct flashrom_programmer *prog);
+
+/* Probing falls back to walking all of flashchips[] while disabled. */
+void probe_index_enable(bool enable);
+bool probe_index_enabled(void);
+
+#endif /* !__PROBE_INDEX_H__ */
@@ -86,6 +86,7 @@ extern const struct programmer_entry programmer_pony_spi;
 extern const struct programmer_entry programmer_raiden_debug_spi;
 extern const struct programmer_entry programmer_rayer_spi;
 extern const struct programmer_entry programmer_realtek_mst_i2c_spi;
+extern const struct programmer_entry programmer_replay;
 extern const struct programmer_entry programmer_satamv;
 extern const struct programmer_entry programmer_satasii;
 extern const struct programmer_entry programmer_serprog;
@@ -250,10 +251,6 @@ struct decode_sizes {
 	uint32_t fwh;
 	uint32_t spi;
 };
-// FIXME: These need to be local, not global
-extern struct decode_sizes max_rom_decode;
-extern bool programmer_may_write;
-extern uintptr_t flashbase; /* used in programmer_enable.c */
 char *extract_programmer_param_str(const struct programmer_cfg *cfg, const char *param_name);
 
 /* spi.c */
@@ -264,6 +261,12 @@ char *extract_programmer_param_str(const struct programmer_cfg *cfg, const char
 #define SPI_MASTER_4BA			(1U << 0)  /**< Can handle 4-byte addresses */
 #define SPI_MASTER_NO_4BA_MODES		(1U << 1)  /**< Compatibility modes (i.e. extended address
 						        register, 4BA mode switch) don't work */
+#define SPI_MASTER_DUAL_OUT		(1U << 2)  /**< Can receive data on two lines (1-1-2) */
+#define SPI_MASTER_DUAL_IO		(1U << 3)  /**< Can send the address on two lines, too (1-2-2) */
+#define SPI_MASTER_QUAD_OUT		(1U << 4)  /**< Can receive data on four lines (1-1-4) */
+#define SPI_MASTER_QUAD_IO		(1U << 5)  /**< Can send the address on four lines, too (1-4-4) */
+#define SPI_MASTER_DUMMY_CYCLES		(1U << 6)  /**< Can clock dummy cycles that don't add up to
+							whole bytes, see struct spi_command */
 
 struct spi_master {
 	uint32_t features;
@@ -427,11 +430,79 @@ struct registered_master {
 		struct spi_master spi;
 		struct opaque_master opaque;
 	};
+	struct flashrom_programmer *programmer;	/* Set by register_master(). */
 };
-extern struct registered_master registered_masters[];
-extern int registered_master_count;
 int register_master(const struct registered_master *mst);
 
+/* The limit of 4 is totally arbitrary. */
+#define MASTERS_MAX 4
+#define SHUTDOWN_MAXFN 32
+
+struct probe_index;
+
+/* Answers to the SPI ID commands, one per enum id_type in spi25.c. */
+#define SPI_ID_CACHE_ENTRIES 5
+struct spi_id_cache_entry {
+	bool is_cached;
+	unsigned char bytes[4];		/* enough to hold largest ID type */
+};
+
+/*
+ * Everything an initialized programmer keeps, so that several programmers
+ * can be used at once, each from its own thread.
+ */
+struct flashrom_programmer {
+	const struct programmer_entry *entry;
+
+	struct registered_master masters[MASTERS_MAX];
+	int master_count;
+
+	/*
+	 * Programmers supporting multiple buses can have differing size limits on
+	 * each bus. Store the limits for each bus in a common struct.
+	 */
+	struct decode_sizes rom_decode;
+	/* If nonzero, used as the start address of bottom-aligned flash. */
+	uintptr_t flash_base;
+	/* Is writing allowed with this programmer? */
+	bool may_write;
+
+	struct shutdown_func_data {
+		int (*func) (void *data);
+		void *data;
+	} shutdown_fn[SHUTDOWN_MAXFN];
+	int shutdown_fn_count;
+	/* Only true between programmer init and shutdown. */
+	bool may_register_shutdown;
+
+	struct spi_id_cache_entry spi_id_cache[SPI_ID_CACHE_ENTRIES];	/* spi25.c */
+	struct probe_index *probe_index;	/* probe_index.c */
+};
+
+/*
+ * The programmer the calling thread works with: the one it initialized last
+ * through flashrom_programmer_init() or, without one, a default instance
+ * shared by all threads that is used by programmer_init().
+ */
+struct flashrom_programmer *programmer_current(void);
+void programmer_set_current(struct flashrom_programmer *prog);
+struct flashrom_programmer *programmer_new(void);
+/* Frees a programmer from programmer_new(), the default instance is kept. */
+void programmer_free(struct flashrom_programmer *prog);
+/* The programmer a master or flash chip belongs to. */
+struct flashrom_programmer *programmer_of_master(const struct registered_master *mst);
+struct flashrom_programmer *programmer_of(const struct flashctx *flash);
+
+/*
+ * Programmer drivers set these while they are initialized, and the masters
+ * they register end up in the same programmer.
+ */
+#define registered_masters	(programmer_current()->masters)
+#define registered_master_count	(programmer_current()->master_count)
+#define max_rom_decode		(programmer_current()->rom_decode)
+#define programmer_may_write	(programmer_current()->may_write)
+#define flashbase		(programmer_current()->flash_base)
+
 /* spi_master feature checks */
 static inline bool spi_master_4ba(const struct flashctx *const flash)
 {
@@ -0,0 +1,135 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*
+ * Protocol of `flashrom --serve`. Requests and replies are single packets on
+ * a SOCK_SEQPACKET unix socket, so every packet is one frame. Images travel as
+ * memfd file descriptors attached to the frame (SCM_RIGHTS) and are mapped by
+ * the receiver, only their size is part of the frame.
+ */
+
+#ifndef __SERVE_H__
+#define __SERVE_H__ 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define SERVE_MAGIC		0x76727366	/* "fsrv" */
+#define SERVE_VERSION		1
+#define SERVE_REGIONS_LEN	512
+#define SERVE_NAME_LEN		64
+
+enum serve_op {
+	SERVE_OP_INFO = 1,	/* Chip name and size. */
+	SERVE_OP_LAYOUT,	/* Sets the layout of the connection. */
+	SERVE_OP_READ,		/* Replies with an image fd. */
+	SERVE_OP_WRITE,		/* Takes an image fd. */
+	SERVE_OP_VERIFY,	/* Takes an image fd. */
+	SERVE_OP_WP_READ,	/* Replies with the WP mode and range. */
+	SERVE_OP_WP_WRITE,	/* Changes the WP mode and/or range. */
+	SERVE_OP_SHUTDOWN,	/* Stops the server after replying. */
+};
+
+enum serve_layout_source {
+	SERVE_LAYOUT_DEFAULT,	/* The layout the server was started with, if any. */
+	SERVE_LAYOUT_FILE,	/* Layout file in the -l format, passed as fd. */
+	SERVE_LAYOUT_IFD,	/* Intel flash descriptor read from the chip. */
+	SERVE_LAYOUT_FMAP,	/* FMAP read from the chip. */
+};
+
+/* Request flags. */
+#define SERVE_NOVERIFY		(1 << 0)	/* Don't verify after writing. */
+#define SERVE_NOVERIFY_ALL	(1 << 1)	/* Only verify the included regions. */
+#define SERVE_WP_SET_MODE	(1 << 2)	/* Apply wp_mode. */
+#define SERVE_WP_SET_RANGE	(1 << 3)	/* Apply wp_start and wp_len. */
+#define SERVE_WP_SET_REGION	(1 << 4)	/* Protect the range of the region in `regions`. */
+
+struct serve_request {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t op;		/* enum serve_op */
+	uint32_t flags;
+	uint32_t layout_source;	/* enum serve_layout_source, for SERVE_OP_LAYOUT */
+	uint32_t wp_mode;	/* enum flashrom_wp_mode */
+	uint64_t wp_start;
+	uint64_t wp_len;
+	uint64_t image_size;	/* Size of the attached fd. */
+	/* Comma separated regions to include (or the WP region), NUL terminated. */
+	char regions[SERVE_REGIONS_LEN];
+};
+
+struct serve_reply {
+	uint32_t magic;
+	uint32_t version;
+	int32_t ret;		/* Return value of the operation, 0 on success. */
+	uint32_t wp_mode;
+	uint64_t wp_start;
+	uint64_t wp_len;
+	uint64_t chip_size;
+	uint64_t image_size;	/* Size of the attached fd. */
+	char chip_vendor[SERVE_NAME_LEN];
+	char chip_name[SERVE_NAME_LEN];
+};
+
+/**
+ * @brief Sends one frame, optionally with a file descriptor.
+ *
+ * @param sock Connected SOCK_SEQPACKET socket.
+ * @param msg  Frame to send.
+ * @param len  Length of the frame.
+ * @param fd   File descriptor to pass along, -1 for none.
+ * @return 0 on success, -1 with errno set otherwise.
+ */
+int serve_send(int sock, const void *msg, size_t len, int fd);
+
+/**
+ * @brief Receives one frame of exactly len bytes.
+ *
+ * @param sock Connected SOCK_SEQPACKET socket.
+ * @param msg  Buffer for the frame.
+ * @param len  Expected length of the frame.
+ * @param fd   Receives the passed file descriptor, -1 if there was none.
+ * @return 0 on success, 1 if the peer closed the connection,
+ *	   -1 with errno set otherwise. A signal makes it fail with EINTR,
+ *	   it is up to the caller to retry.
+ */
+int serve_recv(int sock, void *msg, size_t len, int *fd);
+
+/**
+ * @brief Creates a shared memory file of the given size.
+ *
+ * @param name Name of the memfd, for debugging.
+ * @param size Size of the file.
+ * @return The file descriptor, -1 with errno set on failure.
+ */
+int serve_memfd(const char *name, size_t size);
+
+struct flashrom_flashctx;
+struct flashrom_layout;
+
+/**
+ * @brief Serves the requests of one connection until the peer closes it.
+ *
+ * @param flashctx Probed flash context.
+ * @param conn     Connected SOCK_SEQPACKET socket.
+ * @param layout   Layout to use for SERVE_LAYOUT_DEFAULT, may be NULL.
+ * @return 1 if the client asked the server to shut down, 0 otherwise.
+ */
+int serve_connection(struct flashrom_flashctx *flashctx, int conn, struct flashrom_layout *layout);
+
+/**
+ * @brief Serves requests on a unix socket until SERVE_OP_SHUTDOWN or a signal.
+ *
+ * @param flashctx Probed flash context, its flags apply to all requests
+ *                 except for the verification ones a write request sets.
+ * @param path     Path of the socket to create.
+ * @param layout   Layout to use for SERVE_LAYOUT_DEFAULT, may be NULL.
+ * @return 0 on success.
+ */
+int serve(struct flashrom_flashctx *flashctx, const char *path, struct flashrom_layout *layout);
+
+#endif /* !__SERVE_H__ */
@@ -198,6 +198,18 @@
 /* Read the memory (with delay after sending address) */
 #define JEDEC_READ_FAST		0x0b
 
+/* Fast read with data on two or four lines, one dummy byte after the address */
+#define JEDEC_READ_FAST_DOUT	0x3b
+#define JEDEC_READ_FAST_QOUT	0x6b
+#define JEDEC_READ_FAST_OUTSIZE	0x05
+
+/* Fast read with address, mode bits and data on two or four lines */
+#define JEDEC_READ_FAST_DIO	0xbb
+#define JEDEC_READ_FAST_QIO	0xeb
+
+/* Longest read command: opcode, 4-byte address and up to 8 bytes of mode bits and dummies */
+#define JEDEC_READ_MAX_OUTSIZE	(1 + JEDEC_MAX_ADDR_LEN + 8)
+
 /* Write memory byte */
 #define JEDEC_BYTE_PROGRAM		0x02
 #define JEDEC_BYTE_PROGRAM_OUTSIZE	0x05
@@ -234,12 +246,32 @@ struct spi_command {
 	unsigned int readcnt;
 	const unsigned char *writearr;
 	unsigned char *readarr;
+	/*
+	 * Only for masters that announce the respective SPI_MASTER_* feature:
+	 * writearr[0] is sent on one line, the rest of writearr on the address
+	 * lines of io_mode, followed by dummy_cycles clocks and the data.
+	 */
+	enum spi_io_mode io_mode;
+	unsigned int dummy_cycles;
 };
-#define NULL_SPI_CMD { 0, 0, NULL, NULL, }
+
+#define NULL_SPI_CMD { 0, 0, NULL, NULL, SPI_IO_1_1_1, 0, }
+
+/* Lines used for the address and for the data of a command in `io_mode`. */
+static inline unsigned int spi_io_addr_lines(enum spi_io_mode io_mode)
+{
+	return io_mode == SPI_IO_1_4_4 ? 4 : io_mode == SPI_IO_1_2_2 ? 2 : 1;
+}
+
+static inline unsigned int spi_io_data_lines(enum spi_io_mode io_mode)
+{
+	return io_mode >= SPI_IO_1_1_4 ? 4 : io_mode >= SPI_IO_1_1_2 ? 2 : 1;
+}
+
 int spi_send_command(const struct flashctx *flash, unsigned int writecnt, unsigned int readcnt, const unsigned char *writearr, unsigned char *readarr);
 int spi_send_multicommand(const struct flashctx *flash, struct spi_command *cmds);
 
-void clear_spi_id_cache(void);
+void clear_spi_id_cache(struct flashrom_programmer *prog);
 
 int spi_aai_write(struct flashctx *flash, const uint8_t *buf, unsigned int start, unsigned int len);
 int spi_chip_write_256(struct flashctx *flash, const uint8_t *buf, unsigned int start, unsigned int len);
@@ -0,0 +1,55 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "flash.h"
+#include "libflashrom.h"
+#include "spi.h"
+
+struct stats_collector {
+	struct flashrom_stats stats;
+	enum flashrom_stats_stage stage;
+	uint64_t stage_start_ns;
+	/* Transactions of all stages, to spot transfers that were counted already. */
+	uint64_t transactions;
+};
+
+static inline bool stats_enabled(const struct flashctx *flash)
+{
+	return flash && flash->stats;
+}
+
+uint64_t stats_time_ns(void);
+
+/* Returns the current time if statistics are collected for flash, 0 otherwise. */
+uint64_t stats_start(const struct flashctx *flash);
+
+/* Sets the stage following bus traffic is accounted to and returns the previous one. */
+enum flashrom_stats_stage stats_set_stage(const struct flashctx *flash, enum flashrom_stats_stage stage);
+
+/* The count functions take the stats_start() value from before the operation. */
+void stats_count_command(const struct flashctx *flash, unsigned int writecnt, unsigned int readcnt,
+			 const unsigned char *writearr, uint64_t start_ns);
+void stats_count_multicommand(const struct flashctx *flash, const struct spi_command *cmds, uint64_t start_ns);
+void stats_count_delay(const struct flashctx *flash, uint64_t start_ns);
+void stats_count_wip_poll(const struct flashctx *flash);
+/* Returns the number of transactions counted so far, pass it to stats_count_transfer(). */
+uint64_t stats_transactions(const struct flashctx *flash);
+/*
+ * Counts a read or write of a master that may bypass the command functions.
+ * It is only counted if no transactions were counted since `transactions`.
+ */
+void stats_count_transfer(const struct flashctx *flash, unsigned int bytes_out, unsigned int bytes_in,
+			  uint64_t transactions, uint64_t start_ns);
+/* Counts the time the chip stayed busy after `opcode`, since `start_ns`. */
+void stats_count_busy(const struct flashctx *flash, uint8_t opcode, uint64_t start_ns);
+
+#endif /* !__STATS_H__ */
@@ -0,0 +1,167 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*
+ * Bus traces of flashrom sessions. A trace starts with a 5 byte header, the
+ * magic "FRTR" and a version byte, followed by records. Every record starts
+ * with its type byte, the time since the start of the previous record and its
+ * duration in ns. All integers are LEB128 varints, signed ones zigzag encoded,
+ * so a status register poll takes about 10 bytes.
+ *
+ * The file functions don't depend on the rest of flashrom and can be used by
+ * tools. They return -1 with errno set on failure.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_MAGIC	"FRTR"
+#define TRACE_VERSION	1
+
+enum trace_type {
+	TRACE_MASTER = 1,	/* The following records go through another master. */
+	TRACE_SPI,		/* One SPI command. */
+	TRACE_SPI_READ,		/* Read by a master's own read function, without SPI commands. */
+	TRACE_SPI_WRITE,	/* Write by a master's own write function, without SPI commands. */
+	TRACE_OPAQUE_READ,
+	TRACE_OPAQUE_WRITE,
+	TRACE_OPAQUE_ERASE,
+	TRACE_DELAY,		/* programmer_delay() */
+};
+
+/* TRACE_SPI flags. */
+#define TRACE_SPI_BATCHED	(1 << 0)	/* More commands of the same multicommand follow. */
+
+struct trace_record {
+	enum trace_type type;
+	uint64_t start_ns;	/* Since the start of the trace. */
+	uint64_t duration_ns;	/* Of a whole multicommand on its last command. */
+	int ret;		/* Return value of the operation. */
+
+	/* TRACE_MASTER */
+	uint32_t buses;
+	uint32_t features;	/* SPI master features */
+	uint32_t max_data_read;
+	uint32_t max_data_write;
+
+	/* TRACE_SPI */
+	uint8_t flags;
+	uint8_t io_mode;	/* enum spi_io_mode */
+	uint8_t dummy_cycles;
+	uint32_t writecnt;
+	uint32_t readcnt;
+	const uint8_t *writearr;
+	const uint8_t *readarr;
+
+	/* TRACE_SPI_READ/WRITE, TRACE_OPAQUE_*: the range, readarr holds the data of reads. */
+	uint32_t addr;
+	uint32_t len;
+
+	/* TRACE_DELAY */
+	uint32_t usecs;
+};
+
+struct trace_file;
+
+/**
+ * @brief Creates a trace file and writes its header.
+ *
+ * @param path File to create, an existing one is replaced.
+ * @return The trace, to be finished with trace_close().
+ */
+struct trace_file *trace_create(const char *path);
+
+/**
+ * @brief Appends a record to a trace created with trace_create().
+ *
+ * Records are buffered, errors may only be reported by trace_close().
+ *
+ * @param trace Trace to append to.
+ * @param rec   Record to append, start_ns must not be before the last record's.
+ * @return 0 on success.
+ */
+int trace_append(struct trace_file *trace, const struct trace_record *rec);
+
+/**
+ * @brief Opens a trace for reading and checks its header.
+ *
+ * @param path File to open.
+ * @return The trace, to be released with trace_close().
+ */
+struct trace_file *trace_open(const char *path);
+
+/**
+ * @brief Reads the next record of a trace opened with trace_open().
+ *
+ * @param trace Trace to read.
+ * @param[out] rec The record, its arrays stay valid until the next call.
+ * @return 0 on success, 1 at the end of the trace, -1 if it is corrupt or unreadable.
+ */
+int trace_next(struct trace_file *trace, struct trace_record *rec);
+
+/**
+ * @brief Flushes and closes a trace.
+ *
+ * @param trace Trace to close, may be NULL.
+ * @return 0 on success, -1 if the trace couldn't be written completely.
+ */
+int trace_close(struct trace_file *trace);
+
+struct trace_opcode_summary {
+	uint64_t count;
+	uint64_t bytes;
+	uint64_t time_ns;
+};
+
+struct trace_summary {
+	uint64_t records;
+	uint64_t commands;
+	uint64_t bytes_out;
+	uint64_t bytes_in;
+	uint64_t rdsr_polls;	/* Status reads that follow another one. */
+	uint64_t bulk_bytes;
+	uint64_t opaque_ops;
+	uint64_t delays;
+	uint64_t delay_us;
+	uint64_t errors;
+	uint64_t modelled_ns;	/* Sum of the durations of all operations. */
+	uint64_t end_ns;
+	struct trace_opcode_summary opcode[256];
+};
+
+/**
+ * @brief Sums up the remaining records of a trace opened with trace_open().
+ *
+ * @param trace Trace to read.
+ * @param[out] sum The summary.
+ * @return 0 on success, -1 if the trace is corrupt or unreadable.
+ */
+int trace_summarize(struct trace_file *trace, struct trace_summary *sum);
+
+/*
+ * Capture hooks of the core, called around the master functions. They do
+ * nothing unless tracing was started with flashrom_trace_start().
+ */
+struct flashctx;
+struct spi_command;
+
+/* Returns the current time if flash is traced, 0 otherwise. */
+uint64_t trace_begin(const struct flashctx *flash);
+void trace_command(const struct flashctx *flash, unsigned int writecnt, unsigned int readcnt,
+		   const unsigned char *writearr, const unsigned char *readarr, int ret, uint64_t start_ns);
+void trace_multicommand(const struct flashctx *flash, const struct spi_command *cmds, int ret, uint64_t start_ns);
+/* Records a read, write or erase of a range. Bulk SPI transfers are dropped if they were traced as commands. */
+void trace_range(const struct flashctx *flash, enum trace_type type, unsigned int addr, unsigned int len,
+		 const uint8_t *data, int ret, uint64_t start_ns);
+void trace_delay(const struct flashctx *flash, unsigned int usecs, uint64_t start_ns);
+/* Returns the number of commands traced so far, to tell whether a bulk transfer used any. */
+uint64_t trace_commands(const struct flashctx *flash);
+
+#endif /* !__TRACE_H__ */
@@ -0,0 +1,385 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Write journal, records the progress of a write so that an interrupted one
+ * can be continued, see FLASHROM_FLAG_RESUME_JOURNAL.
+ *
+ * Text format, one item per line:
+ *	flashrom-journal 1
+ *	vendor <chip vendor>
+ *	name <chip name>
+ *	id <manufacture id> <model id>
+ *	size <chip size in bytes>
+ *	block_size <journal block size in bytes>
+ *	image <SHA-256 of the new image in hex>
+ * followed by records, later ones overriding earlier ones:
+ *	<clean|planned|erasing|written> <first block> <last block>
+ *	done
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip_identity.h"
+#include "flash.h"
+#include "journal.h"
+#include "layout.h"
+#include "libflashrom.h"
+#include "sha256.h"
+
+#define JOURNAL_HEADER		"flashrom-journal 1"
+#define JOURNAL_HEADER_LINES	(CHIP_IDENTITY_LINES + 1)
+
+enum journal_block_state {
+	JOURNAL_UNTRACKED = 0,	/* Outside of the layout, or only partially inside. */
+	JOURNAL_CLEAN,		/* Held the new data before the write. */
+	JOURNAL_PLANNED,	/* Differed from the new image, not touched yet. */
+	JOURNAL_ERASING,	/* Being erased, or erased but not completely written. */
+	JOURNAL_WRITTEN,	/* Holds the new data. */
+	JOURNAL_STATES
+};
+
+static const char *const state_names[JOURNAL_STATES] = {
+	[JOURNAL_CLEAN]		= "clean",
+	[JOURNAL_PLANNED]	= "planned",
+	[JOURNAL_ERASING]	= "erasing",
+	[JOURNAL_WRITTEN]	= "written",
+};
+
+struct flashrom_journal {
+	struct chip_identity id;
+	size_t block_count;
+	uint8_t image_digest[SHA256_DIGEST_SIZE];
+	uint8_t *state;
+	bool done;
+	/* A write is being recorded. */
+	bool active;
+	bool append_failed;
+	flashrom_journal_callback *callback;
+	void *user_data;
+};
+
+static void journal_clear(struct flashrom_journal *journal)
+{
+	chip_identity_clear(&journal->id);
+	free(journal->state);
+	journal->state = NULL;
+	journal->block_count = 0;
+	journal->done = false;
+	journal->active = false;
+}
+
+static int journal_alloc_blocks(struct flashrom_journal *journal)
+{
+	journal->block_count = journal->id.chip_size / journal->id.block_size;
+	journal->state = calloc(journal->block_count, sizeof(*journal->state));
+	if (!journal->state) {
+		msg_gerr("Out of memory!\n");
+		journal->block_count = 0;
+		return 1;
+	}
+	return 0;
+}
+
+bool journal_active(const struct flashrom_journal *journal)
+{
+	return journal && journal->active;
+}
+
+/* Whether the journal recorded a write of newcontents (a whole chip buffer) to this chip. */
+bool journal_matches(const struct flashrom_journal *journal, const struct flashchip *chip,
+		     const uint8_t *newcontents)
+{
+	uint8_t digest[SHA256_DIGEST_SIZE];
+
+	if (!journal->block_count || !chip_identity_matches(&journal->id, chip))
+		return false;
+
+	sha256(newcontents, journal->id.chip_size, digest);
+	return !memcmp(digest, journal->image_digest, SHA256_DIGEST_SIZE);
+}
+
+size_t journal_block_size(const struct flashrom_journal *journal)
+{
+	return journal->id.block_size;
+}
+
+/* Whether the block is known to hold the new image, as opposed to being unknown or in flight. */
+bool journal_block_trusted(const struct flashrom_journal *journal, size_t block)
+{
+	return block < journal->block_count &&
+		(journal->state[block] == JOURNAL_CLEAN || journal->state[block] == JOURNAL_WRITTEN);
+}
+
+static int journal_store(struct flashrom_journal *journal, const char *text, bool append)
+{
+	if (!journal->callback)
+		return 0;
+	return journal->callback(text, append, journal->user_data);
+}
+
+static void journal_append(struct flashrom_journal *journal, const char *fmt, ...)
+{
+	char line[64];
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(line, sizeof(line), fmt, args);
+	va_end(args);
+
+	if (journal_store(journal, line, true) && !journal->append_failed) {
+		msg_gwarn("Updating the journal failed, resuming may read more blocks again.\n");
+		journal->append_failed = true;
+	}
+}
+
+/* Sets the state of blocks [first, last] that are in one of the states in `from` and records them. */
+static void journal_set_state(struct flashrom_journal *journal, size_t first, size_t last,
+			      unsigned int from, enum journal_block_state state)
+{
+	for (size_t i = first; i <= last; i++) {
+		if (!(from & (1 << journal->state[i])))
+			continue;
+		size_t run_end = i;
+		while (run_end + 1 <= last && (from & (1 << journal->state[run_end + 1])))
+			run_end++;
+		memset(journal->state + i, state, run_end - i + 1);
+		journal_append(journal, "%s %zu %zu\n", state_names[state], i, run_end);
+		i = run_end;
+	}
+}
+
+static char *journal_to_text(const struct flashrom_journal *journal)
+{
+	size_t capacity = chip_identity_text_size(&journal->id) + 2 * SHA256_DIGEST_SIZE;
+	for (size_t i = 0; i < journal->block_count; i++)
+		capacity += !i || journal->state[i] != journal->state[i - 1] ? 48 : 0;
+
+	char *out = malloc(capacity);
+	if (!out) {
+		msg_gerr("Out of memory!\n");
+		return NULL;
+	}
+
+	size_t len = chip_identity_to_text(&journal->id, JOURNAL_HEADER, out, capacity);
+	len += snprintf(out + len, capacity - len, "image ");
+	for (size_t i = 0; i < SHA256_DIGEST_SIZE; i++)
+		len += snprintf(out + len, capacity - len, "%02x", journal->image_digest[i]);
+	len += snprintf(out + len, capacity - len, "\n");
+
+	for (size_t i = 0; i < journal->block_count; i++) {
+		size_t run_end = i;
+		while (run_end + 1 < journal->block_count && journal->state[run_end + 1] == journal->state[i])
+			run_end++;
+		if (journal->state[i] != JOURNAL_UNTRACKED)
+			len += snprintf(out + len, capacity - len, "%s %zu %zu\n",
+					state_names[journal->state[i]], i, run_end);
+		i = run_end;
+	}
+	if (journal->done)
+		snprintf(out + len, capacity - len, "done\n");
+	return out;
+}
+
+/*
+ * Starts recording a write of newcontents over curcontents, both whole chip
+ * buffers. Blocks fully inside the included regions of the layout are
+ * tracked. The chip must not be touched if this fails.
+ */
+int journal_begin(struct flashrom_journal *journal, const struct flashchip *chip,
+		  const struct flashrom_layout *layout, const uint8_t *curcontents, const uint8_t *newcontents)
+{
+	journal_clear(journal);
+	if (chip_identity_set(&journal->id, chip) || journal_alloc_blocks(journal)) {
+		journal_clear(journal);
+		return 1;
+	}
+	sha256(newcontents, journal->id.chip_size, journal->image_digest);
+
+	const size_t bs = journal->id.block_size;
+	const struct romentry *entry = NULL;
+	while ((entry = layout_next_included(layout, entry))) {
+		for (size_t i = entry->region.start / bs; i <= entry->region.end / bs; i++) {
+			if (i * bs < entry->region.start || (i + 1) * bs - 1 > entry->region.end)
+				continue;
+			journal->state[i] = memcmp(curcontents + i * bs, newcontents + i * bs, bs) ?
+					    JOURNAL_PLANNED : JOURNAL_CLEAN;
+		}
+	}
+
+	char *const text = journal_to_text(journal);
+	const int ret = text ? journal_store(journal, text, false) : 1;
+	free(text);
+	if (ret) {
+		msg_gerr("Storing the journal failed.\n");
+		journal_clear(journal);
+		return 1;
+	}
+	journal->append_failed = false;
+	journal->active = true;
+	return 0;
+}
+
+/*
+ * Records that [start, end] is about to be erased, which puts all tracked
+ * blocks touching it in flight. Must be called before the erase starts, an
+ * interrupted erase can leave any of them half erased.
+ */
+void journal_erasing(struct flashrom_journal *journal, chipoff_t start, chipoff_t end)
+{
+	if (!journal_active(journal))
+		return;
+
+	const unsigned int tracked = 1 << JOURNAL_CLEAN | 1 << JOURNAL_PLANNED |
+				     1 << JOURNAL_ERASING | 1 << JOURNAL_WRITTEN;
+	journal_set_state(journal, start / journal->id.block_size, end / journal->id.block_size,
+			  tracked, JOURNAL_ERASING);
+}
+
+/*
+ * Records that everything in [start, end] was written. Only blocks that are
+ * fully inside are complete, returns the start of the first one that is not.
+ */
+chipoff_t journal_written(struct flashrom_journal *journal, chipoff_t start, chipoff_t end)
+{
+	if (!journal_active(journal))
+		return start;
+
+	const size_t bs = journal->id.block_size;
+	const size_t first = (start + bs - 1) / bs;
+	const size_t next = ((size_t)end + 1) / bs;
+	if (next <= first)
+		return start;
+
+	journal_set_state(journal, first, next - 1, 1 << JOURNAL_PLANNED | 1 << JOURNAL_ERASING,
+			  JOURNAL_WRITTEN);
+	return next * bs;
+}
+
+/* Stops recording, complete if the write (and its verification) succeeded. */
+void journal_end(struct flashrom_journal *journal, bool complete)
+{
+	if (!journal_active(journal))
+		return;
+	if (complete) {
+		journal->done = true;
+		journal_append(journal, "done\n");
+	}
+	journal->active = false;
+}
+
+int flashrom_journal_new(struct flashrom_journal **journal)
+{
+	*journal = calloc(1, sizeof(**journal));
+	if (!*journal) {
+		msg_gerr("Out of memory!\n");
+		return 1;
+	}
+	return 0;
+}
+
+void flashrom_journal_release(struct flashrom_journal *journal)
+{
+	if (!journal)
+		return;
+	journal_clear(journal);
+	free(journal);
+}
+
+void flashrom_journal_set_callback(struct flashrom_journal *journal, flashrom_journal_callback *callback,
+				   void *user_data)
+{
+	journal->callback = callback;
+	journal->user_data = user_data;
+}
+
+bool flashrom_journal_complete(const struct flashrom_journal *journal)
+{
+	return journal->done;
+}
+
+void flashrom_journal_set(struct flashrom_flashctx *flashctx, struct flashrom_journal *journal)
+{
+	flashctx->journal = journal;
+}
+
+static int parse_digest(const char *value, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+	if (strlen(value) != 2 * SHA256_DIGEST_SIZE || strspn(value, "0123456789abcdefABCDEF") != strlen(value))
+		return 2;
+	for (size_t i = 0; i < SHA256_DIGEST_SIZE; i++) {
+		const char byte[3] = { value[2 * i], value[2 * i + 1], '\0' };
+		digest[i] = strtoul(byte, NULL, 16);
+	}
+	return 0;
+}
+
+static int parse_record(struct flashrom_journal *journal, const char *line)
+{
+	unsigned long long first, last;
+	const char *value;
+	char extra;
+
+	if (!strcmp(line, "done")) {
+		journal->done = true;
+		return 0;
+	}
+	for (int state = JOURNAL_CLEAN; state < JOURNAL_STATES; state++) {
+		if (!(value = text_line_value(line, state_names[state])))
+			continue;
+		if (sscanf(value, "%llu %llu%c", &first, &last, &extra) != 2 ||
+		    first > last || last >= journal->block_count)
+			return 2;
+		memset(journal->state + first, state, last - first + 1);
+		return 0;
+	}
+	return 2;
+}
+
+static int parse_line(void *data, unsigned int lineno, const char *line)
+{
+	struct flashrom_journal *const journal = data;
+	const char *value;
+
+	if (lineno < CHIP_IDENTITY_LINES) {
+		const int ret = chip_identity_parse_line(&journal->id, JOURNAL_HEADER, lineno, line);
+		if (ret || lineno != CHIP_IDENTITY_LINES - 1)
+			return ret;
+		return journal->id.chip_size ? journal_alloc_blocks(journal) : 2;
+	}
+	if (lineno == CHIP_IDENTITY_LINES) {
+		if (!(value = text_line_value(line, "image")))
+			return 2;
+		return parse_digest(value, journal->image_digest);
+	}
+	return parse_record(journal, line);
+}
+
+int flashrom_journal_read_from_buffer(struct flashrom_journal **journal, const char *buffer, size_t len)
+{
+	unsigned int lineno;
+
+	/* Drop an incomplete last line, its numbers may be cut short. */
+	while (len && buffer[len - 1] != '\n')
+		len--;
+
+	int ret = flashrom_journal_new(journal);
+	if (ret)
+		return ret;
+
+	ret = text_parse_lines(buffer, len, &lineno, parse_line, *journal);
+	if (!ret && lineno < JOURNAL_HEADER_LINES)
+		ret = 2;
+
+	if (ret) {
+		if (ret == 2)
+			msg_gerr("Invalid journal in line %u.\n", lineno + 1);
+		flashrom_journal_release(*journal);
+		*journal = NULL;
+	}
+	return ret;
+}
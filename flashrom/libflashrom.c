@@ -318,8 +318,11 @@ int flashrom_data_free(void *const p)
 int flashrom_programmer_init(struct flashrom_programmer **const flashprog,
 			     const char *const prog_name, const char *const prog_param)
 {
+	struct flashrom_programmer *const previous = programmer_current();
 	unsigned prog;
+	int ret;
 
+	*flashprog = NULL;
 	for (prog = 0; prog < programmer_table_size; prog++) {
 		if (strcmp(prog_name, programmer_table[prog]->name) == 0)
 			break;
@@ -329,18 +332,54 @@ int flashrom_programmer_init(struct flashrom_programmer **const flashprog,
 		list_programmers_linebreak(0, 80, 0);
 		return 1;
 	}
-	return programmer_init(programmer_table[prog], prog_param);
+
+	*flashprog = programmer_new();
+	if (!*flashprog) {
+		msg_gerr("Out of memory!\n");
+		return 1;
+	}
+	/*
+	 * The driver registers its masters and shutdown functions with the
+	 * current programmer. It stays current for this thread, so that code
+	 * using the programmer without a flash context finds it.
+	 */
+	programmer_set_current(*flashprog);
+	ret = programmer_init(programmer_table[prog], prog_param);
+	if (ret) {
+		/* Undo what the driver registered before it failed. */
+		programmer_shutdown();
+		programmer_free(*flashprog);
+		*flashprog = NULL;
+		programmer_set_current(previous);
+	}
+	return ret;
 }
 
 int flashrom_programmer_shutdown(struct flashrom_programmer *const flashprog)
 {
-	return programmer_shutdown();
+	/* Without a programmer, shut down the one last initialized by this thread. */
+	struct flashrom_programmer *const prog = flashprog ? flashprog : programmer_current();
+	struct flashrom_programmer *const previous = programmer_current();
+
+	/* Shutdown functions run in the context of their programmer. */
+	programmer_set_current(prog);
+	const int ret = programmer_shutdown();
+	programmer_set_current(previous == prog ? NULL : previous);
+	programmer_free(prog);
+	return ret;
+}
+
+/* Probing without a programmer uses the one current for this thread. */
+static struct flashrom_programmer *probed_programmer(const struct flashrom_programmer *const flashprog)
+{
+	return flashprog ? (struct flashrom_programmer *)flashprog : programmer_current();
 }
 
 int flashrom_flash_probe(struct flashrom_flashctx **const flashctx,
 			 const struct flashrom_programmer *const flashprog,
 			 const char *const chip_name)
 {
+	struct flashrom_programmer *const prog = probed_programmer(flashprog);
 	int i, ret = 2;
 	struct flashrom_flashctx second_flashctx = { 0, };
 
@@ -349,9 +388,9 @@ int flashrom_flash_probe(struct flashrom_flashctx **const flashctx,
 		return 1;
 	memset(*flashctx, 0, sizeof(**flashctx));
 
-	for (i = 0; i < registered_master_count; ++i) {
+	for (i = 0; i < prog->master_count; ++i) {
 		int flash_idx = ERROR_FLASHROM_PROBE_NO_CHIPS_FOUND;
-		if (!ret || (flash_idx = probe_flash(&registered_masters[i], 0, *flashctx, 0, chip_name))
+		if (!ret || (flash_idx = probe_flash(&prog->masters[i], 0, *flashctx, 0, chip_name))
 				!= ERROR_FLASHROM_PROBE_NO_CHIPS_FOUND) {
 			if (flash_idx == ERROR_FLASHROM_PROBE_INTERNAL_ERROR) {
 				ret = 1;
@@ -360,7 +399,7 @@ int flashrom_flash_probe(struct flashrom_flashctx **const flashctx,
 			ret = 0;
 			/* We found one chip, now check that there is no second match. */
 			int second_flash_idx =
-				probe_flash(&registered_masters[i], flash_idx + 1, &second_flashctx, 0, chip_name);
+				probe_flash(&prog->masters[i], flash_idx + 1, &second_flashctx, 0, chip_name);
 			if (second_flash_idx == ERROR_FLASHROM_PROBE_INTERNAL_ERROR) {
 				ret = 1;
 				break;
@@ -385,16 +424,20 @@ int flashrom_flash_probe_v2(struct flashrom_flashctx *flashctx,
 				const struct flashrom_programmer *flashprog,
 				const char *chip_name)
 {
+	struct flashrom_programmer *const prog = probed_programmer(flashprog);
 	int startchip = 0;
 	unsigned int all_matched_count = 0; // start with no match found
 	const char **matched_names = calloc(flashchips_size + 1, sizeof(char*));
 
-	for (int i = 0; i < registered_master_count; i++) {
+	for (int i = 0; i < prog->master_count; i++) {
 		startchip = 0;
 		while (all_matched_count < flashchips_size) {
 			struct flashrom_flashctx second_flashctx = { 0, }; // used for second and more matches
+			/* The bus traffic of further probes is accounted to the context probed for. */
+			second_flashctx.stats = flashctx->stats;
+			second_flashctx.trace = flashctx->trace;
 			struct flashctx *context_for_probing = (all_matched_count > 0) ? &second_flashctx : flashctx;
-			startchip = probe_flash(&registered_masters[i], startchip, context_for_probing, 0, chip_name);
+			startchip = probe_flash(&prog->masters[i], startchip, context_for_probing, 0, chip_name);
 
 			if (startchip < 0)
 				break;
@@ -432,6 +475,8 @@ void flashrom_flash_release(struct flashrom_flashctx *const flashctx)
 		return;
 
 	flashrom_layout_release(flashctx->default_layout);
+	flashrom_trace_stop(flashctx);
+	free(flashctx->stats);
 	free(flashctx->chip);
 	free(flashctx);
 }
@@ -446,6 +491,9 @@ void flashrom_flag_set(struct flashrom_flashctx *const flashctx,
 		case FLASHROM_FLAG_VERIFY_WHOLE_CHIP:		flashctx->flags.verify_whole_chip = value; break;
 		case FLASHROM_FLAG_SKIP_UNREADABLE_REGIONS:	flashctx->flags.skip_unreadable_regions = value; break;
 		case FLASHROM_FLAG_SKIP_UNWRITABLE_REGIONS:	flashctx->flags.skip_unwritable_regions = value; break;
+		case FLASHROM_FLAG_COST_ERASE_PLANNER:		flashctx->flags.cost_erase_planner = value; break;
+		case FLASHROM_FLAG_TRUST_MANIFEST:		flashctx->flags.trust_manifest = value; break;
+		case FLASHROM_FLAG_RESUME_JOURNAL:		flashctx->flags.resume_journal = value; break;
 	}
 }
 
@@ -458,6 +506,9 @@ bool flashrom_flag_get(const struct flashrom_flashctx *const flashctx, const enu
 		case FLASHROM_FLAG_VERIFY_WHOLE_CHIP:		return flashctx->flags.verify_whole_chip;
 		case FLASHROM_FLAG_SKIP_UNREADABLE_REGIONS:	return flashctx->flags.skip_unreadable_regions;
 		case FLASHROM_FLAG_SKIP_UNWRITABLE_REGIONS:	return flashctx->flags.skip_unwritable_regions;
+		case FLASHROM_FLAG_COST_ERASE_PLANNER:		return flashctx->flags.cost_erase_planner;
+		case FLASHROM_FLAG_TRUST_MANIFEST:		return flashctx->flags.trust_manifest;
+		case FLASHROM_FLAG_RESUME_JOURNAL:		return flashctx->flags.resume_journal;
 		default:					return false;
 	}
 }
@@ -0,0 +1,248 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Per-block digest manifest of the flash contents. It lets a write skip
+ * reading blocks that are known to already hold the new data, see
+ * FLASHROM_FLAG_TRUST_MANIFEST.
+ *
+ * Text format, one item per line:
+ *	flashrom-manifest 1
+ *	vendor <chip vendor>
+ *	name <chip name>
+ *	id <manufacture id> <model id>
+ *	size <chip size in bytes>
+ *	block_size <digest block size in bytes>
+ *	block <index> <SHA-256 of the block in hex>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip_identity.h"
+#include "flash.h"
+#include "layout.h"
+#include "libflashrom.h"
+#include "manifest.h"
+#include "sha256.h"
+
+#define MANIFEST_HEADER		"flashrom-manifest 1"
+
+struct flashrom_manifest {
+	struct chip_identity id;
+	size_t block_count;
+	bool *valid;
+	uint8_t (*digests)[SHA256_DIGEST_SIZE];
+};
+
+static void manifest_clear(struct flashrom_manifest *manifest)
+{
+	chip_identity_clear(&manifest->id);
+	free(manifest->valid);
+	free(manifest->digests);
+	memset(manifest, 0, sizeof(*manifest));
+}
+
+static int manifest_alloc_blocks(struct flashrom_manifest *manifest)
+{
+	manifest->block_count = manifest->id.chip_size / manifest->id.block_size;
+	manifest->valid = calloc(manifest->block_count, sizeof(*manifest->valid));
+	manifest->digests = calloc(manifest->block_count, sizeof(*manifest->digests));
+	if (!manifest->valid || !manifest->digests) {
+		msg_gerr("Out of memory!\n");
+		manifest_clear(manifest);
+		return 1;
+	}
+	return 0;
+}
+
+/* Drops all digests and makes the manifest describe the given chip. */
+static int manifest_reset(struct flashrom_manifest *manifest, const struct flashchip *chip)
+{
+	manifest_clear(manifest);
+	if (chip_identity_set(&manifest->id, chip))
+		return 1;
+	return manifest_alloc_blocks(manifest);
+}
+
+bool manifest_matches_chip(const struct flashrom_manifest *manifest, const struct flashchip *chip)
+{
+	return manifest->block_count && chip_identity_matches(&manifest->id, chip);
+}
+
+size_t manifest_block_size(const struct flashrom_manifest *manifest)
+{
+	return manifest->id.block_size;
+}
+
+/* Whether the manifest knows the block and contents (a whole chip buffer) hold the same data. */
+bool manifest_block_matches(const struct flashrom_manifest *manifest, size_t block, const uint8_t *contents)
+{
+	uint8_t digest[SHA256_DIGEST_SIZE];
+
+	if (block >= manifest->block_count || !manifest->valid[block])
+		return false;
+	sha256(contents + block * manifest->id.block_size, manifest->id.block_size, digest);
+	return !memcmp(digest, manifest->digests[block], SHA256_DIGEST_SIZE);
+}
+
+/*
+ * Records the digests of all blocks fully covered by the included regions of
+ * the layout, contents being a whole chip buffer. Partially covered blocks
+ * are dropped. A manifest of a different chip is started over.
+ */
+void manifest_update(struct flashrom_manifest *manifest, const struct flashchip *chip,
+		     const struct flashrom_layout *layout, const uint8_t *contents)
+{
+	if (!manifest_matches_chip(manifest, chip)) {
+		msg_cdbg("Starting a new manifest for this flash chip.\n");
+		if (manifest_reset(manifest, chip))
+			return;
+	}
+
+	const struct romentry *entry = NULL;
+	while ((entry = layout_next_included(layout, entry))) {
+		const size_t bs = manifest->id.block_size;
+		for (size_t i = entry->region.start / bs; i <= entry->region.end / bs; i++) {
+			if (i * bs < entry->region.start || (i + 1) * bs - 1 > entry->region.end) {
+				manifest->valid[i] = false;
+				continue;
+			}
+			sha256(contents + i * bs, bs, manifest->digests[i]);
+			manifest->valid[i] = true;
+		}
+	}
+}
+
+/* Drops the digests of all blocks touched by the included regions of the layout, or all if it is NULL. */
+void manifest_invalidate(struct flashrom_manifest *manifest, const struct flashchip *chip,
+			 const struct flashrom_layout *layout)
+{
+	if (!manifest_matches_chip(manifest, chip))
+		return;
+
+	if (!layout) {
+		memset(manifest->valid, 0, manifest->block_count * sizeof(*manifest->valid));
+		return;
+	}
+
+	const struct romentry *entry = NULL;
+	while ((entry = layout_next_included(layout, entry))) {
+		for (size_t i = entry->region.start / manifest->id.block_size;
+		     i <= entry->region.end / manifest->id.block_size; i++)
+			manifest->valid[i] = false;
+	}
+}
+
+int flashrom_manifest_new(struct flashrom_manifest **manifest)
+{
+	*manifest = calloc(1, sizeof(**manifest));
+	if (!*manifest) {
+		msg_gerr("Out of memory!\n");
+		return 1;
+	}
+	return 0;
+}
+
+void flashrom_manifest_release(struct flashrom_manifest *manifest)
+{
+	if (!manifest)
+		return;
+	manifest_clear(manifest);
+	free(manifest);
+}
+
+void flashrom_manifest_set(struct flashrom_flashctx *flashctx, struct flashrom_manifest *manifest)
+{
+	flashctx->manifest = manifest;
+}
+
+static int hex_nibble(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+static int parse_line(void *data, unsigned int lineno, const char *line)
+{
+	struct flashrom_manifest *const manifest = data;
+	const char *value;
+	unsigned long long a;
+
+	if (lineno < CHIP_IDENTITY_LINES) {
+		const int ret = chip_identity_parse_line(&manifest->id, MANIFEST_HEADER, lineno, line);
+		/* A manifest that was never used for a chip has no blocks. */
+		if (ret || lineno != CHIP_IDENTITY_LINES - 1 || !manifest->id.chip_size)
+			return ret;
+		return manifest_alloc_blocks(manifest);
+	}
+
+	if (!(value = text_line_value(line, "block")) || sscanf(value, "%llu", &a) != 1 ||
+	    a >= manifest->block_count)
+		return 2;
+	value = strchr(value, ' ');
+	if (!value || strlen(++value) != 2 * SHA256_DIGEST_SIZE)
+		return 2;
+	for (size_t i = 0; i < SHA256_DIGEST_SIZE; i++) {
+		const int hi = hex_nibble(value[2 * i]), lo = hex_nibble(value[2 * i + 1]);
+		if (hi < 0 || lo < 0)
+			return 2;
+		manifest->digests[a][i] = hi << 4 | lo;
+	}
+	manifest->valid[a] = true;
+	return 0;
+}
+
+int flashrom_manifest_read_from_buffer(struct flashrom_manifest **manifest, const char *buffer, size_t len)
+{
+	unsigned int lineno;
+
+	int ret = flashrom_manifest_new(manifest);
+	if (ret)
+		return ret;
+
+	ret = text_parse_lines(buffer, len, &lineno, parse_line, *manifest);
+	if (!ret && lineno < CHIP_IDENTITY_LINES)
+		ret = 2;
+
+	if (ret) {
+		if (ret == 2)
+			msg_gerr("Invalid manifest in line %u.\n", lineno + 1);
+		flashrom_manifest_release(*manifest);
+		*manifest = NULL;
+	}
+	return ret;
+}
+
+int flashrom_manifest_write_to_buffer(const struct flashrom_manifest *manifest, char **buffer)
+{
+	size_t capacity = chip_identity_text_size(&manifest->id);
+	for (size_t i = 0; i < manifest->block_count; i++)
+		capacity += manifest->valid[i] ? 32 + 2 * SHA256_DIGEST_SIZE : 0;
+
+	char *out = malloc(capacity);
+	if (!out) {
+		msg_gerr("Out of memory!\n");
+		return 1;
+	}
+
+	size_t len = chip_identity_to_text(&manifest->id, MANIFEST_HEADER, out, capacity);
+	for (size_t i = 0; i < manifest->block_count; i++) {
+		if (!manifest->valid[i])
+			continue;
+		len += snprintf(out + len, capacity - len, "block %zu ", i);
+		for (size_t j = 0; j < SHA256_DIGEST_SIZE; j++)
+			len += snprintf(out + len, capacity - len, "%02x", manifest->digests[i][j]);
+		len += snprintf(out + len, capacity - len, "\n");
+	}
+
+	*buffer = out;
+	return 0;
+}
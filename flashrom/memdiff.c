@@ -0,0 +1,400 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Buffer comparison kernels used to diff flash images. Every kernel turns
+ * whole 64-byte lanes into a "differs" and an "erased" mask in a single pass,
+ * the helpers below reduce those masks for need_erase(), get_next_write() and
+ * range verification.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "flash.h"
+#include "memdiff.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define MEMDIFF_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#else
+#define MEMDIFF_X86 0
+#endif
+
+/* Number of lanes whose masks are computed at a time by the helpers. */
+#define MEMDIFF_BATCH_LANES	64
+#define MEMDIFF_BATCH_SIZE	(MEMDIFF_BATCH_LANES * MEMDIFF_LANE_SIZE)
+
+typedef void (memdiff_kernel_t)(const uint8_t *have, const uint8_t *want, size_t lanes,
+				uint8_t erased_value, uint64_t *differs, uint64_t *erased);
+
+static void memdiff_lanes_scalar(const uint8_t *have, const uint8_t *want, size_t lanes,
+				 uint8_t erased_value, uint64_t *differs, uint64_t *erased)
+{
+	for (size_t l = 0; l < lanes; l++) {
+		uint64_t d = 0, e = 0;
+		for (unsigned int i = 0; i < MEMDIFF_LANE_SIZE; i++) {
+			d |= (uint64_t)(have[i] != want[i]) << i;
+			e |= (uint64_t)(have[i] == erased_value) << i;
+		}
+		differs[l] = d;
+		erased[l] = e;
+		have += MEMDIFF_LANE_SIZE;
+		want += MEMDIFF_LANE_SIZE;
+	}
+}
+
+#if MEMDIFF_X86
+__attribute__((target("sse2")))
+static void memdiff_lanes_sse2(const uint8_t *have, const uint8_t *want, size_t lanes,
+			       uint8_t erased_value, uint64_t *differs, uint64_t *erased)
+{
+	const __m128i ev = _mm_set1_epi8((char)erased_value);
+
+	for (size_t l = 0; l < lanes; l++) {
+		uint64_t eq = 0, e = 0;
+		for (unsigned int i = 0; i < 4; i++) {
+			const __m128i h = _mm_loadu_si128((const __m128i *)(have + i * 16));
+			const __m128i w = _mm_loadu_si128((const __m128i *)(want + i * 16));
+			eq |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(h, w)) << (i * 16);
+			e |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(h, ev)) << (i * 16);
+		}
+		differs[l] = ~eq;
+		erased[l] = e;
+		have += MEMDIFF_LANE_SIZE;
+		want += MEMDIFF_LANE_SIZE;
+	}
+}
+
+__attribute__((target("avx2")))
+static void memdiff_lanes_avx2(const uint8_t *have, const uint8_t *want, size_t lanes,
+			       uint8_t erased_value, uint64_t *differs, uint64_t *erased)
+{
+	const __m256i ev = _mm256_set1_epi8((char)erased_value);
+
+	for (size_t l = 0; l < lanes; l++) {
+		const __m256i h0 = _mm256_loadu_si256((const __m256i *)have);
+		const __m256i h1 = _mm256_loadu_si256((const __m256i *)(have + 32));
+		const __m256i w0 = _mm256_loadu_si256((const __m256i *)want);
+		const __m256i w1 = _mm256_loadu_si256((const __m256i *)(want + 32));
+		const uint64_t eq = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(h0, w0)) |
+				    (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(h1, w1)) << 32;
+		differs[l] = ~eq;
+		erased[l] = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(h0, ev)) |
+			    (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(h1, ev)) << 32;
+		have += MEMDIFF_LANE_SIZE;
+		want += MEMDIFF_LANE_SIZE;
+	}
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void memdiff_lanes_avx512(const uint8_t *have, const uint8_t *want, size_t lanes,
+				 uint8_t erased_value, uint64_t *differs, uint64_t *erased)
+{
+	const __m512i ev = _mm512_set1_epi8((char)erased_value);
+
+	for (size_t l = 0; l < lanes; l++) {
+		const __m512i h = _mm512_loadu_si512((const void *)have);
+		const __m512i w = _mm512_loadu_si512((const void *)want);
+		differs[l] = _mm512_cmpneq_epi8_mask(h, w);
+		erased[l] = _mm512_cmpeq_epi8_mask(h, ev);
+		have += MEMDIFF_LANE_SIZE;
+		want += MEMDIFF_LANE_SIZE;
+	}
+}
+
+static uint64_t read_xcr0(void)
+{
+	uint32_t lo, hi;
+
+	__asm__ volatile ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+	return (uint64_t)hi << 32 | lo;
+}
+
+static bool cpu_supports(enum memdiff_impl impl)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+	if (impl == MEMDIFF_IMPL_SSE2)
+		return edx & bit_SSE2;
+
+	/* AVX state has to be enabled by the OS, not only supported by the CPU. */
+	if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+		return false;
+	const uint64_t xcr0 = read_xcr0();
+	if ((xcr0 & 0x06) != 0x06)
+		return false;
+
+	if (__get_cpuid_max(0, NULL) < 7)
+		return false;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	if (impl == MEMDIFF_IMPL_AVX2)
+		return ebx & bit_AVX2;
+	if (impl == MEMDIFF_IMPL_AVX512)
+		return (ebx & bit_AVX512F) && (ebx & bit_AVX512BW) && (xcr0 & 0xe6) == 0xe6;
+	return false;
+}
+#endif /* MEMDIFF_X86 */
+
+static memdiff_kernel_t *const kernels[MEMDIFF_IMPL_NR] = {
+	[MEMDIFF_IMPL_SCALAR]	= memdiff_lanes_scalar,
+#if MEMDIFF_X86
+	[MEMDIFF_IMPL_SSE2]	= memdiff_lanes_sse2,
+	[MEMDIFF_IMPL_AVX2]	= memdiff_lanes_avx2,
+	[MEMDIFF_IMPL_AVX512]	= memdiff_lanes_avx512,
+#endif
+};
+
+static const char *const impl_names[MEMDIFF_IMPL_NR] = {
+	[MEMDIFF_IMPL_SCALAR]	= "scalar",
+	[MEMDIFF_IMPL_SSE2]	= "SSE2",
+	[MEMDIFF_IMPL_AVX2]	= "AVX2",
+	[MEMDIFF_IMPL_AVX512]	= "AVX-512",
+};
+
+/*
+ * Picked on first use, which may happen on several threads at once. They all
+ * pick the same one, the accesses only have to be atomic.
+ */
+static int current_impl = MEMDIFF_IMPL_NR;
+
+static enum memdiff_impl load_impl(void)
+{
+#if defined(__GNUC__)
+	return __atomic_load_n(&current_impl, __ATOMIC_RELAXED);
+#else
+	return current_impl;
+#endif
+}
+
+static void store_impl(enum memdiff_impl impl)
+{
+#if defined(__GNUC__)
+	__atomic_store_n(&current_impl, impl, __ATOMIC_RELAXED);
+#else
+	current_impl = impl;
+#endif
+}
+
+bool memdiff_impl_supported(enum memdiff_impl impl)
+{
+	if (impl >= MEMDIFF_IMPL_NR || !kernels[impl])
+		return false;
+	if (impl == MEMDIFF_IMPL_SCALAR)
+		return true;
+#if MEMDIFF_X86
+	return cpu_supports(impl);
+#else
+	return false;
+#endif
+}
+
+const char *memdiff_impl_name(enum memdiff_impl impl)
+{
+	return impl < MEMDIFF_IMPL_NR ? impl_names[impl] : "unknown";
+}
+
+int memdiff_set_impl(enum memdiff_impl impl)
+{
+	if (!memdiff_impl_supported(impl))
+		return -1;
+	store_impl(impl);
+	return 0;
+}
+
+enum memdiff_impl memdiff_get_impl(void)
+{
+	enum memdiff_impl impl = load_impl();
+
+	if (impl == MEMDIFF_IMPL_NR) {
+		impl = MEMDIFF_IMPL_NR - 1;
+		while (!memdiff_impl_supported(impl))
+			impl--;
+		store_impl(impl);
+		msg_gspew("Using %s buffer comparison.\n", impl_names[impl]);
+	}
+	return impl;
+}
+
+static unsigned int lowest_bit(uint64_t mask)
+{
+#if defined(__GNUC__)
+	return __builtin_ctzll(mask);
+#else
+	unsigned int i = 0;
+	while (!(mask & 1)) {
+		mask >>= 1;
+		i++;
+	}
+	return i;
+#endif
+}
+
+static unsigned int count_bits(uint64_t mask)
+{
+#if defined(__GNUC__)
+	return __builtin_popcountll(mask);
+#else
+	unsigned int i = 0;
+	for (; mask; mask &= mask - 1)
+		i++;
+	return i;
+#endif
+}
+
+static size_t batch_len(size_t len, size_t off)
+{
+	return len - off < MEMDIFF_BATCH_SIZE ? len - off : MEMDIFF_BATCH_SIZE;
+}
+
+/* Mask of the valid bytes of lane l when len bytes were compared. */
+static uint64_t lane_valid(size_t len, size_t l)
+{
+	const size_t left = len - l * MEMDIFF_LANE_SIZE;
+	return left >= MEMDIFF_LANE_SIZE ? UINT64_MAX : ((uint64_t)1 << left) - 1;
+}
+
+/*
+ * Fills one differs and one erased mask per started lane of len bytes. The
+ * bits for bytes past len in the last lane are clear.
+ */
+void memdiff_masks(const uint8_t *have, const uint8_t *want, size_t len, uint8_t erased_value,
+		   uint64_t *differs, uint64_t *erased)
+{
+	const size_t lanes = len / MEMDIFF_LANE_SIZE;
+	const size_t tail = len % MEMDIFF_LANE_SIZE;
+
+	kernels[memdiff_get_impl()](have, want, lanes, erased_value, differs, erased);
+	if (!tail)
+		return;
+
+	have += lanes * MEMDIFF_LANE_SIZE;
+	want += lanes * MEMDIFF_LANE_SIZE;
+	uint64_t d = 0, e = 0;
+	for (unsigned int i = 0; i < tail; i++) {
+		d |= (uint64_t)(have[i] != want[i]) << i;
+		e |= (uint64_t)(have[i] == erased_value) << i;
+	}
+	differs[lanes] = d;
+	erased[lanes] = e;
+}
+
+/* Returns the offset of the first byte that differs (or is equal if equal is set), len if there is none. */
+size_t memdiff_find(const uint8_t *have, const uint8_t *want, size_t len, bool equal)
+{
+	uint64_t differs[MEMDIFF_BATCH_LANES], erased[MEMDIFF_BATCH_LANES];
+
+	for (size_t off = 0; off < len; off += MEMDIFF_BATCH_SIZE) {
+		const size_t n = batch_len(len, off);
+		memdiff_masks(have + off, want + off, n, 0, differs, erased);
+		for (size_t l = 0; l * MEMDIFF_LANE_SIZE < n; l++) {
+			const uint64_t mask = (equal ? ~differs[l] : differs[l]) & lane_valid(n, l);
+			if (mask)
+				return off + l * MEMDIFF_LANE_SIZE + lowest_bit(mask);
+		}
+	}
+	return len;
+}
+
+/* Returns the number of differing bytes and stores the offset of the first one (or len) in first. */
+size_t memdiff_count(const uint8_t *have, const uint8_t *want, size_t len, size_t *first)
+{
+	uint64_t differs[MEMDIFF_BATCH_LANES], erased[MEMDIFF_BATCH_LANES];
+	size_t count = 0;
+
+	*first = len;
+	for (size_t off = 0; off < len; off += MEMDIFF_BATCH_SIZE) {
+		const size_t n = batch_len(len, off);
+		memdiff_masks(have + off, want + off, n, 0, differs, erased);
+		for (size_t l = 0; l * MEMDIFF_LANE_SIZE < n; l++) {
+			if (!differs[l])
+				continue;
+			if (*first == len)
+				*first = off + l * MEMDIFF_LANE_SIZE + lowest_bit(differs[l]);
+			count += count_bits(differs[l]);
+		}
+	}
+	return count;
+}
+
+/* Returns the number of bytes not in erased state and stores the offset of the first one (or len) in first. */
+size_t memdiff_count_unerased(const uint8_t *have, size_t len, uint8_t erased_value, size_t *first)
+{
+	uint64_t differs[MEMDIFF_BATCH_LANES], erased[MEMDIFF_BATCH_LANES];
+	size_t count = 0;
+
+	*first = len;
+	for (size_t off = 0; off < len; off += MEMDIFF_BATCH_SIZE) {
+		const size_t n = batch_len(len, off);
+		/* Only the erased mask is of interest, so compare the buffer against itself. */
+		memdiff_masks(have + off, have + off, n, erased_value, differs, erased);
+		for (size_t l = 0; l * MEMDIFF_LANE_SIZE < n; l++) {
+			const uint64_t mask = ~erased[l] & lane_valid(n, l);
+			if (!mask)
+				continue;
+			if (*first == len)
+				*first = off + l * MEMDIFF_LANE_SIZE + lowest_bit(mask);
+			count += count_bits(mask);
+		}
+	}
+	return count;
+}
+
+/* Returns whether the buffers differ and whether all of have is in erased state, in one pass. */
+bool memdiff_summary(const uint8_t *have, const uint8_t *want, size_t len, uint8_t erased_value,
+		     bool *all_erased)
+{
+	uint64_t differs[MEMDIFF_BATCH_LANES], erased[MEMDIFF_BATCH_LANES];
+	uint64_t any_differs = 0, not_erased = 0;
+
+	for (size_t off = 0; off < len; off += MEMDIFF_BATCH_SIZE) {
+		const size_t n = batch_len(len, off);
+		memdiff_masks(have + off, want + off, n, erased_value, differs, erased);
+		for (size_t l = 0; l * MEMDIFF_LANE_SIZE < n; l++) {
+			any_differs |= differs[l];
+			not_erased |= ~erased[l] & lane_valid(n, l);
+		}
+	}
+	*all_erased = !not_erased;
+	return any_differs;
+}
+
+/* Returns whether any byte differs while not being in erased state. */
+bool memdiff_unerased_diff(const uint8_t *have, const uint8_t *want, size_t len, uint8_t erased_value)
+{
+	uint64_t differs[MEMDIFF_BATCH_LANES], erased[MEMDIFF_BATCH_LANES];
+
+	for (size_t off = 0; off < len; off += MEMDIFF_BATCH_SIZE) {
+		const size_t n = batch_len(len, off);
+		memdiff_masks(have + off, want + off, n, erased_value, differs, erased);
+		for (size_t l = 0; l * MEMDIFF_LANE_SIZE < n; l++)
+			if (differs[l] & ~erased[l])
+				return true;
+	}
+	return false;
+}
+
+/* Returns whether any byte of want has a bit set that is clear in have. */
+bool memdiff_sets_bits(const uint8_t *have, const uint8_t *want, size_t len)
+{
+	uint64_t differs[MEMDIFF_BATCH_LANES], erased[MEMDIFF_BATCH_LANES];
+
+	for (size_t off = 0; off < len; off += MEMDIFF_BATCH_SIZE) {
+		const size_t n = batch_len(len, off);
+		memdiff_masks(have + off, want + off, n, 0, differs, erased);
+		/* Only differing bytes can need a bit set, skip the rest. */
+		for (size_t l = 0; l * MEMDIFF_LANE_SIZE < n; l++) {
+			for (uint64_t mask = differs[l]; mask; mask &= mask - 1) {
+				const size_t i = off + l * MEMDIFF_LANE_SIZE + lowest_bit(mask);
+				if ((have[i] & want[i]) != want[i])
+					return true;
+			}
+		}
+	}
+	return false;
+}
@@ -17,6 +17,8 @@
 #include "flashchips.h"
 #include "chipdrivers.h"
 #include "programmer.h"
+#include "stats.h"
+#include "trace.h"
 
 int probe_opaque(struct flashctx *flash)
 {
@@ -25,17 +27,30 @@ int probe_opaque(struct flashctx *flash)
 
 int read_opaque(struct flashctx *flash, uint8_t *buf, unsigned int start, unsigned int len)
 {
-	return flash->mst->opaque.read(flash, buf, start, len);
+	const uint64_t stats_start_ns = stats_start(flash);
+	const uint64_t trace_start = trace_begin(flash);
+	const int ret = flash->mst->opaque.read(flash, buf, start, len);
+	stats_count_transfer(flash, 0, len, stats_transactions(flash), stats_start_ns);
+	trace_range(flash, TRACE_OPAQUE_READ, start, len, buf, ret, trace_start);
+	return ret;
 }
 
 int write_opaque(struct flashctx *flash, const uint8_t *buf, unsigned int start, unsigned int len)
 {
-	return flash->mst->opaque.write(flash, buf, start, len);
+	const uint64_t stats_start_ns = stats_start(flash);
+	const uint64_t trace_start = trace_begin(flash);
+	const int ret = flash->mst->opaque.write(flash, buf, start, len);
+	stats_count_transfer(flash, len, 0, stats_transactions(flash), stats_start_ns);
+	trace_range(flash, TRACE_OPAQUE_WRITE, start, len, NULL, ret, trace_start);
+	return ret;
 }
 
 int erase_opaque(struct flashctx *flash, unsigned int blockaddr, unsigned int blocklen)
 {
-	return flash->mst->opaque.erase(flash, blockaddr, blocklen);
+	const uint64_t trace_start = trace_begin(flash);
+	const int ret = flash->mst->opaque.erase(flash, blockaddr, blocklen);
+	trace_range(flash, TRACE_OPAQUE_ERASE, blockaddr, blocklen, NULL, ret, trace_start);
+	return ret;
 }
 
 int register_opaque_master(const struct opaque_master *mst, void *data)
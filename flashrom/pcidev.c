@@ -8,10 +8,13 @@
 
 #include "pcidev.h"
 
+#include <limits.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "flash.h"
+#include "platform.h"
 #include "programmer.h"
 
 struct pci_access *pacc;
@@ -153,12 +156,131 @@ struct pci_dev *pcidev_scandev(struct pci_filter *filter, struct pci_dev *start)
 	return NULL;
 }
 
+/*
+ * Index of the devices found by pci_init_common(). Chipset and board enables
+ * look devices up by ID over and over, e.g. once per entry of their tables,
+ * which used to walk the whole device list and read config space each time.
+ * Entries are in device list order and so are the bucket chains, lookups
+ * return the same device a scan of the list would.
+ */
+#define PCIDEV_INDEX_BITS	8
+#define PCIDEV_INDEX_BUCKETS	(1 << PCIDEV_INDEX_BITS)
+
+struct pcidev_index_entry {
+	struct pci_dev *dev;
+	/* Read-only header fields, read once. */
+	uint16_t vendor_id;
+	uint16_t device_id;
+	uint16_t devclass;
+	uint16_t subsystem_vendor_id;
+	uint16_t subsystem_id;
+	/* Next entry with the same hash of vendor and device / of vendor, -1 for none. */
+	int next_id;
+	int next_vendor;
+};
+
+static struct {
+	/* pci_access the index was built from, NULL if there is none. */
+	struct pci_access *acc;
+	struct pcidev_index_entry *entries;
+	int id_buckets[PCIDEV_INDEX_BUCKETS];
+	int vendor_buckets[PCIDEV_INDEX_BUCKETS];
+} pcidev_index;
+
+static unsigned int pcidev_index_hash(uint16_t vendor, uint16_t device)
+{
+	const uint32_t key = (uint32_t)vendor << 16 | device;
+	return (key * 0x9e3779b1u) >> (32 - PCIDEV_INDEX_BITS);
+}
+
+void pcidev_index_release(void)
+{
+	free(pcidev_index.entries);
+	pcidev_index.entries = NULL;
+	pcidev_index.acc = NULL;
+}
+
+void pcidev_index_build(struct pci_access *acc)
+{
+	struct pci_dev *dev;
+	size_t count = 0;
+	int i;
+
+	pcidev_index_release();
+	for (dev = acc->devices; dev; dev = dev->next)
+		count++;
+	if (count == 0 || count > INT_MAX)
+		return;
+
+	pcidev_index.entries = calloc(count, sizeof(*pcidev_index.entries));
+	if (!pcidev_index.entries) {
+		msg_pwarn("Out of memory, PCI device lookups will be slow.\n");
+		return;
+	}
+
+	for (dev = acc->devices, i = 0; dev; dev = dev->next, i++) {
+		struct pcidev_index_entry *const entry = &pcidev_index.entries[i];
+		uint8_t header[PCI_SUBSYSTEM_ID + 2];
+
+		pci_fill_info(dev, PCI_FILL_IDENT);
+		entry->dev = dev;
+		entry->vendor_id = dev->vendor_id;
+		entry->device_id = dev->device_id;
+		/* One config space access instead of one per register. */
+		if (pci_read_block(dev, 0, header, sizeof(header))) {
+			entry->devclass = read_le16(header, PCI_CLASS_DEVICE);
+			entry->subsystem_vendor_id = read_le16(header, PCI_SUBSYSTEM_VENDOR_ID);
+			entry->subsystem_id = read_le16(header, PCI_SUBSYSTEM_ID);
+		} else {
+			entry->devclass = pci_read_word(dev, PCI_CLASS_DEVICE);
+			entry->subsystem_vendor_id = pci_read_word(dev, PCI_SUBSYSTEM_VENDOR_ID);
+			entry->subsystem_id = pci_read_word(dev, PCI_SUBSYSTEM_ID);
+		}
+	}
+
+	/* Prepend in reverse, so that the chains keep the list order. */
+	for (i = 0; i < PCIDEV_INDEX_BUCKETS; i++) {
+		pcidev_index.id_buckets[i] = -1;
+		pcidev_index.vendor_buckets[i] = -1;
+	}
+	for (i = count - 1; i >= 0; i--) {
+		struct pcidev_index_entry *const entry = &pcidev_index.entries[i];
+		const unsigned int id_hash = pcidev_index_hash(entry->vendor_id, entry->device_id);
+		const unsigned int vendor_hash = pcidev_index_hash(entry->vendor_id, 0);
+
+		entry->next_id = pcidev_index.id_buckets[id_hash];
+		pcidev_index.id_buckets[id_hash] = i;
+		entry->next_vendor = pcidev_index.vendor_buckets[vendor_hash];
+		pcidev_index.vendor_buckets[vendor_hash] = i;
+	}
+
+	pcidev_index.acc = acc;
+	msg_pspew("Indexed %zu PCI devices.\n", count);
+}
+
+/* The index can only be used with the pci_access it was built from, see enable_flash_pch100_or_c620(). */
+static bool pcidev_index_valid(void)
+{
+	return pcidev_index.acc && pcidev_index.acc == pacc;
+}
+
 struct pci_dev *pcidev_card_find(uint16_t vendor, uint16_t device,
 				 uint16_t card_vendor, uint16_t card_device)
 {
 	struct pci_dev *temp = NULL;
 	struct pci_filter filter;
 
+	if (pcidev_index_valid()) {
+		int i = pcidev_index.id_buckets[pcidev_index_hash(vendor, device)];
+		for (; i >= 0; i = pcidev_index.entries[i].next_id) {
+			const struct pcidev_index_entry *const entry = &pcidev_index.entries[i];
+			if (entry->vendor_id == vendor && entry->device_id == device &&
+			    entry->subsystem_vendor_id == card_vendor && entry->subsystem_id == card_device)
+				return entry->dev;
+		}
+		return NULL;
+	}
+
 	pci_filter_init(NULL, &filter);
 	filter.vendor = vendor;
 	filter.device = device;
@@ -176,6 +298,16 @@ struct pci_dev *pcidev_find(uint16_t vendor, uint16_t device)
 {
 	struct pci_filter filter;
 
+	if (pcidev_index_valid()) {
+		int i = pcidev_index.id_buckets[pcidev_index_hash(vendor, device)];
+		for (; i >= 0; i = pcidev_index.entries[i].next_id) {
+			const struct pcidev_index_entry *const entry = &pcidev_index.entries[i];
+			if (entry->vendor_id == vendor && entry->device_id == device)
+				return entry->dev;
+		}
+		return NULL;
+	}
+
 	pci_filter_init(NULL, &filter);
 	filter.vendor = vendor;
 	filter.device = device;
@@ -197,6 +329,16 @@ struct pci_dev *pcidev_find_vendorclass(uint16_t vendor, uint16_t devclass)
 	struct pci_filter filter;
 	uint16_t tmp2;
 
+	if (pcidev_index_valid()) {
+		int i = pcidev_index.vendor_buckets[pcidev_index_hash(vendor, 0)];
+		for (; i >= 0; i = pcidev_index.entries[i].next_vendor) {
+			const struct pcidev_index_entry *const entry = &pcidev_index.entries[i];
+			if (entry->vendor_id == vendor && entry->devclass == devclass)
+				return entry->dev;
+		}
+		return NULL;
+	}
+
 	pci_filter_init(NULL, &filter);
 	filter.vendor = vendor;
 
@@ -217,6 +359,7 @@ static int pcidev_shutdown(void *data)
 			 "Please report a bug at flashrom@flashrom.org\n", __func__);
 		return 1;
 	}
+	pcidev_index_release();
 	pci_cleanup(pacc);
 	pacc = NULL;
 	return 0;
@@ -234,6 +377,7 @@ int pci_init_common(void)
 	if (register_shutdown(pcidev_shutdown, NULL))
 		return 1;
 	pci_scan_bus(pacc);     /* We want to get the list of devices */
+	pcidev_index_build(pacc);
 	return 0;
 }
 
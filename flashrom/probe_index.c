@@ -0,0 +1,329 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flash.h"
+#include "flashchips.h"
+#include "chipdrivers.h"
+#include "programmer.h"
+#include "probe_index.h"
+
+/* Probe functions that only compare the answer of one ID command. */
+static const enum probe_func indexed_probes[] = {
+	PROBE_SPI_RDID,
+	PROBE_SPI_RDID4,
+	PROBE_SPI_REMS,
+	PROBE_SPI_RES2,
+};
+
+struct probe_key {
+	enum probe_func probe;
+	uint32_t id1;
+	uint32_t id2;
+};
+
+struct probe_entry {
+	struct probe_key key;
+	size_t chip;
+};
+
+struct probe_bucket {
+	bool used;
+	struct probe_key key;
+	/* Range of entries with this key, sorted by position in flashchips[]. */
+	size_t first;
+	size_t count;
+};
+
+struct probe_group {
+	/* Range of entries using the probe function. */
+	size_t first;
+	size_t count;
+};
+
+struct probe_index {
+	struct probe_entry *entries;
+	size_t entry_count;
+	struct probe_bucket *buckets;
+	size_t bucket_mask;
+	struct probe_group groups[ARRAY_SIZE(indexed_probes)];
+	/* Chips that have to be probed one by one, in flashchips[] order. */
+	size_t *unindexed;
+	size_t unindexed_count;
+};
+
+static bool g_probe_index_disabled;
+
+void probe_index_enable(bool enable)
+{
+	g_probe_index_disabled = !enable;
+}
+
+bool probe_index_enabled(void)
+{
+	return !g_probe_index_disabled;
+}
+
+static bool uses_compare_id(enum probe_func probe)
+{
+	return probe != PROBE_SPI_RES2;
+}
+
+static int group_of(enum probe_func probe)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(indexed_probes); i++) {
+		if (indexed_probes[i] == probe)
+			return i;
+	}
+	return -1;
+}
+
+/* Chips matching any vendor ID are filed under the generic key, whatever their model ID. */
+static struct probe_key chip_key(const struct flashchip *chip)
+{
+	struct probe_key key = { chip->probe, chip->manufacture_id, chip->model_id };
+
+	if (uses_compare_id(chip->probe) && chip->manufacture_id == GENERIC_MANUF_ID)
+		key.id2 = GENERIC_DEVICE_ID;
+	return key;
+}
+
+static int compare_keys(const struct probe_key *a, const struct probe_key *b)
+{
+	if (a->probe != b->probe)
+		return a->probe < b->probe ? -1 : 1;
+	if (a->id1 != b->id1)
+		return a->id1 < b->id1 ? -1 : 1;
+	if (a->id2 != b->id2)
+		return a->id2 < b->id2 ? -1 : 1;
+	return 0;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+	const struct probe_entry *ea = a, *eb = b;
+	const int ret = compare_keys(&ea->key, &eb->key);
+
+	if (ret)
+		return ret;
+	return ea->chip < eb->chip ? -1 : ea->chip > eb->chip;
+}
+
+static int compare_chips(const void *a, const void *b)
+{
+	const size_t ca = *(const size_t *)a, cb = *(const size_t *)b;
+
+	return ca < cb ? -1 : ca > cb;
+}
+
+static size_t hash_key(const struct probe_key *key)
+{
+	uint64_t h = ((uint64_t)key->id1 << 32 | key->id2) ^ ((uint64_t)key->probe << 56);
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static const struct probe_bucket *lookup(const struct probe_index *index, const struct probe_key *key)
+{
+	for (size_t i = hash_key(key) & index->bucket_mask; index->buckets[i].used;
+	     i = (i + 1) & index->bucket_mask) {
+		if (!compare_keys(&index->buckets[i].key, key))
+			return &index->buckets[i];
+	}
+	return NULL;
+}
+
+static void free_index(struct probe_index *index)
+{
+	if (!index)
+		return;
+	free(index->entries);
+	free(index->buckets);
+	free(index->unindexed);
+	free(index);
+}
+
+static struct probe_index *build_index(void)
+{
+	struct probe_index *const index = calloc(1, sizeof(*index));
+	if (!index)
+		return NULL;
+
+	index->entries = malloc(flashchips_size * sizeof(*index->entries));
+	index->unindexed = malloc(flashchips_size * sizeof(*index->unindexed));
+	if (!index->entries || !index->unindexed)
+		goto _err;
+
+	for (size_t i = 0; flashchips[i].name; i++) {
+		if (group_of(flashchips[i].probe) < 0) {
+			index->unindexed[index->unindexed_count++] = i;
+		} else {
+			index->entries[index->entry_count].key = chip_key(&flashchips[i]);
+			index->entries[index->entry_count++].chip = i;
+		}
+	}
+	qsort(index->entries, index->entry_count, sizeof(*index->entries), compare_entries);
+
+	/* Keep the load factor at or below one half. */
+	size_t bucket_count = 16;
+	while (bucket_count < 2 * index->entry_count)
+		bucket_count *= 2;
+	index->buckets = calloc(bucket_count, sizeof(*index->buckets));
+	if (!index->buckets)
+		goto _err;
+	index->bucket_mask = bucket_count - 1;
+
+	for (size_t i = 0; i < index->entry_count; i++) {
+		const struct probe_entry *entry = &index->entries[i];
+		struct probe_group *group = &index->groups[group_of(entry->key.probe)];
+		if (!group->count)
+			group->first = i;
+		group->count++;
+
+		if (i && !compare_keys(&entry->key, &index->entries[i - 1].key))
+			continue;
+		size_t b = hash_key(&entry->key) & index->bucket_mask;
+		while (index->buckets[b].used)
+			b = (b + 1) & index->bucket_mask;
+		index->buckets[b].used = true;
+		index->buckets[b].key = entry->key;
+		index->buckets[b].first = i;
+		index->buckets[b].count = 0;
+		for (size_t j = i; j < index->entry_count && !compare_keys(&index->entries[j].key, &entry->key); j++)
+			index->buckets[b].count++;
+	}
+	return index;
+
+_err:
+	free_index(index);
+	return NULL;
+}
+
+void probe_index_release(struct flashrom_programmer *prog)
+{
+	free_index(prog->probe_index);
+	prog->probe_index = NULL;
+}
+
+/* Same filter probe_flash() applies to chips when no chip name is given. */
+static bool chip_probeable(const struct registered_master *mst, const struct flashchip *chip)
+{
+	if (!(mst->buses_supported & chip->bustype))
+		return false;
+	return chip->bustype != BUS_SPI || chip->spi_cmd_set == SPI25;
+}
+
+/*
+ * Sends the ID command of a group once, in the context of its first chip
+ * that would be probed on this master.
+ */
+static int read_group_ids(struct flashctx *flash, struct registered_master *mst, const struct probe_index *index,
+			  const struct probe_group *group, uint32_t *id1, uint32_t *id2)
+{
+	const struct flashchip *first = NULL;
+
+	for (size_t i = group->first; i < group->first + group->count; i++) {
+		const struct flashchip *chip = &flashchips[index->entries[i].chip];
+		if (chip_probeable(mst, chip) && (!first || chip < first))
+			first = chip;
+	}
+	if (!first)
+		return 1;
+
+	flash->chip = calloc(1, sizeof(*flash->chip));
+	if (!flash->chip) {
+		msg_gerr("Out of memory!\n");
+		return 1;
+	}
+	*flash->chip = *first;
+	flash->mst = mst;
+
+	int ret = map_flash(flash);
+	if (!ret)
+		ret = spi_read_probe_ids(flash, first->probe, id1, id2);
+	unmap_flash(flash);
+	free(flash->chip);
+	flash->chip = NULL;
+	return ret;
+}
+
+static void add_matches(const struct probe_index *index, const struct probe_key *key, int startchip,
+			size_t *chips, size_t *count)
+{
+	const struct probe_bucket *bucket = lookup(index, key);
+	if (!bucket)
+		return;
+
+	for (size_t i = bucket->first; i < bucket->first + bucket->count; i++) {
+		if (index->entries[i].chip >= (size_t)startchip)
+			chips[(*count)++] = index->entries[i].chip;
+	}
+}
+
+/*
+ * Returns the positions in flashchips[], starting from startchip, that are
+ * worth probing on this master, in ascending order. Chips of an indexed group
+ * are only included if the IDs read from the bus can match them; probing them
+ * afterwards uses the cached answer and doesn't touch the bus again.
+ */
+int probe_index_collect(struct flashctx *flash, struct registered_master *mst,
+			int startchip, size_t **chips, size_t *count)
+{
+	/* Each programmer has its own index, so that they can probe in parallel. */
+	struct flashrom_programmer *const prog = programmer_of_master(mst);
+	if (!prog->probe_index)
+		prog->probe_index = build_index();
+	const struct probe_index *const index = prog->probe_index;
+	if (!index)
+		return 1;
+
+	/* Each ID command can add an exact, a vendor-only and an any-vendor match. */
+	size_t *const out = malloc((index->unindexed_count + 3 * index->entry_count) * sizeof(*out));
+	if (!out)
+		return 1;
+	size_t n = 0;
+
+	for (size_t i = 0; i < index->unindexed_count; i++) {
+		if (index->unindexed[i] >= (size_t)startchip)
+			out[n++] = index->unindexed[i];
+	}
+
+	for (size_t g = 0; g < ARRAY_SIZE(indexed_probes); g++) {
+		const struct probe_group *group = &index->groups[g];
+		uint32_t id1, id2;
+
+		if (!group->count || read_group_ids(flash, mst, index, group, &id1, &id2))
+			continue;
+
+		const struct probe_key exact = { indexed_probes[g], id1, id2 };
+		add_matches(index, &exact, startchip, out, &n);
+		if (!uses_compare_id(indexed_probes[g]))
+			continue;
+		const struct probe_key vendor = { indexed_probes[g], id1, GENERIC_DEVICE_ID };
+		add_matches(index, &vendor, startchip, out, &n);
+		if (id1 != 0xff && id1 != 0x00) {
+			const struct probe_key any = { indexed_probes[g], GENERIC_MANUF_ID, GENERIC_DEVICE_ID };
+			add_matches(index, &any, startchip, out, &n);
+		}
+	}
+
+	/* The lookups above overlap if the bus returned generic IDs. */
+	qsort(out, n, sizeof(*out), compare_chips);
+	size_t unique = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (!unique || out[unique - 1] != out[i])
+			out[unique++] = out[i];
+	}
+	*chips = out;
+	*count = unique;
+	return 0;
+}
@@ -5,24 +5,67 @@
  * SPDX-FileCopyrightText: 2009,2010,2011 Carl-Daniel Hailfinger
  */
 
+#include <stdlib.h>
+
 #include "flash.h"
 #include "programmer.h"
 
-/* The limit of 4 is totally arbitrary. */
-#define MASTERS_MAX 4
-struct registered_master registered_masters[MASTERS_MAX];
-int registered_master_count = 0;
+#if defined(__LIBPAYLOAD__) || defined(__DJGPP__)
+#define THREAD_LOCAL	/* single threaded */
+#else
+#define THREAD_LOCAL	__thread
+#endif
+
+static struct flashrom_programmer default_programmer;
+static THREAD_LOCAL struct flashrom_programmer *current_programmer;
+
+struct flashrom_programmer *programmer_current(void)
+{
+	return current_programmer ? current_programmer : &default_programmer;
+}
+
+void programmer_set_current(struct flashrom_programmer *prog)
+{
+	current_programmer = prog;
+}
+
+struct flashrom_programmer *programmer_new(void)
+{
+	return calloc(1, sizeof(struct flashrom_programmer));
+}
+
+void programmer_free(struct flashrom_programmer *prog)
+{
+	if (prog != &default_programmer)
+		free(prog);
+}
+
+struct flashrom_programmer *programmer_of_master(const struct registered_master *mst)
+{
+	/* Masters set up by hand, e.g. in tests, don't belong to a programmer. */
+	if (mst && mst->programmer)
+		return mst->programmer;
+	return programmer_current();
+}
+
+struct flashrom_programmer *programmer_of(const struct flashctx *flash)
+{
+	return programmer_of_master(flash->mst);
+}
 
 /* This function copies the struct registered_master parameter. */
 int register_master(const struct registered_master *mst)
 {
-	if (registered_master_count >= MASTERS_MAX) {
+	struct flashrom_programmer *const prog = programmer_current();
+
+	if (prog->master_count >= MASTERS_MAX) {
 		msg_perr("Tried to register more than %i master "
 			 "interfaces.\n", MASTERS_MAX);
 		return ERROR_FLASHROM_LIMIT;
 	}
-	registered_masters[registered_master_count] = *mst;
-	registered_master_count++;
+	prog->masters[prog->master_count] = *mst;
+	prog->masters[prog->master_count].programmer = prog;
+	prog->master_count++;
 
 	return 0;
 }
@@ -13,6 +13,8 @@
 #include <libusb.h>
 #include "flash.h"
 #include "programmer.h"
+#include "spi.h"
+#include "stats.h"
 #include "platform/udelay.h"
 
 /* LIBUSB_CALL ensures the right calling conventions on libusb callbacks.
@@ -65,6 +67,15 @@
 /* Number of parallel IN transfers. 32 seems to produce the most stable throughput on Windows. */
 #define USB_IN_TRANSFERS 32
 
+/* Bulk reads are split into transactions of CH341A_READ_CHUNK bytes. The command packets of up to
+ * CH341A_READ_QUEUE of them are queued, so that the device never waits for the host between them. */
+#define CH341A_READ_CHUNK	(16 * 1024)
+#define CH341A_READ_QUEUE	4
+/* CS packet, and an SPI stream command for every 31 bytes of opcode, address and data. */
+#define CH341A_READ_OUT_LEN	(CH341_PACKET_LENGTH + \
+	((1 + JEDEC_MAX_ADDR_LEN + CH341A_READ_CHUNK + CH341_PACKET_LENGTH - 2) / (CH341_PACKET_LENGTH - 1)) * \
+	CH341_PACKET_LENGTH)
+
 struct ch341a_spi_data {
 	struct libusb_device_handle *handle;
 
@@ -74,6 +85,12 @@ struct ch341a_spi_data {
 	struct libusb_transfer *transfer_out;
 	struct libusb_transfer *transfer_ins[USB_IN_TRANSFERS];
 
+	/* Bulk reads have an OUT transfer for each queued transaction and receive into bounce buffers,
+	 * as every transaction starts with the echo of its opcode and address. */
+	struct libusb_transfer *read_outs[CH341A_READ_QUEUE];
+	uint8_t read_out_bufs[CH341A_READ_QUEUE][CH341A_READ_OUT_LEN];
+	uint8_t read_in_bufs[USB_IN_TRANSFERS][CH341_PACKET_LENGTH - 1];
+
 	/* Accumulate delays to be plucked between CS deassertion and CS assertions. */
 	unsigned int stored_delay_us;
 };
@@ -375,6 +392,207 @@ static int ch341a_spi_spi_send_command(const struct flashctx *flash, unsigned in
 	return 0;
 }
 
+/* A bulk read and the position in the IN data of its transactions. */
+struct ch341a_bulk_read {
+	uint8_t *buf;
+	unsigned int start;
+	unsigned int len;
+	unsigned int hdr_len;	/* opcode and address, echoed before the data of each transaction */
+	unsigned int chunks;
+};
+
+struct ch341a_read_pos {
+	unsigned int chunk;
+	unsigned int offset;	/* into the transaction, including the header */
+};
+
+static unsigned int ch341a_read_chunk_len(const struct ch341a_bulk_read *rd, unsigned int chunk)
+{
+	return min(CH341A_READ_CHUNK, rd->len - chunk * CH341A_READ_CHUNK);
+}
+
+/* The device answers each SPI stream packet with one IN packet of the bytes it clocked in. */
+static unsigned int ch341a_read_packet_len(const struct ch341a_bulk_read *rd, const struct ch341a_read_pos *pos)
+{
+	const unsigned int total = rd->hdr_len + ch341a_read_chunk_len(rd, pos->chunk);
+	return min(CH341_PACKET_LENGTH - 1, total - pos->offset);
+}
+
+/* Moves pos past one IN packet, returns true if that completed a transaction. */
+static bool ch341a_read_advance(const struct ch341a_bulk_read *rd, struct ch341a_read_pos *pos)
+{
+	pos->offset += ch341a_read_packet_len(rd, pos);
+	if (pos->offset < rd->hdr_len + ch341a_read_chunk_len(rd, pos->chunk))
+		return false;
+	pos->chunk++;
+	pos->offset = 0;
+	return true;
+}
+
+/* Fills buf with the packets of the read transaction of chunk and returns their length. */
+static unsigned int ch341a_fill_read(struct ch341a_spi_data *data, const struct ch341a_bulk_read *rd,
+				     unsigned int chunk, uint8_t opcode, uint8_t *buf)
+{
+	const unsigned int addr = rd->start + chunk * CH341A_READ_CHUNK;
+	const unsigned int total = rd->hdr_len + ch341a_read_chunk_len(rd, chunk);
+	uint8_t hdr[1 + JEDEC_MAX_ADDR_LEN];
+	unsigned int i;
+
+	hdr[0] = opcode;
+	for (i = 1; i < rd->hdr_len; i++)
+		hdr[i] = (addr >> (8 * (rd->hdr_len - 1 - i))) & 0xff;
+
+	memset(buf, 0, CH341_PACKET_LENGTH);
+	pluck_cs(buf, &data->stored_delay_us);
+	uint8_t *ptr = buf + CH341_PACKET_LENGTH;
+	for (i = 0; i < total; i++) {
+		if (i % (CH341_PACKET_LENGTH - 1) == 0)
+			*ptr++ = CH341A_CMD_SPI_STREAM;
+		*ptr++ = i < rd->hdr_len ? reverse_byte(hdr[i]) : 0xFF;
+	}
+	return ptr - buf;
+}
+
+/*
+ * Read in transactions of CH341A_READ_CHUNK bytes. Unlike with ch341a_spi_spi_send_command(), the OUT
+ * transfers of the following transactions are queued while the IN data of the current one drains.
+ */
+static int ch341a_spi_read(struct flashctx *flash, uint8_t *buf, unsigned int start, unsigned int len)
+{
+	struct ch341a_spi_data *data = flash->mst->spi.data;
+	const bool native_4ba = flash->chip->feature_bits & FEATURE_4BA_READ;
+	const uint8_t opcode = native_4ba ? JEDEC_READ_4BA : JEDEC_READ;
+	unsigned int addr_len;
+
+	/* Leave the extended address register to spi_nbyte_read(). */
+	if (native_4ba || flash->in_4ba_mode)
+		addr_len = 4;
+	else if (!(flash->chip->feature_bits & FEATURE_4BA_EAR_ANY) && start + len <= 16 * MiB)
+		addr_len = 3;
+	else
+		return default_spi_read(flash, buf, start, len);
+
+	const struct ch341a_bulk_read rd = {
+		.buf		= buf,
+		.start		= start,
+		.len		= len,
+		.hdr_len	= 1 + addr_len,
+		.chunks		= (len + CH341A_READ_CHUNK - 1) / CH341A_READ_CHUNK,
+	};
+	int state_out[CH341A_READ_QUEUE] = {0};
+	int state_in[USB_IN_TRANSFERS] = {0};
+	uint64_t start_ns[CH341A_READ_QUEUE] = {0};
+	unsigned int out_next = 0; /* The next transaction to queue. */
+	unsigned int out_active = 0;
+	struct ch341a_read_pos in_next = {0}; /* The next IN packet to schedule a transfer for. */
+	struct ch341a_read_pos in_done = {0}; /* The next IN packet to be completed. */
+	unsigned int free_idx = 0;
+	unsigned int in_idx = 0;
+	unsigned int i;
+	int ret;
+
+	while (in_done.chunk < rd.chunks || out_active) {
+		/* Queue transactions as long as their OUT transfer is free. */
+		while (out_next < rd.chunks && out_next < in_done.chunk + CH341A_READ_QUEUE) {
+			const unsigned int slot = out_next % CH341A_READ_QUEUE;
+			struct libusb_transfer *const transfer = data->read_outs[slot];
+			if (state_out[slot] != TRANS_IDLE)
+				break;
+			transfer->length = ch341a_fill_read(data, &rd, out_next, opcode, transfer->buffer);
+			transfer->user_data = &state_out[slot];
+			start_ns[slot] = stats_start(flash);
+			ret = libusb_submit_transfer(transfer);
+			if (ret) {
+				msg_perr("%s: failed to submit OUT transfer: %s\n", __func__, libusb_error_name(ret));
+				goto err;
+			}
+			state_out[slot] = TRANS_ACTIVE;
+			out_active++;
+			out_next++;
+		}
+
+		/* Schedule reads for the packets of all queued transactions. */
+		while (in_next.chunk < out_next && state_in[free_idx] == TRANS_IDLE) {
+			struct libusb_transfer *const transfer = data->transfer_ins[free_idx];
+			transfer->length = ch341a_read_packet_len(&rd, &in_next);
+			transfer->buffer = data->read_in_bufs[free_idx];
+			transfer->user_data = &state_in[free_idx];
+			ret = libusb_submit_transfer(transfer);
+			if (ret) {
+				msg_perr("%s: failed to submit IN transfer: %s\n", __func__, libusb_error_name(ret));
+				goto err;
+			}
+			state_in[free_idx] = TRANS_ACTIVE;
+			ch341a_read_advance(&rd, &in_next);
+			free_idx = (free_idx + 1) % USB_IN_TRANSFERS;
+		}
+
+		libusb_handle_events_timeout(NULL, &(struct timeval){1, 0});
+
+		for (i = 0; i < CH341A_READ_QUEUE; i++) {
+			if (state_out[i] == TRANS_ERR)
+				goto err;
+			if (state_out[i] > 0) {
+				state_out[i] = TRANS_IDLE;
+				out_active--;
+			}
+		}
+
+		/* Copy the data of completed IN transfers in order, skipping the echoed headers. */
+		while (state_in[in_idx] != TRANS_IDLE && state_in[in_idx] != TRANS_ACTIVE) {
+			if (state_in[in_idx] == TRANS_ERR)
+				goto err;
+			const unsigned int chunk = in_done.chunk;
+			const unsigned int expected = ch341a_read_packet_len(&rd, &in_done);
+			if ((unsigned int)state_in[in_idx] != expected) {
+				msg_perr("%s: short IN transfer of %d bytes\n", __func__, state_in[in_idx]);
+				goto err;
+			}
+			for (i = 0; i < expected; i++) {
+				const unsigned int offset = in_done.offset + i;
+				if (offset >= rd.hdr_len)
+					rd.buf[chunk * CH341A_READ_CHUNK + offset - rd.hdr_len] =
+						reverse_byte(data->read_in_bufs[in_idx][i]);
+			}
+			state_in[in_idx] = TRANS_IDLE;
+			in_idx = (in_idx + 1) % USB_IN_TRANSFERS;
+			if (ch341a_read_advance(&rd, &in_done)) {
+				stats_count_command(flash, rd.hdr_len, ch341a_read_chunk_len(&rd, chunk), &opcode,
+						    start_ns[chunk % CH341A_READ_QUEUE]);
+				update_progress(flash, FLASHROM_PROGRESS_READ, ch341a_read_chunk_len(&rd, chunk));
+			}
+		}
+	}
+	return 0;
+err:
+	msg_perr("%s: Failed to read %u bytes at 0x%06x\n", __func__, len, start);
+	for (i = 0; i < CH341A_READ_QUEUE; i++) {
+		if (state_out[i] == TRANS_ACTIVE && libusb_cancel_transfer(data->read_outs[i]) != 0)
+			state_out[i] = TRANS_ERR;
+	}
+	for (i = 0; i < USB_IN_TRANSFERS; i++) {
+		if (state_in[i] == TRANS_ACTIVE && libusb_cancel_transfer(data->transfer_ins[i]) != 0)
+			state_in[i] = TRANS_ERR;
+	}
+
+	/* Wait for cancellations to complete. */
+	while (1) {
+		bool finished = true;
+		for (i = 0; i < CH341A_READ_QUEUE; i++) {
+			if (state_out[i] == TRANS_ACTIVE)
+				finished = false;
+		}
+		for (i = 0; i < USB_IN_TRANSFERS; i++) {
+			if (state_in[i] == TRANS_ACTIVE)
+				finished = false;
+		}
+		if (finished)
+			break;
+		libusb_handle_events_timeout(NULL, &(struct timeval){1, 0});
+	}
+	return -1;
+}
+
 static int ch341a_spi_shutdown(void *data)
 {
 	struct ch341a_spi_data *ch341a_data = data;
@@ -384,6 +602,8 @@ static int ch341a_spi_shutdown(void *data)
 	int i;
 	for (i = 0; i < USB_IN_TRANSFERS; i++)
 		libusb_free_transfer(ch341a_data->transfer_ins[i]);
+	for (i = 0; i < CH341A_READ_QUEUE; i++)
+		libusb_free_transfer(ch341a_data->read_outs[i]);
 	libusb_release_interface(ch341a_data->handle, 0);
 	libusb_attach_kernel_driver(ch341a_data->handle, 0);
 	libusb_close(ch341a_data->handle);
@@ -397,11 +617,12 @@ static const struct spi_master spi_master_ch341a_spi = {
 	.features	= SPI_MASTER_4BA,
 	/* flashrom's current maximum is 256 B. CH341A was tested on Linux and Windows to accept at least
 	 * 128 kB. Basically there should be no hard limit because transfers are broken up into USB packets
-	 * sent to the device and most of their payload streamed via SPI. */
+	 * sent to the device and most of their payload streamed via SPI. The limits apply to single
+	 * commands, whose packets are built on the stack; ch341a_spi_read() is not bound by them. */
 	.max_data_read	= 4 * 1024,
 	.max_data_write	= 4 * 1024,
 	.command	= ch341a_spi_spi_send_command,
-	.read		= default_spi_read,
+	.read		= ch341a_spi_read,
 	.write_256	= default_spi_write_256,
 	.shutdown	= ch341a_spi_shutdown,
 	.delay		= ch341a_spi_delay,
@@ -479,10 +700,20 @@ static int ch341a_spi_init(const struct programmer_cfg *cfg)
 			goto dealloc_transfers;
 		}
 	}
+	for (i = 0; i < CH341A_READ_QUEUE; i++) {
+		data->read_outs[i] = libusb_alloc_transfer(0);
+		if (data->read_outs[i] == NULL) {
+			msg_perr("Failed to alloc libusb OUT transfer %d\n", i);
+			goto dealloc_transfers;
+		}
+	}
 	/* We use these helpers but dont fill the actual buffer yet. */
 	libusb_fill_bulk_transfer(data->transfer_out, data->handle, WRITE_EP, NULL, 0, cb_out, NULL, USB_TIMEOUT);
 	for (i = 0; i < USB_IN_TRANSFERS; i++)
 		libusb_fill_bulk_transfer(data->transfer_ins[i], data->handle, READ_EP, NULL, 0, cb_in, NULL, USB_TIMEOUT);
+	for (i = 0; i < CH341A_READ_QUEUE; i++)
+		libusb_fill_bulk_transfer(data->read_outs[i], data->handle, WRITE_EP, data->read_out_bufs[i], 0,
+					  cb_out, NULL, USB_TIMEOUT);
 
 	if ((config_stream(data, CH341A_STM_I2C_100K) < 0) || (enable_pins(data, true) < 0))
 		goto dealloc_transfers;
@@ -490,6 +721,11 @@ static int ch341a_spi_init(const struct programmer_cfg *cfg)
 	return register_spi_master(&spi_master_ch341a_spi, data);
 
 dealloc_transfers:
+	for (i = 0; i < CH341A_READ_QUEUE; i++) {
+		if (data->read_outs[i] == NULL)
+			break;
+		libusb_free_transfer(data->read_outs[i]);
+	}
 	for (i = 0; i < USB_IN_TRANSFERS; i++) {
 		if (data->transfer_ins[i] == NULL)
 			break;
@@ -208,9 +208,19 @@ static void LIBUSB_CALL dediprog_bulk_read_cb(struct libusb_transfer *const tran
 	++status->finished_idx;
 }
 
-static int dediprog_bulk_read_poll(struct libusb_context *usb_ctx,
-				   const struct dediprog_transfer_status *const status,
-				   const int finish)
+static void LIBUSB_CALL dediprog_bulk_write_cb(struct libusb_transfer *const transfer)
+{
+	struct dediprog_transfer_status *const status = (struct dediprog_transfer_status *)transfer->user_data;
+	if (transfer->status != LIBUSB_TRANSFER_COMPLETED || transfer->actual_length != transfer->length) {
+		status->error = 1;
+		msg_perr("SPI bulk write failed!\n");
+	}
+	++status->finished_idx;
+}
+
+static int dediprog_bulk_poll(struct libusb_context *usb_ctx,
+			      const struct dediprog_transfer_status *const status,
+			      const int finish)
 {
 	if (status->finished_idx >= status->queued_idx)
 		return 0;
@@ -219,13 +229,48 @@ static int dediprog_bulk_read_poll(struct libusb_context *usb_ctx,
 		struct timeval timeout = { 10, 0 };
 		const int ret = libusb_handle_events_timeout(usb_ctx, &timeout);
 		if (ret < 0) {
-			msg_perr("Polling read events failed: %i %s!\n", ret, libusb_error_name(ret));
+			msg_perr("Polling bulk transfer events failed: %i %s!\n", ret, libusb_error_name(ret));
 			return 1;
 		}
 	} while (finish && (status->finished_idx < status->queued_idx));
 	return 0;
 }
 
+/*
+ * Bulk transfers always cover whole chunks. A range that starts or ends in the
+ * middle of a chunk is widened to the chunks around it, only the requested
+ * span of those edge chunks is copied from/to the caller's buffer.
+ */
+struct dediprog_bulk_range {
+	unsigned int start;	/* requested range */
+	unsigned int len;
+	unsigned int chunksize;
+	unsigned int first;	/* address of the first chunk */
+	unsigned int count;	/* number of chunks */
+};
+
+static void dediprog_bulk_range_init(struct dediprog_bulk_range *range,
+				     unsigned int start, unsigned int len, unsigned int chunksize)
+{
+	range->start = start;
+	range->len = len;
+	range->chunksize = chunksize;
+	range->first = start / chunksize * chunksize;
+	range->count = (start + len - range->first + chunksize - 1) / chunksize;
+}
+
+/* Returns how many requested bytes chunk i holds, and at which offset in the chunk. */
+static unsigned int dediprog_bulk_span(const struct dediprog_bulk_range *range, unsigned int i,
+				       unsigned int *offset)
+{
+	const unsigned int addr = range->first + i * range->chunksize;
+	const unsigned int from = MAX(addr, range->start);
+	const unsigned int to = MIN(addr + range->chunksize, range->start + range->len);
+
+	*offset = from - addr;
+	return to - from;
+}
+
 static int dediprog_read(libusb_device_handle *dediprog_handle,
 			 enum dediprog_cmds cmd, unsigned int value, unsigned int idx,
 			 uint8_t *bytes, size_t size)
@@ -429,6 +474,7 @@ static int prepare_rw_cmd(
 }
 
 /* Bulk read interface, will read multiple 512 byte chunks aligned to 512 bytes.
+ * An unaligned start or end is read as a whole chunk into a bounce buffer.
  * @start	start address
  * @len		length
  * @return	0 on success, 1 on failure
@@ -440,7 +486,10 @@ static int dediprog_spi_bulk_read(struct flashctx *flash, uint8_t *buf, unsigned
 
 	/* chunksize must be 512, other sizes will NOT work at all. */
 	const unsigned int chunksize = 512;
-	const unsigned int count = len / chunksize;
+	struct dediprog_bulk_range range;
+	/* First and last chunk, if they are only partially requested. */
+	unsigned char edges[2][512];
+	unsigned int offset, span;
 
 	struct dediprog_transfer_status status = { 0, 0, 0 };
 	struct libusb_transfer *transfers[DEDIPROG_ASYNC_TRANSFERS] = { NULL, };
@@ -449,11 +498,11 @@ static int dediprog_spi_bulk_read(struct flashctx *flash, uint8_t *buf, unsigned
 	if (len == 0)
 		return 0;
 
-	if ((start % chunksize) || (len % chunksize)) {
-		msg_perr("%s: Unaligned start=%i, len=%i! Please report a bug at flashrom@flashrom.org\n",
-			 __func__, start, len);
-		return 1;
-	}
+	dediprog_bulk_range_init(&range, start, len, chunksize);
+	if (range.first != start || range.count * chunksize != len)
+		msg_pdbg("Reading partial chunks of 0x%x bytes at 0x%x as 0x%x bytes at 0x%x\n",
+			 len, start, range.count * chunksize, range.first);
+	const unsigned int count = range.count;
 
 	int command_packet_size;
 	switch (protocol(dp_data)) {
@@ -472,7 +521,7 @@ static int dediprog_spi_bulk_read(struct flashctx *flash, uint8_t *buf, unsigned
 
 	uint8_t data_packet[command_packet_size];
 	unsigned int value, idx;
-	if (prepare_rw_cmd(flash, data_packet, count, READ_MODE_STD, &value, &idx, start, 1))
+	if (prepare_rw_cmd(flash, data_packet, count, READ_MODE_STD, &value, &idx, range.first, 1))
 		return 1;
 
 	int ret = dediprog_write(dp_data->handle, CMD_READ, value, idx, data_packet, sizeof(data_packet));
@@ -502,9 +551,16 @@ static int dediprog_spi_bulk_read(struct flashctx *flash, uint8_t *buf, unsigned
 		while ((status.queued_idx < count) &&
 		       (status.queued_idx - status.finished_idx) < DEDIPROG_ASYNC_TRANSFERS)
 		{
+			unsigned char *dest;
+			span = dediprog_bulk_span(&range, status.queued_idx, &offset);
+			if (span == chunksize)
+				dest = buf + (range.first + status.queued_idx * chunksize - start);
+			else
+				dest = edges[status.queued_idx ? 1 : 0];
+
 			transfer = transfers[status.queued_idx % DEDIPROG_ASYNC_TRANSFERS];
 			libusb_fill_bulk_transfer(transfer, dp_data->handle, 0x80 | dp_data->in_endpoint,
-					(unsigned char *)buf + status.queued_idx * chunksize, chunksize,
+					dest, chunksize,
 					dediprog_bulk_read_cb, &status, DEFAULT_TIMEOUT);
 			transfer->flags |= LIBUSB_TRANSFER_SHORT_NOT_OK;
 			ret = libusb_submit_transfer(transfer);
@@ -515,20 +571,28 @@ static int dediprog_spi_bulk_read(struct flashctx *flash, uint8_t *buf, unsigned
 			}
 			++status.queued_idx;
 		}
-		if (dediprog_bulk_read_poll(dp_data->usb_ctx, &status, 0))
+		if (dediprog_bulk_poll(dp_data->usb_ctx, &status, 0))
 			goto err_free;
 	}
 	/* Wait for transfers to finish. */
-	if (dediprog_bulk_read_poll(dp_data->usb_ctx, &status, 1))
+	if (dediprog_bulk_poll(dp_data->usb_ctx, &status, 1))
 		goto err_free;
 	/* Check if everything has been transmitted. */
 	if ((status.finished_idx < count) || status.error)
 		goto err_free;
 
+	/* Copy the requested parts of the edge chunks. */
+	span = dediprog_bulk_span(&range, 0, &offset);
+	if (span != chunksize)
+		memcpy(buf, edges[0] + offset, span);
+	span = dediprog_bulk_span(&range, count - 1, &offset);
+	if (count > 1 && span != chunksize)
+		memcpy(buf + len - span, edges[1], span);
+
 	err = 0;
 
 err_free:
-	dediprog_bulk_read_poll(dp_data->usb_ctx, &status, 1);
+	dediprog_bulk_poll(dp_data->usb_ctx, &status, 1);
 	for (i = 0; i < DEDIPROG_ASYNC_TRANSFERS; ++i)
 		if (transfers[i]) libusb_free_transfer(transfers[i]);
 	return err;
@@ -536,47 +600,23 @@ err_free:
 
 static int dediprog_spi_read(struct flashctx *flash, uint8_t *buf, unsigned int start, unsigned int len)
 {
-	int ret;
-	/* chunksize must be 512, other sizes will NOT work at all. */
-	const unsigned int chunksize = 0x200;
-	unsigned int residue = start % chunksize ? min(len, chunksize - start % chunksize) : 0;
-	unsigned int bulklen;
 	const struct dediprog_data *dp_data = flash->mst->spi.data;
 
 	dediprog_set_leds(LED_BUSY, dp_data);
 
-	if (residue) {
-		msg_pdbg("Slow read for partial block from 0x%x, length 0x%x\n",
-			 start, residue);
-		ret = default_spi_read(flash, buf, start, residue);
-		if (ret)
-			goto err;
-	}
-
-	/* Round down. */
-	bulklen = (len - residue) / chunksize * chunksize;
-	ret = dediprog_spi_bulk_read(flash, buf + residue, start + residue, bulklen);
-	if (ret)
-		goto err;
-
-	len -= residue + bulklen;
-	if (len != 0) {
-		msg_pdbg("Slow read for partial block from 0x%x, length 0x%x\n",
-			 start, len);
-		ret = default_spi_read(flash, buf + residue + bulklen,
-				       start + residue + bulklen, len);
-		if (ret)
-			goto err;
+	const int ret = dediprog_spi_bulk_read(flash, buf, start, len);
+	if (ret) {
+		dediprog_set_leds(LED_ERROR, dp_data);
+		return ret;
 	}
 
 	dediprog_set_leds(LED_PASS, dp_data);
 	return 0;
-err:
-	dediprog_set_leds(LED_ERROR, dp_data);
-	return ret;
 }
 
 /* Bulk write interface, will write multiple chunksize byte chunks aligned to chunksize bytes.
+ * An unaligned start or end is written as a whole chunk padded with 0xff. Programming 0xff
+ * leaves a flash byte as it is, so the bytes around the requested range keep their contents.
  * @chunksize       length of data chunks, only 256 supported by now
  * @start           start address
  * @len             length
@@ -590,8 +630,16 @@ static int dediprog_spi_bulk_write(struct flashctx *flash, const uint8_t *buf, u
 	 * chunksize is the real data size per USB bulk transfer. The remaining
 	 * space in a USB bulk transfer must be filled with 0xff padding.
 	 */
-	const unsigned int count = len / chunksize;
+	int err = 1;
 	const struct dediprog_data *dp_data = flash->mst->spi.data;
+	struct dediprog_bulk_range range;
+	unsigned int offset, span;
+
+	struct dediprog_transfer_status status = { 0, 0, 0 };
+	struct libusb_transfer *transfers[DEDIPROG_ASYNC_TRANSFERS] = { NULL, };
+	struct libusb_transfer *transfer;
+	/* A transfer's buffer must stay untouched until it finished. */
+	unsigned char usbbufs[DEDIPROG_ASYNC_TRANSFERS][512];
 
 	/*
 	 * We should change this check to
@@ -604,16 +652,16 @@ static int dediprog_spi_bulk_write(struct flashctx *flash, const uint8_t *buf, u
 		return 1;
 	}
 
-	if ((start % chunksize) || (len % chunksize)) {
-		msg_perr("%s: Unaligned start=%i, len=%i! Please report a bug "
-			 "at flashrom@flashrom.org\n", __func__, start, len);
-		return 1;
-	}
-
 	/* No idea if the hardware can handle empty writes, so chicken out. */
 	if (len == 0)
 		return 0;
 
+	dediprog_bulk_range_init(&range, start, len, chunksize);
+	if (range.first != start || range.count * chunksize != len)
+		msg_pdbg("Writing partial pages of 0x%x bytes at 0x%x as 0x%x bytes at 0x%x\n",
+			 len, start, range.count * chunksize, range.first);
+	const unsigned int count = range.count;
+
 	int command_packet_size;
 	switch (protocol(dp_data)) {
 	case PROTOCOL_V1:
@@ -631,7 +679,7 @@ static int dediprog_spi_bulk_write(struct flashctx *flash, const uint8_t *buf, u
 
 	uint8_t data_packet[command_packet_size];
 	unsigned int value, idx;
-	if (prepare_rw_cmd(flash, data_packet, count, dedi_spi_cmd, &value, &idx, start, 0))
+	if (prepare_rw_cmd(flash, data_packet, count, dedi_spi_cmd, &value, &idx, range.first, 0))
 		return 1;
 	int ret = dediprog_write(dp_data->handle, CMD_WRITE, value, idx, data_packet, sizeof(data_packet));
 	if (ret != (int)sizeof(data_packet)) {
@@ -639,22 +687,54 @@ static int dediprog_spi_bulk_write(struct flashctx *flash, const uint8_t *buf, u
 		return 1;
 	}
 
+	/* Same ring buffer of bulk transfers as for reads. */
 	unsigned int i;
-	for (i = 0; i < count; i++) {
-		unsigned char usbbuf[512];
-		memcpy(usbbuf, buf + i * chunksize, chunksize);
-		memset(usbbuf + chunksize, 0xff, sizeof(usbbuf) - chunksize); // fill up with 0xFF
-		int transferred;
-		ret = libusb_bulk_transfer(dp_data->handle, dp_data->out_endpoint, usbbuf, 512, &transferred,
-					   DEFAULT_TIMEOUT);
-		if ((ret < 0) || (transferred != 512)) {
-			msg_perr("SPI bulk write failed, expected %i, got %s!\n", 512, libusb_error_name(ret));
-			return 1;
+	for (i = 0; i < MIN(DEDIPROG_ASYNC_TRANSFERS, count); ++i) {
+		transfers[i] = libusb_alloc_transfer(0);
+		if (!transfers[i]) {
+			msg_perr("Allocating libusb transfer %i failed!\n", i);
+			goto err_free;
 		}
-		update_progress(flash, FLASHROM_PROGRESS_WRITE, chunksize);
 	}
 
-	return 0;
+	unsigned int reported = 0;
+	while (!status.error && (status.finished_idx < count)) {
+		while ((status.queued_idx < count) &&
+		       (status.queued_idx - status.finished_idx) < DEDIPROG_ASYNC_TRANSFERS)
+		{
+			unsigned char *const usbbuf = usbbufs[status.queued_idx % DEDIPROG_ASYNC_TRANSFERS];
+			span = dediprog_bulk_span(&range, status.queued_idx, &offset);
+			memset(usbbuf, 0xff, sizeof(usbbufs[0]));
+			memcpy(usbbuf + offset, buf + (range.first + status.queued_idx * chunksize + offset - start),
+			       span);
+
+			transfer = transfers[status.queued_idx % DEDIPROG_ASYNC_TRANSFERS];
+			libusb_fill_bulk_transfer(transfer, dp_data->handle, dp_data->out_endpoint,
+					usbbuf, sizeof(usbbufs[0]),
+					dediprog_bulk_write_cb, &status, DEFAULT_TIMEOUT);
+			ret = libusb_submit_transfer(transfer);
+			if (ret < 0) {
+				msg_perr("Submitting SPI bulk write %i failed: %s!\n",
+					 status.queued_idx, libusb_error_name(ret));
+				goto err_free;
+			}
+			++status.queued_idx;
+		}
+		if (dediprog_bulk_poll(dp_data->usb_ctx, &status, 0))
+			goto err_free;
+		for (; reported < status.finished_idx; reported++)
+			update_progress(flash, FLASHROM_PROGRESS_WRITE, dediprog_bulk_span(&range, reported, &offset));
+	}
+	if (status.error)
+		goto err_free;
+
+	err = 0;
+
+err_free:
+	dediprog_bulk_poll(dp_data->usb_ctx, &status, 1);
+	for (i = 0; i < DEDIPROG_ASYNC_TRANSFERS; ++i)
+		if (transfers[i]) libusb_free_transfer(transfers[i]);
+	return err;
 }
 
 static int dediprog_spi_write(struct flashctx *flash, const uint8_t *buf,
@@ -662,7 +742,7 @@ static int dediprog_spi_write(struct flashctx *flash, const uint8_t *buf,
 {
 	int ret;
 	const unsigned int chunksize = flash->chip->page_size;
-	unsigned int residue = start % chunksize ? chunksize - start % chunksize : 0;
+	unsigned int residue = 0;
 	unsigned int bulklen;
 	const struct dediprog_data *dp_data = flash->mst->spi.data;
 
@@ -673,6 +753,9 @@ static int dediprog_spi_write(struct flashctx *flash, const uint8_t *buf,
 			 "we don't know how dediprog\nhandles them.\n");
 		/* Write everything like it was residue. */
 		residue = len;
+	} else if (dedi_spi_cmd != WRITE_MODE_PAGE_PGM && start % chunksize) {
+		/* Partial pages are padded for page programs only, AAI is untested with that. */
+		residue = min(len, chunksize - start % chunksize);
 	}
 
 	if (residue) {
@@ -686,12 +769,17 @@ static int dediprog_spi_write(struct flashctx *flash, const uint8_t *buf,
 		}
 	}
 
-	/* Round down. */
-	bulklen = (len - residue) / chunksize * chunksize;
-	ret = dediprog_spi_bulk_write(flash, buf + residue, chunksize, start + residue, bulklen, dedi_spi_cmd);
-	if (ret) {
-		dediprog_set_leds(LED_ERROR, dp_data);
-		return ret;
+	if (dedi_spi_cmd == WRITE_MODE_PAGE_PGM)
+		bulklen = len - residue;
+	else /* Round down. */
+		bulklen = (len - residue) / chunksize * chunksize;
+	if (bulklen) {
+		ret = dediprog_spi_bulk_write(flash, buf + residue, chunksize, start + residue, bulklen,
+					      dedi_spi_cmd);
+		if (ret) {
+			dediprog_set_leds(LED_ERROR, dp_data);
+			return ret;
+		}
 	}
 
 	len -= residue + bulklen;
@@ -12,15 +12,26 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include "chipdrivers.h"
 #include "programmer.h"
 #include "flashchips.h"
 #include "spi.h"
+#include "stats.h"
 #include "writeprotect.h"
 #include "platform/udelay.h"
 
+#if !defined(__LIBPAYLOAD__) && !defined(__DJGPP__) && !IS_WINDOWS
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#define HAVE_IMAGE_MMAP 1
+#else
+#define HAVE_IMAGE_MMAP 0
+#endif
+
 enum emu_chip {
 	EMULATE_NONE,
 	EMULATE_ST_M25P10_RES,
@@ -32,6 +43,27 @@ enum emu_chip {
 	EMULATE_VARIABLE_SIZE,
 };
 
+/* Times in us the emulated chip stays busy after a command. */
+struct emu_timing {
+	unsigned int byte_program_us;
+	unsigned int page_program_us;	/* 256 bytes, shorter programs are interpolated */
+	unsigned int wrsr_us;
+	unsigned int se_us;		/* JEDEC_SE */
+	unsigned int be_52_us;
+	unsigned int be_d8_us;
+	unsigned int ce_us;		/* JEDEC_CE_60 and JEDEC_CE_C7 */
+};
+
+/* Typical times from the datasheets of the emulated chips. */
+static const struct emu_timing emu_timings[] = {
+	[EMULATE_ST_M25P10_RES]		= { 400, 1400, 5000, 0, 0, 650000, 1000000 },
+	[EMULATE_SST_SST25VF040_REMS]	= { 14, 14, 0, 18000, 18000, 0, 70000 },
+	[EMULATE_SST_SST25VF032B]	= { 7, 7, 0, 18000, 18000, 18000, 35000 },
+	[EMULATE_MACRONIX_MX25L6436]	= { 9, 1400, 40000, 40000, 200000, 400000, 50000000 },
+	[EMULATE_WINBOND_W25Q128FV]	= { 30, 700, 10000, 45000, 120000, 150000, 40000000 },
+	[EMULATE_SPANSION_S25FL128L]	= { 60, 450, 2000, 50000, 200000, 270000, 55000000 },
+};
+
 struct emu_data {
 	enum emu_chip emu_chip;
 	char *emu_persistent_image;
@@ -43,11 +75,16 @@ struct emu_data {
 	bool emu_wrsr_ext3;
 	bool erase_to_zero;
 	bool emu_modified;	/* is the image modified since reading it? */
+	bool image_mapped;	/* flashchip_contents is a shared mapping of the image */
 	uint8_t emu_status[3];
 	uint8_t emu_status_len;	/* number of emulated status registers */
 	/* If "freq" parameter is passed in from command line, commands will delay
 	 * for this period before returning. */
 	unsigned long long delay_ns;
+	/* With timing=yes, program, erase and WRSR keep WIP set for these times. */
+	bool timed;
+	struct emu_timing timing;
+	uint64_t busy_until_ns;
 	unsigned int emu_max_byteprogram_size;
 	unsigned int emu_max_aai_size;
 	unsigned int emu_jedec_se_size;
@@ -66,6 +103,8 @@ struct emu_data {
 	uint32_t wp_end;
 
 	unsigned int spi_write_256_chunksize;
+	/* Data lines of the emulated bus, multi-I/O reads need 2 or 4. */
+	unsigned int spi_io_width;
 	uint8_t *flashchip_contents;
 
 	/* An instance of this structure is shared between multiple masters, so
@@ -349,6 +388,28 @@ static bool is_write_protected(const struct emu_data *data, uint32_t start, uint
 	return (start < data->wp_end && last >= data->wp_start);
 }
 
+static bool is_busy(const struct emu_data *data)
+{
+	return data->busy_until_ns && stats_time_ns() < data->busy_until_ns;
+}
+
+/* Sets WIP for the next `us` microseconds. */
+static void set_busy(struct emu_data *data, unsigned int us)
+{
+	if (data->timed && us)
+		data->busy_until_ns = stats_time_ns() + (uint64_t)us * 1000;
+}
+
+static unsigned int program_time_us(const struct emu_data *data, unsigned int len)
+{
+	const struct emu_timing *const t = &data->timing;
+
+	if (len <= 1 || t->page_program_us <= t->byte_program_us)
+		return t->byte_program_us;
+	len = min(len, 256);
+	return t->byte_program_us + (len - 1) * (t->page_program_us - t->byte_program_us) / 255;
+}
+
 /* Returns non-zero on error. */
 static int write_flash_data(struct emu_data *data, uint32_t start, uint32_t len, const uint8_t *buf)
 {
@@ -414,6 +475,13 @@ static int emulate_spi_chip_response(unsigned int writecnt,
 		}
 	}
 
+	/* A busy chip only answers status register reads. */
+	if (is_busy(data) && writearr[0] != JEDEC_RDSR &&
+	    writearr[0] != JEDEC_RDSR2 && writearr[0] != JEDEC_RDSR3) {
+		msg_perr("Opcode 0x%02x ignored, the chip is busy!\n", writearr[0]);
+		return 0;
+	}
+
 	if (data->emu_max_aai_size && (data->emu_status[0] & SPI_SR_AAI)) {
 		if (writearr[0] != JEDEC_AAI_WORD_PROGRAM &&
 		    writearr[0] != JEDEC_WRDI &&
@@ -538,7 +606,7 @@ static int emulate_spi_chip_response(unsigned int writecnt,
 		}
 		break;
 	case JEDEC_RDSR:
-		memset(readarr, data->emu_status[0], readcnt);
+		memset(readarr, data->emu_status[0] | (is_busy(data) ? SPI_SR_WIP : 0), readcnt);
 		break;
 	case JEDEC_RDSR2:
 		if (data->emu_status_len >= 2)
@@ -562,8 +630,6 @@ static int emulate_spi_chip_response(unsigned int writecnt,
 		wrsr_ext2 = (writecnt == 3 && data->emu_wrsr_ext2);
 		wrsr_ext3 = (writecnt == 4 && data->emu_wrsr_ext3);
 
-		/* FIXME: add some reasonable simulation of the busy flag */
-
 		ro_bits = get_reg_ro_bit_mask(data, STATUS1);
 		data->emu_status[0] &= ro_bits;
 		data->emu_status[0] |= writearr[1] & ~ro_bits;
@@ -586,6 +652,7 @@ static int emulate_spi_chip_response(unsigned int writecnt,
 			msg_pdbg2("WRSR wrote 0x%02x.\n", data->emu_status[0]);
 
 		update_write_protection(data);
+		set_busy(data, data->timing.wrsr_us);
 		break;
 	case JEDEC_WRSR2:
 		if (data->emu_status_len < 2)
@@ -602,6 +669,7 @@ static int emulate_spi_chip_response(unsigned int writecnt,
 		msg_pdbg2("WRSR2 wrote 0x%02x.\n", data->emu_status[1]);
 
 		update_write_protection(data);
+		set_busy(data, data->timing.wrsr_us);
 		break;
 	case JEDEC_WRSR3:
 		if (data->emu_status_len < 3)
@@ -616,6 +684,7 @@ static int emulate_spi_chip_response(unsigned int writecnt,
 		data->emu_status[2] |= (writearr[1] & ~ro_bits);
 
 		msg_pdbg2("WRSR3 wrote 0x%02x.\n", data->emu_status[2]);
+		set_busy(data, data->timing.wrsr_us);
 		break;
 	case JEDEC_READ:
 		offs = writearr[1] << 16 | writearr[2] << 8 | writearr[3];
@@ -647,6 +716,7 @@ static int emulate_spi_chip_response(unsigned int writecnt,
 			msg_perr("Failed to program flash!\n");
 			return 1;
 		}
+		set_busy(data, program_time_us(data, writecnt - 4));
 		break;
 	case JEDEC_BYTE_PROGRAM_4BA:
 		offs = writearr[1] << 24 | writearr[2] << 16 | writearr[3] << 8 | writearr[4];
@@ -664,6 +734,7 @@ static int emulate_spi_chip_response(unsigned int writecnt,
 			msg_perr("Failed to program flash!\n");
 			return 1;
 		}
+		set_busy(data, program_time_us(data, writecnt - 5));
 		break;
 	case JEDEC_AAI_WORD_PROGRAM:
 		if (!data->emu_max_aai_size)
@@ -706,6 +777,7 @@ static int emulate_spi_chip_response(unsigned int writecnt,
 			}
 			aai_offs += 2;
 		}
+		set_busy(data, program_time_us(data, 2));
 		break;
 	case JEDEC_WRDI:
 		if (data->emu_max_aai_size)
@@ -730,6 +802,7 @@ static int emulate_spi_chip_response(unsigned int writecnt,
 			msg_perr("Failed to erase flash!\n");
 			return 1;
 		}
+		set_busy(data, data->timing.se_us);
 		break;
 	case JEDEC_BE_52:
 		if (!data->emu_jedec_be_52_size)
@@ -750,6 +823,7 @@ static int emulate_spi_chip_response(unsigned int writecnt,
 			msg_perr("Failed to erase flash!\n");
 			return 1;
 		}
+		set_busy(data, data->timing.be_52_us);
 		break;
 	case JEDEC_BE_D8:
 		if (!data->emu_jedec_be_d8_size)
@@ -770,6 +844,7 @@ static int emulate_spi_chip_response(unsigned int writecnt,
 			msg_perr("Failed to erase flash!\n");
 			return 1;
 		}
+		set_busy(data, data->timing.be_d8_us);
 		break;
 	case JEDEC_CE_60:
 		if (!data->emu_jedec_ce_60_size)
@@ -788,6 +863,7 @@ static int emulate_spi_chip_response(unsigned int writecnt,
 			msg_perr("Failed to erase flash!\n");
 			return 1;
 		}
+		set_busy(data, data->timing.ce_us);
 		break;
 	case JEDEC_CE_C7:
 		if (!data->emu_jedec_ce_c7_size)
@@ -806,6 +882,7 @@ static int emulate_spi_chip_response(unsigned int writecnt,
 			msg_perr("Failed to erase flash!\n");
 			return 1;
 		}
+		set_busy(data, data->timing.ce_us);
 		break;
 	case JEDEC_SFDP:
 		if (data->emu_chip != EMULATE_MACRONIX_MX25L6436)
@@ -869,6 +946,9 @@ static int dummy_spi_send_command(const struct flashctx *flash, unsigned int wri
 	for (i = 0; i < writecnt; i++)
 		msg_pspew(" 0x%02x", writearr[i]);
 
+	/* The chip only starts programming or erasing once the command was clocked in. */
+	default_delay(((writecnt + readcnt) * emu_data->delay_ns) / 1000);
+
 	/* Response for unknown commands and missing chip is 0xff. */
 	memset(readarr, 0xff, readcnt);
 	switch (emu_data->emu_chip) {
@@ -892,11 +972,88 @@ static int dummy_spi_send_command(const struct flashctx *flash, unsigned int wri
 	for (i = 0; i < readcnt; i++)
 		msg_pspew(" 0x%02x", readarr[i]);
 	msg_pspew("\n");
+	return 0;
+}
 
-	default_delay(((writecnt + readcnt) * emu_data->delay_ns) / 1000);
+/*
+ * Clocks between the address and the data of the multi-I/O fast reads the
+ * emulated chips know, the mode clocks included.
+ */
+static int dummy_fast_read_clocks(uint8_t opcode)
+{
+	switch (opcode) {
+	case JEDEC_READ_FAST_DOUT:
+	case JEDEC_READ_FAST_QOUT:
+		return 8;
+	case JEDEC_READ_FAST_DIO:
+		return 4;
+	case JEDEC_READ_FAST_QIO:
+		return 6;
+	default:
+		return -1;
+	}
+}
+
+static int dummy_spi_read_multi_io(const struct spi_command *cmd, struct emu_data *emu_data)
+{
+	const unsigned int addr_lines = spi_io_addr_lines(cmd->io_mode);
+	const unsigned int data_lines = spi_io_data_lines(cmd->io_mode);
+	const int clocks = dummy_fast_read_clocks(cmd->writearr[0]);
+
+	if (data_lines > emu_data->spi_io_width) {
+		msg_perr("%s: %u data lines, but the bus has only %u\n", __func__,
+			 data_lines, emu_data->spi_io_width);
+		return SPI_INVALID_OPCODE;
+	}
+	/* Only 3-byte addresses, the mode and dummy bytes follow them. */
+	if (clocks < 0 || cmd->writecnt < JEDEC_READ_OUTSIZE ||
+	    (cmd->writecnt - JEDEC_READ_OUTSIZE) * 8 / addr_lines + cmd->dummy_cycles != (unsigned int)clocks) {
+		msg_perr("%s: invalid fast read 0x%02x with %u bytes and %u dummy clocks\n", __func__,
+			 cmd->writearr[0], cmd->writecnt, cmd->dummy_cycles);
+		return SPI_INVALID_OPCODE;
+	}
+	if (is_busy(emu_data)) {
+		msg_perr("%s: fast read 0x%02x ignored, the chip is busy!\n", __func__, cmd->writearr[0]);
+		memset(cmd->readarr, 0xff, cmd->readcnt);
+		return 0;
+	}
+	if (data_lines == 4 && emu_data->emu_chip == EMULATE_WINBOND_W25Q128FV &&
+	    !(emu_data->emu_status[1] & (1 << 1))) {
+		msg_perr("%s: quad read with QE cleared\n", __func__);
+		return SPI_INVALID_OPCODE;
+	}
+
+	const unsigned int offs = (cmd->writearr[1] << 16 | cmd->writearr[2] << 8 | cmd->writearr[3]) %
+				  emu_data->emu_chip_size;
+	msg_pspew("%s: 0x%02x at 0x%06x, %u bytes on %u-%u-%u\n", __func__, cmd->writearr[0],
+		  offs, cmd->readcnt, 1, addr_lines, data_lines);
+	for (unsigned int i = 0; i < cmd->readcnt; i++)
+		cmd->readarr[i] = emu_data->flashchip_contents[(offs + i) % emu_data->emu_chip_size];
+
+	/* delay_ns is per byte on a single line, charge the clocks actually needed. */
+	const unsigned long long bus_clocks = 8 + (cmd->writecnt - 1) * 8 / addr_lines + cmd->dummy_cycles +
+					      cmd->readcnt * 8 / data_lines;
+	default_delay((bus_clocks * emu_data->delay_ns / 8) / 1000);
 	return 0;
 }
 
+static int dummy_spi_send_multicommand(const struct flashctx *flash, struct spi_command *cmds)
+{
+	struct emu_data *emu_data = flash->mst->spi.data;
+	int ret = 0;
+
+	for (; (cmds->writecnt || cmds->readcnt) && !ret; cmds++) {
+		if (cmds->io_mode == SPI_IO_1_1_1 && !cmds->dummy_cycles)
+			ret = dummy_spi_send_command(flash, cmds->writecnt, cmds->readcnt,
+						     cmds->writearr, cmds->readarr);
+		else if (emu_data->emu_chip != EMULATE_NONE)
+			ret = dummy_spi_read_multi_io(cmds, emu_data);
+		else
+			ret = SPI_INVALID_OPCODE;
+	}
+	return ret;
+}
+
 static int dummy_shutdown(void *data)
 {
 	msg_pspew("%s\n", __func__);
@@ -907,14 +1064,21 @@ static int dummy_shutdown(void *data)
 		return 0;
 
 	if (emu_data->emu_chip != EMULATE_NONE) {
-		if (emu_data->emu_persistent_image && emu_data->emu_modified) {
-			msg_pdbg("Writing %s\n", emu_data->emu_persistent_image);
-			write_buf_to_file(emu_data->flashchip_contents,
-					  emu_data->emu_chip_size,
-					  emu_data->emu_persistent_image);
+		if (emu_data->image_mapped) {
+			/* Changes went to the image file already. */
+#if HAVE_IMAGE_MMAP
+			(void)munmap(emu_data->flashchip_contents, emu_data->emu_chip_size);
+#endif
+		} else {
+			if (emu_data->emu_persistent_image && emu_data->emu_modified) {
+				msg_pdbg("Writing %s\n", emu_data->emu_persistent_image);
+				write_buf_to_file(emu_data->flashchip_contents,
+						  emu_data->emu_chip_size,
+						  emu_data->emu_persistent_image);
+			}
+			free(emu_data->flashchip_contents);
 		}
 		free(emu_data->emu_persistent_image);
-		free(emu_data->flashchip_contents);
 	}
 	free(data);
 	return 0;
@@ -924,6 +1088,15 @@ static void dummy_nop_delay(const struct flashctx *flash, unsigned int usecs)
 {
 }
 
+static void dummy_spi_delay(const struct flashctx *flash, unsigned int usecs)
+{
+	const struct emu_data *emu_data = flash->mst->spi.data;
+
+	/* Only the timing model makes the chip busy, there's nothing to wait for otherwise. */
+	if (emu_data->timed)
+		default_delay(usecs);
+}
+
 static enum flashrom_wp_result dummy_wp_read_cfg(struct flashrom_wp_cfg *cfg, struct flashctx *flash)
 {
 	cfg->mode = FLASHROM_WP_MODE_DISABLED;
@@ -958,11 +1131,12 @@ static const struct spi_master spi_master_dummyflasher = {
 	.max_data_read	= MAX_DATA_READ_UNLIMITED,
 	.max_data_write	= MAX_DATA_UNSPECIFIED,
 	.command	= dummy_spi_send_command,
+	.multicommand	= dummy_spi_send_multicommand,
 	.read		= default_spi_read,
 	.write_256	= dummy_spi_write_256,
 	.shutdown	= dummy_shutdown,
 	.probe_opcode	= dummy_spi_probe_opcode,
-	.delay		= dummy_nop_delay,
+	.delay		= dummy_spi_delay,
 };
 
 static const struct par_master par_master_dummyflasher = {
@@ -1000,7 +1174,7 @@ static int init_data(const struct programmer_cfg *cfg,
 	unsigned int i;
 	char *endptr;
 	char *status = NULL;
-	int size = -1;  /* size for VARIABLE_SIZE chip device */
+	unsigned long long size = 0;  /* size for VARIABLE_SIZE chip device */
 
 	bustext = extract_programmer_param_str(cfg, "bus");
 	msg_pdbg("Requested buses are: %s\n", bustext ? bustext : "default");
@@ -1045,6 +1219,18 @@ static int init_data(const struct programmer_cfg *cfg,
 	}
 	free(tmp);
 
+	tmp = extract_programmer_param_str(cfg, "spi_io_width");
+	if (tmp) {
+		data->spi_io_width = strtoul(tmp, &endptr, 0);
+		if (*endptr != '\0' || (data->spi_io_width != 1 && data->spi_io_width != 2 &&
+					data->spi_io_width != 4)) {
+			msg_perr("invalid spi_io_width, must be 1, 2 or 4\n");
+			free(tmp);
+			return 1;
+		}
+	}
+	free(tmp);
+
 	tmp = extract_programmer_param_str(cfg, "spi_blacklist");
 	if (tmp) {
 		i = strlen(tmp);
@@ -1170,8 +1356,8 @@ static int init_data(const struct programmer_cfg *cfg,
 
 	tmp = extract_programmer_param_str(cfg, "size");
 	if (tmp) {
-		size = strtol(tmp, NULL, 10);
-		if (size <= 0 || (size % 1024 != 0)) {
+		size = strtoull(tmp, NULL, 10);
+		if (size == 0 || (size % 1024 != 0) || size > UINT_MAX) {
 			msg_perr("%s: Chip size is not a multiple of 1024: %s\n",
 					 __func__, tmp);
 			free(tmp);
@@ -1197,7 +1383,7 @@ static int init_data(const struct programmer_cfg *cfg,
 
 	tmp = extract_programmer_param_str(cfg, "emulate");
 	if (!tmp) {
-		if (size != -1) {
+		if (size) {
 			msg_perr("%s: size parameter is only valid for VARIABLE_SIZE chip.\n", __func__);
 			return 1;
 		}
@@ -1296,16 +1482,16 @@ static int init_data(const struct programmer_cfg *cfg,
 	 *   flashrom -p dummy:emulate=VARIABLE_SIZE,size=4194304
 	 */
 	if (!strcmp(tmp, "VARIABLE_SIZE")) {
-		if (size == -1) {
+		if (!size) {
 			msg_perr("%s: the size parameter is not given.\n", __func__);
 			free(tmp);
 			return 1;
 		}
 		data->emu_chip = EMULATE_VARIABLE_SIZE;
 		data->emu_chip_size = size;
-		msg_pdbg("Emulating generic SPI flash chip (size=%d bytes)\n",
+		msg_pdbg("Emulating generic SPI flash chip (size=%u bytes)\n",
 		         data->emu_chip_size);
-	} else if (size != -1) {
+	} else if (size) {
 		msg_perr("%s: size parameter is only valid for VARIABLE_SIZE chip.\n", __func__);
 		free(tmp);
 		return 1;
@@ -1339,6 +1525,48 @@ static int init_data(const struct programmer_cfg *cfg,
 	}
 	free(tmp);
 
+	/* Should emulated SPI chips take as long as real ones (yes/no)? */
+	tmp = extract_programmer_param_str(cfg, "timing");
+	if (tmp) {
+		if (!strcmp(tmp, "yes")) {
+			data->timed = true;
+		} else if (strcmp(tmp, "no")) {
+			msg_perr("timing can be \"yes\" or \"no\"\n");
+			free(tmp);
+			return 1;
+		}
+	}
+	free(tmp);
+
+	/* Percentage of the datasheet times the timing model uses. */
+	unsigned long timing_scale = 100;
+	tmp = extract_programmer_param_str(cfg, "timing_scale");
+	if (tmp) {
+		timing_scale = strtoul(tmp, &endptr, 0);
+		if (*endptr != '\0' || timing_scale > 1000 || !data->timed) {
+			msg_perr("timing_scale must be a percentage up to 1000 and needs timing=yes\n");
+			free(tmp);
+			return 1;
+		}
+	}
+	free(tmp);
+
+	if (data->timed && data->emu_chip < ARRAY_SIZE(emu_timings)) {
+		const struct emu_timing *const t = &emu_timings[data->emu_chip];
+		data->timing.byte_program_us = t->byte_program_us * timing_scale / 100;
+		data->timing.page_program_us = t->page_program_us * timing_scale / 100;
+		data->timing.wrsr_us = t->wrsr_us * timing_scale / 100;
+		data->timing.se_us = t->se_us * timing_scale / 100;
+		data->timing.be_52_us = t->be_52_us * timing_scale / 100;
+		data->timing.be_d8_us = t->be_d8_us * timing_scale / 100;
+		data->timing.ce_us = (unsigned long long)t->ce_us * timing_scale / 100;
+		/* Without a bus clock, assume a common SPI clock of 50 MHz. */
+		if (!data->delay_ns)
+			data->delay_ns = (1000000000ull * 8) / 50000000;
+		msg_pdbg("Emulating chip timing at %lu%% of the typical times, page program %u us, "
+			 "chip erase %u us\n", timing_scale, data->timing.page_program_us, data->timing.ce_us);
+	}
+
 	status = extract_programmer_param_str(cfg, "spi_status");
 	if (status) {
 		unsigned int emu_status;
@@ -1374,13 +1602,39 @@ static int init_data(const struct programmer_cfg *cfg,
 		}
 	}
 
-	data->flashchip_contents = malloc(data->emu_chip_size);
-	if (!data->flashchip_contents) {
-		msg_perr("Out of memory!\n");
+	return 0;
+}
+
+/* Maps the persistent image if it matches the emulated chip. Returns 1 if it should be read instead. */
+static int map_image(struct emu_data *data)
+{
+#if HAVE_IMAGE_MMAP
+	const int fd = open(data->emu_persistent_image, O_RDWR);
+	if (fd < 0)
+		return 1;
+
+	struct stat image_stat;
+	if (fstat(fd, &image_stat) != 0 || !S_ISREG(image_stat.st_mode) ||
+	    (uintmax_t)image_stat.st_size != data->emu_chip_size) {
+		(void)close(fd);
 		return 1;
 	}
 
+	/* Shared, so the chip contents are the file: nothing to read now or to write at shutdown. */
+	void *const buf = mmap(NULL, data->emu_chip_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	(void)close(fd);
+	if (buf == MAP_FAILED) {
+		msg_pdbg("Mapping %s failed (%s), reading it instead.\n",
+			 data->emu_persistent_image, strerror(errno));
+		return 1;
+	}
+	msg_pdbg("Mapped persistent image %s\n", data->emu_persistent_image);
+	data->flashchip_contents = buf;
+	data->image_mapped = true;
 	return 0;
+#else
+	return 1;
+#endif
 }
 
 static int dummy_init(const struct programmer_cfg *cfg)
@@ -1396,6 +1650,7 @@ static int dummy_init(const struct programmer_cfg *cfg)
 	data->emu_chip = EMULATE_NONE;
 	data->delay_ns = 0;
 	data->spi_write_256_chunksize = 256;
+	data->spi_io_width = 1;
 
 	msg_pspew("%s\n", __func__);
 
@@ -1411,12 +1666,22 @@ static int dummy_init(const struct programmer_cfg *cfg)
 		goto dummy_init_out;
 	}
 
-	msg_pdbg("Filling fake flash chip with 0x%02x, size %i\n",
+	/* Will be freed by shutdown function if necessary. */
+	data->emu_persistent_image = extract_programmer_param_str(cfg, "image");
+	if (data->emu_persistent_image && !map_image(data))
+		goto dummy_init_out;
+
+	data->flashchip_contents = malloc(data->emu_chip_size);
+	if (!data->flashchip_contents) {
+		msg_perr("Out of memory!\n");
+		free(data->emu_persistent_image);
+		free(data);
+		return 1;
+	}
+	msg_pdbg("Filling fake flash chip with 0x%02x, size %u\n",
 			data->erase_to_zero ? 0x00 : 0xff, data->emu_chip_size);
 	memset(data->flashchip_contents, data->erase_to_zero ? 0x00 : 0xff, data->emu_chip_size);
 
-	/* Will be freed by shutdown function if necessary. */
-	data->emu_persistent_image = extract_programmer_param_str(cfg, "image");
 	if (!data->emu_persistent_image) {
 		/* Nothing else to do. */
 		goto dummy_init_out;
@@ -1454,8 +1719,14 @@ dummy_init_out:
 					   data);
 	}
 	if ((dummy_buses_supported & BUS_SPI) && !ret) {
+		struct spi_master mst = spi_master_dummyflasher;
+		/* Odd wait states on the address lines are clocked individually. */
+		if (data->spi_io_width >= 2)
+			mst.features |= SPI_MASTER_DUAL_OUT | SPI_MASTER_DUAL_IO | SPI_MASTER_DUMMY_CYCLES;
+		if (data->spi_io_width >= 4)
+			mst.features |= SPI_MASTER_QUAD_OUT | SPI_MASTER_QUAD_IO;
 		data->refs_cnt++;
-		ret |= register_spi_master(&spi_master_dummyflasher, data);
+		ret |= register_spi_master(&mst, data);
 	}
 
 	return ret;
@@ -12,8 +12,10 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include "chipdrivers.h"
 #include "programmer.h"
 #include "spi.h"
+#include "stats.h"
 #include <ftdi.h>
 
 /* This is not defined in libftdi.h <0.20 (c7e4c09e68cfa6f5e112334aa1b3bb23401c8dc7 to be exact).
@@ -75,6 +77,15 @@ static const struct dev_entry devs_ft2232spi[] = {
 
 #define FTDI_HW_BUFFER_SIZE 4096 /* in bytes */
 
+/*
+ * In async mode, reads are split into batches of FT2232_ASYNC_READ_CHUNK
+ * bytes and the commands of FT2232_ASYNC_BATCHES of them are kept in flight,
+ * so that the chip works on the next batch while the host receives the data
+ * of the current one.
+ */
+#define FT2232_ASYNC_READ_CHUNK	(16 * 1024)
+#define FT2232_ASYNC_BATCHES	2
+
 #define DEFAULT_DIVISOR 2
 
 #define BITMODE_BITBANG_NORMAL	1
@@ -111,6 +122,10 @@ struct ft2232_data {
 	uint8_t cs_bits;
 	uint8_t aux_bits;
 	uint8_t pindir;
+	/* Overlap the USB transfers of reads and page programs, see ft2232_spi_read(). */
+	bool async;
+	/* SPI clock in kHz if the chip can clock without data (H chips only), 0 otherwise. */
+	unsigned int idle_clock_khz;
 	struct ftdi_context ftdic_context;
 };
 
@@ -167,6 +182,37 @@ static int get_buf(struct ftdi_context *ftdic, const unsigned char *buf,
 	return 0;
 }
 
+static struct ftdi_transfer_control *submit_buf(struct ftdi_context *ftdic, const unsigned char *buf, int size)
+{
+	struct ftdi_transfer_control *tc;
+	tc = ftdi_write_data_submit(ftdic, (unsigned char *) buf, size);
+	if (!tc)
+		msg_perr("ftdi_write_data_submit: %s\n", ftdi_get_error_string(ftdic));
+	return tc;
+}
+
+static struct ftdi_transfer_control *submit_get_buf(struct ftdi_context *ftdic, unsigned char *buf, int size)
+{
+	struct ftdi_transfer_control *tc;
+	tc = ftdi_read_data_submit(ftdic, buf, size);
+	if (!tc)
+		msg_perr("ftdi_read_data_submit: %s\n", ftdi_get_error_string(ftdic));
+	return tc;
+}
+
+/* Waits for a submitted transfer, which is freed afterwards. */
+static int transfer_done(struct ftdi_context *ftdic, struct ftdi_transfer_control *tc, int size)
+{
+	int r;
+	r = ftdi_transfer_data_done(tc);
+	if (r != size) {
+		msg_perr("ftdi_transfer_data_done: %d, %s\n", r,
+				ftdi_get_error_string(ftdic));
+		return 1;
+	}
+	return 0;
+}
+
 static int ft2232_shutdown(void *data)
 {
 	struct ft2232_data *spi_data = (struct ft2232_data *) data;
@@ -207,6 +253,43 @@ static bool ft2232_spi_command_fits(const struct spi_command *cmd, size_t buffer
 		<= buffer_size;
 }
 
+/* Packs the MPSSE commands for one SPI command into buf and returns their length. */
+static size_t ft2232_spi_pack_command(const struct ft2232_data *spi_data, unsigned char *buf,
+				      const struct spi_command *cmd)
+{
+	size_t i = 0;
+
+	msg_pspew("Assert CS#\n");
+	buf[i++] = SET_BITS_LOW;
+	/* assert CS# pins, keep aux_bits, all other output pins stay low */
+	buf[i++] = spi_data->aux_bits;
+	buf[i++] = spi_data->pindir;
+
+	/* WREN, OP(PROGRAM, ERASE), ADDR, DATA */
+	if (cmd->writecnt) {
+		buf[i++] = MPSSE_DO_WRITE | MPSSE_WRITE_NEG;
+		buf[i++] = (cmd->writecnt - 1) & 0xff;
+		buf[i++] = ((cmd->writecnt - 1) >> 8) & 0xff;
+		memcpy(buf + i, cmd->writearr, cmd->writecnt);
+		i += cmd->writecnt;
+	}
+
+	/* An optional read command */
+	if (cmd->readcnt) {
+		buf[i++] = MPSSE_DO_READ;
+		buf[i++] = (cmd->readcnt - 1) & 0xff;
+		buf[i++] = ((cmd->readcnt - 1) >> 8) & 0xff;
+	}
+
+	/* Add final de-assert CS# */
+	msg_pspew("De-assert CS#\n");
+	buf[i++] = SET_BITS_LOW;
+	buf[i++] = spi_data->cs_bits | spi_data->aux_bits;
+	buf[i++] = spi_data->pindir;
+
+	return i;
+}
+
 /* Returns 0 upon success, a negative number upon errors. */
 static int ft2232_spi_send_multicommand(const struct flashctx *flash, struct spi_command *cmds)
 {
@@ -229,33 +312,7 @@ static int ft2232_spi_send_multicommand(const struct flashctx *flash, struct spi
 			return SPI_GENERIC_ERROR;
 		}
 
-		msg_pspew("Assert CS#\n");
-		buf[i++] = SET_BITS_LOW;
-		/* assert CS# pins, keep aux_bits, all other output pins stay low */
-		buf[i++] = spi_data->aux_bits;
-		buf[i++] = spi_data->pindir;
-
-		/* WREN, OP(PROGRAM, ERASE), ADDR, DATA */
-		if (cmds->writecnt) {
-			buf[i++] = MPSSE_DO_WRITE | MPSSE_WRITE_NEG;
-			buf[i++] = (cmds->writecnt - 1) & 0xff;
-			buf[i++] = ((cmds->writecnt - 1) >> 8) & 0xff;
-			memcpy(buf + i, cmds->writearr, cmds->writecnt);
-			i += cmds->writecnt;
-		}
-
-		/* An optional read command */
-		if (cmds->readcnt) {
-			buf[i++] = MPSSE_DO_READ;
-			buf[i++] = (cmds->readcnt - 1) & 0xff;
-			buf[i++] = ((cmds->readcnt - 1) >> 8) & 0xff;
-		}
-
-		/* Add final de-assert CS# */
-		msg_pspew("De-assert CS#\n");
-		buf[i++] = SET_BITS_LOW;
-		buf[i++] = spi_data->cs_bits | spi_data->aux_bits;
-		buf[i++] = spi_data->pindir;
+		i += ft2232_spi_pack_command(spi_data, buf + i, cmds);
 
 		/* continue if there is no read-cmd and further cmds exist */
 		if (!cmds->readcnt &&
@@ -282,13 +339,205 @@ static int ft2232_spi_send_multicommand(const struct flashctx *flash, struct spi
 	return ret ? -1 : 0;
 }
 
+/* Address length for a read or program up to `end`, 0 if it needs the extended address register. */
+static unsigned int ft2232_spi_addr_len(const struct flashctx *flash, bool native_4ba, unsigned int end)
+{
+	if (native_4ba || flash->in_4ba_mode)
+		return 4;
+	if (flash->chip->feature_bits & FEATURE_4BA_EAR_ANY || end > 16 * MiB)
+		return 0;
+	return 3;
+}
+
+static void ft2232_spi_put_addr(uint8_t *buf, unsigned int addr_len, unsigned int addr)
+{
+	unsigned int i;
+	for (i = 0; i < addr_len; i++)
+		buf[i] = (addr >> (8 * (addr_len - 1 - i))) & 0xff;
+}
+
+/*
+ * Read in batches, with the commands of the next ones already submitted while
+ * the data of the current one is received. libftdi receives into one buffer
+ * per context, so only a single read transfer is submitted at a time.
+ */
+static int ft2232_spi_read(struct flashctx *flash, uint8_t *buf, unsigned int start, unsigned int len)
+{
+	struct ft2232_data *spi_data = flash->mst->spi.data;
+	struct ftdi_context *ftdic = &spi_data->ftdic_context;
+	const bool native_4ba = flash->chip->feature_bits & FEATURE_4BA_READ;
+	const unsigned int addr_len = ft2232_spi_addr_len(flash, native_4ba, start + len);
+
+	if (!spi_data->async || !addr_len)
+		return default_spi_read(flash, buf, start, len);
+
+	const uint8_t opcode = native_4ba ? JEDEC_READ_4BA : JEDEC_READ;
+	const unsigned int batches = (len + FT2232_ASYNC_READ_CHUNK - 1) / FT2232_ASYNC_READ_CHUNK;
+	struct ftdi_transfer_control *cmd_tc[FT2232_ASYNC_BATCHES] = { NULL };
+	unsigned char cmd_buf[FT2232_ASYNC_BATCHES][3 + 3 + 1 + JEDEC_MAX_ADDR_LEN + 3 + 3];
+	int cmd_len[FT2232_ASYNC_BATCHES];
+	uint64_t start_ns[FT2232_ASYNC_BATCHES];
+	unsigned int queued = 0, done = 0;
+	unsigned int i;
+	int ret = 0;
+
+	while (!ret && done < batches) {
+		/* Keep the commands of FT2232_ASYNC_BATCHES batches in flight. */
+		while (queued < batches && queued < done + FT2232_ASYNC_BATCHES) {
+			const unsigned int slot = queued % FT2232_ASYNC_BATCHES;
+			const unsigned int addr = start + queued * FT2232_ASYNC_READ_CHUNK;
+			uint8_t writearr[1 + JEDEC_MAX_ADDR_LEN] = { opcode };
+			const struct spi_command cmd = {
+				.writecnt	= 1 + addr_len,
+				.writearr	= writearr,
+				.readcnt	= min(FT2232_ASYNC_READ_CHUNK, len - queued * FT2232_ASYNC_READ_CHUNK),
+			};
+			ft2232_spi_put_addr(writearr + 1, addr_len, addr);
+			cmd_len[slot] = ft2232_spi_pack_command(spi_data, cmd_buf[slot], &cmd);
+			start_ns[slot] = stats_start(flash);
+			cmd_tc[slot] = submit_buf(ftdic, cmd_buf[slot], cmd_len[slot]);
+			if (!cmd_tc[slot]) {
+				ret = 1;
+				break;
+			}
+			queued++;
+		}
+		if (ret)
+			break;
+
+		const unsigned int slot = done % FT2232_ASYNC_BATCHES;
+		const unsigned int to_read = min(FT2232_ASYNC_READ_CHUNK, len - done * FT2232_ASYNC_READ_CHUNK);
+		struct ftdi_transfer_control *const tc = submit_get_buf(ftdic, buf + done * FT2232_ASYNC_READ_CHUNK,
+									to_read);
+		if (!tc || transfer_done(ftdic, tc, to_read)) {
+			ret = 1;
+			break;
+		}
+		ret = transfer_done(ftdic, cmd_tc[slot], cmd_len[slot]);
+		cmd_tc[slot] = NULL;
+		stats_count_command(flash, 1 + addr_len, to_read, &opcode, start_ns[slot]);
+		update_progress(flash, FLASHROM_PROGRESS_READ, to_read);
+		done++;
+	}
+
+	/* Don't leave submitted commands behind on errors. */
+	for (i = 0; i < FT2232_ASYNC_BATCHES; i++) {
+		if (cmd_tc[i])
+			ftdi_transfer_data_done(cmd_tc[i]);
+	}
+	if (ret)
+		msg_perr("%s: failed to read %u bytes at 0x%06x\n", __func__, len, start);
+	return ret;
+}
+
+/* Appends commands that clock for about `us` with CS# deasserted, returns their length. */
+static size_t ft2232_spi_pack_idle(const struct ft2232_data *spi_data, unsigned char *buf, unsigned int us)
+{
+	/* Each byte is 8 clocks, a single command clocks 65536 bytes at most. */
+	const uint64_t clocks = (uint64_t)us * spi_data->idle_clock_khz / 8000;
+	const unsigned int bytes = clocks > 65536 ? 65536 : clocks;
+
+	if (!bytes)
+		return 0;
+	buf[0] = CLK_BYTES;
+	buf[1] = (bytes - 1) & 0xff;
+	buf[2] = ((bytes - 1) >> 8) & 0xff;
+	return 3;
+}
+
+/*
+ * Program one chunk in a single submission: WREN, the program command, clocks
+ * for the typical program time and the first WIP poll. Only if the chip is
+ * slower than typical, spi_poll_wip() takes over.
+ */
+static int ft2232_spi_program(struct flashctx *flash, uint8_t op, unsigned int addr_len,
+			      unsigned int addr, const uint8_t *bytes, unsigned int len)
+{
+	struct ft2232_data *spi_data = flash->mst->spi.data;
+	struct ftdi_context *ftdic = &spi_data->ftdic_context;
+	/* WREN, program, idle clocks and RDSR, each command with CS# (de-)assertion. */
+	unsigned char buf[(3 + 3 + 1 + 3) + (3 + 3 + 1 + JEDEC_MAX_ADDR_LEN + 256 + 3) + 3 + (3 + 3 + 1 + 3 + 3)];
+	uint8_t cmd[1 + JEDEC_MAX_ADDR_LEN + 256] = { op };
+	uint8_t status;
+	const struct spi_command cmds[] = {
+	{
+		.writecnt	= 1,
+		.writearr	= (const unsigned char[]){ JEDEC_WREN },
+	}, {
+		.writecnt	= 1 + addr_len + len,
+		.writearr	= cmd,
+	}, {
+		.writecnt	= 1,
+		.writearr	= (const unsigned char[]){ JEDEC_RDSR },
+		.readcnt	= 1,
+		.readarr	= &status,
+	},
+		NULL_SPI_CMD,
+	};
+	size_t i = 0;
+
+	ft2232_spi_put_addr(cmd + 1, addr_len, addr);
+	memcpy(cmd + 1 + addr_len, bytes, len);
+	i += ft2232_spi_pack_command(spi_data, buf + i, &cmds[0]);
+	i += ft2232_spi_pack_command(spi_data, buf + i, &cmds[1]);
+	i += ft2232_spi_pack_idle(spi_data, buf + i, spi_chip_typ_busy_us(flash, op, len));
+	i += ft2232_spi_pack_command(spi_data, buf + i, &cmds[2]);
+
+	const uint64_t start_ns = stats_start(flash);
+	struct ftdi_transfer_control *const write_tc = submit_buf(ftdic, buf, i);
+	if (!write_tc)
+		return 1;
+	struct ftdi_transfer_control *const read_tc = submit_get_buf(ftdic, &status, 1);
+	int ret = !read_tc || transfer_done(ftdic, read_tc, 1);
+	ret |= transfer_done(ftdic, write_tc, i);
+	if (ret) {
+		msg_perr("%s: failed to program %u bytes at 0x%06x\n", __func__, len, addr);
+		return ret;
+	}
+	stats_count_multicommand(flash, cmds, start_ns);
+	stats_count_wip_poll(flash);
+
+	if (!(status & SPI_SR_WIP)) {
+		stats_count_busy(flash, op, start_ns);
+		return 0;
+	}
+	/* As spi_nbyte_program() does. */
+	return spi_poll_wip(flash, op, len, 10, 100 * 1000);
+}
+
+static int ft2232_spi_write_256(struct flashctx *flash, const uint8_t *buf, unsigned int start, unsigned int len)
+{
+	struct ft2232_data *spi_data = flash->mst->spi.data;
+	const bool native_4ba = flash->chip->feature_bits & FEATURE_4BA_WRITE;
+	const unsigned int addr_len = ft2232_spi_addr_len(flash, native_4ba, start + len);
+
+	if (!spi_data->async || !addr_len)
+		return default_spi_write_256(flash, buf, start, len);
+
+	const uint8_t op = native_4ba ? JEDEC_BYTE_PROGRAM_4BA : JEDEC_BYTE_PROGRAM;
+	const unsigned int page_size = flash->chip->page_size;
+	const unsigned int end = start + len;
+	unsigned int addr, towrite;
+
+	/* Split as spi_write_chunked() does. */
+	for (addr = start; addr < end; addr += towrite) {
+		const unsigned int page_end = min(end, (addr / page_size + 1) * page_size);
+		towrite = min(flash->mst->spi.max_data_write, page_end - addr);
+		const int ret = ft2232_spi_program(flash, op, addr_len, addr, buf + addr - start, towrite);
+		if (ret)
+			return ret;
+		update_progress(flash, FLASHROM_PROGRESS_WRITE, towrite);
+	}
+	return 0;
+}
+
 static const struct spi_master spi_master_ft2232 = {
 	.features	= SPI_MASTER_4BA,
 	.max_data_read	= 64 * 1024,
 	.max_data_write	= 256,
 	.multicommand	= ft2232_spi_send_multicommand,
-	.read		= default_spi_read,
-	.write_256	= default_spi_write_256,
+	.read		= ft2232_spi_read,
+	.write_256	= ft2232_spi_write_256,
 	.shutdown	= ft2232_shutdown,
 };
 
@@ -469,6 +718,20 @@ static int ft2232_spi_init(const struct programmer_cfg *cfg)
 	}
 	free(arg);
 
+	bool async = false;
+	arg = extract_programmer_param_str(cfg, "async");
+	if (arg) {
+		if (!strcasecmp(arg, "on")) {
+			async = true;
+		} else if (strcasecmp(arg, "off")) {
+			msg_perr("Error: Invalid async mode specified: \"%s\".\n"
+				 "Valid are on and off.\n", arg);
+			free(arg);
+			return -2;
+		}
+	}
+	free(arg);
+
 	arg = extract_programmer_param_str(cfg, "divisor");
 	if (arg && strlen(arg)) {
 		unsigned int temp = 0;
@@ -682,6 +945,10 @@ format_error:
 	spi_data->cs_bits = cs_bits;
 	spi_data->aux_bits = aux_bits;
 	spi_data->pindir = pindir;
+	spi_data->async = async;
+	/* Clocking without data transfer is only available on the H chips. */
+	if (clock_5x)
+		spi_data->idle_clock_khz = mpsse_clk * 1000 / divisor;
 	spi_data->ftdic_context = ftdic;
 
 	return register_spi_master(&spi_master_ft2232, spi_data);
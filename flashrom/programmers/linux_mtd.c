@@ -9,6 +9,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,15 +25,23 @@
 #define LINUX_DEV_ROOT			"/dev"
 #define LINUX_MTD_SYSFS_ROOT		"/sys/class/mtd"
 
+/*
+ * Reads and writes are issued in spans of this size (or one eraseblock, if
+ * that is larger), aligned to it. mtdchar splits them up as the driver needs.
+ */
+#define LINUX_MTD_IO_SIZE		(1 * MiB)
+
 struct linux_mtd_data {
-	FILE *dev_fp;
+	int dev_fd;
 	bool device_is_writeable;
 	bool no_erase;
 	/* Size info is presented in bytes in sysfs. */
 	unsigned long int total_size;
 	unsigned long int numeraseregions;
-	/* only valid if numeraseregions is 0 */
+	/* largest eraseblock size, the only one if numeraseregions is 0 */
 	unsigned long int erasesize;
+	/* only valid if numeraseregions is not 0, sorted by offset */
+	struct region_info_user regions[NUM_ERASEREGIONS];
 };
 
 /* read a string from a sysfs file and sanitize it */
@@ -136,8 +145,8 @@ static int get_mtd_info(const char *sysfs_path, struct linux_mtd_data *data)
 	/* Total size */
 	if (read_sysfs_int(sysfs_path, "size", &data->total_size))
 		return 1;
-	if (popcnt(data->total_size) != 1) {
-		msg_perr("MTD size is not a power of 2\n");
+	if (!data->total_size || data->total_size % 1024) {
+		msg_perr("MTD size is not a multiple of 1 KiB\n");
 		return 1;
 	}
 
@@ -149,11 +158,16 @@ static int get_mtd_info(const char *sysfs_path, struct linux_mtd_data *data)
 		return 1;
 	}
 
-	/* Erase regions */
+	/* Erase regions, their layout is read with MEMGETREGIONINFO once the device is open. */
 	if (read_sysfs_int(sysfs_path, "numeraseregions", &data->numeraseregions))
 		return 1;
-	if (data->numeraseregions != 0) {
-		msg_perr("Non-uniform eraseblock size is unsupported.\n");
+	if (data->numeraseregions > NUM_ERASEREGIONS) {
+		msg_perr("MTD has %lu erase regions, at most %d are supported.\n",
+			 data->numeraseregions, NUM_ERASEREGIONS);
+		return 1;
+	}
+	if (!data->numeraseregions && data->total_size % data->erasesize) {
+		msg_perr("MTD size is not a multiple of the erase size\n");
 		return 1;
 	}
 
@@ -165,102 +179,162 @@ static int get_mtd_info(const char *sysfs_path, struct linux_mtd_data *data)
 	return 0;
 }
 
+/* Size of the eraseblock at `offset`. */
+static unsigned long int linux_mtd_block_size(const struct linux_mtd_data *data, unsigned long int offset)
+{
+	for (unsigned long int i = 0; i < data->numeraseregions; i++) {
+		const struct region_info_user *region = &data->regions[i];
+		if (offset < (unsigned long int)region->offset + region->erasesize * region->numblocks)
+			return region->erasesize;
+	}
+	return data->erasesize;
+}
+
 static int linux_mtd_probe(struct flashctx *flash)
 {
 	struct linux_mtd_data *data = flash->mst->opaque.data;
+	struct flashchip *chip = flash->chip;
 
 	if (data->no_erase)
-		flash->chip->feature_bits |= FEATURE_NO_ERASE;
-	flash->chip->tested = TEST_OK_PREWB;
-	flash->chip->total_size = data->total_size / 1024;	/* bytes -> kB */
-	flash->chip->block_erasers[0].eraseblocks[0].size = data->erasesize;
-	flash->chip->block_erasers[0].eraseblocks[0].count =
-		data->total_size / data->erasesize;
+		chip->feature_bits |= FEATURE_NO_ERASE;
+	chip->tested = TEST_OK_PREWB;
+	chip->total_size = data->total_size / 1024;	/* bytes -> kB */
+
+	struct block_eraser *eraser = &chip->block_erasers[0];
+	if (data->numeraseregions) {
+		for (unsigned long int i = 0; i < data->numeraseregions; i++) {
+			eraser->eraseblocks[i].size = data->regions[i].erasesize;
+			eraser->eraseblocks[i].count = data->regions[i].numblocks;
+		}
+	} else {
+		eraser->eraseblocks[0].size = data->erasesize;
+		eraser->eraseblocks[0].count = data->total_size / data->erasesize;
+	}
+
+	/*
+	 * Offer larger, uniform blocks as well, up to the whole device, so the
+	 * erase planner can cover runs of dirty eraseblocks with a single
+	 * MEMERASE64. Every region starts at a multiple of its own block size,
+	 * so the larger blocks always end on an eraseblock boundary. If they
+	 * don't divide the device, the rest of it is one smaller block.
+	 */
+	unsigned long int size = data->erasesize;
+	for (size_t i = 1; i < NUM_ERASEFUNCTIONS && size < data->total_size; i++) {
+		size = size * 16 < data->total_size ? size * 16 : data->total_size;
+		eraser = &chip->block_erasers[i];
+		*eraser = (struct block_eraser){
+			.eraseblocks = { { size, data->total_size / size } },
+			.block_erase = OPAQUE_ERASE,
+		};
+		if (data->total_size % size) {
+			eraser->eraseblocks[1].size = data->total_size % size;
+			eraser->eraseblocks[1].count = 1;
+		}
+	}
 	return 1;
 }
 
+/*
+ * Reads exactly `len` bytes at `offset` into `in`, or writes them from `out`
+ * if it isn't NULL, retrying short transfers.
+ */
+static int linux_mtd_io(const struct linux_mtd_data *data, uint8_t *in, const uint8_t *out,
+			unsigned int offset, unsigned int len)
+{
+	while (len) {
+		const ssize_t ret = out ? pwrite(data->dev_fd, out, len, offset)
+					: pread(data->dev_fd, in, len, offset);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			msg_perr("Cannot %s 0x%06x bytes at 0x%06x: %s\n", out ? "write" : "read",
+				 len, offset, ret < 0 ? strerror(errno) : "unexpected end of device");
+			return 1;
+		}
+		if (out)
+			out += ret;
+		else
+			in += ret;
+		offset += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+static unsigned int linux_mtd_io_step(const struct linux_mtd_data *data, unsigned int offset, unsigned int len)
+{
+	const unsigned long int io_size = max(LINUX_MTD_IO_SIZE, data->erasesize);
+	const unsigned long int step = io_size - offset % io_size;
+
+	return step < len ? step : len;
+}
+
 static int linux_mtd_read(struct flashctx *flash, uint8_t *buf,
 			  unsigned int start, unsigned int len)
 {
 	struct linux_mtd_data *data = flash->mst->opaque.data;
-	unsigned int eb_size = flash->chip->block_erasers[0].eraseblocks[0].size;
-	unsigned int i;
+	unsigned int step;
 
-	if (fseek(data->dev_fp, start, SEEK_SET) != 0) {
-		msg_perr("Cannot seek to 0x%06x: %s\n", start, strerror(errno));
-		return 1;
-	}
-
-	for (i = 0; i < len; ) {
-		/*
-		 * Try to align reads to eraseblock size.
-		 * FIXME: Shouldn't actually be necessary, but not all MTD
-		 * drivers handle arbitrary large reads well.
-		 */
-		unsigned int step = eb_size - ((start + i) % eb_size);
-		step = min(step, len - i);
-
-		if (fread(buf + i, step, 1, data->dev_fp) != 1) {
-			msg_perr("Cannot read 0x%06x bytes at 0x%06x: %s\n",
-					step, start + i, strerror(errno));
+	for (unsigned int i = 0; i < len; i += step) {
+		step = linux_mtd_io_step(data, start + i, len - i);
+		if (linux_mtd_io(data, buf + i, NULL, start + i, step))
 			return 1;
-		}
-
-		i += step;
 		update_progress(flash, FLASHROM_PROGRESS_READ, step);
 	}
 
 	return 0;
 }
 
-/* this version assumes we must divide the write request into chunks ourselves */
 static int linux_mtd_write(struct flashctx *flash, const uint8_t *buf,
 				unsigned int start, unsigned int len)
 {
 	struct linux_mtd_data *data = flash->mst->opaque.data;
-	unsigned int chunksize = flash->chip->block_erasers[0].eraseblocks[0].size;
-	unsigned int i;
+	unsigned int step;
 
 	if (!data->device_is_writeable)
 		return 1;
 
-	if (fseek(data->dev_fp, start, SEEK_SET) != 0) {
-		msg_perr("Cannot seek to 0x%06x: %s\n", start, strerror(errno));
-		return 1;
+	for (unsigned int i = 0; i < len; i += step) {
+		step = linux_mtd_io_step(data, start + i, len - i);
+		if (linux_mtd_io(data, NULL, buf + i, start + i, step))
+			return 1;
+		update_progress(flash, FLASHROM_PROGRESS_WRITE, step);
 	}
 
-	/*
-	 * Try to align writes to eraseblock size. We want these large enough
-	 * to give MTD room for optimizing performance.
-	 * FIXME: Shouldn't need to divide this up at all, but not all MTD
-	 * drivers handle arbitrary large writes well.
-	 */
-	for (i = 0; i < len; ) {
-		unsigned int step = chunksize - ((start + i) % chunksize);
-		step = min(step, len - i);
+	return 0;
+}
 
-		if (fwrite(buf + i, step, 1, data->dev_fp) != 1) {
-			msg_perr("Cannot write 0x%06x bytes at 0x%06x\n", step, start + i);
-			return 1;
-		}
+static int linux_mtd_erase_run(const struct linux_mtd_data *data, uint64_t start, uint64_t len)
+{
+	if (!len)
+		return 0;
 
-		if (fflush(data->dev_fp) == EOF) {
-			msg_perr("Failed to flush buffer: %s\n", strerror(errno));
-			return 1;
-		}
+	struct erase_info_user64 erase_info = {
+		.start = start,
+		.length = len,
+	};
 
-		i += step;
-		update_progress(flash, FLASHROM_PROGRESS_WRITE, step);
+	int ret = ioctl(data->dev_fd, MEMERASE64, &erase_info);
+	if (ret < 0) {
+		msg_perr("%s: MEMERASE64 ioctl call for 0x%06"PRIx64" bytes at 0x%06"PRIx64
+			 " returned %d, error: %s\n", __func__, len, start, ret, strerror(errno));
+		return 1;
 	}
-
 	return 0;
 }
 
+/*
+ * Erase the eraseblocks in the range which are not blank yet. Reading is much
+ * cheaper than erasing NOR flash, and each run of dirty blocks is erased with
+ * one ioctl.
+ */
 static int linux_mtd_erase(struct flashctx *flash,
 			unsigned int start, unsigned int len)
 {
 	struct linux_mtd_data *data = flash->mst->opaque.data;
-	uint32_t u;
+	const uint8_t erased_value = ERASED_VALUE(flash);
+	uint64_t run_start = start, run_len = 0;
+	int ret = 1;
 
 	if (data->no_erase) {
 		msg_perr("%s: device does not support erasing. Please file a "
@@ -268,36 +342,39 @@ static int linux_mtd_erase(struct flashctx *flash,
 		return 1;
 	}
 
-	if (data->numeraseregions != 0) {
-		/* TODO: Support non-uniform eraseblock size using
-		   use MEMGETREGIONCOUNT/MEMGETREGIONINFO ioctls */
-		msg_perr("%s: numeraseregions must be 0\n", __func__);
+	uint8_t *block = malloc(data->erasesize);
+	if (!block) {
+		msg_perr("Out of memory!\n");
 		return 1;
 	}
 
-	for (u = 0; u < len; u += data->erasesize) {
-		struct erase_info_user erase_info = {
-			.start = start + u,
-			.length = data->erasesize,
-		};
-
-		int ret = ioctl(fileno(data->dev_fp), MEMERASE, &erase_info);
-		if (ret < 0) {
-		        msg_perr("%s: MEMERASE ioctl call returned %d, error: %s\n",
-		                 __func__, ret, strerror(errno));
-		        return 1;
+	for (unsigned int offset = start, block_size; offset < start + len; offset += block_size) {
+		block_size = linux_mtd_block_size(data, offset);
+		if (linux_mtd_io(data, block, NULL, offset, block_size))
+			goto out;
+
+		if (block[0] == erased_value && !memcmp(block, block + 1, block_size - 1)) {
+			msg_pspew("%s: skipping blank eraseblock at 0x%06x\n", __func__, offset);
+			if (linux_mtd_erase_run(data, run_start, run_len))
+				goto out;
+			run_len = 0;
+			continue;
 		}
+		if (!run_len)
+			run_start = offset;
+		run_len += block_size;
 	}
-
-	return 0;
+	ret = linux_mtd_erase_run(data, run_start, run_len);
+out:
+	free(block);
+	return ret;
 }
 
 static int linux_mtd_shutdown(void *data)
 {
 	struct linux_mtd_data *mtd_data = data;
-	if (mtd_data->dev_fp != NULL) {
-		fclose(mtd_data->dev_fp);
-	}
+	if (mtd_data->dev_fd >= 0)
+		close(mtd_data->dev_fd);
 	free(data);
 
 	return 0;
@@ -314,13 +391,12 @@ static enum flashrom_wp_result linux_mtd_wp_read_cfg(struct flashrom_wp_cfg *cfg
 	cfg->range.len = 0;
 
 	/* Check protection status of each block */
-	for (size_t u = 0; u < data->total_size; u += data->erasesize) {
-		struct erase_info_user erase_info = {
-			.start = u,
-			.length = data->erasesize,
-		};
+	struct erase_info_user erase_info;
+	for (size_t u = 0; u < data->total_size; u += erase_info.length) {
+		erase_info.start = u;
+		erase_info.length = linux_mtd_block_size(data, u);
 
-		int ret = ioctl(fileno(data->dev_fp), MEMISLOCKED, &erase_info);
+		int ret = ioctl(data->dev_fd, MEMISLOCKED, &erase_info);
 		if (ret == 0) {
 			/* Block is unprotected. */
 
@@ -343,7 +419,7 @@ static enum flashrom_wp_result linux_mtd_wp_read_cfg(struct flashrom_wp_cfg *cfg
 				cfg->mode = FLASHROM_WP_MODE_HARDWARE;
 				start_found = true;
 			}
-			cfg->range.len += data->erasesize;
+			cfg->range.len += erase_info.length;
 		} else {
 			msg_perr("%s: ioctl: %s\n", __func__, strerror(errno));
 			return FLASHROM_WP_ERR_READ_FAILED;
@@ -382,7 +458,7 @@ static enum flashrom_wp_result linux_mtd_wp_write_cfg(struct flashctx *flash, co
 	 * just protect the requsted range, we need to disable the current
 	 * write protection and then enable it for the desired range.
 	 */
-	int ret = ioctl(fileno(data->dev_fp), MEMUNLOCK, &entire_chip);
+	int ret = ioctl(data->dev_fd, MEMUNLOCK, &entire_chip);
 	if (ret < 0) {
 		msg_perr("%s: Failed to disable write-protection, MEMUNLOCK ioctl "
 			 "retuned %d, error: %s\n", __func__, ret, strerror(errno));
@@ -390,7 +466,7 @@ static enum flashrom_wp_result linux_mtd_wp_write_cfg(struct flashctx *flash, co
 	}
 
 	if (cfg->range.len > 0) {
-		ret = ioctl(fileno(data->dev_fp), MEMLOCK, &desired_range);
+		ret = ioctl(data->dev_fd, MEMLOCK, &desired_range);
 		if (ret < 0) {
 			msg_perr("%s: Failed to enable write-protection, "
 				 "MEMLOCK ioctl retuned %d, error: %s\n",
@@ -443,6 +519,38 @@ static const struct opaque_master linux_mtd_opaque_master = {
 	.delay		= linux_mtd_nop_delay,
 };
 
+/* Reads the layout of non-uniform devices, which sysfs only has the number of regions for. */
+static int linux_mtd_get_regions(struct linux_mtd_data *data)
+{
+	unsigned long int next_offset = 0;
+
+	for (unsigned long int i = 0; i < data->numeraseregions; i++) {
+		struct region_info_user *region = &data->regions[i];
+
+		region->regionindex = i;
+		if (ioctl(data->dev_fd, MEMGETREGIONINFO, region) < 0) {
+			msg_perr("%s: MEMGETREGIONINFO ioctl call for region %lu failed: %s\n",
+				 __func__, i, strerror(errno));
+			return 1;
+		}
+		msg_pdbg("%s: region %lu: offset 0x%06x, %u blocks of 0x%x bytes\n", __func__,
+			 i, region->offset, region->numblocks, region->erasesize);
+
+		if (region->offset != next_offset || popcnt(region->erasesize) != 1 ||
+		    region->erasesize > data->erasesize || region->offset % region->erasesize) {
+			msg_perr("MTD erase region %lu is not supported\n", i);
+			return 1;
+		}
+		next_offset = region->offset + (unsigned long int)region->erasesize * region->numblocks;
+	}
+
+	if (data->numeraseregions && next_offset != data->total_size) {
+		msg_perr("MTD erase regions don't cover the device\n");
+		return 1;
+	}
+	return 0;
+}
+
 /* Returns 0 if setup is successful, non-zero to indicate error */
 static int linux_mtd_setup(int dev_num, struct linux_mtd_data *data)
 {
@@ -478,14 +586,16 @@ static int linux_mtd_setup(int dev_num, struct linux_mtd_data *data)
 	if (get_mtd_info(sysfs_path, data))
 		goto linux_mtd_setup_exit;
 
-	/* open file stream and go! */
-	if ((data->dev_fp = fopen(dev_path, "r+")) == NULL) {
-		msg_perr("Cannot open file stream for %s\n", dev_path);
+	/* open the device and go! */
+	if ((data->dev_fd = open(dev_path, O_RDWR)) < 0) {
+		msg_perr("Cannot open %s: %s\n", dev_path, strerror(errno));
+		goto linux_mtd_setup_exit;
+	}
+	if (linux_mtd_get_regions(data)) {
+		close(data->dev_fd);
+		data->dev_fd = -1;
 		goto linux_mtd_setup_exit;
 	}
-	ret = setvbuf(data->dev_fp, NULL, _IONBF, 0);
-	if (ret)
-		msg_pwarn("Failed to set MTD device to unbuffered: %d\n", ret);
 
 	msg_pinfo("Opened %s successfully\n", dev_path);
 
@@ -35,17 +35,36 @@
 
 #define BUF_SIZE_FROM_SYSFS	"/sys/module/spidev/parameters/bufsiz"
 
+/* Most transfers batched into one SPI_IOC_MESSAGE, a command takes up to three. */
+#define MAX_TRANSFERS_PER_MESSAGE	32
+
 struct linux_spi_data {
 	int fd;
 	size_t max_kernel_buf_size;
 };
 
+static int linux_spi_send_message(const struct linux_spi_data *spi_data,
+				  struct spi_ioc_transfer *xfers, unsigned int count)
+{
+	if (!count)
+		return 0;
+
+	/* cs_change on the last transfer would keep CS asserted after the message. */
+	xfers[count - 1].cs_change = 0;
+	if (ioctl(spi_data->fd, SPI_IOC_MESSAGE(count), xfers) == -1) {
+		msg_cerr("%s: ioctl: %s\n", __func__, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
 static int linux_spi_read(struct flashctx *flash, uint8_t *buf, unsigned int start, unsigned int len)
 {
 	struct linux_spi_data *spi_data = flash->mst->spi.data;
+
 	/* Older kernels use a single buffer for combined input and output
-	   data. So account for longest possible command + address, too. */
-	return spi_read_chunked(flash, buf, start, len, spi_data->max_kernel_buf_size - 5);
+	   data. So account for longest possible read command, too. */
+	return spi_read_chunked(flash, buf, start, len, spi_data->max_kernel_buf_size - JEDEC_READ_MAX_OUTSIZE);
 }
 
 static int linux_spi_write_256(struct flashctx *flash, const uint8_t *buf, unsigned int start, unsigned int len)
@@ -102,11 +121,76 @@ static int linux_spi_send_command(const struct flashctx *flash, unsigned int wri
 	return 0;
 }
 
+/*
+ * Send a chain of commands with as few ioctls as possible. Each command is
+ * one write and an optional read transfer, and CS is released after the last
+ * transfer of a command by setting cs_change on it. Multi-I/O commands send
+ * the opcode on its own if the address goes out on more than one line, and
+ * receive the data on as many lines as the I/O mode asks for.
+ */
+static int linux_spi_send_multicommand(const struct flashctx *flash, struct spi_command *cmds)
+{
+	struct linux_spi_data *spi_data = flash->mst->spi.data;
+	struct spi_ioc_transfer xfers[MAX_TRANSFERS_PER_MESSAGE];
+	unsigned int count = 0;
+	size_t msg_len = 0;
+
+	if (spi_data->fd == -1)
+		return -1;
+
+	for (; cmds->writecnt || cmds->readcnt; cmds++) {
+		/* Like linux_spi_send_command(), each command must start by sending. */
+		if (cmds->writecnt == 0)
+			return SPI_INVALID_LENGTH;
+		/* Dummy clocks are sent as bytes, the kernel cannot do partial words. */
+		if (cmds->dummy_cycles)
+			return SPI_INVALID_LENGTH;
+
+		const unsigned int addr_lines = spi_io_addr_lines(cmds->io_mode);
+		const bool split = addr_lines > 1 && cmds->writecnt > 1;
+
+		/* Older kernels count input and output against the same buffer. */
+		const size_t cmd_len = cmds->writecnt + cmds->readcnt;
+		const unsigned int cmd_xfers = (split ? 2 : 1) + (cmds->readcnt ? 1 : 0);
+		if (count + cmd_xfers > ARRAY_SIZE(xfers) ||
+		    (count && msg_len + cmd_len > spi_data->max_kernel_buf_size)) {
+			if (linux_spi_send_message(spi_data, xfers, count))
+				return -1;
+			count = 0;
+			msg_len = 0;
+		}
+
+		xfers[count++] = (struct spi_ioc_transfer){
+			.tx_buf = (uint64_t)(uintptr_t)cmds->writearr,
+			.len = split ? 1 : cmds->writecnt,
+		};
+		if (split) {
+			xfers[count++] = (struct spi_ioc_transfer){
+				.tx_buf = (uint64_t)(uintptr_t)(cmds->writearr + 1),
+				.len = cmds->writecnt - 1,
+				.tx_nbits = addr_lines,
+			};
+		}
+		if (cmds->readcnt) {
+			xfers[count++] = (struct spi_ioc_transfer){
+				.rx_buf = (uint64_t)(uintptr_t)cmds->readarr,
+				.len = cmds->readcnt,
+				.rx_nbits = spi_io_data_lines(cmds->io_mode),
+			};
+		}
+		xfers[count - 1].cs_change = 1;
+		msg_len += cmd_len;
+	}
+
+	return linux_spi_send_message(spi_data, xfers, count);
+}
+
 static const struct spi_master spi_master_linux = {
 	.features	= SPI_MASTER_4BA,
 	.max_data_read	= MAX_DATA_UNSPECIFIED, /* TODO? */
 	.max_data_write	= MAX_DATA_UNSPECIFIED, /* TODO? */
 	.command	= linux_spi_send_command,
+	.multicommand	= linux_spi_send_multicommand,
 	.read		= linux_spi_read,
 	.write_256	= linux_spi_write_256,
 	.shutdown	= linux_spi_shutdown,
@@ -161,6 +245,7 @@ static int linux_spi_init(const struct programmer_cfg *cfg)
 	/* SPI mode 0 (beware this also includes: MSB first, CS active low and others */
 	const uint8_t mode = SPI_MODE_0;
 	const uint8_t bits = 8;
+	struct spi_master mst = spi_master_linux;
 	int fd;
 	size_t max_kernel_buf_size;
 	struct linux_spi_data *spi_data;
@@ -204,11 +289,51 @@ static int linux_spi_init(const struct programmer_cfg *cfg)
 	}
 	msg_pdbg("Using %"PRIu32"kHz clock\n", speed_hz / 1000);
 
+	/*
+	 * The bus widths the kernel got from the device tree tell how many data
+	 * lines are actually wired up. Writing an 8-bit mode drops them, so they
+	 * are read first and written back along with the mode.
+	 */
+#ifdef SPI_IOC_RD_MODE32
+	uint32_t mode32 = 0;
+	if (ioctl(fd, SPI_IOC_RD_MODE32, &mode32) == -1) {
+		msg_pdbg("%s: failed to read the SPI mode, using single I/O: %s\n",
+			 __func__, strerror(errno));
+		if (ioctl(fd, SPI_IOC_WR_MODE, &mode) == -1) {
+			msg_perr("%s: failed to set SPI mode to 0x%02x: %s\n",
+				 __func__, mode, strerror(errno));
+			goto init_err;
+		}
+	} else {
+		mode32 = mode | (mode32 & (SPI_TX_DUAL | SPI_TX_QUAD | SPI_RX_DUAL | SPI_RX_QUAD));
+		if (ioctl(fd, SPI_IOC_WR_MODE32, &mode32) == -1) {
+			msg_perr("%s: failed to set SPI mode to 0x%08"PRIx32": %s\n",
+				 __func__, mode32, strerror(errno));
+			goto init_err;
+		}
+
+		const bool rx_dual = mode32 & (SPI_RX_DUAL | SPI_RX_QUAD);
+		const bool tx_dual = mode32 & (SPI_TX_DUAL | SPI_TX_QUAD);
+
+		if (rx_dual)
+			mst.features |= SPI_MASTER_DUAL_OUT;
+		if (rx_dual && tx_dual)
+			mst.features |= SPI_MASTER_DUAL_IO;
+		if (mode32 & SPI_RX_QUAD)
+			mst.features |= SPI_MASTER_QUAD_OUT;
+		if ((mode32 & SPI_RX_QUAD) && (mode32 & SPI_TX_QUAD))
+			mst.features |= SPI_MASTER_QUAD_IO;
+		msg_pdbg("%s: receiving on %u, sending on %u data line(s)\n", __func__,
+			 mode32 & SPI_RX_QUAD ? 4 : rx_dual ? 2 : 1,
+			 mode32 & SPI_TX_QUAD ? 4 : tx_dual ? 2 : 1);
+	}
+#else
 	if (ioctl(fd, SPI_IOC_WR_MODE, &mode) == -1) {
 		msg_perr("%s: failed to set SPI mode to 0x%02x: %s\n",
 			 __func__, mode, strerror(errno));
 		goto init_err;
 	}
+#endif
 
 	if (ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits) == -1) {
 		msg_perr("%s: failed to set the number of bits per SPI word to %u: %s\n",
@@ -227,7 +352,7 @@ static int linux_spi_init(const struct programmer_cfg *cfg)
 	spi_data->fd = fd;
 	spi_data->max_kernel_buf_size = max_kernel_buf_size;
 
-	return register_spi_master(&spi_master_linux, spi_data);
+	return register_spi_master(&mst, spi_data);
 
 init_err:
 	close(fd);
@@ -0,0 +1,499 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*
+ * Answers the SPI commands of a trace recorded with `flashrom --trace`, so a
+ * session can be rerun without the hardware it was recorded on.
+ *
+ * Commands are looked up in the trace starting after the last one answered,
+ * so a session that takes a slightly different path still finds its
+ * commands. Status register polls are not replayed one by one: the time the
+ * chip stayed busy after a command is taken from the polls that followed it
+ * in the trace, and WIP reads as set for that long. Without timing=yes the
+ * replay runs on a virtual clock that advances by the recorded durations of
+ * the commands and by the delays requested, so replays are fast and their
+ * polling still matches the recording.
+ *
+ * The operations of opaque masters are recorded but can't be replayed.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flash.h"
+#include "programmer.h"
+#include "spi.h"
+#include "stats.h"
+#include "trace.h"
+#include "platform/udelay.h"
+
+/* How many commands of the trace may be skipped to find the next one asked for. */
+#define REPLAY_WINDOW	256
+
+struct replay_cmd {
+	uint64_t start_ns;
+	uint64_t duration_ns;
+	uint64_t busy_ns;	/* Time the chip stayed busy after the command. */
+	size_t data;		/* Offset of writearr in replay_data.blob, readarr follows it. */
+	uint32_t writecnt;
+	uint32_t readcnt;
+	int ret;
+	uint8_t io_mode;
+	uint8_t dummy_cycles;
+};
+
+struct replay_range {
+	enum trace_type type;
+	uint32_t addr;
+	uint32_t len;
+	int ret;
+	uint64_t duration_ns;
+	size_t data;		/* Offset of the data of reads in replay_data.blob. */
+};
+
+struct replay_data {
+	struct replay_cmd *cmds;
+	size_t num_cmds;
+	size_t cmds_size;
+	struct replay_range *ranges;
+	size_t num_ranges;
+	size_t ranges_size;
+	uint8_t *blob;
+	size_t blob_len;
+	size_t blob_size;
+
+	bool have_master;
+	uint32_t features;
+	uint32_t max_data_read;
+	uint32_t max_data_write;
+	bool bulk_read;
+	bool bulk_write;
+	unsigned int opaque_ops;
+
+	size_t cursor;		/* Next command expected. */
+	size_t range_cursor;
+	unsigned int answered;
+	unsigned int misses;
+	bool timed;
+	uint64_t now_ns;	/* Virtual clock unless timed. */
+	uint64_t busy_until_ns;
+};
+
+static int grow(void **array, size_t *size, size_t needed, size_t elem_size)
+{
+	if (needed <= *size)
+		return 0;
+
+	size_t new_size = *size ? *size : 256;
+	while (new_size < needed)
+		new_size *= 2;
+	void *const new_array = realloc(*array, new_size * elem_size);
+	if (!new_array)
+		return 1;
+	*array = new_array;
+	*size = new_size;
+	return 0;
+}
+
+static int store(struct replay_data *data, const uint8_t *bytes, size_t len, size_t *offset)
+{
+	if (grow((void **)&data->blob, &data->blob_size, data->blob_len + len, 1))
+		return 1;
+	if (len)
+		memcpy(data->blob + data->blob_len, bytes, len);
+	*offset = data->blob_len;
+	data->blob_len += len;
+	return 0;
+}
+
+static int add_command(struct replay_data *data, const struct trace_record *rec)
+{
+	if (grow((void **)&data->cmds, &data->cmds_size, data->num_cmds + 1, sizeof(*data->cmds)))
+		return 1;
+
+	struct replay_cmd *const cmd = &data->cmds[data->num_cmds];
+	*cmd = (struct replay_cmd){
+		.start_ns = rec->start_ns,
+		.duration_ns = rec->duration_ns,
+		.writecnt = rec->writecnt,
+		.readcnt = rec->readcnt,
+		.ret = rec->ret,
+		.io_mode = rec->io_mode,
+		.dummy_cycles = rec->dummy_cycles,
+	};
+	size_t readarr;
+	if (store(data, rec->writearr, rec->writecnt, &cmd->data) ||
+	    store(data, rec->readarr, rec->readcnt, &readarr))
+		return 1;
+	data->num_cmds++;
+	return 0;
+}
+
+static int add_range(struct replay_data *data, const struct trace_record *rec)
+{
+	if (grow((void **)&data->ranges, &data->ranges_size, data->num_ranges + 1, sizeof(*data->ranges)))
+		return 1;
+
+	struct replay_range *const range = &data->ranges[data->num_ranges];
+	*range = (struct replay_range){
+		.type = rec->type,
+		.addr = rec->addr,
+		.len = rec->len,
+		.ret = rec->ret,
+		.duration_ns = rec->duration_ns,
+	};
+	if (rec->type == TRACE_SPI_READ && store(data, rec->readarr, rec->len, &range->data))
+		return 1;
+	data->num_ranges++;
+	return 0;
+}
+
+static const uint8_t *cmd_writearr(const struct replay_data *data, const struct replay_cmd *cmd)
+{
+	return data->blob + cmd->data;
+}
+
+static const uint8_t *cmd_readarr(const struct replay_data *data, const struct replay_cmd *cmd)
+{
+	return data->blob + cmd->data + cmd->writecnt;
+}
+
+static bool is_rdsr(const struct replay_data *data, const struct replay_cmd *cmd)
+{
+	return cmd->writecnt == 1 && cmd->readcnt == 1 && cmd_writearr(data, cmd)[0] == JEDEC_RDSR;
+}
+
+static bool is_busy_poll(const struct replay_data *data, const struct replay_cmd *cmd)
+{
+	return is_rdsr(data, cmd) && (cmd_readarr(data, cmd)[0] & SPI_SR_WIP);
+}
+
+/*
+ * The chip finished somewhere between the last poll that saw it busy and the
+ * first one that didn't, take the middle.
+ */
+static void compute_busy_times(struct replay_data *data)
+{
+	for (size_t i = 0; i < data->num_cmds; i++) {
+		struct replay_cmd *const cmd = &data->cmds[i];
+		if (is_rdsr(data, cmd))
+			continue;
+
+		size_t j = i + 1;
+		while (j < data->num_cmds && is_busy_poll(data, &data->cmds[j]))
+			j++;
+		if (j == i + 1)
+			continue;
+
+		const struct replay_cmd *const last_busy = &data->cmds[j - 1];
+		const uint64_t busy_end_ns = last_busy->start_ns + last_busy->duration_ns;
+		const uint64_t clear_ns = j < data->num_cmds ? data->cmds[j].start_ns : busy_end_ns;
+		const uint64_t done_ns = busy_end_ns + (clear_ns - busy_end_ns) / 2;
+		const uint64_t cmd_end_ns = cmd->start_ns + cmd->duration_ns;
+		cmd->busy_ns = done_ns > cmd_end_ns ? done_ns - cmd_end_ns : 0;
+	}
+}
+
+static int load_trace(struct replay_data *data, const char *path)
+{
+	struct trace_file *const trace = trace_open(path);
+	if (!trace) {
+		msg_perr("Cannot open trace %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	struct trace_record rec;
+	bool spi = false;
+	int ret;
+	while (!(ret = trace_next(trace, &rec))) {
+		switch (rec.type) {
+		case TRACE_MASTER:
+			spi = rec.buses & BUS_SPI;
+			/* The first SPI master of the trace is the one replayed. */
+			if (spi && !data->have_master) {
+				data->have_master = true;
+				data->features = rec.features;
+				data->max_data_read = rec.max_data_read;
+				data->max_data_write = rec.max_data_write;
+			}
+			break;
+		case TRACE_SPI:
+			if (spi && add_command(data, &rec))
+				ret = -1;
+			break;
+		case TRACE_SPI_READ:
+		case TRACE_SPI_WRITE:
+			if (spi && add_range(data, &rec))
+				ret = -1;
+			data->bulk_read |= spi && rec.type == TRACE_SPI_READ;
+			data->bulk_write |= spi && rec.type == TRACE_SPI_WRITE;
+			break;
+		case TRACE_OPAQUE_READ:
+		case TRACE_OPAQUE_WRITE:
+		case TRACE_OPAQUE_ERASE:
+			data->opaque_ops++;
+			break;
+		default:
+			break;
+		}
+		if (ret)
+			break;
+	}
+	trace_close(trace);
+
+	if (ret < 0) {
+		msg_perr("Cannot load trace %s, it is corrupt or too large.\n", path);
+		return 1;
+	}
+	if (!data->have_master) {
+		msg_perr("Trace %s has no SPI traffic, only SPI sessions can be replayed.\n", path);
+		return 1;
+	}
+	if (data->opaque_ops)
+		msg_pwarn("Ignoring %u operations of opaque masters in the trace.\n", data->opaque_ops);
+
+	compute_busy_times(data);
+	msg_pdbg("Loaded %zu commands and %zu bulk transfers from %s.\n", data->num_cmds, data->num_ranges, path);
+	return 0;
+}
+
+static uint64_t replay_now(const struct replay_data *data)
+{
+	return data->timed ? stats_time_ns() : data->now_ns;
+}
+
+static void replay_wait(struct replay_data *data, uint64_t ns)
+{
+	if (data->timed)
+		default_delay(ns / 1000);
+	else
+		data->now_ns += ns;
+}
+
+static bool cmd_matches(const struct replay_data *data, const struct replay_cmd *cmd,
+			const struct spi_command *req)
+{
+	return cmd->writecnt == req->writecnt && cmd->readcnt == req->readcnt &&
+	       cmd->io_mode == req->io_mode && cmd->dummy_cycles == req->dummy_cycles &&
+	       !memcmp(cmd_writearr(data, cmd), req->writearr, req->writecnt);
+}
+
+/* Answers req like cmd did, as the command the trace continues after. */
+static int answer(struct replay_data *data, size_t index, struct spi_command *req)
+{
+	const struct replay_cmd *const cmd = &data->cmds[index];
+
+	if (req->readcnt)
+		memcpy(req->readarr, cmd_readarr(data, cmd), req->readcnt);
+	replay_wait(data, cmd->duration_ns);
+	if (cmd->busy_ns)
+		data->busy_until_ns = replay_now(data) + cmd->busy_ns;
+	data->cursor = index + 1;
+	data->answered++;
+	return cmd->ret;
+}
+
+/* Status reads take WIP from the busy time, a run of them in the trace counts as one. */
+static int answer_rdsr(struct replay_data *data, size_t index, bool advance, struct spi_command *req)
+{
+	size_t last = index;
+	while (last + 1 < data->num_cmds && is_rdsr(data, &data->cmds[last + 1]))
+		last++;
+
+	const bool busy = replay_now(data) < data->busy_until_ns;
+	const struct replay_cmd *const cmd = &data->cmds[busy ? index : last];
+	req->readarr[0] = cmd_readarr(data, cmd)[0];
+	if (busy)
+		req->readarr[0] |= SPI_SR_WIP;
+	else
+		req->readarr[0] &= ~SPI_SR_WIP;
+
+	replay_wait(data, cmd->duration_ns);
+	if (advance && !busy)
+		data->cursor = last + 1;
+	data->answered++;
+	return cmd->ret;
+}
+
+static int replay_command(struct replay_data *data, struct spi_command *req)
+{
+	const bool rdsr = req->writecnt == 1 && req->readcnt == 1 && req->writearr[0] == JEDEC_RDSR &&
+			  req->io_mode == SPI_IO_1_1_1 && !req->dummy_cycles;
+	size_t i;
+
+	/* Polls may outnumber those of the trace, they only match right at the cursor. */
+	if (rdsr) {
+		if (data->cursor < data->num_cmds && cmd_matches(data, &data->cmds[data->cursor], req))
+			return answer_rdsr(data, data->cursor, true, req);
+	} else {
+		for (i = data->cursor; i < data->num_cmds && i < data->cursor + REPLAY_WINDOW; i++) {
+			if (cmd_matches(data, &data->cmds[i], req))
+				return answer(data, i, req);
+		}
+	}
+
+	/* Reads that aren't where the trace has them are answered like before. */
+	if (req->readcnt) {
+		for (i = data->cursor; i-- > 0;) {
+			if (!cmd_matches(data, &data->cmds[i], req))
+				continue;
+			if (rdsr)
+				return answer_rdsr(data, i, false, req);
+			memcpy(req->readarr, cmd_readarr(data, &data->cmds[i]), req->readcnt);
+			replay_wait(data, data->cmds[i].duration_ns);
+			data->answered++;
+			return data->cmds[i].ret;
+		}
+	}
+
+	msg_perr("%s: Command 0x%02x (%u bytes out, %u in) is not in the trace after command %zu.\n",
+		 __func__, req->writecnt ? req->writearr[0] : 0, req->writecnt, req->readcnt, data->cursor);
+	data->misses++;
+	return SPI_GENERIC_ERROR;
+}
+
+static int replay_spi_send_command(const struct flashctx *flash, unsigned int writecnt, unsigned int readcnt,
+				   const unsigned char *writearr, unsigned char *readarr)
+{
+	struct spi_command req = {
+		.writecnt = writecnt,
+		.readcnt = readcnt,
+		.writearr = writearr,
+		.readarr = readarr,
+	};
+	return replay_command(flash->mst->spi.data, &req);
+}
+
+static int replay_spi_send_multicommand(const struct flashctx *flash, struct spi_command *cmds)
+{
+	int ret = 0;
+	for (; (cmds->writecnt || cmds->readcnt) && !ret; cmds++)
+		ret = replay_command(flash->mst->spi.data, cmds);
+	return ret;
+}
+
+/* Bulk transfers are looked up by their range, starting after the last one. */
+static const struct replay_range *find_range(struct replay_data *data, enum trace_type type,
+					     unsigned int start, unsigned int len)
+{
+	for (size_t n = 0; n < data->num_ranges; n++) {
+		const size_t i = (data->range_cursor + n) % data->num_ranges;
+		const struct replay_range *const range = &data->ranges[i];
+		if (range->type != type || start < range->addr || start - range->addr > range->len ||
+		    len > range->len - (start - range->addr))
+			continue;
+		if (type == TRACE_SPI_WRITE && (start != range->addr || len != range->len))
+			continue;
+		data->range_cursor = i + 1;
+		return range;
+	}
+	msg_perr("%s: No %s of 0x%06x-0x%06x in the trace.\n", __func__,
+		 type == TRACE_SPI_READ ? "read" : "write", start, start + len - 1);
+	data->misses++;
+	return NULL;
+}
+
+static int replay_spi_read(struct flashctx *flash, uint8_t *buf, unsigned int start, unsigned int len)
+{
+	struct replay_data *const data = flash->mst->spi.data;
+	const struct replay_range *const range = find_range(data, TRACE_SPI_READ, start, len);
+	if (!range)
+		return SPI_GENERIC_ERROR;
+
+	memcpy(buf, data->blob + range->data + (start - range->addr), len);
+	replay_wait(data, range->duration_ns);
+	return range->ret;
+}
+
+/* The data of bulk writes isn't recorded, only that they happened. */
+static int replay_spi_write_256(struct flashctx *flash, const uint8_t *buf, unsigned int start, unsigned int len)
+{
+	struct replay_data *const data = flash->mst->spi.data;
+	const struct replay_range *const range = find_range(data, TRACE_SPI_WRITE, start, len);
+	if (!range)
+		return SPI_GENERIC_ERROR;
+
+	replay_wait(data, range->duration_ns);
+	return range->ret;
+}
+
+static void replay_spi_delay(const struct flashctx *flash, unsigned int usecs)
+{
+	replay_wait(flash->mst->spi.data, (uint64_t)usecs * 1000);
+}
+
+static int replay_shutdown(void *data)
+{
+	struct replay_data *const replay = data;
+
+	msg_pdbg("Replayed %u commands up to command %zu of %zu, %u not found in the trace.\n",
+		 replay->answered, replay->cursor, replay->num_cmds, replay->misses);
+	free(replay->cmds);
+	free(replay->ranges);
+	free(replay->blob);
+	free(replay);
+	return 0;
+}
+
+static int replay_init(const struct programmer_cfg *cfg)
+{
+	char *tmp;
+
+	struct replay_data *const data = calloc(1, sizeof(*data));
+	if (!data) {
+		msg_perr("Out of memory!\n");
+		return 1;
+	}
+
+	tmp = extract_programmer_param_str(cfg, "timing");
+	if (tmp) {
+		if (!strcmp(tmp, "yes")) {
+			data->timed = true;
+		} else if (strcmp(tmp, "no")) {
+			msg_perr("%s: timing parameter incorrect (use yes or no)\n", __func__);
+			free(tmp);
+			goto init_err;
+		}
+		free(tmp);
+	}
+
+	tmp = extract_programmer_param_str(cfg, "trace");
+	if (!tmp) {
+		msg_perr("%s: Missing trace parameter, use -p replay:trace=<file>\n", __func__);
+		goto init_err;
+	}
+	const int ret = load_trace(data, tmp);
+	free(tmp);
+	if (ret)
+		goto init_err;
+
+	/* Chunk like the recorded master, masters with their own transfer functions don't tell. */
+	const struct spi_master mst = {
+		.features	= data->features,
+		.max_data_read	= data->max_data_read ? data->max_data_read : MAX_DATA_READ_UNLIMITED,
+		.max_data_write	= data->max_data_write ? data->max_data_write : MAX_DATA_WRITE_UNLIMITED,
+		.command	= replay_spi_send_command,
+		.multicommand	= replay_spi_send_multicommand,
+		.read		= data->bulk_read ? replay_spi_read : default_spi_read,
+		.write_256	= data->bulk_write ? replay_spi_write_256 : default_spi_write_256,
+		.shutdown	= replay_shutdown,
+		.delay		= replay_spi_delay,
+	};
+	return register_spi_master(&mst, data);
+
+init_err:
+	replay_shutdown(data);
+	return 1;
+}
+
+const struct programmer_entry programmer_replay = {
+	.name			= "replay",
+	.type			= OTHER,
+	.devs.note		= "Replays a trace recorded with --trace\n",
+	.init			= replay_init,
+};
@@ -31,33 +31,9 @@
 #include "chipdrivers.h"
 #include "platform/udelay.h"
 #include "serial.h"
-
-/* According to Serial Flasher Protocol Specification - version 1 */
-#define S_ACK			0x06
-#define S_NAK			0x15
-#define S_CMD_NOP		0x00	/* No operation					*/
-#define S_CMD_Q_IFACE		0x01	/* Query interface version			*/
-#define S_CMD_Q_CMDMAP		0x02	/* Query supported commands bitmap		*/
-#define S_CMD_Q_PGMNAME		0x03	/* Query programmer name			*/
-#define S_CMD_Q_SERBUF		0x04	/* Query Serial Buffer Size			*/
-#define S_CMD_Q_BUSTYPE		0x05	/* Query supported bustypes			*/
-#define S_CMD_Q_CHIPSIZE	0x06	/* Query supported chipsize (2^n format)	*/
-#define S_CMD_Q_OPBUF		0x07	/* Query operation buffer size			*/
-#define S_CMD_Q_WRNMAXLEN	0x08	/* Query Write to opbuf: Write-N maximum length */
-#define S_CMD_R_BYTE		0x09	/* Read a single byte				*/
-#define S_CMD_R_NBYTES		0x0A	/* Read n bytes					*/
-#define S_CMD_O_INIT		0x0B	/* Initialize operation buffer			*/
-#define S_CMD_O_WRITEB		0x0C	/* Write opbuf: Write byte with address		*/
-#define S_CMD_O_WRITEN		0x0D	/* Write to opbuf: Write-N			*/
-#define S_CMD_O_DELAY		0x0E	/* Write opbuf: udelay				*/
-#define S_CMD_O_EXEC		0x0F	/* Execute operation buffer			*/
-#define S_CMD_SYNCNOP		0x10	/* Special no-operation that returns NAK+ACK	*/
-#define S_CMD_Q_RDNMAXLEN	0x11	/* Query read-n maximum length			*/
-#define S_CMD_S_BUSTYPE		0x12	/* Set used bustype(s).				*/
-#define S_CMD_O_SPIOP		0x13	/* Perform SPI operation.			*/
-#define S_CMD_S_SPI_FREQ	0x14	/* Set SPI clock frequency			*/
-#define S_CMD_S_PIN_STATE	0x15	/* Enable/disable output drivers		*/
-#define S_CMD_S_SPI_CS		0x16	/* Set SPI chip select to use			*/
+#include "serprog.h"
+#include "spi.h"
+#include "stats.h"
 
 #define MSGHEADER "serprog: "
 
@@ -93,6 +69,40 @@ static int sp_opbuf_usage = 0;
 	whether the command is supported before doing it */
 static int sp_check_avail_automatic = 0;
 
+/* Tagged operations that were sent but whose answer was not read yet. The
+   device answers them in order, the tag only guards against lost sync. */
+#define SP_MAX_WINDOW		16
+/* Bulk reads are split so that the progress can be reported. */
+#define SP_BULK_READ_CHUNK	(64 * KiB)
+/* Program timeout on the device, as spi_nbyte_program() uses it. */
+#define SP_PROGRAM_TIMEOUT_US	(100 * 1000)
+
+struct sp_tagged_op {
+	uint8_t tag;
+	uint8_t cmd;
+	/* Request bytes, for flow control */
+	unsigned int sent;
+	/* Where the answer goes, NULL to discard it */
+	uint8_t *retbuf;
+	unsigned int retlen;
+	/* Set for operations that bypass spi_send_command() */
+	struct flashctx *flash;
+	uint8_t spi_opcode;
+	unsigned int spi_writecnt;
+	unsigned int spi_readcnt;
+	uint64_t start_ns;
+	enum flashrom_progress_stage stage;
+	unsigned int progress;
+};
+
+/* Number of outstanding tagged ops allowed, 0 if the device can't do it */
+static unsigned int sp_window = 0;
+static struct sp_tagged_op sp_tagged_ops[SP_MAX_WINDOW];
+static unsigned int sp_tagged_first = 0;
+static unsigned int sp_tagged_count = 0;
+static unsigned int sp_tagged_bytes = 0;
+static uint8_t sp_next_tag = 0;
+
 #if ! IS_WINDOWS
 static int sp_opensocket(char *ip, unsigned int port)
 {
@@ -219,12 +229,80 @@ static int sp_automatic_cmdcheck(uint8_t cmd)
 	return 0;
 }
 
+/* Read the answer of the oldest outstanding tagged operation. Returns 1 if
+   the device NAKed it, -1 if the stream is out of sync. */
+static int sp_tagged_reap(void)
+{
+	struct sp_tagged_op *const op = &sp_tagged_ops[sp_tagged_first];
+	unsigned char reply[2];
+
+	sp_tagged_first = (sp_tagged_first + 1) % SP_MAX_WINDOW;
+	sp_tagged_count--;
+	sp_tagged_bytes -= op->sent;
+
+	if (serialport_read(reply, 2) != 0) {
+		msg_perr("Error: cannot read from device: %s\n", strerror(errno));
+		return -1;
+	}
+	if (reply[1] != op->tag) {
+		msg_perr("Error: answer tagged 0x%02X from device, expected 0x%02X (to command 0x%02X)\n",
+			 reply[1], op->tag, op->cmd);
+		return -1;
+	}
+	if (reply[0] == S_NAK) {
+		msg_perr("Error: NAK to tagged command 0x%02X\n", op->cmd);
+		return 1;
+	}
+	if (reply[0] != S_ACK) {
+		msg_perr("Error: invalid response 0x%02X from device (to command 0x%02X)\n", reply[0], op->cmd);
+		return -1;
+	}
+	/* The status of a program operation is not needed. */
+	uint8_t status;
+	if (op->retlen && serialport_read(op->retbuf ? op->retbuf : &status, op->retlen) != 0) {
+		msg_perr("Error: cannot read return parameters: %s\n", strerror(errno));
+		return -1;
+	}
+	if (op->flash) {
+		stats_count_command(op->flash, op->spi_writecnt, op->spi_readcnt, &op->spi_opcode, op->start_ns);
+		update_progress(op->flash, op->stage, op->progress);
+	}
+	return 0;
+}
+
+/* No answer that follows can be trusted anymore, stop using tagged operations. */
+static void sp_tagged_lost_sync(void)
+{
+	sp_tagged_count = 0;
+	sp_tagged_bytes = 0;
+	sp_window = 0;
+}
+
+/* Wait for all outstanding tagged operations. Errors of operations nobody
+   waited for are reported here. */
+static int sp_tagged_drain(void)
+{
+	int ret = 0;
+
+	while (sp_tagged_count) {
+		const int rc = sp_tagged_reap();
+		if (rc < 0) {
+			sp_tagged_lost_sync();
+			return 1;
+		}
+		ret |= rc;
+	}
+	return ret;
+}
+
 static int sp_docommand(uint8_t command, uint32_t parmlen,
 			uint8_t *params, uint32_t retlen, void *retparms)
 {
 	unsigned char c;
 	if (sp_automatic_cmdcheck(command))
 		return 1;
+	if (sp_tagged_count && sp_tagged_drain())
+		return 1;
 	if (serialport_write(&command, 1) != 0) {
 		msg_perr("Error: cannot write op code: %s\n", strerror(errno));
 		return 1;
@@ -280,6 +358,8 @@ static int sp_stream_buffer_op(uint8_t cmd, uint32_t parmlen, uint8_t *parms)
 	uint8_t *sp;
 	if (sp_automatic_cmdcheck(cmd))
 		return 1;
+	if (sp_tagged_count && sp_tagged_drain())
+		return 1;
 
 	sp = malloc(1 + parmlen);
 	if (!sp) {
@@ -313,6 +393,8 @@ static int sp_pass_writen(void)
 {
 	unsigned char header[7];
 	msg_pspew(MSGHEADER "Passing write-n bytes=%d addr=0x%x\n", sp_write_n_bytes, sp_write_n_addr);
+	if (sp_tagged_count && sp_tagged_drain())
+		return 1;
 	if (sp_streamed_transmit_bytes >= (7 + sp_write_n_bytes + sp_device_serbuf_size)) {
 		if (sp_flush_stream() != 0) {
 			return 1;
@@ -381,6 +463,57 @@ static int sp_execute_opbuf(void)
 	return 0;
 }
 
+/* Send a tagged command, made of cmd, the tag, params and data, without
+   waiting for its answer. The answer is read into op->retbuf later. */
+static int sp_tagged_submit(struct sp_tagged_op *op, uint8_t cmd, const uint8_t *params,
+			    unsigned int parmlen, const uint8_t *data, unsigned int datalen)
+{
+	const unsigned int len = 2 + parmlen + datalen;
+	int ret = 0;
+
+	/* Untagged answers must not get in between. */
+	if ((sp_opbuf_usage || (sp_max_write_n && sp_write_n_bytes)) && sp_execute_opbuf())
+		return 1;
+	if (sp_flush_stream())
+		return 1;
+
+	/* Keep what the device may have to buffer within its serial buffer. */
+	while (sp_tagged_count &&
+	       (sp_tagged_count >= sp_window || sp_tagged_bytes + len > sp_device_serbuf_size)) {
+		const int rc = sp_tagged_reap();
+		if (rc < 0) {
+			sp_tagged_lost_sync();
+			return 1;
+		}
+		ret |= rc;
+	}
+
+	uint8_t *const buf = malloc(len);
+	if (!buf) {
+		msg_perr("Error: cannot malloc command buffer\n");
+		return 1;
+	}
+	buf[0] = cmd;
+	buf[1] = sp_next_tag;
+	memcpy(buf + 2, params, parmlen);
+	if (datalen)
+		memcpy(buf + 2 + parmlen, data, datalen);
+	if (serialport_write(buf, len) != 0) {
+		msg_perr("Error: cannot write tagged command: %s\n", strerror(errno));
+		free(buf);
+		return 1;
+	}
+	free(buf);
+
+	op->tag = sp_next_tag++;
+	op->cmd = cmd;
+	op->sent = len;
+	sp_tagged_ops[(sp_tagged_first + sp_tagged_count) % SP_MAX_WINDOW] = *op;
+	sp_tagged_count++;
+	sp_tagged_bytes += len;
+	return ret;
+}
+
 static int serprog_spi_send_command(const struct flashctx *flash,
 				    unsigned int writecnt, unsigned int readcnt,
 				    const unsigned char *writearr,
@@ -389,6 +522,18 @@ static int serprog_spi_send_command(const struct flashctx *flash,
 	unsigned char *parmbuf;
 	int ret;
 	msg_pspew("%s, writecnt=%i, readcnt=%i\n", __func__, writecnt, readcnt);
+	if (sp_window) {
+		/* Commands without answer, e.g. WREN, don't wait for the device. */
+		struct sp_tagged_op op = { .retbuf = readarr, .retlen = readcnt };
+		const uint8_t lens[6] = {
+			(writecnt >> 0) & 0xFF, (writecnt >> 8) & 0xFF, (writecnt >> 16) & 0xFF,
+			(readcnt >> 0) & 0xFF, (readcnt >> 8) & 0xFF, (readcnt >> 16) & 0xFF,
+		};
+		ret = sp_tagged_submit(&op, S_CMD_O_SPIOP_TAGGED, lens, sizeof(lens), writearr, writecnt);
+		if (!readcnt)
+			return ret;
+		return sp_tagged_drain() | ret;
+	}
 	if ((sp_opbuf_usage) || (sp_max_write_n && sp_write_n_bytes)) {
 		if (sp_execute_opbuf() != 0) {
 			msg_perr("Error: could not execute command buffer before sending SPI commands.\n");
@@ -414,8 +559,121 @@ static int serprog_spi_send_command(const struct flashctx *flash,
 	return ret;
 }
 
+/*
+ * Length of the address that the bulk commands send, 0 if the range up to
+ * `end` needs the default path. That is also the case for chips with an
+ * extended address register: only spi_prepare_address() keeps it up to date.
+ */
+static unsigned int sp_spi_addr_len(const struct flashctx *flash, bool native_4ba, unsigned int end)
+{
+	if (native_4ba || flash->in_4ba_mode)
+		return 4;
+	if (flash->chip->feature_bits & FEATURE_4BA_EAR_ANY)
+		return 0;
+	return end <= 16 * MiB ? 3 : 0;
+}
+
+/* The address goes out MSB first, as on the SPI bus. */
+static void sp_spi_put_addr(uint8_t *buf, unsigned int addr_len, unsigned int addr)
+{
+	for (unsigned int i = 0; i < addr_len; i++)
+		buf[i] = (addr >> (8 * (addr_len - 1 - i))) & 0xFF;
+}
+
+/* Read with one continuous SPI read per chunk, each chunk a single round trip. */
+static int serprog_spi_read(struct flashctx *flash, uint8_t *buf, unsigned int start, unsigned int len)
+{
+	const bool native_4ba = flash->chip->feature_bits & FEATURE_4BA_READ;
+	const unsigned int addr_len = sp_spi_addr_len(flash, native_4ba, start + len);
+
+	if (!sp_window || !addr_len || !sp_check_commandavail(S_CMD_R_SPI_BULK))
+		return default_spi_read(flash, buf, start, len);
+
+	unsigned int to_read;
+	int ret = 0;
+	for (; len; len -= to_read, buf += to_read, start += to_read) {
+		to_read = min(SP_BULK_READ_CHUNK, len);
+		const uint8_t params[9] = {
+			native_4ba ? JEDEC_READ_4BA : JEDEC_READ,
+			addr_len,
+			(start >> 0) & 0xFF,
+			(start >> 8) & 0xFF,
+			(start >> 16) & 0xFF,
+			(start >> 24) & 0xFF,
+			(to_read >> 0) & 0xFF,
+			(to_read >> 8) & 0xFF,
+			(to_read >> 16) & 0xFF,
+		};
+		struct sp_tagged_op op = {
+			.retbuf		= buf,
+			.retlen		= to_read,
+			.flash		= flash,
+			.spi_opcode	= params[0],
+			.spi_writecnt	= 1 + addr_len,
+			.spi_readcnt	= to_read,
+			.start_ns	= stats_start(flash),
+			.stage		= FLASHROM_PROGRESS_READ,
+			.progress	= to_read,
+		};
+		ret = sp_tagged_submit(&op, S_CMD_R_SPI_BULK, params, sizeof(params), NULL, 0);
+		if (ret)
+			break;
+	}
+	return sp_tagged_drain() | ret;
+}
+
+/* Program pages, the device polls WIP after each, so that nothing waits for an answer. */
+static int serprog_spi_write_256(struct flashctx *flash, const uint8_t *buf, unsigned int start, unsigned int len)
+{
+	const bool native_4ba = flash->chip->feature_bits & FEATURE_4BA_WRITE;
+	const unsigned int addr_len = sp_spi_addr_len(flash, native_4ba, start + len);
+	const unsigned int page_size = flash->chip->page_size;
+	const unsigned int chunksize = flash->mst->spi.max_data_write;
+
+	if (!sp_window || !addr_len || !sp_check_commandavail(S_CMD_O_SPI_PROGRAM))
+		return default_spi_write_256(flash, buf, start, len);
+
+	const unsigned int end = start + len;
+	unsigned int addr, towrite;
+	int ret = 0;
+	/* Split as spi_write_chunked() does. */
+	for (addr = start; addr < end; addr += towrite) {
+		const unsigned int page_end = min(end, (addr / page_size + 1) * page_size);
+		towrite = min(chunksize, page_end - addr);
+		const unsigned int slen = 1 + addr_len + towrite;
+		uint8_t params[4 + 3 + 1 + JEDEC_MAX_ADDR_LEN] = {
+			(SP_PROGRAM_TIMEOUT_US >> 0) & 0xFF,
+			(SP_PROGRAM_TIMEOUT_US >> 8) & 0xFF,
+			(SP_PROGRAM_TIMEOUT_US >> 16) & 0xFF,
+			(SP_PROGRAM_TIMEOUT_US >> 24) & 0xFF,
+			(slen >> 0) & 0xFF,
+			(slen >> 8) & 0xFF,
+			(slen >> 16) & 0xFF,
+			native_4ba ? JEDEC_BYTE_PROGRAM_4BA : JEDEC_BYTE_PROGRAM,
+		};
+		sp_spi_put_addr(params + 8, addr_len, addr);
+		struct sp_tagged_op op = {
+			.retlen		= 1,
+			.flash		= flash,
+			.spi_opcode	= params[7],
+			.spi_writecnt	= slen,
+			.start_ns	= stats_start(flash),
+			.stage		= FLASHROM_PROGRESS_WRITE,
+			.progress	= towrite,
+		};
+		ret = sp_tagged_submit(&op, S_CMD_O_SPI_PROGRAM, params, 8 + addr_len,
+				       buf + addr - start, towrite);
+		if (ret)
+			break;
+	}
+	return sp_tagged_drain() | ret;
+}
+
 static int serprog_shutdown(void *data)
 {
+	if (sp_tagged_count && sp_tagged_drain())
+		msg_pwarn("Could not read answers to tagged commands.\n");
+	sp_window = 0;
 	if ((sp_opbuf_usage) || (sp_max_write_n && sp_write_n_bytes))
 	if (sp_execute_opbuf() != 0)
 		msg_pwarn("Could not flush command buffer.\n");
@@ -456,8 +714,8 @@ static struct spi_master spi_master_serprog = {
 	.max_data_read	= MAX_DATA_READ_UNLIMITED,
 	.max_data_write	= MAX_DATA_WRITE_UNLIMITED,
 	.command	= serprog_spi_send_command,
-	.read		= default_spi_read,
-	.write_256	= default_spi_write_256,
+	.read		= serprog_spi_read,
+	.write_256	= serprog_spi_write_256,
 	.delay		= serprog_delay,
 };
 
@@ -694,6 +952,9 @@ static int serprog_init(const struct programmer_cfg *cfg)
 	msg_pdbg(MSGHEADER "connected - attempting to synchronize\n");
 
 	sp_check_avail_automatic = 0;
+	sp_window = 0;
+	sp_tagged_count = 0;
+	sp_tagged_bytes = 0;
 
 	if (sp_synchronize())
 		goto init_err_cleanup_exit;
@@ -929,6 +1190,16 @@ static int serprog_init(const struct programmer_cfg *cfg)
 	msg_pdbg(MSGHEADER "Serial buffer size is %d\n",
 		     sp_device_serbuf_size);
 
+	if ((serprog_buses_supported & BUS_SPI) && sp_check_commandavail(S_CMD_Q_PIPELINE) &&
+	    sp_check_commandavail(S_CMD_O_SPIOP_TAGGED)) {
+		if (sp_docommand(S_CMD_Q_PIPELINE, 0, NULL, 1, &c)) {
+			msg_pwarn("Warning: NAK to query tagged operations\n");
+		} else if (c) {
+			sp_window = min(c, SP_MAX_WINDOW);
+			msg_pdbg(MSGHEADER "Up to %u tagged operations in flight\n", sp_window);
+		}
+	}
+
 	if (sp_check_commandavail(S_CMD_O_INIT)) {
 		/* This would be inconsistent. */
 		if (sp_check_commandavail(S_CMD_O_EXEC) == 0) {
@@ -0,0 +1,103 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Framing of the `flashrom --serve` protocol, shared by the server and
+ * flashrom_client. Doesn't depend on the rest of flashrom.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
+#include <linux/memfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "serve.h"
+
+int serve_send(int sock, const void *msg, size_t len, int fd)
+{
+	struct iovec iov = { .iov_base = (void *)msg, .iov_len = len };
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct msghdr hdr = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+	if (fd >= 0) {
+		memset(&control, 0, sizeof(control));
+		hdr.msg_control = control.buf;
+		hdr.msg_controllen = sizeof(control.buf);
+		struct cmsghdr *const cmsg = CMSG_FIRSTHDR(&hdr);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+
+	ssize_t sent;
+	do {
+		sent = sendmsg(sock, &hdr, MSG_NOSIGNAL);
+	} while (sent < 0 && errno == EINTR);
+	if (sent < 0)
+		return -1;
+	if ((size_t)sent != len) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	return 0;
+}
+
+int serve_recv(int sock, void *msg, size_t len, int *fd)
+{
+	struct iovec iov = { .iov_base = msg, .iov_len = len };
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct msghdr hdr = {
+		.msg_iov	= &iov,
+		.msg_iovlen	= 1,
+		.msg_control	= control.buf,
+		.msg_controllen	= sizeof(control.buf),
+	};
+
+	*fd = -1;
+	/* Not restarted on EINTR, the caller may have to stop. */
+	const ssize_t received = recvmsg(sock, &hdr, MSG_CMSG_CLOEXEC);
+	if (received < 0)
+		return -1;
+	if (received == 0)
+		return 1;
+
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+		    cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+			memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+	}
+	if ((size_t)received != len || (hdr.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+		if (*fd >= 0)
+			close(*fd);
+		*fd = -1;
+		errno = EPROTO;
+		return -1;
+	}
+	return 0;
+}
+
+int serve_memfd(const char *name, size_t size)
+{
+	/* glibc only has a wrapper since 2.27. */
+	const int fd = syscall(SYS_memfd_create, name, MFD_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (ftruncate(fd, size)) {
+		const int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	return fd;
+}
@@ -68,7 +68,8 @@ struct sfdp_tbl_hdr {
 	uint32_t ptp; /* 24b pointer */
 };
 
-static int sfdp_add_uniform_eraser(struct flashchip *chip, uint8_t opcode, uint32_t block_size)
+static int sfdp_add_uniform_eraser(struct flashchip *chip, uint8_t opcode, uint32_t block_size,
+				   unsigned int typ_erase_us)
 {
 	int i;
 	uint32_t total_size = chip->total_size * 1024;
@@ -89,6 +90,9 @@ static int sfdp_add_uniform_eraser(struct flashchip *chip, uint8_t opcode, uint3
 			msg_cdbg2("  Tried to add a duplicate block eraser: "
 				  "%"PRId32" x %"PRId32" B with opcode 0x%02x.\n",
 				  total_size/block_size, block_size, opcode);
+			/* The 4kB eraser from the 1st double word has no timing. */
+			if (!eraser->typ_erase_us)
+				eraser->typ_erase_us = typ_erase_us;
 			return 1;
 		}
 		if (eraser->eraseblocks[0].size != 0 ||
@@ -101,6 +105,7 @@ static int sfdp_add_uniform_eraser(struct flashchip *chip, uint8_t opcode, uint3
 		eraser->block_erase = erasefn;
 		eraser->eraseblocks[0].size = block_size;
 		eraser->eraseblocks[0].count = total_size/block_size;
+		eraser->typ_erase_us = typ_erase_us;
 		msg_cdbg2("  Block eraser %d: %"PRId32" x %"PRId32" B with opcode "
 			  "0x%02x\n", i, total_size/block_size, block_size,
 			  opcode);
@@ -126,9 +131,98 @@ static int compare_erasers(const void *aptr, const void *bptr)
 	return ((int) a->eraseblocks[0].size) - ((int) b->eraseblocks[0].size);
 }
 
+/* Decodes a typical erase time field of the 10th double word (JESD216A). */
+static unsigned int sfdp_erase_time_us(uint8_t field)
+{
+	static const unsigned int units_us[] = { 1000, 16 * 1000, 128 * 1000, 1000 * 1000 };
+
+	return ((field & 0x1f) + 1) * units_us[(field >> 5) & 0x3];
+}
+
+static uint32_t sfdp_dword(const uint8_t *buf, unsigned int n)
+{
+	return (uint32_t)buf[4 * n] | (uint32_t)buf[4 * n + 1] << 8 |
+	       (uint32_t)buf[4 * n + 2] << 16 | (uint32_t)buf[4 * n + 3] << 24;
+}
+
+/* Where the 1. double word announces a fast read and the 3. or 4. one describes it. */
+static const struct sfdp_fast_read {
+	enum spi_io_mode io_mode;
+	int feature;
+	unsigned int support_bit;
+	unsigned int dword;
+	unsigned int shift;
+	const char *name;
+} sfdp_fast_reads[] = {
+	{ SPI_IO_1_1_2, FEATURE_FAST_READ_DOUT, 16, 3,  0, "dual output (1-1-2)" },
+	{ SPI_IO_1_2_2, FEATURE_FAST_READ_DIO,  20, 3, 16, "dual I/O (1-2-2)" },
+	{ SPI_IO_1_1_4, FEATURE_FAST_READ_QOUT, 22, 2, 16, "quad output (1-1-4)" },
+	{ SPI_IO_1_4_4, FEATURE_FAST_READ_QIO,  21, 2,  0, "quad I/O (1-4-4)" },
+};
+
+/*
+ * Fast read fields hold the wait states in bits 4:0, the mode clocks in bits 7:5
+ * and the instruction in bits 15:8.
+ */
+static void sfdp_add_fast_reads(struct flashchip *chip, const uint8_t *buf, uint32_t dword1)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(sfdp_fast_reads); i++) {
+		const struct sfdp_fast_read *const fr = &sfdp_fast_reads[i];
+		const uint32_t field = sfdp_dword(buf, fr->dword) >> fr->shift;
+		const struct spi_read_insn insn = {
+			.opcode		= (field >> 8) & 0xff,
+			.mode_clocks	= (field >> 5) & 0x7,
+			.wait_states	= field & 0x1f,
+		};
+
+		if (!(dword1 & (1 << fr->support_bit)) || insn.opcode == 0x00 || insn.opcode == 0xff)
+			continue;
+		chip->fast_read[fr->io_mode] = insn;
+		chip->feature_bits |= fr->feature;
+		msg_cdbg2("  Supports %s fast read with opcode 0x%02x, %u mode and %u wait clocks.\n",
+			  fr->name, insn.opcode, insn.mode_clocks, insn.wait_states);
+	}
+}
+
+/*
+ * The quad enable requirements in bits 22:20 of the 15. double word. Quad
+ * reads are only used if the QE bit can be read and is set.
+ */
+static void sfdp_set_quad_enable(struct flashchip *chip, uint32_t dword15)
+{
+	switch ((dword15 >> 20) & 0x7) {
+	case 0x0: /* No QE bit, IO2 and IO3 are always data lines. */
+		break;
+	case 0x2:
+		chip->reg_bits.qe = (struct reg_bit_info){ STATUS1, 6, RW };
+		break;
+	case 0x4:
+	case 0x5:
+	case 0x6: /* SR2 read with 0x35 and written with 0x31. */
+		/*
+		 * Bit 1 of SR2. How SR2 is read and written is up to the chip's
+		 * feature bits, without them spi_read_chunked() can't check it.
+		 */
+		chip->reg_bits.qe = (struct reg_bit_info){ STATUS2, 1, RW };
+		break;
+	default:
+		/*
+		 * 0x1 is bit 1 of SR2 without an instruction to read SR2, 0x3 is
+		 * bit 7 of SR2 read with 0x3f, 0x7 is reserved. None of them can
+		 * be checked.
+		 */
+		chip->feature_bits &= ~(FEATURE_FAST_READ_QOUT | FEATURE_FAST_READ_QIO);
+		break;
+	}
+}
+
 static int sfdp_fill_flash(struct flashchip *chip, uint8_t *buf, uint16_t len)
 {
+	unsigned int typ_erase_us[4] = { 0 };
 	uint8_t opcode_4k_erase = 0xFF;
+	uint32_t dword1;
 	uint32_t tmp32;
 	uint8_t tmp8;
 	uint32_t total_size; /* in bytes */
@@ -191,6 +285,8 @@ static int sfdp_fill_flash(struct flashchip *chip, uint8_t *buf, uint16_t len)
 		chip->write = SPI_CHIP_WRITE1;
 	}
 
+	dword1 = tmp32;
+
 	if ((tmp32 & 0x3) == 0x1) {
 		opcode_4k_erase = (tmp32 >> 8) & 0xFF;
 		msg_cspew("  4kB erase opcode is 0x%02x.\n", opcode_4k_erase);
@@ -217,18 +313,54 @@ static int sfdp_fill_flash(struct flashchip *chip, uint8_t *buf, uint16_t len)
 		return 1;
 	}
 
+	/* 3. and 4. double word: multi-I/O fast read instructions */
+	sfdp_add_fast_reads(chip, buf, dword1);
+
 	if (opcode_4k_erase != 0xFF)
-		sfdp_add_uniform_eraser(chip, opcode_4k_erase, 4 * 1024);
+		sfdp_add_uniform_eraser(chip, opcode_4k_erase, 4 * 1024, 0);
 
-	/* FIXME: double words 3-7 contain unused fast read information */
+	/* FIXME: double words 5-7 contain unused fast read information (2-2-2 and 4-4-4) */
 
 	if (len == 4 * 4) {
 		msg_cdbg("  It seems like this chip supports the preliminary "
 			 "Intel version of SFDP, skipping processing of double "
-			 "words 3-9.\n");
+			 "words 5-9.\n");
 		goto done;
 	}
 
+	/* 10. and 11. double word, only present since JESD216A */
+	if (len >= 11 * 4) {
+		tmp32 =  ((unsigned int)buf[(4 * 9) + 0]);
+		tmp32 |= ((unsigned int)buf[(4 * 9) + 1]) << 8;
+		tmp32 |= ((unsigned int)buf[(4 * 9) + 2]) << 16;
+		tmp32 |= ((unsigned int)buf[(4 * 9) + 3]) << 24;
+		for (j = 0; j < 4; j++) {
+			typ_erase_us[j] = sfdp_erase_time_us((tmp32 >> (4 + 7 * j)) & 0x7f);
+			msg_cspew("   Erase Sector Type %d typical time: %u us\n", j + 1, typ_erase_us[j]);
+		}
+		chip->max_erase_time_factor = 2 * ((tmp32 & 0xf) + 1);
+		msg_cdbg2("  Maximum erase times are %u times the typical ones.\n", chip->max_erase_time_factor);
+
+		tmp32 =  ((unsigned int)buf[(4 * 10) + 0]);
+		tmp32 |= ((unsigned int)buf[(4 * 10) + 1]) << 8;
+		tmp32 |= ((unsigned int)buf[(4 * 10) + 2]) << 16;
+		tmp32 |= ((unsigned int)buf[(4 * 10) + 3]) << 24;
+		chip->typ_page_program_us = (((tmp32 >> 8) & 0x1f) + 1) * ((tmp32 & (1 << 13)) ? 64 : 8);
+		msg_cdbg2("  Typical page program time is %u us.\n", chip->typ_page_program_us);
+		chip->typ_byte_program_us = (((tmp32 >> 14) & 0xf) + 1) * ((tmp32 & (1 << 18)) ? 8 : 1);
+		msg_cdbg2("  Typical byte program time is %u us.\n", chip->typ_byte_program_us);
+		static const unsigned int chip_erase_units_ms[] = { 16, 256, 4 * 1000, 64 * 1000 };
+		chip->typ_chip_erase_us = (((tmp32 >> 24) & 0x1f) + 1) *
+					  chip_erase_units_ms[(tmp32 >> 29) & 0x3] * 1000;
+		msg_cdbg2("  Typical chip erase time is %u ms.\n", chip->typ_chip_erase_us / 1000);
+		chip->max_time_factor = 2 * ((tmp32 & 0xf) + 1);
+		msg_cdbg2("  Maximum program times are %u times the typical ones.\n", chip->max_time_factor);
+	}
+
+	/* 15. double word, only present since JESD216B */
+	if (len >= 15 * 4)
+		sfdp_set_quad_enable(chip, sfdp_dword(buf, 14));
+
 	/* 8. double word */
 	for (j = 0; j < 4; j++) {
 		/* 7 double words from the start + 2 bytes for every eraser */
@@ -249,7 +381,7 @@ static int sfdp_fill_flash(struct flashchip *chip, uint8_t *buf, uint16_t len)
 		tmp8 = buf[(4 * 7) + (j * 2) + 1];
 		msg_cspew("   Erase Sector Type %d Opcode: 0x%02x\n", j + 1,
 			  tmp8);
-		sfdp_add_uniform_eraser(chip, tmp8, block_size);
+		sfdp_add_uniform_eraser(chip, tmp8, block_size, typ_erase_us[j]);
 	}
 
 	/* Sort block erasers in ascending order by size; this is required
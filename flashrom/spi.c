@@ -17,6 +17,8 @@
 #include "flashchips.h"
 #include "chipdrivers.h"
 #include "programmer.h"
+#include "stats.h"
+#include "trace.h"
 
 static int default_spi_send_command(const struct flashctx *flash, unsigned int writecnt,
 			     unsigned int readcnt,
@@ -44,6 +46,9 @@ static int default_spi_send_multicommand(const struct flashctx *flash,
 {
 	int result = 0;
 	for (; (cmds->writecnt || cmds->readcnt) && !result; cmds++) {
+		/* Single commands are always sent on one line. */
+		if (cmds->io_mode != SPI_IO_1_1_1 || cmds->dummy_cycles)
+			return SPI_INVALID_OPCODE;
 		result = spi_send_command(flash, cmds->writecnt, cmds->readcnt,
 					  cmds->writearr, cmds->readarr);
 	}
@@ -54,16 +59,28 @@ int spi_send_command(const struct flashctx *flash, unsigned int writecnt,
 		     unsigned int readcnt, const unsigned char *writearr,
 		     unsigned char *readarr)
 {
-	if (flash->mst->spi.command)
-		return flash->mst->spi.command(flash, writecnt, readcnt, writearr, readarr);
-	return default_spi_send_command(flash, writecnt, readcnt, writearr, readarr);
+	if (!flash->mst->spi.command)
+		return default_spi_send_command(flash, writecnt, readcnt, writearr, readarr);
+
+	const uint64_t start = stats_start(flash);
+	const uint64_t trace_start = trace_begin(flash);
+	const int ret = flash->mst->spi.command(flash, writecnt, readcnt, writearr, readarr);
+	stats_count_command(flash, writecnt, readcnt, writearr, start);
+	trace_command(flash, writecnt, readcnt, writearr, readarr, ret, trace_start);
+	return ret;
 }
 
 int spi_send_multicommand(const struct flashctx *flash, struct spi_command *cmds)
 {
-	if (flash->mst->spi.multicommand)
-		return flash->mst->spi.multicommand(flash, cmds);
-	return default_spi_send_multicommand(flash, cmds);
+	if (!flash->mst->spi.multicommand)
+		return default_spi_send_multicommand(flash, cmds);
+
+	const uint64_t start = stats_start(flash);
+	const uint64_t trace_start = trace_begin(flash);
+	const int ret = flash->mst->spi.multicommand(flash, cmds);
+	stats_count_multicommand(flash, cmds, start);
+	trace_multicommand(flash, cmds, ret, trace_start);
+	return ret;
 }
 
 int default_spi_read(struct flashctx *flash, uint8_t *buf, unsigned int start,
@@ -102,7 +119,15 @@ int spi_chip_read(struct flashctx *flash, uint8_t *buf, unsigned int start,
 		   o multi-die 4-byte-addressing chips,
 		   o dediprog that has a protocol limit of 32MiB-512B. */
 		to_read = min(ALIGN_DOWN(start + 16*MiB, 16*MiB) - start, len);
+		const uint64_t stats_start_ns = stats_start(flash);
+		const uint64_t transactions = stats_transactions(flash);
+		const uint64_t trace_start = trace_begin(flash);
+		const uint64_t commands = trace_commands(flash);
 		ret = flash->mst->spi.read(flash, buf, start, to_read);
+		/* Masters that read with SPI commands have been counted and traced already. */
+		stats_count_transfer(flash, 0, to_read, transactions, stats_start_ns);
+		if (trace_commands(flash) == commands)
+			trace_range(flash, TRACE_SPI_READ, start, to_read, buf, ret, trace_start);
 		if (ret)
 			return ret;
 	}
@@ -118,7 +143,15 @@ int spi_chip_read(struct flashctx *flash, uint8_t *buf, unsigned int start,
 /* real chunksize is up to 256, logical chunksize is 256 */
 int spi_chip_write_256(struct flashctx *flash, const uint8_t *buf, unsigned int start, unsigned int len)
 {
-	return flash->mst->spi.write_256(flash, buf, start, len);
+	const uint64_t stats_start_ns = stats_start(flash);
+	const uint64_t transactions = stats_transactions(flash);
+	const uint64_t trace_start = trace_begin(flash);
+	const uint64_t commands = trace_commands(flash);
+	const int ret = flash->mst->spi.write_256(flash, buf, start, len);
+	stats_count_transfer(flash, len, 0, transactions, stats_start_ns);
+	if (trace_commands(flash) == commands)
+		trace_range(flash, TRACE_SPI_WRITE, start, len, NULL, ret, trace_start);
+	return ret;
 }
 
 int spi_aai_write(struct flashctx *flash, const uint8_t *buf, unsigned int start, unsigned int len)
@@ -197,6 +230,17 @@ static const struct {
 	{S25FS_BLOCK_ERASE_D8, {0xd8}},
 };
 
+/* Like spi_get_opcode_from_erasefn(), but quietly returns NULL for non-SPI erase functions. */
+const uint8_t *spi_find_opcode_from_erasefn(enum block_erase_func func)
+{
+	size_t i;
+	for (i = 0; i < ARRAY_SIZE(function_opcode_list); i++) {
+		if (function_opcode_list[i].func == func)
+			return function_opcode_list[i].opcode;
+	}
+	return NULL;
+}
+
 /*
  * @brief Get erase function pointer from passed opcode list.
  *
@@ -212,11 +256,9 @@ static const struct {
  */
 const uint8_t *spi_get_opcode_from_erasefn(enum block_erase_func func)
 {
-	size_t i;
-	for (i = 0; i < ARRAY_SIZE(function_opcode_list); i++) {
-		if (function_opcode_list[i].func == func)
-			return function_opcode_list[i].opcode;
-	}
+	const uint8_t *const opcode = spi_find_opcode_from_erasefn(func);
+	if (opcode)
+		return opcode;
 	msg_cinfo("%s: unknown erase function (0x%d). Please report "
 			"this at flashrom@flashrom.org\n", __func__, func);
 	return NULL;
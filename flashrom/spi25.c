@@ -17,6 +17,7 @@
 #include "chipdrivers.h"
 #include "programmer.h"
 #include "spi.h"
+#include "stats.h"
 
 enum id_type {
 	RDID,
@@ -27,14 +28,9 @@ enum id_type {
 	NUM_ID_TYPES,
 };
 
-static struct {
-	bool is_cached;
-	unsigned char bytes[4];		/* enough to hold largest ID type */
-} id_cache[NUM_ID_TYPES];
-
-void clear_spi_id_cache(void)
+void clear_spi_id_cache(struct flashrom_programmer *prog)
 {
-	memset(id_cache, 0, sizeof(id_cache));
+	memset(prog->spi_id_cache, 0, sizeof(prog->spi_id_cache));
 	return;
 }
 
@@ -147,46 +143,99 @@ static int compare_id(const struct flashctx *flash, uint32_t id1, uint32_t id2)
 	return 0;
 }
 
-static int probe_spi_rdid_generic(struct flashctx *flash, int bytes)
+/* Sends the ID command of the given type unless its answer is cached already. */
+static int get_cached_ids(struct flashctx *flash, enum id_type idty, uint32_t *id1, uint32_t *id2)
 {
-	uint32_t id1, id2;
-	enum id_type idty = bytes == 3 ? RDID : RDID4;
-
-	if (!id_cache[idty].is_cached) {
-		const int ret = spi_rdid(flash, id_cache[idty].bytes, bytes);
-		if (ret == SPI_INVALID_LENGTH)
-			msg_cinfo("%d byte RDID not supported on this SPI controller\n", bytes);
-		if (ret)
-			return 0;
-		id_cache[idty].is_cached = true;
+	const int bytes = idty == RDID4 ? 4 : 3;
+	/* The answers are kept per programmer, several may be probed at once. */
+	struct spi_id_cache_entry *const id_cache = programmer_of(flash)->spi_id_cache;
+
+	switch (idty) {
+	case RDID:
+	case RDID4:
+		if (!id_cache[idty].is_cached) {
+			const int ret = spi_rdid(flash, id_cache[idty].bytes, bytes);
+			if (ret == SPI_INVALID_LENGTH)
+				msg_cinfo("%d byte RDID not supported on this SPI controller\n", bytes);
+			if (ret)
+				return 1;
+			id_cache[idty].is_cached = true;
+		}
+		rdid_get_ids(id_cache[idty].bytes, bytes, id1, id2);
+		return 0;
+	case REMS:
+		if (!id_cache[REMS].is_cached) {
+			if (spi_rems(flash, id_cache[REMS].bytes))
+				return 1;
+			id_cache[REMS].is_cached = true;
+		}
+		*id1 = id_cache[REMS].bytes[0];
+		*id2 = id_cache[REMS].bytes[1];
+		return 0;
+	case RES2:
+		if (!id_cache[RES2].is_cached) {
+			if (spi_res(flash, id_cache[RES2].bytes, 2))
+				return 1;
+			id_cache[RES2].is_cached = true;
+		}
+		*id1 = id_cache[RES2].bytes[0];
+		*id2 = id_cache[RES2].bytes[1];
+		return 0;
+	case RES3:
+		if (!id_cache[RES3].is_cached) {
+			if (spi_res(flash, id_cache[RES3].bytes, 3))
+				return 1;
+			id_cache[RES3].is_cached = true;
+		}
+		*id1 = (id_cache[RES3].bytes[0] << 8) | id_cache[RES3].bytes[1];
+		*id2 = id_cache[RES3].bytes[3];
+		return 0;
+	case NUM_ID_TYPES:
+		break;
 	}
+	return 1;
+}
 
-	rdid_get_ids(id_cache[idty].bytes, bytes, &id1, &id2);
-	return compare_id(flash, id1, id2);
+int spi_read_probe_ids(struct flashctx *flash, enum probe_func probe, uint32_t *id1, uint32_t *id2)
+{
+	switch (probe) {
+	case PROBE_SPI_RDID:
+		return get_cached_ids(flash, RDID, id1, id2);
+	case PROBE_SPI_RDID4:
+		return get_cached_ids(flash, RDID4, id1, id2);
+	case PROBE_SPI_REMS:
+		return get_cached_ids(flash, REMS, id1, id2);
+	case PROBE_SPI_RES2:
+		return get_cached_ids(flash, RES2, id1, id2);
+	default:
+		return 1;
+	}
 }
 
 int probe_spi_rdid(struct flashctx *flash)
 {
-	return probe_spi_rdid_generic(flash, 3);
+	uint32_t id1, id2;
+
+	if (get_cached_ids(flash, RDID, &id1, &id2))
+		return 0;
+	return compare_id(flash, id1, id2);
 }
 
 int probe_spi_rdid4(struct flashctx *flash)
 {
-	return probe_spi_rdid_generic(flash, 4);
+	uint32_t id1, id2;
+
+	if (get_cached_ids(flash, RDID4, &id1, &id2))
+		return 0;
+	return compare_id(flash, id1, id2);
 }
 
 int probe_spi_rems(struct flashctx *flash)
 {
 	uint32_t id1, id2;
 
-	if (!id_cache[REMS].is_cached) {
-		if (spi_rems(flash, id_cache[REMS].bytes))
-			return 0;
-		id_cache[REMS].is_cached = true;
-	}
-
-	id1 = id_cache[REMS].bytes[0];
-	id2 = id_cache[REMS].bytes[1];
+	if (get_cached_ids(flash, REMS, &id1, &id2))
+		return 0;
 	return compare_id(flash, id1, id2);
 }
 
@@ -235,14 +284,8 @@ int probe_spi_res2(struct flashctx *flash)
 {
 	uint32_t id1, id2;
 
-	if (!id_cache[RES2].is_cached) {
-		if (spi_res(flash, id_cache[RES2].bytes, 2))
-			return 0;
-		id_cache[RES2].is_cached = true;
-	}
-
-	id1 = id_cache[RES2].bytes[0];
-	id2 = id_cache[RES2].bytes[1];
+	if (get_cached_ids(flash, RES2, &id1, &id2))
+		return 0;
 	msg_cdbg("%s: id1 0x%"PRIx32", id2 0x%"PRIx32"\n", __func__, id1, id2);
 
 	if (id1 != flash->chip->manufacture_id || id2 != flash->chip->model_id)
@@ -255,14 +298,8 @@ int probe_spi_res3(struct flashctx *flash)
 {
 	uint32_t id1, id2;
 
-	if (!id_cache[RES3].is_cached) {
-		if (spi_res(flash, id_cache[RES3].bytes, 3))
-			return 0;
-		id_cache[RES3].is_cached = true;
-	}
-
-	id1 = (id_cache[RES3].bytes[0] << 8) | id_cache[RES3].bytes[1];
-	id2 = id_cache[RES3].bytes[3];
+	if (get_cached_ids(flash, RES3, &id1, &id2))
+		return 0;
 	msg_cdbg("%s: id1 0x%"PRIx32", id2 0x%"PRIx32"\n", __func__, id1, id2);
 
 	if (id1 != flash->chip->manufacture_id || id2 != flash->chip->model_id)
@@ -293,30 +330,125 @@ int probe_spi_at25f(struct flashctx *flash)
 	return 0;
 }
 
-static int spi_poll_wip(struct flashctx *const flash, const unsigned int poll_delay)
+/* Shortest interval between two WIP polls in us. */
+#define WIP_MIN_POLL_US		1
+
+static bool is_program_op(const uint8_t op)
+{
+	return op == JEDEC_BYTE_PROGRAM || op == JEDEC_BYTE_PROGRAM_4BA || op == JEDEC_AAI_WORD_PROGRAM;
+}
+
+/* Programming less than half a page is timed like a single byte and not learned from. */
+static bool is_short_program(const struct flashctx *flash, const uint8_t op, const size_t len)
+{
+	return is_program_op(op) && len < flash->chip->page_size / 2;
+}
+
+/* Typical time in us the chip stays busy after `op` according to flashchips.c or SFDP, 0 if unknown. */
+unsigned int spi_chip_typ_busy_us(const struct flashctx *flash, const uint8_t op, const size_t len)
+{
+	const struct flashchip *const chip = flash->chip;
+	unsigned int typ_us = 0;
+
+	if (is_short_program(flash, op, len))
+		return chip->typ_byte_program_us;
+	if (is_program_op(op))
+		return chip->typ_page_program_us;
+
+	for (size_t i = 0; i < NUM_ERASEFUNCTIONS && !typ_us; i++) {
+		const enum block_erase_func func = chip->block_erasers[i].block_erase;
+		if (func == NO_BLOCK_ERASE_FUNC)
+			continue;
+		const uint8_t *const eraser_op = spi_find_opcode_from_erasefn(func);
+		if (eraser_op && *eraser_op == op)
+			typ_us = chip->block_erasers[i].typ_erase_us;
+	}
+	if (!typ_us && (op == JEDEC_CE_60 || op == JEDEC_CE_62 || op == JEDEC_CE_C7))
+		typ_us = chip->typ_chip_erase_us;
+	return typ_us;
+}
+
+/**
+ * Wait for the chip to finish `op` by polling WIP.
+ *
+ * Most of the typical time of `op` is slept through before the first poll, so
+ * a 150ms erase doesn't cost hundreds of status reads on slow programmers.
+ * Without chip data the time this opcode took before is used instead. After
+ * that the interval doubles, up to `poll_us` or a quarter of the typical time,
+ * whichever is longer.
+ *
+ * @param flash    the flash chip's context
+ * @param op       the opcode that made the chip busy
+ * @param len      number of data bytes sent with `op`
+ * @param poll_us  longest interval between two polls in us
+ * @param max_us   give up if the chip is still busy after this long, unless
+ *                 the chip data tells how long `op` may take at most
+ * @return 0 on success, TIMEOUT_ERROR if the chip stays busy, non-zero on other errors
+ */
+int spi_poll_wip(struct flashctx *const flash, const uint8_t op, const size_t len,
+		 const unsigned int poll_us, const unsigned int max_us)
 {
-	/* FIXME: We don't time out. */
+	const bool learnable = !is_short_program(flash, op, len);
+	const unsigned int chip_typ_us = spi_chip_typ_busy_us(flash, op, len);
+	const unsigned int typ_us = chip_typ_us ? chip_typ_us : learnable ? flash->learned_busy_us[op] : 0;
+	const unsigned int max_factor = is_program_op(op) ? flash->chip->max_time_factor
+							  : flash->chip->max_erase_time_factor;
+	uint64_t timeout_us = max_us;
+	if (chip_typ_us && max_factor)
+		timeout_us = (uint64_t)chip_typ_us * max_factor;
+
+	const uint64_t start = stats_time_ns();
+	unsigned int interval = max(poll_us / 8, WIP_MIN_POLL_US);
+	unsigned int max_interval = poll_us;
+	uint64_t waited_us = 0;
+
+	if (typ_us) {
+		waited_us = typ_us - typ_us / 4;
+		programmer_delay(flash, waited_us);
+		interval = max(typ_us / 16, WIP_MIN_POLL_US);
+		max_interval = max(poll_us, typ_us / 4);
+	}
+
 	while (true) {
 		uint8_t status;
 		int ret = spi_read_register(flash, STATUS1, &status);
 		if (ret)
 			return ret;
+		stats_count_wip_poll(flash);
 		if (!(status & SPI_SR_WIP))
-			return 0;
+			break;
+
+		if (waited_us >= timeout_us) {
+			msg_cerr("%s: chip still busy %"PRIu64" us after opcode 0x%02x, giving up.\n",
+				 __func__, waited_us, op);
+			return TIMEOUT_ERROR;
+		}
+		programmer_delay(flash, interval);
+		waited_us += interval;
+		interval = min(interval * 2, max_interval);
+	}
 
-		programmer_delay(flash, poll_delay);
+	stats_count_busy(flash, op, start);
+	if (learnable) {
+		const uint64_t now = stats_time_ns();
+		const uint64_t busy_us = now > start ? (now - start) / 1000 : 0;
+		unsigned int *const learned = &flash->learned_busy_us[op];
+		*learned = *learned ? (3 * (uint64_t)*learned + busy_us) / 4 : busy_us;
 	}
+	return 0;
 }
 
 /**
  * Execute WREN plus another one byte `op`, optionally poll WIP afterwards.
  *
- * @param flash       the flash chip's context
- * @param op          the operation to execute
- * @param poll_delay  interval in us for polling WIP, don't poll if zero
+ * @param flash    the flash chip's context
+ * @param op       the operation to execute
+ * @param poll_us  longest interval in us for polling WIP, don't poll if zero
+ * @param max_us   WIP timeout in us, see spi_poll_wip()
  * @return 0 on success, non-zero otherwise
  */
-static int spi_simple_write_cmd(struct flashctx *const flash, const uint8_t op, const unsigned int poll_delay)
+static int spi_simple_write_cmd(struct flashctx *const flash, const uint8_t op,
+				const unsigned int poll_us, const unsigned int max_us)
 {
 	struct spi_command cmds[] = {
 	{
@@ -335,7 +467,7 @@ static int spi_simple_write_cmd(struct flashctx *const flash, const uint8_t op,
 	if (result)
 		msg_cerr("%s failed during command execution\n", __func__);
 
-	const int status = poll_delay ? spi_poll_wip(flash, poll_delay) : 0;
+	const int status = poll_us ? spi_poll_wip(flash, op, 0, poll_us, max_us) : 0;
 
 	return result ? result : status;
 }
@@ -420,13 +552,14 @@ static int spi_prepare_address(struct flashctx *const flash, uint8_t cmd_buf[],
  * @param out_bytes   bytes to send after the address,
  *                    may be NULL if and only if `out_bytes` is 0
  * @param out_bytes   number of bytes to send, 256 at most, may be zero
- * @param poll_delay  interval in us for polling WIP
+ * @param poll_us     longest interval in us for polling WIP
+ * @param max_us      WIP timeout in us, see spi_poll_wip()
  * @return 0 on success, non-zero otherwise
  */
 static int spi_write_cmd(struct flashctx *const flash, const uint8_t op,
 			 const bool native_4ba, const unsigned int addr,
 			 const uint8_t *const out_bytes, const size_t out_len,
-			 const unsigned int poll_delay)
+			 const unsigned int poll_us, const unsigned int max_us)
 {
 	uint8_t cmd[1 + JEDEC_MAX_ADDR_LEN + 256];
 	struct spi_command cmds[] = {
@@ -460,34 +593,34 @@ static int spi_write_cmd(struct flashctx *const flash, const uint8_t op,
 	if (result)
 		msg_cerr("%s failed during command execution at address 0x%x\n", __func__, addr);
 
-	const int status = spi_poll_wip(flash, poll_delay);
+	const int status = spi_poll_wip(flash, op, out_len, poll_us, max_us);
 
 	return result ? result : status;
 }
 
 static int spi_chip_erase_60(struct flashctx *flash)
 {
-	/* This usually takes 1-85s, so wait in 1s steps. */
-	return spi_simple_write_cmd(flash, JEDEC_CE_60, 1000 * 1000);
+	/* This usually takes 1-85s, so wait in 1s steps and give up after 400s. */
+	return spi_simple_write_cmd(flash, JEDEC_CE_60, 1000 * 1000, 400 * 1000 * 1000);
 }
 
 static int spi_chip_erase_62(struct flashctx *flash)
 {
-	/* This usually takes 2-5s, so wait in 100ms steps. */
-	return spi_simple_write_cmd(flash, JEDEC_CE_62, 100 * 1000);
+	/* This usually takes 2-5s, so wait in 100ms steps and give up after 20s. */
+	return spi_simple_write_cmd(flash, JEDEC_CE_62, 100 * 1000, 20 * 1000 * 1000);
 }
 
 static int spi_chip_erase_c7(struct flashctx *flash)
 {
-	/* This usually takes 1-85s, so wait in 1s steps. */
-	return spi_simple_write_cmd(flash, JEDEC_CE_C7, 1000 * 1000);
+	/* This usually takes 1-85s, so wait in 1s steps and give up after 400s. */
+	return spi_simple_write_cmd(flash, JEDEC_CE_C7, 1000 * 1000, 400 * 1000 * 1000);
 }
 
 int spi_block_erase_52(struct flashctx *flash, unsigned int addr,
 		       unsigned int blocklen)
 {
-	/* This usually takes 100-4000ms, so wait in 100ms steps. */
-	return spi_write_cmd(flash, JEDEC_BE_52, false, addr, NULL, 0, 100 * 1000);
+	/* This usually takes 100-4000ms, so wait in 100ms steps and give up after 16s. */
+	return spi_write_cmd(flash, JEDEC_BE_52, false, addr, NULL, 0, 100 * 1000, 16 * 1000 * 1000);
 }
 
 /* Block size is usually
@@ -495,8 +628,8 @@ int spi_block_erase_52(struct flashctx *flash, unsigned int addr,
  */
 int spi_block_erase_c4(struct flashctx *flash, unsigned int addr, unsigned int blocklen)
 {
-	/* This usually takes 240-480s, so wait in 500ms steps. */
-	return spi_write_cmd(flash, JEDEC_BE_C4, false, addr, NULL, 0, 500 * 1000);
+	/* This usually takes 240-480s, so wait in 500ms steps and give up after 2000s. */
+	return spi_write_cmd(flash, JEDEC_BE_C4, false, addr, NULL, 0, 500 * 1000, 2000u * 1000 * 1000);
 }
 
 /* Block size is usually
@@ -507,8 +640,8 @@ int spi_block_erase_c4(struct flashctx *flash, unsigned int addr, unsigned int b
 int spi_block_erase_d8(struct flashctx *flash, unsigned int addr,
 		       unsigned int blocklen)
 {
-	/* This usually takes 100-4000ms, so wait in 100ms steps. */
-	return spi_write_cmd(flash, JEDEC_BE_D8, false, addr, NULL, 0, 100 * 1000);
+	/* This usually takes 100-4000ms, so wait in 100ms steps and give up after 16s. */
+	return spi_write_cmd(flash, JEDEC_BE_D8, false, addr, NULL, 0, 100 * 1000, 16 * 1000 * 1000);
 }
 
 /* Block size is usually
@@ -517,36 +650,36 @@ int spi_block_erase_d8(struct flashctx *flash, unsigned int addr,
 int spi_block_erase_d7(struct flashctx *flash, unsigned int addr,
 		       unsigned int blocklen)
 {
-	/* This usually takes 100-4000ms, so wait in 100ms steps. */
-	return spi_write_cmd(flash, JEDEC_BE_D7, false, addr, NULL, 0, 100 * 1000);
+	/* This usually takes 100-4000ms, so wait in 100ms steps and give up after 16s. */
+	return spi_write_cmd(flash, JEDEC_BE_D7, false, addr, NULL, 0, 100 * 1000, 16 * 1000 * 1000);
 }
 
 /* Page erase (usually 256B blocks) */
 int spi_block_erase_db(struct flashctx *flash, unsigned int addr, unsigned int blocklen)
 {
 	/* This takes up to 20ms usually (on worn out devices
-	   up to the 0.5s range), so wait in 1ms steps. */
-	return spi_write_cmd(flash, 0xdb, false, addr, NULL, 0, 1 * 1000);
+	   up to the 0.5s range), so wait in 1ms steps and give up after 1s. */
+	return spi_write_cmd(flash, 0xdb, false, addr, NULL, 0, 1 * 1000, 1000 * 1000);
 }
 
 /* Sector size is usually 4k, though Macronix eliteflash has 64k */
 int spi_block_erase_20(struct flashctx *flash, unsigned int addr,
 		       unsigned int blocklen)
 {
-	/* This usually takes 15-800ms, so wait in 10ms steps. */
-	return spi_write_cmd(flash, JEDEC_SE, false, addr, NULL, 0, 10 * 1000);
+	/* This usually takes 15-800ms, so wait in 10ms steps and give up after 4s. */
+	return spi_write_cmd(flash, JEDEC_SE, false, addr, NULL, 0, 10 * 1000, 4 * 1000 * 1000);
 }
 
 int spi_block_erase_50(struct flashctx *flash, unsigned int addr, unsigned int blocklen)
 {
-	/* This usually takes 10ms, so wait in 1ms steps. */
-	return spi_write_cmd(flash, JEDEC_BE_50, false, addr, NULL, 0, 1 * 1000);
+	/* This usually takes 10ms, so wait in 1ms steps and give up after 1s. */
+	return spi_write_cmd(flash, JEDEC_BE_50, false, addr, NULL, 0, 1 * 1000, 1000 * 1000);
 }
 
 int spi_block_erase_81(struct flashctx *flash, unsigned int addr, unsigned int blocklen)
 {
-	/* This usually takes 8ms, so wait in 1ms steps. */
-	return spi_write_cmd(flash, JEDEC_BE_81, false, addr, NULL, 0, 1 * 1000);
+	/* This usually takes 8ms, so wait in 1ms steps and give up after 1s. */
+	return spi_write_cmd(flash, JEDEC_BE_81, false, addr, NULL, 0, 1 * 1000, 1000 * 1000);
 }
 
 int spi_block_erase_60(struct flashctx *flash, unsigned int addr,
@@ -584,29 +717,29 @@ int spi_block_erase_c7(struct flashctx *flash, unsigned int addr,
 /* Erase 4 KB of flash with 4-bytes address from ANY mode (3-bytes or 4-bytes) */
 int spi_block_erase_21(struct flashctx *flash, unsigned int addr, unsigned int blocklen)
 {
-	/* This usually takes 15-800ms, so wait in 10ms steps. */
-	return spi_write_cmd(flash, 0x21, true, addr, NULL, 0, 10 * 1000);
+	/* This usually takes 15-800ms, so wait in 10ms steps and give up after 4s. */
+	return spi_write_cmd(flash, 0x21, true, addr, NULL, 0, 10 * 1000, 4 * 1000 * 1000);
 }
 
 /* Erase 32 KB of flash with 4-bytes address from ANY mode (3-bytes or 4-bytes) */
 int spi_block_erase_53(struct flashctx *flash, unsigned int addr, unsigned int blocklen)
 {
-	/* This usually takes 100-4000ms, so wait in 100ms steps. */
-	return spi_write_cmd(flash, 0x53, true, addr, NULL, 0, 100 * 1000);
+	/* This usually takes 100-4000ms, so wait in 100ms steps and give up after 16s. */
+	return spi_write_cmd(flash, 0x53, true, addr, NULL, 0, 100 * 1000, 16 * 1000 * 1000);
 }
 
 /* Erase 32 KB of flash with 4-bytes address from ANY mode (3-bytes or 4-bytes) */
 int spi_block_erase_5c(struct flashctx *flash, unsigned int addr, unsigned int blocklen)
 {
-	/* This usually takes 100-4000ms, so wait in 100ms steps. */
-	return spi_write_cmd(flash, 0x5c, true, addr, NULL, 0, 100 * 1000);
+	/* This usually takes 100-4000ms, so wait in 100ms steps and give up after 16s. */
+	return spi_write_cmd(flash, 0x5c, true, addr, NULL, 0, 100 * 1000, 16 * 1000 * 1000);
 }
 
 /* Erase 64 KB of flash with 4-bytes address from ANY mode (3-bytes or 4-bytes) */
 int spi_block_erase_dc(struct flashctx *flash, unsigned int addr, unsigned int blocklen)
 {
-	/* This usually takes 100-4000ms, so wait in 100ms steps. */
-	return spi_write_cmd(flash, 0xdc, true, addr, NULL, 0, 100 * 1000);
+	/* This usually takes 100-4000ms, so wait in 100ms steps and give up after 16s. */
+	return spi_write_cmd(flash, 0xdc, true, addr, NULL, 0, 100 * 1000, 16 * 1000 * 1000);
 }
 
 static const struct {
@@ -646,7 +779,7 @@ static int spi_nbyte_program(struct flashctx *flash, unsigned int addr, const ui
 {
 	const bool native_4ba = flash->chip->feature_bits & FEATURE_4BA_WRITE && spi_master_4ba(flash);
 	const uint8_t op = native_4ba ? JEDEC_BYTE_PROGRAM_4BA : JEDEC_BYTE_PROGRAM;
-	return spi_write_cmd(flash, op, native_4ba, addr, bytes, len, 10);
+	return spi_write_cmd(flash, op, native_4ba, addr, bytes, len, 10, 100 * 1000);
 }
 
 int spi_nbyte_read(struct flashctx *flash, unsigned int address, uint8_t *bytes,
@@ -663,18 +796,130 @@ int spi_nbyte_read(struct flashctx *flash, unsigned int address, uint8_t *bytes,
 	return spi_send_command(flash, 1 + addr_len, len, cmd, bytes);
 }
 
+/* Required features and standard instruction of each I/O mode. */
+static const struct spi_io_mode_info {
+	int chip_feature;
+	uint32_t master_feature;
+	struct spi_read_insn insn;
+} spi_io_modes[SPI_IO_MODES] = {
+	[SPI_IO_1_1_1] = { 0, 0, { JEDEC_READ, 0, 0 } },
+	[SPI_IO_1_1_2] = { FEATURE_FAST_READ_DOUT, SPI_MASTER_DUAL_OUT, { JEDEC_READ_FAST_DOUT, 0, 8 } },
+	[SPI_IO_1_2_2] = { FEATURE_FAST_READ_DIO, SPI_MASTER_DUAL_IO, { JEDEC_READ_FAST_DIO, 4, 0 } },
+	[SPI_IO_1_1_4] = { FEATURE_FAST_READ_QOUT, SPI_MASTER_QUAD_OUT, { JEDEC_READ_FAST_QOUT, 0, 8 } },
+	[SPI_IO_1_4_4] = { FEATURE_FAST_READ_QIO, SPI_MASTER_QUAD_IO, { JEDEC_READ_FAST_QIO, 2, 4 } },
+};
+
+struct spi_read_mode {
+	enum spi_io_mode io_mode;
+	uint8_t opcode;
+	unsigned int dummy_bytes;	/* mode bits and dummies sent with the address */
+	unsigned int dummy_cycles;	/* dummies clocked by the master */
+};
+
+/*
+ * IO2 and IO3 may double as WP# and HOLD#. If the chip has a QE bit, it has
+ * to be set for quad reads, otherwise the quad feature bits are trusted. A QE
+ * bit that can't be read counts as cleared.
+ */
+static bool spi_quad_enabled(const struct flashctx *flash)
+{
+	const struct reg_bit_info *const qe = &flash->chip->reg_bits.qe;
+	uint8_t value;
+
+	if (qe->reg == INVALID_REG)
+		return true;
+	if (qe->reg == STATUS2 && !(flash->chip->feature_bits & (FEATURE_WRSR_EXT2 | FEATURE_WRSR2)))
+		return false;
+	if (spi_read_register(flash, qe->reg, &value))
+		return false;
+	return value & (1 << qe->bit_index);
+}
+
+/* Pick the fastest read instruction that both the chip and the master support to read up to `end`. */
+static void spi_pick_read_mode(const struct flashctx *flash, unsigned int end, struct spi_read_mode *mode)
+{
+	const struct flashchip *const chip = flash->chip;
+	const uint32_t master_features = flash->mst->spi.features;
+	int m;
+
+	*mode = (struct spi_read_mode){ .io_mode = SPI_IO_1_1_1, .opcode = JEDEC_READ };
+
+	/* The fast read instructions take 3-byte addresses outside of 4BA mode. */
+	if (!flash->in_4ba_mode && !(chip->feature_bits & FEATURE_4BA_EAR_ANY) && end > 16 * MiB)
+		return;
+
+	for (m = SPI_IO_MODES - 1; m > SPI_IO_1_1_1; m--) {
+		const struct spi_io_mode_info *const info = &spi_io_modes[m];
+		if (!(chip->feature_bits & info->chip_feature) || !(master_features & info->master_feature))
+			continue;
+
+		const struct spi_read_insn insn = chip->fast_read[m].opcode ? chip->fast_read[m] : info->insn;
+		const unsigned int mode_bits = insn.mode_clocks * spi_io_addr_lines(m);
+		const unsigned int wait_bits = insn.wait_states * spi_io_addr_lines(m);
+		/* Mode bits are sent with the address, dummies too if they fill whole bytes. */
+		if (mode_bits % 8 || (wait_bits % 8 && !(master_features & SPI_MASTER_DUMMY_CYCLES)))
+			continue;
+		const unsigned int dummy_bytes = mode_bits / 8 + (wait_bits % 8 ? 0 : wait_bits / 8);
+		if (1 + JEDEC_MAX_ADDR_LEN + dummy_bytes > JEDEC_READ_MAX_OUTSIZE)
+			continue;
+		if (spi_io_data_lines(m) == 4 && !spi_quad_enabled(flash))
+			continue;
+
+		*mode = (struct spi_read_mode){
+			.io_mode	= m,
+			.opcode		= insn.opcode,
+			.dummy_bytes	= dummy_bytes,
+			.dummy_cycles	= wait_bits % 8 ? insn.wait_states : 0,
+		};
+		msg_cspew("Reading with opcode 0x%02x on %u/%u lines.\n",
+			  insn.opcode, spi_io_addr_lines(m), spi_io_data_lines(m));
+		return;
+	}
+}
+
+static int spi_nbyte_read_mode(struct flashctx *flash, const struct spi_read_mode *mode,
+			       unsigned int address, uint8_t *bytes, unsigned int len)
+{
+	/* Mode bits and dummies are zero, which keeps the chip out of continuous read modes. */
+	uint8_t cmd[JEDEC_READ_MAX_OUTSIZE] = { mode->opcode, };
+
+	if (mode->io_mode == SPI_IO_1_1_1)
+		return spi_nbyte_read(flash, address, bytes, len);
+
+	const int addr_len = spi_prepare_address(flash, cmd, false, address);
+	if (addr_len < 0)
+		return 1;
+
+	struct spi_command cmds[] = {
+	{
+		.writecnt	= 1 + addr_len + mode->dummy_bytes,
+		.writearr	= cmd,
+		.readcnt	= len,
+		.readarr	= bytes,
+		.io_mode	= mode->io_mode,
+		.dummy_cycles	= mode->dummy_cycles,
+	},
+		NULL_SPI_CMD,
+	};
+	return spi_send_multicommand(flash, cmds);
+}
+
 /*
  * Read a part of the flash chip.
- * Data is read in chunks with a maximum size of chunksize.
+ * Data is read in chunks with a maximum size of chunksize, with the fastest
+ * read instruction the chip and the master have in common.
  */
 int spi_read_chunked(struct flashctx *flash, uint8_t *buf, unsigned int start,
 		     unsigned int len, unsigned int chunksize)
 {
+	struct spi_read_mode mode;
 	int ret;
 	size_t to_read;
+
+	spi_pick_read_mode(flash, start + len, &mode);
 	for (; len; len -= to_read, buf += to_read, start += to_read) {
 		to_read = min(chunksize, len);
-		ret = spi_nbyte_read(flash, start, buf, to_read);
+		ret = spi_nbyte_read_mode(flash, &mode, start, buf, to_read);
 		if (ret)
 			return ret;
 		update_progress(flash, FLASHROM_PROGRESS_READ, to_read);
@@ -778,7 +1023,7 @@ int default_spi_write_aai(struct flashctx *flash, const uint8_t *buf, unsigned i
 		//return SPI_GENERIC_ERROR;
 	}
 
-	result = spi_write_cmd(flash, JEDEC_AAI_WORD_PROGRAM, false, start, buf + pos - start, 2, 10);
+	result = spi_write_cmd(flash, JEDEC_AAI_WORD_PROGRAM, false, start, buf + pos - start, 2, 10, 100 * 1000);
 	if (result)
 		goto bailout;
 
@@ -794,7 +1039,7 @@ int default_spi_write_aai(struct flashctx *flash, const uint8_t *buf, unsigned i
 			msg_cerr("%s failed during followup AAI command execution: %d\n", __func__, result);
 			goto bailout;
 		}
-		if (spi_poll_wip(flash, 10))
+		if (spi_poll_wip(flash, JEDEC_AAI_WORD_PROGRAM, 2, 10, 100 * 1000))
 			goto bailout;
 	}
 
@@ -828,7 +1073,7 @@ static int spi_enter_exit_4ba(struct flashctx *const flash, const bool enter)
 	if (flash->chip->feature_bits & FEATURE_4BA_ENTER)
 		ret = spi_send_command(flash, sizeof(cmd), 0, &cmd, NULL);
 	else if (flash->chip->feature_bits & FEATURE_4BA_ENTER_WREN)
-		ret = spi_simple_write_cmd(flash, cmd, 0);
+		ret = spi_simple_write_cmd(flash, cmd, 0, 0);
 	else if (flash->chip->feature_bits & FEATURE_4BA_ENTER_EAR7)
 		ret = spi_set_extended_address(flash, enter ? 0x80 : 0x00);
 
@@ -0,0 +1,223 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Bus traffic statistics of a flash context. The SPI core, the WIP polling
+ * and programmer_delay() report to the functions here, which do nothing
+ * unless statistics were enabled with flashrom_stats_enable().
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if HAVE_CLOCK_GETTIME != 1
+#include <sys/time.h>
+#endif
+
+#include "flash.h"
+#include "libflashrom.h"
+#include "spi.h"
+#include "stats.h"
+
+uint64_t stats_time_ns(void)
+{
+#if HAVE_CLOCK_GETTIME == 1
+	struct timespec now;
+#ifdef CLOCK_MONOTONIC
+	if (!clock_gettime(CLOCK_MONOTONIC, &now))
+		return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+	if (!clock_gettime(CLOCK_REALTIME, &now))
+		return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+	return 0;
+#else
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_usec * 1000;
+#endif
+}
+
+static uint64_t elapsed_ns(uint64_t start_ns)
+{
+	const uint64_t now = stats_time_ns();
+	/* Only a clock that is not monotonic can go backwards. */
+	return now > start_ns ? now - start_ns : 0;
+}
+
+uint64_t stats_start(const struct flashctx *flash)
+{
+	return stats_enabled(flash) ? stats_time_ns() : 0;
+}
+
+enum flashrom_stats_stage stats_set_stage(const struct flashctx *flash, enum flashrom_stats_stage stage)
+{
+	if (!stats_enabled(flash))
+		return FLASHROM_STATS_OTHER;
+
+	struct stats_collector *const collector = flash->stats;
+	const enum flashrom_stats_stage previous = collector->stage;
+	const uint64_t now = stats_time_ns();
+
+	if (now > collector->stage_start_ns)
+		collector->stats.stage[previous].time_ns += now - collector->stage_start_ns;
+	collector->stage = stage;
+	collector->stage_start_ns = now;
+	return previous;
+}
+
+static struct flashrom_stage_stats *current_stage(const struct flashctx *flash)
+{
+	return &flash->stats->stats.stage[flash->stats->stage];
+}
+
+static void count_latency(const struct flashctx *flash, uint8_t opcode, uint64_t ns)
+{
+	struct flashrom_opcode_stats *const op = &flash->stats->stats.opcode[opcode];
+	unsigned int bucket = 0;
+
+	for (uint64_t us = ns / 1000; us && bucket < FLASHROM_STATS_LATENCY_BUCKETS - 1; us >>= 1)
+		bucket++;
+
+	op->count++;
+	op->total_ns += ns;
+	if (ns > op->max_ns)
+		op->max_ns = ns;
+	op->latency[bucket]++;
+}
+
+void stats_count_command(const struct flashctx *flash, unsigned int writecnt, unsigned int readcnt,
+			 const unsigned char *writearr, uint64_t start_ns)
+{
+	if (!stats_enabled(flash))
+		return;
+
+	const uint64_t ns = elapsed_ns(start_ns);
+	struct flashrom_stage_stats *const stage = current_stage(flash);
+
+	flash->stats->transactions++;
+	stage->transactions++;
+	stage->bytes_out += writecnt;
+	stage->bytes_in += readcnt;
+	stage->bus_ns += ns;
+	if (writecnt)
+		count_latency(flash, writearr[0], ns);
+}
+
+void stats_count_multicommand(const struct flashctx *flash, const struct spi_command *cmds, uint64_t start_ns)
+{
+	if (!stats_enabled(flash))
+		return;
+
+	const uint64_t ns = elapsed_ns(start_ns);
+	struct flashrom_stage_stats *const stage = current_stage(flash);
+	const struct spi_command *last = NULL;
+
+	for (; cmds->writecnt || cmds->readcnt; cmds++) {
+		flash->stats->transactions++;
+		stage->transactions++;
+		stage->bytes_out += cmds->writecnt;
+		stage->bytes_in += cmds->readcnt;
+		if (cmds->writecnt)
+			last = cmds;
+	}
+	stage->bus_ns += ns;
+	if (last)
+		count_latency(flash, last->writearr[0], ns);
+}
+
+uint64_t stats_transactions(const struct flashctx *flash)
+{
+	return stats_enabled(flash) ? flash->stats->transactions : 0;
+}
+
+void stats_count_transfer(const struct flashctx *flash, unsigned int bytes_out, unsigned int bytes_in,
+			  uint64_t transactions, uint64_t start_ns)
+{
+	if (!stats_enabled(flash) || flash->stats->transactions != transactions)
+		return;
+
+	struct flashrom_stage_stats *const stage = current_stage(flash);
+
+	flash->stats->transactions++;
+	stage->transactions++;
+	stage->bytes_out += bytes_out;
+	stage->bytes_in += bytes_in;
+	stage->bus_ns += elapsed_ns(start_ns);
+}
+
+void stats_count_delay(const struct flashctx *flash, uint64_t start_ns)
+{
+	if (!stats_enabled(flash))
+		return;
+
+	struct flashrom_stage_stats *const stage = current_stage(flash);
+	stage->delays++;
+	stage->delay_ns += elapsed_ns(start_ns);
+}
+
+void stats_count_wip_poll(const struct flashctx *flash)
+{
+	if (!stats_enabled(flash))
+		return;
+
+	current_stage(flash)->wip_polls++;
+}
+
+void stats_count_busy(const struct flashctx *flash, uint8_t opcode, uint64_t start_ns)
+{
+	if (!stats_enabled(flash))
+		return;
+
+	struct flashrom_opcode_stats *const op = &flash->stats->stats.opcode[opcode];
+	const uint64_t ns = elapsed_ns(start_ns);
+
+	op->busy_count++;
+	op->busy_total_ns += ns;
+	if (ns > op->busy_max_ns)
+		op->busy_max_ns = ns;
+}
+
+int flashrom_stats_enable(struct flashrom_flashctx *const flashctx, const bool enable)
+{
+	free(flashctx->stats);
+	flashctx->stats = NULL;
+	if (!enable)
+		return 0;
+
+	flashctx->stats = calloc(1, sizeof(*flashctx->stats));
+	if (!flashctx->stats) {
+		msg_gerr("Out of memory!\n");
+		return 1;
+	}
+	flashctx->stats->stage = FLASHROM_STATS_OTHER;
+	flashctx->stats->stage_start_ns = stats_time_ns();
+	return 0;
+}
+
+int flashrom_stats_get(const struct flashrom_flashctx *const flashctx, struct flashrom_stats *const stats)
+{
+	if (!stats_enabled(flashctx))
+		return 1;
+
+	const struct stats_collector *const collector = flashctx->stats;
+	memcpy(stats, &collector->stats, sizeof(*stats));
+	stats->stage[collector->stage].time_ns += elapsed_ns(collector->stage_start_ns);
+	return 0;
+}
+
+const char *flashrom_stats_stage_name(const enum flashrom_stats_stage stage)
+{
+	static const char *const names[FLASHROM_STATS_NR] = {
+		[FLASHROM_STATS_OTHER]	= "other",
+		[FLASHROM_STATS_PROBE]	= "probe",
+		[FLASHROM_STATS_READ]	= "read",
+		[FLASHROM_STATS_ERASE]	= "erase",
+		[FLASHROM_STATS_WRITE]	= "write",
+		[FLASHROM_STATS_VERIFY]	= "verify",
+	};
+
+	if ((unsigned int)stage >= FLASHROM_STATS_NR)
+		return "unknown";
+	return names[stage];
+}
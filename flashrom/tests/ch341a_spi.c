@@ -10,6 +10,7 @@
 #include "lifecycle.h"
 
 #if CONFIG_CH341A_SPI == 1
+#include "spi.h"
 
 /* Same macro as in ch341a_spi.c programmer. */
 #define WRITE_EP 0x02
@@ -126,7 +127,196 @@ void ch341a_spi_probe_lifecycle_test_success(void **state)
 				expected_matched_names, 1);
 }
 
+/*
+ * Packet level emulation of a CH341A with a W25Q128.V attached. The device
+ * works through the queued OUT transfers one 32-byte packet at a time, and
+ * answers every SPI stream packet with an IN packet of the bytes it clocked
+ * in. It can only proceed while the host has an IN transfer waiting.
+ */
+#define CH341A_EMU_PACKET_LENGTH	0x20
+#define CH341A_EMU_MAX_TRANSFERS	64
+#define CH341A_EMU_CMD_SPI_STREAM	0xA8
+#define CH341A_EMU_CMD_UIO_STREAM	0xAB
+#define CH341A_EMU_READ_SIZE		(256 * KiB)
+
+struct ch341a_spi_emu_state {
+	struct libusb_transfer *outs[CH341A_EMU_MAX_TRANSFERS];
+	unsigned int out_count;
+	unsigned int out_offset;	/* into outs[0] */
+	struct libusb_transfer *ins[CH341A_EMU_MAX_TRANSFERS];
+	unsigned int in_count;
+
+	/* SPI transaction in progress */
+	uint8_t opcode;
+	unsigned int pos;
+	unsigned int addr;
+
+	unsigned int reads;		/* READ transactions */
+	unsigned int max_read_len;	/* longest one, in data bytes */
+	unsigned int max_outs_queued;
+	unsigned int read_stalls;	/* OUT transfers submitted to a device idle after a READ */
+};
+
+static uint8_t ch341a_emu_flash_byte(unsigned int addr)
+{
+	return (addr * 7) ^ (addr >> 8);
+}
+
+static uint8_t ch341a_emu_spi_byte(struct ch341a_spi_emu_state *emu, uint8_t out)
+{
+	const uint8_t rdid[] = { 0xEF /* WINBOND_NEX_ID */, 0x40, 0x18 /* WINBOND_NEX_W25Q128_V */ };
+	const unsigned int pos = emu->pos++;
+
+	if (pos == 0) {
+		emu->opcode = out;
+		emu->addr = 0;
+		if (out == JEDEC_READ)
+			emu->reads++;
+		return 0xFF;
+	}
+	switch (emu->opcode) {
+	case JEDEC_RDID:
+		return pos <= ARRAY_SIZE(rdid) ? rdid[pos - 1] : 0xFF;
+	case JEDEC_RDSR:
+		return 0x00;
+	case JEDEC_READ:
+		if (pos <= 3) {
+			emu->addr = emu->addr << 8 | out;
+			return 0xFF;
+		}
+		emu->max_read_len = max(emu->max_read_len, pos - 3);
+		return ch341a_emu_flash_byte(emu->addr + pos - 4);
+	default:
+		return 0xFF;
+	}
+}
+
+static void ch341a_emu_complete(struct libusb_transfer *transfer, int actual_length)
+{
+	transfer->status = LIBUSB_TRANSFER_COMPLETED;
+	transfer->actual_length = actual_length;
+	transfer->callback(transfer);
+}
+
+static void ch341a_emu_pop(struct libusb_transfer **queue, unsigned int *count)
+{
+	memmove(queue, queue + 1, --*count * sizeof(*queue));
+}
+
+static int ch341a_emu_submit_transfer(void *state, struct libusb_transfer *transfer)
+{
+	struct ch341a_spi_emu_state *emu = state;
+
+	assert_true(transfer->endpoint == WRITE_EP || transfer->endpoint == READ_EP);
+
+	if (transfer->endpoint == WRITE_EP) {
+		assert_true(emu->out_count < CH341A_EMU_MAX_TRANSFERS);
+		if (emu->out_count == 0 && emu->opcode == JEDEC_READ)
+			emu->read_stalls++;
+		emu->outs[emu->out_count++] = transfer;
+		emu->max_outs_queued = max(emu->max_outs_queued, emu->out_count);
+	} else {
+		assert_true(emu->in_count < CH341A_EMU_MAX_TRANSFERS);
+		emu->ins[emu->in_count++] = transfer;
+	}
+
+	return 0;
+}
+
+static int ch341a_emu_handle_events_timeout(void *state, libusb_context *ctx, struct timeval *tv)
+{
+	struct ch341a_spi_emu_state *emu = state;
+
+	while (emu->out_count) {
+		struct libusb_transfer *const out = emu->outs[0];
+		if (emu->out_offset == (unsigned int)out->length) {
+			emu->out_offset = 0;
+			ch341a_emu_pop(emu->outs, &emu->out_count);
+			ch341a_emu_complete(out, out->length);
+			continue;
+		}
+
+		const uint8_t *const packet = out->buffer + emu->out_offset;
+		const unsigned int len = min(CH341A_EMU_PACKET_LENGTH, out->length - emu->out_offset);
+		if (packet[0] == CH341A_EMU_CMD_SPI_STREAM) {
+			if (!emu->in_count)
+				break;
+			struct libusb_transfer *const in = emu->ins[0];
+			assert_true(len - 1 <= (unsigned int)in->length);
+			for (unsigned int i = 1; i < len; i++)
+				in->buffer[i - 1] = reverse_byte(ch341a_emu_spi_byte(emu, reverse_byte(packet[i])));
+			ch341a_emu_pop(emu->ins, &emu->in_count);
+			ch341a_emu_complete(in, len - 1);
+		} else if (packet[0] == CH341A_EMU_CMD_UIO_STREAM) {
+			/* Chip select toggles, a new transaction starts. */
+			emu->pos = 0;
+		}
+		emu->out_offset += len;
+	}
+
+	return 0;
+}
+
+void ch341a_spi_read_pipelined_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct ch341a_spi_emu_state *emu = calloc(1, sizeof(*emu));
+	assert_non_null(emu);
+	struct io_mock_fallback_open_state ch341a_spi_fallback_open_state = {
+		.noc = 0,
+		.paths = { NULL },
+	};
+	const struct io_mock ch341a_spi_io = {
+		.state = emu,
+		.libusb_alloc_transfer = &ch341a_libusb_alloc_transfer,
+		.libusb_submit_transfer = &ch341a_emu_submit_transfer,
+		.libusb_free_transfer = &ch341a_libusb_free_transfer,
+		.libusb_handle_events_timeout = &ch341a_emu_handle_events_timeout,
+		.fallback_open_state = &ch341a_spi_fallback_open_state,
+	};
+	struct flashrom_programmer *flashprog;
+	struct flashrom_flashctx *flashctx;
+	struct flashrom_layout *layout;
+	const char **names = NULL;
+
+	io_mock_register(&ch341a_spi_io);
+	assert_int_equal(0, flashrom_programmer_init(&flashprog, "ch341a_spi", ""));
+	assert_int_equal(0, flashrom_create_context(&flashctx));
+	assert_int_equal(1, flashrom_flash_probe_v2(flashctx, &names, flashprog, "W25Q128.V"));
+	assert_int_equal(0, flashrom_layout_new(&layout));
+	assert_int_equal(0, flashrom_layout_add_region(layout, 0, CH341A_EMU_READ_SIZE - 1, "region"));
+	assert_int_equal(0, flashrom_layout_include_region(layout, "region"));
+	flashrom_layout_set(flashctx, layout);
+
+	const size_t size = flashrom_flash_getsize(flashctx);
+	uint8_t *const buf = malloc(size);
+	assert_non_null(buf);
+	emu->reads = 0;
+	emu->read_stalls = 0;
+	emu->max_outs_queued = 0;
+	assert_int_equal(0, flashrom_image_read(flashctx, buf, size));
+	for (unsigned int i = 0; i < CH341A_EMU_READ_SIZE; i++)
+		assert_int_equal(ch341a_emu_flash_byte(i), buf[i]);
+	free(buf);
+
+	/* Transactions are no longer capped at 4 KiB... */
+	assert_true(emu->max_read_len > 4 * KiB);
+	assert_int_equal(CH341A_EMU_READ_SIZE / emu->max_read_len, emu->reads);
+	/* ...and the device never waits for the host between them. */
+	assert_true(emu->max_outs_queued > 1);
+	assert_int_equal(0, emu->read_stalls);
+
+	flashrom_layout_release(layout);
+	flashrom_data_free(names);
+	flashrom_flash_release(flashctx);
+	assert_int_equal(0, flashrom_programmer_shutdown(flashprog));
+	io_mock_register(NULL);
+	free(emu);
+}
+
 #else
 	SKIP_TEST(ch341a_spi_basic_lifecycle_test_success)
 	SKIP_TEST(ch341a_spi_probe_lifecycle_test_success)
+	SKIP_TEST(ch341a_spi_read_pipelined_test_success)
 #endif /* CONFIG_CH341A_SPI */
@@ -26,7 +26,9 @@
 #include "chipdrivers.h"
 #include "flash.h"
 #include "io_mock.h"
+#include "journal.h"
 #include "libflashrom.h"
+#include "manifest.h"
 #include "programmer.h"
 
 #define MOCK_CHIP_SIZE (8*MiB)
@@ -708,6 +710,488 @@ void write_nonaligned_region_with_dummyflasher_test_success(void **state)
 	free(newcontents);
 }
 
+void write_plan_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	static struct io_mock_fallback_open_state data = {
+		.noc	= 0,
+		.paths	= { NULL },
+	};
+	const struct io_mock chip_io = {
+		.fallback_open_state = &data,
+	};
+
+	g_test_write_injector = write_chip;
+	g_test_read_injector = read_chip;
+	g_test_erase_injector[0] = block_erase_chip;
+	struct flashrom_flashctx flashctx = { 0 };
+	struct flashrom_layout *layout;
+	struct flashchip mock_chip = chip_8MiB;
+	const char *param = ""; /* Default values for all params. */
+
+	/* Clearing bits can be done without an erase, setting them can't. */
+	mock_chip.gran = WRITE_GRAN_1BIT;
+	mock_chip.name = "\"Quoted\" \\ chip";
+	setup_chip(&flashctx, &layout, &mock_chip, param, &chip_io);
+
+	unsigned long size = mock_chip.total_size * 1024;
+	uint8_t *const newcontents = malloc(size);
+	assert_non_null(newcontents);
+	memset(newcontents, MOCK_CHIP_CONTENT, size);
+	newcontents[3 * MiB + 10] = 0xDD;
+	newcontents[5 * MiB] = 0x88;
+
+	char *plan_json = NULL;
+	printf("Write plan operation started.\n");
+	assert_int_equal(0, flashrom_image_write_plan(&flashctx, newcontents, size, NULL, &plan_json));
+	printf("Write plan operation done.\n");
+	assert_non_null(plan_json);
+
+	assert_non_null(strstr(plan_json, "{\"vendor\": \"aklm\", \"name\": \"\\\"Quoted\\\" \\\\ chip\", \"size\": 8388608}"));
+	assert_non_null(strstr(plan_json, "\"erase_bytes\": 2097152,"));
+	assert_non_null(strstr(plan_json, "\"write_bytes\": 2,"));
+	assert_non_null(strstr(plan_json, "{\"start\": 2097152, \"end\": 4194303, \"needs_erase\": true}"));
+	assert_non_null(strstr(plan_json, "{\"start\": 4194304, \"end\": 6291455, \"needs_erase\": false}"));
+	assert_non_null(strstr(plan_json, "{\"start\": 3145738, \"len\": 1}"));
+	assert_non_null(strstr(plan_json, "{\"start\": 5242880, \"len\": 1}"));
+	/* No byte of the erased block is 0xff in the new image, so all of it is programmed again. */
+	assert_non_null(strstr(plan_json, "\"erase_ops\": [\n    {\"start\": 2097152, \"len\": 2097152}\n  ],"));
+	assert_non_null(strstr(plan_json, "\"write_ops\": [\n    {\"start\": 2097152, \"len\": 2097152},"));
+
+	/* Planning must not touch the chip. */
+	for (unsigned long i = 0; i < size; i++)
+		assert_int_equal(MOCK_CHIP_CONTENT, g_chip_state.buf[i]);
+
+	/* Executing the plan brings the chip to the new contents. */
+	assert_int_equal(0, flashrom_image_write(&flashctx, newcontents, size, NULL));
+	assert_int_equal(0, memcmp(g_chip_state.buf, newcontents, size));
+
+	teardown(&layout);
+
+	flashrom_data_free(plan_json);
+	free(newcontents);
+}
+
+void write_plan_cost_planner_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	static struct io_mock_fallback_open_state data = {
+		.noc	= 0,
+		.paths	= { NULL },
+	};
+	const struct io_mock chip_io = {
+		.fallback_open_state = &data,
+	};
+
+	g_test_write_injector = write_chip;
+	g_test_read_injector = read_chip;
+	g_test_erase_injector[0] = block_erase_chip;
+	g_test_erase_injector[1] = block_erase_chip;
+	struct flashrom_flashctx flashctx = { 0 };
+	struct flashrom_layout *layout;
+	struct flashchip mock_chip = chip_8MiB;
+	const char *param = ""; /* Default values for all params. */
+
+	mock_chip.gran = WRITE_GRAN_1BIT;
+	mock_chip.block_erasers[0] = (struct block_eraser){
+		.eraseblocks = { {4 * KiB, 2048} },
+		.block_erase = TEST_ERASE_INJECTOR_1,
+		.typ_erase_us = 50000,
+	};
+	mock_chip.block_erasers[1] = (struct block_eraser){
+		.eraseblocks = { {64 * KiB, 128} },
+		.block_erase = TEST_ERASE_INJECTOR_2,
+		.typ_erase_us = 150000,
+	};
+	setup_chip(&flashctx, &layout, &mock_chip, param, &chip_io);
+
+	/*
+	 * Half of the first 64 KiB block needs an erase and nothing has to be
+	 * programmed back. Eight 4 KiB erases take 400 ms, one 64 KiB erase
+	 * takes 150 ms.
+	 */
+	unsigned long size = mock_chip.total_size * 1024;
+	memset(g_chip_state.buf, 0xff, size);
+	for (unsigned int i = 0; i < 8; i++)
+		g_chip_state.buf[i * 4 * KiB] = 0x00;
+	uint8_t *const newcontents = malloc(size);
+	assert_non_null(newcontents);
+	memset(newcontents, 0xff, size);
+
+	char *plan_json = NULL;
+	printf("Greedy write plan operation started.\n");
+	assert_int_equal(0, flashrom_image_write_plan(&flashctx, newcontents, size, NULL, &plan_json));
+	assert_non_null(strstr(plan_json, "\"erase_planner\": \"greedy\","));
+	assert_non_null(strstr(plan_json, "\"predicted_us\": 400000,"));
+	assert_non_null(strstr(plan_json, "{\"start\": 28672, \"len\": 4096}"));
+	assert_null(strstr(plan_json, "\"len\": 65536}"));
+	assert_non_null(strstr(plan_json, "\"write_ops\": []"));
+	flashrom_data_free(plan_json);
+
+	flashrom_flag_set(&flashctx, FLASHROM_FLAG_COST_ERASE_PLANNER, true);
+	printf("Cost write plan operation started.\n");
+	assert_int_equal(0, flashrom_image_write_plan(&flashctx, newcontents, size, NULL, &plan_json));
+	assert_non_null(strstr(plan_json, "\"erase_planner\": \"cost\","));
+	assert_non_null(strstr(plan_json, "\"predicted_us\": 150000,"));
+	assert_non_null(strstr(plan_json, "\"erase_ops\": [\n    {\"start\": 0, \"len\": 65536}\n  ],"));
+	assert_non_null(strstr(plan_json, "\"write_ops\": []"));
+	flashrom_data_free(plan_json);
+
+	/* Planning must not touch the chip. */
+	assert_int_equal(0x00, g_chip_state.buf[7 * 4 * KiB]);
+
+	assert_int_equal(0, flashrom_image_write(&flashctx, newcontents, size, NULL));
+	assert_int_equal(0, memcmp(g_chip_state.buf, newcontents, size));
+
+	teardown(&layout);
+
+	free(newcontents);
+}
+
+static size_t g_bytes_read;
+
+static int counting_read_chip(struct flashctx *flash, uint8_t *buf, unsigned int start, unsigned int len)
+{
+	g_bytes_read += len;
+	return read_chip(flash, buf, start, len);
+}
+
+static void setup_manifest_chip(struct flashchip *mock_chip)
+{
+	g_test_write_injector = write_chip;
+	g_test_read_injector = counting_read_chip;
+	g_test_erase_injector[0] = block_erase_chip;
+	*mock_chip = chip_8MiB;
+	mock_chip->block_erasers[0] = (struct block_eraser){
+		.eraseblocks = { {4 * KiB, 2048} },
+		.block_erase = TEST_ERASE_INJECTOR_1,
+	};
+}
+
+void write_chip_trust_manifest_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	static struct io_mock_fallback_open_state data = {
+		.noc	= 0,
+		.paths	= { NULL },
+	};
+	const struct io_mock chip_io = {
+		.fallback_open_state = &data,
+	};
+
+	struct flashrom_flashctx flashctx = { 0 };
+	struct flashrom_layout *layout;
+	struct flashrom_manifest *manifest;
+	struct flashchip mock_chip;
+	const char *param = ""; /* Default values for all params. */
+
+	setup_manifest_chip(&mock_chip);
+	setup_chip(&flashctx, &layout, &mock_chip, param, &chip_io);
+	assert_int_equal(0, flashrom_manifest_new(&manifest));
+	flashrom_manifest_set(&flashctx, manifest);
+	flashrom_flag_set(&flashctx, FLASHROM_FLAG_TRUST_MANIFEST, true);
+
+	unsigned long size = mock_chip.total_size * 1024;
+	uint8_t *const newcontents = malloc(size);
+	assert_non_null(newcontents);
+	memset(newcontents, 0x5A, size);
+
+	/* Without digests everything has to be read, the write fills the manifest. */
+	printf("First write operation started.\n");
+	g_bytes_read = 0;
+	assert_int_equal(0, flashrom_image_write(&flashctx, newcontents, size, NULL));
+	assert_in_range(g_bytes_read, size, 2 * size);
+	assert_int_equal(0, memcmp(g_chip_state.buf, newcontents, size));
+
+	/* Only the changed block and a sample of the others are read before writing. */
+	printf("Trusted write operation started.\n");
+	flashrom_flag_set(&flashctx, FLASHROM_FLAG_VERIFY_AFTER_WRITE, false);
+	newcontents[3 * MiB + 10] = 0x00;
+	g_bytes_read = 0;
+	assert_int_equal(0, flashrom_image_write(&flashctx, newcontents, size, NULL));
+	assert_in_range(g_bytes_read, 4 * KiB, 4 * KiB * (1 + 2048 / MANIFEST_SAMPLE_RATIO));
+	assert_int_equal(0, memcmp(g_chip_state.buf, newcontents, size));
+
+	teardown(&layout);
+
+	flashrom_manifest_release(manifest);
+	free(newcontents);
+}
+
+void write_chip_stale_manifest_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	static struct io_mock_fallback_open_state data = {
+		.noc	= 0,
+		.paths	= { NULL },
+	};
+	const struct io_mock chip_io = {
+		.fallback_open_state = &data,
+	};
+
+	struct flashrom_flashctx flashctx = { 0 };
+	struct flashrom_layout *layout;
+	struct flashrom_manifest *manifest;
+	struct flashchip mock_chip;
+	const char *param = ""; /* Default values for all params. */
+
+	setup_manifest_chip(&mock_chip);
+	setup_chip(&flashctx, &layout, &mock_chip, param, &chip_io);
+	assert_int_equal(0, flashrom_manifest_new(&manifest));
+	flashrom_manifest_set(&flashctx, manifest);
+	flashrom_flag_set(&flashctx, FLASHROM_FLAG_TRUST_MANIFEST, true);
+
+	unsigned long size = mock_chip.total_size * 1024;
+	uint8_t *const newcontents = malloc(size);
+	assert_non_null(newcontents);
+	memset(newcontents, 0x5A, size);
+	assert_int_equal(0, flashrom_image_write(&flashctx, newcontents, size, NULL));
+
+	/* Something else changed every block behind the manifest's back. */
+	for (unsigned long i = 0; i < size; i += 4 * KiB)
+		g_chip_state.buf[i + 100] = 0x00;
+
+	/* Any sample notices, the write falls back to reading the whole chip. */
+	printf("Write operation with stale manifest started.\n");
+	flashrom_flag_set(&flashctx, FLASHROM_FLAG_VERIFY_AFTER_WRITE, false);
+	g_bytes_read = 0;
+	assert_int_equal(0, flashrom_image_write(&flashctx, newcontents, size, NULL));
+	assert_in_range(g_bytes_read, size, 2 * size);
+	assert_int_equal(0, memcmp(g_chip_state.buf, newcontents, size));
+
+	teardown(&layout);
+
+	flashrom_manifest_release(manifest);
+	free(newcontents);
+}
+
+void erase_chip_manifest_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	static struct io_mock_fallback_open_state data = {
+		.noc	= 0,
+		.paths	= { NULL },
+	};
+	const struct io_mock chip_io = {
+		.fallback_open_state = &data,
+	};
+
+	struct flashrom_flashctx flashctx = { 0 };
+	struct flashrom_layout *layout;
+	struct flashrom_manifest *manifest;
+	struct flashchip mock_chip;
+	const char *param = ""; /* Default values for all params. */
+
+	setup_manifest_chip(&mock_chip);
+	setup_chip(&flashctx, &layout, &mock_chip, param, &chip_io);
+	assert_int_equal(0, flashrom_manifest_new(&manifest));
+	flashrom_manifest_set(&flashctx, manifest);
+	flashrom_flag_set(&flashctx, FLASHROM_FLAG_TRUST_MANIFEST, true);
+
+	unsigned long size = mock_chip.total_size * 1024;
+	uint8_t *const newcontents = malloc(size);
+	assert_non_null(newcontents);
+
+	/* A successful erase records the erased blocks. */
+	printf("Erase operation started.\n");
+	assert_int_equal(0, flashrom_flash_erase(&flashctx));
+
+	printf("Trusted write operation started.\n");
+	flashrom_flag_set(&flashctx, FLASHROM_FLAG_VERIFY_AFTER_WRITE, false);
+	memset(newcontents, ERASED_VALUE(&flashctx), size);
+	newcontents[3 * MiB + 10] = 0x00;
+	g_bytes_read = 0;
+	assert_int_equal(0, flashrom_image_write(&flashctx, newcontents, size, NULL));
+	assert_in_range(g_bytes_read, 4 * KiB, 4 * KiB * (1 + 2048 / MANIFEST_SAMPLE_RATIO));
+	assert_int_equal(0, memcmp(g_chip_state.buf, newcontents, size));
+
+	teardown(&layout);
+
+	flashrom_manifest_release(manifest);
+	free(newcontents);
+}
+
+static int g_writes_left;
+
+static int failing_write_chip(struct flashctx *flash, const uint8_t *buf, unsigned int start, unsigned int len)
+{
+	if (!g_writes_left)
+		return 1;
+	g_writes_left--;
+	return write_chip(flash, buf, start, len);
+}
+
+struct journal_text {
+	char *buf;
+	size_t len;
+};
+
+static int capture_journal(const char *text, bool append, void *user_data)
+{
+	struct journal_text *const captured = user_data;
+	const size_t len = strlen(text);
+
+	if (!append)
+		captured->len = 0;
+	captured->buf = realloc(captured->buf, captured->len + len + 1);
+	assert_non_null(captured->buf);
+	memcpy(captured->buf + captured->len, text, len + 1);
+	captured->len += len;
+	return 0;
+}
+
+void write_chip_resume_journal_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	static struct io_mock_fallback_open_state data = {
+		.noc	= 0,
+		.paths	= { NULL },
+	};
+	const struct io_mock chip_io = {
+		.fallback_open_state = &data,
+	};
+
+	struct flashrom_flashctx flashctx = { 0 };
+	struct flashrom_layout *layout;
+	struct flashrom_journal *journal, *resumed;
+	struct journal_text captured = { .buf = NULL };
+	struct flashchip mock_chip;
+	const char *param = ""; /* Default values for all params. */
+
+	setup_manifest_chip(&mock_chip);
+	g_test_write_injector = failing_write_chip;
+	setup_chip(&flashctx, &layout, &mock_chip, param, &chip_io);
+	assert_int_equal(0, flashrom_journal_new(&journal));
+	flashrom_journal_set_callback(journal, capture_journal, &captured);
+	flashrom_journal_set(&flashctx, journal);
+
+	unsigned long size = mock_chip.total_size * 1024;
+	uint8_t *const newcontents = malloc(size);
+	assert_non_null(newcontents);
+	memset(newcontents, 0xA5, size);
+
+	/* Writing fails half way, each 4 KiB block is written separately. */
+	printf("Interrupted write operation started.\n");
+	g_writes_left = 1000;
+	assert_int_equal(2, flashrom_image_write(&flashctx, newcontents, size, NULL));
+	assert_false(flashrom_journal_complete(journal));
+
+	/* Only the blocks that weren't recorded as written are read again. */
+	printf("Resumed write operation started.\n");
+	assert_int_equal(0, flashrom_journal_read_from_buffer(&resumed, captured.buf, captured.len));
+	flashrom_journal_set_callback(resumed, capture_journal, &captured);
+	flashrom_journal_set(&flashctx, resumed);
+	flashrom_flag_set(&flashctx, FLASHROM_FLAG_RESUME_JOURNAL, true);
+	flashrom_flag_set(&flashctx, FLASHROM_FLAG_VERIFY_AFTER_WRITE, false);
+	g_writes_left = 2048;
+	g_bytes_read = 0;
+	assert_int_equal(0, flashrom_image_write(&flashctx, newcontents, size, NULL));
+	assert_int_equal((2048 - 1000) * 4 * KiB, g_bytes_read);
+	assert_int_equal(0, memcmp(g_chip_state.buf, newcontents, size));
+	assert_true(flashrom_journal_complete(resumed));
+
+	/* A journal of another image is ignored. */
+	printf("Write operation of another image started.\n");
+	newcontents[0] = 0x00;
+	g_bytes_read = 0;
+	assert_int_equal(0, flashrom_image_write(&flashctx, newcontents, size, NULL));
+	assert_in_range(g_bytes_read, size, 2 * size);
+	assert_int_equal(0, memcmp(g_chip_state.buf, newcontents, size));
+
+	teardown(&layout);
+
+	flashrom_journal_release(resumed);
+	flashrom_journal_release(journal);
+	free(captured.buf);
+	free(newcontents);
+}
+
+/* Stops half way through the first 64 KiB erase, like a power cut would. */
+static int interrupted_block_erase_chip(struct flashctx *flash, unsigned int blockaddr, unsigned int blocklen)
+{
+	memset(&g_chip_state.buf[blockaddr], 0xff, blocklen / 2);
+	return 1;
+}
+
+void write_chip_resume_journal_erase_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	static struct io_mock_fallback_open_state data = {
+		.noc	= 0,
+		.paths	= { NULL },
+	};
+	const struct io_mock chip_io = {
+		.fallback_open_state = &data,
+	};
+
+	struct flashrom_flashctx flashctx = { 0 };
+	struct flashrom_layout *layout;
+	struct flashrom_journal *journal, *resumed;
+	struct journal_text captured = { .buf = NULL };
+	struct flashchip mock_chip;
+	const char *param = ""; /* Default values for all params. */
+
+	setup_manifest_chip(&mock_chip);
+	mock_chip.typ_page_program_us = 1;
+	mock_chip.block_erasers[0].typ_erase_us = 50000;
+	mock_chip.block_erasers[1] = (struct block_eraser){
+		.eraseblocks = { {64 * KiB, 128} },
+		.block_erase = TEST_ERASE_INJECTOR_2,
+		.typ_erase_us = 150000,
+	};
+	g_test_erase_injector[1] = interrupted_block_erase_chip;
+	setup_chip(&flashctx, &layout, &mock_chip, param, &chip_io);
+	flashrom_flag_set(&flashctx, FLASHROM_FLAG_COST_ERASE_PLANNER, true);
+	assert_int_equal(0, flashrom_journal_new(&journal));
+	flashrom_journal_set_callback(journal, capture_journal, &captured);
+	flashrom_journal_set(&flashctx, journal);
+
+	/*
+	 * The first six 4 KiB blocks change, the other ten of the first 64 KiB
+	 * block already hold the new data. One 64 KiB erase is cheaper than six
+	 * 4 KiB ones, so the clean blocks are erased as well.
+	 */
+	unsigned long size = mock_chip.total_size * 1024;
+	uint8_t *const newcontents = malloc(size);
+	assert_non_null(newcontents);
+	memset(newcontents, MOCK_CHIP_CONTENT, size);
+	memset(newcontents, 0x5A, 6 * 4 * KiB);
+
+	printf("Write operation interrupted while erasing started.\n");
+	assert_int_equal(2, flashrom_image_write(&flashctx, newcontents, size, NULL));
+	assert_int_equal(0xff, g_chip_state.buf[7 * 4 * KiB]);
+	assert_int_equal(MOCK_CHIP_CONTENT, g_chip_state.buf[8 * 4 * KiB]);
+
+	/* The clean blocks the erase touched can't be trusted anymore. */
+	printf("Resumed write operation started.\n");
+	assert_int_equal(0, flashrom_journal_read_from_buffer(&resumed, captured.buf, captured.len));
+	for (size_t i = 0; i < 16; i++)
+		assert_false(journal_block_trusted(resumed, i));
+	assert_true(journal_block_trusted(resumed, 16));
+	flashrom_journal_set_callback(resumed, capture_journal, &captured);
+	flashrom_journal_set(&flashctx, resumed);
+	flashrom_flag_set(&flashctx, FLASHROM_FLAG_RESUME_JOURNAL, true);
+	flashrom_flag_set(&flashctx, FLASHROM_FLAG_VERIFY_AFTER_WRITE, false);
+	g_test_erase_injector[1] = block_erase_chip;
+	assert_int_equal(0, flashrom_image_write(&flashctx, newcontents, size, NULL));
+	assert_int_equal(0, memcmp(g_chip_state.buf, newcontents, size));
+	assert_true(flashrom_journal_complete(resumed));
+
+	teardown(&layout);
+
+	flashrom_journal_release(resumed);
+	flashrom_journal_release(journal);
+	free(captured.buf);
+	free(newcontents);
+}
+
 static size_t verify_chip_fread(void *state, void *buf, size_t size, size_t len, FILE *fp)
 {
 	/*
@@ -5,6 +5,8 @@
  * SPDX-FileCopyrightText: 2021 Google LLC
  */
 
+#include <stdlib.h>
+
 #include "lifecycle.h"
 
 #if CONFIG_DEDIPROG == 1
@@ -45,6 +47,286 @@ void dediprog_basic_lifecycle_test_success(void **state)
 
 	run_basic_lifecycle(state, &dediprog_io, &programmer_dediprog, "voltage=3.5V");
 }
+
+/*
+ * Emulation of an SF600 with protocol V2 firmware and a W25Q128.V attached.
+ * Bulk reads and writes are served from the transfers queued with the
+ * asynchronous interface, everything else goes through control transfers.
+ */
+#define DEDIPROG_EMU_SIZE		(16 * MiB)
+#define DEDIPROG_EMU_MAX_TRANSFERS	16
+#define DEDIPROG_EMU_ASYNC_TRANSFERS	8	/* DEDIPROG_ASYNC_TRANSFERS in dediprog.c */
+#define DEDIPROG_EMU_CMD_TRANSCEIVE	0x01
+#define DEDIPROG_EMU_CMD_READ_PROG_INFO	0x08
+#define DEDIPROG_EMU_CMD_READ		0x20
+#define DEDIPROG_EMU_CMD_WRITE		0x30
+#define DEDIPROG_EMU_WRITE_MODE_PAGE_PGM 1
+
+struct dediprog_emu_state {
+	uint8_t *flash;
+
+	/* Last SPI command */
+	uint8_t opcode;
+	unsigned int spi_addr;
+
+	/* Bulk command in progress */
+	uint8_t bulk_cmd;
+	unsigned int bulk_addr;
+	unsigned int bulk_chunks;
+
+	struct libusb_transfer *transfers[DEDIPROG_EMU_MAX_TRANSFERS];
+	unsigned int queued;
+
+	unsigned int bulk_reads;	/* CMD_READ commands */
+	unsigned int bulk_writes;	/* CMD_WRITE commands */
+	unsigned int slow_reads;	/* JEDEC_READ sent with CMD_TRANSCEIVE */
+	unsigned int slow_writes;	/* JEDEC_BYTE_PROGRAM sent with CMD_TRANSCEIVE */
+	unsigned int max_queued;
+};
+
+static uint8_t dediprog_emu_pattern(unsigned int addr)
+{
+	/* Never 0xff, so a write of a range is one run. */
+	return (addr * 7) & 0x7f;
+}
+
+static void dediprog_emu_erase(struct dediprog_emu_state *emu, unsigned int addr, unsigned int size)
+{
+	addr &= ~(size - 1);
+	memset(emu->flash + addr, 0xff, size);
+}
+
+static void dediprog_emu_spi(struct dediprog_emu_state *emu, const unsigned char *data, uint16_t len)
+{
+	emu->opcode = data[0];
+	emu->spi_addr = len >= 4 ? data[1] << 16 | data[2] << 8 | data[3] : 0;
+
+	switch (emu->opcode) {
+	case JEDEC_READ:
+		emu->slow_reads++;
+		break;
+	case JEDEC_BYTE_PROGRAM:
+		emu->slow_writes++;
+		for (unsigned int i = 4; i < len; i++)
+			emu->flash[emu->spi_addr + i - 4] &= data[i];
+		break;
+	case JEDEC_SE:
+		dediprog_emu_erase(emu, emu->spi_addr, 4 * KiB);
+		break;
+	case JEDEC_BE_52:
+		dediprog_emu_erase(emu, emu->spi_addr, 32 * KiB);
+		break;
+	case JEDEC_BE_D8:
+		dediprog_emu_erase(emu, emu->spi_addr, 64 * KiB);
+		break;
+	case JEDEC_CE_60:
+	case JEDEC_CE_C7:
+		dediprog_emu_erase(emu, 0, DEDIPROG_EMU_SIZE);
+		break;
+	}
+}
+
+static int dediprog_emu_control_transfer(void *state,
+					 libusb_device_handle *devh,
+					 uint8_t bmRequestType,
+					 uint8_t bRequest,
+					 uint16_t wValue,
+					 uint16_t wIndex,
+					 unsigned char *data,
+					 uint16_t wLength,
+					 unsigned int timeout)
+{
+	struct dediprog_emu_state *emu = state;
+	const bool in = bmRequestType & LIBUSB_ENDPOINT_IN;
+	const uint8_t rdid[] = { 0xEF /* WINBOND_NEX_ID */, 0x40, 0x18 /* WINBOND_NEX_W25Q128_V */ };
+
+	switch (bRequest) {
+	case DEDIPROG_EMU_CMD_READ_PROG_INFO:
+		memcpy(data, "SF600 V:7.2.2   ", wLength);
+		break;
+	case DEDIPROG_EMU_CMD_TRANSCEIVE:
+		if (!in) {
+			dediprog_emu_spi(emu, data, wLength);
+		} else if (emu->opcode == JEDEC_RDID) {
+			memset(data, 0xff, wLength);
+			memcpy(data, rdid, min(wLength, sizeof(rdid)));
+		} else if (emu->opcode == JEDEC_READ) {
+			memcpy(data, emu->flash + emu->spi_addr, wLength);
+		} else if (emu->opcode == JEDEC_RDSR || emu->opcode == JEDEC_RDSR2 ||
+			   emu->opcode == JEDEC_RDSR3) {
+			/* Not busy, not protected */
+			memset(data, 0x00, wLength);
+		} else {
+			memset(data, 0xff, wLength);
+		}
+		break;
+	case DEDIPROG_EMU_CMD_READ:
+	case DEDIPROG_EMU_CMD_WRITE:
+		/* Protocol V2 command packet */
+		assert_int_equal(10, wLength);
+		assert_int_equal(0, emu->bulk_chunks);
+		emu->bulk_cmd = bRequest;
+		emu->bulk_chunks = data[0] | data[1] << 8;
+		emu->bulk_addr = data[6] | data[7] << 8 | data[8] << 16 | (unsigned int)data[9] << 24;
+		if (bRequest == DEDIPROG_EMU_CMD_READ) {
+			assert_int_equal(0, emu->bulk_addr % 512);
+			emu->bulk_reads++;
+		} else {
+			assert_int_equal(DEDIPROG_EMU_WRITE_MODE_PAGE_PGM, data[3]);
+			assert_int_equal(0, emu->bulk_addr % 256);
+			emu->bulk_writes++;
+		}
+		break;
+	}
+	return wLength;
+}
+
+static struct libusb_transfer *dediprog_emu_alloc_transfer(void *state, int iso_packets)
+{
+	return calloc(1, sizeof(struct libusb_transfer));
+}
+
+static void dediprog_emu_free_transfer(void *state, struct libusb_transfer *transfer)
+{
+	free(transfer);
+}
+
+static int dediprog_emu_submit_transfer(void *state, struct libusb_transfer *transfer)
+{
+	struct dediprog_emu_state *emu = state;
+
+	assert_true(emu->queued < DEDIPROG_EMU_MAX_TRANSFERS);
+	emu->transfers[emu->queued++] = transfer;
+	emu->max_queued = max(emu->max_queued, emu->queued);
+
+	return 0;
+}
+
+static int dediprog_emu_handle_events_timeout(void *state, libusb_context *ctx, struct timeval *tv)
+{
+	struct dediprog_emu_state *emu = state;
+
+	for (unsigned int i = 0; i < emu->queued; i++) {
+		struct libusb_transfer *const transfer = emu->transfers[i];
+
+		assert_int_equal(512, transfer->length);
+		assert_true(emu->bulk_chunks > 0);
+		if (transfer->endpoint & LIBUSB_ENDPOINT_IN) {
+			assert_int_equal(DEDIPROG_EMU_CMD_READ, emu->bulk_cmd);
+			memcpy(transfer->buffer, emu->flash + emu->bulk_addr, 512);
+			emu->bulk_addr += 512;
+		} else {
+			assert_int_equal(DEDIPROG_EMU_CMD_WRITE, emu->bulk_cmd);
+			/* 256 bytes of data and 0xff padding */
+			for (unsigned int j = 0; j < 256; j++)
+				emu->flash[emu->bulk_addr + j] &= transfer->buffer[j];
+			for (unsigned int j = 256; j < 512; j++)
+				assert_int_equal(0xff, transfer->buffer[j]);
+			emu->bulk_addr += 256;
+		}
+		emu->bulk_chunks--;
+
+		transfer->status = LIBUSB_TRANSFER_COMPLETED;
+		transfer->actual_length = transfer->length;
+		transfer->callback(transfer);
+	}
+	emu->queued = 0;
+
+	return 0;
+}
+
+static void dediprog_emu_select_region(struct flashrom_flashctx *flashctx, struct flashrom_layout **layout,
+				       unsigned int start, unsigned int end)
+{
+	if (*layout)
+		flashrom_layout_release(*layout);
+	assert_int_equal(0, flashrom_layout_new(layout));
+	assert_int_equal(0, flashrom_layout_add_region(*layout, start, end, "region"));
+	assert_int_equal(0, flashrom_layout_include_region(*layout, "region"));
+	flashrom_layout_set(flashctx, *layout);
+}
+
+void dediprog_unaligned_bulk_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct dediprog_emu_state emu = { 0 };
+	struct io_mock_fallback_open_state dediprog_fallback_open_state = {
+		.noc = 0,
+		.paths = { NULL },
+	};
+	const struct io_mock dediprog_io = {
+		.state = &emu,
+		.libusb_init = dediprog_libusb_init,
+		.libusb_control_transfer = dediprog_emu_control_transfer,
+		.libusb_alloc_transfer = dediprog_emu_alloc_transfer,
+		.libusb_submit_transfer = dediprog_emu_submit_transfer,
+		.libusb_free_transfer = dediprog_emu_free_transfer,
+		.libusb_handle_events_timeout = dediprog_emu_handle_events_timeout,
+		.fallback_open_state = &dediprog_fallback_open_state,
+	};
+	struct flashrom_programmer *flashprog;
+	struct flashrom_flashctx *flashctx;
+	struct flashrom_layout *layout = NULL;
+	const char **names = NULL;
+	unsigned int i;
+
+	emu.flash = malloc(DEDIPROG_EMU_SIZE);
+	assert_non_null(emu.flash);
+	for (i = 0; i < DEDIPROG_EMU_SIZE; i++)
+		emu.flash[i] = dediprog_emu_pattern(i);
+
+	io_mock_register(&dediprog_io);
+	assert_int_equal(0, flashrom_programmer_init(&flashprog, "dediprog", "voltage=3.5V"));
+	assert_int_equal(0, flashrom_create_context(&flashctx));
+	assert_int_equal(1, flashrom_flash_probe_v2(flashctx, &names, flashprog, "W25Q128.V"));
+
+	uint8_t *const buf = malloc(DEDIPROG_EMU_SIZE);
+	assert_non_null(buf);
+
+	/* Both ends in the middle of a 512 byte chunk. */
+	dediprog_emu_select_region(flashctx, &layout, 0x1234, 0x5677);
+	assert_int_equal(0, flashrom_image_read(flashctx, buf, DEDIPROG_EMU_SIZE));
+	for (i = 0x1234; i <= 0x5677; i++)
+		assert_int_equal(dediprog_emu_pattern(i), buf[i]);
+	assert_int_equal(1, emu.bulk_reads);
+	assert_int_equal(0, emu.slow_reads);
+	assert_int_equal(DEDIPROG_EMU_ASYNC_TRANSFERS, emu.max_queued);
+
+	/*
+	 * Write a region that starts and ends in the middle of a page, into
+	 * erased flash surrounded by data that must survive the padding.
+	 */
+	const unsigned int start = 0x10010, end = 0x12f0f;
+	memset(emu.flash + start, 0xff, end - start + 1);
+	for (i = start; i <= end; i++)
+		buf[i] = dediprog_emu_pattern(i) ^ 0x40;
+	emu.bulk_reads = 0;
+	emu.max_queued = 0;
+	dediprog_emu_select_region(flashctx, &layout, start, end);
+	assert_int_equal(0, flashrom_image_write(flashctx, buf, DEDIPROG_EMU_SIZE, NULL));
+
+	for (i = start - 0x10; i <= end + 0x10; i++) {
+		if (i < start || i > end)
+			assert_int_equal(dediprog_emu_pattern(i), emu.flash[i]);
+		else
+			assert_int_equal(buf[i], emu.flash[i]);
+	}
+	/* One bulk command for the whole range, no page programs for the partial pages. */
+	assert_int_equal(1, emu.bulk_writes);
+	assert_int_equal(0, emu.slow_writes);
+	assert_int_equal(0, emu.slow_reads);
+	assert_int_equal(DEDIPROG_EMU_ASYNC_TRANSFERS, emu.max_queued);
+
+	free(buf);
+	flashrom_layout_release(layout);
+	flashrom_data_free(names);
+	flashrom_flash_release(flashctx);
+	assert_int_equal(0, flashrom_programmer_shutdown(flashprog));
+	io_mock_register(NULL);
+	free(emu.flash);
+}
 #else
 	SKIP_TEST(dediprog_basic_lifecycle_test_success)
+	SKIP_TEST(dediprog_unaligned_bulk_test_success)
 #endif /* CONFIG_DEDIPROG */
@@ -0,0 +1,239 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Tests for decoding the SMBIOS tables Linux exports in sysfs. The tables are
+ * trimmed captures, only the structures dmi.c looks at are kept.
+ */
+
+#include "lifecycle.h"
+
+#if CONFIG_INTERNAL == 1 && (defined(__i386__) || defined(__x86_64__)) && defined(__linux__)
+
+#define SYSFS_ENTRY_POINT	"/sys/firmware/dmi/tables/smbios_entry_point"
+#define SYSFS_TABLE		"/sys/firmware/dmi/tables/DMI"
+
+/* ThinkPad X220, SMBIOS 2.6 structures behind a 3.0 entry point. */
+static const char x220_table[] =
+	/* Type 1 (system), handle 0x000f */
+	"\x01\x08\x0f\x00\x01\x02\x03\x04"
+	"LENOVO\0" "4291WH1\0" "ThinkPad X220\0" "R9-XXXXX\0" "\0"
+	/* Type 2 (baseboard), handle 0x0010 */
+	"\x02\x08\x10\x00\x01\x02\x03\x04"
+	"LENOVO\0" "4291WH1\0" "Not Available\0" "1ZXXXXXXXXX\0" "\0"
+	/* Type 3 (chassis), handle 0x0011: notebook */
+	"\x03\x09\x11\x00\x01\x0a\x02\x00\x00"
+	"LENOVO\0" "Not Available\0" "\0"
+	/* Type 127 (end-of-table), handle 0x0040 */
+	"\x7f\x04\x40\x00" "\0" "\0"
+	/* Never reached */
+	"\x01\x08\x41\x00\x01\x00\x00\x00" "Bogus\0" "\0";
+
+/* Supermicro X7DWT, legacy structures behind an SMBIOS 2.5 entry point. */
+static const char x7dwt_table[] =
+	/* Type 2 (baseboard), handle 0x0002, with junk in the manufacturer string */
+	"\x02\x08\x02\x00\x01\x02\x03\x00"
+	"Supermicro\x07\0" "X7DWT\0" "PCB Version\0" "\0"
+	/* A second baseboard, the first one wins */
+	"\x02\x08\x03\x00\x01\x02\x00\x00"
+	"Other\0" "Board\0" "\0"
+	/* Type 1 (system), handle 0x0001 */
+	"\x01\x08\x01\x00\x01\x02\x00\x00"
+	"Supermicro\0" "X7DWT\0" "\0"
+	/* Type 3 (chassis), handle 0x0004: multi-system */
+	"\x03\x09\x04\x00\x01\x19\x00\x00\x00"
+	"Supermicro\0" "\0";
+
+struct dmi_io_state {
+	const uint8_t *entry_point;
+	size_t entry_point_len;
+	const uint8_t *table;
+	size_t table_len;
+	/* File opened last and position in it */
+	const uint8_t *data;
+	size_t data_len;
+	size_t pos;
+	unsigned int table_opens;
+};
+
+static FILE *dmi_fopen(void *state, const char *pathname, const char *mode)
+{
+	struct dmi_io_state *io_state = state;
+
+	io_state->pos = 0;
+	if (!strcmp(pathname, SYSFS_ENTRY_POINT)) {
+		io_state->data = io_state->entry_point;
+		io_state->data_len = io_state->entry_point_len;
+	} else if (!strcmp(pathname, SYSFS_TABLE)) {
+		io_state->data = io_state->table;
+		io_state->data_len = io_state->table_len;
+		io_state->table_opens++;
+	} else {
+		return NULL;
+	}
+
+	return not_null();
+}
+
+static size_t dmi_fread(void *state, void *buf, size_t size, size_t len, FILE *fp)
+{
+	struct dmi_io_state *io_state = state;
+	size_t count = min(size * len, io_state->data_len - io_state->pos);
+
+	memcpy(buf, io_state->data + io_state->pos, count);
+	io_state->pos += count;
+
+	return count / size;
+}
+
+static int dmi_fclose(void *state, FILE *fp)
+{
+	struct dmi_io_state *io_state = state;
+
+	io_state->data = NULL;
+	io_state->data_len = 0;
+
+	return 0;
+}
+
+static void set_checksum(uint8_t *buf, size_t len, size_t checksum_offset)
+{
+	uint8_t sum = 0;
+
+	buf[checksum_offset] = 0;
+	for (size_t i = 0; i < len; i++)
+		sum += buf[i];
+	buf[checksum_offset] = -sum;
+}
+
+static int dmi_test_is_laptop;
+
+static int dmi_test_init(const struct programmer_cfg *cfg)
+{
+	dmi_test_is_laptop = 2;
+	dmi_init(&dmi_test_is_laptop);
+	return 0;
+}
+
+static const struct programmer_entry dmi_test_programmer = {
+	.name = "dmi_test",
+	.type = OTHER,
+	.devs.note = "DMI decoding only.\n",
+	.init = dmi_test_init,
+};
+
+static void run_dmi_init(struct dmi_io_state *io_state)
+{
+	const struct io_mock dmi_io = {
+		.state		= io_state,
+		.iom_fopen	= dmi_fopen,
+		.iom_fread	= dmi_fread,
+		.iom_fclose	= dmi_fclose,
+	};
+
+	io_mock_register(&dmi_io);
+	assert_int_equal(0, programmer_init(&dmi_test_programmer, ""));
+	io_mock_register(NULL);
+}
+
+void dmi_sysfs_smbios3_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	uint8_t entry_point[0x18] = { '_', 'S', 'M', '3', '_', 0, 0x18, 3, 0, 0, 1, 0 };
+	/* Table maximum size, the exported table can be shorter. */
+	entry_point[0x0c] = sizeof(x220_table) + 0x40;
+	/* Table address, irrelevant for sysfs. */
+	entry_point[0x13] = 0x0d;
+	entry_point[0x14] = 0xca;
+	set_checksum(entry_point, sizeof(entry_point), 0x05);
+
+	struct dmi_io_state io_state = {
+		.entry_point = entry_point,
+		.entry_point_len = sizeof(entry_point),
+		.table = (const uint8_t *)x220_table,
+		.table_len = sizeof(x220_table),
+	};
+	run_dmi_init(&io_state);
+
+	assert_int_equal(1, io_state.table_opens);
+	assert_true(dmi_is_supported());
+	assert_int_equal(1, dmi_test_is_laptop);
+	assert_true(dmi_match("^LENOVO$"));
+	assert_true(dmi_match("^4291WH1$"));
+	assert_true(dmi_match("X220$"));
+	assert_false(dmi_match("Bogus"));
+	/* Serial numbers aren't decoded. */
+	assert_false(dmi_match("R9-XXXXX"));
+
+	assert_int_equal(0, programmer_shutdown());
+	assert_false(dmi_is_supported());
+	assert_false(dmi_match("LENOVO"));
+}
+
+void dmi_sysfs_smbios2_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	uint8_t entry_point[0x1f] = { '_', 'S', 'M', '_', 0, 0x1f, 2, 5 };
+	memcpy(entry_point + 0x10, "_DMI_", 5);
+	/* Table length, address and number of structures */
+	entry_point[0x16] = sizeof(x7dwt_table) - 1;
+	entry_point[0x1a] = 0x0f;
+	entry_point[0x1c] = 4;
+	set_checksum(entry_point + 0x10, 0x0f, 0x05);
+	set_checksum(entry_point, sizeof(entry_point), 0x04);
+
+	struct dmi_io_state io_state = {
+		.entry_point = entry_point,
+		.entry_point_len = sizeof(entry_point),
+		.table = (const uint8_t *)x7dwt_table,
+		.table_len = sizeof(x7dwt_table) - 1,
+	};
+	run_dmi_init(&io_state);
+
+	assert_int_equal(1, io_state.table_opens);
+	assert_true(dmi_is_supported());
+	assert_int_equal(0, dmi_test_is_laptop);
+	assert_true(dmi_match("^Supermicro $"));
+	assert_true(dmi_match("^X7DWT$"));
+	assert_true(dmi_match("PCB Version"));
+	assert_false(dmi_match("Board"));
+
+	assert_int_equal(0, programmer_shutdown());
+}
+
+void dmi_sysfs_broken_table_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	uint8_t entry_point[0x18] = { '_', 'S', 'M', '3', '_', 0, 0x18, 3, 2, 0, 1, 0 };
+	entry_point[0x0c] = sizeof(x220_table);
+	set_checksum(entry_point, sizeof(entry_point), 0x05);
+
+	/* Cut off in the middle of the baseboard strings. */
+	struct dmi_io_state io_state = {
+		.entry_point = entry_point,
+		.entry_point_len = sizeof(entry_point),
+		.table = (const uint8_t *)x220_table,
+		.table_len = 0x4a,
+	};
+	run_dmi_init(&io_state);
+
+	assert_true(dmi_is_supported());
+	/* The chassis is beyond the end of the table. */
+	assert_int_equal(2, dmi_test_is_laptop);
+	assert_true(dmi_match("^ThinkPad X220$"));
+	/* The baseboard version is clipped at the end of the table. */
+	assert_true(dmi_match("^Not $"));
+	assert_false(dmi_match("Available"));
+
+	assert_int_equal(0, programmer_shutdown());
+}
+
+#else
+	SKIP_TEST(dmi_sysfs_smbios3_test_success)
+	SKIP_TEST(dmi_sysfs_smbios2_test_success)
+	SKIP_TEST(dmi_sysfs_broken_table_test_success)
+#endif /* CONFIG_INTERNAL */
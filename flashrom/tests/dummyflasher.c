@@ -5,7 +5,12 @@
  * SPDX-FileCopyrightText: 2021 Google LLC
  */
 
+#include <pthread.h>
+#include <time.h>
+
 #include "lifecycle.h"
+#include "chipdrivers.h"
+#include "probe_index.h"
 
 #if CONFIG_DUMMY == 1
 void dummy_basic_lifecycle_test_success(void **state)
@@ -339,6 +344,265 @@ void dummy_probe_and_erase(void **state)
 	dummy_test_shutdown(flashctx, flashprog);
 }
 
+static unsigned int probe_all_chips(const char *param, const char ***names, long *elapsed_us)
+{
+	struct flashrom_programmer *flashprog = NULL;
+	struct flashrom_flashctx *flashctx = NULL;
+	struct timespec start, end;
+
+	assert_int_equal(0, flashrom_create_context(&flashctx));
+	assert_int_equal(0, flashrom_programmer_init(&flashprog, "dummy", param));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	const int count = flashrom_flash_probe_v2(flashctx, names, flashprog, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	assert_in_range(count, 0, flashchips_size);
+	assert_int_equal(0, flashrom_programmer_shutdown(flashprog));
+	flashrom_flash_release(flashctx);
+
+	*elapsed_us = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+	return count;
+}
+
+void dummy_probe_index_matches_linear_scan(void **state)
+{
+	(void) state; /* unused */
+
+	static const char *const params[] = {
+		"bus=spi,emulate=W25Q128FV",
+		"bus=spi,emulate=MX25L6436",
+		"bus=spi,emulate=SST25VF032B",
+		"bus=spi,emulate=S25FL128L",
+		"bus=spi,emulate=M25P10.RES",
+		"bus=spi,emulate=SST25VF040.REMS",
+		"bus=parallel+lpc+fwh+spi+prog,emulate=W25Q128FV",
+		"bus=parallel+lpc+fwh+spi+prog",
+	};
+
+	for (size_t i = 0; i < ARRAY_SIZE(params); i++) {
+		const char **linear_names = NULL, **indexed_names = NULL;
+		long linear_us, indexed_us;
+
+		probe_index_enable(false);
+		const unsigned int linear = probe_all_chips(params[i], &linear_names, &linear_us);
+		probe_index_enable(true);
+		const unsigned int indexed = probe_all_chips(params[i], &indexed_names, &indexed_us);
+
+		printf("Probing with %s: %u matches, linear scan %ld us, indexed %ld us\n",
+		       params[i], indexed, linear_us, indexed_us);
+		assert_int_equal(linear, indexed);
+		for (unsigned int j = 0; j < linear; j++)
+			assert_string_equal(linear_names[j], indexed_names[j]);
+
+		flashrom_data_free(linear_names);
+		flashrom_data_free(indexed_names);
+	}
+}
+
+#define PARALLEL_PROGRAMMERS	4
+
+struct parallel_job {
+	pthread_t thread;
+	uint8_t seed;
+	int ret;
+	bool matches;
+};
+
+/*
+ * Runs a whole session on a programmer of its own. Nothing here may assert,
+ * cmocka can only handle failures in the main thread.
+ */
+static void *parallel_session(void *arg)
+{
+	struct parallel_job *const job = arg;
+	struct flashrom_programmer *flashprog = NULL;
+	struct flashrom_flashctx *flashctx = NULL;
+	const char **names = NULL;
+	uint8_t *newcontents = NULL, *readback = NULL;
+
+	job->ret = flashrom_programmer_init(&flashprog, "dummy", "bus=spi,emulate=M25P10.RES");
+	if (job->ret)
+		return NULL;
+	job->ret = flashrom_create_context(&flashctx);
+	if (job->ret)
+		goto shutdown;
+	if (flashrom_flash_probe_v2(flashctx, &names, flashprog, "M25P10") != 1) {
+		job->ret = -1;
+		goto release;
+	}
+
+	const size_t size = flashrom_flash_getsize(flashctx);
+	newcontents = malloc(size);
+	readback = malloc(size);
+	if (!newcontents || !readback) {
+		job->ret = -1;
+		goto release;
+	}
+	for (size_t i = 0; i < size; i++)
+		newcontents[i] = job->seed + i / 256;
+
+	job->ret = flashrom_image_write(flashctx, newcontents, size, NULL);
+	if (!job->ret)
+		job->ret = flashrom_image_read(flashctx, readback, size);
+	job->matches = !job->ret && !memcmp(newcontents, readback, size);
+
+release:
+	free(readback);
+	free(newcontents);
+	flashrom_data_free(names);
+	flashrom_flash_release(flashctx);
+shutdown:
+	if (flashrom_programmer_shutdown(flashprog) && !job->ret)
+		job->ret = -1;
+	return NULL;
+}
+
+void dummy_parallel_programmers_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct parallel_job jobs[PARALLEL_PROGRAMMERS];
+
+	for (size_t i = 0; i < PARALLEL_PROGRAMMERS; i++) {
+		jobs[i] = (struct parallel_job){ .seed = 0x11 * (i + 1), .ret = -1 };
+		assert_int_equal(0, pthread_create(&jobs[i].thread, NULL, parallel_session, &jobs[i]));
+	}
+	for (size_t i = 0; i < PARALLEL_PROGRAMMERS; i++)
+		assert_int_equal(0, pthread_join(jobs[i].thread, NULL));
+
+	/* Each emulated chip holds what its own thread wrote. */
+	for (size_t i = 0; i < PARALLEL_PROGRAMMERS; i++) {
+		assert_int_equal(0, jobs[i].ret);
+		assert_true(jobs[i].matches);
+	}
+
+	/* The main thread's programmer was left alone. */
+	assert_null(programmer_current()->entry);
+}
+
+#define MULTI_IO_START	0x1000
+#define MULTI_IO_LEN	(4 * KiB)
+#define MULTI_IO_ALL	(FEATURE_FAST_READ_DOUT | FEATURE_FAST_READ_DIO | \
+			 FEATURE_FAST_READ_QOUT | FEATURE_FAST_READ_QIO)
+
+/*
+ * Reads back what was written with the given dummy parameters after limiting
+ * the chip's fast reads to `features` and, if `qe`, setting its quad enable
+ * bit. Returns how often `opcode` was sent.
+ */
+static uint64_t dummy_multi_io_read(const char *param, int features, bool qe, uint8_t opcode)
+{
+	struct flashrom_programmer *flashprog = NULL;
+	struct flashrom_flashctx *flashctx = NULL;
+	const char **names = NULL;
+	uint8_t buf[MULTI_IO_LEN], readback[MULTI_IO_LEN];
+
+	assert_int_equal(0, flashrom_create_context(&flashctx));
+	assert_int_equal(0, flashrom_stats_enable(flashctx, true));
+	assert_int_equal(0, flashrom_programmer_init(&flashprog, "dummy", param));
+	assert_int_equal(1, flashrom_flash_probe_v2(flashctx, &names, flashprog, "W25Q128.V"));
+
+	for (size_t i = 0; i < sizeof(buf); i++)
+		buf[i] = i * 3 + (i >> 8);
+	assert_int_equal(0, write_flash(flashctx, buf, MULTI_IO_START, sizeof(buf)));
+
+	/* flashchips.c has all fast reads and the QE bit of the W25Q128.V. */
+	assert_int_equal(MULTI_IO_ALL, flashctx->chip->feature_bits & MULTI_IO_ALL);
+	assert_int_equal(STATUS2, flashctx->chip->reg_bits.qe.reg);
+	assert_int_equal(1, flashctx->chip->reg_bits.qe.bit_index);
+	flashctx->chip->feature_bits &= ~MULTI_IO_ALL | features;
+	if (qe)
+		assert_int_equal(0, spi_write_register(flashctx, STATUS2, 1 << 1));
+	assert_int_equal(0, read_flash(flashctx, readback, MULTI_IO_START, sizeof(readback)));
+	assert_memory_equal(buf, readback, sizeof(buf));
+
+	struct flashrom_stats *const stats = malloc(sizeof(*stats));
+	assert_non_null(stats);
+	assert_int_equal(0, flashrom_stats_get(flashctx, stats));
+	const uint64_t count = stats->opcode[opcode].count;
+	free(stats);
+
+	flashrom_data_free(names);
+	flashrom_flash_release(flashctx);
+	assert_int_equal(0, flashrom_programmer_shutdown(flashprog));
+	return count;
+}
+
+void dummy_multi_io_read_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	const int all = MULTI_IO_ALL;
+	const char *const single = "bus=spi,emulate=W25Q128FV";
+	const char *const dual = "bus=spi,emulate=W25Q128FV,spi_io_width=2";
+	const char *const quad = "bus=spi,emulate=W25Q128FV,spi_io_width=4";
+
+	/* The fastest mode both sides support is used. */
+	assert_int_equal(1, dummy_multi_io_read(quad, all, true, JEDEC_READ_FAST_QIO));
+	assert_int_equal(1, dummy_multi_io_read(dual, all, true, JEDEC_READ_FAST_DIO));
+	assert_int_equal(1, dummy_multi_io_read(single, all, true, JEDEC_READ));
+	assert_int_equal(1, dummy_multi_io_read(quad, FEATURE_FAST_READ_DOUT | FEATURE_FAST_READ_QOUT,
+						true, JEDEC_READ_FAST_QOUT));
+	assert_int_equal(1, dummy_multi_io_read(quad, 0, true, JEDEC_READ));
+
+	/* With QE cleared the chip ignores quad reads, so they must not be tried. */
+	assert_int_equal(1, dummy_multi_io_read(quad, all, false, JEDEC_READ_FAST_DIO));
+}
+
+#define TIMED_START	0x1000
+#define TIMED_LEN	(4 * KiB)
+
+void dummy_timing_model_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct flashrom_programmer *flashprog = NULL;
+	struct flashrom_flashctx *flashctx = NULL;
+	const char **names = NULL;
+	/* A hundredth of the W25Q128FV times: 450us sector erase, 7us page program. */
+	const char *const param = "bus=spi,emulate=W25Q128FV,timing=yes,timing_scale=1";
+	static const uint8_t sector_erase[] = { JEDEC_SE, 0x00, 0x00, 0x00 };
+	static const uint8_t byte_program[] = { JEDEC_BYTE_PROGRAM, 0x00, 0x10, 0x00, 0x5a };
+	uint8_t buf[TIMED_LEN], readback[TIMED_LEN];
+	uint8_t status;
+
+	assert_int_equal(0, flashrom_create_context(&flashctx));
+	assert_int_equal(0, flashrom_programmer_init(&flashprog, "dummy", param));
+	assert_int_equal(1, flashrom_flash_probe_v2(flashctx, &names, flashprog, "W25Q128.V"));
+	assert_int_equal(0, flashrom_stats_enable(flashctx, true));
+
+	/* The erase keeps the chip busy... */
+	assert_int_equal(0, spi_write_enable(flashctx));
+	assert_int_equal(0, spi_send_command(flashctx, sizeof(sector_erase), 0, sector_erase, NULL));
+	assert_int_equal(0, spi_read_register(flashctx, STATUS1, &status));
+	assert_true(status & SPI_SR_WIP);
+	/* ...and a program meanwhile is ignored. */
+	assert_int_equal(0, spi_send_command(flashctx, sizeof(byte_program), 0, byte_program, NULL));
+	assert_int_equal(0, spi_poll_wip(flashctx, JEDEC_SE, 0, 100, 1000 * 1000));
+	assert_int_equal(0, spi_read_register(flashctx, STATUS1, &status));
+	assert_false(status & SPI_SR_WIP);
+	assert_int_equal(0, read_flash(flashctx, readback, TIMED_START, 1));
+	assert_int_equal(0xff, readback[0]);
+
+	/* Every page program is waited for. */
+	for (size_t i = 0; i < sizeof(buf); i++)
+		buf[i] = i * 5 + (i >> 8);
+	assert_int_equal(0, write_flash(flashctx, buf, TIMED_START, sizeof(buf)));
+	assert_int_equal(0, read_flash(flashctx, readback, TIMED_START, sizeof(readback)));
+	assert_memory_equal(buf, readback, sizeof(buf));
+
+	struct flashrom_stats *const stats = malloc(sizeof(*stats));
+	assert_non_null(stats);
+	assert_int_equal(0, flashrom_stats_get(flashctx, stats));
+	assert_true(stats->opcode[JEDEC_SE].busy_total_ns >= 450 * 1000);
+	assert_int_equal(TIMED_LEN / 256, stats->opcode[JEDEC_BYTE_PROGRAM].busy_count);
+	assert_true(stats->opcode[JEDEC_BYTE_PROGRAM].busy_total_ns >= TIMED_LEN / 256 * 7 * 1000);
+	free(stats);
+
+	flashrom_data_free(names);
+	flashrom_flash_release(flashctx);
+	assert_int_equal(0, flashrom_programmer_shutdown(flashprog));
+}
+
 #else
 	SKIP_TEST(dummy_basic_lifecycle_test_success)
 	SKIP_TEST(dummy_probe_lifecycle_test_success)
@@ -356,4 +620,8 @@ void dummy_probe_and_erase(void **state)
 	SKIP_TEST(dummy_probe_and_read)
 	SKIP_TEST(dummy_probe_and_write)
 	SKIP_TEST(dummy_probe_and_erase)
+	SKIP_TEST(dummy_probe_index_matches_linear_scan)
+	SKIP_TEST(dummy_parallel_programmers_test_success)
+	SKIP_TEST(dummy_multi_io_read_test_success)
+	SKIP_TEST(dummy_timing_model_test_success)
 #endif /* CONFIG_DUMMY */
@@ -0,0 +1,447 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "lifecycle.h"
+
+#if CONFIG_FT2232_SPI == 1
+#include <ftdi.h>
+
+#include "flash.h"
+
+void ft2232_spi_basic_lifecycle_test_success(void **state)
+{
+	struct io_mock_fallback_open_state ft2232_spi_fallback_open_state = {
+		.noc = 0,
+		.paths = { NULL },
+	};
+	const struct io_mock ft2232_spi_io = {
+		.fallback_open_state = &ft2232_spi_fallback_open_state,
+	};
+
+	run_basic_lifecycle(state, &ft2232_spi_io, &programmer_ft2232_spi, "");
+}
+
+/*
+ * Byte level emulation of an FT2232H in MPSSE mode with a W25Q128.V attached.
+ * Writes are executed right away, the bytes clocked in by read commands queue
+ * up until the host reads them. Page programs keep the chip busy for a while,
+ * measured in real time plus the time the host let the MPSSE clock idle.
+ */
+#define FT2232_EMU_CHIP_SIZE		(16 * MiB)
+#define FT2232_EMU_RX_SIZE		(256 * KiB)
+#define FT2232_EMU_SPI_KHZ		30000	/* 60 MHz MPSSE clock, default divisor */
+#define FT2232_EMU_PROGRAM_NS		(40 * 1000)
+#define FT2232_EMU_TYP_PROGRAM_US	50
+#define FT2232_EMU_READ_SIZE		(256 * KiB)
+#define FT2232_EMU_WRITE_SIZE		(16 * KiB)
+#define FT2232_EMU_PAGES		(FT2232_EMU_WRITE_SIZE / 256)
+#define FT2232_EMU_CS			0x08	/* ADBUS3, the default CS# */
+
+struct ft2232_spi_emu_state {
+	uint8_t *flash;
+	uint8_t rx[FT2232_EMU_RX_SIZE];
+	unsigned int rx_len;
+
+	/* SPI transaction in progress */
+	bool selected;
+	uint8_t opcode;
+	unsigned int pos;
+	unsigned int addr;
+	uint8_t page[256];
+	unsigned int page_len;
+	bool wel;
+	bool polling;			/* RDSR after a page program */
+	uint64_t busy_until_ns;
+	uint64_t idle_ns;		/* clocked without data, added to the real time */
+
+	unsigned int writes_in_flight;
+	unsigned int max_writes_in_flight;
+	unsigned int reads_in_flight;
+	unsigned int read_stalls;	/* READ commands sent to a device with nothing to return */
+	unsigned int program_batches;	/* submissions with a page program... */
+	unsigned int program_poll_batches; /* ...and those that also poll WIP */
+	unsigned int program_polls;
+	unsigned int busy_polls;
+	bool batch_programs;
+};
+
+static uint8_t ft2232_emu_flash_byte(unsigned int addr)
+{
+	return (addr * 7) ^ (addr >> 8);
+}
+
+static uint64_t ft2232_emu_now_ns(const struct ft2232_spi_emu_state *emu)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec + emu->idle_ns;
+}
+
+static bool ft2232_emu_busy(const struct ft2232_spi_emu_state *emu)
+{
+	return ft2232_emu_now_ns(emu) < emu->busy_until_ns;
+}
+
+static uint8_t ft2232_emu_spi_byte(struct ft2232_spi_emu_state *emu, uint8_t out)
+{
+	const uint8_t rdid[] = { 0xEF /* WINBOND_NEX_ID */, 0x40, 0x18 /* WINBOND_NEX_W25Q128_V */ };
+	const unsigned int pos = emu->pos++;
+
+	if (pos == 0) {
+		emu->opcode = out;
+		emu->addr = 0;
+		emu->page_len = 0;
+		if (out == JEDEC_RDSR) {
+			if (emu->polling)
+				emu->program_polls++;
+		} else {
+			/* The chip ignores everything but RDSR while busy. */
+			assert_false(ft2232_emu_busy(emu));
+			emu->polling = false;
+		}
+		if (out == JEDEC_WREN)
+			emu->wel = true;
+		if (out == JEDEC_BYTE_PROGRAM && emu->batch_programs)
+			emu->program_batches++;
+		return 0xFF;
+	}
+	switch (emu->opcode) {
+	case JEDEC_RDID:
+		return pos <= ARRAY_SIZE(rdid) ? rdid[pos - 1] : 0xFF;
+	case JEDEC_RDSR:
+		if (pos == 1 && ft2232_emu_busy(emu))
+			emu->busy_polls++;
+		return (ft2232_emu_busy(emu) ? SPI_SR_WIP : 0) | (emu->wel ? SPI_SR_WEL : 0);
+	case JEDEC_READ:
+		if (pos <= 3) {
+			emu->addr = emu->addr << 8 | out;
+			return 0xFF;
+		}
+		return emu->flash[(emu->addr + pos - 4) % FT2232_EMU_CHIP_SIZE];
+	case JEDEC_BYTE_PROGRAM:
+		if (pos <= 3)
+			emu->addr = emu->addr << 8 | out;
+		else
+			emu->page[emu->page_len++ % 256] = out;
+		return 0xFF;
+	case 0x35: /* RDSR2 */
+	case 0x15: /* RDSR3 */
+		return 0x00;
+	default:
+		return 0xFF;
+	}
+}
+
+/* CS# was deasserted, a page program starts. */
+static void ft2232_emu_deselect(struct ft2232_spi_emu_state *emu)
+{
+	if (emu->opcode != JEDEC_BYTE_PROGRAM || !emu->wel || emu->pos < 4)
+		return;
+	for (unsigned int i = 0; i < emu->page_len && i < 256; i++) {
+		const unsigned int addr = (emu->addr & ~0xff) | ((emu->addr + i) & 0xff);
+		emu->flash[addr] &= emu->page[i];
+	}
+	emu->wel = false;
+	emu->polling = true;
+	emu->busy_until_ns = ft2232_emu_now_ns(emu) + FT2232_EMU_PROGRAM_NS;
+}
+
+static void ft2232_emu_execute(struct ft2232_spi_emu_state *emu, const unsigned char *buf, int size)
+{
+	const unsigned int program_polls = emu->program_polls;
+	const unsigned int program_batches = emu->program_batches;
+	int i = 0;
+
+	emu->batch_programs = true;
+	while (i < size) {
+		const uint8_t cmd = buf[i++];
+		unsigned int len;
+
+		switch (cmd) {
+		case SET_BITS_LOW: {
+			assert_true(i + 2 <= size);
+			const bool selected = (buf[i + 1] & FT2232_EMU_CS) && !(buf[i] & FT2232_EMU_CS);
+			if (emu->selected && !selected)
+				ft2232_emu_deselect(emu);
+			if (selected && !emu->selected)
+				emu->pos = 0;
+			emu->selected = selected;
+			i += 2;
+			break;
+		}
+		case SET_BITS_HIGH:
+		case TCK_DIVISOR:
+			i += 2;
+			break;
+		case DIS_DIV_5:
+		case LOOPBACK_END:
+			break;
+		case MPSSE_DO_WRITE | MPSSE_WRITE_NEG:
+			assert_true(i + 2 <= size);
+			len = (buf[i] | buf[i + 1] << 8) + 1;
+			i += 2;
+			assert_true(i + (int)len <= size);
+			if (emu->pos == 0 && buf[i] == JEDEC_READ && !emu->rx_len)
+				emu->read_stalls++;
+			for (unsigned int j = 0; j < len; j++)
+				ft2232_emu_spi_byte(emu, buf[i + j]);
+			i += len;
+			break;
+		case MPSSE_DO_READ:
+			assert_true(i + 2 <= size);
+			len = (buf[i] | buf[i + 1] << 8) + 1;
+			i += 2;
+			assert_true(emu->rx_len + len <= FT2232_EMU_RX_SIZE);
+			for (unsigned int j = 0; j < len; j++)
+				emu->rx[emu->rx_len++] = ft2232_emu_spi_byte(emu, 0xFF);
+			break;
+		case CLK_BYTES:
+			assert_true(i + 2 <= size);
+			len = (buf[i] | buf[i + 1] << 8) + 1;
+			i += 2;
+			emu->idle_ns += (uint64_t)len * 8 * 1000000 / FT2232_EMU_SPI_KHZ;
+			break;
+		default:
+			fail_msg("Unexpected MPSSE command 0x%02x", cmd);
+		}
+	}
+	emu->batch_programs = false;
+	if (emu->program_batches != program_batches && emu->program_polls != program_polls)
+		emu->program_poll_batches++;
+}
+
+static void ft2232_emu_receive(struct ft2232_spi_emu_state *emu, unsigned char *buf, int size)
+{
+	assert_true((unsigned int)size <= emu->rx_len);
+	memcpy(buf, emu->rx, size);
+	emu->rx_len -= size;
+	memmove(emu->rx, emu->rx + size, emu->rx_len);
+}
+
+static int ft2232_emu_write_data(void *state, struct ftdi_context *ftdi, const unsigned char *buf, int size)
+{
+	ft2232_emu_execute(state, buf, size);
+	return size;
+}
+
+static int ft2232_emu_read_data(void *state, struct ftdi_context *ftdi, unsigned char *buf, int size)
+{
+	ft2232_emu_receive(state, buf, size);
+	return size;
+}
+
+static struct ftdi_transfer_control *ft2232_emu_write_data_submit(void *state, struct ftdi_context *ftdi,
+								  unsigned char *buf, int size)
+{
+	struct ft2232_spi_emu_state *emu = state;
+	struct ftdi_transfer_control *tc = calloc(1, sizeof(*tc));
+
+	assert_non_null(tc);
+	tc->ftdi = ftdi;
+	tc->size = size;
+	ft2232_emu_execute(emu, buf, size);
+	emu->max_writes_in_flight = max(emu->max_writes_in_flight, ++emu->writes_in_flight);
+	return tc;
+}
+
+static struct ftdi_transfer_control *ft2232_emu_read_data_submit(void *state, struct ftdi_context *ftdi,
+								 unsigned char *buf, int size)
+{
+	struct ft2232_spi_emu_state *emu = state;
+	struct ftdi_transfer_control *tc = calloc(1, sizeof(*tc));
+
+	/* libftdi receives into a buffer of the context, one read at a time. */
+	assert_int_equal(0, emu->reads_in_flight);
+	assert_non_null(tc);
+	tc->ftdi = ftdi;
+	tc->buf = buf;
+	tc->size = size;
+	emu->reads_in_flight++;
+	return tc;
+}
+
+static int ft2232_emu_transfer_data_done(void *state, struct ftdi_transfer_control *tc)
+{
+	struct ft2232_spi_emu_state *emu = state;
+	const int size = tc->size;
+
+	if (tc->buf) {
+		ft2232_emu_receive(emu, tc->buf, size);
+		emu->reads_in_flight--;
+	} else {
+		emu->writes_in_flight--;
+	}
+	free(tc);
+	return size;
+}
+
+static struct io_mock ft2232_emu_io(struct ft2232_spi_emu_state *emu)
+{
+	return (struct io_mock) {
+		.state			= emu,
+		.ftdi_write_data	= ft2232_emu_write_data,
+		.ftdi_read_data		= ft2232_emu_read_data,
+		.ftdi_write_data_submit	= ft2232_emu_write_data_submit,
+		.ftdi_read_data_submit	= ft2232_emu_read_data_submit,
+		.ftdi_transfer_data_done = ft2232_emu_transfer_data_done,
+	};
+}
+
+static struct ft2232_spi_emu_state *ft2232_emu_new(void)
+{
+	struct ft2232_spi_emu_state *emu = calloc(1, sizeof(*emu));
+	assert_non_null(emu);
+	emu->flash = malloc(FT2232_EMU_CHIP_SIZE);
+	assert_non_null(emu->flash);
+	memset(emu->flash, 0xff, FT2232_EMU_CHIP_SIZE);
+	return emu;
+}
+
+static void ft2232_emu_free(struct ft2232_spi_emu_state *emu)
+{
+	free(emu->flash);
+	free(emu);
+}
+
+void ft2232_spi_probe_lifecycle_test_success(void **state)
+{
+	struct ft2232_spi_emu_state *emu = ft2232_emu_new();
+	const struct io_mock ft2232_spi_io = ft2232_emu_io(emu);
+
+	const char *expected_matched_names[1] = {"W25Q128.V"};
+	run_probe_v2_lifecycle(state, &ft2232_spi_io, &programmer_ft2232_spi, "", "W25Q128.V",
+				expected_matched_names, 1);
+	ft2232_emu_free(emu);
+}
+
+struct ft2232_emu_session {
+	struct flashrom_programmer *flashprog;
+	struct flashrom_flashctx *flashctx;
+	struct flashrom_layout *layout;
+	const char **names;
+};
+
+static void ft2232_emu_open(struct ft2232_emu_session *s, const struct io_mock *io,
+			    const char *param, unsigned int region_size)
+{
+	io_mock_register(io);
+	assert_int_equal(0, flashrom_programmer_init(&s->flashprog, "ft2232_spi", param));
+	assert_int_equal(0, flashrom_create_context(&s->flashctx));
+	assert_int_equal(1, flashrom_flash_probe_v2(s->flashctx, &s->names, s->flashprog, "W25Q128.V"));
+	assert_int_equal(FT2232_EMU_CHIP_SIZE, flashrom_flash_getsize(s->flashctx));
+	/* Without chip data, the host would not clock through the program time. */
+	s->flashctx->chip->typ_page_program_us = FT2232_EMU_TYP_PROGRAM_US;
+	assert_int_equal(0, flashrom_layout_new(&s->layout));
+	assert_int_equal(0, flashrom_layout_add_region(s->layout, 0, region_size - 1, "region"));
+	assert_int_equal(0, flashrom_layout_include_region(s->layout, "region"));
+	flashrom_layout_set(s->flashctx, s->layout);
+}
+
+static void ft2232_emu_close(struct ft2232_emu_session *s)
+{
+	flashrom_layout_release(s->layout);
+	flashrom_data_free(s->names);
+	flashrom_flash_release(s->flashctx);
+	assert_int_equal(0, flashrom_programmer_shutdown(s->flashprog));
+	io_mock_register(NULL);
+}
+
+static void ft2232_emu_read(struct ft2232_spi_emu_state *emu, const char *param)
+{
+	struct ft2232_emu_session s = { NULL };
+	const struct io_mock io = ft2232_emu_io(emu);
+
+	for (unsigned int i = 0; i < FT2232_EMU_READ_SIZE; i++)
+		emu->flash[i] = ft2232_emu_flash_byte(i);
+	ft2232_emu_open(&s, &io, param, FT2232_EMU_READ_SIZE);
+
+	uint8_t *const buf = malloc(FT2232_EMU_CHIP_SIZE);
+	assert_non_null(buf);
+	emu->read_stalls = 0;
+	emu->max_writes_in_flight = 0;
+	assert_int_equal(0, flashrom_image_read(s.flashctx, buf, FT2232_EMU_CHIP_SIZE));
+	assert_memory_equal(emu->flash, buf, FT2232_EMU_READ_SIZE);
+	free(buf);
+
+	ft2232_emu_close(&s);
+	assert_int_equal(0, emu->writes_in_flight);
+	assert_int_equal(0, emu->reads_in_flight);
+}
+
+void ft2232_spi_async_read_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct ft2232_spi_emu_state *emu = ft2232_emu_new();
+
+	/* Synchronously, the chip idles while each 64 KiB read travels to the host. */
+	ft2232_emu_read(emu, "");
+	assert_int_equal(FT2232_EMU_READ_SIZE / (64 * KiB), emu->read_stalls);
+
+	/* With async=on, the next command is always queued behind the current data. */
+	ft2232_emu_read(emu, "async=on");
+	assert_int_equal(1, emu->read_stalls);
+	assert_true(emu->max_writes_in_flight >= 2);
+
+	ft2232_emu_free(emu);
+}
+
+static void ft2232_emu_write(struct ft2232_spi_emu_state *emu, const char *param)
+{
+	struct ft2232_emu_session s = { NULL };
+	const struct io_mock io = ft2232_emu_io(emu);
+
+	memset(emu->flash, 0xff, FT2232_EMU_CHIP_SIZE);
+	ft2232_emu_open(&s, &io, param, FT2232_EMU_WRITE_SIZE);
+
+	uint8_t *const image = malloc(FT2232_EMU_CHIP_SIZE);
+	assert_non_null(image);
+	for (unsigned int i = 0; i < FT2232_EMU_CHIP_SIZE; i++)
+		image[i] = ft2232_emu_flash_byte(i);
+	emu->program_batches = 0;
+	emu->program_poll_batches = 0;
+	emu->program_polls = 0;
+	emu->busy_polls = 0;
+	assert_int_equal(0, flashrom_image_write(s.flashctx, image, FT2232_EMU_CHIP_SIZE, NULL));
+	assert_memory_equal(image, emu->flash, FT2232_EMU_WRITE_SIZE);
+	assert_int_equal(0xff, emu->flash[FT2232_EMU_WRITE_SIZE]);
+	free(image);
+
+	ft2232_emu_close(&s);
+}
+
+void ft2232_spi_async_write_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct ft2232_spi_emu_state *emu = ft2232_emu_new();
+
+	/* Synchronously, the host waits for every page before it polls WIP. */
+	ft2232_emu_write(emu, "");
+	assert_int_equal(FT2232_EMU_PAGES, emu->program_batches);
+	assert_int_equal(0, emu->program_poll_batches);
+	assert_true(emu->program_polls >= FT2232_EMU_PAGES);
+
+	/*
+	 * With async=on, each page is programmed and polled in a single submission,
+	 * which clocks through the program time, so the first poll finds it done.
+	 */
+	ft2232_emu_write(emu, "async=on");
+	assert_int_equal(FT2232_EMU_PAGES, emu->program_batches);
+	assert_int_equal(FT2232_EMU_PAGES, emu->program_poll_batches);
+	assert_int_equal(0, emu->busy_polls);
+
+	ft2232_emu_free(emu);
+}
+#else
+	SKIP_TEST(ft2232_spi_basic_lifecycle_test_success)
+	SKIP_TEST(ft2232_spi_probe_lifecycle_test_success)
+	SKIP_TEST(ft2232_spi_async_read_test_success)
+	SKIP_TEST(ft2232_spi_async_write_test_success)
+#endif /* CONFIG_FT2232_SPI */
@@ -0,0 +1,107 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <string.h>
+
+#include <include/test.h>
+#include "io_mock.h"
+
+#if CONFIG_FT2232_SPI == 1
+#include "ftdi_wraps.h"
+
+int __wrap_ftdi_init(struct ftdi_context *ftdi)
+{
+	LOG_ME;
+	memset(ftdi, 0, sizeof(*ftdi));
+	return 0;
+}
+
+int __wrap_ftdi_set_interface(struct ftdi_context *ftdi, enum ftdi_interface interface)
+{
+	LOG_ME;
+	return 0;
+}
+
+int __wrap_ftdi_usb_open_desc(struct ftdi_context *ftdi, int vendor, int product,
+		const char *description, const char *serial)
+{
+	LOG_ME;
+	/* A high-speed chip, which can disable the divide-by-5 prescaler. */
+	ftdi->type = TYPE_2232H;
+	return 0;
+}
+
+int __wrap_ftdi_usb_close(struct ftdi_context *ftdi)
+{
+	LOG_ME;
+	return 0;
+}
+
+int __wrap_ftdi_usb_reset(struct ftdi_context *ftdi)
+{
+	LOG_ME;
+	return 0;
+}
+
+int __wrap_ftdi_set_latency_timer(struct ftdi_context *ftdi, unsigned char latency)
+{
+	LOG_ME;
+	return 0;
+}
+
+int __wrap_ftdi_set_bitmode(struct ftdi_context *ftdi, unsigned char bitmask, unsigned char mode)
+{
+	LOG_ME;
+	return 0;
+}
+
+int __wrap_ftdi_write_data(struct ftdi_context *ftdi, const unsigned char *buf, int size)
+{
+	LOG_ME;
+	if (get_io() && get_io()->ftdi_write_data)
+		return get_io()->ftdi_write_data(get_io()->state, ftdi, buf, size);
+	return size;
+}
+
+int __wrap_ftdi_read_data(struct ftdi_context *ftdi, unsigned char *buf, int size)
+{
+	LOG_ME;
+	if (get_io() && get_io()->ftdi_read_data)
+		return get_io()->ftdi_read_data(get_io()->state, ftdi, buf, size);
+	memset(buf, 0, size);
+	return size;
+}
+
+struct ftdi_transfer_control *__wrap_ftdi_write_data_submit(struct ftdi_context *ftdi, unsigned char *buf, int size)
+{
+	LOG_ME;
+	if (get_io() && get_io()->ftdi_write_data_submit)
+		return get_io()->ftdi_write_data_submit(get_io()->state, ftdi, buf, size);
+	return NULL;
+}
+
+struct ftdi_transfer_control *__wrap_ftdi_read_data_submit(struct ftdi_context *ftdi, unsigned char *buf, int size)
+{
+	LOG_ME;
+	if (get_io() && get_io()->ftdi_read_data_submit)
+		return get_io()->ftdi_read_data_submit(get_io()->state, ftdi, buf, size);
+	return NULL;
+}
+
+int __wrap_ftdi_transfer_data_done(struct ftdi_transfer_control *tc)
+{
+	LOG_ME;
+	if (get_io() && get_io()->ftdi_transfer_data_done)
+		return get_io()->ftdi_transfer_data_done(get_io()->state, tc);
+	return -1;
+}
+
+const char *__wrap_ftdi_get_error_string(struct ftdi_context *ftdi)
+{
+	LOG_ME;
+	return "mocked error";
+}
+#endif /* CONFIG_FT2232_SPI */
@@ -0,0 +1,27 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#ifndef FTDI_WRAPS_H
+#define FTDI_WRAPS_H
+
+#include <ftdi.h>
+
+int __wrap_ftdi_init(struct ftdi_context *ftdi);
+int __wrap_ftdi_set_interface(struct ftdi_context *ftdi, enum ftdi_interface interface);
+int __wrap_ftdi_usb_open_desc(struct ftdi_context *ftdi, int vendor, int product,
+		const char *description, const char *serial);
+int __wrap_ftdi_usb_close(struct ftdi_context *ftdi);
+int __wrap_ftdi_usb_reset(struct ftdi_context *ftdi);
+int __wrap_ftdi_set_latency_timer(struct ftdi_context *ftdi, unsigned char latency);
+int __wrap_ftdi_set_bitmode(struct ftdi_context *ftdi, unsigned char bitmask, unsigned char mode);
+int __wrap_ftdi_write_data(struct ftdi_context *ftdi, const unsigned char *buf, int size);
+int __wrap_ftdi_read_data(struct ftdi_context *ftdi, unsigned char *buf, int size);
+struct ftdi_transfer_control *__wrap_ftdi_write_data_submit(struct ftdi_context *ftdi, unsigned char *buf, int size);
+struct ftdi_transfer_control *__wrap_ftdi_read_data_submit(struct ftdi_context *ftdi, unsigned char *buf, int size);
+int __wrap_ftdi_transfer_data_done(struct ftdi_transfer_control *tc);
+const char *__wrap_ftdi_get_error_string(struct ftdi_context *ftdi);
+
+#endif /* FTDI_WRAPS_H */
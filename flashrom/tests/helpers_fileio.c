@@ -0,0 +1,312 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Tests for the image file helpers. These work on real files in a temporary
+ * directory, the file I/O wraps are pointed at the real functions for them.
+ */
+
+#include <include/test.h>
+
+#include "tests.h"
+#include "io_mock.h"
+#include "wraps.h"
+#include "flash.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define IMAGE_SIZE	(64 * KiB)
+
+static int fileio_open(void *state, const char *pathname, int flags, mode_t mode)
+{
+	return __real_open(pathname, flags, mode);
+}
+
+static int fileio_fstat(void *state, int fd, void *buf)
+{
+	return __real_fstat(fd, buf);
+}
+
+static FILE *fileio_fopen(void *state, const char *pathname, const char *mode)
+{
+	return __real_fopen(pathname, mode);
+}
+
+static size_t fileio_fwrite(void *state, const void *buf, size_t size, size_t len, FILE *fp)
+{
+	return __real_fwrite(buf, size, len, fp);
+}
+
+static int fileio_fclose(void *state, FILE *fp)
+{
+	return __real_fclose(fp);
+}
+
+static int fileio_write(void *state, int fd, const void *buf, size_t sz)
+{
+	return __real_write(fd, buf, sz);
+}
+
+/* What image_file_map() and image_file_create() use to look at files. */
+static const struct io_mock fileio_map_io = {
+	.iom_open	= fileio_open,
+	.iom_fstat	= fileio_fstat,
+};
+
+/* What replace_file() uses to write the replacement. */
+static const struct io_mock fileio_replace_io = {
+	.iom_write	= fileio_write,
+};
+
+/* What image_file_commit() uses to write unmapped outputs. */
+static const struct io_mock fileio_stdio_io = {
+	.iom_fopen	= fileio_fopen,
+	.iom_fwrite	= fileio_fwrite,
+	.iom_fclose	= fileio_fclose,
+};
+
+static void write_file(const char *path, uint8_t value, size_t size, mode_t mode)
+{
+	const int fd = __real_open(path, O_RDWR | O_CREAT | O_TRUNC, mode);
+	assert_true(fd >= 0);
+	assert_int_equal(0, fchmod(fd, mode));
+	assert_int_equal(0, ftruncate(fd, size));
+	uint8_t *const buf = mmap(NULL, size, PROT_WRITE, MAP_SHARED, fd, 0);
+	assert_true(buf != MAP_FAILED);
+	memset(buf, value, size);
+	munmap(buf, size);
+	close(fd);
+}
+
+/* Checks that `path` holds `size` bytes of `value`. */
+static void check_file(const char *path, uint8_t value, size_t size)
+{
+	struct stat st;
+	assert_int_equal(0, lstat(path, &st));
+	assert_int_equal(size, st.st_size);
+
+	FILE *const fp = __real_fopen(path, "rb");
+	assert_non_null(fp);
+	for (size_t i = 0; i < size; i++)
+		assert_int_equal(value, getc(fp));
+	__real_fclose(fp);
+}
+
+static unsigned int count_entries(const char *dir)
+{
+	unsigned int count = 0;
+	DIR *const d = opendir(dir);
+	assert_non_null(d);
+	for (struct dirent *e; (e = readdir(d));)
+		count += strcmp(e->d_name, ".") && strcmp(e->d_name, "..");
+	closedir(d);
+	return count;
+}
+
+static void remove_dir(const char *dir)
+{
+	DIR *const d = opendir(dir);
+	assert_non_null(d);
+	for (struct dirent *e; (e = readdir(d));) {
+		if (strcmp(e->d_name, ".") && strcmp(e->d_name, ".."))
+			assert_int_equal(0, unlinkat(dirfd(d), e->d_name, 0));
+	}
+	closedir(d);
+	assert_int_equal(0, rmdir(dir));
+}
+
+void image_file_map_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	char dir[] = "/tmp/flashrom_fileio_XXXXXX";
+	char path[256];
+	struct image_file file;
+
+	assert_non_null(mkdtemp(dir));
+	snprintf(path, sizeof(path), "%s/image.bin", dir);
+	write_file(path, 0x5a, IMAGE_SIZE, 0644);
+
+	io_mock_register(&fileio_map_io);
+	assert_int_equal(0, image_file_map(&file, path, IMAGE_SIZE, true));
+	io_mock_register(NULL);
+	assert_true(file.mapped);
+	assert_int_equal(0x5a, file.buf[0]);
+	assert_int_equal(0x5a, file.buf[IMAGE_SIZE - 1]);
+
+	/* Changes to a writable input stay in memory. */
+	memset(file.buf, 0xa5, IMAGE_SIZE);
+	image_file_release(&file);
+	check_file(path, 0x5a, IMAGE_SIZE);
+
+	remove_dir(dir);
+}
+
+void image_file_replace_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	char dir[] = "/tmp/flashrom_fileio_XXXXXX";
+	char path[256], stale[256];
+	struct image_file file;
+	struct stat st;
+
+	assert_non_null(mkdtemp(dir));
+	snprintf(path, sizeof(path), "%s/image.bin", dir);
+	snprintf(stale, sizeof(stale), "%s/image.bin.tmp", dir);
+	write_file(path, 0x11, IMAGE_SIZE, 0640);
+	write_file(stale, 0x22, 16, 0600);
+
+	io_mock_register(&fileio_map_io);
+	assert_int_equal(0, image_file_create(&file, path, IMAGE_SIZE));
+	io_mock_register(NULL);
+	assert_true(file.mapped);
+	memset(file.buf, 0x33, IMAGE_SIZE);
+
+	/* The file is only replaced on commit. */
+	check_file(path, 0x11, IMAGE_SIZE);
+	assert_int_equal(0, image_file_commit(&file));
+	image_file_release(&file);
+
+	/* The replacement keeps the mode, and files next to it are left alone. */
+	check_file(path, 0x33, IMAGE_SIZE);
+	assert_int_equal(0, lstat(path, &st));
+	assert_int_equal(0640, st.st_mode & 07777);
+	check_file(stale, 0x22, 16);
+	assert_int_equal(2, count_entries(dir));
+
+	remove_dir(dir);
+}
+
+void image_file_create_new_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	char dir[] = "/tmp/flashrom_fileio_XXXXXX";
+	char path[256];
+	struct image_file file;
+	struct stat st;
+
+	assert_non_null(mkdtemp(dir));
+	snprintf(path, sizeof(path), "%s/image.bin", dir);
+
+	/* Outputs that aren't committed leave nothing behind. */
+	io_mock_register(&fileio_map_io);
+	assert_int_equal(0, image_file_create(&file, path, IMAGE_SIZE));
+	io_mock_register(NULL);
+	assert_true(file.mapped);
+	image_file_release(&file);
+	assert_int_equal(0, count_entries(dir));
+
+	io_mock_register(&fileio_map_io);
+	assert_int_equal(0, image_file_create(&file, path, IMAGE_SIZE));
+	io_mock_register(NULL);
+	memset(file.buf, 0x44, IMAGE_SIZE);
+	assert_int_equal(0, image_file_commit(&file));
+	image_file_release(&file);
+
+	/* New files get the mode they would have got from open(). */
+	const mode_t mask = umask(0);
+	umask(mask);
+	check_file(path, 0x44, IMAGE_SIZE);
+	assert_int_equal(0, lstat(path, &st));
+	assert_int_equal(0666 & ~mask, st.st_mode & 07777);
+	assert_int_equal(1, count_entries(dir));
+
+	remove_dir(dir);
+}
+
+void image_file_in_place_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	char dir[] = "/tmp/flashrom_fileio_XXXXXX";
+	char path[256], link_path[256], symlink_path[256];
+	struct image_file file;
+	struct stat st;
+
+	assert_non_null(mkdtemp(dir));
+	snprintf(path, sizeof(path), "%s/image.bin", dir);
+	snprintf(link_path, sizeof(link_path), "%s/hardlink.bin", dir);
+	snprintf(symlink_path, sizeof(symlink_path), "%s/symlink.bin", dir);
+	write_file(path, 0x55, IMAGE_SIZE, 0644);
+	assert_int_equal(0, link(path, link_path));
+	assert_int_equal(0, symlink(path, symlink_path));
+
+	/* Replacing a hard link would split it from the other names of the file. */
+	io_mock_register(&fileio_map_io);
+	assert_int_equal(0, image_file_create(&file, link_path, IMAGE_SIZE));
+	io_mock_register(NULL);
+	assert_false(file.mapped);
+	memset(file.buf, 0x66, IMAGE_SIZE);
+	io_mock_register(&fileio_stdio_io);
+	assert_int_equal(0, image_file_commit(&file));
+	io_mock_register(NULL);
+	image_file_release(&file);
+	check_file(path, 0x66, IMAGE_SIZE);
+
+	/* A symlink stays a symlink, its target is written. */
+	io_mock_register(&fileio_map_io);
+	assert_int_equal(0, image_file_create(&file, symlink_path, IMAGE_SIZE));
+	io_mock_register(NULL);
+	assert_false(file.mapped);
+	memset(file.buf, 0x77, IMAGE_SIZE);
+	io_mock_register(&fileio_stdio_io);
+	assert_int_equal(0, image_file_commit(&file));
+	io_mock_register(NULL);
+	image_file_release(&file);
+	assert_int_equal(0, lstat(symlink_path, &st));
+	assert_true(S_ISLNK(st.st_mode));
+	check_file(path, 0x77, IMAGE_SIZE);
+	check_file(link_path, 0x77, IMAGE_SIZE);
+	assert_int_equal(3, count_entries(dir));
+
+	remove_dir(dir);
+}
+
+void replace_file_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	char dir[] = "/tmp/flashrom_fileio_XXXXXX";
+	char path[256], stale[256];
+	uint8_t buf[1000];
+	struct stat st;
+
+	assert_non_null(mkdtemp(dir));
+	snprintf(path, sizeof(path), "%s/manifest", dir);
+	snprintf(stale, sizeof(stale), "%s/manifest.tmp", dir);
+	write_file(stale, 0x22, 16, 0600);
+
+	/* New files get the mode they would have got from open(). */
+	const mode_t mask = umask(0);
+	umask(mask);
+	memset(buf, 0x11, sizeof(buf));
+	io_mock_register(&fileio_replace_io);
+	assert_int_equal(0, replace_file(path, buf, sizeof(buf)));
+	io_mock_register(NULL);
+	check_file(path, 0x11, sizeof(buf));
+	assert_int_equal(0, lstat(path, &st));
+	assert_int_equal(0666 & ~mask, st.st_mode & 07777);
+
+	/* A replacement keeps the mode, and another run's temporary file is left alone. */
+	assert_int_equal(0, chmod(path, 0640));
+	memset(buf, 0x33, sizeof(buf));
+	io_mock_register(&fileio_replace_io);
+	assert_int_equal(0, replace_file(path, buf, sizeof(buf) / 2));
+	io_mock_register(NULL);
+	check_file(path, 0x33, sizeof(buf) / 2);
+	assert_int_equal(0, lstat(path, &st));
+	assert_int_equal(0640, st.st_mode & 07777);
+	check_file(stale, 0x22, 16);
+	assert_int_equal(2, count_entries(dir));
+
+	remove_dir(dir);
+}
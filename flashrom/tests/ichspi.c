@@ -0,0 +1,362 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Tests for reading the BIOS region through its memory mapping with the Intel
+ * hardware sequencer. The SPI register block of a Cannon Point PCH with an
+ * 8 MiB flash is modelled in software, the BIOS region is mapped from a file.
+ */
+
+#include "lifecycle.h"
+#include "chipdrivers.h"
+
+#if CONFIG_INTERNAL == 1 && (defined(__i386__) || defined(__x86_64__)) && defined(__linux__)
+
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define FLASH_SIZE	(8 * MiB)
+#define BIOS_BASE	(4 * MiB)	/* The BIOS region is the upper half. */
+#define BIOS_SIZE	(4 * MiB)
+#define HWSEQ_BLOCK	64
+
+/* Registers of the model, see ichspi.c */
+#define REG_HSFS	0x04
+#define REG_HSFC	0x06
+#define REG_FADDR	0x08
+#define REG_FDATA0	0x10
+#define REG_FRAP	0x50
+#define REG_FREG0	0x54
+#define REG_FDOC	0xb4
+#define REG_FDOD	0xb8
+#define REGS_SIZE	0x200
+
+#define HSFS_FDONE	(1 << 0)
+#define HSFS_FCERR	(1 << 1)
+#define HSFS_AEL	(1 << 2)
+#define HSFS_FDV	(1 << 14)
+#define HSFC_FGO	(1 << 0)
+
+struct ich_model {
+	uint32_t regs[REGS_SIZE / 4];
+	uint8_t flash[FLASH_SIZE];
+	unsigned int read_cycles;
+	int image_fd;		/* What the CPU reads below 4 GiB. */
+	void *bios_map;
+	unsigned int physmaps;
+	struct io_mock io;	/* Registered while the programmer is up. */
+};
+
+static uint8_t *reg(struct ich_model *model, unsigned int off)
+{
+	return (uint8_t *)model->regs + off;
+}
+
+static uint32_t reg32(struct ich_model *model, unsigned int off)
+{
+	uint32_t val;
+	memcpy(&val, reg(model, off), sizeof(val));
+	return val;
+}
+
+static void set_reg16(struct ich_model *model, unsigned int off, uint16_t val)
+{
+	memcpy(reg(model, off), &val, sizeof(val));
+}
+
+static void set_reg32(struct ich_model *model, unsigned int off, uint32_t val)
+{
+	memcpy(reg(model, off), &val, sizeof(val));
+}
+
+/* Descriptor of a single 8 MiB component, as read through FDOC/FDOD. */
+static uint32_t descriptor_reg(unsigned int section, unsigned int index)
+{
+	if (section == 0 && index == 0)
+		return 0x0ff0a55a;	/* FLVALSIG */
+	if (section == 0 && index == 1)
+		return 0x00040003;	/* FLMAP0: FCBA 0x30, NC 0, FRBA 0x40 */
+	if (section == 1 && index == 0)
+		return 0x00000004;	/* FLCOMP: 8 MiB */
+	return 0;
+}
+
+static void run_cycle(struct ich_model *model, uint16_t hsfc)
+{
+	const unsigned int cycle = (hsfc >> 1) & 0xf;
+	const unsigned int len = ((hsfc >> 8) & 0x3f) + 1;
+	const uint32_t addr = reg32(model, REG_FADDR) & 0x07ffffff;
+	uint8_t *const fdata = reg(model, REG_FDATA0);
+	uint16_t hsfs = HSFS_FDONE;
+
+	switch (cycle) {
+	case 0:	/* read */
+		assert_true(addr + len <= FLASH_SIZE);
+		memcpy(fdata, model->flash + addr, len);
+		model->read_cycles++;
+		break;
+	case 2:	/* write */
+		assert_true(addr + len <= FLASH_SIZE);
+		for (unsigned int i = 0; i < len; i++)
+			model->flash[addr + i] &= fdata[i];
+		break;
+	case 3:	/* 4 KiB erase */
+		assert_true(addr < FLASH_SIZE);
+		memset(model->flash + (addr & ~0xfff), 0xff, 4 * KiB);
+		break;
+	case 6:	/* RDID */
+		memcpy(fdata, "\xef\x40\x17", 3);
+		break;
+	default:
+		hsfs |= HSFS_FCERR;
+		break;
+	}
+	set_reg16(model, REG_HSFS, (reg32(model, REG_HSFS) & 0xffff) | hsfs);
+}
+
+static void ich_mmio_write(struct ich_model *model, void *addr, uint32_t val, unsigned int len)
+{
+	const ptrdiff_t off = (uint8_t *)addr - reg(model, 0);
+	assert_true(off >= 0 && off + len <= REGS_SIZE);
+
+	if (off == REG_HSFS && len == 2) {
+		/* FDONE, FCERR and AEL are cleared by writing 1. */
+		const uint16_t hsfs = reg32(model, REG_HSFS) & 0xffff;
+		set_reg16(model, REG_HSFS, hsfs & ~(val & (HSFS_FDONE | HSFS_FCERR | HSFS_AEL)));
+	} else if (off == REG_HSFC && len == 2) {
+		set_reg16(model, REG_HSFC, val & ~HSFC_FGO);
+		if (val & HSFC_FGO)
+			run_cycle(model, val);
+	} else if (off == REG_FDOC && len == 4) {
+		set_reg32(model, REG_FDOC, val);
+		set_reg32(model, REG_FDOD, descriptor_reg((val >> 12) & 0x3, (val >> 2) & 0x3ff));
+	} else {
+		memcpy(reg(model, off), &val, len);
+	}
+}
+
+static void ich_mmio_writeb(void *state, uint8_t value, void *addr)
+{
+	ich_mmio_write(state, addr, value, 1);
+}
+
+static void ich_mmio_writew(void *state, uint16_t value, void *addr)
+{
+	ich_mmio_write(state, addr, value, 2);
+}
+
+static void ich_mmio_writel(void *state, uint32_t value, void *addr)
+{
+	ich_mmio_write(state, addr, value, 4);
+}
+
+/* The BIOS region ends right below 4 GiB. */
+static void *ich_physmap_ro(void *state, const char *descr, uintptr_t phys_addr, size_t len)
+{
+	struct ich_model *model = state;
+
+	assert_int_equal(BIOS_SIZE, len);
+	assert_int_equal(0x100000000ULL - BIOS_SIZE, phys_addr);
+	model->physmaps++;
+	model->bios_map = mmap(NULL, len, PROT_READ, MAP_SHARED, model->image_fd, 0);
+	assert_true(model->bios_map != MAP_FAILED);
+	return model->bios_map;
+}
+
+static int ich_test_init(const struct programmer_cfg *cfg);
+
+static const struct programmer_entry ich_test_programmer = {
+	.name = "ich_test",
+	.type = OTHER,
+	.devs.note = "Modelled Cannon Point PCH.\n",
+	.init = ich_test_init,
+};
+
+static struct ich_model *current_model;
+
+static int ich_test_init(const struct programmer_cfg *cfg)
+{
+	return ich_init_spi(cfg, current_model->regs, CHIPSET_300_SERIES_CANNON_POINT);
+}
+
+static struct ich_model *model_new(void)
+{
+	char path[] = "/tmp/flashrom_ichspi_XXXXXX";
+	struct ich_model *const model = calloc(1, sizeof(*model));
+	assert_non_null(model);
+
+	for (size_t i = 0; i < FLASH_SIZE; i++)
+		model->flash[i] = i * 13 + (i >> 12);
+
+	set_reg16(model, REG_HSFS, HSFS_FDV);
+	set_reg32(model, REG_FRAP, 0xffff);		/* The BIOS can access all regions. */
+	set_reg32(model, REG_FREG0, 0x00000000);	/* Descriptor:	0x000000-0x000fff */
+	set_reg32(model, REG_FREG0 + 4, 0x07ff0400);	/* BIOS:	0x400000-0x7fffff */
+	set_reg32(model, REG_FREG0 + 8, 0x03ff0001);	/* ME:		0x001000-0x3fffff */
+
+	/* The image starts out with what the flash holds. */
+	model->image_fd = mkstemp(path);
+	assert_true(model->image_fd >= 0);
+	unlink(path);
+	assert_int_equal(0, ftruncate(model->image_fd, BIOS_SIZE));
+	uint8_t *const image = mmap(NULL, BIOS_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, model->image_fd, 0);
+	assert_true(image != MAP_FAILED);
+	memcpy(image, model->flash + BIOS_BASE, BIOS_SIZE);
+	munmap(image, BIOS_SIZE);
+
+	return model;
+}
+
+static void model_free(struct ich_model *model)
+{
+	if (model->bios_map)
+		munmap(model->bios_map, BIOS_SIZE);
+	close(model->image_fd);
+	free(model);
+}
+
+static int ich_test_programmer_init(struct ich_model *model, const char *param)
+{
+	model->io = (struct io_mock) {
+		.state		= model,
+		.physmap_ro	= ich_physmap_ro,
+		.mmio_writeb	= ich_mmio_writeb,
+		.mmio_writew	= ich_mmio_writew,
+		.mmio_writel	= ich_mmio_writel,
+	};
+	io_mock_register(&model->io);
+	current_model = model;
+	return programmer_init(&ich_test_programmer, param);
+}
+
+static void ich_test_programmer_shutdown(void)
+{
+	assert_int_equal(0, programmer_shutdown());
+	io_mock_register(NULL);
+	current_model = NULL;
+}
+
+static struct flashrom_flashctx *ich_init_and_probe(struct ich_model *model, const char *param)
+{
+	struct flashrom_flashctx *flashctx = NULL;
+	const char **names = NULL;
+
+	assert_int_equal(0, ich_test_programmer_init(model, param));
+	assert_int_equal(0, flashrom_create_context(&flashctx));
+	assert_int_equal(1, flashrom_flash_probe_v2(flashctx, &names, NULL, "Opaque flash chip"));
+	assert_int_equal(FLASH_SIZE, flashrom_flash_getsize(flashctx));
+	flashrom_data_free(names);
+	return flashctx;
+}
+
+static void ich_release(struct flashrom_flashctx *flashctx)
+{
+	flashrom_flash_release(flashctx);
+	ich_test_programmer_shutdown();
+}
+
+/* Reads a range and returns the number of read cycles it took. */
+static unsigned int read_and_compare(struct flashrom_flashctx *flashctx, struct ich_model *model,
+				     unsigned int start, unsigned int len)
+{
+	uint8_t *const buf = malloc(len);
+	assert_non_null(buf);
+
+	const unsigned int cycles = model->read_cycles;
+	assert_int_equal(0, read_flash(flashctx, buf, start, len));
+	assert_memory_equal(model->flash + start, buf, len);
+
+	free(buf);
+	return model->read_cycles - cycles;
+}
+
+void ichspi_mmap_read_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct ich_model *const model = model_new();
+	struct flashrom_flashctx *const flashctx = ich_init_and_probe(model, "ich_mmap_read=yes");
+	assert_int_equal(1, model->physmaps);
+
+	/* Only a few blocks of the BIOS region are also read by the sequencer. */
+	const unsigned int cycles = read_and_compare(flashctx, model, BIOS_BASE, BIOS_SIZE);
+	assert_true(cycles > 0);
+	assert_true(cycles <= BIOS_SIZE / (4 * KiB));
+
+	/* The rest of the flash isn't mapped. */
+	assert_int_equal(BIOS_BASE / HWSEQ_BLOCK, read_and_compare(flashctx, model, 0, BIOS_BASE));
+
+	/* A read across the start of the BIOS region is split. */
+	assert_int_equal(2 * KiB / HWSEQ_BLOCK + 1, read_and_compare(flashctx, model, BIOS_BASE - 2 * KiB, 4 * KiB));
+
+	ich_release(flashctx);
+	model_free(model);
+}
+
+void ichspi_mmap_read_mismatch_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct ich_model *const model = model_new();
+	/* The flash changed behind the back of the mapping. */
+	for (size_t i = BIOS_BASE; i < FLASH_SIZE; i++)
+		model->flash[i] ^= 0x5a;
+
+	struct flashrom_flashctx *const flashctx = ich_init_and_probe(model, "ich_mmap_read=yes");
+
+	/* The first sample differs, everything is read with the sequencer then and from now on. */
+	assert_int_equal(BIOS_SIZE / HWSEQ_BLOCK + 1, read_and_compare(flashctx, model, BIOS_BASE, BIOS_SIZE));
+	assert_int_equal(BIOS_SIZE / HWSEQ_BLOCK, read_and_compare(flashctx, model, BIOS_BASE, BIOS_SIZE));
+
+	ich_release(flashctx);
+	model_free(model);
+}
+
+void ichspi_mmap_read_invalidate_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct ich_model *const model = model_new();
+	struct flashrom_flashctx *const flashctx = ich_init_and_probe(model, "ich_mmap_read=yes");
+
+	assert_int_equal(1, read_and_compare(flashctx, model, FLASH_SIZE - 4 * KiB, 4 * KiB));
+
+	/* Erasing outside of the mapping keeps it. */
+	assert_int_equal(0, erase_opaque(flashctx, 0x1000, 4 * KiB));
+	assert_int_equal(1, read_and_compare(flashctx, model, FLASH_SIZE - 4 * KiB, 4 * KiB));
+
+	/* The image isn't updated, the erased block must not be read from it. */
+	assert_int_equal(0, erase_opaque(flashctx, FLASH_SIZE - 4 * KiB, 4 * KiB));
+	assert_int_equal(4 * KiB / HWSEQ_BLOCK, read_and_compare(flashctx, model, FLASH_SIZE - 4 * KiB, 4 * KiB));
+
+	ich_release(flashctx);
+	model_free(model);
+}
+
+void ichspi_hwseq_read_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct ich_model *const model = model_new();
+	struct flashrom_flashctx *const flashctx = ich_init_and_probe(model, "ich_mmap_read=no");
+
+	assert_int_equal(0, model->physmaps);
+	assert_int_equal(BIOS_SIZE / HWSEQ_BLOCK, read_and_compare(flashctx, model, BIOS_BASE, BIOS_SIZE));
+
+	ich_release(flashctx);
+
+	/* Invalid values are rejected. */
+	assert_int_equal(ERROR_FLASHROM_FATAL, ich_test_programmer_init(model, "ich_mmap_read=maybe"));
+	ich_test_programmer_shutdown();
+
+	model_free(model);
+}
+
+#else
+	SKIP_TEST(ichspi_mmap_read_test_success)
+	SKIP_TEST(ichspi_mmap_read_mismatch_test_success)
+	SKIP_TEST(ichspi_mmap_read_invalidate_test_success)
+	SKIP_TEST(ichspi_hwseq_read_test_success)
+#endif /* CONFIG_INTERNAL */
@@ -0,0 +1,272 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Tests for the firmware image indexer. The image is assembled from minimal
+ * but valid instances of each structure, plus signatures that appear in data
+ * without a valid structure around them.
+ */
+
+#include <include/test.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tests.h"
+#include "flash.h"
+#include "fmap.h"
+#include "image_index.h"
+#include "libflashrom.h"
+
+#define IMAGE_SIZE	(128 * KiB)
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+	put_le16(p, v);
+	put_le16(p + 2, v >> 16);
+}
+
+static void put_le64(uint8_t *p, uint64_t v)
+{
+	put_le32(p, v);
+	put_le32(p + 4, v >> 32);
+}
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/* ICH8 style descriptor with the signature at 0x10: fd, bios and me regions. */
+static void put_ifd(uint8_t *image)
+{
+	uint8_t *const ifd = image + 0x10;
+
+	put_le32(ifd + 0x00, 0x0ff0a55a);
+	put_le32(ifd + 0x04, 0x04040003);	/* NR 4, FRBA 0x40, FCBA 0x30 */
+	put_le32(ifd + 0x08, 0x00100006);	/* FISBA 0x100, FMBA 0x60 */
+	put_le32(ifd + 0x0c, 0x00000020);	/* FMSBA 0x200 */
+	for (size_t i = 0; i < 8; i++)
+		put_le32(image + 0x40 + 4 * i, 0x00007fff);	/* unused */
+	put_le32(image + 0x40, 0x00000000);	/* fd   0x00000 - 0x00fff */
+	put_le32(image + 0x44, 0x001f0010);	/* bios 0x10000 - 0x1ffff */
+	put_le32(image + 0x48, 0x00070001);	/* me   0x01000 - 0x07fff */
+}
+
+/* ME region at 0x1000 with the partition table behind the ROM bypass vector. */
+static void put_fpt(uint8_t *image)
+{
+	uint8_t *const fpt = image + 0x1010;
+
+	memcpy(fpt, "$FPT", 4);
+	put_le32(fpt + 4, 3);
+	fpt[8] = 0x20;		/* header version */
+	fpt[9] = 0x10;		/* entry version */
+	fpt[10] = 0x20;		/* header length */
+
+	uint8_t *entry = fpt + 0x20;
+	memcpy(entry, "FTPR", 4);
+	put_le32(entry + 8, 0x1000);
+	put_le32(entry + 12, 0x2000);
+	entry += 0x20;
+	memcpy(entry, "NFTP", 4);
+	put_le32(entry + 8, 0x3000);
+	put_le32(entry + 12, 0x1000);
+	entry += 0x20;
+	memcpy(entry, "PSVN", 4);	/* empty partition */
+	put_le32(entry + 8, 0xffffffff);
+	put_le32(entry + 12, 0);
+}
+
+static void put_fmap_area(uint8_t *area, uint32_t offset, uint32_t size, const char *name)
+{
+	put_le32(area, offset);
+	put_le32(area + 4, size);
+	strcpy((char *)area + 8, name);
+}
+
+static void put_fmap(uint8_t *image, size_t at)
+{
+	uint8_t *const fmap = image + at;
+
+	memcpy(fmap, FMAP_SIGNATURE, 8);
+	fmap[8] = FMAP_VER_MAJOR;
+	fmap[9] = FMAP_VER_MINOR;
+	put_le32(fmap + 18, IMAGE_SIZE);
+	strcpy((char *)fmap + 22, "FLASH");
+	put_le16(fmap + 54, 3);
+	put_fmap_area(fmap + 56, 0x10000, 0x8000, "RO_SECTION");
+	put_fmap_area(fmap + 56 + 42, 0x18000, 0x4000, "COREBOOT");
+	put_fmap_area(fmap + 56 + 84, 0x1c000, 0, "EMPTY");
+}
+
+static void put_cbfs_file(uint8_t *image, size_t at, uint32_t type, uint32_t len, const char *name)
+{
+	uint8_t *const file = image + at;
+
+	memcpy(file, "LARCHIVE", 8);
+	put_be32(file + 8, len);
+	put_be32(file + 12, type);
+	put_be32(file + 16, 0);
+	put_be32(file + 20, 0x40);
+	strcpy((char *)file + 24, name);
+}
+
+static void put_fv(uint8_t *image, size_t at, uint64_t len)
+{
+	uint8_t *const fv = image + at;
+	uint16_t sum = 0;
+
+	put_le64(fv + 32, len);
+	memcpy(fv + 40, "_FVH", 4);
+	put_le32(fv + 44, 0x0004feff);	/* attributes */
+	put_le16(fv + 48, 0x48);
+	fv[55] = 2;
+	put_le16(fv + 50, 0);
+	for (size_t i = 0; i < 0x48; i += 2)
+		sum += fv[i] | fv[i + 1] << 8;
+	put_le16(fv + 50, -sum);
+}
+
+static uint8_t *build_image(void)
+{
+	uint8_t *const image = malloc(IMAGE_SIZE);
+	assert_non_null(image);
+	memset(image, 0xff, IMAGE_SIZE);
+
+	put_ifd(image);
+	put_fpt(image);
+	put_fmap(image, 0x10000);
+	put_cbfs_file(image, 0x18000, 0x10, 0x100, "fallback/romstage");
+	put_cbfs_file(image, 0x18140, 0xffffffff, 0x1000, "");
+	put_cbfs_file(image, 0x19180, 0x50, 0x80, "config");
+	put_fv(image, 0x1c000, 0x2000);
+
+	/* Signatures without a valid structure around them. */
+	memcpy(image + 0x1e000, FMAP_SIGNATURE " in a string", 20);
+	put_fv(image, 0x1e100, 0x1000);
+	image[0x1e100] ^= 1;		/* breaks the checksum */
+	put_cbfs_file(image, 0x1e204, 0x10, 0x10, "unaligned");
+	memcpy(image + 0x1e300, "$FPT", 4);
+
+	return image;
+}
+
+struct expected_region {
+	enum image_region_type type;
+	size_t start;
+	size_t end;
+	const char *name;
+};
+
+void image_index_scan_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	static const struct expected_region expected[] = {
+		{ IMAGE_REGION_IFD,	0x00000, 0x00fff, "fd" },
+		{ IMAGE_REGION_IFD,	0x01000, 0x07fff, "me" },
+		{ IMAGE_REGION_FPT,	0x02000, 0x03fff, "fpt_FTPR" },
+		{ IMAGE_REGION_FPT,	0x04000, 0x04fff, "fpt_NFTP" },
+		{ IMAGE_REGION_FMAP,	0x10000, 0x17fff, "RO_SECTION" },
+		{ IMAGE_REGION_IFD,	0x10000, 0x1ffff, "bios" },
+		{ IMAGE_REGION_FMAP,	0x18000, 0x1bfff, "COREBOOT" },
+		{ IMAGE_REGION_CBFS,	0x18000, 0x1813f, "cbfs_fallback/romstage" },
+		{ IMAGE_REGION_CBFS,	0x19180, 0x1923f, "cbfs_config" },
+		{ IMAGE_REGION_FV,	0x1c000, 0x1dfff, "fv_0001c000" },
+	};
+	struct image_index index;
+	uint8_t *const image = build_image();
+
+	assert_int_equal(0, image_index_scan(image, IMAGE_SIZE, IMAGE_REGION_ALL, &index));
+	for (size_t i = 0; i < index.count; i++) {
+		printf("%s 0x%05zx-0x%05zx %s\n", image_region_type_name(index.regions[i].type),
+		       index.regions[i].start, index.regions[i].end, index.regions[i].name);
+	}
+	assert_int_equal(ARRAY_SIZE(expected), index.count);
+	for (size_t i = 0; i < ARRAY_SIZE(expected); i++) {
+		assert_int_equal(expected[i].type, index.regions[i].type);
+		assert_int_equal(expected[i].start, index.regions[i].start);
+		assert_int_equal(expected[i].end, index.regions[i].end);
+		assert_string_equal(expected[i].name, index.regions[i].name);
+	}
+	image_index_free(&index);
+
+	/* Only the requested types are searched for. */
+	assert_int_equal(0, image_index_scan(image, IMAGE_SIZE, IMAGE_REGION_MASK(IMAGE_REGION_FV), &index));
+	assert_int_equal(1, index.count);
+	assert_int_equal(IMAGE_REGION_FV, index.regions[0].type);
+	image_index_free(&index);
+
+	assert_int_equal(0x10000, image_index_find_first(image, IMAGE_SIZE, IMAGE_REGION_FMAP));
+	assert_int_equal(0x1010, image_index_find_first(image, IMAGE_SIZE, IMAGE_REGION_FPT));
+	assert_int_equal(-1, image_index_find_first(image, 0x10000, IMAGE_REGION_FMAP));
+
+	free(image);
+}
+
+void image_index_fmap_search_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct fmap *fmap;
+	uint8_t *const image = build_image();
+
+	assert_int_equal(0, fmap_read_from_buffer(&fmap, image, IMAGE_SIZE));
+	assert_int_equal(3, fmap->nareas);
+	assert_string_equal("COREBOOT", (const char *)fmap->areas[1].name);
+	free(fmap);
+
+	/* A header whose areas run past the end of the buffer is rejected. */
+	assert_int_equal(2, fmap_read_from_buffer(&fmap, image, 0x10000 + 0x40));
+
+	/* The first of several valid headers is used, wherever it is. */
+	put_fmap(image, 0x7);
+	assert_int_equal(0, fmap_read_from_buffer(&fmap, image, IMAGE_SIZE));
+	free(fmap);
+
+	free(image);
+}
+
+void image_index_to_layout_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct image_index index;
+	struct flashrom_layout *layout;
+	uint8_t *const image = build_image();
+
+	/* A second CBFS with a file of the same name. */
+	put_cbfs_file(image, 0x1f000, 0x10, 0x100, "fallback/romstage");
+	assert_int_equal(0, image_index_scan(image, IMAGE_SIZE, IMAGE_REGION_ALL, &index));
+
+	const unsigned int types = IMAGE_REGION_MASK(IMAGE_REGION_FMAP) | IMAGE_REGION_MASK(IMAGE_REGION_CBFS);
+	assert_int_equal(0, image_index_to_layout(&index, types, &layout));
+
+	unsigned int start, len;
+	assert_int_equal(0, flashrom_layout_get_region_range(layout, "COREBOOT", &start, &len));
+	assert_int_equal(0x18000, start);
+	assert_int_equal(0x4000, len);
+	assert_int_equal(0, flashrom_layout_get_region_range(layout, "cbfs_fallback/romstage", &start, &len));
+	assert_int_equal(0x18000, start);
+	assert_int_equal(0, flashrom_layout_get_region_range(layout, "cbfs_fallback/romstage@1f000", &start, &len));
+	assert_int_equal(0x1f000, start);
+	assert_int_equal(0x140, len);
+	/* Regions of other types are left out. */
+	assert_int_not_equal(0, flashrom_layout_get_region_range(layout, "fd", &start, &len));
+	assert_int_not_equal(0, flashrom_layout_get_region_range(layout, "fv_0001c000", &start, &len));
+
+	flashrom_layout_release(layout);
+	image_index_free(&index);
+	free(image);
+}
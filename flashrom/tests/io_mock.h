@@ -24,11 +24,17 @@
 /* Address value needs fit into uint8_t. */
 #define USB_DEVICE_ADDRESS 19
 
-/* Define struct pci_dev to avoid dependency on pci.h */
+/* libftdi types are only used through pointers, avoiding a dependency on ftdi.h */
+struct ftdi_context;
+struct ftdi_transfer_control;
+
+/* Define struct pci_dev to avoid dependency on pci.h, unless a test uses the real one. */
+#ifndef PCI_LIB_VERSION
 struct pci_dev {
 	char padding[18];
 	unsigned int device_id;
 };
+#endif
 
 /* Linux I2C interface constants, avoiding linux/i2c-dev.h */
 #define I2C_SLAVE 0x0703
@@ -58,6 +64,16 @@ struct io_mock {
 	void (*outl)(void *state, unsigned int value, unsigned short port);
 	unsigned int (*inl)(void *state, unsigned short port);
 
+	/* Memory mapped I/O */
+	void *(*physmap_ro)(void *state, const char *descr, uintptr_t phys_addr, size_t len);
+	void (*mmio_writeb)(void *state, uint8_t value, void *addr);
+	void (*mmio_writew)(void *state, uint16_t value, void *addr);
+	void (*mmio_writel)(void *state, uint32_t value, void *addr);
+
+	/* PCI config space */
+	uint16_t (*pci_read_word)(void *state, struct pci_dev *dev, int pos);
+	int (*pci_read_block)(void *state, struct pci_dev *dev, int pos, uint8_t *buf, int len);
+
 	/* USB I/O */
 	int (*libusb_init)(void *state, libusb_context **ctx);
 	int (*libusb_control_transfer)(void *state,
@@ -84,12 +100,24 @@ struct io_mock {
 	int (*libusb_bulk_transfer)(void *state, libusb_device_handle *devh, unsigned char endpoint,
 							unsigned char *data, int length, int *actual_length, unsigned int timeout);
 
+	/* FTDI I/O */
+	int (*ftdi_write_data)(void *state, struct ftdi_context *ftdi, const unsigned char *buf, int size);
+	int (*ftdi_read_data)(void *state, struct ftdi_context *ftdi, unsigned char *buf, int size);
+	struct ftdi_transfer_control *(*ftdi_write_data_submit)(void *state, struct ftdi_context *ftdi,
+								unsigned char *buf, int size);
+	struct ftdi_transfer_control *(*ftdi_read_data_submit)(void *state, struct ftdi_context *ftdi,
+							       unsigned char *buf, int size);
+	int (*ftdi_transfer_data_done)(void *state, struct ftdi_transfer_control *tc);
+
 	/* POSIX File I/O */
 	int (*iom_open)(void *state, const char *pathname, int flags, mode_t mode);
 	int (*iom_fcntl)(void *state, int fd, unsigned long cmd, va_list args);
 	int (*iom_ioctl)(void *state, int fd, unsigned long request, va_list args);
 	int (*iom_read)(void *state, int fd, void *buf, size_t sz);
 	int (*iom_write)(void *state, int fd, const void *buf, size_t sz);
+	ssize_t (*iom_pread)(void *state, int fd, void *buf, size_t sz, off_t offset);
+	ssize_t (*iom_pwrite)(void *state, int fd, const void *buf, size_t sz, off_t offset);
+	int (*iom_fstat)(void *state, int fd, void *buf);
 
 	/* Standard I/O */
 	FILE* (*iom_fopen)(void *state, const char *pathname, const char *mode);
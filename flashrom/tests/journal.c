@@ -0,0 +1,149 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Tests for the write journal. Resuming interrupted writes is covered with
+ * the other chip operations in chip.c.
+ */
+
+#include <include/test.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tests.h"
+#include "flash.h"
+#include "journal.h"
+#include "libflashrom.h"
+
+static const struct flashchip journal_chip = {
+	.vendor		= "aklm",
+	.name		= "journal chip",
+	.manufacture_id	= 0x12,
+	.model_id	= 0x3456,
+	.total_size	= 64,
+	.block_erasers	=
+	{
+		{
+			.eraseblocks = { {4 * KiB, 16} },
+			.block_erase = TEST_ERASE_INJECTOR_1,
+		}, {
+			.eraseblocks = { {64 * KiB, 1} },
+			.block_erase = TEST_ERASE_INJECTOR_2,
+		},
+	},
+};
+
+struct journal_text {
+	char buf[4 * KiB];
+	size_t len;
+};
+
+static int capture_journal(const char *text, bool append, void *user_data)
+{
+	struct journal_text *const captured = user_data;
+
+	if (!append)
+		captured->len = 0;
+	assert_in_range(captured->len + strlen(text), 0, sizeof(captured->buf) - 1);
+	strcpy(captured->buf + captured->len, text);
+	captured->len += strlen(text);
+	return 0;
+}
+
+void journal_round_trip_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct flashrom_journal *journal, *parsed;
+	struct flashrom_layout *layout;
+	struct journal_text captured = { .len = 0 };
+	const size_t size = journal_chip.total_size * KiB;
+	uint8_t *const curcontents = malloc(size);
+	uint8_t *const newcontents = malloc(size);
+	assert_non_null(curcontents);
+	assert_non_null(newcontents);
+	memset(curcontents, 0xcc, size);
+	memset(newcontents, 0xcc, size);
+	newcontents[0x2100] = 0x00;
+
+	/* Blocks only partially inside the included region aren't tracked. */
+	assert_int_equal(0, flashrom_layout_new(&layout));
+	assert_int_equal(0, flashrom_layout_add_region(layout, 0x1000, 0x37ff, "part"));
+	assert_int_equal(0, flashrom_layout_include_region(layout, "part"));
+
+	assert_int_equal(0, flashrom_journal_new(&journal));
+	flashrom_journal_set_callback(journal, capture_journal, &captured);
+	assert_false(journal_active(journal));
+	assert_int_equal(0, journal_begin(journal, &journal_chip, layout, curcontents, newcontents));
+	assert_true(journal_active(journal));
+	assert_true(journal_matches(journal, &journal_chip, newcontents));
+	assert_false(journal_matches(journal, &journal_chip, curcontents));
+	assert_int_equal(4 * KiB, journal_block_size(journal));
+	assert_false(journal_block_trusted(journal, 0));
+	assert_true(journal_block_trusted(journal, 1));
+	assert_false(journal_block_trusted(journal, 2));
+	assert_false(journal_block_trusted(journal, 3));
+
+	/* Erasing puts every tracked block it touches in flight. */
+	journal_erasing(journal, 0x0000, 0x1fff);
+	assert_false(journal_block_trusted(journal, 1));
+	/* Only complete blocks are recorded as written. */
+	assert_int_equal(0x1000, journal_written(journal, 0x1000, 0x1ffe));
+	assert_int_equal(0x3000, journal_written(journal, 0x1000, 0x2fff));
+	assert_true(journal_block_trusted(journal, 1));
+	assert_true(journal_block_trusted(journal, 2));
+
+	/* The records appended so far describe the same state. */
+	assert_int_equal(0, flashrom_journal_read_from_buffer(&parsed, captured.buf, captured.len));
+	assert_true(journal_matches(parsed, &journal_chip, newcontents));
+	assert_false(journal_block_trusted(parsed, 0));
+	assert_true(journal_block_trusted(parsed, 1));
+	assert_true(journal_block_trusted(parsed, 2));
+	assert_false(flashrom_journal_complete(parsed));
+	flashrom_journal_release(parsed);
+
+	journal_end(journal, true);
+	assert_false(journal_active(journal));
+	assert_true(flashrom_journal_complete(journal));
+	assert_int_equal(0, flashrom_journal_read_from_buffer(&parsed, captured.buf, captured.len));
+	assert_true(flashrom_journal_complete(parsed));
+	flashrom_journal_release(parsed);
+
+	/* A record cut short by a crash is ignored. */
+	assert_int_equal(0, flashrom_journal_read_from_buffer(&parsed, captured.buf, captured.len - 1));
+	assert_false(flashrom_journal_complete(parsed));
+	flashrom_journal_release(parsed);
+
+	flashrom_journal_release(journal);
+	flashrom_layout_release(layout);
+	free(newcontents);
+	free(curcontents);
+}
+
+void journal_read_invalid(void **state)
+{
+	(void) state; /* unused */
+
+#define JOURNAL_HEAD "flashrom-journal 1\nvendor a\nname b\nid 0x1 0x2\nsize 65536\n"
+#define JOURNAL_IMAGE "image ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad\n"
+	static const char *const invalid[] = {
+		"",
+		"flashrom-journal 2\n",
+		JOURNAL_HEAD "block_size 4096\n",
+		JOURNAL_HEAD "block_size 3000\n" JOURNAL_IMAGE,
+		JOURNAL_HEAD "block_size 4096\nimage ba78\n",
+		JOURNAL_HEAD "block_size 4096\n" JOURNAL_IMAGE "written 15 16\n",
+		JOURNAL_HEAD "block_size 4096\n" JOURNAL_IMAGE "written 2 1\n",
+		JOURNAL_HEAD "block_size 4096\n" JOURNAL_IMAGE "bogus 0 1\n",
+	};
+	struct flashrom_journal *journal;
+
+	for (size_t i = 0; i < ARRAY_SIZE(invalid); i++) {
+		printf("Parsing invalid journal %zu\n", i);
+		assert_int_equal(2, flashrom_journal_read_from_buffer(&journal, invalid[i], strlen(invalid[i])));
+	}
+#undef JOURNAL_IMAGE
+#undef JOURNAL_HEAD
+}
@@ -82,7 +82,7 @@ void run_probe_v2_lifecycle(void **state, const struct io_mock *io,
 		const char **expected_matched_names, unsigned int expected_matched_count)
 {
 	/* Each probe lifecycle should run independently, without cache. */
-	clear_spi_id_cache();
+	clear_spi_id_cache(programmer_current());
 	run_lifecycle(state, io, prog, param, chip_name,
 			expected_matched_names, expected_matched_count, &probe_chip_v2);
 }
@@ -99,6 +99,7 @@ void run_init_error_path(void **state, const struct io_mock *io, const struct pr
 	printf("Testing init error path for programmer=%s with params: %s ...\n", prog->name, param);
 	assert_int_equal(error_code, flashrom_programmer_init(&flashprog, prog->name, param));
 	printf("... init failed with error code %i as expected\n", error_code);
+	assert_null(flashprog);
 
 	/*
 	 * `flashrom_programmer_shutdown` runs only registered shutdown functions, which means
@@ -10,8 +10,25 @@
 #include "lifecycle.h"
 
 #if CONFIG_LINUX_MTD == 1
+#include <mtd/mtd-user.h>
+
+/* Largest device the tests emulate, 0x310000 bytes like a 3MiB part with a 64K tail. */
+#define MOCK_MTD_SIZE		(3 * MiB + 64 * KiB)
+#define MOCK_MTD_MAX_ERASES	8
+
 struct linux_mtd_io_state {
 	char *fopen_path;
+	/* sysfs attributes, the lifecycle test uses the defaults */
+	const char *size;
+	const char *erasesize;
+	const char *numeraseregions;
+	const struct region_info_user *regions;
+	/* Contents of /dev/mtd0 */
+	uint8_t contents[MOCK_MTD_SIZE];
+	unsigned int preads;
+	unsigned int pwrites;
+	struct erase_info_user64 erases[MOCK_MTD_MAX_ERASES];
+	unsigned int erase_count;
 };
 
 static FILE *linux_mtd_fopen(void *state, const char *pathname, const char *mode)
@@ -25,6 +42,7 @@ static FILE *linux_mtd_fopen(void *state, const char *pathname, const char *mode
 
 static size_t linux_mtd_fread(void *state, void *buf, size_t size, size_t len, FILE *fp)
 {
+	struct linux_mtd_io_state *io_state = state;
 	struct linux_mtd_fread_mock_entry {
 		const char *path;
 		const char *data;
@@ -32,13 +50,13 @@ static size_t linux_mtd_fread(void *state, void *buf, size_t size, size_t len, F
 	const struct linux_mtd_fread_mock_entry fread_mock_map[] = {
 		{ "/sys/class/mtd/mtd0//type",            "nor"    },
 		{ "/sys/class/mtd/mtd0//name",            "Device" },
-		{ "/sys/class/mtd/mtd0//flags",           ""       },
-		{ "/sys/class/mtd/mtd0//size",            "1024"   },
-		{ "/sys/class/mtd/mtd0//erasesize",       "512"    },
-		{ "/sys/class/mtd/mtd0//numeraseregions", "0"      },
+		{ "/sys/class/mtd/mtd0//flags",           io_state->size ? "0x400" /* MTD_WRITEABLE */ : "" },
+		{ "/sys/class/mtd/mtd0//size",            io_state->size ? io_state->size : "1024" },
+		{ "/sys/class/mtd/mtd0//erasesize",       io_state->erasesize ? io_state->erasesize : "512" },
+		{ "/sys/class/mtd/mtd0//numeraseregions",
+			io_state->numeraseregions ? io_state->numeraseregions : "0" },
 	};
 
-	struct linux_mtd_io_state *io_state = state;
 	unsigned int i;
 
 	if (!io_state->fopen_path)
@@ -66,12 +84,54 @@ static int linux_mtd_fclose(void *state, FILE *fp)
 	return 0;
 }
 
+static ssize_t linux_mtd_pread(void *state, int fd, void *buf, size_t sz, off_t offset)
+{
+	struct linux_mtd_io_state *io_state = state;
+
+	assert_true(offset + sz <= MOCK_MTD_SIZE);
+	memcpy(buf, io_state->contents + offset, sz);
+	io_state->preads++;
+	return sz;
+}
+
+static ssize_t linux_mtd_pwrite(void *state, int fd, const void *buf, size_t sz, off_t offset)
+{
+	struct linux_mtd_io_state *io_state = state;
+
+	assert_true(offset + sz <= MOCK_MTD_SIZE);
+	/* NOR flash can only clear bits. */
+	for (size_t i = 0; i < sz; i++)
+		io_state->contents[offset + i] &= ((const uint8_t *)buf)[i];
+	io_state->pwrites++;
+	return sz;
+}
+
+static int linux_mtd_ioctl(void *state, int fd, unsigned long request, va_list args)
+{
+	struct linux_mtd_io_state *io_state = state;
+
+	if (request == MEMERASE64) {
+		const struct erase_info_user64 *erase_info = va_arg(args, struct erase_info_user64 *);
+		assert_true(erase_info->start + erase_info->length <= MOCK_MTD_SIZE);
+		assert_true(io_state->erase_count < MOCK_MTD_MAX_ERASES);
+		memset(io_state->contents + erase_info->start, 0xff, erase_info->length);
+		io_state->erases[io_state->erase_count++] = *erase_info;
+	} else if (request == MEMGETREGIONINFO) {
+		struct region_info_user *region = va_arg(args, struct region_info_user *);
+		const uint32_t index = region->regionindex;
+		*region = io_state->regions[index];
+		region->regionindex = index;
+	}
+	return 0;
+}
+
 void linux_mtd_probe_lifecycle_test_success(void **state)
 {
 	struct linux_mtd_io_state linux_mtd_io_state = { NULL };
 	struct io_mock_fallback_open_state linux_mtd_fallback_open_state = {
 		.noc = 0,
-		.paths = { NULL },
+		.paths = { "/dev/mtd0", NULL },
+		.flags = { O_RDWR },
 	};
 	const struct io_mock linux_mtd_io = {
 		.state	= &linux_mtd_io_state,
@@ -85,6 +145,164 @@ void linux_mtd_probe_lifecycle_test_success(void **state)
 	run_probe_v2_lifecycle(state, &linux_mtd_io, &programmer_linux_mtd, "", "Opaque flash chip",
 				expected_matched_names, 1);
 }
+
+static void linux_mtd_erase_and_write(struct linux_mtd_io_state *io_state,
+				      void (*check_chip)(const struct flashchip *chip, size_t size))
+{
+	const size_t size = strtoul(io_state->size, NULL, 0);
+	struct io_mock_fallback_open_state fallback_open_state = {
+		.noc = 0,
+		.paths = { "/dev/mtd0", NULL },
+		.flags = { O_RDWR },
+	};
+	const struct io_mock linux_mtd_io = {
+		.state		= io_state,
+		.iom_fopen	= linux_mtd_fopen,
+		.iom_fread	= linux_mtd_fread,
+		.iom_fclose	= linux_mtd_fclose,
+		.iom_pread	= linux_mtd_pread,
+		.iom_pwrite	= linux_mtd_pwrite,
+		.iom_ioctl	= linux_mtd_ioctl,
+		.fallback_open_state = &fallback_open_state,
+	};
+	struct flashrom_programmer *flashprog;
+	struct flashrom_flashctx *flashctx;
+	const char **names = NULL;
+
+	io_mock_register(&linux_mtd_io);
+	assert_int_equal(0, flashrom_programmer_init(&flashprog, "linux_mtd", ""));
+	assert_int_equal(0, flashrom_create_context(&flashctx));
+	assert_int_equal(1, flashrom_flash_probe_v2(flashctx, &names, flashprog, "Opaque flash chip"));
+	assert_int_equal(size, flashrom_flash_getsize(flashctx));
+	if (check_chip)
+		check_chip(flashctx->chip, size);
+
+	assert_int_equal(0, flashrom_flash_erase(flashctx));
+	for (size_t i = 0; i < size; i++)
+		assert_int_equal(0xff, io_state->contents[i]);
+
+	/* Writing the blank device takes a single read and a single write per MiB. */
+	uint8_t *const image = malloc(size);
+	assert_non_null(image);
+	for (size_t i = 0; i < size; i++)
+		image[i] = i * 7;
+	io_state->preads = 0;
+	io_state->pwrites = 0;
+	assert_int_equal(0, flashrom_image_write(flashctx, image, size, NULL));
+	assert_int_equal((size + MiB - 1) / MiB, io_state->preads);
+	assert_int_equal((size + MiB - 1) / MiB, io_state->pwrites);
+	assert_memory_equal(image, io_state->contents, size);
+	free(image);
+
+	flashrom_data_free(names);
+	flashrom_flash_release(flashctx);
+	assert_int_equal(0, flashrom_programmer_shutdown(flashprog));
+	io_mock_register(NULL);
+}
+
+void linux_mtd_erase_dirty_runs_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct linux_mtd_io_state *io_state = calloc(1, sizeof(*io_state));
+	assert_non_null(io_state);
+	io_state->size = "65536";
+	io_state->erasesize = "4096";
+	memset(io_state->contents, 0xff, MOCK_MTD_SIZE);
+	/* Eraseblocks 0-3 and 8-9 have data, the rest is blank. */
+	memset(io_state->contents, 0x00, 16 * KiB);
+	memset(io_state->contents + 32 * KiB + 100, 0x5a, 8 * KiB - 200);
+
+	linux_mtd_erase_and_write(io_state, NULL);
+
+	/* Blank blocks are skipped, each run of dirty ones takes one ioctl. */
+	assert_int_equal(2, io_state->erase_count);
+	assert_int_equal(0, io_state->erases[0].start);
+	assert_int_equal(16 * KiB, io_state->erases[0].length);
+	assert_int_equal(32 * KiB, io_state->erases[1].start);
+	assert_int_equal(8 * KiB, io_state->erases[1].length);
+
+	free(io_state);
+}
+
+void linux_mtd_erase_regions_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	/* Four 4K boot blocks, followed by three 16K blocks. */
+	const struct region_info_user regions[] = {
+		{ .offset = 0,		.erasesize = 4 * KiB,	.numblocks = 4 },
+		{ .offset = 16 * KiB,	.erasesize = 16 * KiB,	.numblocks = 3 },
+	};
+	struct linux_mtd_io_state *io_state = calloc(1, sizeof(*io_state));
+	assert_non_null(io_state);
+	io_state->size = "65536";
+	io_state->erasesize = "16384";
+	io_state->numeraseregions = "2";
+	io_state->regions = regions;
+	memset(io_state->contents, 0xff, MOCK_MTD_SIZE);
+	/* The second and third boot block and the first large block have data. */
+	io_state->contents[4 * KiB] = 0;
+	io_state->contents[12 * KiB - 1] = 0;
+	io_state->contents[20 * KiB] = 0;
+
+	linux_mtd_erase_and_write(io_state, NULL);
+
+	assert_int_equal(2, io_state->erase_count);
+	assert_int_equal(4 * KiB, io_state->erases[0].start);
+	assert_int_equal(8 * KiB, io_state->erases[0].length);
+	assert_int_equal(16 * KiB, io_state->erases[1].start);
+	assert_int_equal(16 * KiB, io_state->erases[1].length);
+
+	free(io_state);
+}
+
+/* Every eraser has to cover the whole device, without running past its end. */
+static void check_odd_size_erasers(const struct flashchip *chip, size_t size)
+{
+	unsigned int erasers = 0;
+
+	for (size_t i = 0; i < NUM_ERASEFUNCTIONS; i++) {
+		const struct block_eraser *eraser = &chip->block_erasers[i];
+		size_t covered = 0;
+
+		if (eraser->block_erase == NO_BLOCK_ERASE_FUNC)
+			continue;
+		for (size_t j = 0; j < NUM_ERASEREGIONS; j++)
+			covered += (size_t)eraser->eraseblocks[j].size * eraser->eraseblocks[j].count;
+		assert_int_equal(size, covered);
+		erasers++;
+	}
+	/* 64K eraseblocks, 1M blocks with a 64K one at the end, and the whole device. */
+	assert_int_equal(3, erasers);
+	assert_int_equal(1 * MiB, chip->block_erasers[1].eraseblocks[0].size);
+	assert_int_equal(3, chip->block_erasers[1].eraseblocks[0].count);
+	assert_int_equal(64 * KiB, chip->block_erasers[1].eraseblocks[1].size);
+	assert_int_equal(1, chip->block_erasers[1].eraseblocks[1].count);
+}
+
+void linux_mtd_erase_odd_size_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct linux_mtd_io_state *io_state = calloc(1, sizeof(*io_state));
+	assert_non_null(io_state);
+	io_state->size = "3211264"; /* 0x310000 */
+	io_state->erasesize = "65536";
+	memset(io_state->contents, 0x00, MOCK_MTD_SIZE);
+
+	linux_mtd_erase_and_write(io_state, check_odd_size_erasers);
+
+	/* The whole device is dirty, so it takes one ioctl, including the 64K at the end. */
+	assert_int_equal(1, io_state->erase_count);
+	assert_int_equal(0, io_state->erases[0].start);
+	assert_int_equal(MOCK_MTD_SIZE, io_state->erases[0].length);
+
+	free(io_state);
+}
 #else
 	SKIP_TEST(linux_mtd_probe_lifecycle_test_success)
+	SKIP_TEST(linux_mtd_erase_dirty_runs_test_success)
+	SKIP_TEST(linux_mtd_erase_regions_test_success)
+	SKIP_TEST(linux_mtd_erase_odd_size_test_success)
 #endif /* CONFIG_LINUX_MTD */
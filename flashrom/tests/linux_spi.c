@@ -61,6 +61,236 @@ void linux_spi_probe_lifecycle_test_success(void **state)
 	run_probe_v2_lifecycle(state, &linux_spi_io, &programmer_linux_spi, "dev=/dev/null", "W25Q128.V",
 				expected_matched_names, 1);
 }
+
+struct linux_spi_io_state {
+	uint32_t mode;			/* SPI_IOC_RD_MODE32 and SPI_IOC_WR_MODE(32) */
+	unsigned int messages;		/* SPI_IOC_MESSAGE ioctls after probing */
+	struct spi_ioc_transfer last[8];
+	uint8_t last_tx[8][16];		/* The buffers are gone once the ioctl returned. */
+	unsigned int last_count;
+	uint8_t status2;		/* read with JEDEC_RDSR2 */
+};
+
+static int linux_spi_batching_ioctl(void *state, int fd, unsigned long request, va_list args)
+{
+	struct linux_spi_io_state *io_state = state;
+
+	if (request == SPI_IOC_RD_MODE32) {
+		*va_arg(args, uint32_t *) = io_state->mode;
+		return 0;
+	}
+	/* Like spidev, an 8-bit mode replaces the bus widths too. */
+	if (request == SPI_IOC_WR_MODE) {
+		io_state->mode = *va_arg(args, uint8_t *);
+		return 0;
+	}
+	if (request == SPI_IOC_WR_MODE32) {
+		io_state->mode = *va_arg(args, uint32_t *);
+		return 0;
+	}
+	for (unsigned int n = 1; n <= ARRAY_SIZE(io_state->last); n++) {
+		if (request != SPI_IOC_MESSAGE(n))
+			continue;
+		struct spi_ioc_transfer *msg = va_arg(args, struct spi_ioc_transfer *);
+		const unsigned char *writearr = (const unsigned char *)(uintptr_t)msg[0].tx_buf;
+		if (n == 2 && msg[0].len == 1 && writearr[0] == JEDEC_RDID && msg[1].len == 3) {
+			unsigned char *readarr = (unsigned char *)(uintptr_t)msg[1].rx_buf;
+			readarr[0] = 0xEF; /* WINBOND_NEX_ID */
+			readarr[1] = 0x40; /* WINBOND_NEX_W25Q128_V left byte */
+			readarr[2] = 0x18; /* WINBOND_NEX_W25Q128_V right byte */
+			return 0;
+		}
+		if (n == 2 && msg[0].len == 1 && writearr[0] == JEDEC_RDSR2 && msg[1].len >= 1)
+			*(unsigned char *)(uintptr_t)msg[1].rx_buf = io_state->status2;
+		io_state->messages++;
+		io_state->last_count = n;
+		memcpy(io_state->last, msg, n * sizeof(*msg));
+		for (unsigned int i = 0; i < n; i++) {
+			if (msg[i].tx_buf)
+				memcpy(io_state->last_tx[i], (const void *)(uintptr_t)msg[i].tx_buf,
+				       min(msg[i].len, sizeof(io_state->last_tx[i])));
+		}
+		return 0;
+	}
+	return 0;
+}
+
+static void linux_spi_probe_w25q128(struct linux_spi_io_state *io_state,
+				    struct flashrom_programmer **flashprog, struct flashrom_flashctx **flashctx)
+{
+	const char **names = NULL;
+
+	assert_int_equal(0, flashrom_programmer_init(flashprog, "linux_spi", "dev=/dev/null"));
+	clear_spi_id_cache(programmer_current());
+	assert_int_equal(0, flashrom_create_context(flashctx));
+	assert_int_equal(1, flashrom_flash_probe_v2(*flashctx, &names, *flashprog, "W25Q128.V"));
+	flashrom_data_free(names);
+	io_state->messages = 0;
+	/* The tests add the fast reads and the QE bit they need themselves. */
+	(*flashctx)->chip->feature_bits &= ~(FEATURE_FAST_READ_DOUT | FEATURE_FAST_READ_DIO |
+					     FEATURE_FAST_READ_QOUT | FEATURE_FAST_READ_QIO);
+	(*flashctx)->chip->reg_bits.qe = (struct reg_bit_info){ INVALID_REG };
+}
+
+void linux_spi_multicommand_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct linux_spi_io_state io_state = { 0 };
+	struct io_mock_fallback_open_state fallback_open_state = {
+		.noc = 0,
+		.paths = { "/dev/null", NULL },
+		.flags = { O_RDWR },
+	};
+	const struct io_mock linux_spi_io = {
+		.state		= &io_state,
+		.iom_fgets	= linux_spi_fgets,
+		.iom_ioctl	= linux_spi_batching_ioctl,
+		.fallback_open_state = &fallback_open_state,
+	};
+	struct flashrom_programmer *flashprog;
+	struct flashrom_flashctx *flashctx;
+
+	io_mock_register(&linux_spi_io);
+	linux_spi_probe_w25q128(&io_state, &flashprog, &flashctx);
+
+	const unsigned char page_program[] = { JEDEC_BYTE_PROGRAM, 0, 0, 0, 0xaa };
+	unsigned char status;
+	struct spi_command cmds[] = {
+	{
+		.writecnt = JEDEC_WREN_OUTSIZE,
+		.writearr = (const unsigned char[]){ JEDEC_WREN },
+	}, {
+		.writecnt = sizeof(page_program),
+		.writearr = page_program,
+	}, {
+		.writecnt = JEDEC_RDSR_OUTSIZE,
+		.writearr = (const unsigned char[]){ JEDEC_RDSR },
+		.readcnt = JEDEC_RDSR_INSIZE,
+		.readarr = &status,
+	},
+		NULL_SPI_CMD,
+	};
+	assert_int_equal(0, spi_send_multicommand(flashctx, cmds));
+
+	/* All three commands go in one message, CS is released after each but the last. */
+	assert_int_equal(1, io_state.messages);
+	assert_int_equal(4, io_state.last_count);
+	assert_int_equal(1, io_state.last[0].cs_change);
+	assert_int_equal(sizeof(page_program), io_state.last[1].len);
+	assert_int_equal(1, io_state.last[1].cs_change);
+	assert_int_equal(0, io_state.last[2].cs_change);
+	assert_int_equal(JEDEC_RDSR_INSIZE, io_state.last[3].len);
+	assert_int_equal((uintptr_t)&status, io_state.last[3].rx_buf);
+	assert_int_equal(0, io_state.last[3].cs_change);
+
+	flashrom_flash_release(flashctx);
+	assert_int_equal(0, flashrom_programmer_shutdown(flashprog));
+	io_mock_register(NULL);
+}
+
+void linux_spi_quad_read_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct linux_spi_io_state io_state = { .mode = SPI_MODE_0 | SPI_RX_QUAD };
+	struct io_mock_fallback_open_state fallback_open_state = {
+		.noc = 0,
+		.paths = { "/dev/null", NULL },
+		.flags = { O_RDWR },
+	};
+	const struct io_mock linux_spi_io = {
+		.state		= &io_state,
+		.iom_fgets	= linux_spi_fgets,
+		.iom_ioctl	= linux_spi_batching_ioctl,
+		.fallback_open_state = &fallback_open_state,
+	};
+	struct flashrom_programmer *flashprog;
+	struct flashrom_flashctx *flashctx;
+	uint8_t buf[0x100];
+
+	io_mock_register(&linux_spi_io);
+	linux_spi_probe_w25q128(&io_state, &flashprog, &flashctx);
+
+	/* Without chip support reads stay single I/O. */
+	assert_int_equal(0, read_flash(flashctx, buf, 0x1000, sizeof(buf)));
+	assert_int_equal(1, io_state.messages);
+	assert_int_equal(JEDEC_READ, io_state.last_tx[0][0]);
+
+	flashctx->chip->feature_bits |= FEATURE_FAST_READ_QOUT;
+	assert_int_equal(0, read_flash(flashctx, buf, 0x1000, sizeof(buf)));
+	assert_int_equal(2, io_state.messages);
+	assert_int_equal(2, io_state.last_count);
+	assert_int_equal(JEDEC_READ_FAST_OUTSIZE, io_state.last[0].len);
+	assert_int_equal(JEDEC_READ_FAST_QOUT, io_state.last_tx[0][0]);
+	assert_int_equal(0x10, io_state.last_tx[0][2]);
+	assert_int_equal(sizeof(buf), io_state.last[1].len);
+	assert_int_equal(4, io_state.last[1].rx_nbits);
+
+	/* With a QE bit, quad reads need it set, or IO2 and IO3 are WP# and HOLD#. */
+	flashctx->chip->reg_bits.qe = (struct reg_bit_info){ STATUS2, 1, RW };
+	assert_int_equal(0, read_flash(flashctx, buf, 0x1000, sizeof(buf)));
+	assert_int_equal(JEDEC_READ, io_state.last_tx[0][0]);
+	io_state.status2 = 1 << 1;
+	assert_int_equal(0, read_flash(flashctx, buf, 0x1000, sizeof(buf)));
+	assert_int_equal(JEDEC_READ_FAST_QOUT, io_state.last_tx[0][0]);
+
+	/* A QE bit in an SR2 the chip can't read counts as cleared. */
+	flashctx->chip->feature_bits &= ~(FEATURE_WRSR_EXT2 | FEATURE_WRSR2);
+	assert_int_equal(0, read_flash(flashctx, buf, 0x1000, sizeof(buf)));
+	assert_int_equal(JEDEC_READ, io_state.last_tx[0][0]);
+
+	flashrom_flash_release(flashctx);
+	assert_int_equal(0, flashrom_programmer_shutdown(flashprog));
+	io_mock_register(NULL);
+}
+
+void linux_spi_quad_io_read_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct linux_spi_io_state io_state = { .mode = SPI_MODE_0 | SPI_TX_QUAD | SPI_RX_QUAD };
+	struct io_mock_fallback_open_state fallback_open_state = {
+		.noc = 0,
+		.paths = { "/dev/null", NULL },
+		.flags = { O_RDWR },
+	};
+	const struct io_mock linux_spi_io = {
+		.state		= &io_state,
+		.iom_fgets	= linux_spi_fgets,
+		.iom_ioctl	= linux_spi_batching_ioctl,
+		.fallback_open_state = &fallback_open_state,
+	};
+	struct flashrom_programmer *flashprog;
+	struct flashrom_flashctx *flashctx;
+	uint8_t buf[0x100];
+
+	io_mock_register(&linux_spi_io);
+	linux_spi_probe_w25q128(&io_state, &flashprog, &flashctx);
+	/* Setting the mode kept the bus widths. */
+	assert_int_equal(SPI_MODE_0 | SPI_TX_QUAD | SPI_RX_QUAD, io_state.mode);
+
+	/* Quad I/O wins over quad output, the address goes out on four lines too. */
+	flashctx->chip->feature_bits |= FEATURE_FAST_READ_QOUT | FEATURE_FAST_READ_QIO;
+	assert_int_equal(0, read_flash(flashctx, buf, 0x1000, sizeof(buf)));
+	assert_int_equal(1, io_state.messages);
+	assert_int_equal(3, io_state.last_count);
+	assert_int_equal(1, io_state.last[0].len);
+	assert_int_equal(JEDEC_READ_FAST_QIO, io_state.last_tx[0][0]);
+	/* Address, a mode byte and four wait states. */
+	assert_int_equal(3 + 1 + 2, io_state.last[1].len);
+	assert_int_equal(4, io_state.last[1].tx_nbits);
+	assert_int_equal(0x10, io_state.last_tx[1][1]);
+	assert_int_equal(sizeof(buf), io_state.last[2].len);
+	assert_int_equal(4, io_state.last[2].rx_nbits);
+
+	flashrom_flash_release(flashctx);
+	assert_int_equal(0, flashrom_programmer_shutdown(flashprog));
+	io_mock_register(NULL);
+}
 #else
 	SKIP_TEST(linux_spi_probe_lifecycle_test_success)
+	SKIP_TEST(linux_spi_multicommand_test_success)
+	SKIP_TEST(linux_spi_quad_read_test_success)
+	SKIP_TEST(linux_spi_quad_io_read_test_success)
 #endif /* CONFIG_LINUX_SPI */
@@ -0,0 +1,148 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Tests for the block digest manifest and the SHA-256 implementation it uses.
+ * Writes that trust the manifest are covered with the other chip operations
+ * in chip.c.
+ */
+
+#include <include/test.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tests.h"
+#include "flash.h"
+#include "libflashrom.h"
+#include "manifest.h"
+#include "sha256.h"
+
+static void assert_digest(const char *expected, const uint8_t digest[SHA256_DIGEST_SIZE])
+{
+	char hex[2 * SHA256_DIGEST_SIZE + 1];
+
+	for (size_t i = 0; i < SHA256_DIGEST_SIZE; i++)
+		snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+	assert_string_equal(expected, hex);
+}
+
+void sha256_test_vectors(void **state)
+{
+	(void) state; /* unused */
+
+	uint8_t digest[SHA256_DIGEST_SIZE];
+
+	/* FIPS 180-4 examples. */
+	sha256("", 0, digest);
+	assert_digest("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855", digest);
+	sha256("abc", 3, digest);
+	assert_digest("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", digest);
+	const char *const two_blocks = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+	sha256(two_blocks, strlen(two_blocks), digest);
+	assert_digest("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1", digest);
+
+	/* Feeding the data in pieces that straddle the block boundary must not matter. */
+	uint8_t million_a[1000];
+	memset(million_a, 'a', sizeof(million_a));
+	struct sha256_ctx ctx;
+	sha256_init(&ctx);
+	for (size_t i = 0; i < 1000; i++)
+		sha256_update(&ctx, million_a, sizeof(million_a));
+	sha256_final(&ctx, digest);
+	assert_digest("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0", digest);
+}
+
+static const struct flashchip manifest_chip = {
+	.vendor		= "aklm",
+	.name		= "manifest chip",
+	.manufacture_id	= 0x12,
+	.model_id	= 0x3456,
+	.total_size	= 64,
+	.block_erasers	=
+	{
+		{
+			.eraseblocks = { {4 * KiB, 16} },
+			.block_erase = TEST_ERASE_INJECTOR_1,
+		}, {
+			.eraseblocks = { {64 * KiB, 1} },
+			.block_erase = TEST_ERASE_INJECTOR_2,
+		},
+	},
+};
+
+void manifest_round_trip_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct flashrom_manifest *manifest, *parsed;
+	struct flashrom_layout *layout;
+	const size_t size = manifest_chip.total_size * KiB;
+	uint8_t *const contents = malloc(size);
+	assert_non_null(contents);
+	for (size_t i = 0; i < size; i++)
+		contents[i] = i * 7;
+
+	assert_int_equal(0, flashrom_manifest_new(&manifest));
+	assert_false(manifest_matches_chip(manifest, &manifest_chip));
+
+	/* Only the blocks touched by the included region are known afterwards. */
+	assert_int_equal(0, flashrom_layout_new(&layout));
+	assert_int_equal(0, flashrom_layout_add_region(layout, 0x1000, 0x2fff, "part"));
+	assert_int_equal(0, flashrom_layout_include_region(layout, "part"));
+	manifest_update(manifest, &manifest_chip, layout, contents);
+	assert_true(manifest_matches_chip(manifest, &manifest_chip));
+	assert_int_equal(4 * KiB, manifest_block_size(manifest));
+	assert_false(manifest_block_matches(manifest, 0, contents));
+	assert_true(manifest_block_matches(manifest, 1, contents));
+	assert_true(manifest_block_matches(manifest, 2, contents));
+	contents[0x2000] ^= 1;
+	assert_false(manifest_block_matches(manifest, 2, contents));
+	contents[0x2000] ^= 1;
+
+	char *text = NULL;
+	assert_int_equal(0, flashrom_manifest_write_to_buffer(manifest, &text));
+	assert_int_equal(0, flashrom_manifest_read_from_buffer(&parsed, text, strlen(text)));
+	assert_true(manifest_matches_chip(parsed, &manifest_chip));
+	assert_false(manifest_block_matches(parsed, 0, contents));
+	assert_true(manifest_block_matches(parsed, 1, contents));
+	assert_true(manifest_block_matches(parsed, 2, contents));
+
+	/* Serialising the parsed manifest gives the same text. */
+	char *text2 = NULL;
+	assert_int_equal(0, flashrom_manifest_write_to_buffer(parsed, &text2));
+	assert_string_equal(text, text2);
+
+	manifest_invalidate(parsed, &manifest_chip, layout);
+	assert_false(manifest_block_matches(parsed, 1, contents));
+	assert_false(manifest_block_matches(parsed, 2, contents));
+
+	flashrom_data_free(text2);
+	flashrom_data_free(text);
+	flashrom_manifest_release(parsed);
+	flashrom_manifest_release(manifest);
+	flashrom_layout_release(layout);
+	free(contents);
+}
+
+void manifest_read_invalid(void **state)
+{
+	(void) state; /* unused */
+
+	static const char *const invalid[] = {
+		"",
+		"flashrom-manifest 2\n",
+		"flashrom-manifest 1\nvendor a\nname b\nid 0x1 0x2\nsize 65536\nblock_size 0\n",
+		"flashrom-manifest 1\nvendor a\nname b\nid 0x1 0x2\nsize 65536\nblock_size 4096\nblock 16 "
+			"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad\n",
+		"flashrom-manifest 1\nvendor a\nname b\nid 0x1 0x2\nsize 65536\nblock_size 4096\nblock 0 ba78\n",
+		"flashrom-manifest 1\nvendor a\nname b\nid 0x1 0x2\nsize 65536\nblock_size 4096\nbogus\n",
+	};
+	struct flashrom_manifest *manifest;
+
+	for (size_t i = 0; i < ARRAY_SIZE(invalid); i++) {
+		printf("Parsing invalid manifest %zu\n", i);
+		assert_int_equal(2, flashrom_manifest_read_from_buffer(&manifest, invalid[i], strlen(invalid[i])));
+	}
+}
@@ -0,0 +1,296 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Checks that every buffer comparison kernel supported by the host CPU gives
+ * bit-exact results compared to the byte loops need_erase() and
+ * get_next_write() used before the kernels were introduced.
+ */
+
+#include <include/test.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tests.h"
+#include "flash.h"
+#include "memdiff.h"
+
+#define TEST_BUF_SIZE	(8 * 1056 + 77) /* Covers all chunk sizes plus a partial lane. */
+#define ERASED		0xff
+
+static const enum write_granularity all_grans[] = {
+	WRITE_GRAN_256BYTES,
+	WRITE_GRAN_1BIT,
+	WRITE_GRAN_1BYTE,
+	WRITE_GRAN_128BYTES,
+	WRITE_GRAN_264BYTES,
+	WRITE_GRAN_512BYTES,
+	WRITE_GRAN_528BYTES,
+	WRITE_GRAN_1024BYTES,
+	WRITE_GRAN_1056BYTES,
+	WRITE_GRAN_1BYTE_IMPLICIT_ERASE,
+};
+
+static const size_t test_lens[] = { 0, 1, 63, 64, 65, 264, 1000, 4096, 4097, TEST_BUF_SIZE };
+
+static unsigned int gran_stride(enum write_granularity gran)
+{
+	switch (gran) {
+	case WRITE_GRAN_128BYTES: return 128;
+	case WRITE_GRAN_256BYTES: return 256;
+	case WRITE_GRAN_264BYTES: return 264;
+	case WRITE_GRAN_512BYTES: return 512;
+	case WRITE_GRAN_528BYTES: return 528;
+	case WRITE_GRAN_1024BYTES: return 1024;
+	case WRITE_GRAN_1056BYTES: return 1056;
+	default: return 1;
+	}
+}
+
+/* Reference: need_erase() as a plain byte loop. */
+static int ref_need_erase(const uint8_t *have, const uint8_t *want, unsigned int len,
+			  enum write_granularity gran, uint8_t erased_value)
+{
+	unsigned int i, j;
+	const unsigned int stride = gran_stride(gran);
+
+	switch (gran) {
+	case WRITE_GRAN_1BIT:
+		for (i = 0; i < len; i++)
+			if ((have[i] & want[i]) != want[i])
+				return 1;
+		return 0;
+	case WRITE_GRAN_1BYTE:
+		for (i = 0; i < len; i++)
+			if ((have[i] != want[i]) && (have[i] != erased_value))
+				return 1;
+		return 0;
+	case WRITE_GRAN_1BYTE_IMPLICIT_ERASE:
+		return 0;
+	default:
+		for (j = 0; j < len / stride; j++) {
+			if (!memcmp(have + j * stride, want + j * stride, stride))
+				continue;
+			for (i = 0; i < stride; i++)
+				if (have[j * stride + i] != erased_value)
+					return 1;
+		}
+		return 0;
+	}
+}
+
+/* Reference: get_next_write() as a plain chunk loop. */
+static unsigned int ref_get_next_write(const uint8_t *have, const uint8_t *want, unsigned int len,
+				       unsigned int *first_start, enum write_granularity gran)
+{
+	const unsigned int stride = gran_stride(gran);
+	bool need_write = false;
+	unsigned int rel_start = 0, first_len = 0, i;
+
+	for (i = 0; i < len / stride; i++) {
+		if (memcmp(have + i * stride, want + i * stride, stride)) {
+			if (!need_write) {
+				need_write = true;
+				rel_start = i * stride;
+			}
+		} else if (need_write) {
+			break;
+		}
+	}
+	if (need_write)
+		first_len = min(i * stride - rel_start, len);
+	*first_start += rel_start;
+	return first_len;
+}
+
+static uint32_t lcg_state;
+
+static uint8_t next_random(void)
+{
+	lcg_state = lcg_state * 1103515245 + 12345;
+	return lcg_state >> 16;
+}
+
+/*
+ * Fills have/want with a mix of identical, erased, bit-clearing and random
+ * areas, so every branch of the reference functions is taken.
+ */
+static void fill_buffers(uint8_t *have, uint8_t *want, size_t len, unsigned int pattern)
+{
+	lcg_state = pattern;
+	for (size_t i = 0; i < len; i++) {
+		const uint8_t r = next_random();
+		have[i] = (pattern & 1) ? ERASED : r;
+		want[i] = have[i];
+		switch ((i / 97 + pattern) % 5) {
+		case 0: /* identical */
+			break;
+		case 1: /* only clear bits */
+			if (!(r & 7))
+				want[i] = have[i] & next_random();
+			break;
+		case 2: /* sparse random change */
+			if (!(r & 63))
+				want[i] = next_random();
+			break;
+		case 3: /* erased source */
+			have[i] = ERASED;
+			if (r & 1)
+				want[i] = r;
+			break;
+		default: /* dense random change */
+			want[i] = next_random();
+			break;
+		}
+	}
+}
+
+void memdiff_masks_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	uint8_t have[TEST_BUF_SIZE], want[TEST_BUF_SIZE];
+	uint64_t d_ref[TEST_BUF_SIZE / MEMDIFF_LANE_SIZE + 1], e_ref[TEST_BUF_SIZE / MEMDIFF_LANE_SIZE + 1];
+	uint64_t d[TEST_BUF_SIZE / MEMDIFF_LANE_SIZE + 1], e[TEST_BUF_SIZE / MEMDIFF_LANE_SIZE + 1];
+	const enum memdiff_impl saved = memdiff_get_impl();
+
+	for (unsigned int pattern = 0; pattern < 10; pattern++) {
+		fill_buffers(have, want, sizeof(have), pattern);
+
+		for (size_t l = 0; l < ARRAY_SIZE(test_lens); l++) {
+			const size_t len = test_lens[l];
+			const size_t lanes = (len + MEMDIFF_LANE_SIZE - 1) / MEMDIFF_LANE_SIZE;
+
+			/* Expected masks straight from the definition. */
+			memset(d_ref, 0, sizeof(d_ref));
+			memset(e_ref, 0, sizeof(e_ref));
+			for (size_t i = 0; i < len; i++) {
+				d_ref[i / 64] |= (uint64_t)(have[i] != want[i]) << (i % 64);
+				e_ref[i / 64] |= (uint64_t)(have[i] == ERASED) << (i % 64);
+			}
+
+			for (enum memdiff_impl impl = 0; impl < MEMDIFF_IMPL_NR; impl++) {
+				if (memdiff_set_impl(impl))
+					continue;
+				printf("Testing %s kernel, pattern %u, len %zu\n", memdiff_impl_name(impl), pattern, len);
+				memdiff_masks(have, want, len, ERASED, d, e);
+				for (size_t i = 0; i < lanes; i++) {
+					assert_true(d[i] == d_ref[i]);
+					assert_true(e[i] == e_ref[i]);
+				}
+			}
+		}
+	}
+
+	assert_int_equal(0, memdiff_set_impl(saved));
+}
+
+void memdiff_need_erase_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	uint8_t have[TEST_BUF_SIZE], want[TEST_BUF_SIZE];
+	const enum memdiff_impl saved = memdiff_get_impl();
+
+	for (unsigned int pattern = 0; pattern < 10; pattern++) {
+		fill_buffers(have, want, sizeof(have), pattern);
+
+		for (size_t g = 0; g < ARRAY_SIZE(all_grans); g++) {
+			for (size_t l = 0; l < ARRAY_SIZE(test_lens); l++) {
+				/* Shift the start to also get chunks that are identical. */
+				for (size_t off = 0; off < 3; off++) {
+					const size_t len = test_lens[l] - (test_lens[l] > off ? off : 0);
+					const int expected = ref_need_erase(have + off, want + off, len,
+									    all_grans[g], ERASED);
+
+					for (enum memdiff_impl impl = 0; impl < MEMDIFF_IMPL_NR; impl++) {
+						if (memdiff_set_impl(impl))
+							continue;
+						assert_int_equal(expected, need_erase(have + off, want + off, len,
+										      all_grans[g], ERASED));
+					}
+				}
+			}
+		}
+	}
+
+	assert_int_equal(0, memdiff_set_impl(saved));
+}
+
+void memdiff_get_next_write_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	uint8_t have[TEST_BUF_SIZE], want[TEST_BUF_SIZE];
+	const enum memdiff_impl saved = memdiff_get_impl();
+
+	for (unsigned int pattern = 0; pattern < 10; pattern++) {
+		fill_buffers(have, want, sizeof(have), pattern);
+
+		for (size_t g = 0; g < ARRAY_SIZE(all_grans); g++) {
+			for (size_t l = 0; l < ARRAY_SIZE(test_lens); l++) {
+				const unsigned int len = test_lens[l];
+
+				for (enum memdiff_impl impl = 0; impl < MEMDIFF_IMPL_NR; impl++) {
+					if (memdiff_set_impl(impl))
+						continue;
+
+					/* Walk all writes of the range like the write loop does. */
+					unsigned int start = 0, ref_start = 0;
+					unsigned int write_len, ref_len;
+					do {
+						ref_len = ref_get_next_write(have + ref_start, want + ref_start,
+									     len - ref_start, &ref_start, all_grans[g]);
+						write_len = get_next_write(have + start, want + start,
+									   len - start, &start, all_grans[g]);
+						assert_int_equal(ref_len, write_len);
+						assert_int_equal(ref_start, start);
+						start += write_len;
+						ref_start += ref_len;
+					} while (ref_len);
+				}
+			}
+		}
+	}
+
+	assert_int_equal(0, memdiff_set_impl(saved));
+}
+
+void memdiff_count_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	uint8_t have[TEST_BUF_SIZE], want[TEST_BUF_SIZE];
+	const enum memdiff_impl saved = memdiff_get_impl();
+
+	for (unsigned int pattern = 0; pattern < 10; pattern++) {
+		fill_buffers(have, want, sizeof(have), pattern);
+
+		for (size_t l = 0; l < ARRAY_SIZE(test_lens); l++) {
+			const size_t len = test_lens[l];
+			size_t diff_count = 0, diff_first = len, unerased_count = 0, unerased_first = len;
+
+			for (size_t i = 0; i < len; i++) {
+				if (have[i] != want[i] && !diff_count++)
+					diff_first = i;
+				if (have[i] != ERASED && !unerased_count++)
+					unerased_first = i;
+			}
+
+			for (enum memdiff_impl impl = 0; impl < MEMDIFF_IMPL_NR; impl++) {
+				size_t first;
+				if (memdiff_set_impl(impl))
+					continue;
+				assert_int_equal(diff_count, memdiff_count(have, want, len, &first));
+				assert_int_equal(diff_first, first);
+				assert_int_equal(unerased_count, memdiff_count_unerased(have, len, ERASED, &first));
+				assert_int_equal(unerased_first, first);
+				assert_int_equal(diff_first, memdiff_find(have, want, len, false));
+			}
+		}
+	}
+
+	assert_int_equal(0, memdiff_set_impl(saved));
+}
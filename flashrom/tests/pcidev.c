@@ -0,0 +1,279 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Tests for the PCI device index. The device lists are built here, config
+ * space reads go to the lists' mock config space. The lookups have to return
+ * the same devices with the index as with a scan of the list by libpci.
+ */
+
+#include <include/test.h>
+#include "tests.h"
+
+#if CONFIG_INTERNAL == 1
+
+#include <stdbool.h>
+#include <string.h>
+
+/* Before io_mock.h, for the real struct pci_dev. */
+#include "pcidev.h"
+#include "platform.h"
+#include "io_mock.h"
+
+#define MAX_DEVS	48
+
+struct mock_config {
+	uint16_t devclass;
+	uint16_t subsystem_vendor_id;
+	uint16_t subsystem_id;
+	bool no_block_read;	/* Makes pci_read_block() fail. */
+};
+
+struct mock_bus {
+	struct pci_access acc;
+	struct pci_dev devs[MAX_DEVS];
+	struct mock_config config[MAX_DEVS];
+	unsigned int count;
+};
+
+struct pcidev_mock_state {
+	struct mock_bus *buses[2];
+	unsigned int word_reads;
+};
+
+static const struct mock_config *find_config(const struct pcidev_mock_state *s, const struct pci_dev *dev)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(s->buses); i++) {
+		const struct mock_bus *const bus = s->buses[i];
+		if (bus && dev >= bus->devs && dev < bus->devs + bus->count)
+			return &bus->config[dev - bus->devs];
+	}
+	fail_msg("Config space read of an unknown device");
+	return NULL;
+}
+
+static void set_word(uint8_t *header, int pos, uint16_t value)
+{
+	header[pos] = value & 0xff;
+	header[pos + 1] = value >> 8;
+}
+
+static void fill_header(uint8_t *header, const struct pci_dev *dev, const struct mock_config *config)
+{
+	set_word(header, PCI_VENDOR_ID, dev->vendor_id);
+	set_word(header, PCI_VENDOR_ID + 2, dev->device_id);
+	set_word(header, PCI_CLASS_DEVICE, config->devclass);
+	set_word(header, PCI_SUBSYSTEM_VENDOR_ID, config->subsystem_vendor_id);
+	set_word(header, PCI_SUBSYSTEM_ID, config->subsystem_id);
+}
+
+static uint16_t pcidev_read_word(void *state, struct pci_dev *dev, int pos)
+{
+	struct pcidev_mock_state *const s = state;
+	uint8_t header[64] = { 0 };
+
+	assert_in_range(pos, 0, sizeof(header) - 2);
+	fill_header(header, dev, find_config(s, dev));
+	s->word_reads++;
+	return read_le16(header, pos);
+}
+
+static int pcidev_read_block(void *state, struct pci_dev *dev, int pos, uint8_t *buf, int len)
+{
+	struct pcidev_mock_state *const s = state;
+	const struct mock_config *const config = find_config(s, dev);
+	uint8_t header[64] = { 0 };
+
+	if (config->no_block_read)
+		return 0;
+	assert_in_range(pos + len, 0, sizeof(header));
+	fill_header(header, dev, config);
+	memcpy(buf, header + pos, len);
+	return 1;
+}
+
+/* Appends a device to the device list of `bus`. */
+static void add_dev(struct mock_bus *bus, uint16_t vendor, uint16_t device, uint16_t devclass,
+		    uint16_t subsystem_vendor, uint16_t subsystem, bool no_block_read)
+{
+	assert_in_range(bus->count, 0, MAX_DEVS - 1);
+
+	struct pci_dev *const dev = &bus->devs[bus->count];
+	dev->bus = bus->count / 32;
+	dev->dev = bus->count % 32;
+	dev->vendor_id = vendor;
+	dev->device_id = device;
+	/* Keeps libpci from looking the IDs up itself. */
+	dev->known_fields = PCI_FILL_IDENT;
+	if (bus->count)
+		bus->devs[bus->count - 1].next = dev;
+	else
+		bus->acc.devices = dev;
+
+	bus->config[bus->count] = (struct mock_config) {
+		.devclass		= devclass,
+		.subsystem_vendor_id	= subsystem_vendor,
+		.subsystem_id		= subsystem,
+		.no_block_read		= no_block_read,
+	};
+	bus->count++;
+}
+
+struct lookups {
+	struct pci_dev *by_id[MAX_DEVS + 1];
+	struct pci_dev *by_card[MAX_DEVS + 1];
+	struct pci_dev *by_class[MAX_DEVS + 1];
+};
+
+/* Looks up the IDs of every device of `bus`, and IDs that aren't there. */
+static void lookup_all(const struct mock_bus *bus, struct lookups *found)
+{
+	for (unsigned int i = 0; i < bus->count; i++) {
+		const struct pci_dev *const dev = &bus->devs[i];
+		const struct mock_config *const config = &bus->config[i];
+		found->by_id[i] = pcidev_find(dev->vendor_id, dev->device_id);
+		found->by_card[i] = pcidev_card_find(dev->vendor_id, dev->device_id,
+						     config->subsystem_vendor_id, config->subsystem_id);
+		found->by_class[i] = pcidev_find_vendorclass(dev->vendor_id, config->devclass);
+	}
+	found->by_id[bus->count] = pcidev_find(0x1234, 0x5678);
+	found->by_card[bus->count] = pcidev_card_find(0x8086, 0x1c44, 0xffff, 0xffff);
+	found->by_class[bus->count] = pcidev_find_vendorclass(0x8086, 0x0c05);
+}
+
+/* 0x8086:0x1c44 matches three devices, two of them with the same subsystem IDs. */
+static void add_default_devs(struct mock_bus *bus)
+{
+	add_dev(bus, 0x8086, 0x0100, 0x0600, 0x1043, 0x844d, false);
+	add_dev(bus, 0x8086, 0x0102, 0x0300, 0x1043, 0x844d, true);
+	add_dev(bus, 0x8086, 0x1c44, 0x0601, 0x1043, 0x844d, false);
+	add_dev(bus, 0x10de, 0x0de1, 0x0300, 0x1043, 0x8415, false);
+	add_dev(bus, 0x8086, 0x1c44, 0x0601, 0x1458, 0x5001, true);
+	add_dev(bus, 0x8086, 0x1c44, 0x0601, 0x1458, 0x5001, false);
+	add_dev(bus, 0x1022, 0x780e, 0x0601, 0x1022, 0x780e, false);
+	add_dev(bus, 0x1022, 0x780b, 0x0c05, 0x1022, 0x780b, false);
+	/* Enough devices to share buckets. */
+	for (unsigned int i = 0; i < MAX_DEVS - 16; i++)
+		add_dev(bus, 0x1000 + i % 5, 0x2000 + i, 0x0100 + i % 3, 0x1000 + i % 5, i, i % 7 == 0);
+}
+
+void pcidev_index_matches_scan_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	static struct mock_bus bus;
+	struct pcidev_mock_state mock_state = { .buses = { &bus } };
+	const struct io_mock pcidev_io = {
+		.state		= &mock_state,
+		.pci_read_word	= pcidev_read_word,
+		.pci_read_block	= pcidev_read_block,
+	};
+	struct lookups indexed = { 0 }, scanned = { 0 };
+
+	memset(&bus, 0, sizeof(bus));
+	add_default_devs(&bus);
+	io_mock_register(&pcidev_io);
+	pacc = &bus.acc;
+
+	pcidev_index_build(pacc);
+	mock_state.word_reads = 0;
+	lookup_all(&bus, &indexed);
+	/* Only the index is looked at. */
+	assert_int_equal(0, mock_state.word_reads);
+
+	pcidev_index_release();
+	lookup_all(&bus, &scanned);
+	assert_int_not_equal(0, mock_state.word_reads);
+
+	assert_memory_equal(&indexed, &scanned, sizeof(indexed));
+
+	pacc = NULL;
+	io_mock_register(NULL);
+}
+
+void pcidev_index_duplicate_ids_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	static struct mock_bus bus;
+	struct pcidev_mock_state mock_state = { .buses = { &bus } };
+	const struct io_mock pcidev_io = {
+		.state		= &mock_state,
+		.pci_read_word	= pcidev_read_word,
+		.pci_read_block	= pcidev_read_block,
+	};
+
+	memset(&bus, 0, sizeof(bus));
+	add_default_devs(&bus);
+	io_mock_register(&pcidev_io);
+	pacc = &bus.acc;
+	pcidev_index_build(pacc);
+
+	/* The first device of the list that matches, whichever lookup. */
+	assert_ptr_equal(&bus.devs[2], pcidev_find(0x8086, 0x1c44));
+	assert_ptr_equal(&bus.devs[2], pcidev_card_find(0x8086, 0x1c44, 0x1043, 0x844d));
+	assert_ptr_equal(&bus.devs[4], pcidev_card_find(0x8086, 0x1c44, 0x1458, 0x5001));
+	assert_ptr_equal(&bus.devs[0], pcidev_find_vendorclass(0x8086, 0x0600));
+	assert_ptr_equal(&bus.devs[1], pcidev_find_vendorclass(0x8086, 0x0300));
+	assert_ptr_equal(&bus.devs[2], pcidev_find_vendorclass(0x8086, 0x0601));
+	assert_ptr_equal(&bus.devs[6], pcidev_find_vendorclass(0x1022, 0x0601));
+	assert_null(pcidev_find_vendorclass(0x10de, 0x0601));
+
+	pcidev_index_release();
+	pacc = NULL;
+	io_mock_register(NULL);
+}
+
+void pcidev_index_swapped_pacc_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	static struct mock_bus bus, other_bus;
+	struct pcidev_mock_state mock_state = { .buses = { &bus, &other_bus } };
+	const struct io_mock pcidev_io = {
+		.state		= &mock_state,
+		.pci_read_word	= pcidev_read_word,
+		.pci_read_block	= pcidev_read_block,
+	};
+
+	memset(&bus, 0, sizeof(bus));
+	memset(&other_bus, 0, sizeof(other_bus));
+	add_default_devs(&bus);
+	add_dev(&other_bus, 0x8086, 0x1c44, 0x0601, 0x1043, 0x844d, false);
+	add_dev(&other_bus, 0x8086, 0xa324, 0x0c80, 0x1043, 0x8694, false);
+	io_mock_register(&pcidev_io);
+	pacc = &bus.acc;
+	pcidev_index_build(pacc);
+
+	/*
+	 * enable_flash_pch100_or_c620() swaps pacc for a pci_access of its
+	 * own. The index isn't of its devices, they are scanned.
+	 */
+	pacc = &other_bus.acc;
+	mock_state.word_reads = 0;
+	assert_ptr_equal(&other_bus.devs[0], pcidev_find(0x8086, 0x1c44));
+	assert_ptr_equal(&other_bus.devs[1], pcidev_find(0x8086, 0xa324));
+	assert_null(pcidev_find(0x10de, 0x0de1));
+	assert_ptr_equal(&other_bus.devs[1], pcidev_find_vendorclass(0x8086, 0x0c80));
+	assert_int_not_equal(0, mock_state.word_reads);
+
+	/* Once it is restored, the index is used again. */
+	pacc = &bus.acc;
+	mock_state.word_reads = 0;
+	assert_ptr_equal(&bus.devs[2], pcidev_find(0x8086, 0x1c44));
+	assert_ptr_equal(&bus.devs[3], pcidev_find(0x10de, 0x0de1));
+	assert_null(pcidev_find(0x8086, 0xa324));
+	assert_null(pcidev_find_vendorclass(0x8086, 0x0c80));
+	assert_int_equal(0, mock_state.word_reads);
+
+	pcidev_index_release();
+	pacc = NULL;
+	io_mock_register(NULL);
+}
+
+#else
+	SKIP_TEST(pcidev_index_matches_scan_test_success)
+	SKIP_TEST(pcidev_index_duplicate_ids_test_success)
+	SKIP_TEST(pcidev_index_swapped_pacc_test_success)
+#endif /* CONFIG_INTERNAL */
@@ -0,0 +1,156 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lifecycle.h"
+
+#if CONFIG_SERPROG == 1 && CONFIG_DUMMY == 1 && !IS_WINDOWS
+#include "serprog.h"
+#include "serprog_sim.h"
+
+#define SERPROG_SIM_CHIP	"MX25L6436E/MX25L6445E/MX25L6465E"
+#define SERPROG_SIM_CHIP_SIZE	(8 * MiB)
+#define SERPROG_SIM_REGION_SIZE	(128 * KiB)
+#define SERPROG_SIM_PAGES	(SERPROG_SIM_REGION_SIZE / 256)
+
+/* Writes the start of a blank chip through the simulator and reads it back. */
+static void serprog_sim_write_and_read(struct serprog_sim *sim)
+{
+	struct flashrom_programmer *flashprog;
+	struct flashrom_flashctx *flashctx;
+	struct flashrom_layout *layout;
+	const char **names = NULL;
+	char param[32];
+
+	sim->dummy_params = "bus=spi,emulate=MX25L6436";
+	sim->chip_name = SERPROG_SIM_CHIP;
+	assert_int_equal(0, serprog_sim_start(sim));
+	const struct io_mock serprog_io = serprog_sim_host_io(sim);
+	io_mock_register(&serprog_io);
+
+	snprintf(param, sizeof(param), "ip=127.0.0.1:%u", sim->port);
+	assert_int_equal(0, flashrom_programmer_init(&flashprog, "serprog", param));
+	assert_int_equal(0, flashrom_create_context(&flashctx));
+	assert_int_equal(1, flashrom_flash_probe_v2(flashctx, &names, flashprog, SERPROG_SIM_CHIP));
+	assert_int_equal(SERPROG_SIM_CHIP_SIZE, flashrom_flash_getsize(flashctx));
+	assert_int_equal(0, flashrom_layout_new(&layout));
+	assert_int_equal(0, flashrom_layout_add_region(layout, 0, SERPROG_SIM_REGION_SIZE - 1, "region"));
+	assert_int_equal(0, flashrom_layout_include_region(layout, "region"));
+	flashrom_layout_set(flashctx, layout);
+
+	uint8_t *const image = malloc(SERPROG_SIM_CHIP_SIZE);
+	uint8_t *const readback = malloc(SERPROG_SIM_CHIP_SIZE);
+	assert_non_null(image);
+	assert_non_null(readback);
+	for (size_t i = 0; i < SERPROG_SIM_CHIP_SIZE; i++)
+		image[i] = i * 7;
+	flashrom_flag_set(flashctx, FLASHROM_FLAG_VERIFY_AFTER_WRITE, true);
+	assert_int_equal(0, flashrom_image_write(flashctx, image, SERPROG_SIM_CHIP_SIZE, NULL));
+	assert_int_equal(0, flashrom_image_read(flashctx, readback, SERPROG_SIM_CHIP_SIZE));
+	assert_memory_equal(image, readback, SERPROG_SIM_REGION_SIZE);
+	free(readback);
+	free(image);
+
+	flashrom_layout_release(layout);
+	flashrom_data_free(names);
+	flashrom_flash_release(flashctx);
+	assert_int_equal(0, flashrom_programmer_shutdown(flashprog));
+	io_mock_register(NULL);
+	assert_int_equal(0, serprog_sim_stop(sim));
+}
+
+void serprog_pipelined_write_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct serprog_sim *sim = calloc(1, sizeof(*sim));
+	assert_non_null(sim);
+	sim->pipelined = true;
+	serprog_sim_write_and_read(sim);
+
+	/* Each page is one compound command, the device polls WIP. */
+	assert_int_equal(SERPROG_SIM_PAGES, sim->commands[S_CMD_O_SPI_PROGRAM]);
+	assert_int_equal(0, sim->host_spi_ops[JEDEC_BYTE_PROGRAM]);
+	/* The host still reads the status register, e.g. for the block protection. */
+	assert_true(sim->host_spi_ops[JEDEC_RDSR] < 8);
+	/* The old contents, the verification and the read back. */
+	assert_int_equal(3 * SERPROG_SIM_REGION_SIZE / (64 * KiB), sim->commands[S_CMD_R_SPI_BULK]);
+	assert_int_equal(0, sim->host_spi_ops[JEDEC_READ]);
+	/* Everything else is tagged, too. */
+	assert_int_equal(0, sim->commands[S_CMD_O_SPIOP]);
+
+	free(sim);
+}
+
+void serprog_legacy_write_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct serprog_sim *sim = calloc(1, sizeof(*sim));
+	assert_non_null(sim);
+	sim->pipelined = false;
+	serprog_sim_write_and_read(sim);
+
+	/* Without the extension, every page is programmed and polled by the host. */
+	assert_int_equal(0, sim->commands[S_CMD_O_SPIOP_TAGGED]);
+	assert_int_equal(0, sim->commands[S_CMD_O_SPI_PROGRAM]);
+	assert_int_equal(0, sim->commands[S_CMD_R_SPI_BULK]);
+	assert_int_equal(SERPROG_SIM_PAGES, sim->host_spi_ops[JEDEC_BYTE_PROGRAM]);
+	assert_true(sim->host_spi_ops[JEDEC_RDSR] >= SERPROG_SIM_PAGES);
+
+	free(sim);
+}
+
+void serprog_ear_read_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct serprog_sim *sim = calloc(1, sizeof(*sim));
+	struct flashrom_programmer *flashprog;
+	struct flashrom_flashctx *flashctx;
+	const char **names = NULL;
+	char param[32];
+	uint8_t buf[0x1000];
+
+	assert_non_null(sim);
+	sim->pipelined = true;
+	sim->dummy_params = "bus=spi,emulate=MX25L6436";
+	sim->chip_name = SERPROG_SIM_CHIP;
+	assert_int_equal(0, serprog_sim_start(sim));
+	const struct io_mock serprog_io = serprog_sim_host_io(sim);
+	io_mock_register(&serprog_io);
+
+	snprintf(param, sizeof(param), "ip=127.0.0.1:%u", sim->port);
+	assert_int_equal(0, flashrom_programmer_init(&flashprog, "serprog", param));
+	assert_int_equal(0, flashrom_create_context(&flashctx));
+	assert_int_equal(1, flashrom_flash_probe_v2(flashctx, &names, flashprog, SERPROG_SIM_CHIP));
+
+	/*
+	 * Below 16 MiB, but the extended address register may still select
+	 * another bank. The default path takes care of it, not the bulk read.
+	 */
+	flashctx->chip->feature_bits |= FEATURE_4BA_EAR_C5C8;
+	flashctx->address_high_byte = 0;
+	assert_int_equal(0, read_flash(flashctx, buf, 0, sizeof(buf)));
+
+	flashrom_data_free(names);
+	flashrom_flash_release(flashctx);
+	assert_int_equal(0, flashrom_programmer_shutdown(flashprog));
+	io_mock_register(NULL);
+	assert_int_equal(0, serprog_sim_stop(sim));
+
+	assert_int_equal(0, sim->commands[S_CMD_R_SPI_BULK]);
+	assert_int_not_equal(0, sim->host_spi_ops[JEDEC_READ]);
+
+	free(sim);
+}
+#else
+	SKIP_TEST(serprog_pipelined_write_test_success)
+	SKIP_TEST(serprog_legacy_write_test_success)
+	SKIP_TEST(serprog_ear_read_test_success)
+#endif /* CONFIG_SERPROG && CONFIG_DUMMY */
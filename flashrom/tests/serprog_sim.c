@@ -0,0 +1,392 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * A serprog device for tests and benchmarks, see serprog_sim.h. It talks over
+ * TCP with recv() and send(), which are not mocked, and keeps the dummy
+ * programmer's chip as its flash.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "flash.h"
+#include "serprog.h"
+#include "serprog_sim.h"
+#include "spi.h"
+
+#define SIM_SERBUF_SIZE		0xffff
+#define SIM_OPBUF_SIZE		4096
+#define SIM_MAX_WRITE_N		256
+#define SIM_WIP_POLL_US		10
+
+static void sim_sleep_us(unsigned int us)
+{
+	nanosleep(&(struct timespec){ us / 1000000, (us % 1000000) * 1000 }, NULL);
+}
+
+static int sim_recv(int fd, void *buf, size_t len)
+{
+	uint8_t *p = buf;
+
+	while (len) {
+		const ssize_t got = recv(fd, p, len, 0);
+		if (got <= 0) {
+			if (got < 0 && errno == EINTR)
+				continue;
+			return 1;
+		}
+		p += got;
+		len -= got;
+	}
+	return 0;
+}
+
+static int sim_send(int fd, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+
+	while (len) {
+		const ssize_t sent = send(fd, p, len, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+			return 1;
+		}
+		p += sent;
+		len -= sent;
+	}
+	return 0;
+}
+
+static uint32_t sim_le(const uint8_t *p, unsigned int bytes)
+{
+	uint32_t v = 0;
+	for (unsigned int i = 0; i < bytes; i++)
+		v |= (uint32_t)p[i] << (8 * i);
+	return v;
+}
+
+static bool sim_supports(const struct serprog_sim *sim, uint8_t cmd)
+{
+	switch (cmd) {
+	case S_CMD_NOP:
+	case S_CMD_Q_IFACE:
+	case S_CMD_Q_CMDMAP:
+	case S_CMD_Q_PGMNAME:
+	case S_CMD_Q_SERBUF:
+	case S_CMD_Q_BUSTYPE:
+	case S_CMD_Q_OPBUF:
+	case S_CMD_Q_WRNMAXLEN:
+	case S_CMD_O_INIT:
+	case S_CMD_O_DELAY:
+	case S_CMD_O_EXEC:
+	case S_CMD_SYNCNOP:
+	case S_CMD_Q_RDNMAXLEN:
+	case S_CMD_S_BUSTYPE:
+	case S_CMD_O_SPIOP:
+		return true;
+	case S_CMD_Q_PIPELINE:
+	case S_CMD_O_SPIOP_TAGGED:
+	case S_CMD_O_SPI_PROGRAM:
+	case S_CMD_R_SPI_BULK:
+		return sim->pipelined;
+	default:
+		return false;
+	}
+}
+
+/* Reads the lengths and data of an SPI operation and runs it. */
+static int sim_spiop(struct serprog_sim *sim, int fd, uint8_t **rbuf, uint32_t *rlen)
+{
+	uint8_t lens[6];
+
+	if (sim_recv(fd, lens, sizeof(lens)))
+		return -1;
+	const uint32_t slen = sim_le(lens, 3);
+	*rlen = sim_le(lens + 3, 3);
+
+	uint8_t *const sbuf = malloc(slen + 1);
+	*rbuf = malloc(*rlen + 1);
+	if (!sbuf || !*rbuf || sim_recv(fd, sbuf, slen)) {
+		free(sbuf);
+		return -1;
+	}
+	if (slen)
+		sim->host_spi_ops[sbuf[0]]++;
+	const int ret = spi_send_command(sim->flash, slen, *rlen, sbuf, *rbuf);
+	free(sbuf);
+	return ret;
+}
+
+/* WREN, the SPI write and polling WIP until it clears or the timeout is over. */
+static int sim_program(struct serprog_sim *sim, int fd, uint8_t *status)
+{
+	uint8_t params[7];
+
+	if (sim_recv(fd, params, sizeof(params)))
+		return -1;
+	const uint32_t timeout_us = sim_le(params, 4);
+	const uint32_t slen = sim_le(params + 4, 3);
+
+	uint8_t *const sbuf = malloc(slen + 1);
+	if (!sbuf || sim_recv(fd, sbuf, slen)) {
+		free(sbuf);
+		return -1;
+	}
+	const uint8_t wren = JEDEC_WREN, rdsr = JEDEC_RDSR;
+	int ret = spi_send_command(sim->flash, 1, 0, &wren, status) ||
+		  spi_send_command(sim->flash, slen, 0, sbuf, status);
+	free(sbuf);
+
+	for (uint32_t waited_us = 0; !ret; waited_us += SIM_WIP_POLL_US) {
+		ret = spi_send_command(sim->flash, 1, 1, &rdsr, status);
+		if (ret || !(*status & SPI_SR_WIP))
+			break;
+		if (waited_us >= timeout_us)
+			ret = 1;
+		sim_sleep_us(SIM_WIP_POLL_US);
+	}
+	return ret;
+}
+
+/* One continuous SPI read of the given length. */
+static int sim_bulk_read(struct serprog_sim *sim, int fd, uint8_t **rbuf, uint32_t *rlen)
+{
+	uint8_t params[9];
+
+	if (sim_recv(fd, params, sizeof(params)))
+		return -1;
+	const uint8_t addr_len = params[1];
+	const uint32_t addr = sim_le(params + 2, 4);
+	*rlen = sim_le(params + 6, 3);
+	*rbuf = malloc(*rlen + 1);
+	if (!*rbuf)
+		return -1;
+	if (addr_len != 3 && addr_len != 4)
+		return 1;
+
+	uint8_t cmd[1 + JEDEC_MAX_ADDR_LEN] = { params[0] };
+	for (unsigned int i = 0; i < addr_len; i++)
+		cmd[1 + i] = (addr >> (8 * (addr_len - 1 - i))) & 0xff;
+	return spi_send_command(sim->flash, 1 + addr_len, *rlen, cmd, *rbuf);
+}
+
+/* Sends ACK or NAK, the tag of tagged commands and on success the data. */
+static int sim_answer(int fd, int ret, const uint8_t *tag, const uint8_t *data, uint32_t len)
+{
+	const uint8_t head[2] = { ret ? S_NAK : S_ACK, tag ? *tag : 0 };
+
+	if (sim_send(fd, head, tag ? 2 : 1))
+		return 1;
+	return ret || !len ? 0 : sim_send(fd, data, len);
+}
+
+/* Serves one command, returns non-zero when the connection is gone. */
+static int sim_command(struct serprog_sim *sim, int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	uint8_t cmd, tag, buf[32] = { 0 };
+	uint8_t *rbuf = NULL;
+	uint32_t rlen = 0;
+	int ret;
+
+	if (poll(&pfd, 1, 0) == 0) {
+		sim->stalls++;
+		if (poll(&pfd, 1, -1) < 0)
+			return 1;
+		if (sim->link_delay_us)
+			sim_sleep_us(sim->link_delay_us);
+	}
+	if (sim_recv(fd, &cmd, 1))
+		return 1;
+	sim->commands[cmd]++;
+
+	if (!sim_supports(sim, cmd))
+		return sim_answer(fd, 1, NULL, NULL, 0);
+
+	switch (cmd) {
+	case S_CMD_NOP:
+	case S_CMD_O_INIT:
+	case S_CMD_O_EXEC:
+		return sim_answer(fd, 0, NULL, NULL, 0);
+	case S_CMD_O_DELAY:
+		/* The emulated chip is never busy for long, skip delays. */
+		if (sim_recv(fd, buf, 4))
+			return 1;
+		return sim_answer(fd, 0, NULL, NULL, 0);
+	case S_CMD_SYNCNOP:
+		buf[0] = S_NAK;
+		buf[1] = S_ACK;
+		return sim_send(fd, buf, 2);
+	case S_CMD_Q_IFACE:
+		buf[0] = 1;
+		return sim_answer(fd, 0, NULL, buf, 2);
+	case S_CMD_Q_CMDMAP:
+		for (unsigned int i = 0; i < 256; i++)
+			if (sim_supports(sim, i))
+				buf[i / 8] |= 1 << (i % 8);
+		return sim_answer(fd, 0, NULL, buf, 32);
+	case S_CMD_Q_PGMNAME:
+		strcpy((char *)buf, "serprog_sim");
+		return sim_answer(fd, 0, NULL, buf, 16);
+	case S_CMD_Q_SERBUF:
+		buf[0] = SIM_SERBUF_SIZE & 0xff;
+		buf[1] = SIM_SERBUF_SIZE >> 8;
+		return sim_answer(fd, 0, NULL, buf, 2);
+	case S_CMD_Q_OPBUF:
+		buf[0] = SIM_OPBUF_SIZE & 0xff;
+		buf[1] = SIM_OPBUF_SIZE >> 8;
+		return sim_answer(fd, 0, NULL, buf, 2);
+	case S_CMD_Q_BUSTYPE:
+		buf[0] = BUS_SPI;
+		return sim_answer(fd, 0, NULL, buf, 1);
+	case S_CMD_S_BUSTYPE:
+		if (sim_recv(fd, buf, 1))
+			return 1;
+		return sim_answer(fd, buf[0] & ~BUS_SPI, NULL, NULL, 0);
+	case S_CMD_Q_WRNMAXLEN:
+		buf[0] = SIM_MAX_WRITE_N & 0xff;
+		buf[1] = (SIM_MAX_WRITE_N >> 8) & 0xff;
+		return sim_answer(fd, 0, NULL, buf, 3);
+	case S_CMD_Q_RDNMAXLEN:
+		/* Zero means 2^24 */
+		return sim_answer(fd, 0, NULL, buf, 3);
+	case S_CMD_Q_PIPELINE:
+		buf[0] = sim->window;
+		return sim_answer(fd, 0, NULL, buf, 1);
+	case S_CMD_O_SPIOP:
+		ret = sim_spiop(sim, fd, &rbuf, &rlen);
+		break;
+	case S_CMD_O_SPIOP_TAGGED:
+	case S_CMD_O_SPI_PROGRAM:
+	case S_CMD_R_SPI_BULK:
+		if (sim_recv(fd, &tag, 1))
+			return 1;
+		if (cmd == S_CMD_O_SPIOP_TAGGED) {
+			ret = sim_spiop(sim, fd, &rbuf, &rlen);
+		} else if (cmd == S_CMD_O_SPI_PROGRAM) {
+			ret = sim_program(sim, fd, buf);
+			rbuf = NULL;
+			rlen = 1;
+		} else {
+			ret = sim_bulk_read(sim, fd, &rbuf, &rlen);
+		}
+		if (ret >= 0)
+			ret = sim_answer(fd, ret, &tag, rbuf ? rbuf : buf, rlen);
+		free(rbuf);
+		return ret;
+	default:
+		return 1;
+	}
+
+	if (ret >= 0)
+		ret = sim_answer(fd, ret, NULL, rbuf, rlen);
+	free(rbuf);
+	return ret;
+}
+
+static void *sim_serve(void *arg)
+{
+	struct serprog_sim *const sim = arg;
+	const int fd = accept(sim->listen_fd, NULL, NULL);
+
+	if (fd < 0)
+		return NULL;
+	const int flag = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+	while (!sim_command(sim, fd))
+		;
+	close(fd);
+	return NULL;
+}
+
+int serprog_sim_start(struct serprog_sim *sim)
+{
+	union { struct sockaddr_in si; struct sockaddr s; } addr = {
+		.si = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) },
+	};
+	socklen_t addr_len = sizeof(addr.si);
+	const char **names = NULL;
+
+	if (!sim->window)
+		sim->window = 8;
+	if (flashrom_programmer_init(&sim->prog, "dummy", sim->dummy_params))
+		return 1;
+	if (flashrom_create_context(&sim->flash) ||
+	    flashrom_flash_probe_v2(sim->flash, &names, sim->prog, sim->chip_name) != 1)
+		goto err_prog;
+	flashrom_data_free(names);
+
+	sim->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (sim->listen_fd < 0)
+		goto err_prog;
+	if (bind(sim->listen_fd, &addr.s, addr_len) || listen(sim->listen_fd, 1) ||
+	    getsockname(sim->listen_fd, &addr.s, &addr_len))
+		goto err_sock;
+	sim->port = ntohs(addr.si.sin_port);
+	if (pthread_create(&sim->thread, NULL, sim_serve, sim))
+		goto err_sock;
+	return 0;
+
+err_sock:
+	close(sim->listen_fd);
+err_prog:
+	flashrom_data_free(names);
+	flashrom_flash_release(sim->flash);
+	flashrom_programmer_shutdown(sim->prog);
+	return 1;
+}
+
+int serprog_sim_stop(struct serprog_sim *sim)
+{
+	/* Wakes up accept() if the host never connected. */
+	shutdown(sim->listen_fd, SHUT_RDWR);
+	pthread_join(sim->thread, NULL);
+	close(sim->listen_fd);
+	flashrom_flash_release(sim->flash);
+	return flashrom_programmer_shutdown(sim->prog);
+}
+
+static int sim_host_read(void *state, int fd, void *buf, size_t sz)
+{
+	struct serprog_sim *const sim = state;
+	return recv(fd, buf, sz, (sim->host_flags & O_NONBLOCK) ? MSG_DONTWAIT : 0);
+}
+
+static int sim_host_write(void *state, int fd, const void *buf, size_t sz)
+{
+	return send(fd, buf, sz, MSG_NOSIGNAL);
+}
+
+static int sim_host_fcntl(void *state, int fd, unsigned long cmd, va_list args)
+{
+	struct serprog_sim *const sim = state;
+
+	if (cmd == F_GETFL)
+		return sim->host_flags;
+	if (cmd == F_SETFL)
+		sim->host_flags = va_arg(args, int);
+	return 0;
+}
+
+struct io_mock serprog_sim_host_io(struct serprog_sim *sim)
+{
+	return (struct io_mock) {
+		.state		= sim,
+		.iom_read	= sim_host_read,
+		.iom_write	= sim_host_write,
+		.iom_fcntl	= sim_host_fcntl,
+	};
+}
@@ -0,0 +1,54 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#ifndef __SERPROG_SIM_H__
+#define __SERPROG_SIM_H__
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "io_mock.h"
+#include "libflashrom.h"
+
+/*
+ * A serprog device listening on a local TCP port. It answers SPI operations
+ * with a chip emulated by the dummy programmer, from a thread of its own, so
+ * that the serprog programmer can talk to it with `ip=127.0.0.1:<port>`.
+ */
+struct serprog_sim {
+	/* Set up before serprog_sim_start() */
+	const char *dummy_params;	/* e.g. "bus=spi,emulate=M25P10.RES" */
+	const char *chip_name;
+	bool pipelined;			/* advertise the tagged commands */
+	unsigned int window;		/* tagged operations in flight, if pipelined */
+	unsigned int link_delay_us;	/* added whenever the device waits for the host */
+
+	/* Set by serprog_sim_start() */
+	unsigned int port;
+
+	/* Counted while serving, valid after serprog_sim_stop() */
+	unsigned int commands[256];	/* serprog commands by number */
+	unsigned int host_spi_ops[256];	/* SPI operations the host sent, by opcode */
+	unsigned int stalls;		/* times the device had to wait for the host */
+
+	/* Internal */
+	struct flashrom_programmer *prog;
+	struct flashrom_flashctx *flash;
+	int listen_fd;
+	int host_flags;
+	pthread_t thread;
+};
+
+int serprog_sim_start(struct serprog_sim *sim);
+int serprog_sim_stop(struct serprog_sim *sim);
+
+/*
+ * read() and write() are mocked in the unit tests, the mock returned here
+ * passes them through to the socket of the serprog programmer.
+ */
+struct io_mock serprog_sim_host_io(struct serprog_sim *sim);
+
+#endif /* __SERPROG_SIM_H__ */
@@ -0,0 +1,322 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Tests for `flashrom --serve`. Requests are sent over a socketpair, the
+ * server side runs serve_connection() against the dummy programmer once the
+ * client side is done sending.
+ */
+
+#include <include/test.h>
+
+#include "tests.h"
+
+#if defined(__linux__)
+
+#include "flash.h"
+#include "io_mock.h"
+#include "libflashrom.h"
+#include "serve.h"
+#include "wraps.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define CHIP_SIZE	(16 * MiB)
+#define MAX_REQUESTS	8
+
+static int serve_fstat(void *state, int fd, void *buf)
+{
+	return __real_fstat(fd, buf);
+}
+
+/* The server checks the size of images it gets. */
+static const struct io_mock serve_io = {
+	.iom_fstat	= serve_fstat,
+};
+
+struct serve_call {
+	struct serve_request req;
+	int fd;			/* Image passed along, closed by run_session(). */
+	struct serve_reply reply;
+	int reply_fd;
+};
+
+static struct flashrom_flashctx *setup_server(struct flashrom_programmer **flashprog)
+{
+	struct flashrom_flashctx *flashctx = NULL;
+	const char **matched = NULL;
+
+	io_mock_register(&serve_io);
+	assert_int_equal(0, flashrom_programmer_init(flashprog, "dummy", "bus=spi,emulate=W25Q128FV"));
+	assert_int_equal(0, flashrom_create_context(&flashctx));
+	assert_int_equal(1, flashrom_flash_probe_v2(flashctx, &matched, *flashprog, "W25Q128.V"));
+	flashrom_data_free(matched);
+	return flashctx;
+}
+
+static void teardown_server(struct flashrom_flashctx *flashctx, struct flashrom_programmer *flashprog)
+{
+	flashrom_flash_release(flashctx);
+	assert_int_equal(0, flashrom_programmer_shutdown(flashprog));
+	io_mock_register(NULL);
+}
+
+/*
+ * Sends all requests of `calls` on one connection, then lets the server answer
+ * them. Returns what serve_connection() returned.
+ */
+static int run_session(struct flashrom_flashctx *flashctx, struct flashrom_layout *layout,
+		       struct serve_call *calls, size_t count)
+{
+	int sv[2];
+
+	assert_int_equal(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv));
+	for (size_t i = 0; i < count; i++) {
+		calls[i].req.magic = SERVE_MAGIC;
+		calls[i].req.version = SERVE_VERSION;
+		assert_int_equal(0, serve_send(sv[0], &calls[i].req, sizeof(calls[i].req), calls[i].fd));
+		if (calls[i].fd >= 0)
+			close(calls[i].fd);
+	}
+	assert_int_equal(0, shutdown(sv[0], SHUT_WR));
+
+	const int ret = serve_connection(flashctx, sv[1], layout);
+	close(sv[1]);
+
+	for (size_t i = 0; i < count; i++) {
+		assert_int_equal(0, serve_recv(sv[0], &calls[i].reply, sizeof(calls[i].reply),
+					       &calls[i].reply_fd));
+		assert_int_equal(SERVE_MAGIC, calls[i].reply.magic);
+		assert_int_equal(CHIP_SIZE, calls[i].reply.chip_size);
+	}
+	close(sv[0]);
+	return ret;
+}
+
+/* Creates an image of `size` bytes, 0xff (erased) except for `len` bytes of `value` at `start`. */
+static int create_image(size_t size, size_t start, size_t len, uint8_t value)
+{
+	const int fd = serve_memfd("serve-test", size);
+	assert_true(fd >= 0);
+	uint8_t *const buf = mmap(NULL, size, PROT_WRITE, MAP_SHARED, fd, 0);
+	assert_true(buf != MAP_FAILED);
+	memset(buf, 0xff, size);
+	memset(buf + start, value, len);
+	munmap(buf, size);
+	return fd;
+}
+
+/* Checks `len` bytes at `start` of a read reply. */
+static void check_image(const struct serve_call *call, size_t start, size_t len, uint8_t value)
+{
+	assert_int_equal(0, call->reply.ret);
+	assert_int_equal(CHIP_SIZE, call->reply.image_size);
+	assert_true(call->reply_fd >= 0);
+
+	const uint8_t *const buf = mmap(NULL, CHIP_SIZE, PROT_READ, MAP_SHARED, call->reply_fd, 0);
+	assert_true(buf != MAP_FAILED);
+	for (size_t i = start; i < start + len; i++)
+		assert_int_equal(value, buf[i]);
+	munmap((void *)buf, CHIP_SIZE);
+}
+
+static void close_replies(struct serve_call *calls, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		if (calls[i].reply_fd >= 0)
+			close(calls[i].reply_fd);
+	}
+}
+
+static void alarm_handler(int sig)
+{
+	(void)sig;
+}
+
+void serve_framing_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct serve_request req = { .magic = SERVE_MAGIC, .op = SERVE_OP_READ }, got;
+	struct sigaction sa = { .sa_handler = alarm_handler }, old_sa;
+	const struct itimerval timer = { .it_value = { .tv_usec = 10000 } };
+	struct stat st;
+	int sv[2], fd;
+
+	assert_int_equal(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv));
+
+	/* A frame without a file descriptor. */
+	snprintf(req.regions, sizeof(req.regions), "region");
+	assert_int_equal(0, serve_send(sv[0], &req, sizeof(req), -1));
+	assert_int_equal(0, serve_recv(sv[1], &got, sizeof(got), &fd));
+	assert_int_equal(-1, fd);
+	assert_memory_equal(&req, &got, sizeof(req));
+
+	/* The file descriptor arrives along with the frame. */
+	const int image = serve_memfd("serve-test", 4096);
+	assert_true(image >= 0);
+	assert_int_equal(0, serve_send(sv[0], &req, sizeof(req), image));
+	close(image);
+	assert_int_equal(0, serve_recv(sv[1], &got, sizeof(got), &fd));
+	assert_true(fd >= 0);
+	assert_int_equal(0, __real_fstat(fd, &st));
+	assert_int_equal(4096, st.st_size);
+	close(fd);
+
+	/* Frames of the wrong size are rejected, their file descriptor is closed. */
+	const int short_image = serve_memfd("serve-test", 0);
+	assert_true(short_image >= 0);
+	assert_int_equal(0, serve_send(sv[0], &req, sizeof(req) / 2, short_image));
+	close(short_image);
+	assert_int_equal(-1, serve_recv(sv[1], &got, sizeof(got), &fd));
+	assert_int_equal(EPROTO, errno);
+	assert_int_equal(-1, fd);
+
+	/* A signal is reported, not retried, so the server can stop. */
+	sigemptyset(&sa.sa_mask);
+	assert_int_equal(0, sigaction(SIGALRM, &sa, &old_sa));
+	assert_int_equal(0, setitimer(ITIMER_REAL, &timer, NULL));
+	assert_int_equal(-1, serve_recv(sv[1], &got, sizeof(got), &fd));
+	assert_int_equal(EINTR, errno);
+	assert_int_equal(0, sigaction(SIGALRM, &old_sa, NULL));
+
+	/* The peer closing the connection isn't an error. */
+	close(sv[0]);
+	assert_int_equal(1, serve_recv(sv[1], &got, sizeof(got), &fd));
+	close(sv[1]);
+}
+
+void serve_read_write_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct flashrom_programmer *flashprog = NULL;
+	struct serve_call calls[MAX_REQUESTS];
+	struct flashrom_flashctx *const flashctx = setup_server(&flashprog);
+
+	/* Write an image, read it back and verify it, all on one connection. */
+	memset(calls, 0, sizeof(calls));
+	calls[0].req.op = SERVE_OP_WRITE;
+	calls[0].req.image_size = CHIP_SIZE;
+	calls[0].fd = create_image(CHIP_SIZE, 0x10000, 0x2000, 0x5a);
+	calls[1].req.op = SERVE_OP_READ;
+	calls[1].fd = -1;
+	calls[2].req.op = SERVE_OP_VERIFY;
+	calls[2].req.image_size = CHIP_SIZE;
+	calls[2].fd = create_image(CHIP_SIZE, 0x10000, 0x2000, 0x5a);
+	calls[3].req.op = SERVE_OP_VERIFY;
+	calls[3].req.image_size = CHIP_SIZE;
+	calls[3].fd = create_image(CHIP_SIZE, 0x10000, 0x2000, 0xa5);
+	assert_int_equal(0, run_session(flashctx, NULL, calls, 4));
+
+	assert_int_equal(0, calls[0].reply.ret);
+	check_image(&calls[1], 0, 0x10000, ERASED_VALUE(flashctx));
+	check_image(&calls[1], 0x10000, 0x2000, 0x5a);
+	check_image(&calls[1], 0x12000, CHIP_SIZE - 0x12000, ERASED_VALUE(flashctx));
+	assert_int_equal(0, calls[2].reply.ret);
+	assert_int_not_equal(0, calls[3].reply.ret);
+	close_replies(calls, 4);
+
+	/* Images that are smaller than they claim to be, or missing, are refused. */
+	memset(calls, 0, sizeof(calls));
+	calls[0].req.op = SERVE_OP_WRITE;
+	calls[0].req.image_size = CHIP_SIZE;
+	calls[0].fd = create_image(CHIP_SIZE / 2, 0, CHIP_SIZE / 2, 0x00);
+	calls[1].req.op = SERVE_OP_WRITE;
+	calls[1].req.image_size = CHIP_SIZE;
+	calls[1].fd = -1;
+	calls[2].req.op = SERVE_OP_READ;
+	calls[2].fd = -1;
+	calls[3].req.op = SERVE_OP_SHUTDOWN;
+	calls[3].fd = -1;
+	assert_int_equal(1, run_session(flashctx, NULL, calls, 4));
+
+	assert_int_equal(1, calls[0].reply.ret);
+	assert_int_equal(1, calls[1].reply.ret);
+	check_image(&calls[2], 0, 0x10000, ERASED_VALUE(flashctx));
+	check_image(&calls[2], 0x10000, 0x2000, 0x5a);
+	assert_int_equal(0, calls[3].reply.ret);
+	close_replies(calls, 4);
+
+	teardown_server(flashctx, flashprog);
+}
+
+void serve_layout_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct flashrom_programmer *flashprog = NULL;
+	struct flashrom_layout *layout;
+	struct serve_call calls[MAX_REQUESTS];
+
+	assert_int_equal(0, flashrom_layout_new(&layout));
+	assert_int_equal(0, flashrom_layout_add_region(layout, 0x0000, 0x0fff, "first"));
+	assert_int_equal(0, flashrom_layout_add_region(layout, 0x1000, 0x1fff, "second"));
+	assert_int_equal(0, flashrom_layout_add_region(layout, 0x2000, 0x2fff, "third"));
+
+	struct flashrom_flashctx *const flashctx = setup_server(&flashprog);
+
+	/* Only the requested regions of the image are written. */
+	memset(calls, 0, sizeof(calls));
+	calls[0].req.op = SERVE_OP_WRITE;
+	calls[0].req.image_size = CHIP_SIZE;
+	snprintf(calls[0].req.regions, sizeof(calls[0].req.regions), "first,third");
+	calls[0].fd = create_image(CHIP_SIZE, 0, 0x3000, 0x11);
+	calls[1].req.op = SERVE_OP_READ;
+	calls[1].fd = -1;
+	/* Unknown and overlapping regions are refused. */
+	calls[2].req.op = SERVE_OP_READ;
+	snprintf(calls[2].req.regions, sizeof(calls[2].req.regions), "fourth");
+	calls[2].fd = -1;
+	calls[3].req.op = SERVE_OP_READ;
+	snprintf(calls[3].req.regions, sizeof(calls[3].req.regions), "first,first");
+	calls[3].fd = -1;
+	/* A layout file has to come with the request. */
+	calls[4].req.op = SERVE_OP_LAYOUT;
+	calls[4].req.layout_source = SERVE_LAYOUT_FILE;
+	calls[4].fd = -1;
+	calls[5].req.op = SERVE_OP_LAYOUT;
+	calls[5].req.layout_source = SERVE_LAYOUT_DEFAULT;
+	calls[5].fd = -1;
+	calls[6].req.op = SERVE_OP_READ;
+	snprintf(calls[6].req.regions, sizeof(calls[6].req.regions), "second");
+	calls[6].fd = -1;
+	assert_int_equal(0, run_session(flashctx, layout, calls, 7));
+
+	assert_int_equal(0, calls[0].reply.ret);
+	check_image(&calls[1], 0x0000, 0x1000, 0x11);
+	check_image(&calls[1], 0x1000, 0x1000, ERASED_VALUE(flashctx));
+	check_image(&calls[1], 0x2000, 0x1000, 0x11);
+	assert_int_equal(1, calls[2].reply.ret);
+	assert_int_equal(1, calls[3].reply.ret);
+	assert_int_equal(1, calls[4].reply.ret);
+	assert_int_equal(0, calls[5].reply.ret);
+	check_image(&calls[6], 0x1000, 0x1000, ERASED_VALUE(flashctx));
+	close_replies(calls, 7);
+
+	/* Without a layout there are no regions to include. */
+	memset(calls, 0, sizeof(calls));
+	calls[0].req.op = SERVE_OP_READ;
+	snprintf(calls[0].req.regions, sizeof(calls[0].req.regions), "first");
+	calls[0].fd = -1;
+	assert_int_equal(0, run_session(flashctx, NULL, calls, 1));
+	assert_int_equal(1, calls[0].reply.ret);
+	assert_int_equal(-1, calls[0].reply_fd);
+
+	teardown_server(flashctx, flashprog);
+	flashrom_layout_release(layout);
+}
+
+#else
+	SKIP_TEST(serve_framing_test_success)
+	SKIP_TEST(serve_read_write_test_success)
+	SKIP_TEST(serve_layout_test_success)
+#endif /* __linux__ */
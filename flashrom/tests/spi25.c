@@ -6,6 +6,7 @@
  */
 
 #include <include/test.h>
+#include <limits.h>
 
 #include "wraps.h"
 #include "tests.h"
@@ -212,7 +213,7 @@ void probe_spi_res2_test_success(void **state)
 	(void) state; /* unused */
 
 	/* setup initial test state. */
-	clear_spi_id_cache();
+	clear_spi_id_cache(programmer_current());
 	struct flashctx flashctx = { .chip = &mock_chip };
 	expect_memory(__wrap_spi_send_command, flash,
 			&flashctx, sizeof(flashctx));
@@ -253,6 +254,118 @@ void probe_spi_at25f_test_success(void **state)
 	assert_int_equal(0, probe_spi_at25f(&flashctx));
 }
 
+struct busy_chip_state {
+	unsigned int busy_polls;	/* RDSR reads that still report WIP, UINT_MAX for a stuck chip */
+	unsigned int polls;
+	unsigned int delays;
+	uint64_t first_delay_us;
+	uint64_t delay_us;
+};
+
+static struct busy_chip_state busy_chip;
+
+static int busy_chip_command(const struct flashctx *flash, unsigned int writecnt, unsigned int readcnt,
+			     const unsigned char *writearr, unsigned char *readarr)
+{
+	if (writearr[0] == JEDEC_RDSR) {
+		readarr[0] = busy_chip.polls < busy_chip.busy_polls ? SPI_SR_WIP : 0;
+		busy_chip.polls++;
+	}
+	return 0;
+}
+
+static void busy_chip_delay(const struct flashctx *flash, unsigned int usecs)
+{
+	if (!busy_chip.delays)
+		busy_chip.first_delay_us = usecs;
+	busy_chip.delays++;
+	busy_chip.delay_us += usecs;
+}
+
+void spi_poll_wip_timeout_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct flashchip chip = {
+		.name		= "busy SPI chip",
+		.bustype	= BUS_SPI,
+		.total_size	= 4,
+		.page_size	= 256,
+		.block_erasers	= {
+			{
+				.eraseblocks = { {4 * 1024, 1} },
+				.block_erase = SPI_BLOCK_ERASE_20,
+			},
+		},
+	};
+	struct registered_master mst = {
+		.buses_supported = BUS_SPI,
+		.spi.command = busy_chip_command,
+		.spi.delay = busy_chip_delay,
+	};
+	struct flashctx flashctx = {
+		.chip = &chip,
+		.mst = &mst,
+	};
+
+	/* Without timing data the chip is polled right away and given 4s. */
+	busy_chip = (struct busy_chip_state){ .busy_polls = UINT_MAX };
+	assert_int_equal(TIMEOUT_ERROR, spi_block_erase_20(&flashctx, 0, 4 * 1024));
+	assert_true(busy_chip.delay_us >= 4 * 1000 * 1000);
+	assert_true(busy_chip.delay_us < 4 * 1000 * 1000 + 10 * 1000);
+	assert_true(busy_chip.polls == busy_chip.delays + 1);
+
+	/* With it, 3/4 of the typical time is slept through and the chip's maximum enforced. */
+	chip.block_erasers[0].typ_erase_us = 40 * 1000;
+	chip.max_time_factor = 2;
+	chip.max_erase_time_factor = 4;
+	busy_chip = (struct busy_chip_state){ .busy_polls = UINT_MAX };
+	assert_int_equal(TIMEOUT_ERROR, spi_block_erase_20(&flashctx, 0, 4 * 1024));
+	assert_int_equal(30 * 1000, busy_chip.first_delay_us);
+	assert_true(busy_chip.delay_us >= 160 * 1000);
+	assert_true(busy_chip.delay_us < 160 * 1000 + 10 * 1000);
+
+	/* A chip that finishes in time is read once after the initial sleep. */
+	busy_chip = (struct busy_chip_state){ .busy_polls = 0 };
+	assert_int_equal(0, spi_block_erase_20(&flashctx, 0, 4 * 1024));
+	assert_int_equal(1, busy_chip.polls);
+	assert_int_equal(1, busy_chip.delays);
+}
+
+void spi_chip_typ_busy_us_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct flashchip chip = {
+		.name			= "timed SPI chip",
+		.bustype		= BUS_SPI,
+		.total_size		= 64,
+		.page_size		= 256,
+		.typ_page_program_us	= 700,
+		.typ_byte_program_us	= 30,
+		.typ_chip_erase_us	= 500 * 1000,
+		.block_erasers		= {
+			{
+				.eraseblocks = { {64 * 1024, 1} },
+				.block_erase = SPI_BLOCK_ERASE_EMULATION,
+				.typ_erase_us = 1,
+			}, {
+				.eraseblocks = { {64 * 1024, 1} },
+				.block_erase = SPI_BLOCK_ERASE_D8,
+				.typ_erase_us = 150 * 1000,
+			},
+		},
+	};
+	struct flashctx flashctx = { .chip = &chip };
+
+	/* Erasers without an opcode and empty slots are skipped. */
+	assert_int_equal(150 * 1000, spi_chip_typ_busy_us(&flashctx, JEDEC_BE_D8, 0));
+	assert_int_equal(0, spi_chip_typ_busy_us(&flashctx, JEDEC_SE, 0));
+	assert_int_equal(500 * 1000, spi_chip_typ_busy_us(&flashctx, JEDEC_CE_C7, 0));
+	assert_int_equal(700, spi_chip_typ_busy_us(&flashctx, JEDEC_BYTE_PROGRAM, 256));
+	assert_int_equal(30, spi_chip_typ_busy_us(&flashctx, JEDEC_BYTE_PROGRAM, 1));
+}
+
 /* spi95.c */
 void probe_spi_st95_test_success(void **state)
 {
@@ -0,0 +1,185 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Tests for the bus traffic statistics of a flash context.
+ */
+
+#include <include/test.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tests.h"
+#include "flash.h"
+#include "libflashrom.h"
+#include "programmer.h"
+#include "spi.h"
+#include "stats.h"
+
+void stats_disabled_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct flashrom_flashctx *flashctx = NULL;
+	struct flashrom_stats stats;
+
+	assert_int_equal(0, flashrom_create_context(&flashctx));
+	assert_int_equal(1, flashrom_stats_get(flashctx, &stats));
+	assert_int_equal(0, flashrom_stats_enable(flashctx, true));
+	assert_int_equal(0, flashrom_stats_get(flashctx, &stats));
+	assert_int_equal(0, stats.stage[FLASHROM_STATS_READ].transactions);
+	assert_int_equal(0, flashrom_stats_enable(flashctx, false));
+	assert_int_equal(1, flashrom_stats_get(flashctx, &stats));
+
+	assert_string_equal("write", flashrom_stats_stage_name(FLASHROM_STATS_WRITE));
+	assert_string_equal("unknown", flashrom_stats_stage_name(FLASHROM_STATS_NR));
+
+	flashrom_flash_release(flashctx);
+}
+
+static int transfer_command(const struct flashctx *flash, unsigned int writecnt, unsigned int readcnt,
+			    const unsigned char *writearr, unsigned char *readarr)
+{
+	memset(readarr, 0xff, readcnt);
+	return 0;
+}
+
+/* Reads and writes like a controller that handles whole transfers itself. */
+static int transfer_read(struct flashctx *flash, uint8_t *buf, unsigned int start, unsigned int len)
+{
+	memset(buf, 0xff, len);
+	return 0;
+}
+
+static int transfer_write(struct flashctx *flash, const uint8_t *buf, unsigned int start, unsigned int len)
+{
+	return 0;
+}
+
+void stats_master_transfer_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct flashchip chip = {
+		.total_size	= 64,
+		.page_size	= 256,
+	};
+	struct registered_master mst = {
+		.buses_supported	= BUS_SPI,
+		.spi.command		= transfer_command,
+		.spi.read		= transfer_read,
+		.spi.write_256		= transfer_write,
+		.spi.max_data_read	= 64,
+	};
+	struct flashctx flashctx = {
+		.chip	= &chip,
+		.mst	= &mst,
+	};
+	struct flashrom_stats stats;
+	uint8_t buf[1024];
+
+	assert_int_equal(0, flashrom_stats_enable(&flashctx, true));
+
+	/* Transfers that never reach the command functions count as one transaction each. */
+	stats_set_stage(&flashctx, FLASHROM_STATS_READ);
+	assert_int_equal(0, spi_chip_read(&flashctx, buf, 0, sizeof(buf)));
+	stats_set_stage(&flashctx, FLASHROM_STATS_WRITE);
+	assert_int_equal(0, spi_chip_write_256(&flashctx, buf, 0, 256));
+	assert_int_equal(0, flashrom_stats_get(&flashctx, &stats));
+	assert_int_equal(1, stats.stage[FLASHROM_STATS_READ].transactions);
+	assert_int_equal(sizeof(buf), stats.stage[FLASHROM_STATS_READ].bytes_in);
+	assert_int_equal(1, stats.stage[FLASHROM_STATS_WRITE].transactions);
+	assert_int_equal(256, stats.stage[FLASHROM_STATS_WRITE].bytes_out);
+
+	/* Reads made of SPI commands are counted once, by the commands. */
+	mst.spi.read = default_spi_read;
+	stats_set_stage(&flashctx, FLASHROM_STATS_VERIFY);
+	assert_int_equal(0, spi_chip_read(&flashctx, buf, 0, sizeof(buf)));
+	assert_int_equal(0, flashrom_stats_get(&flashctx, &stats));
+	assert_int_equal(sizeof(buf) / 64, stats.stage[FLASHROM_STATS_VERIFY].transactions);
+	assert_int_equal(sizeof(buf), stats.stage[FLASHROM_STATS_VERIFY].bytes_in);
+
+	assert_int_equal(0, flashrom_stats_enable(&flashctx, false));
+}
+
+#if CONFIG_DUMMY == 1
+static uint64_t histogram_sum(const struct flashrom_opcode_stats *op)
+{
+	uint64_t sum = 0;
+	for (size_t i = 0; i < FLASHROM_STATS_LATENCY_BUCKETS; i++)
+		sum += op->latency[i];
+	return sum;
+}
+
+void stats_dummy_write_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct flashrom_programmer *flashprog = NULL;
+	struct flashrom_flashctx *flashctx = NULL;
+	const char **names = NULL;
+
+	assert_int_equal(0, flashrom_create_context(&flashctx));
+	assert_int_equal(0, flashrom_stats_enable(flashctx, true));
+	assert_int_equal(0, flashrom_programmer_init(&flashprog, "dummy", "bus=spi,emulate=M25P10.RES"));
+	assert_int_equal(1, flashrom_flash_probe_v2(flashctx, &names, flashprog, "M25P10"));
+
+	const size_t size = flashrom_flash_getsize(flashctx);
+	uint8_t *const newcontents = malloc(size);
+	assert_non_null(newcontents);
+	flashrom_flag_set(flashctx, FLASHROM_FLAG_VERIFY_AFTER_WRITE, true);
+	/* The second write has to erase what the first one programmed. */
+	for (size_t i = 0; i < size; i++)
+		newcontents[i] = i;
+	assert_int_equal(0, flashrom_image_write(flashctx, newcontents, size, NULL));
+	for (size_t i = 0; i < size; i++)
+		newcontents[i] = ~i;
+	assert_int_equal(0, flashrom_image_write(flashctx, newcontents, size, NULL));
+
+	struct flashrom_stats *const stats = malloc(sizeof(*stats));
+	assert_non_null(stats);
+	assert_int_equal(0, flashrom_stats_get(flashctx, stats));
+
+	const struct flashrom_stage_stats *const probe = &stats->stage[FLASHROM_STATS_PROBE];
+	const struct flashrom_stage_stats *const read = &stats->stage[FLASHROM_STATS_READ];
+	const struct flashrom_stage_stats *const erase = &stats->stage[FLASHROM_STATS_ERASE];
+	const struct flashrom_stage_stats *const write = &stats->stage[FLASHROM_STATS_WRITE];
+	const struct flashrom_stage_stats *const verify = &stats->stage[FLASHROM_STATS_VERIFY];
+
+	assert_true(probe->transactions > 0);
+	/* Each write reads the old contents and verifies the whole chip once. */
+	assert_true(read->bytes_in == 2 * size);
+	assert_true(verify->bytes_in == 2 * size);
+	assert_true(erase->transactions > 0 && erase->wip_polls > 0);
+	/* Every byte is sent at least once, with its opcode and address. */
+	assert_true(write->bytes_out > 2 * size);
+	assert_true(write->wip_polls > 0);
+
+	const struct flashrom_opcode_stats *const page_program = &stats->opcode[JEDEC_BYTE_PROGRAM];
+	assert_true(page_program->count > 0);
+	assert_true(page_program->count == histogram_sum(page_program));
+	assert_true(page_program->total_ns >= page_program->max_ns);
+	/* Every page program and every erase waits for WIP to clear once. */
+	assert_true(page_program->busy_count == page_program->count);
+	assert_true(page_program->busy_total_ns >= page_program->busy_max_ns);
+	assert_true(stats->opcode[JEDEC_BE_D8].busy_count + stats->opcode[JEDEC_CE_C7].busy_count > 0);
+	assert_true(stats->opcode[JEDEC_READ].count > 0);
+	assert_int_equal(0, stats->opcode[JEDEC_SE].count);
+
+	free(stats);
+
+	/* A write leaves the stage of its caller in place. */
+	stats_set_stage(flashctx, FLASHROM_STATS_ERASE);
+	assert_int_equal(0, flashrom_image_write(flashctx, newcontents, size, NULL));
+	assert_int_equal(FLASHROM_STATS_ERASE, stats_set_stage(flashctx, FLASHROM_STATS_OTHER));
+
+	free(newcontents);
+	flashrom_data_free(names);
+	assert_int_equal(0, flashrom_programmer_shutdown(flashprog));
+	flashrom_flash_release(flashctx);
+}
+#else
+	SKIP_TEST(stats_dummy_write_test_success)
+#endif /* CONFIG_DUMMY */
@@ -17,6 +17,40 @@
 #include <stdint.h>
 #include <pthread.h>
 
+static pthread_mutex_t alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void *unittest_malloc(const size_t size, const char *file, const int line)
+{
+	pthread_mutex_lock(&alloc_lock);
+	void *const ptr = _test_malloc(size, file, line);
+	pthread_mutex_unlock(&alloc_lock);
+	return ptr;
+}
+
+void *unittest_realloc(void *ptr, const size_t size, const char *file, const int line)
+{
+	pthread_mutex_lock(&alloc_lock);
+	ptr = _test_realloc(ptr, size, file, line);
+	pthread_mutex_unlock(&alloc_lock);
+	return ptr;
+}
+
+void *unittest_calloc(const size_t number_of_elements, const size_t size,
+		      const char *file, const int line)
+{
+	pthread_mutex_lock(&alloc_lock);
+	void *const ptr = _test_calloc(number_of_elements, size, file, line);
+	pthread_mutex_unlock(&alloc_lock);
+	return ptr;
+}
+
+void unittest_free(void *const ptr, const char *file, const int line)
+{
+	pthread_mutex_lock(&alloc_lock);
+	_test_free(ptr, file, line);
+	pthread_mutex_unlock(&alloc_lock);
+}
+
 void *not_null(void)
 {
 	return (void *)MOCK_FD;
@@ -43,6 +77,51 @@ void *__wrap_physmap(const char *descr, uintptr_t phys_addr, size_t len)
 	return NULL;
 }
 
+void *__wrap_physmap_ro(const char *descr, uintptr_t phys_addr, size_t len)
+{
+	LOG_ME;
+	if (get_io() && get_io()->physmap_ro)
+		return get_io()->physmap_ro(get_io()->state, descr, phys_addr, len);
+	return __real_physmap_ro(descr, phys_addr, len);
+}
+
+void __wrap_mmio_writeb(uint8_t val, void *addr)
+{
+	/* LOG_ME; */
+	if (get_io() && get_io()->mmio_writeb)
+		get_io()->mmio_writeb(get_io()->state, val, addr);
+	else
+		__real_mmio_writeb(val, addr);
+}
+
+void __wrap_mmio_writew(uint16_t val, void *addr)
+{
+	/* LOG_ME; */
+	if (get_io() && get_io()->mmio_writew)
+		get_io()->mmio_writew(get_io()->state, val, addr);
+	else
+		__real_mmio_writew(val, addr);
+}
+
+void __wrap_mmio_writel(uint32_t val, void *addr)
+{
+	/* LOG_ME; */
+	if (get_io() && get_io()->mmio_writel)
+		get_io()->mmio_writel(get_io()->state, val, addr);
+	else
+		__real_mmio_writel(val, addr);
+}
+
+/* Calls mmio_writel() in the same unit, which isn't wrapped. Tests run little-endian. */
+void __wrap_mmio_le_writel(uint32_t val, void *addr)
+{
+	/* LOG_ME; */
+	if (get_io() && get_io()->mmio_writel)
+		get_io()->mmio_writel(get_io()->state, val, addr);
+	else
+		__real_mmio_le_writel(val, addr);
+}
+
 struct pci_dev mock_pci_dev = {
 	.device_id = NON_ZERO,
 };
@@ -59,6 +138,22 @@ uintptr_t __wrap_pcidev_readbar(void *dev, int bar)
 	return NON_ZERO;
 }
 
+uint16_t __wrap_pci_read_word(struct pci_dev *dev, int pos)
+{
+	LOG_ME;
+	if (get_io() && get_io()->pci_read_word)
+		return get_io()->pci_read_word(get_io()->state, dev, pos);
+	return 0;
+}
+
+int __wrap_pci_read_block(struct pci_dev *dev, int pos, uint8_t *buf, int len)
+{
+	LOG_ME;
+	if (get_io() && get_io()->pci_read_block)
+		return get_io()->pci_read_block(get_io()->state, dev, pos, buf, len);
+	return 0;
+}
+
 void __wrap_sio_write(uint16_t port, uint8_t reg, uint8_t data)
 {
 	LOG_ME;
@@ -134,7 +229,7 @@ int __wrap___open64_2(const char *pathname, int flags, ...)
 int __wrap_fcntl(int fd, int cmd, ...)
 {
 	LOG_ME;
-	if (get_io() && get_io()->iom_ioctl) {
+	if (get_io() && get_io()->iom_fcntl) {
 		va_list args;
 		int out;
 		va_start(args, cmd);
@@ -148,7 +243,7 @@ int __wrap_fcntl(int fd, int cmd, ...)
 int __wrap_fcntl64(int fd, int cmd, ...)
 {
 	LOG_ME;
-	if (get_io() && get_io()->iom_ioctl) {
+	if (get_io() && get_io()->iom_fcntl) {
 		va_list args;
 		int out;
 		va_start(args, cmd);
@@ -189,6 +284,38 @@ int __wrap_read(int fd, void *buf, size_t sz)
 	return sz;
 }
 
+ssize_t __wrap_pread(int fd, void *buf, size_t sz, off_t offset)
+{
+	LOG_ME;
+	if (get_io() && get_io()->iom_pread)
+		return get_io()->iom_pread(get_io()->state, fd, buf, sz, offset);
+	return sz;
+}
+
+ssize_t __wrap_pread64(int fd, void *buf, size_t sz, off_t offset)
+{
+	LOG_ME;
+	if (get_io() && get_io()->iom_pread)
+		return get_io()->iom_pread(get_io()->state, fd, buf, sz, offset);
+	return sz;
+}
+
+ssize_t __wrap_pwrite(int fd, const void *buf, size_t sz, off_t offset)
+{
+	LOG_ME;
+	if (get_io() && get_io()->iom_pwrite)
+		return get_io()->iom_pwrite(get_io()->state, fd, buf, sz, offset);
+	return sz;
+}
+
+ssize_t __wrap_pwrite64(int fd, const void *buf, size_t sz, off_t offset)
+{
+	LOG_ME;
+	if (get_io() && get_io()->iom_pwrite)
+		return get_io()->iom_pwrite(get_io()->state, fd, buf, sz, offset);
+	return sz;
+}
+
 FILE *__wrap_fopen(const char *pathname, const char *mode)
 {
 	LOG_ME;
@@ -242,12 +369,16 @@ int __wrap___xstat64(const char *path, void *buf)
 int __wrap_fstat(int fd, void *buf)
 {
 	LOG_ME;
+	if (get_io() && get_io()->iom_fstat)
+		return get_io()->iom_fstat(get_io()->state, fd, buf);
 	return 0;
 }
 
 int __wrap_fstat64(int fd, void *buf)
 {
 	LOG_ME;
+	if (get_io() && get_io()->iom_fstat)
+		return get_io()->iom_fstat(get_io()->state, fd, buf);
 	return 0;
 }
 
@@ -456,6 +587,15 @@ int main(int argc, char *argv[])
 	};
 	ret |= cmocka_run_group_tests_name("helpers.c tests", helpers_tests, NULL, NULL);
 
+	const struct CMUnitTest helpers_fileio_tests[] = {
+		cmocka_unit_test(image_file_map_test_success),
+		cmocka_unit_test(image_file_replace_test_success),
+		cmocka_unit_test(image_file_create_new_test_success),
+		cmocka_unit_test(image_file_in_place_test_success),
+		cmocka_unit_test(replace_file_test_success),
+	};
+	ret |= cmocka_run_group_tests_name("helpers_fileio.c tests", helpers_fileio_tests, NULL, NULL);
+
 	const struct CMUnitTest selfcheck[] = {
 		cmocka_unit_test(selfcheck_programmer_table),
 		cmocka_unit_test(selfcheck_flashchips_table),
@@ -470,6 +610,63 @@ int main(int argc, char *argv[])
 	};
 	ret |= cmocka_run_group_tests_name("flashrom.c tests", flashrom_tests, NULL, NULL);
 
+	const struct CMUnitTest memdiff_tests[] = {
+		cmocka_unit_test(memdiff_masks_test_success),
+		cmocka_unit_test(memdiff_need_erase_test_success),
+		cmocka_unit_test(memdiff_get_next_write_test_success),
+		cmocka_unit_test(memdiff_count_test_success),
+	};
+	ret |= cmocka_run_group_tests_name("memdiff.c tests", memdiff_tests, NULL, NULL);
+
+	const struct CMUnitTest manifest_tests[] = {
+		cmocka_unit_test(sha256_test_vectors),
+		cmocka_unit_test(manifest_round_trip_test_success),
+		cmocka_unit_test(manifest_read_invalid),
+	};
+	ret |= cmocka_run_group_tests_name("manifest.c tests", manifest_tests, NULL, NULL);
+
+	const struct CMUnitTest dmi_tests[] = {
+		cmocka_unit_test(dmi_sysfs_smbios3_test_success),
+		cmocka_unit_test(dmi_sysfs_smbios2_test_success),
+		cmocka_unit_test(dmi_sysfs_broken_table_test_success),
+	};
+	ret |= cmocka_run_group_tests_name("dmi.c tests", dmi_tests, NULL, NULL);
+
+	const struct CMUnitTest ichspi_tests[] = {
+		cmocka_unit_test(ichspi_mmap_read_test_success),
+		cmocka_unit_test(ichspi_mmap_read_mismatch_test_success),
+		cmocka_unit_test(ichspi_mmap_read_invalidate_test_success),
+		cmocka_unit_test(ichspi_hwseq_read_test_success),
+	};
+	ret |= cmocka_run_group_tests_name("ichspi.c tests", ichspi_tests, NULL, NULL);
+
+	const struct CMUnitTest pcidev_tests[] = {
+		cmocka_unit_test(pcidev_index_matches_scan_test_success),
+		cmocka_unit_test(pcidev_index_duplicate_ids_test_success),
+		cmocka_unit_test(pcidev_index_swapped_pacc_test_success),
+	};
+	ret |= cmocka_run_group_tests_name("pcidev.c tests", pcidev_tests, NULL, NULL);
+
+	const struct CMUnitTest journal_tests[] = {
+		cmocka_unit_test(journal_round_trip_test_success),
+		cmocka_unit_test(journal_read_invalid),
+	};
+	ret |= cmocka_run_group_tests_name("journal.c tests", journal_tests, NULL, NULL);
+
+	const struct CMUnitTest image_index_tests[] = {
+		cmocka_unit_test(image_index_scan_test_success),
+		cmocka_unit_test(image_index_fmap_search_test_success),
+		cmocka_unit_test(image_index_to_layout_test_success),
+	};
+	ret |= cmocka_run_group_tests_name("image_index.c tests", image_index_tests, NULL, NULL);
+
+	const struct CMUnitTest stats_tests[] = {
+		cmocka_unit_test(stats_disabled_test_success),
+		cmocka_unit_test(stats_master_transfer_test_success),
+		cmocka_unit_test(stats_dummy_write_test_success),
+	};
+	ret |= cmocka_run_group_tests_name("stats.c tests", stats_tests, NULL, NULL);
+
 	const struct CMUnitTest libflashrom_tests[] = {
 		cmocka_unit_test(flashrom_set_log_callback_test_success),
 		cmocka_unit_test(flashrom_set_log_callback_v2_test_success),
@@ -491,6 +688,8 @@ int main(int argc, char *argv[])
 		cmocka_unit_test(probe_spi_res2_test_success),
 		cmocka_unit_test(probe_spi_res3_test_success),
 		cmocka_unit_test(probe_spi_at25f_test_success),
+		cmocka_unit_test(spi_poll_wip_timeout_test_success),
+		cmocka_unit_test(spi_chip_typ_busy_us_test_success),
 		cmocka_unit_test(probe_spi_st95_test_success), /* spi95.c */
 	};
 	ret |= cmocka_run_group_tests_name("spi25.c tests", spi25_tests, NULL, NULL);
@@ -512,6 +711,13 @@ int main(int argc, char *argv[])
 		cmocka_unit_test(dummy_probe_and_read),
 		cmocka_unit_test(dummy_probe_and_write),
 		cmocka_unit_test(dummy_probe_and_erase),
+		cmocka_unit_test(dummy_probe_index_matches_linear_scan),
+		cmocka_unit_test(dummy_parallel_programmers_test_success),
+		cmocka_unit_test(dummy_multi_io_read_test_success),
+		cmocka_unit_test(dummy_timing_model_test_success),
+		cmocka_unit_test(trace_record_replay_test_success),
+		cmocka_unit_test(trace_replay_divergence_test_success),
+		cmocka_unit_test(trace_summary_wip_polling_test_success),
 		cmocka_unit_test(nicrealtek_basic_lifecycle_test_success),
 		cmocka_unit_test(raiden_debug_basic_lifecycle_test_success),
 		cmocka_unit_test(raiden_debug_targetAP_basic_lifecycle_test_success),
@@ -519,8 +725,15 @@ int main(int argc, char *argv[])
 		cmocka_unit_test(raiden_debug_target0_basic_lifecycle_test_success),
 		cmocka_unit_test(raiden_debug_target1_basic_lifecycle_test_success),
 		cmocka_unit_test(dediprog_basic_lifecycle_test_success),
+		cmocka_unit_test(dediprog_unaligned_bulk_test_success),
 		cmocka_unit_test(linux_mtd_probe_lifecycle_test_success),
+		cmocka_unit_test(linux_mtd_erase_dirty_runs_test_success),
+		cmocka_unit_test(linux_mtd_erase_regions_test_success),
+		cmocka_unit_test(linux_mtd_erase_odd_size_test_success),
 		cmocka_unit_test(linux_spi_probe_lifecycle_test_success),
+		cmocka_unit_test(linux_spi_multicommand_test_success),
+		cmocka_unit_test(linux_spi_quad_read_test_success),
+		cmocka_unit_test(linux_spi_quad_io_read_test_success),
 		cmocka_unit_test(parade_lspcon_basic_lifecycle_test_success),
 		cmocka_unit_test(parade_lspcon_no_allow_brick_test_success),
 		cmocka_unit_test(mediatek_i2c_spi_basic_lifecycle_test_success),
@@ -529,7 +742,15 @@ int main(int argc, char *argv[])
 		cmocka_unit_test(realtek_mst_no_allow_brick_test_success),
 		cmocka_unit_test(ch341a_spi_basic_lifecycle_test_success),
 		cmocka_unit_test(ch341a_spi_probe_lifecycle_test_success),
+		cmocka_unit_test(ch341a_spi_read_pipelined_test_success),
+		cmocka_unit_test(ft2232_spi_basic_lifecycle_test_success),
+		cmocka_unit_test(ft2232_spi_probe_lifecycle_test_success),
+		cmocka_unit_test(ft2232_spi_async_read_test_success),
+		cmocka_unit_test(ft2232_spi_async_write_test_success),
 		cmocka_unit_test(spidriver_probe_lifecycle_test_success),
+		cmocka_unit_test(serprog_pipelined_write_test_success),
+		cmocka_unit_test(serprog_legacy_write_test_success),
+		cmocka_unit_test(serprog_ear_read_test_success),
 		cmocka_unit_test(nv_sma_spi_basic_lifecycle_test_success),
 	};
 	ret |= cmocka_run_group_tests_name("lifecycle.c tests", lifecycle_tests, NULL, NULL);
@@ -557,6 +778,13 @@ int main(int argc, char *argv[])
 		cmocka_unit_test(write_chip_feature_no_erase),
 		cmocka_unit_test(write_chip_feature_no_erase_with_progress),
 		cmocka_unit_test(write_nonaligned_region_with_dummyflasher_test_success),
+		cmocka_unit_test(write_plan_test_success),
+		cmocka_unit_test(write_plan_cost_planner_test_success),
+		cmocka_unit_test(write_chip_trust_manifest_test_success),
+		cmocka_unit_test(write_chip_stale_manifest_test_success),
+		cmocka_unit_test(erase_chip_manifest_test_success),
+		cmocka_unit_test(write_chip_resume_journal_test_success),
+		cmocka_unit_test(write_chip_resume_journal_erase_test_success),
 		cmocka_unit_test(verify_chip_test_success),
 		cmocka_unit_test(verify_chip_with_dummyflasher_test_success),
 	};
@@ -567,6 +795,13 @@ int main(int argc, char *argv[])
 	};
 	ret |= cmocka_run_group_tests_name("udelay.c tests", delay_tests, NULL, NULL);
 
+	const struct CMUnitTest serve_tests[] = {
+		cmocka_unit_test(serve_framing_test_success),
+		cmocka_unit_test(serve_read_write_test_success),
+		cmocka_unit_test(serve_layout_test_success),
+	};
+	ret |= cmocka_run_group_tests_name("serve.c tests", serve_tests, NULL, NULL);
+
 	size_t n_erase_tests;
 	struct CMUnitTest *erase_func_algo_tests = get_erase_func_algo_tests(&n_erase_tests);
 	ret |= _cmocka_run_group_tests("erase_func_algo.c tests", erase_func_algo_tests, n_erase_tests, NULL, NULL);
@@ -20,9 +20,57 @@ void tolower_string_test_success(void **state);
 void reverse_byte_test_success(void **state);
 void reverse_bytes_test_success(void **state);
 
+/* helpers_fileio.c */
+void image_file_map_test_success(void **state);
+void image_file_replace_test_success(void **state);
+void image_file_create_new_test_success(void **state);
+void image_file_in_place_test_success(void **state);
+void replace_file_test_success(void **state);
+
 /* flashrom.c */
 void flashbuses_to_text_test_success(void **state);
 
+/* memdiff.c */
+void memdiff_masks_test_success(void **state);
+void memdiff_need_erase_test_success(void **state);
+void memdiff_get_next_write_test_success(void **state);
+void memdiff_count_test_success(void **state);
+
+/* manifest.c */
+void sha256_test_vectors(void **state);
+void manifest_round_trip_test_success(void **state);
+void manifest_read_invalid(void **state);
+
+/* dmi.c */
+void dmi_sysfs_smbios3_test_success(void **state);
+void dmi_sysfs_smbios2_test_success(void **state);
+void dmi_sysfs_broken_table_test_success(void **state);
+
+/* ichspi.c */
+void ichspi_mmap_read_test_success(void **state);
+void ichspi_mmap_read_mismatch_test_success(void **state);
+void ichspi_mmap_read_invalidate_test_success(void **state);
+void ichspi_hwseq_read_test_success(void **state);
+
+/* pcidev.c */
+void pcidev_index_matches_scan_test_success(void **state);
+void pcidev_index_duplicate_ids_test_success(void **state);
+void pcidev_index_swapped_pacc_test_success(void **state);
+
+/* journal.c */
+void journal_round_trip_test_success(void **state);
+void journal_read_invalid(void **state);
+
+/* image_index.c */
+void image_index_scan_test_success(void **state);
+void image_index_fmap_search_test_success(void **state);
+void image_index_to_layout_test_success(void **state);
+
+/* stats.c */
+void stats_disabled_test_success(void **state);
+void stats_master_transfer_test_success(void **state);
+void stats_dummy_write_test_success(void **state);
+
 /* libflashrom.c */
 void flashrom_set_log_callback_test_success(void **state);
 void flashrom_set_log_callback_v2_test_success(void **state);
@@ -42,6 +90,8 @@ void probe_spi_res1_test_success(void **state);
 void probe_spi_res2_test_success(void **state);
 void probe_spi_res3_test_success(void **state);
 void probe_spi_at25f_test_success(void **state);
+void spi_poll_wip_timeout_test_success(void **state);
+void spi_chip_typ_busy_us_test_success(void **state);
 void probe_spi_st95_test_success(void **state); /* spi95.c */
 
 /* lifecycle.c */
@@ -61,6 +111,13 @@ void dummy_freq_param_init(void **state);
 void dummy_probe_and_read(void **state);
 void dummy_probe_and_write(void **state);
 void dummy_probe_and_erase(void **state);
+void dummy_probe_index_matches_linear_scan(void **state);
+void dummy_parallel_programmers_test_success(void **state);
+void dummy_multi_io_read_test_success(void **state);
+void dummy_timing_model_test_success(void **state);
+void trace_record_replay_test_success(void **state);
+void trace_replay_divergence_test_success(void **state);
+void trace_summary_wip_polling_test_success(void **state);
 void nicrealtek_basic_lifecycle_test_success(void **state);
 void raiden_debug_basic_lifecycle_test_success(void **state);
 void raiden_debug_targetAP_basic_lifecycle_test_success(void **state);
@@ -68,8 +125,15 @@ void raiden_debug_targetEC_basic_lifecycle_test_success(void **state);
 void raiden_debug_target0_basic_lifecycle_test_success(void **state);
 void raiden_debug_target1_basic_lifecycle_test_success(void **state);
 void dediprog_basic_lifecycle_test_success(void **state);
+void dediprog_unaligned_bulk_test_success(void **state);
 void linux_mtd_probe_lifecycle_test_success(void **state);
+void linux_mtd_erase_dirty_runs_test_success(void **state);
+void linux_mtd_erase_regions_test_success(void **state);
+void linux_mtd_erase_odd_size_test_success(void **state);
 void linux_spi_probe_lifecycle_test_success(void **state);
+void linux_spi_multicommand_test_success(void **state);
+void linux_spi_quad_read_test_success(void **state);
+void linux_spi_quad_io_read_test_success(void **state);
 void parade_lspcon_basic_lifecycle_test_success(void **state);
 void parade_lspcon_no_allow_brick_test_success(void **state);
 void mediatek_i2c_spi_basic_lifecycle_test_success(void **state);
@@ -78,7 +142,15 @@ void realtek_mst_basic_lifecycle_test_success(void **state);
 void realtek_mst_no_allow_brick_test_success(void **state);
 void ch341a_spi_basic_lifecycle_test_success(void **state);
 void ch341a_spi_probe_lifecycle_test_success(void **state);
+void ch341a_spi_read_pipelined_test_success(void **state);
+void ft2232_spi_basic_lifecycle_test_success(void **state);
+void ft2232_spi_probe_lifecycle_test_success(void **state);
+void ft2232_spi_async_read_test_success(void **state);
+void ft2232_spi_async_write_test_success(void **state);
 void spidriver_probe_lifecycle_test_success(void **state);
+void serprog_pipelined_write_test_success(void **state);
+void serprog_legacy_write_test_success(void **state);
+void serprog_ear_read_test_success(void **state);
 void nv_sma_spi_basic_lifecycle_test_success(void **state);
 
 /* layout.c */
@@ -102,6 +174,13 @@ void write_chip_with_dummyflasher_test_success(void **state);
 void write_chip_feature_no_erase(void **state);
 void write_chip_feature_no_erase_with_progress(void **state);
 void write_nonaligned_region_with_dummyflasher_test_success(void **state);
+void write_plan_test_success(void **state);
+void write_plan_cost_planner_test_success(void **state);
+void write_chip_trust_manifest_test_success(void **state);
+void write_chip_stale_manifest_test_success(void **state);
+void erase_chip_manifest_test_success(void **state);
+void write_chip_resume_journal_test_success(void **state);
+void write_chip_resume_journal_erase_test_success(void **state);
 void verify_chip_test_success(void **state);
 void verify_chip_with_dummyflasher_test_success(void **state);
 
@@ -129,4 +208,9 @@ void write_function_algo_test_success(void **state);
 /* udelay.c */
 void udelay_test_short(void **state);
 
+/* serve.c */
+void serve_framing_test_success(void **state);
+void serve_read_write_test_success(void **state);
+void serve_layout_test_success(void **state);
+
 #endif /* TESTS_H */
@@ -0,0 +1,242 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ *
+ * Records a session with the timed dummyflasher and replays it with the
+ * replay programmer. The trace is kept in memory.
+ */
+
+#include "lifecycle.h"
+#include "chipdrivers.h"
+#include "trace.h"
+
+#if CONFIG_DUMMY == 1 && CONFIG_REPLAY == 1
+
+#define TRACE_PATH	"trace.bin"
+#define TRACE_START	0x1000
+#define TRACE_LEN	(4 * KiB)
+
+struct trace_io_state {
+	uint8_t *buf;
+	size_t len;
+	size_t size;
+	size_t pos;
+};
+
+static FILE *trace_fopen(void *state, const char *pathname, const char *mode)
+{
+	struct trace_io_state *io_state = state;
+
+	assert_string_equal(TRACE_PATH, pathname);
+	if (mode[0] == 'w')
+		io_state->len = 0;
+	io_state->pos = 0;
+	return not_null();
+}
+
+static size_t trace_fwrite(void *state, const void *buf, size_t size, size_t len, FILE *fp)
+{
+	struct trace_io_state *io_state = state;
+
+	if (io_state->len + size * len > io_state->size) {
+		io_state->size = (io_state->len + size * len) * 2;
+		io_state->buf = realloc(io_state->buf, io_state->size);
+		assert_non_null(io_state->buf);
+	}
+	memcpy(io_state->buf + io_state->len, buf, size * len);
+	io_state->len += size * len;
+	return len;
+}
+
+static size_t trace_fread(void *state, void *buf, size_t size, size_t len, FILE *fp)
+{
+	struct trace_io_state *io_state = state;
+	const size_t count = min(size * len, io_state->len - io_state->pos);
+
+	memcpy(buf, io_state->buf + io_state->pos, count);
+	io_state->pos += count;
+	return count / size;
+}
+
+static int trace_fclose(void *state, FILE *fp)
+{
+	return 0;
+}
+
+/* Erases, writes and reads back a sector, counting the commands sent. */
+static int run_session(const char *prog_name, const char *param, struct trace_io_state *io_state, bool record,
+		       const uint8_t *buf, uint8_t *readback, struct flashrom_stats *stats)
+{
+	struct flashrom_programmer *flashprog = NULL;
+	struct flashrom_flashctx *flashctx = NULL;
+	const char **names = NULL;
+	const struct io_mock trace_io = {
+		.state		= io_state,
+		.iom_fopen	= trace_fopen,
+		.iom_fwrite	= trace_fwrite,
+		.iom_fread	= trace_fread,
+		.iom_fclose	= trace_fclose,
+	};
+	int ret;
+
+	io_mock_register(&trace_io);
+	assert_int_equal(0, flashrom_create_context(&flashctx));
+	if (record)
+		assert_int_equal(0, flashrom_trace_start(flashctx, TRACE_PATH));
+	assert_int_equal(0, flashrom_stats_enable(flashctx, true));
+	assert_int_equal(0, flashrom_programmer_init(&flashprog, prog_name, param));
+	assert_int_equal(1, flashrom_flash_probe_v2(flashctx, &names, flashprog, "W25Q128.V"));
+
+	ret = spi_block_erase_20(flashctx, TRACE_START, TRACE_LEN);
+	ret |= write_flash(flashctx, buf, TRACE_START, TRACE_LEN);
+	ret |= read_flash(flashctx, readback, TRACE_START, TRACE_LEN);
+	assert_int_equal(0, flashrom_stats_get(flashctx, stats));
+
+	flashrom_data_free(names);
+	assert_int_equal(0, flashrom_trace_stop(flashctx));
+	flashrom_flash_release(flashctx);
+	assert_int_equal(0, flashrom_programmer_shutdown(flashprog));
+	io_mock_register(NULL);
+	return ret;
+}
+
+static void fill(uint8_t *buf, size_t len, unsigned int seed)
+{
+	for (size_t i = 0; i < len; i++)
+		buf[i] = i * seed + (i >> 8);
+}
+
+void trace_record_replay_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct trace_io_state io_state = { 0 };
+	uint8_t buf[TRACE_LEN], recorded[TRACE_LEN], replayed[TRACE_LEN];
+	struct flashrom_stats *const record_stats = malloc(sizeof(*record_stats));
+	struct flashrom_stats *const replay_stats = malloc(sizeof(*replay_stats));
+	assert_non_null(record_stats);
+	assert_non_null(replay_stats);
+
+	fill(buf, sizeof(buf), 7);
+	/* A tenth of the W25Q128FV times, the erase is polled for. */
+	assert_int_equal(0, run_session("dummy", "bus=spi,emulate=W25Q128FV,timing=yes,timing_scale=10",
+					&io_state, true, buf, recorded, record_stats));
+	assert_memory_equal(buf, recorded, sizeof(buf));
+	assert_memory_equal(TRACE_MAGIC, io_state.buf, strlen(TRACE_MAGIC));
+
+	assert_int_equal(0, run_session("replay", "trace=" TRACE_PATH ",timing=no",
+					&io_state, false, buf, replayed, replay_stats));
+	assert_memory_equal(buf, replayed, sizeof(buf));
+
+	/* Only the number of status polls may differ. */
+	for (int i = 0; i < 256; i++) {
+		if (i != JEDEC_RDSR)
+			assert_int_equal(record_stats->opcode[i].count, replay_stats->opcode[i].count);
+	}
+	assert_int_equal(1, replay_stats->opcode[JEDEC_SE].busy_count);
+	assert_int_equal(TRACE_LEN / 256, replay_stats->opcode[JEDEC_BYTE_PROGRAM].busy_count);
+	/* The erase kept the replayed chip busy for more than its first poll. */
+	assert_true(replay_stats->stage[FLASHROM_STATS_OTHER].wip_polls > 1 + TRACE_LEN / 256);
+
+	free(record_stats);
+	free(replay_stats);
+	free(io_state.buf);
+}
+
+void trace_replay_divergence_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct trace_io_state io_state = { 0 };
+	uint8_t buf[TRACE_LEN], readback[TRACE_LEN];
+	struct flashrom_stats *const stats = malloc(sizeof(*stats));
+	assert_non_null(stats);
+
+	fill(buf, sizeof(buf), 3);
+	assert_int_equal(0, run_session("dummy", "bus=spi,emulate=W25Q128FV", &io_state, true, buf, readback, stats));
+
+	/* Programming other data than recorded finds no page program to match. */
+	fill(buf, sizeof(buf), 5);
+	assert_int_not_equal(0, run_session("replay", "trace=" TRACE_PATH, &io_state, false, buf, readback, stats));
+
+	free(stats);
+	free(io_state.buf);
+}
+
+static void append_command(struct trace_file *trace, uint64_t *now_ns, uint8_t opcode,
+			   unsigned int writecnt, unsigned int readcnt)
+{
+	uint8_t writearr[JEDEC_MAX_ADDR_LEN + 1 + 256] = { opcode };
+	uint8_t readarr[256] = { 0 };
+	const struct trace_record rec = {
+		.type		= TRACE_SPI,
+		.start_ns	= *now_ns,
+		.duration_ns	= 1000,
+		.writecnt	= writecnt,
+		.readcnt	= readcnt,
+		.writearr	= writearr,
+		.readarr	= readarr,
+	};
+
+	assert_int_equal(0, trace_append(trace, &rec));
+	*now_ns += 2000;
+}
+
+void trace_summary_wip_polling_test_success(void **state)
+{
+	(void) state; /* unused */
+
+	struct trace_io_state io_state = { 0 };
+	const struct io_mock trace_io = {
+		.state		= &io_state,
+		.iom_fopen	= trace_fopen,
+		.iom_fwrite	= trace_fwrite,
+		.iom_fread	= trace_fread,
+		.iom_fclose	= trace_fclose,
+	};
+	struct trace_summary *const sum = malloc(sizeof(*sum));
+	uint64_t now_ns = 0;
+	assert_non_null(sum);
+
+	io_mock_register(&trace_io);
+	struct trace_file *trace = trace_create(TRACE_PATH);
+	assert_non_null(trace);
+	append_command(trace, &now_ns, JEDEC_WREN, 1, 0);
+	append_command(trace, &now_ns, JEDEC_SE, JEDEC_SE_OUTSIZE, 0);
+	/* spi_read_register() reads two bytes. */
+	for (int i = 0; i < 3; i++)
+		append_command(trace, &now_ns, JEDEC_RDSR, 1, 2);
+	append_command(trace, &now_ns, JEDEC_WREN, 1, 0);
+	append_command(trace, &now_ns, JEDEC_BYTE_PROGRAM, JEDEC_BYTE_PROGRAM_OUTSIZE + 15, 0);
+	for (int i = 0; i < 2; i++)
+		append_command(trace, &now_ns, JEDEC_RDSR, 1, 2);
+	append_command(trace, &now_ns, JEDEC_READ, JEDEC_READ_OUTSIZE, 16);
+	for (int i = 0; i < 2; i++)
+		append_command(trace, &now_ns, JEDEC_RDSR, 1, JEDEC_RDSR_INSIZE);
+	assert_int_equal(0, trace_close(trace));
+
+	trace = trace_open(TRACE_PATH);
+	assert_non_null(trace);
+	assert_int_equal(0, trace_summarize(trace, sum));
+	assert_int_equal(0, trace_close(trace));
+	io_mock_register(NULL);
+
+	assert_int_equal(12, sum->records);
+	assert_int_equal(12, sum->commands);
+	assert_int_equal(7, sum->opcode[JEDEC_RDSR].count);
+	assert_int_equal(5 * (1 + 2) + 2 * (1 + 1), sum->opcode[JEDEC_RDSR].bytes);
+	/* Every status read of a run but its first one. */
+	assert_int_equal(2 + 1 + 1, sum->rdsr_polls);
+	assert_int_equal(5 * 2 + 16 + 2 * 1, sum->bytes_in);
+	assert_int_equal(now_ns - 1000, sum->end_ns);
+
+	free(sum);
+	free(io_state.buf);
+}
+
+#else
+	SKIP_TEST(trace_record_replay_test_success)
+	SKIP_TEST(trace_replay_divergence_test_success)
+	SKIP_TEST(trace_summary_wip_polling_test_success)
+#endif /* CONFIG_DUMMY && CONFIG_REPLAY */
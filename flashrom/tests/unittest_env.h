@@ -13,6 +13,10 @@
  * See flashrom_test_dep in meson.build for more details.
  *
  * https://api.cmocka.org/group__cmocka__alloc.html
+ *
+ * cmocka's allocation tracking is not thread safe, so the calls go through
+ * wrappers in tests.c which serialise them for tests that run programmers in
+ * several threads.
  */
 
 extern void* _test_malloc(const size_t size, const char* file, const int line);
@@ -21,6 +25,12 @@ extern void* _test_calloc(const size_t number_of_elements, const size_t size,
                         const char* file, const int line);
 extern void _test_free(void* const ptr, const char* file, const int line);
 
+extern void *unittest_malloc(const size_t size, const char *file, const int line);
+extern void *unittest_realloc(void *ptr, const size_t size, const char *file, const int line);
+extern void *unittest_calloc(const size_t number_of_elements, const size_t size,
+			     const char *file, const int line);
+extern void unittest_free(void *const ptr, const char *file, const int line);
+
 #ifdef malloc
 #undef malloc
 #endif
@@ -34,7 +44,7 @@ extern void _test_free(void* const ptr, const char* file, const int line);
 #undef free
 #endif
 
-#define malloc(size) _test_malloc(size, __FILE__, __LINE__)
-#define realloc(ptr, size) _test_realloc(ptr, size, __FILE__, __LINE__)
-#define calloc(num, size) _test_calloc(num, size, __FILE__, __LINE__)
-#define free(ptr) _test_free(ptr, __FILE__, __LINE__)
+#define malloc(size) unittest_malloc(size, __FILE__, __LINE__)
+#define realloc(ptr, size) unittest_realloc(ptr, size, __FILE__, __LINE__)
+#define calloc(num, size) unittest_calloc(num, size, __FILE__, __LINE__)
+#define free(ptr) unittest_free(ptr, __FILE__, __LINE__)
@@ -9,6 +9,7 @@
 #define WRAPS_H
 
 #include <stdio.h>
+#include <sys/types.h>
 #include "flash.h"
 
 struct programmer_cfg; /* defined in programmer.h */
@@ -17,8 +18,20 @@ struct termios;
 char *__wrap_strdup(const char *s);
 void __wrap_physunmap(void *virt_addr, size_t len);
 void *__wrap_physmap(const char *descr, uintptr_t phys_addr, size_t len);
+void *__wrap_physmap_ro(const char *descr, uintptr_t phys_addr, size_t len);
+void *__real_physmap_ro(const char *descr, uintptr_t phys_addr, size_t len);
+void __wrap_mmio_writeb(uint8_t val, void *addr);
+void __real_mmio_writeb(uint8_t val, void *addr);
+void __wrap_mmio_writew(uint16_t val, void *addr);
+void __real_mmio_writew(uint16_t val, void *addr);
+void __wrap_mmio_writel(uint32_t val, void *addr);
+void __real_mmio_writel(uint32_t val, void *addr);
+void __wrap_mmio_le_writel(uint32_t val, void *addr);
+void __real_mmio_le_writel(uint32_t val, void *addr);
 struct pci_dev *__wrap_pcidev_init(const struct programmer_cfg *cfg, void *devs, int bar);
 uintptr_t __wrap_pcidev_readbar(void *dev, int bar);
+uint16_t __wrap_pci_read_word(struct pci_dev *dev, int pos);
+int __wrap_pci_read_block(struct pci_dev *dev, int pos, uint8_t *buf, int len);
 void __wrap_sio_write(uint16_t port, uint8_t reg, uint8_t data);
 uint8_t __wrap_sio_read(uint16_t port, uint8_t reg);
 int __wrap_open(const char *pathname, int flags, ...);
@@ -29,7 +42,12 @@ int __wrap_fcntl(int fd, int cmd, ...);
 int __wrap_fcntl64(int fd, int cmd, ...);
 int __wrap_ioctl(int fd, unsigned long int request, ...);
 int __wrap_write(int fd, const void *buf, size_t sz);
+int __real_write(int fd, const void *buf, size_t sz);
 int __wrap_read(int fd, void *buf, size_t sz);
+ssize_t __wrap_pread(int fd, void *buf, size_t sz, off_t offset);
+ssize_t __wrap_pread64(int fd, void *buf, size_t sz, off_t offset);
+ssize_t __wrap_pwrite(int fd, const void *buf, size_t sz, off_t offset);
+ssize_t __wrap_pwrite64(int fd, const void *buf, size_t sz, off_t offset);
 FILE *__wrap_fopen(const char *pathname, const char *mode);
 FILE *__real_fopen(const char *pathname, const char *mode);
 FILE *__wrap_fopen64(const char *pathname, const char *mode);
@@ -40,6 +58,7 @@ int __wrap_stat64(const char *path, void *buf);
 int __wrap___xstat(const char *path, void *buf);
 int __wrap___xstat64(const char *path, void *buf);
 int __wrap_fstat(int fd, void *buf);
+int __real_fstat(int fd, void *buf);
 int __wrap_fstat64(int fd, void *buf);
 int __wrap___fstat50(int fd, void *buf);
 int __wrap___fxstat(int fd, void *buf);
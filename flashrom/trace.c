@@ -0,0 +1,207 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Records the bus traffic of a flash context into a trace file. The SPI core,
+ * the opaque dispatchers and programmer_delay() report to the functions here,
+ * which do nothing unless tracing was started with flashrom_trace_start().
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flash.h"
+#include "libflashrom.h"
+#include "programmer.h"
+#include "spi.h"
+#include "stats.h"
+#include "trace.h"
+
+struct trace_capture {
+	struct trace_file *file;
+	uint64_t t0_ns;
+	/* Master of the last record, a TRACE_MASTER record is emitted when it changes. */
+	const struct registered_master *mst;
+	uint64_t last_start_ns;
+	uint64_t commands;
+	bool failed;
+};
+
+static struct trace_capture *capture(const struct flashctx *flash)
+{
+	if (!flash || !flash->trace || flash->trace->failed)
+		return NULL;
+	return flash->trace;
+}
+
+/* Records are written when they end, one that encloses others is moved behind their start. */
+static uint64_t since_start(struct trace_capture *tc, uint64_t ns)
+{
+	const uint64_t start_ns = ns > tc->t0_ns ? ns - tc->t0_ns : 0;
+	if (start_ns > tc->last_start_ns)
+		tc->last_start_ns = start_ns;
+	return tc->last_start_ns;
+}
+
+static void append(struct trace_capture *tc, const struct trace_record *rec)
+{
+	if (!trace_append(tc->file, rec))
+		return;
+	msg_gerr("Writing the trace failed: %s. Tracing stopped.\n", strerror(errno));
+	tc->failed = true;
+}
+
+/* Fills in the timing of rec and announces a change of the master before it. */
+static void begin_record(const struct flashctx *flash, struct trace_capture *tc, struct trace_record *rec,
+			 enum trace_type type, uint64_t start_ns)
+{
+	const uint64_t now = stats_time_ns();
+
+	if (tc->mst != flash->mst) {
+		const struct trace_record master = {
+			.type = TRACE_MASTER,
+			.start_ns = since_start(tc, start_ns),
+			.buses = flash->mst->buses_supported,
+			.features = flash->mst->buses_supported & BUS_SPI ? flash->mst->spi.features : 0,
+			.max_data_read = flash->mst->buses_supported & BUS_SPI ? flash->mst->spi.max_data_read : 0,
+			.max_data_write = flash->mst->buses_supported & BUS_SPI ? flash->mst->spi.max_data_write : 0,
+		};
+		append(tc, &master);
+		tc->mst = flash->mst;
+	}
+
+	memset(rec, 0, sizeof(*rec));
+	rec->type = type;
+	rec->start_ns = since_start(tc, start_ns);
+	rec->duration_ns = now > start_ns ? now - start_ns : 0;
+}
+
+uint64_t trace_begin(const struct flashctx *flash)
+{
+	return capture(flash) ? stats_time_ns() : 0;
+}
+
+static void append_command(struct trace_capture *tc, struct trace_record *rec, const struct spi_command *cmd)
+{
+	rec->io_mode = cmd->io_mode;
+	rec->dummy_cycles = cmd->dummy_cycles;
+	rec->writecnt = cmd->writecnt;
+	rec->readcnt = cmd->readcnt;
+	rec->writearr = cmd->writearr;
+	rec->readarr = cmd->readarr;
+	append(tc, rec);
+	tc->commands++;
+}
+
+void trace_command(const struct flashctx *flash, unsigned int writecnt, unsigned int readcnt,
+		   const unsigned char *writearr, const unsigned char *readarr, int ret, uint64_t start_ns)
+{
+	struct trace_capture *const tc = capture(flash);
+	if (!tc)
+		return;
+
+	const struct spi_command cmd = {
+		.writecnt = writecnt,
+		.readcnt = readcnt,
+		.writearr = writearr,
+		.readarr = (unsigned char *)readarr,
+	};
+	struct trace_record rec;
+	begin_record(flash, tc, &rec, TRACE_SPI, start_ns);
+	rec.ret = ret;
+	append_command(tc, &rec, &cmd);
+}
+
+void trace_multicommand(const struct flashctx *flash, const struct spi_command *cmds, int ret, uint64_t start_ns)
+{
+	struct trace_capture *const tc = capture(flash);
+	if (!tc)
+		return;
+
+	struct trace_record rec;
+	begin_record(flash, tc, &rec, TRACE_SPI, start_ns);
+	const uint64_t duration_ns = rec.duration_ns;
+
+	/* The batch is timed as a whole, its duration goes to the last command. */
+	for (; cmds->writecnt || cmds->readcnt; cmds++) {
+		const bool last = !cmds[1].writecnt && !cmds[1].readcnt;
+		rec.flags = last ? 0 : TRACE_SPI_BATCHED;
+		rec.duration_ns = last ? duration_ns : 0;
+		rec.ret = last ? ret : 0;
+		append_command(tc, &rec, cmds);
+	}
+}
+
+void trace_range(const struct flashctx *flash, enum trace_type type, unsigned int addr, unsigned int len,
+		 const uint8_t *data, int ret, uint64_t start_ns)
+{
+	struct trace_capture *const tc = capture(flash);
+	if (!tc)
+		return;
+
+	struct trace_record rec;
+	begin_record(flash, tc, &rec, type, start_ns);
+	rec.ret = ret;
+	rec.addr = addr;
+	rec.len = len;
+	if (type == TRACE_SPI_READ || type == TRACE_OPAQUE_READ)
+		rec.readarr = data;
+	append(tc, &rec);
+}
+
+void trace_delay(const struct flashctx *flash, unsigned int usecs, uint64_t start_ns)
+{
+	struct trace_capture *const tc = capture(flash);
+	if (!tc)
+		return;
+
+	struct trace_record rec;
+	begin_record(flash, tc, &rec, TRACE_DELAY, start_ns);
+	rec.usecs = usecs;
+	append(tc, &rec);
+}
+
+uint64_t trace_commands(const struct flashctx *flash)
+{
+	const struct trace_capture *const tc = capture(flash);
+	return tc ? tc->commands : 0;
+}
+
+int flashrom_trace_start(struct flashrom_flashctx *const flashctx, const char *const path)
+{
+	if (flashrom_trace_stop(flashctx))
+		return 1;
+
+	struct trace_capture *const tc = calloc(1, sizeof(*tc));
+	if (!tc) {
+		msg_gerr("Out of memory!\n");
+		return 1;
+	}
+	tc->file = trace_create(path);
+	if (!tc->file) {
+		msg_gerr("Error: Cannot create trace file %s: %s\n", path, strerror(errno));
+		free(tc);
+		return 1;
+	}
+	tc->t0_ns = stats_time_ns();
+	flashctx->trace = tc;
+	return 0;
+}
+
+int flashrom_trace_stop(struct flashrom_flashctx *const flashctx)
+{
+	struct trace_capture *const tc = flashctx->trace;
+	if (!tc)
+		return 0;
+
+	flashctx->trace = NULL;
+	int ret = tc->failed;
+	if (trace_close(tc->file)) {
+		msg_gerr("Error: Writing the trace failed: %s\n", strerror(errno));
+		ret = 1;
+	}
+	free(tc);
+	return ret;
+}
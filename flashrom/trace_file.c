@@ -0,0 +1,382 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Encoding of bus traces, see trace.h for the format. Kept free of the rest
+ * of flashrom so tools can use it.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+#define TRACE_BUF_SIZE	(64 * 1024)
+#define JEDEC_RDSR	0x05
+
+struct trace_file {
+	FILE *fp;
+	bool writing;
+	bool failed;
+	uint64_t last_start_ns;
+	/* Write buffer, or read buffer and the part of it not parsed yet. */
+	uint8_t buf[TRACE_BUF_SIZE];
+	size_t pos;
+	size_t len;
+	/* Arrays of the last record read. */
+	uint8_t *data;
+	size_t data_size;
+};
+
+static void flush_buf(struct trace_file *trace)
+{
+	if (trace->pos && fwrite(trace->buf, 1, trace->pos, trace->fp) != trace->pos)
+		trace->failed = true;
+	trace->pos = 0;
+}
+
+static void put_bytes(struct trace_file *trace, const void *data, size_t len)
+{
+	if (trace->pos + len > sizeof(trace->buf))
+		flush_buf(trace);
+	if (len > sizeof(trace->buf)) {
+		if (fwrite(data, 1, len, trace->fp) != len)
+			trace->failed = true;
+		return;
+	}
+	if (len)
+		memcpy(trace->buf + trace->pos, data, len);
+	trace->pos += len;
+}
+
+static void put_u8(struct trace_file *trace, uint8_t value)
+{
+	put_bytes(trace, &value, 1);
+}
+
+static void put_varint(struct trace_file *trace, uint64_t value)
+{
+	uint8_t bytes[10];
+	size_t len = 0;
+
+	do {
+		bytes[len] = value & 0x7f;
+		value >>= 7;
+		if (value)
+			bytes[len] |= 0x80;
+		len++;
+	} while (value);
+	put_bytes(trace, bytes, len);
+}
+
+static void put_svarint(struct trace_file *trace, int64_t value)
+{
+	put_varint(trace, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+struct trace_file *trace_create(const char *path)
+{
+	struct trace_file *const trace = calloc(1, sizeof(*trace));
+	if (!trace)
+		return NULL;
+
+	trace->fp = fopen(path, "wb");
+	if (!trace->fp) {
+		free(trace);
+		return NULL;
+	}
+	trace->writing = true;
+	put_bytes(trace, TRACE_MAGIC, strlen(TRACE_MAGIC));
+	put_u8(trace, TRACE_VERSION);
+	return trace;
+}
+
+int trace_append(struct trace_file *trace, const struct trace_record *rec)
+{
+	if (!trace->writing || rec->start_ns < trace->last_start_ns) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	put_u8(trace, rec->type);
+	put_varint(trace, rec->start_ns - trace->last_start_ns);
+	put_varint(trace, rec->duration_ns);
+	trace->last_start_ns = rec->start_ns;
+
+	switch (rec->type) {
+	case TRACE_MASTER:
+		put_varint(trace, rec->buses);
+		put_varint(trace, rec->features);
+		put_varint(trace, rec->max_data_read);
+		put_varint(trace, rec->max_data_write);
+		break;
+	case TRACE_SPI:
+		put_u8(trace, rec->flags);
+		put_u8(trace, rec->io_mode);
+		put_u8(trace, rec->dummy_cycles);
+		put_svarint(trace, rec->ret);
+		put_varint(trace, rec->writecnt);
+		put_varint(trace, rec->readcnt);
+		put_bytes(trace, rec->writearr, rec->writecnt);
+		put_bytes(trace, rec->readarr, rec->readcnt);
+		break;
+	case TRACE_SPI_READ:
+	case TRACE_OPAQUE_READ:
+		put_svarint(trace, rec->ret);
+		put_varint(trace, rec->addr);
+		put_varint(trace, rec->len);
+		put_bytes(trace, rec->readarr, rec->len);
+		break;
+	case TRACE_SPI_WRITE:
+	case TRACE_OPAQUE_WRITE:
+	case TRACE_OPAQUE_ERASE:
+		put_svarint(trace, rec->ret);
+		put_varint(trace, rec->addr);
+		put_varint(trace, rec->len);
+		break;
+	case TRACE_DELAY:
+		put_varint(trace, rec->usecs);
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (trace->failed) {
+		errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
+/* Reads len bytes, returns 1 if the trace ends before the first one. */
+static int get_bytes(struct trace_file *trace, void *data, size_t len)
+{
+	uint8_t *dest = data;
+	size_t got = 0;
+
+	while (got < len) {
+		if (trace->pos == trace->len) {
+			trace->pos = 0;
+			trace->len = fread(trace->buf, 1, sizeof(trace->buf), trace->fp);
+			if (!trace->len)
+				break;
+		}
+		const size_t chunk = len - got < trace->len - trace->pos ? len - got : trace->len - trace->pos;
+		memcpy(dest + got, trace->buf + trace->pos, chunk);
+		trace->pos += chunk;
+		got += chunk;
+	}
+	if (got == len)
+		return 0;
+	if (got == 0)
+		return 1;
+	errno = EINVAL;
+	return -1;
+}
+
+static int get_u8(struct trace_file *trace, uint8_t *value)
+{
+	return get_bytes(trace, value, 1) ? -1 : 0;
+}
+
+static int get_varint(struct trace_file *trace, uint64_t *value)
+{
+	*value = 0;
+	for (unsigned int shift = 0; shift < 64; shift += 7) {
+		uint8_t byte;
+		if (get_u8(trace, &byte))
+			return -1;
+		*value |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return 0;
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+static int get_u32(struct trace_file *trace, uint32_t *value)
+{
+	uint64_t wide;
+	if (get_varint(trace, &wide))
+		return -1;
+	if (wide > UINT32_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+	*value = wide;
+	return 0;
+}
+
+static int get_ret(struct trace_file *trace, int *ret)
+{
+	uint64_t zigzag;
+	if (get_varint(trace, &zigzag))
+		return -1;
+	*ret = (int)(int64_t)((zigzag >> 1) ^ -(zigzag & 1));
+	return 0;
+}
+
+/* Reads len bytes into the record data at offset. */
+static int get_data(struct trace_file *trace, size_t offset, size_t len)
+{
+	if (offset + len > trace->data_size) {
+		uint8_t *const data = realloc(trace->data, offset + len);
+		if (!data)
+			return -1;
+		trace->data = data;
+		trace->data_size = offset + len;
+	}
+	return get_bytes(trace, trace->data + offset, len) ? -1 : 0;
+}
+
+struct trace_file *trace_open(const char *path)
+{
+	struct trace_file *const trace = calloc(1, sizeof(*trace));
+	if (!trace)
+		return NULL;
+
+	trace->fp = fopen(path, "rb");
+	if (!trace->fp) {
+		free(trace);
+		return NULL;
+	}
+
+	uint8_t header[sizeof(TRACE_MAGIC)];
+	if (get_bytes(trace, header, sizeof(header)) ||
+	    memcmp(header, TRACE_MAGIC, strlen(TRACE_MAGIC)) || header[strlen(TRACE_MAGIC)] != TRACE_VERSION) {
+		trace_close(trace);
+		errno = EINVAL;
+		return NULL;
+	}
+	return trace;
+}
+
+int trace_next(struct trace_file *trace, struct trace_record *rec)
+{
+	uint8_t type;
+	uint64_t delta;
+
+	const int ret = get_bytes(trace, &type, 1);
+	if (ret)
+		return ret;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->type = type;
+	if (get_varint(trace, &delta) || get_varint(trace, &rec->duration_ns))
+		return -1;
+	trace->last_start_ns += delta;
+	rec->start_ns = trace->last_start_ns;
+
+	switch (rec->type) {
+	case TRACE_MASTER:
+		if (get_u32(trace, &rec->buses) || get_u32(trace, &rec->features) ||
+		    get_u32(trace, &rec->max_data_read) || get_u32(trace, &rec->max_data_write))
+			return -1;
+		break;
+	case TRACE_SPI:
+		if (get_u8(trace, &rec->flags) || get_u8(trace, &rec->io_mode) ||
+		    get_u8(trace, &rec->dummy_cycles) || get_ret(trace, &rec->ret) ||
+		    get_u32(trace, &rec->writecnt) || get_u32(trace, &rec->readcnt) ||
+		    get_data(trace, 0, (size_t)rec->writecnt + rec->readcnt))
+			return -1;
+		rec->writearr = trace->data;
+		rec->readarr = trace->data + rec->writecnt;
+		break;
+	case TRACE_SPI_READ:
+	case TRACE_OPAQUE_READ:
+		if (get_ret(trace, &rec->ret) || get_u32(trace, &rec->addr) || get_u32(trace, &rec->len) ||
+		    get_data(trace, 0, rec->len))
+			return -1;
+		rec->readarr = trace->data;
+		break;
+	case TRACE_SPI_WRITE:
+	case TRACE_OPAQUE_WRITE:
+	case TRACE_OPAQUE_ERASE:
+		if (get_ret(trace, &rec->ret) || get_u32(trace, &rec->addr) || get_u32(trace, &rec->len))
+			return -1;
+		break;
+	case TRACE_DELAY:
+		if (get_u32(trace, &rec->usecs))
+			return -1;
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+int trace_summarize(struct trace_file *trace, struct trace_summary *sum)
+{
+	struct trace_record rec;
+	bool polling = false;
+	int ret;
+
+	memset(sum, 0, sizeof(*sum));
+	while (!(ret = trace_next(trace, &rec))) {
+		sum->records++;
+		if (rec.start_ns + rec.duration_ns > sum->end_ns)
+			sum->end_ns = rec.start_ns + rec.duration_ns;
+		if (rec.type != TRACE_MASTER)
+			sum->modelled_ns += rec.duration_ns;
+		if (rec.ret)
+			sum->errors++;
+
+		switch (rec.type) {
+		case TRACE_MASTER:
+			break;
+		case TRACE_SPI: {
+			/* Status registers are read with more than one byte, e.g. by spi_read_register(). */
+			const bool rdsr = rec.writecnt == 1 && rec.readcnt >= 1 && rec.writearr[0] == JEDEC_RDSR;
+			/* Every status read after the first of a run is a poll. */
+			if (rdsr && polling)
+				sum->rdsr_polls++;
+			polling = rdsr;
+			sum->commands++;
+			sum->bytes_out += rec.writecnt;
+			sum->bytes_in += rec.readcnt;
+			if (rec.writecnt) {
+				struct trace_opcode_summary *const op = &sum->opcode[rec.writearr[0]];
+				op->count++;
+				op->bytes += rec.writecnt + rec.readcnt;
+				op->time_ns += rec.duration_ns;
+			}
+			break;
+		}
+		case TRACE_SPI_READ:
+		case TRACE_SPI_WRITE:
+			sum->bulk_bytes += rec.len;
+			break;
+		case TRACE_DELAY:
+			sum->delays++;
+			sum->delay_us += rec.usecs;
+			break;
+		default:
+			sum->opaque_ops++;
+			break;
+		}
+	}
+	return ret < 0 ? -1 : 0;
+}
+
+int trace_close(struct trace_file *trace)
+{
+	if (!trace)
+		return 0;
+
+	if (trace->writing)
+		flush_buf(trace);
+	if (fclose(trace->fp))
+		trace->failed = true;
+
+	const int ret = trace->failed ? -1 : 0;
+	free(trace->data);
+	free(trace);
+	if (ret)
+		errno = EIO;
+	return ret;
+}
@@ -0,0 +1,514 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Times flashrom's operations against chips emulated by the dummy programmer,
+ * and some of the helpers they spend their time in on their own, and prints
+ * the results as JSON. Run it with `meson test --benchmark` and compare the
+ * output of two builds to see what a change costs.
+ */
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "flash.h"
+#include "erasure_layout.h"
+#include "fmap.h"
+#include "libflashrom.h"
+
+#define DEFAULT_MAX_SIZE	(256 * MiB)
+#define DIRTY_BLOCK_SIZE	(4 * KiB)
+#define FMAP_AREAS		64
+#define MICRO_MIN_NS		200000000ULL
+#define MICRO_BUF_SIZE		(64 * KiB)
+
+struct bench_chip {
+	const char *params;	/* Parameters of the dummy programmer, %zu is replaced by the size. */
+	const char *name;
+	size_t size;
+};
+
+static const struct bench_chip spi_chips[] = {
+	{ "bus=spi,emulate=MX25L6436", "MX25L6436E/MX25L6445E/MX25L6465E", 8 * MiB },
+	{ "bus=spi,emulate=W25Q128FV", "W25Q128.V", 16 * MiB },
+};
+
+/* Only the opaque VARIABLE_SIZE chip comes in any size. */
+static const size_t opaque_sizes[] = { 1 * MiB, 4 * MiB, 16 * MiB, 64 * MiB, 256 * MiB };
+
+/* Percentage of 4 KiB blocks changed from one write to the next, the first one writes an erased chip. */
+static const unsigned int dirty_percents[] = { 100, 50, 10, 1, 0 };
+
+static uint64_t allocations;
+static uint64_t allocated_bytes;
+
+#if defined(BENCH_WRAP_MALLOC)
+/* The allocators are wrapped at link time, see meson.build. */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t nmemb, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	allocations++;
+	allocated_bytes += size;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	allocations++;
+	allocated_bytes += nmemb * size;
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	allocations++;
+	allocated_bytes += size;
+	return __real_realloc(ptr, size);
+}
+#endif
+
+struct sample {
+	uint64_t start_ns;
+	uint64_t allocations;
+	uint64_t allocated_bytes;
+};
+
+static volatile uint64_t sink;
+static bool first_record;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static long peak_rss_kib(void)
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage))
+		return -1;
+#if defined(__APPLE__)
+	return usage.ru_maxrss / 1024;	/* bytes */
+#else
+	return usage.ru_maxrss;
+#endif
+}
+
+static void sample_begin(struct sample *sample)
+{
+	sample->allocations = allocations;
+	sample->allocated_bytes = allocated_bytes;
+	sample->start_ns = now_ns();
+}
+
+static int log_errors(enum flashrom_log_level level, const char *format, va_list args)
+{
+	if (level > FLASHROM_MSG_ERROR)
+		return 0;
+	return vfprintf(stderr, format, args);
+}
+
+static void begin_record(void)
+{
+	printf("%s\n    {", first_record ? "" : ",");
+	first_record = false;
+}
+
+static void print_workload(const char *workload, const struct bench_chip *chip, int dirty_percent,
+			   const struct sample *sample, struct flashrom_flashctx *flashctx, bool ok)
+{
+	const uint64_t elapsed_ns = now_ns() - sample->start_ns;
+	struct flashrom_stats stats;
+	struct flashrom_stage_stats total = { 0 };
+
+	if (flashctx && !flashrom_stats_get(flashctx, &stats)) {
+		for (int i = 0; i < FLASHROM_STATS_NR; i++) {
+			total.transactions += stats.stage[i].transactions;
+			total.bytes_out += stats.stage[i].bytes_out;
+			total.bytes_in += stats.stage[i].bytes_in;
+			total.wip_polls += stats.stage[i].wip_polls;
+			total.delays += stats.stage[i].delays;
+		}
+	}
+
+	begin_record();
+	printf("\"workload\": \"%s\", \"chip\": \"%s\", \"size\": %zu, ", workload, chip->name, chip->size);
+	if (dirty_percent >= 0)
+		printf("\"dirty_percent\": %d, ", dirty_percent);
+	printf("\"ok\": %s, \"seconds\": %.6f, ", ok ? "true" : "false", elapsed_ns / 1e9);
+	if (strcmp(workload, "probe"))
+		printf("\"mib_per_s\": %.3f, ", (double)chip->size / MiB / (elapsed_ns / 1e9));
+	printf("\"transactions\": %" PRIu64 ", \"bytes_out\": %" PRIu64 ", \"bytes_in\": %" PRIu64
+	       ", \"wip_polls\": %" PRIu64 ", \"delays\": %" PRIu64 ", ",
+	       total.transactions, total.bytes_out, total.bytes_in, total.wip_polls, total.delays);
+	printf("\"allocations\": %" PRIu64 ", \"allocated_bytes\": %" PRIu64 ", \"peak_rss_kib\": %ld}",
+	       allocations - sample->allocations, allocated_bytes - sample->allocated_bytes, peak_rss_kib());
+
+	/* Start the next workload with fresh statistics. */
+	if (flashctx)
+		flashrom_stats_enable(flashctx, true);
+}
+
+static void fill_random(uint8_t *buf, size_t len, uint64_t seed)
+{
+	uint64_t x = seed | 1;
+	for (size_t i = 0; i < len; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		buf[i] = x;
+	}
+}
+
+/* Puts an fmap with FMAP_AREAS areas into the last 4 KiB of the image. */
+static void put_fmap(uint8_t *image, size_t size)
+{
+	const size_t area_size = (size - 4 * KiB) / FMAP_AREAS;
+	struct fmap *const fmap = (struct fmap *)(image + size - 4 * KiB);
+
+	memset(fmap, 0, sizeof(*fmap) + (FMAP_AREAS + 1) * sizeof(fmap->areas[0]));
+	memcpy(fmap->signature, FMAP_SIGNATURE, sizeof(fmap->signature));
+	fmap->ver_major = FMAP_VER_MAJOR;
+	fmap->ver_minor = FMAP_VER_MINOR;
+	fmap->size = size;
+	strcpy((char *)fmap->name, "BENCH");
+	fmap->nareas = FMAP_AREAS + 1;
+	for (int i = 0; i < FMAP_AREAS; i++) {
+		fmap->areas[i].offset = i * area_size;
+		fmap->areas[i].size = area_size;
+		snprintf((char *)fmap->areas[i].name, FMAP_STRLEN, "AREA_%d", i);
+	}
+	fmap->areas[FMAP_AREAS].offset = size - 4 * KiB;
+	fmap->areas[FMAP_AREAS].size = 4 * KiB;
+	strcpy((char *)fmap->areas[FMAP_AREAS].name, "FMAP");
+}
+
+/* Changes dirty_percent of the 4 KiB blocks of the image, spread evenly, but never the fmap. */
+static void dirty_image(uint8_t *image, size_t size, unsigned int dirty_percent, unsigned int round)
+{
+	const size_t blocks = size / DIRTY_BLOCK_SIZE - 1;
+	for (size_t i = 0; i < blocks; i++) {
+		if ((i * 37) % 100 >= dirty_percent)
+			continue;
+		uint8_t *const block = image + i * DIRTY_BLOCK_SIZE;
+		for (size_t j = 0; j < DIRTY_BLOCK_SIZE; j++)
+			block[j] ^= 0xa5 ^ round;
+	}
+}
+
+static int probe(struct flashrom_flashctx **flashctx, struct flashrom_programmer *flashprog, const char *chip_name)
+{
+	const char **names = NULL;
+
+	if (flashrom_create_context(flashctx))
+		return 1;
+	flashrom_stats_enable(*flashctx, true);
+	const int ret = flashrom_flash_probe_v2(*flashctx, &names, flashprog, chip_name);
+	flashrom_data_free(names);
+	return chip_name ? ret != 1 : ret < 1;
+}
+
+static int bench_chip(const struct bench_chip *chip)
+{
+	struct flashrom_programmer *flashprog = NULL;
+	struct flashrom_flashctx *flashctx = NULL;
+	struct flashrom_layout *layout = NULL;
+	struct sample sample;
+	char params[128];
+	int ret = 1;
+	bool ok;
+
+	uint8_t *const image = malloc(chip->size);
+	uint8_t *const readback = malloc(chip->size);
+	if (!image || !readback) {
+		fprintf(stderr, "Error: Out of memory!\n");
+		goto out;
+	}
+	fill_random(image, chip->size, chip->size);
+	put_fmap(image, chip->size);
+
+	snprintf(params, sizeof(params), chip->params, chip->size);
+	if (flashrom_programmer_init(&flashprog, "dummy", params)) {
+		fprintf(stderr, "Error: Cannot initialize dummy:%s\n", params);
+		goto out;
+	}
+
+	/* A probe for all chips, like the CLI does without -c. */
+	sample_begin(&sample);
+	ok = !probe(&flashctx, flashprog, NULL);
+	print_workload("probe", chip, -1, &sample, flashctx, ok);
+	flashrom_flash_release(flashctx);
+
+	if (probe(&flashctx, flashprog, chip->name)) {
+		fprintf(stderr, "Error: %s not found on dummy:%s\n", chip->name, params);
+		goto shutdown;
+	}
+	flashrom_flag_set(flashctx, FLASHROM_FLAG_VERIFY_AFTER_WRITE, false);
+
+	sample_begin(&sample);
+	ok = !flashrom_layout_read_fmap_from_buffer(&layout, flashctx, image, chip->size);
+	print_workload("layout", chip, -1, &sample, flashctx, ok);
+	flashrom_layout_release(layout);
+
+	sample_begin(&sample);
+	ok = !flashrom_flash_erase(flashctx);
+	print_workload("erase", chip, -1, &sample, flashctx, ok);
+
+	for (size_t i = 0; i < ARRAY_SIZE(dirty_percents); i++) {
+		if (i > 0)
+			dirty_image(image, chip->size, dirty_percents[i], i);
+		sample_begin(&sample);
+		ok = !flashrom_image_write(flashctx, image, chip->size, NULL);
+		print_workload("write", chip, dirty_percents[i], &sample, flashctx, ok);
+	}
+
+	sample_begin(&sample);
+	ok = !flashrom_image_verify(flashctx, image, chip->size);
+	print_workload("verify", chip, -1, &sample, flashctx, ok);
+
+	sample_begin(&sample);
+	ok = !flashrom_image_read(flashctx, readback, chip->size) && !memcmp(image, readback, chip->size);
+	print_workload("read", chip, -1, &sample, flashctx, ok);
+
+	ret = 0;
+shutdown:
+	flashrom_flash_release(flashctx);
+	flashrom_programmer_shutdown(flashprog);
+out:
+	free(image);
+	free(readback);
+	return ret;
+}
+
+struct micro_bench {
+	const char *name;
+	size_t bytes_per_op;	/* 0 if throughput means nothing for it */
+	void (*run)(void *arg);
+	void *arg;
+};
+
+/* Repeats the operation, doubling the count, until it ran for long enough. */
+static void run_micro(const struct micro_bench *bench)
+{
+	uint64_t iterations = 1, elapsed_ns;
+	struct sample sample;
+
+	for (;; iterations *= 2) {
+		sample_begin(&sample);
+		for (uint64_t i = 0; i < iterations; i++)
+			bench->run(bench->arg);
+		elapsed_ns = now_ns() - sample.start_ns;
+		if (elapsed_ns >= MICRO_MIN_NS)
+			break;
+	}
+
+	begin_record();
+	printf("\"benchmark\": \"%s\", \"iterations\": %" PRIu64 ", \"ns_per_op\": %.1f, ",
+	       bench->name, iterations, (double)elapsed_ns / iterations);
+	if (bench->bytes_per_op)
+		printf("\"mib_per_s\": %.3f, ",
+		       (double)bench->bytes_per_op * iterations / MiB / (elapsed_ns / 1e9));
+	printf("\"allocations_per_op\": %.2f}", (double)(allocations - sample.allocations) / iterations);
+}
+
+struct compare_args {
+	const uint8_t *have;
+	const uint8_t *want;
+	size_t len;
+	enum write_granularity gran;
+};
+
+static void run_need_erase(void *arg)
+{
+	const struct compare_args *const args = arg;
+	sink += need_erase(args->have, args->want, args->len, args->gran, 0xff);
+}
+
+/* Walks the buffer like the erase and write planner does. */
+static void run_get_next_write(void *arg)
+{
+	const struct compare_args *const args = arg;
+	unsigned int start = 0, len;
+
+	while ((len = get_next_write(args->have + start, args->want + start, args->len - start,
+				     &start, args->gran))) {
+		sink += len;
+		start += len;
+	}
+}
+
+struct fmap_args {
+	const uint8_t *image;
+	size_t size;
+};
+
+/* fmap_lsearch() is static, this is it plus a copy of the fmap found. */
+static void run_fmap_lsearch(void *arg)
+{
+	const struct fmap_args *const args = arg;
+	struct fmap *fmap = NULL;
+
+	sink += fmap_read_from_buffer(&fmap, args->image, args->size);
+	free(fmap);
+}
+
+static void run_create_erase_layout(void *arg)
+{
+	struct flashctx *const flashctx = arg;
+	struct erase_layout *layout = NULL;
+
+	const int count = create_erase_layout(flashctx, &layout);
+	if (count > 0)
+		free_erase_layout(layout, count);
+	sink += count;
+}
+
+static int bench_micro(void)
+{
+	const struct bench_chip *const chip = &spi_chips[ARRAY_SIZE(spi_chips) - 1];
+	struct flashrom_programmer *flashprog = NULL;
+	struct flashrom_flashctx *flashctx = NULL;
+	int ret = 1;
+
+	uint8_t *const have = malloc(MICRO_BUF_SIZE);
+	uint8_t *const want = malloc(MICRO_BUF_SIZE);
+	uint8_t *const same = malloc(MICRO_BUF_SIZE);
+	uint8_t *const pages = malloc(MICRO_BUF_SIZE);
+	uint8_t *const image = malloc(chip->size);
+	if (!have || !want || !same || !pages || !image) {
+		fprintf(stderr, "Error: Out of memory!\n");
+		goto out;
+	}
+
+	/* No erase is needed, so need_erase() has to look at all of it. */
+	fill_random(have, MICRO_BUF_SIZE, 1);
+	for (size_t i = 0; i < MICRO_BUF_SIZE; i++)
+		want[i] = have[i] & 0xf0;
+	memcpy(same, have, MICRO_BUF_SIZE);
+	const struct compare_args no_erase = { have, want, MICRO_BUF_SIZE, WRITE_GRAN_1BIT };
+	const struct compare_args no_erase_256 = { have, same, MICRO_BUF_SIZE, WRITE_GRAN_256BYTES };
+
+	/* Every other page differs. */
+	memcpy(pages, have, MICRO_BUF_SIZE);
+	for (size_t i = 0; i < MICRO_BUF_SIZE; i += 512)
+		pages[i + 17] ^= 0xff;
+	const struct compare_args alternate_pages = { have, pages, MICRO_BUF_SIZE, WRITE_GRAN_256BYTES };
+	const struct compare_args alternate_bytes = { have, pages, MICRO_BUF_SIZE, WRITE_GRAN_1BYTE };
+
+	fill_random(image, chip->size, 2);
+	put_fmap(image, chip->size);
+	const struct fmap_args fmap_image = { image, chip->size };
+
+	if (flashrom_programmer_init(&flashprog, "dummy", chip->params)) {
+		fprintf(stderr, "Error: Cannot initialize dummy:%s\n", chip->params);
+		goto out;
+	}
+	if (probe(&flashctx, flashprog, chip->name)) {
+		fprintf(stderr, "Error: %s not found on dummy:%s\n", chip->name, chip->params);
+		goto shutdown;
+	}
+
+	const struct micro_bench benches[] = {
+		{ "need_erase/1bit/64KiB", MICRO_BUF_SIZE, run_need_erase, (void *)&no_erase },
+		{ "need_erase/256bytes/64KiB", MICRO_BUF_SIZE, run_need_erase, (void *)&no_erase_256 },
+		{ "get_next_write/256bytes/64KiB", MICRO_BUF_SIZE, run_get_next_write, (void *)&alternate_pages },
+		{ "get_next_write/1byte/64KiB", MICRO_BUF_SIZE, run_get_next_write, (void *)&alternate_bytes },
+		{ "fmap_lsearch/16MiB", chip->size, run_fmap_lsearch, (void *)&fmap_image },
+		{ "create_erase_layout/W25Q128.V", 0, run_create_erase_layout, flashctx },
+	};
+	for (size_t i = 0; i < ARRAY_SIZE(benches); i++)
+		run_micro(&benches[i]);
+
+	ret = 0;
+shutdown:
+	flashrom_flash_release(flashctx);
+	flashrom_programmer_shutdown(flashprog);
+out:
+	free(have);
+	free(want);
+	free(same);
+	free(pages);
+	free(image);
+	return ret;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [--max-size=<MiB>]\n\n"
+		"Benchmarks flashrom against chips emulated by the dummy programmer up to\n"
+		"the given size, %d MiB by default, and prints the results as JSON.\n",
+		name, DEFAULT_MAX_SIZE / MiB);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t max_size = DEFAULT_MAX_SIZE;
+	int ret = 0;
+
+	if (argc > 2) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (argc == 2) {
+		char *end;
+		if (strncmp(argv[1], "--max-size=", strlen("--max-size="))) {
+			usage(argv[0]);
+			return 1;
+		}
+		max_size = strtoul(argv[1] + strlen("--max-size="), &end, 0) * MiB;
+		if (*end != '\0' || !max_size) {
+			fprintf(stderr, "Error: Invalid size \"%s\".\n", argv[1]);
+			return 1;
+		}
+	}
+
+	flashrom_set_log_callback(log_errors);
+	if (flashrom_init(1)) {
+		fprintf(stderr, "Error: flashrom_init() failed.\n");
+		return 1;
+	}
+
+	printf("{\n  \"flashrom\": \"%s\",\n  \"allocations_counted\": %s,\n  \"workloads\": [",
+	       flashrom_version_info(),
+#if defined(BENCH_WRAP_MALLOC)
+	       "true"
+#else
+	       "false"
+#endif
+	       );
+	first_record = true;
+	for (size_t i = 0; i < ARRAY_SIZE(spi_chips); i++) {
+		if (spi_chips[i].size <= max_size)
+			ret |= bench_chip(&spi_chips[i]);
+	}
+	for (size_t i = 0; i < ARRAY_SIZE(opaque_sizes); i++) {
+		const struct bench_chip chip = {
+			"bus=prog,emulate=VARIABLE_SIZE,size=%zu", "Opaque flash chip", opaque_sizes[i]
+		};
+		if (chip.size <= max_size)
+			ret |= bench_chip(&chip);
+	}
+
+	printf("\n  ],\n  \"micro\": [");
+	first_record = true;
+	ret |= bench_micro();
+	printf("\n  ]\n}\n");
+
+	flashrom_shutdown();
+	return ret;
+}
@@ -0,0 +1,375 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Client of `flashrom --serve <socket>`. Takes the flashrom options scripts
+ * commonly use, so that `flashrom -p internal -r file` can become
+ * `flashrom_client -r file` while the server keeps the programmer open.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "libflashrom.h"
+#include "serve.h"
+
+#define DEFAULT_SOCKET	"/run/flashrom.sock"
+
+enum {
+	OPTION_IFD = 0x0100,
+	OPTION_FMAP,
+	OPTION_FLASH_NAME,
+	OPTION_FLASH_SIZE,
+	OPTION_WP_STATUS,
+	OPTION_WP_SET_RANGE,
+	OPTION_WP_SET_REGION,
+	OPTION_WP_ENABLE,
+	OPTION_WP_DISABLE,
+	OPTION_SHUTDOWN,
+};
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-S <socket>] [-p <ignored>] [-l <layoutfile>|--ifd|--fmap] [-i <region>]...\n"
+	       "       [-n] [-N] (-r <file>|-w <file>|-v <file>|--flash-name|--flash-size|\n"
+	       "       --wp-status|[--wp-range <start>,<len>|--wp-region <region>]\n"
+	       "       [--wp-enable|--wp-disable]|--shutdown)\n\n"
+	       " -S | --socket <socket>     socket of `flashrom --serve`, defaults to\n"
+	       "                            $FLASHROM_SOCKET or " DEFAULT_SOCKET "\n"
+	       " -p | --programmer <name>   accepted for compatibility, the server's\n"
+	       "                            programmer is used\n"
+	       "All other options work like flashrom's.\n", name);
+}
+
+static int connect_to(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Error: Socket path \"%s\" is too long.\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	const int sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (sock < 0 || connect(sock, (const struct sockaddr *)&addr, sizeof(addr))) {
+		fprintf(stderr, "Error: Connecting to \"%s\" failed: %s\n", path, strerror(errno));
+		if (sock >= 0)
+			close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+static int call(int sock, struct serve_request *req, int fd, struct serve_reply *reply, int *reply_fd)
+{
+	req->magic = SERVE_MAGIC;
+	req->version = SERVE_VERSION;
+	int ret = serve_send(sock, req, sizeof(*req), fd);
+	if (!ret) {
+		/* The server is busy until it replies, just wait for it. */
+		do {
+			ret = serve_recv(sock, reply, sizeof(*reply), reply_fd);
+		} while (ret < 0 && errno == EINTR);
+	}
+	if (ret) {
+		fprintf(stderr, "Error: Request to the server failed: %s\n", strerror(errno));
+		return 1;
+	}
+	if (reply->magic != SERVE_MAGIC || reply->version != SERVE_VERSION) {
+		fprintf(stderr, "Error: Invalid reply from the server.\n");
+		return 1;
+	}
+	return reply->ret;
+}
+
+/* Copies a file into a new memfd, the server maps it. */
+static int file_to_memfd(const char *filename, uint64_t *size)
+{
+	FILE *file = fopen(filename, "rb");
+	struct stat st;
+
+	if (!file || fstat(fileno(file), &st)) {
+		fprintf(stderr, "Error: Opening \"%s\" failed: %s\n", filename, strerror(errno));
+		if (file)
+			fclose(file);
+		return -1;
+	}
+
+	const int fd = serve_memfd("flashrom-image", st.st_size);
+	void *buf = MAP_FAILED;
+	if (fd >= 0 && st.st_size)
+		buf = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (fd < 0 || (st.st_size && buf == MAP_FAILED)) {
+		fprintf(stderr, "Error: Creating the image failed: %s\n", strerror(errno));
+		goto _err;
+	}
+	if (st.st_size && fread(buf, 1, st.st_size, file) != (size_t)st.st_size) {
+		fprintf(stderr, "Error: Reading \"%s\" failed.\n", filename);
+		goto _err;
+	}
+	if (st.st_size)
+		munmap(buf, st.st_size);
+	fclose(file);
+	*size = st.st_size;
+	return fd;
+
+_err:
+	if (buf != MAP_FAILED)
+		munmap(buf, st.st_size);
+	if (fd >= 0)
+		close(fd);
+	fclose(file);
+	return -1;
+}
+
+static int memfd_to_file(int fd, uint64_t size, const char *filename)
+{
+	void *const buf = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (buf == MAP_FAILED) {
+		fprintf(stderr, "Error: Mapping the image failed: %s\n", strerror(errno));
+		return 1;
+	}
+
+	int ret = 1;
+	FILE *file = fopen(filename, "wb");
+	if (!file) {
+		fprintf(stderr, "Error: Opening \"%s\" failed: %s\n", filename, strerror(errno));
+	} else {
+		const bool written = fwrite(buf, 1, size, file) == size;
+		if (fclose(file) || !written)
+			fprintf(stderr, "Error: Writing \"%s\" failed.\n", filename);
+		else
+			ret = 0;
+	}
+	munmap(buf, size);
+	return ret;
+}
+
+static int append_region(char *regions, const char *name)
+{
+	const size_t len = strlen(regions);
+
+	if (len + !!len + strlen(name) >= SERVE_REGIONS_LEN || strchr(name, ',') || strchr(name, ':')) {
+		fprintf(stderr, "Error: Invalid region \"%s\", only plain region names are supported.\n", name);
+		return 1;
+	}
+	sprintf(regions + len, "%s%s", len ? "," : "", name);
+	return 0;
+}
+
+static const char *wp_mode_name(uint32_t mode)
+{
+	switch (mode) {
+	case FLASHROM_WP_MODE_DISABLED:		return "disabled";
+	case FLASHROM_WP_MODE_HARDWARE:		return "hardware";
+	case FLASHROM_WP_MODE_POWER_CYCLE:	return "power_cycle";
+	case FLASHROM_WP_MODE_PERMANENT:	return "permanent";
+	default:				return "unknown";
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct option long_options[] = {
+		{"socket",		1, NULL, 'S'},
+		{"programmer",		1, NULL, 'p'},
+		{"read",		1, NULL, 'r'},
+		{"write",		1, NULL, 'w'},
+		{"verify",		1, NULL, 'v'},
+		{"noverify",		0, NULL, 'n'},
+		{"noverify-all",	0, NULL, 'N'},
+		{"layout",		1, NULL, 'l'},
+		{"ifd",			0, NULL, OPTION_IFD},
+		{"fmap",		0, NULL, OPTION_FMAP},
+		{"include",		1, NULL, 'i'},
+		{"flash-name",		0, NULL, OPTION_FLASH_NAME},
+		{"flash-size",		0, NULL, OPTION_FLASH_SIZE},
+		{"wp-status",		0, NULL, OPTION_WP_STATUS},
+		{"wp-range",		1, NULL, OPTION_WP_SET_RANGE},
+		{"wp-region",		1, NULL, OPTION_WP_SET_REGION},
+		{"wp-enable",		0, NULL, OPTION_WP_ENABLE},
+		{"wp-disable",		0, NULL, OPTION_WP_DISABLE},
+		{"shutdown",		0, NULL, OPTION_SHUTDOWN},
+		{"help",		0, NULL, 'h'},
+		{NULL,			0, NULL, 0},
+	};
+	const char *socket_path = getenv("FLASHROM_SOCKET");
+	const char *filename = NULL, *layoutfile = NULL;
+	struct serve_request req = { .op = 0 };
+	struct serve_request layout_req = { .layout_source = SERVE_LAYOUT_DEFAULT };
+	bool print_name = false, print_size = false;
+	int opt, ops = 0;
+
+	while ((opt = getopt_long(argc, argv, "S:p:r:w:v:nNl:i:h", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'S':
+			socket_path = optarg;
+			break;
+		case 'p':
+			break;
+		case 'r':
+		case 'w':
+		case 'v':
+			req.op = opt == 'r' ? SERVE_OP_READ : opt == 'w' ? SERVE_OP_WRITE : SERVE_OP_VERIFY;
+			filename = optarg;
+			ops++;
+			break;
+		case 'n':
+			req.flags |= SERVE_NOVERIFY;
+			break;
+		case 'N':
+			req.flags |= SERVE_NOVERIFY_ALL;
+			break;
+		case 'l':
+			layoutfile = optarg;
+			layout_req.layout_source = SERVE_LAYOUT_FILE;
+			break;
+		case OPTION_IFD:
+			layout_req.layout_source = SERVE_LAYOUT_IFD;
+			break;
+		case OPTION_FMAP:
+			layout_req.layout_source = SERVE_LAYOUT_FMAP;
+			break;
+		case 'i':
+			if (append_region(req.regions, optarg))
+				return 1;
+			break;
+		case OPTION_FLASH_NAME:
+		case OPTION_FLASH_SIZE:
+			req.op = SERVE_OP_INFO;
+			print_name = opt == OPTION_FLASH_NAME;
+			print_size = opt == OPTION_FLASH_SIZE;
+			ops++;
+			break;
+		case OPTION_WP_STATUS:
+			if (req.op != SERVE_OP_WP_WRITE) {
+				req.op = SERVE_OP_WP_READ;
+				ops++;
+			}
+			break;
+		case OPTION_WP_SET_RANGE: {
+			unsigned long long start, len;
+			char extra;
+			if (sscanf(optarg, "%lli,%lli%c", &start, &len, &extra) != 2) {
+				fprintf(stderr, "Error: Invalid range \"%s\".\n", optarg);
+				return 1;
+			}
+			req.wp_start = start;
+			req.wp_len = len;
+			req.flags |= SERVE_WP_SET_RANGE;
+			break;
+		}
+		case OPTION_WP_SET_REGION:
+			if (append_region(req.regions, optarg))
+				return 1;
+			req.flags |= SERVE_WP_SET_REGION;
+			break;
+		case OPTION_WP_ENABLE:
+		case OPTION_WP_DISABLE:
+			req.wp_mode = opt == OPTION_WP_ENABLE ? FLASHROM_WP_MODE_HARDWARE : FLASHROM_WP_MODE_DISABLED;
+			req.flags |= SERVE_WP_SET_MODE;
+			break;
+		case OPTION_SHUTDOWN:
+			req.op = SERVE_OP_SHUTDOWN;
+			ops++;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	/* Like flashrom, WP changes may come without another operation. */
+	if (req.flags & (SERVE_WP_SET_MODE | SERVE_WP_SET_RANGE | SERVE_WP_SET_REGION)) {
+		if (req.op == SERVE_OP_WP_READ)
+			ops--;
+		req.op = SERVE_OP_WP_WRITE;
+		ops++;
+	}
+	/* Like `flashrom -p <programmer>` without an operation, just show the chip. */
+	if (!ops) {
+		req.op = SERVE_OP_INFO;
+		ops++;
+	}
+	if (optind < argc || ops != 1) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (!socket_path)
+		socket_path = DEFAULT_SOCKET;
+
+	const int sock = connect_to(socket_path);
+	if (sock < 0)
+		return 1;
+
+	struct serve_reply reply;
+	int ret = 0, fd = -1, reply_fd = -1;
+
+	if (layout_req.layout_source != SERVE_LAYOUT_DEFAULT) {
+		layout_req.op = SERVE_OP_LAYOUT;
+		if (layout_req.layout_source == SERVE_LAYOUT_FILE &&
+		    (fd = file_to_memfd(layoutfile, &layout_req.image_size)) < 0)
+			ret = 1;
+		if (!ret)
+			ret = call(sock, &layout_req, fd, &reply, &reply_fd);
+		if (fd >= 0)
+			close(fd);
+		fd = -1;
+		if (ret)
+			fprintf(stderr, "Error: Setting the layout failed.\n");
+	}
+
+	if (!ret && (req.op == SERVE_OP_WRITE || req.op == SERVE_OP_VERIFY) &&
+	    (fd = file_to_memfd(filename, &req.image_size)) < 0)
+		ret = 1;
+	if (!ret)
+		ret = call(sock, &req, fd, &reply, &reply_fd);
+	if (fd >= 0)
+		close(fd);
+
+	if (!ret) {
+		switch (req.op) {
+		case SERVE_OP_INFO:
+			if (!print_name && !print_size)
+				printf("Found %s flash chip \"%s\" (%"PRIu64" kB) on %s.\n",
+				       reply.chip_vendor, reply.chip_name, reply.chip_size / 1024, socket_path);
+			if (print_name)
+				printf("vendor=\"%s\" name=\"%s\"\n", reply.chip_vendor, reply.chip_name);
+			if (print_size)
+				printf("%"PRIu64"\n", reply.chip_size);
+			break;
+		case SERVE_OP_READ:
+			ret = reply_fd < 0 ? 1 : memfd_to_file(reply_fd, reply.image_size, filename);
+			break;
+		case SERVE_OP_WP_READ:
+		case SERVE_OP_WP_WRITE:
+			printf("Protection range: start=0x%08"PRIx64" length=0x%08"PRIx64"\n",
+			       reply.wp_start, reply.wp_len);
+			printf("Protection mode: %s\n", wp_mode_name(reply.wp_mode));
+			break;
+		default:
+			break;
+		}
+	} else if (req.op) {
+		fprintf(stderr, "Error: The server failed the request (%d), see its log for details.\n", ret);
+	}
+	if (reply_fd >= 0)
+		close(reply_fd);
+	close(sock);
+	return ret;
+}
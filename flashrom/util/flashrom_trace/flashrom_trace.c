@@ -0,0 +1,255 @@
+/*
+ * This file is part of the flashrom project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Prints and compares bus traces recorded with `flashrom --trace`, e.g. to
+ * check that a change to flashrom doesn't send more commands or poll more
+ * than before for the same operation.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+#define DEFAULT_TOLERANCE	5.0	/* percent */
+#define DUMP_BYTES		16
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s dump <trace>\n"
+		"       %s summary <trace>\n"
+		"       %s diff [--tolerance=<percent>] <old trace> <new trace>\n\n"
+		"diff exits with 1 if the new trace sends more commands or bytes, polls or\n"
+		"delays more, or takes longer than the old one by more than the tolerance,\n"
+		"%.0f%% by default.\n", name, name, name, DEFAULT_TOLERANCE);
+}
+
+static struct trace_file *open_trace(const char *path)
+{
+	struct trace_file *const trace = trace_open(path);
+	if (!trace)
+		fprintf(stderr, "Error: Cannot open trace %s: %s\n", path, strerror(errno));
+	return trace;
+}
+
+static int finish(struct trace_file *trace, const char *path, int ret)
+{
+	trace_close(trace);
+	if (ret < 0) {
+		fprintf(stderr, "Error: Trace %s is corrupt.\n", path);
+		return 1;
+	}
+	return 0;
+}
+
+static void print_bytes(const char *prefix, const uint8_t *bytes, uint32_t len)
+{
+	printf("%s", prefix);
+	for (uint32_t i = 0; i < len && i < DUMP_BYTES; i++)
+		printf(" %02x", bytes[i]);
+	if (len > DUMP_BYTES)
+		printf(" ... (%" PRIu32 " bytes)", len);
+}
+
+static const char *range_name(enum trace_type type)
+{
+	switch (type) {
+	case TRACE_SPI_READ:		return "read";
+	case TRACE_SPI_WRITE:		return "write";
+	case TRACE_OPAQUE_READ:		return "opaque read";
+	case TRACE_OPAQUE_WRITE:	return "opaque write";
+	case TRACE_OPAQUE_ERASE:	return "opaque erase";
+	default:			return "?";
+	}
+}
+
+static int dump(const char *path)
+{
+	struct trace_file *const trace = open_trace(path);
+	if (!trace)
+		return 1;
+
+	struct trace_record rec;
+	int ret;
+	while (!(ret = trace_next(trace, &rec))) {
+		printf("%12.3f ms %10.3f us  ", rec.start_ns / 1e6, rec.duration_ns / 1e3);
+		switch (rec.type) {
+		case TRACE_MASTER:
+			printf("master buses 0x%" PRIx32 " features 0x%" PRIx32 " max read %" PRIu32
+			       " max write %" PRIu32, rec.buses, rec.features, rec.max_data_read, rec.max_data_write);
+			break;
+		case TRACE_SPI:
+			printf("%s", rec.flags & TRACE_SPI_BATCHED ? "spi+" : "spi ");
+			if (rec.io_mode || rec.dummy_cycles)
+				printf(" mode %u dummy %u", rec.io_mode, rec.dummy_cycles);
+			print_bytes("", rec.writearr, rec.writecnt);
+			if (rec.readcnt)
+				print_bytes(" ->", rec.readarr, rec.readcnt);
+			if (rec.ret)
+				printf(" ret %d", rec.ret);
+			break;
+		case TRACE_DELAY:
+			printf("delay %" PRIu32 " us", rec.usecs);
+			break;
+		default:
+			printf("%s 0x%06" PRIx32 " +0x%" PRIx32, range_name(rec.type), rec.addr, rec.len);
+			if (rec.ret)
+				printf(" ret %d", rec.ret);
+			break;
+		}
+		printf("\n");
+	}
+	return finish(trace, path, ret);
+}
+
+static int summarize(const char *path, struct trace_summary *sum)
+{
+	struct trace_file *const trace = open_trace(path);
+	if (!trace)
+		return 1;
+	return finish(trace, path, trace_summarize(trace, sum));
+}
+
+struct metric {
+	const char *name;
+	size_t offset;
+};
+
+#define METRIC(field) { #field, offsetof(struct trace_summary, field) }
+
+static const struct metric metrics[] = {
+	METRIC(commands),
+	METRIC(bytes_out),
+	METRIC(bytes_in),
+	METRIC(rdsr_polls),
+	METRIC(bulk_bytes),
+	METRIC(opaque_ops),
+	METRIC(delays),
+	METRIC(delay_us),
+	METRIC(errors),
+	METRIC(modelled_ns),
+	METRIC(end_ns),
+};
+
+static uint64_t metric_value(const struct trace_summary *sum, const struct metric *metric)
+{
+	return *(const uint64_t *)((const char *)sum + metric->offset);
+}
+
+static void print_summary(const struct trace_summary *sum)
+{
+	printf("records %" PRIu64 "\n", sum->records);
+	for (size_t i = 0; i < sizeof(metrics) / sizeof(metrics[0]); i++)
+		printf("%s %" PRIu64 "\n", metrics[i].name, metric_value(sum, &metrics[i]));
+
+	printf("\nopcode  count       bytes       time [us]\n");
+	for (int i = 0; i < 256; i++) {
+		const struct trace_opcode_summary *const op = &sum->opcode[i];
+		if (op->count)
+			printf("0x%02x    %-11" PRIu64 " %-11" PRIu64 " %.1f\n", i, op->count, op->bytes, op->time_ns / 1e3);
+	}
+}
+
+/* Whether new exceeds old by more than tolerance percent. */
+static bool regressed(uint64_t old, uint64_t new, double tolerance)
+{
+	return new > old && (double)(new - old) > (double)old * tolerance / 100;
+}
+
+static void print_change(const char *name, uint64_t old, uint64_t new, bool regression)
+{
+	printf("%-16s %14" PRIu64 " %14" PRIu64, name, old, new);
+	if (old)
+		printf(" %+8.1f%%", ((double)new - (double)old) * 100 / (double)old);
+	else
+		printf(" %9s", new ? "new" : "");
+	printf("%s\n", regression ? "  REGRESSION" : "");
+}
+
+static int diff(const char *old_path, const char *new_path, double tolerance)
+{
+	struct trace_summary *const old = malloc(sizeof(*old));
+	struct trace_summary *const new = malloc(sizeof(*new));
+	int ret = 2;
+
+	if (!old || !new) {
+		fprintf(stderr, "Error: Out of memory!\n");
+		goto out;
+	}
+	if (summarize(old_path, old) || summarize(new_path, new))
+		goto out;
+
+	bool regression = false;
+	printf("%-16s %14s %14s %9s\n", "", "old", "new", "change");
+	for (size_t i = 0; i < sizeof(metrics) / sizeof(metrics[0]); i++) {
+		const uint64_t old_value = metric_value(old, &metrics[i]);
+		const uint64_t new_value = metric_value(new, &metrics[i]);
+		const bool worse = regressed(old_value, new_value, tolerance);
+		print_change(metrics[i].name, old_value, new_value, worse);
+		regression |= worse;
+	}
+
+	printf("\n");
+	for (int i = 0; i < 256; i++) {
+		const struct trace_opcode_summary *const old_op = &old->opcode[i];
+		const struct trace_opcode_summary *const new_op = &new->opcode[i];
+		if (old_op->count == new_op->count && old_op->bytes == new_op->bytes)
+			continue;
+		char name[32];
+		snprintf(name, sizeof(name), "opcode 0x%02x", i);
+		const bool worse = regressed(old_op->count, new_op->count, tolerance);
+		print_change(name, old_op->count, new_op->count, worse);
+		regression |= worse;
+	}
+
+	ret = regression ? 1 : 0;
+out:
+	free(old);
+	free(new);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc == 3 && !strcmp(argv[1], "dump"))
+		return dump(argv[2]) ? 2 : 0;
+
+	if (argc == 3 && !strcmp(argv[1], "summary")) {
+		struct trace_summary *const sum = malloc(sizeof(*sum));
+		if (!sum) {
+			fprintf(stderr, "Error: Out of memory!\n");
+			return 2;
+		}
+		const int ret = summarize(argv[2], sum);
+		if (!ret)
+			print_summary(sum);
+		free(sum);
+		return ret ? 2 : 0;
+	}
+
+	if (argc >= 4 && !strcmp(argv[1], "diff")) {
+		double tolerance = DEFAULT_TOLERANCE;
+		int arg = 2;
+		if (!strncmp(argv[arg], "--tolerance=", strlen("--tolerance="))) {
+			char *end;
+			tolerance = strtod(argv[arg] + strlen("--tolerance="), &end);
+			if (*end != '\0' || tolerance < 0) {
+				fprintf(stderr, "Error: Invalid tolerance \"%s\".\n", argv[arg]);
+				return 2;
+			}
+			arg++;
+		}
+		if (argc == arg + 2)
+			return diff(argv[arg], argv[arg + 1], tolerance);
+	}
+
+	usage(argv[0]);
+	return 2;
+}